@@ -1,6 +1,5 @@
 /* automatically generated by rust-bindgen 0.69.4 */
 
-pub type MachnetRingSlot_t = u32;
 #[repr(C)]
 #[derive(Debug, Copy, Clone)]
 pub struct MachnetFlow {
@@ -65,6 +64,283 @@ fn bindgen_test_layout_MachnetFlow() {
     );
 }
 pub type MachnetFlow_t = MachnetFlow;
+#[doc = " Configuration of a buffer size class, used when creating a channel."]
+#[repr(C)]
+#[derive(Debug, Copy, Clone)]
+pub struct MachnetChannelBufClassConf {
+    pub buf_ring_slot_nr: usize,
+    pub buffer_size: usize,
+}
+#[test]
+fn bindgen_test_layout_MachnetChannelBufClassConf() {
+    const UNINIT: ::std::mem::MaybeUninit<MachnetChannelBufClassConf> =
+        ::std::mem::MaybeUninit::uninit();
+    let ptr = UNINIT.as_ptr();
+    assert_eq!(
+        ::std::mem::size_of::<MachnetChannelBufClassConf>(),
+        16usize,
+        concat!("Size of: ", stringify!(MachnetChannelBufClassConf))
+    );
+    assert_eq!(
+        ::std::mem::align_of::<MachnetChannelBufClassConf>(),
+        8usize,
+        concat!("Alignment of ", stringify!(MachnetChannelBufClassConf))
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).buf_ring_slot_nr) as usize - ptr as usize },
+        0usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(MachnetChannelBufClassConf),
+            "::",
+            stringify!(buf_ring_slot_nr)
+        )
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).buffer_size) as usize - ptr as usize },
+        8usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(MachnetChannelBufClassConf),
+            "::",
+            stringify!(buffer_size)
+        )
+    );
+}
+#[doc = " Configuration of a buffer size class, used when creating a channel."]
+pub type MachnetChannelBufClassConf_t = MachnetChannelBufClassConf;
+#[doc = " Sizing options of a channel, requested by the application when attaching\n (see `machnet_attach_ex()'). A zero field selects Machnet's default. Machnet\n validates the options against its per-host limits, and refuses the channel\n if they are exceeded."]
+#[repr(C)]
+#[derive(Debug, Copy, Clone)]
+pub struct MachnetChannelOpts {
+    pub machnet_ring_slot_nr: u32,
+    pub app_ring_slot_nr: u32,
+    pub buf_ring_slot_nr: u32,
+    pub flags: u32,
+    pub buf_class_nr: u32,
+    pub buf_classes: [MachnetChannelBufClassConf_t; 4usize],
+    pub numa_node: u32,
+}
+#[test]
+fn bindgen_test_layout_MachnetChannelOpts() {
+    const UNINIT: ::std::mem::MaybeUninit<MachnetChannelOpts> = ::std::mem::MaybeUninit::uninit();
+    let ptr = UNINIT.as_ptr();
+    assert_eq!(
+        ::std::mem::size_of::<MachnetChannelOpts>(),
+        96usize,
+        concat!("Size of: ", stringify!(MachnetChannelOpts))
+    );
+    assert_eq!(
+        ::std::mem::align_of::<MachnetChannelOpts>(),
+        8usize,
+        concat!("Alignment of ", stringify!(MachnetChannelOpts))
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).machnet_ring_slot_nr) as usize - ptr as usize },
+        0usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(MachnetChannelOpts),
+            "::",
+            stringify!(machnet_ring_slot_nr)
+        )
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).app_ring_slot_nr) as usize - ptr as usize },
+        4usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(MachnetChannelOpts),
+            "::",
+            stringify!(app_ring_slot_nr)
+        )
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).buf_ring_slot_nr) as usize - ptr as usize },
+        8usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(MachnetChannelOpts),
+            "::",
+            stringify!(buf_ring_slot_nr)
+        )
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).flags) as usize - ptr as usize },
+        12usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(MachnetChannelOpts),
+            "::",
+            stringify!(flags)
+        )
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).buf_class_nr) as usize - ptr as usize },
+        16usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(MachnetChannelOpts),
+            "::",
+            stringify!(buf_class_nr)
+        )
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).buf_classes) as usize - ptr as usize },
+        24usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(MachnetChannelOpts),
+            "::",
+            stringify!(buf_classes)
+        )
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).numa_node) as usize - ptr as usize },
+        88usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(MachnetChannelOpts),
+            "::",
+            stringify!(numa_node)
+        )
+    );
+}
+#[doc = " Sizing options of a channel, requested by the application when attaching\n (see `machnet_attach_ex()'). A zero field selects Machnet's default. Machnet\n validates the options against its per-host limits, and refuses the channel\n if they are exceeded."]
+pub type MachnetChannelOpts_t = MachnetChannelOpts;
+#[doc = " A buffer size class of a channel: a free ring and the pool of buffers it\n manages.\n\n Classes created with the channel are always `ACTIVE'. The lifecycle of a\n class backed by an extension segment is driven by Machnet, and the\n application acknowledges every state change: Machnet bumps `state_gen' along\n with `state', and the application copies it to `app_state_gen' once it has\n done what the state asks for.\n   FREE -> MAPPING:      Machnet created the segment; the application must\n                         map it.\n   MAPPING -> ACTIVE:    Both sides have the segment mapped.\n   ACTIVE -> DRAINING:   The segment is idle; the application must stop\n                         allocating from it, and give back the buffers of it\n                         that it caches.\n   DRAINING -> ACTIVE:   The segment is needed again.\n   DRAINING -> UNMAPPING: Neither side allocates from the segment, and all of\n                         its buffers are back; the application must unmap it.\n   UNMAPPING -> FREE:    Machnet destroyed the segment."]
+#[repr(C)]
+#[derive(Debug, Copy, Clone)]
+pub struct MachnetChannelBufClass {
+    pub buf_ring_ofs: usize,
+    pub buf_pool_ofs: usize,
+    pub segment_size: usize,
+    pub buf_nr: u32,
+    pub buf_size: u32,
+    pub buf_mss: u32,
+    pub parent: u32,
+    pub state: u32,
+    pub state_gen: u32,
+    pub app_state_gen: u32,
+}
+#[test]
+fn bindgen_test_layout_MachnetChannelBufClass() {
+    const UNINIT: ::std::mem::MaybeUninit<MachnetChannelBufClass> =
+        ::std::mem::MaybeUninit::uninit();
+    let ptr = UNINIT.as_ptr();
+    assert_eq!(
+        ::std::mem::size_of::<MachnetChannelBufClass>(),
+        56usize,
+        concat!("Size of: ", stringify!(MachnetChannelBufClass))
+    );
+    assert_eq!(
+        ::std::mem::align_of::<MachnetChannelBufClass>(),
+        8usize,
+        concat!("Alignment of ", stringify!(MachnetChannelBufClass))
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).buf_ring_ofs) as usize - ptr as usize },
+        0usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(MachnetChannelBufClass),
+            "::",
+            stringify!(buf_ring_ofs)
+        )
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).buf_pool_ofs) as usize - ptr as usize },
+        8usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(MachnetChannelBufClass),
+            "::",
+            stringify!(buf_pool_ofs)
+        )
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).segment_size) as usize - ptr as usize },
+        16usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(MachnetChannelBufClass),
+            "::",
+            stringify!(segment_size)
+        )
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).buf_nr) as usize - ptr as usize },
+        24usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(MachnetChannelBufClass),
+            "::",
+            stringify!(buf_nr)
+        )
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).buf_size) as usize - ptr as usize },
+        28usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(MachnetChannelBufClass),
+            "::",
+            stringify!(buf_size)
+        )
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).buf_mss) as usize - ptr as usize },
+        32usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(MachnetChannelBufClass),
+            "::",
+            stringify!(buf_mss)
+        )
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).parent) as usize - ptr as usize },
+        36usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(MachnetChannelBufClass),
+            "::",
+            stringify!(parent)
+        )
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).state) as usize - ptr as usize },
+        40usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(MachnetChannelBufClass),
+            "::",
+            stringify!(state)
+        )
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).state_gen) as usize - ptr as usize },
+        44usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(MachnetChannelBufClass),
+            "::",
+            stringify!(state_gen)
+        )
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).app_state_gen) as usize - ptr as usize },
+        48usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(MachnetChannelBufClass),
+            "::",
+            stringify!(app_state_gen)
+        )
+    );
+}
+#[doc = " A buffer size class of a channel: a free ring and the pool of buffers it\n manages.\n\n Classes created with the channel are always `ACTIVE'. The lifecycle of a\n class backed by an extension segment is driven by Machnet, and the\n application acknowledges every state change: Machnet bumps `state_gen' along\n with `state', and the application copies it to `app_state_gen' once it has\n done what the state asks for.\n   FREE -> MAPPING:      Machnet created the segment; the application must\n                         map it.\n   MAPPING -> ACTIVE:    Both sides have the segment mapped.\n   ACTIVE -> DRAINING:   The segment is idle; the application must stop\n                         allocating from it, and give back the buffers of it\n                         that it caches.\n   DRAINING -> ACTIVE:   The segment is needed again.\n   DRAINING -> UNMAPPING: Neither side allocates from the segment, and all of\n                         its buffers are back; the application must unmap it.\n   UNMAPPING -> FREE:    Machnet destroyed the segment."]
+pub type MachnetChannelBufClass_t = MachnetChannelBufClass;
 #[repr(C)]
 #[repr(align(64))]
 #[derive(Debug, Copy, Clone)]
@@ -74,12 +350,12 @@ pub struct MachnetChannelDataCtx {
     pub ctrl_cq_ring_ofs: usize,
     pub machnet_ring_ofs: usize,
     pub app_ring_ofs: usize,
-    pub buf_ring_ofs: usize,
-    pub buffer_index_table_ofs: usize,
+    pub completion_ring_ofs: usize,
     pub buf_pool_ofs: usize,
-    pub buf_pool_mask: usize,
-    pub buf_size: u32,
-    pub buf_mss: u32,
+    pub buf_pool_size: usize,
+    pub buf_class_nr: u32,
+    pub buf_class_order: [u8; 16usize],
+    pub buf_classes: [MachnetChannelBufClass_t; 16usize],
 }
 #[test]
 fn bindgen_test_layout_MachnetChannelDataCtx() {
@@ -88,7 +364,7 @@ fn bindgen_test_layout_MachnetChannelDataCtx() {
     let ptr = UNINIT.as_ptr();
     assert_eq!(
         ::std::mem::size_of::<MachnetChannelDataCtx>(),
-        128usize,
+        1024usize,
         concat!("Size of: ", stringify!(MachnetChannelDataCtx))
     );
     assert_eq!(
@@ -147,63 +423,63 @@ fn bindgen_test_layout_MachnetChannelDataCtx() {
         )
     );
     assert_eq!(
-        unsafe { ::std::ptr::addr_of!((*ptr).buf_ring_ofs) as usize - ptr as usize },
+        unsafe { ::std::ptr::addr_of!((*ptr).completion_ring_ofs) as usize - ptr as usize },
         40usize,
         concat!(
             "Offset of field: ",
             stringify!(MachnetChannelDataCtx),
             "::",
-            stringify!(buf_ring_ofs)
+            stringify!(completion_ring_ofs)
         )
     );
     assert_eq!(
-        unsafe { ::std::ptr::addr_of!((*ptr).buffer_index_table_ofs) as usize - ptr as usize },
+        unsafe { ::std::ptr::addr_of!((*ptr).buf_pool_ofs) as usize - ptr as usize },
         48usize,
         concat!(
             "Offset of field: ",
             stringify!(MachnetChannelDataCtx),
             "::",
-            stringify!(buffer_index_table_ofs)
+            stringify!(buf_pool_ofs)
         )
     );
     assert_eq!(
-        unsafe { ::std::ptr::addr_of!((*ptr).buf_pool_ofs) as usize - ptr as usize },
+        unsafe { ::std::ptr::addr_of!((*ptr).buf_pool_size) as usize - ptr as usize },
         56usize,
         concat!(
             "Offset of field: ",
             stringify!(MachnetChannelDataCtx),
             "::",
-            stringify!(buf_pool_ofs)
+            stringify!(buf_pool_size)
         )
     );
     assert_eq!(
-        unsafe { ::std::ptr::addr_of!((*ptr).buf_pool_mask) as usize - ptr as usize },
+        unsafe { ::std::ptr::addr_of!((*ptr).buf_class_nr) as usize - ptr as usize },
         64usize,
         concat!(
             "Offset of field: ",
             stringify!(MachnetChannelDataCtx),
             "::",
-            stringify!(buf_pool_mask)
+            stringify!(buf_class_nr)
         )
     );
     assert_eq!(
-        unsafe { ::std::ptr::addr_of!((*ptr).buf_size) as usize - ptr as usize },
-        72usize,
+        unsafe { ::std::ptr::addr_of!((*ptr).buf_class_order) as usize - ptr as usize },
+        68usize,
         concat!(
             "Offset of field: ",
             stringify!(MachnetChannelDataCtx),
             "::",
-            stringify!(buf_size)
+            stringify!(buf_class_order)
         )
     );
     assert_eq!(
-        unsafe { ::std::ptr::addr_of!((*ptr).buf_mss) as usize - ptr as usize },
-        76usize,
+        unsafe { ::std::ptr::addr_of!((*ptr).buf_classes) as usize - ptr as usize },
+        88usize,
         concat!(
             "Offset of field: ",
             stringify!(MachnetChannelDataCtx),
             "::",
-            stringify!(buf_mss)
+            stringify!(buf_classes)
         )
     );
 }
@@ -213,6 +489,8 @@ pub type MachnetChannelDataCtx_t = MachnetChannelDataCtx;
 #[derive(Debug, Copy, Clone)]
 pub struct MachnetChannelCtrlCtx {
     pub req_id: usize,
+    pub segment_gen: u32,
+    pub app_segment_gen: u32,
 }
 #[test]
 fn bindgen_test_layout_MachnetChannelCtrlCtx() {
@@ -239,51 +517,28 @@ fn bindgen_test_layout_MachnetChannelCtrlCtx() {
             stringify!(req_id)
         )
     );
-}
-pub type MachnetChannelCtrlCtx_t = MachnetChannelCtrlCtx;
-#[repr(C)]
-#[derive(Debug, Copy, Clone)]
-pub struct MachnetChannelAppBufferCache {
-    pub count: u32,
-    pub indices: [MachnetRingSlot_t; 64usize],
-}
-#[test]
-fn bindgen_test_layout_MachnetChannelAppBufferCache() {
-    const UNINIT: ::std::mem::MaybeUninit<MachnetChannelAppBufferCache> =
-        ::std::mem::MaybeUninit::uninit();
-    let ptr = UNINIT.as_ptr();
-    assert_eq!(
-        ::std::mem::size_of::<MachnetChannelAppBufferCache>(),
-        260usize,
-        concat!("Size of: ", stringify!(MachnetChannelAppBufferCache))
-    );
-    assert_eq!(
-        ::std::mem::align_of::<MachnetChannelAppBufferCache>(),
-        4usize,
-        concat!("Alignment of ", stringify!(MachnetChannelAppBufferCache))
-    );
     assert_eq!(
-        unsafe { ::std::ptr::addr_of!((*ptr).count) as usize - ptr as usize },
-        0usize,
+        unsafe { ::std::ptr::addr_of!((*ptr).segment_gen) as usize - ptr as usize },
+        8usize,
         concat!(
             "Offset of field: ",
-            stringify!(MachnetChannelAppBufferCache),
+            stringify!(MachnetChannelCtrlCtx),
             "::",
-            stringify!(count)
+            stringify!(segment_gen)
         )
     );
     assert_eq!(
-        unsafe { ::std::ptr::addr_of!((*ptr).indices) as usize - ptr as usize },
-        4usize,
+        unsafe { ::std::ptr::addr_of!((*ptr).app_segment_gen) as usize - ptr as usize },
+        12usize,
         concat!(
             "Offset of field: ",
-            stringify!(MachnetChannelAppBufferCache),
+            stringify!(MachnetChannelCtrlCtx),
             "::",
-            stringify!(indices)
+            stringify!(app_segment_gen)
         )
     );
 }
-pub type MachnetChannelAppBufferCache_t = MachnetChannelAppBufferCache;
+pub type MachnetChannelCtrlCtx_t = MachnetChannelCtrlCtx;
 #[doc = " The `MachnetChannelCtx' holds all the metadata information (context) of an\n Machnet Channel.\n\n It is always located at the beginning of the shared memory area."]
 #[repr(C)]
 #[repr(align(64))]
@@ -296,7 +551,6 @@ pub struct MachnetChannelCtx {
     pub __bindgen_padding_0: [u64; 6usize],
     pub ctrl_ctx: MachnetChannelCtrlCtx_t,
     pub data_ctx: MachnetChannelDataCtx_t,
-    pub app_buffer_cache: MachnetChannelAppBufferCache_t,
 }
 #[test]
 fn bindgen_test_layout_MachnetChannelCtx() {
@@ -304,7 +558,7 @@ fn bindgen_test_layout_MachnetChannelCtx() {
     let ptr = UNINIT.as_ptr();
     assert_eq!(
         ::std::mem::size_of::<MachnetChannelCtx>(),
-        832usize,
+        1408usize,
         concat!("Size of: ", stringify!(MachnetChannelCtx))
     );
     assert_eq!(
@@ -372,19 +626,64 @@ fn bindgen_test_layout_MachnetChannelCtx() {
             stringify!(data_ctx)
         )
     );
+}
+#[doc = " The `MachnetChannelCtx' holds all the metadata information (context) of an\n Machnet Channel.\n\n It is always located at the beginning of the shared memory area."]
+pub type MachnetChannelCtx_t = MachnetChannelCtx;
+#[doc = " TX completion entry: Posted by Machnet to the completion ring of a channel\n once the remote peer has acknowledged the last packet of a message flagged\n with `MACHNET_MSGBUF_NOTIFY_DELIVERY'."]
+#[repr(C)]
+#[derive(Debug, Copy, Clone)]
+pub struct MachnetTxCompletion {
+    pub cookie: u64,
+    pub flow: MachnetFlow_t,
+    pub status: u32,
+}
+#[test]
+fn bindgen_test_layout_MachnetTxCompletion() {
+    const UNINIT: ::std::mem::MaybeUninit<MachnetTxCompletion> = ::std::mem::MaybeUninit::uninit();
+    let ptr = UNINIT.as_ptr();
+    assert_eq!(
+        ::std::mem::size_of::<MachnetTxCompletion>(),
+        24usize,
+        concat!("Size of: ", stringify!(MachnetTxCompletion))
+    );
     assert_eq!(
-        unsafe { ::std::ptr::addr_of!((*ptr).app_buffer_cache) as usize - ptr as usize },
-        512usize,
+        ::std::mem::align_of::<MachnetTxCompletion>(),
+        8usize,
+        concat!("Alignment of ", stringify!(MachnetTxCompletion))
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).cookie) as usize - ptr as usize },
+        0usize,
         concat!(
             "Offset of field: ",
-            stringify!(MachnetChannelCtx),
+            stringify!(MachnetTxCompletion),
+            "::",
+            stringify!(cookie)
+        )
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).flow) as usize - ptr as usize },
+        8usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(MachnetTxCompletion),
+            "::",
+            stringify!(flow)
+        )
+    );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).status) as usize - ptr as usize },
+        20usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(MachnetTxCompletion),
             "::",
-            stringify!(app_buffer_cache)
+            stringify!(status)
         )
     );
 }
-#[doc = " The `MachnetChannelCtx' holds all the metadata information (context) of an\n Machnet Channel.\n\n It is always located at the beginning of the shared memory area."]
-pub type MachnetChannelCtx_t = MachnetChannelCtx;
+#[doc = " TX completion entry: Posted by Machnet to the completion ring of a channel\n once the remote peer has acknowledged the last packet of a message flagged\n with `MACHNET_MSGBUF_NOTIFY_DELIVERY'."]
+pub type MachnetTxCompletion_t = MachnetTxCompletion;
 #[doc = " @brief Descriptor for SG data that constitute a message.\n\n This structure resembles `struct iovec` (check writev(2))."]
 #[repr(C)]
 #[derive(Debug, Copy, Clone)]
@@ -431,7 +730,7 @@ fn bindgen_test_layout_MachnetIovec() {
 }
 #[doc = " @brief Descriptor for SG data that constitute a message.\n\n This structure resembles `struct iovec` (check writev(2))."]
 pub type MachnetIovec_t = MachnetIovec;
-#[doc = " @brief Descriptor for a message.\n\n This structure resembles `struct msghdr`, but with a few adjustments:\n - `msg_size` is the total size of the message payload.\n - `peer_addr` is the address of the network peer that is the recipient or\n    sender of the message (depending on the direction).\n - `msg_iov` is a vector of `msg_iovlen` `MachnetIovec_t` structures.\n - `msg_iovlen` is the number of `MachnetIovec_t` structures in `msg_iov`.\n - `flags` is the message flags."]
+#[doc = " @brief Descriptor for a message.\n\n This structure resembles `struct msghdr`, but with a few adjustments:\n - `msg_size` is the total size of the message payload.\n - `peer_addr` is the address of the network peer that is the recipient or\n    sender of the message (depending on the direction).\n - `msg_iov` is a vector of `msg_iovlen` `MachnetIovec_t` structures.\n - `msg_iovlen` is the number of `MachnetIovec_t` structures in `msg_iov`.\n - `flags` is the message flags.\n - `cookie` is an opaque value that is returned in the TX completion of the\n    message, if `MACHNET_MSGBUF_NOTIFY_DELIVERY` is set in `flags` (TX only)."]
 #[repr(C)]
 #[derive(Debug, Copy, Clone)]
 pub struct MachnetMsgHdr {
@@ -440,6 +739,7 @@ pub struct MachnetMsgHdr {
     pub msg_iov: *mut MachnetIovec_t,
     pub msg_iovlen: usize,
     pub flags: u16,
+    pub cookie: u64,
 }
 #[test]
 fn bindgen_test_layout_MachnetMsgHdr() {
@@ -447,7 +747,7 @@ fn bindgen_test_layout_MachnetMsgHdr() {
     let ptr = UNINIT.as_ptr();
     assert_eq!(
         ::std::mem::size_of::<MachnetMsgHdr>(),
-        40usize,
+        48usize,
         concat!("Size of: ", stringify!(MachnetMsgHdr))
     );
     assert_eq!(
@@ -505,9 +805,21 @@ fn bindgen_test_layout_MachnetMsgHdr() {
             stringify!(flags)
         )
     );
+    assert_eq!(
+        unsafe { ::std::ptr::addr_of!((*ptr).cookie) as usize - ptr as usize },
+        40usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(MachnetMsgHdr),
+            "::",
+            stringify!(cookie)
+        )
+    );
 }
-#[doc = " @brief Descriptor for a message.\n\n This structure resembles `struct msghdr`, but with a few adjustments:\n - `msg_size` is the total size of the message payload.\n - `peer_addr` is the address of the network peer that is the recipient or\n    sender of the message (depending on the direction).\n - `msg_iov` is a vector of `msg_iovlen` `MachnetIovec_t` structures.\n - `msg_iovlen` is the number of `MachnetIovec_t` structures in `msg_iov`.\n - `flags` is the message flags."]
+#[doc = " @brief Descriptor for a message.\n\n This structure resembles `struct msghdr`, but with a few adjustments:\n - `msg_size` is the total size of the message payload.\n - `peer_addr` is the address of the network peer that is the recipient or\n    sender of the message (depending on the direction).\n - `msg_iov` is a vector of `msg_iovlen` `MachnetIovec_t` structures.\n - `msg_iovlen` is the number of `MachnetIovec_t` structures in `msg_iov`.\n - `flags` is the message flags.\n - `cookie` is an opaque value that is returned in the TX completion of the\n    message, if `MACHNET_MSGBUF_NOTIFY_DELIVERY` is set in `flags` (TX only)."]
 pub type MachnetMsgHdr_t = MachnetMsgHdr;
+#[doc = " @brief Handle to a message received in zero-copy mode (see\n `machnet_recvmsg_zc()`).\n\n The buffers backing the message are lent to the application until the handle\n is returned to Machnet with `machnet_release()`."]
+pub type MachnetMsgHandle_t = u32;
 extern "C" {
     #[doc = " @brief Initializes the Machnet library for the application, which is used\n to interact with the Machnet service on the machine.\n\n @return 0 on success, -1 on failure."]
     pub fn machnet_init() -> ::std::os::raw::c_int;
@@ -523,6 +835,14 @@ extern "C" {
     #[doc = " @brief Creates a new channel to the Machnet controller and binds to it. A\n channel is a logical entity between an application and the Machnet service.\n\n @return A pointer to the channel context on success, NULL otherwise."]
     pub fn machnet_attach() -> *mut ::std::os::raw::c_void;
 }
+extern "C" {
+    #[doc = " @brief Like `machnet_attach()', but with the channel sized as requested by\n the application: the depth of the messaging rings, the number of buffers and\n the buffer size classes (see `MachnetChannelOpts_t'). Bigger channels allow\n more messages in flight, at the cost of memory. Machnet refuses a channel\n that exceeds its per-host limits.\n\n @param opts The sizing options of the channel; zero fields (or `NULL')\n select the defaults.\n @return A pointer to the channel context on success, NULL otherwise."]
+    pub fn machnet_attach_ex(opts: *const MachnetChannelOpts_t) -> *mut ::std::os::raw::c_void;
+}
+extern "C" {
+    #[doc = " @brief Detaches from a channel. The buffers cached by the application's\n threads for this channel are returned to the channel's pool. This must be\n called when no other thread is using the channel, and before the channel is\n unmapped.\n\n @param channel_ctx The channel context."]
+    pub fn machnet_detach(channel_ctx: *const ::std::os::raw::c_void);
+}
 extern "C" {
     #[doc = " @brief Listens for incoming messages on a specific IP and port.\n @param[in] channel The channel associated to the listener.\n @param[in] ip The local IP address to listen on.\n @param[in] port The local port to listen on.\n @return 0 on success, -1 on failure."]
     pub fn machnet_listen(
@@ -551,7 +871,7 @@ extern "C" {
     ) -> ::std::os::raw::c_int;
 }
 extern "C" {
-    #[doc = " This function enqueues one message for transmission to a remote peer over\n the network. The application needs to provide the destination's (remote\n peer) address. Machnet is responsible for end-to-end encrypted, reliable\n delivery of each message to the relevant receiver. This function supports\n SG collection of a message's buffers from the application's address\n space.\n\n @param[in] channel_ctx        The Machnet channel context\n @param[in] msghdr             An `MachnetMsgHdr' descriptor\n @return                   0 on success, -1 on failure"]
+    #[doc = " This function enqueues one message for transmission to a remote peer over\n the network. The application needs to provide the destination's (remote\n peer) address. Machnet is responsible for end-to-end encrypted, reliable\n delivery of each message to the relevant receiver. This function supports\n SG collection of a message's buffers from the application's address\n space.\n\n If `MACHNET_MSGBUF_NOTIFY_DELIVERY` is set in the msghdr flags, Machnet posts\n a TX completion carrying the msghdr `cookie` once the remote peer has\n acknowledged the whole message (see `machnet_poll_completions()`).\n\n @param[in] channel_ctx        The Machnet channel context\n @param[in] msghdr             An `MachnetMsgHdr' descriptor\n @return                   0 on success, -1 on failure"]
     pub fn machnet_sendmsg(
         channel_ctx: *const ::std::os::raw::c_void,
         msghdr: *const MachnetMsgHdr_t,
@@ -581,3 +901,49 @@ extern "C" {
         msghdr: *mut MachnetMsgHdr_t,
     ) -> ::std::os::raw::c_int;
 }
+extern "C" {
+    #[doc = " This function returns the size of the next pending message (destined to the\n application) without consuming it from the Machnet Channel.\n\n @param[in] channel_ctx        The Machnet channel context\n @param[out] flow              If not `NULL', it is filled with the flow\n                               information of the pending message.\n @return                       0 if no pending message, otherwise the size of\n                               the pending message in bytes."]
+    pub fn machnet_peek(
+        channel_ctx: *const ::std::os::raw::c_void,
+        flow: *mut MachnetFlow_t,
+    ) -> isize;
+}
+extern "C" {
+    #[doc = " This function receives a pending message (destined to the application) from\n the Machnet Channel without copying its payload. Instead of copying, the\n `msg_iov` entries of the msghdr are set to point to the data of the channel\n buffers that hold the message, in order. The buffers remain owned by the\n application until `machnet_release()` is called with the returned handle;\n the data must not be accessed after that.\n\n @param[in] channel_ctx        The Machnet channel context\n @param[in, out] msghdr        An `MachnetMsgHdr' descriptor. The application\n                               provides an array of `msg_iovlen` entries in\n                               `msg_iov`. On success, `msg_iovlen` is set to\n                               the number of entries used, and `msg_size` and\n                               `flow_info` describe the message. If the array\n                               is too small, `msg_iovlen` is set to the number\n                               of entries required, and the message is left\n                               pending.\n @param[out] handle            The handle of the received message.\n @return                       0 if no pending message, 1 if a message is\n                               received, -1 on failure"]
+    pub fn machnet_recvmsg_zc(
+        channel_ctx: *const ::std::os::raw::c_void,
+        msghdr: *mut MachnetMsgHdr_t,
+        handle: *mut MachnetMsgHandle_t,
+    ) -> ::std::os::raw::c_int;
+}
+extern "C" {
+    #[doc = " This function returns the buffers of a message that was received with\n `machnet_recvmsg_zc()`, or allocated with `machnet_msg_alloc()` and not\n submitted, back to the Machnet Channel.\n\n @param[in] channel_ctx        The Machnet channel context\n @param[in] handle             The handle of the received message.\n @return                       0 on success, -1 on failure"]
+    pub fn machnet_release(
+        channel_ctx: *const ::std::os::raw::c_void,
+        handle: MachnetMsgHandle_t,
+    ) -> ::std::os::raw::c_int;
+}
+extern "C" {
+    #[doc = " This function allocates a message of `msg_size` bytes directly in the\n Machnet Channel, so that the application can build its payload in place\n (zero-copy send). The message is backed by a train of chained channel\n buffers; the `msg_iov` entries of the msghdr are set to the writable spans\n of these buffers, in order. Once the payload is written, the message is\n transmitted with `machnet_msg_submit()`, or discarded with\n `machnet_release()`.\n\n @param[in] channel_ctx        The Machnet channel context\n @param[in, out] msghdr        An `MachnetMsgHdr' descriptor. The application\n                               sets `msg_size`, `flags` and `cookie` (see\n                               `machnet_sendmsg()`), and provides an array of\n                               `msg_iovlen` entries in `msg_iov`. On success,\n                               `msg_iovlen` is set to the number of entries\n                               used. If the array is too small, `msg_iovlen`\n                               is set to the number of entries required.\n @param[out] handle            The handle of the allocated message.\n @return                       0 on success, -1 on failure"]
+    pub fn machnet_msg_alloc(
+        channel_ctx: *const ::std::os::raw::c_void,
+        msghdr: *mut MachnetMsgHdr_t,
+        handle: *mut MachnetMsgHandle_t,
+    ) -> ::std::os::raw::c_int;
+}
+extern "C" {
+    #[doc = " This function enqueues a message that was allocated with\n `machnet_msg_alloc()` for transmission to a remote peer over the network.\n On success, ownership of the message is transferred to Machnet.\n\n @param[in] channel_ctx        The Machnet channel context\n @param[in] flow               The pre-created flow to the remote peer\n @param[in] handle             The handle of the allocated message.\n @return                       0 on success, -1 on failure (the application\n                               still owns the message)"]
+    pub fn machnet_msg_submit(
+        channel_ctx: *const ::std::os::raw::c_void,
+        flow: MachnetFlow_t,
+        handle: MachnetMsgHandle_t,
+    ) -> ::std::os::raw::c_int;
+}
+extern "C" {
+    #[doc = " This function retrieves TX completions from the Machnet Channel. A completion\n is posted for every message that was sent with the\n `MACHNET_MSGBUF_NOTIFY_DELIVERY` flag, once the remote peer has acknowledged\n all of its packets.\n\n @param[in] channel_ctx        The Machnet channel context\n @param[out] completions       An array that can hold up to `n` completions.\n @param[in] n                  The size of the `completions` array.\n @return                       # of completions retrieved."]
+    pub fn machnet_poll_completions(
+        channel_ctx: *const ::std::os::raw::c_void,
+        completions: *mut MachnetTxCompletion_t,
+        n: ::std::os::raw::c_int,
+    ) -> ::std::os::raw::c_int;
+}
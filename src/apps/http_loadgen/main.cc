@@ -0,0 +1,616 @@
+/**
+ * @file main.cc
+ * @brief A constant-throughput HTTP/1.1 load generator over Machnet, with the
+ * semantics and the output of wrk2, so that its results compare with wrk2's
+ * over kernel TCP.
+ *
+ * Each connection (a Machnet flow, see `http_server') has one request in
+ * flight, and issues its requests on a fixed schedule, at its share of --rate.
+ * The latency of a request is measured from the time it was scheduled to be
+ * sent: a request that waits for the previous response to arrive accounts for
+ * the wait, which corrects for "coordinated omission". As in wrk2, each thread
+ * calibrates once, after which the recorded latencies restart, and the rate of
+ * responses is sampled at an interval derived from the calibration.
+ */
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <hdr/hdr_histogram.h>
+#include <machnet.h>
+
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <chrono>
+#include <cinttypes>
+#include <cmath>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+DEFINE_string(local_ip, "", "IP of the local Machnet interface");
+DEFINE_string(url, "",
+              "URL to request, as http://<ip>[:port]/path. The host must be "
+              "the IP of the server's Machnet interface.");
+DEFINE_uint32(threads, 2, "Threads, each with its own channel (wrk -t).");
+DEFINE_uint32(connections, 10,
+              "Connections, shared evenly among the threads (wrk -c).");
+DEFINE_string(duration, "10s", "Duration of the test, e.g., 30s, 2m (wrk -d).");
+DEFINE_double(rate, 0, "Total request rate, in requests/sec (wrk -R).");
+DEFINE_bool(latency, false, "Print the latency distribution (wrk -L).");
+DEFINE_bool(u_latency, false,
+            "Also print the uncorrected latency distribution (wrk -U).");
+DEFINE_uint32(remote_ports, 1,
+              "Connections are spread over this many ports from the URL's "
+              "(the server's --threads).");
+
+static volatile int g_keep_running = 1;
+
+void SigIntHandler([[maybe_unused]] int signal) { g_keep_running = 0; }
+
+// As in wrk2: latencies are recorded in microseconds, up to a day.
+static constexpr int64_t kMaxLatencyMicros = 24LL * 60 * 60 * 1000 * 1000;
+static constexpr int kLatencyPrecision = 3;
+// Each thread calibrates after this long, plus 5 ms per connection, or half
+// way through shorter tests.
+static constexpr uint64_t kCalibrateDelayNs = 10ULL * 1000 * 1000 * 1000;
+// Responses with a larger header are malformed.
+static constexpr size_t kMaxHeaderSize = 8192;
+
+uint64_t NowNs() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+hdr_histogram *NewLatencyHistogram() {
+  hdr_histogram *hist;
+  const int ret = hdr_init(1, kMaxLatencyMicros, kLatencyPrecision, &hist);
+  CHECK_EQ(ret, 0) << "Failed to initialize latency histogram.";
+  return hist;
+}
+
+/**
+ * @brief Incremental parser of a stream of responses. Only the headers are
+ * buffered; the bodies are skipped as they arrive.
+ */
+class ResponseParser {
+ public:
+  enum class Status { kIncomplete, kComplete, kError };
+
+  /**
+   * @brief Consumes the start of `data', up to the end of the current
+   * response.
+   *
+   * @param data     The next bytes of the stream.
+   * @param consumed Set to the number of bytes of `data' that were consumed.
+   * @return kComplete at the end of a response, whose status code is then
+   *         `status()'.
+   */
+  Status Consume(std::string_view data, size_t *consumed) {
+    *consumed = 0;
+    if (in_header_) {
+      // Only the bytes that may belong to the header are buffered.
+      const size_t old_size = header_.size();
+      header_.append(data.substr(0, kMaxHeaderSize + 4 - old_size));
+      const size_t header_end =
+          header_.find("\r\n\r\n", old_size < 3 ? 0 : old_size - 3);
+      if (header_end == std::string::npos) {
+        *consumed = header_.size() - old_size;
+        return header_.size() > kMaxHeaderSize ? Status::kError
+                                               : Status::kIncomplete;
+      }
+      *consumed = header_end + 4 - old_size;
+      if (!ParseHeader(std::string_view(header_).substr(0, header_end + 2))) {
+        return Status::kError;
+      }
+      header_.clear();
+      in_header_ = false;
+    }
+
+    const size_t body_bytes =
+        std::min<uint64_t>(body_remaining_, data.size() - *consumed);
+    *consumed += body_bytes;
+    body_remaining_ -= body_bytes;
+    if (body_remaining_ > 0) return Status::kIncomplete;
+    in_header_ = true;
+    return Status::kComplete;
+  }
+
+  int status() const { return status_; }
+
+ private:
+  // Parses the status line, and the length of the body.
+  bool ParseHeader(std::string_view header) {
+    // "HTTP/1.x NNN Reason"
+    if (!header.starts_with("HTTP/1.") || header.size() < 12) return false;
+    if (std::from_chars(header.data() + 9, header.data() + 12, status_).ec !=
+        std::errc()) {
+      return false;
+    }
+
+    body_remaining_ = 0;
+    static constexpr std::string_view kContentLength = "\r\ncontent-length:";
+    for (size_t pos = header.find("\r\n"); pos < header.size();
+         pos = header.find("\r\n", pos + 2)) {
+      const std::string_view field = header.substr(pos);
+      if (field.size() < kContentLength.size() ||
+          strncasecmp(field.data(), kContentLength.data(),
+                      kContentLength.size()) != 0) {
+        continue;
+      }
+      const char *value = field.data() + kContentLength.size();
+      const char *end = field.data() + field.size();
+      while (value < end && *value == ' ') value++;
+      if (std::from_chars(value, end, body_remaining_).ec != std::errc()) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  bool in_header_{true};
+  std::string header_;
+  uint64_t body_remaining_{0};
+  int status_{0};
+};
+
+/**
+ * @brief A connection, with its schedule: request `n' is due at `start_ns' +
+ * `n' times the gap between requests.
+ */
+struct Connection {
+  MachnetFlow_t flow;
+  uint64_t start_ns{0};
+  double gap_ns{0};
+  uint64_t sent{0};
+  bool in_flight{false};
+  uint64_t sent_ns{0};
+  ResponseParser parser;
+
+  uint64_t NextStart() const {
+    return start_ns + static_cast<uint64_t>(sent * gap_ns);
+  }
+};
+
+class ThreadCtx {
+ public:
+  ThreadCtx(void *channel_ctx, uint32_t id)
+      : channel_ctx(channel_ctx),
+        id(id),
+        latency_hist(NewLatencyHistogram()),
+        u_latency_hist(NewLatencyHistogram()),
+        rx_iov(8) {}
+  ~ThreadCtx() {
+    hdr_close(latency_hist);
+    hdr_close(u_latency_hist);
+  }
+
+  void *const channel_ctx;
+  const uint32_t id;
+  std::vector<Connection> connections;
+  // Connections by the local port of their flow.
+  std::unordered_map<uint16_t, Connection *> connections_by_port;
+  // Latency from the scheduled send time, and from the actual send time (us).
+  hdr_histogram *latency_hist;
+  hdr_histogram *u_latency_hist;
+  // Responses per second, sampled every `sample_interval_ms' once calibrated.
+  std::vector<uint64_t> rate_samples;
+  uint32_t sample_interval_ms{0};
+  uint64_t complete{0};
+  uint64_t bytes{0};
+  uint64_t status_errors{0};
+  uint64_t parse_errors{0};
+  std::vector<MachnetIovec_t> rx_iov;
+};
+
+// Send the next request of a connection; false if the channel is full.
+bool SendRequest(ThreadCtx *thread_ctx, Connection *conn,
+                 const std::string &request) {
+  if (machnet_send(thread_ctx->channel_ctx, conn->flow, request.data(),
+                   request.size()) != 0) {
+    return false;
+  }
+  conn->in_flight = true;
+  conn->sent_ns = NowNs();
+  return true;
+}
+
+// Record a response of a connection, which completes its request. A malformed
+// response completes it too, as an error, so that the schedule goes on.
+void CompleteRequest(ThreadCtx *thread_ctx, Connection *conn, uint64_t now,
+                     bool malformed) {
+  // The request was due at its scheduled time, even if it was sent later.
+  const uint64_t scheduled_ns = conn->NextStart();
+  hdr_record_value(thread_ctx->latency_hist,
+                   (now - std::min(now, scheduled_ns)) / 1000);
+  hdr_record_value(thread_ctx->u_latency_hist, (now - conn->sent_ns) / 1000);
+  const int status = conn->parser.status();
+  if (malformed) {
+    thread_ctx->parse_errors++;
+  } else if (status < 200 || status > 399) {
+    thread_ctx->status_errors++;
+  }
+  thread_ctx->complete++;
+  conn->sent++;
+  conn->in_flight = false;
+}
+
+// Receive the pending responses, and return how many were completed.
+uint64_t ReceiveResponses(ThreadCtx *thread_ctx) {
+  uint64_t nb_complete = 0;
+  while (true) {
+    MachnetMsgHdr_t msghdr = {};
+    msghdr.msg_iov = thread_ctx->rx_iov.data();
+    msghdr.msg_iovlen = thread_ctx->rx_iov.size();
+    MachnetMsgHandle_t handle;
+    const int ret =
+        machnet_recvmsg_zc(thread_ctx->channel_ctx, &msghdr, &handle);
+    if (ret == 0) break;
+    if (ret < 0) {
+      // Not enough segments for the message, which is still pending.
+      CHECK_GT(msghdr.msg_iovlen, thread_ctx->rx_iov.size())
+          << "machnet_recvmsg_zc() failed";
+      thread_ctx->rx_iov.resize(msghdr.msg_iovlen);
+      continue;
+    }
+    thread_ctx->bytes += msghdr.msg_size;
+
+    // A received flow's destination is the local end.
+    const auto it =
+        thread_ctx->connections_by_port.find(msghdr.flow_info.dst_port);
+    if (it == thread_ctx->connections_by_port.end()) {
+      machnet_release(thread_ctx->channel_ctx, handle);
+      continue;
+    }
+    Connection *conn = it->second;
+    const uint64_t now = NowNs();
+    bool malformed = false;
+    for (size_t i = 0; i < msghdr.msg_iovlen && !malformed; i++) {
+      std::string_view data(static_cast<const char *>(msghdr.msg_iov[i].base),
+                            msghdr.msg_iov[i].len);
+      while (!data.empty()) {
+        size_t consumed;
+        const auto status = conn->parser.Consume(data, &consumed);
+        data.remove_prefix(consumed);
+        if (status == ResponseParser::Status::kError) {
+          // Resynchronize on the next message.
+          conn->parser = ResponseParser();
+          malformed = true;
+          if (conn->in_flight) {
+            CompleteRequest(thread_ctx, conn, now, true);
+            nb_complete++;
+          } else {
+            thread_ctx->parse_errors++;
+          }
+          break;
+        }
+        if (status == ResponseParser::Status::kComplete && conn->in_flight) {
+          CompleteRequest(thread_ctx, conn, now, false);
+          nb_complete++;
+        }
+      }
+    }
+    machnet_release(thread_ctx->channel_ctx, handle);
+  }
+  return nb_complete;
+}
+
+void ThreadLoop(ThreadCtx *thread_ctx, std::string request, double rate,
+                uint64_t duration_ns) {
+  const uint64_t start = NowNs();
+  const uint64_t end = start + duration_ns;
+  // The connections' schedules are staggered over one gap.
+  auto &connections = thread_ctx->connections;
+  const double gap_ns = connections.size() * 1E9 / rate;
+  for (size_t i = 0; i < connections.size(); i++) {
+    connections[i].start_ns = start + gap_ns * i / connections.size();
+    connections[i].gap_ns = gap_ns;
+  }
+
+  const uint64_t calibrate_at =
+      start + std::min(kCalibrateDelayNs + connections.size() * 5000000,
+                       duration_ns / 2);
+  bool calibrated = false;
+  uint64_t next_sample = 0;
+  uint64_t last_sample = 0;
+  uint64_t sample_complete = 0;
+  uint64_t now = start;
+  while (g_keep_running && now < end) {
+    for (auto &conn : connections) {
+      if (!conn.in_flight && conn.NextStart() <= now) {
+        SendRequest(thread_ctx, &conn, request);
+      }
+    }
+    ReceiveResponses(thread_ctx);
+    now = NowNs();
+
+    if (!calibrated && now >= calibrate_at) {
+      // The sampling interval is twice the 90th percentile of the latency, and
+      // at least 10 ms.
+      const double mean_ms = hdr_mean(thread_ctx->latency_hist) / 1000.0;
+      const double p90_ms =
+          hdr_value_at_percentile(thread_ctx->latency_hist, 90.0) / 1000.0;
+      thread_ctx->sample_interval_ms = std::max(p90_ms * 2, 10.0);
+      printf("  Thread calibration: mean lat.: %.3fms, rate sampling "
+             "interval: %ums\n",
+             mean_ms, thread_ctx->sample_interval_ms);
+      hdr_reset(thread_ctx->latency_hist);
+      hdr_reset(thread_ctx->u_latency_hist);
+      calibrated = true;
+      last_sample = now;
+      next_sample = now + thread_ctx->sample_interval_ms * 1000000ULL;
+      sample_complete = thread_ctx->complete;
+    } else if (calibrated && now >= next_sample) {
+      const double elapsed_s = (now - last_sample) / 1E9;
+      thread_ctx->rate_samples.push_back(
+          (thread_ctx->complete - sample_complete) / elapsed_s);
+      last_sample = now;
+      next_sample = now + thread_ctx->sample_interval_ms * 1000000ULL;
+      sample_complete = thread_ctx->complete;
+    }
+  }
+}
+
+// Formatting of values with units, as in wrk.
+struct Units {
+  int scale;
+  const char *base;
+  std::vector<const char *> units;
+};
+
+std::string FormatUnits(long double n, const Units &units, int precision) {
+  const char *unit = units.base;
+  // A value moves to the next unit from 85% of its scale; it stays in the
+  // last but one.
+  for (size_t i = 0; i + 1 < units.units.size() && n >= units.scale * 0.85;
+       i++) {
+    n /= units.scale;
+    unit = units.units[i];
+  }
+  char buf[64];
+  snprintf(buf, sizeof(buf), "%.*Lf%s", precision, n, unit);
+  return buf;
+}
+
+std::string FormatMetric(long double n) {
+  return FormatUnits(n, {1000, "", {"k", "M", "G", "T", "P"}}, 2);
+}
+
+std::string FormatBinary(long double n) {
+  return FormatUnits(n, {1024, "", {"K", "M", "G", "T", "P"}}, 2);
+}
+
+std::string FormatTimeUs(long double n) {
+  if (n >= 1000000.0) {
+    return FormatUnits(n / 1000000.0, {60, "s", {"m", "h"}}, 2);
+  }
+  return FormatUnits(n, {1000, "us", {"ms", "s"}}, 2);
+}
+
+std::string FormatTimeS(long double n) {
+  return FormatUnits(n, {60, "s", {"m", "h"}}, 0);
+}
+
+// Print a value in a column of `width', where units take the padding.
+void PrintUnits(const std::string &s, int width) {
+  int pad = 2;
+  if (s.size() >= 1 && isalpha(s[s.size() - 1])) pad--;
+  if (s.size() >= 2 && isalpha(s[s.size() - 2])) pad--;
+  width -= pad;
+  printf("%*.*s%.*s", width, width, s.c_str(), pad, "  ");
+}
+
+void PrintStatsRow(const char *name, long double mean, long double stdev,
+                   long double max, long double within_stdev,
+                   std::string (*format)(long double)) {
+  printf("    %-10s", name);
+  PrintUnits(format(mean), 8);
+  PrintUnits(format(stdev), 10);
+  PrintUnits(format(max), 9);
+  printf("%8.2Lf%%\n", within_stdev);
+}
+
+void PrintLatencyStats(hdr_histogram *hist) {
+  const long double mean = hdr_mean(hist);
+  const long double stdev = hdr_stddev(hist);
+  int64_t within = 0;
+  hdr_iter iter;
+  hdr_iter_recorded_init(&iter, hist);
+  while (hdr_iter_next(&iter)) {
+    if (iter.value >= mean - stdev && iter.value <= mean + stdev) {
+      within += iter.count;
+    }
+  }
+  const long double total = std::max<int64_t>(hist->total_count, 1);
+  PrintStatsRow("Latency", mean, stdev, hdr_max(hist), within * 100 / total,
+                FormatTimeUs);
+}
+
+void PrintRateStats(const std::vector<uint64_t> &samples) {
+  long double mean = 0, stdev = 0, max = 0, within = 0;
+  if (!samples.empty()) {
+    for (const auto sample : samples) mean += sample;
+    mean /= samples.size();
+    if (samples.size() > 1) {
+      for (const auto sample : samples) stdev += powl(sample - mean, 2);
+      stdev = sqrtl(stdev / (samples.size() - 1));
+    }
+    max = *std::max_element(samples.begin(), samples.end());
+    for (const auto sample : samples) {
+      within += sample >= mean - stdev && sample <= mean + stdev;
+    }
+    within = within * 100 / samples.size();
+  }
+  PrintStatsRow("Req/Sec", mean, stdev, max, within, FormatMetric);
+}
+
+void PrintLatencyDistribution(hdr_histogram *hist, const char *description) {
+  static constexpr double kPercentiles[] = {50.0, 75.0,   90.0,   99.0,
+                                            99.9, 99.99, 99.999, 100.0};
+  printf("  Latency Distribution (HdrHistogram - %s)\n", description);
+  for (const double p : kPercentiles) {
+    printf("%7.3f%%", p);
+    PrintUnits(FormatTimeUs(hdr_value_at_percentile(hist, p)), 10);
+    printf("\n");
+  }
+  printf("\n  Detailed Percentile spectrum:\n");
+  hdr_percentiles_print(hist, stdout, 5, 1000.0, CLASSIC);
+}
+
+// Parse a wrk duration: a number of seconds, or minutes or hours with `m' or
+// `h'.
+std::optional<uint64_t> ParseDuration(std::string_view s) {
+  uint64_t value;
+  const auto [ptr, ec] = std::from_chars(s.data(), s.data() + s.size(), value);
+  if (ec != std::errc()) return std::nullopt;
+  const std::string_view unit(ptr, s.data() + s.size() - ptr);
+  if (unit.empty() || unit == "s") return value;
+  if (unit == "m") return value * 60;
+  if (unit == "h") return value * 3600;
+  return std::nullopt;
+}
+
+struct Url {
+  std::string host;
+  uint16_t port;
+  std::string path;
+};
+
+std::optional<Url> ParseUrl(std::string_view s) {
+  static constexpr std::string_view kScheme = "http://";
+  if (!s.starts_with(kScheme)) return std::nullopt;
+  s.remove_prefix(kScheme.size());
+  const size_t path_start = std::min(s.find('/'), s.size());
+  Url url = {.host = std::string(s.substr(0, path_start)),
+             .port = 80,
+             .path = path_start == s.size()
+                         ? "/"
+                         : std::string(s.substr(path_start))};
+  const size_t colon = url.host.find(':');
+  if (colon != std::string::npos) {
+    const char *end = url.host.data() + url.host.size();
+    const auto [ptr, ec] =
+        std::from_chars(url.host.data() + colon + 1, end, url.port);
+    if (ec != std::errc() || ptr != end) return std::nullopt;
+    url.host.resize(colon);
+  }
+  if (url.host.empty()) return std::nullopt;
+  return url;
+}
+
+int main(int argc, char *argv[]) {
+  ::google::InitGoogleLogging(argv[0]);
+  gflags::SetUsageMessage("wrk2-compatible HTTP load generator over Machnet.");
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+  signal(SIGINT, SigIntHandler);
+  FLAGS_logtostderr = 1;
+
+  CHECK(!FLAGS_local_ip.empty()) << "--local_ip is required";
+  const auto url = ParseUrl(FLAGS_url);
+  CHECK(url.has_value()) << "Malformed --url " << FLAGS_url;
+  const auto duration_s = ParseDuration(FLAGS_duration);
+  CHECK(duration_s.has_value() && duration_s.value() > 0)
+      << "Malformed --duration " << FLAGS_duration;
+  CHECK_GT(FLAGS_rate, 0) << "--rate is required";
+  CHECK_GT(FLAGS_threads, 0);
+  CHECK_GE(FLAGS_connections, FLAGS_threads)
+      << "Every thread needs at least one connection";
+  CHECK_GT(FLAGS_remote_ports, 0);
+
+  const std::string request = "GET " + url->path + " HTTP/1.1\r\nHost: " +
+                              url->host + ":" + std::to_string(url->port) +
+                              "\r\n\r\n";
+
+  CHECK_EQ(machnet_init(), 0) << "Failed to initialize Machnet library.";
+
+  const uint32_t connections_per_thread = FLAGS_connections / FLAGS_threads;
+  std::vector<std::unique_ptr<ThreadCtx>> thread_ctxs;
+  for (uint32_t i = 0; i < FLAGS_threads; i++) {
+    void *channel_ctx = machnet_attach();
+    CHECK_NOTNULL(channel_ctx);
+    auto thread_ctx = std::make_unique<ThreadCtx>(channel_ctx, i);
+    thread_ctx->connections.resize(connections_per_thread);
+    for (uint32_t j = 0; j < connections_per_thread; j++) {
+      const uint32_t index = i * connections_per_thread + j;
+      const uint16_t remote_port = url->port + index % FLAGS_remote_ports;
+      auto &conn = thread_ctx->connections[j];
+      const int ret =
+          machnet_connect(channel_ctx, FLAGS_local_ip.c_str(),
+                          url->host.c_str(), remote_port, &conn.flow);
+      CHECK(ret == 0) << "Failed to connect to remote host. "
+                         "machnet_connect() error: "
+                      << strerror(ret);
+      thread_ctx->connections_by_port[conn.flow.src_port] = &conn;
+    }
+    thread_ctxs.push_back(std::move(thread_ctx));
+  }
+
+  printf("Running %s test @ %s\n", FormatTimeS(duration_s.value()).c_str(),
+         FLAGS_url.c_str());
+  printf("  %u threads and %u connections\n", FLAGS_threads,
+         connections_per_thread * FLAGS_threads);
+  fflush(stdout);
+
+  const uint64_t start = NowNs();
+  std::vector<std::thread> threads;
+  for (auto &thread_ctx : thread_ctxs) {
+    threads.emplace_back(ThreadLoop, thread_ctx.get(), request,
+                         FLAGS_rate / FLAGS_threads,
+                         duration_s.value() * 1000 * 1000 * 1000);
+  }
+  for (auto &thread : threads) thread.join();
+  const double runtime_s = (NowNs() - start) / 1E9;
+
+  hdr_histogram *latency_hist = NewLatencyHistogram();
+  hdr_histogram *u_latency_hist = NewLatencyHistogram();
+  std::vector<uint64_t> rate_samples;
+  uint64_t complete = 0, bytes = 0, status_errors = 0, parse_errors = 0;
+  for (const auto &thread_ctx : thread_ctxs) {
+    hdr_add(latency_hist, thread_ctx->latency_hist);
+    hdr_add(u_latency_hist, thread_ctx->u_latency_hist);
+    rate_samples.insert(rate_samples.end(), thread_ctx->rate_samples.begin(),
+                        thread_ctx->rate_samples.end());
+    complete += thread_ctx->complete;
+    bytes += thread_ctx->bytes;
+    status_errors += thread_ctx->status_errors;
+    parse_errors += thread_ctx->parse_errors;
+  }
+
+  printf("  Thread Stats%6s%11s%8s%12s\n", "Avg", "Stdev", "Max", "+/- Stdev");
+  PrintLatencyStats(latency_hist);
+  PrintRateStats(rate_samples);
+  if (FLAGS_latency) {
+    PrintLatencyDistribution(latency_hist, "Recorded Latency");
+    printf("----------------------------------------------------------\n");
+  }
+  if (FLAGS_u_latency) {
+    printf("\n");
+    PrintLatencyDistribution(u_latency_hist,
+                             "Uncorrected Latency (measured without taking "
+                             "delayed starts into account)");
+    printf("----------------------------------------------------------\n");
+  }
+  printf("  %" PRIu64 " requests in %s, %sB read\n", complete,
+         FormatTimeUs(runtime_s * 1E6).c_str(), FormatBinary(bytes).c_str());
+  if (parse_errors > 0) {
+    printf("  Malformed responses: %" PRIu64 "\n", parse_errors);
+  }
+  if (status_errors > 0) {
+    printf("  Non-2xx or 3xx responses: %" PRIu64 "\n", status_errors);
+  }
+  printf("Requests/sec: %9.2Lf\n", complete / (long double)runtime_s);
+  printf("Transfer/sec: %10sB\n", FormatBinary(bytes / runtime_s).c_str());
+
+  hdr_close(latency_hist);
+  hdr_close(u_latency_hist);
+  return 0;
+}
@@ -0,0 +1,106 @@
+/**
+ * @file http_request.h
+ * @brief Parsing of the HTTP/1.1 requests of the http_server, in place in the
+ * data of a flow.
+ */
+
+#ifndef SRC_APPS_HTTP_SERVER_HTTP_REQUEST_H_
+#define SRC_APPS_HTTP_SERVER_HTTP_REQUEST_H_
+
+#include <machnet_common.h>
+#include <strings.h>
+
+#include <charconv>
+#include <cstddef>
+#include <string_view>
+#include <system_error>
+
+// Requests with a larger header are rejected.
+static constexpr size_t kMaxHeaderSize = 8192;
+// Requests with a larger body are rejected.
+static constexpr size_t kMaxBodySize = MACHNET_MSG_MAX_LEN;
+
+/**
+ * @brief A request parsed in place: the views point into the parsed data.
+ */
+struct Request {
+  std::string_view method;
+  std::string_view target;
+  // Size of the header and body.
+  size_t size;
+  // Status of the error response, if the request is malformed.
+  int error_status;
+};
+
+enum class ParseStatus { kComplete, kIncomplete, kError };
+
+inline bool EqualsIgnoreCase(std::string_view a, std::string_view b) {
+  return a.size() == b.size() && strncasecmp(a.data(), b.data(), a.size()) == 0;
+}
+
+inline std::string_view Trim(std::string_view s) {
+  const size_t begin = s.find_first_not_of(" \t");
+  if (begin == std::string_view::npos) return {};
+  return s.substr(begin, s.find_last_not_of(" \t") - begin + 1);
+}
+
+/**
+ * @brief Parses the request at the start of `data'. Only the fields needed to
+ * serve static content are looked at: the request line, and the framing of the
+ * body, which is skipped.
+ */
+inline ParseStatus ParseRequest(std::string_view data, Request *request) {
+  const size_t header_end = data.find("\r\n\r\n");
+  if (header_end == std::string_view::npos || header_end > kMaxHeaderSize) {
+    if (data.size() <= kMaxHeaderSize) return ParseStatus::kIncomplete;
+    request->error_status = 431;
+    return ParseStatus::kError;
+  }
+  request->error_status = 400;
+  // Each line of the header ends with CRLF.
+  const std::string_view header = data.substr(0, header_end + 2);
+
+  // The request line: method, target and version.
+  const size_t line_end = header.find("\r\n");
+  const std::string_view line = header.substr(0, line_end);
+  const size_t sp1 = line.find(' ');
+  const size_t sp2 = line.find(' ', sp1 + 1);
+  if (sp1 == 0 || sp2 == std::string_view::npos || sp2 == sp1 + 1) {
+    return ParseStatus::kError;
+  }
+  request->method = line.substr(0, sp1);
+  request->target = line.substr(sp1 + 1, sp2 - sp1 - 1);
+  if (!line.substr(sp2 + 1).starts_with("HTTP/1.")) return ParseStatus::kError;
+
+  size_t content_length = 0;
+  for (size_t pos = line_end + 2; pos < header.size();) {
+    const size_t end = header.find("\r\n", pos);
+    const std::string_view field = header.substr(pos, end - pos);
+    pos = end + 2;
+    const size_t colon = field.find(':');
+    if (colon == std::string_view::npos) return ParseStatus::kError;
+    const std::string_view name = field.substr(0, colon);
+    const std::string_view value = Trim(field.substr(colon + 1));
+    if (EqualsIgnoreCase(name, "Content-Length")) {
+      const auto [ptr, ec] = std::from_chars(
+          value.data(), value.data() + value.size(), content_length);
+      if (ec != std::errc() || ptr != value.data() + value.size()) {
+        return ParseStatus::kError;
+      }
+    } else if (EqualsIgnoreCase(name, "Transfer-Encoding")) {
+      // Chunked request bodies are not supported.
+      request->error_status = 501;
+      return ParseStatus::kError;
+    }
+  }
+  if (content_length > kMaxBodySize) {
+    request->error_status = 413;
+    return ParseStatus::kError;
+  }
+
+  request->size = header_end + 4 + content_length;
+  if (data.size() < request->size) return ParseStatus::kIncomplete;
+  return ParseStatus::kComplete;
+}
+
+#endif  // SRC_APPS_HTTP_SERVER_HTTP_REQUEST_H_
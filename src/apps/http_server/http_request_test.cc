@@ -0,0 +1,125 @@
+/**
+ * @file http_request_test.cc
+ *
+ * Unit tests for the request parser of the http_server.
+ */
+
+#include <gtest/gtest.h>
+
+#include <string>
+#include <string_view>
+
+#include "http_request.h"
+
+TEST(HttpRequestTest, Get) {
+  const std::string_view data =
+      "GET /index.html?x=1 HTTP/1.1\r\nHost: a\r\n\r\n";
+  Request request;
+  ASSERT_EQ(ParseRequest(data, &request), ParseStatus::kComplete);
+  EXPECT_EQ(request.method, "GET");
+  EXPECT_EQ(request.target, "/index.html?x=1");
+  EXPECT_EQ(request.size, data.size());
+}
+
+TEST(HttpRequestTest, Head) {
+  const std::string_view data = "HEAD / HTTP/1.0\r\n\r\n";
+  Request request;
+  ASSERT_EQ(ParseRequest(data, &request), ParseStatus::kComplete);
+  EXPECT_EQ(request.method, "HEAD");
+  EXPECT_EQ(request.target, "/");
+  EXPECT_EQ(request.size, data.size());
+}
+
+TEST(HttpRequestTest, Pipelined) {
+  const std::string first = "GET /a HTTP/1.1\r\n\r\n";
+  const std::string second =
+      "POST /b HTTP/1.1\r\ncontent-length:  5 \r\n\r\nhello";
+  const std::string third = "HEAD /c HTTP/1.1\r\n\r\n";
+  const std::string data = first + second + third;
+
+  // Each request is parsed from where the previous one ends.
+  std::string_view rest = data;
+  Request request;
+  ASSERT_EQ(ParseRequest(rest, &request), ParseStatus::kComplete);
+  EXPECT_EQ(request.target, "/a");
+  EXPECT_EQ(request.size, first.size());
+  rest.remove_prefix(request.size);
+  ASSERT_EQ(ParseRequest(rest, &request), ParseStatus::kComplete);
+  EXPECT_EQ(request.method, "POST");
+  EXPECT_EQ(request.target, "/b");
+  EXPECT_EQ(request.size, second.size());
+  rest.remove_prefix(request.size);
+  ASSERT_EQ(ParseRequest(rest, &request), ParseStatus::kComplete);
+  EXPECT_EQ(request.method, "HEAD");
+  EXPECT_EQ(request.size, third.size());
+  rest.remove_prefix(request.size);
+  EXPECT_TRUE(rest.empty());
+}
+
+TEST(HttpRequestTest, Split) {
+  const std::string data =
+      "PUT /a HTTP/1.1\r\nContent-Length: 10\r\n\r\n0123456789";
+  // Any prefix of the request, across the header or the body, is incomplete.
+  Request request;
+  for (size_t len = 0; len < data.size(); len++) {
+    EXPECT_EQ(ParseRequest(std::string_view(data).substr(0, len), &request),
+              ParseStatus::kIncomplete)
+        << len;
+  }
+  ASSERT_EQ(ParseRequest(data, &request), ParseStatus::kComplete);
+  EXPECT_EQ(request.size, data.size());
+}
+
+TEST(HttpRequestTest, BadRequest) {
+  const std::string_view kBadRequests[] = {
+      " / HTTP/1.1\r\n\r\n",                           // No method.
+      "GET  HTTP/1.1\r\n\r\n",                         // No target.
+      "GET /\r\n\r\n",                                 // No version.
+      "GET / HTTP/2\r\n\r\n",                          // Not HTTP/1.
+      "GET / HTTP/1.1\r\nHost\r\n\r\n",                // Not a field.
+      "GET / HTTP/1.1\r\nContent-Length: 1x\r\n\r\n",  // Bad length.
+      "GET / HTTP/1.1\r\nContent-Length: -1\r\n\r\n",
+  };
+  for (const auto &data : kBadRequests) {
+    Request request;
+    EXPECT_EQ(ParseRequest(data, &request), ParseStatus::kError) << data;
+    EXPECT_EQ(request.error_status, 400) << data;
+  }
+}
+
+TEST(HttpRequestTest, BodyTooLarge) {
+  const std::string data = "POST / HTTP/1.1\r\nContent-Length: " +
+                           std::to_string(kMaxBodySize + 1) + "\r\n\r\n";
+  Request request;
+  EXPECT_EQ(ParseRequest(data, &request), ParseStatus::kError);
+  EXPECT_EQ(request.error_status, 413);
+}
+
+TEST(HttpRequestTest, HeaderTooLarge) {
+  // Incomplete until the header could no longer fit.
+  std::string data = "GET / HTTP/1.1\r\nX: ";
+  data.append(kMaxHeaderSize - data.size(), 'x');
+  Request request;
+  EXPECT_EQ(ParseRequest(data, &request), ParseStatus::kIncomplete);
+  data.append("x");
+  EXPECT_EQ(ParseRequest(data, &request), ParseStatus::kError);
+  EXPECT_EQ(request.error_status, 431);
+
+  // Complete, but too large.
+  data.append("\r\n\r\n");
+  EXPECT_EQ(ParseRequest(data, &request), ParseStatus::kError);
+  EXPECT_EQ(request.error_status, 431);
+}
+
+TEST(HttpRequestTest, Chunked) {
+  const std::string_view data =
+      "POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n";
+  Request request;
+  EXPECT_EQ(ParseRequest(data, &request), ParseStatus::kError);
+  EXPECT_EQ(request.error_status, 501);
+}
+
+int main(int argc, char **argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,566 @@
+/**
+ * @file main.cc
+ * @brief A static-content HTTP/1.1 server over Machnet.
+ *
+ * Machnet flows stand in for TCP connections: the messages of a flow make up
+ * its byte stream, so a message may hold several requests (pipelining), or only
+ * a part of one. Requests are parsed in place in the channel buffers (see
+ * `machnet_recvmsg_zc()`); only the requests that span buffers or messages are
+ * copied. The content is loaded from --root at startup into read-only memory
+ * maps, with the response headers rendered ahead of time, so responses are
+ * gathered straight from the cache into Machnet messages.
+ *
+ * Each worker thread has its own channel and listens on its own port.
+ */
+
+#include <fcntl.h>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <machnet.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "http_request.h"
+
+using std::chrono::duration_cast;
+using std::chrono::steady_clock;
+
+DEFINE_string(local_ip, "", "IP of the local Machnet interface");
+DEFINE_uint32(local_port, 8000,
+              "Port to listen on. Worker thread i listens on --local_port + "
+              "i.");
+DEFINE_uint32(threads, 1, "Worker threads, each with its own channel.");
+DEFINE_string(root, "",
+              "Directory of the content to serve. If empty, `/' serves a page "
+              "of --body_size bytes.");
+DEFINE_uint64(body_size, 1024, "Size of the page served without --root.");
+
+static volatile int g_keep_running = 1;
+
+void SigIntHandler([[maybe_unused]] int signal) { g_keep_running = 0; }
+
+// Segments of a response message, before it is sent.
+static constexpr size_t kMaxTxSegments = 64;
+// Response messages queued for room in the channel, beyond which no more
+// requests are read.
+static constexpr size_t kMaxPendingTx = 1024;
+// The state kept for a flow (the start of a request, or that it was closed) is
+// dropped once the flow has been idle for that long.
+static constexpr auto kFlowIdleTimeout = std::chrono::seconds(30);
+
+/**
+ * @brief A response, as its rendered header and its body. Both live in the
+ * cache for the whole run.
+ */
+struct Content {
+  std::string header;
+  const char *body;
+  size_t body_size;
+};
+
+// Hash for lookups by `std::string_view' in maps keyed by `std::string'.
+struct StringHash {
+  using is_transparent = void;
+  size_t operator()(std::string_view s) const {
+    return std::hash<std::string_view>()(s);
+  }
+};
+
+std::string RenderHeader(int status, std::string_view reason,
+                         std::string_view content_type, size_t content_length,
+                         std::string_view extra_fields = "") {
+  std::string header = "HTTP/1.1 " + std::to_string(status) + " ";
+  header.append(reason);
+  header.append("\r\nServer: machnet-http\r\nContent-Type: ");
+  header.append(content_type);
+  header.append("\r\nContent-Length: " + std::to_string(content_length));
+  header.append("\r\n");
+  header.append(extra_fields);
+  header.append("\r\n");
+  return header;
+}
+
+std::string_view ContentType(const std::filesystem::path &path) {
+  static const std::unordered_map<std::string, std::string_view> kTypes = {
+      {".html", "text/html"},        {".htm", "text/html"},
+      {".css", "text/css"},          {".js", "text/javascript"},
+      {".json", "application/json"}, {".txt", "text/plain"},
+      {".png", "image/png"},         {".jpg", "image/jpeg"},
+      {".jpeg", "image/jpeg"},       {".gif", "image/gif"},
+      {".svg", "image/svg+xml"},     {".ico", "image/x-icon"}};
+  const auto it = kTypes.find(path.extension().string());
+  return it == kTypes.end() ? "application/octet-stream" : it->second;
+}
+
+/**
+ * @brief The content served, by path, and the error responses. Files are
+ * mapped read-only, and prefaulted, so that serving them never blocks.
+ */
+class ContentCache {
+ public:
+  ContentCache() {
+    static constexpr std::pair<int, std::string_view> kErrors[] = {
+        {400, "Bad Request"},
+        {404, "Not Found"},
+        {405, "Method Not Allowed"},
+        {413, "Content Too Large"},
+        {431, "Request Header Fields Too Large"},
+        {501, "Not Implemented"}};
+    for (const auto &[status, reason] : kErrors) {
+      auto &content = errors_[status];
+      content.body = reason.data();
+      content.body_size = reason.size();
+      // The flow is closed after a malformed request (see `Worker').
+      std::string_view extra_fields = "Connection: close\r\n";
+      if (status == 404) extra_fields = "";
+      if (status == 405) extra_fields = "Allow: GET, HEAD\r\n";
+      content.header = RenderHeader(status, reason, "text/plain",
+                                    reason.size(), extra_fields);
+    }
+  }
+  ContentCache(const ContentCache &) = delete;
+  ContentCache &operator=(const ContentCache &) = delete;
+
+  ~ContentCache() {
+    for (const auto &[addr, size] : mappings_) munmap(addr, size);
+  }
+
+  /// Load the regular files under `root'; `dir/index.html' is also `dir/'.
+  bool Load(const std::string &root) {
+    std::error_code ec;
+    auto it = std::filesystem::recursive_directory_iterator(root, ec);
+    if (ec) {
+      LOG(ERROR) << "Failed to open " << root << ": " << ec.message();
+      return false;
+    }
+    for (; it != std::filesystem::recursive_directory_iterator();
+         it.increment(ec)) {
+      if (ec) {
+        LOG(ERROR) << "Failed to list " << root << ": " << ec.message();
+        return false;
+      }
+      if (!it->is_regular_file(ec)) continue;
+      const auto &path = it->path();
+      const std::string url_path =
+          "/" + path.lexically_relative(root).generic_string();
+      const char *body;
+      size_t body_size;
+      if (!MapFile(path.string(), &body, &body_size)) return false;
+      Add(url_path, ContentType(path), body, body_size);
+      if (path.filename() == "index.html") {
+        Add(url_path.substr(0, url_path.size() - strlen("index.html")),
+            "text/html", body, body_size);
+      }
+    }
+    return !contents_.empty();
+  }
+
+  /// Serve a page of `size' bytes at `/' and `/index.html'.
+  void LoadPage(size_t size) {
+    char *body = nullptr;
+    if (size > 0) {
+      void *addr = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+      CHECK(addr != MAP_FAILED)
+          << "Failed to map the page: " << strerror(errno);
+      mappings_.emplace_back(addr, size);
+      body = static_cast<char *>(addr);
+      for (size_t i = 0; i < size; i++) body[i] = 'a' + i % 26;
+      mprotect(addr, size, PROT_READ);
+    }
+    Add("/", "text/plain", body, size);
+    Add("/index.html", "text/plain", body, size);
+  }
+
+  const Content *Find(std::string_view path) const {
+    const auto it = contents_.find(path);
+    return it == contents_.end() ? nullptr : &it->second;
+  }
+
+  const Content *Error(int status) const {
+    return &errors_.find(status)->second;
+  }
+
+  size_t size() const { return contents_.size(); }
+
+ private:
+  bool MapFile(const std::string &path, const char **body, size_t *size) {
+    const int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+      LOG(ERROR) << "Failed to open " << path << ": " << strerror(errno);
+      return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+      LOG(ERROR) << "Failed to stat " << path << ": " << strerror(errno);
+      close(fd);
+      return false;
+    }
+    *size = st.st_size;
+    *body = nullptr;
+    if (*size > 0) {
+      void *addr =
+          mmap(nullptr, *size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+      if (addr == MAP_FAILED) {
+        LOG(ERROR) << "Failed to map " << path << ": " << strerror(errno);
+        close(fd);
+        return false;
+      }
+      mappings_.emplace_back(addr, *size);
+      *body = static_cast<const char *>(addr);
+    }
+    close(fd);
+    return true;
+  }
+
+  void Add(const std::string &path, std::string_view content_type,
+           const char *body, size_t body_size) {
+    contents_[path] = {
+        .header = RenderHeader(200, "OK", content_type, body_size),
+        .body = body,
+        .body_size = body_size};
+  }
+
+  std::vector<std::pair<void *, size_t>> mappings_;
+  std::unordered_map<std::string, Content, StringHash, std::equal_to<>>
+      contents_;
+  std::map<int, Content> errors_;
+};
+
+/**
+ * @brief A worker thread: it serves the flows of its own channel. After a
+ * malformed request, the flow is closed: the rest of what it sends is dropped.
+ */
+class Worker {
+ public:
+  Worker(void *channel_ctx, uint32_t id, const ContentCache *cache)
+      : channel_ctx_(channel_ctx), id_(id), cache_(cache), rx_iov_(8) {
+    tx_iov_.reserve(kMaxTxSegments);
+  }
+
+  void Run() {
+    LOG(INFO) << "Worker " << id_ << ": Starting.";
+    last_report_ = steady_clock::now();
+    while (g_keep_running) {
+      SendPending();
+      // While too many responses wait for room, stop reading requests; the
+      // clients are then held back by the windows of their flows.
+      if (pending_tx_.size() < kMaxPendingTx) HandleMessage();
+      ReportStats();
+    }
+    LOG(INFO) << "Worker " << id_ << ": Served " << stats_.requests
+              << " requests (" << stats_.errors << " errors), received "
+              << stats_.rx_bytes << " Bytes, sent " << stats_.tx_bytes
+              << " Bytes.";
+  }
+
+ private:
+  struct Stats {
+    uint64_t requests{0};
+    uint64_t errors{0};
+    uint64_t rx_bytes{0};
+    uint64_t tx_bytes{0};
+    uint64_t tx_retries{0};
+  };
+
+  // What is kept of a flow between its messages. Flows only have a state while
+  // they have an incomplete request, or once closed.
+  struct FlowState {
+    // The start of the incomplete request.
+    std::string partial;
+    bool closed{false};
+    steady_clock::time_point last_rx;
+  };
+
+  // A response message waiting for room in the channel.
+  struct PendingTx {
+    MachnetFlow_t flow;
+    std::vector<MachnetIovec_t> iov;
+    size_t size;
+  };
+
+  // Receive a message, if any, and respond to the requests it completes.
+  void HandleMessage() {
+    MachnetMsgHdr_t msghdr = {};
+    msghdr.msg_iov = rx_iov_.data();
+    msghdr.msg_iovlen = rx_iov_.size();
+    MachnetMsgHandle_t handle;
+    const int ret = machnet_recvmsg_zc(channel_ctx_, &msghdr, &handle);
+    if (ret == 0) return;
+    if (ret < 0) {
+      // Not enough segments for the message, which is still pending.
+      if (msghdr.msg_iovlen > rx_iov_.size()) {
+        rx_iov_.resize(msghdr.msg_iovlen);
+      } else {
+        LOG(ERROR) << "machnet_recvmsg_zc() failed";
+      }
+      return;
+    }
+    stats_.rx_bytes += msghdr.msg_size;
+
+    const MachnetFlow_t &rx_flow = msghdr.flow_info;
+    const uint64_t flow_key =
+        (static_cast<uint64_t>(rx_flow.src_ip) << 16) | rx_flow.src_port;
+    auto state = flows_.find(flow_key);
+    if (state != flows_.end()) {
+      state->second.last_rx = steady_clock::now();
+      if (state->second.closed) {
+        machnet_release(channel_ctx_, handle);
+        return;
+      }
+    }
+
+    // The rest of an incomplete request is appended to its start, from the
+    // flow's previous messages. Otherwise, the message is parsed in place if it
+    // is contiguous.
+    std::string *buffer = nullptr;
+    if (state != flows_.end()) {
+      buffer = &state->second.partial;
+    } else if (msghdr.msg_iovlen > 1) {
+      buffer = &scratch_;
+      buffer->clear();
+    }
+    std::string_view data;
+    if (buffer != nullptr) {
+      for (size_t i = 0; i < msghdr.msg_iovlen; i++) {
+        buffer->append(static_cast<const char *>(rx_iov_[i].base),
+                       rx_iov_[i].len);
+      }
+      data = *buffer;
+    } else {
+      data = std::string_view(static_cast<const char *>(rx_iov_[0].base),
+                              rx_iov_[0].len);
+    }
+
+    MachnetFlow_t tx_flow;
+    tx_flow.dst_ip = rx_flow.src_ip;
+    tx_flow.src_ip = rx_flow.dst_ip;
+    tx_flow.src_port = rx_flow.dst_port;
+    tx_flow.dst_port = rx_flow.src_port;
+
+    bool close = false;
+    size_t consumed = 0;
+    while (consumed < data.size()) {
+      Request request;
+      const auto status = ParseRequest(data.substr(consumed), &request);
+      if (status == ParseStatus::kIncomplete) break;
+      stats_.requests++;
+      if (status == ParseStatus::kError) {
+        // The stream cannot be resynchronized after a malformed request.
+        stats_.errors++;
+        Respond(tx_flow, cache_->Error(request.error_status), false);
+        close = true;
+        break;
+      }
+      Route(tx_flow, request);
+      consumed += request.size;
+    }
+
+    if (close) {
+      auto &closed_state = flows_[flow_key];
+      closed_state.partial = std::string();
+      closed_state.closed = true;
+      closed_state.last_rx = steady_clock::now();
+    } else if (buffer == &scratch_ || buffer == nullptr) {
+      // Keep the incomplete request for the next messages of the flow.
+      if (consumed < data.size()) {
+        auto &new_state = flows_[flow_key];
+        new_state.partial.assign(data.substr(consumed));
+        new_state.last_rx = steady_clock::now();
+      }
+    } else if (consumed == data.size()) {
+      flows_.erase(state);
+    } else {
+      buffer->erase(0, consumed);
+    }
+
+    // The responses do not point into the request buffers.
+    machnet_release(channel_ctx_, handle);
+    Flush(tx_flow);
+  }
+
+  // Respond to a well-formed request. The flow stays open, even when the
+  // response is an error.
+  void Route(const MachnetFlow_t &flow, const Request &request) {
+    const bool head = request.method == "HEAD";
+    if (!head && request.method != "GET") {
+      stats_.errors++;
+      Respond(flow, cache_->Error(405), false);
+      return;
+    }
+    const std::string_view path =
+        request.target.substr(0, request.target.find('?'));
+    const Content *content = cache_->Find(path);
+    if (content == nullptr) {
+      stats_.errors++;
+      Respond(flow, cache_->Error(404), head);
+      return;
+    }
+    Respond(flow, content, head);
+  }
+
+  void Respond(const MachnetFlow_t &flow, const Content *content, bool head) {
+    Append(flow, content->header.data(), content->header.size());
+    if (!head) Append(flow, content->body, content->body_size);
+  }
+
+  // Add data to the response message of the flow, which is sent when full.
+  void Append(const MachnetFlow_t &flow, const char *data, size_t size) {
+    while (size > 0) {
+      if (tx_iov_.size() == kMaxTxSegments || tx_size_ == MACHNET_MSG_MAX_LEN) {
+        Flush(flow);
+      }
+      const size_t len = std::min<size_t>(size, MACHNET_MSG_MAX_LEN - tx_size_);
+      tx_iov_.push_back({.base = const_cast<char *>(data), .len = len});
+      tx_size_ += len;
+      data += len;
+      size -= len;
+    }
+  }
+
+  // Send the response message of the flow. The responses are part of the
+  // flow's byte stream, so when the channel is full they are queued, in order,
+  // rather than dropped; they point into the cache, which outlives them.
+  void Flush(const MachnetFlow_t &flow) {
+    if (tx_iov_.empty()) return;
+    if (!pending_tx_.empty() || !Send(flow, tx_iov_, tx_size_)) {
+      pending_tx_.push_back({flow, tx_iov_, tx_size_});
+    }
+    tx_iov_.clear();
+    tx_size_ = 0;
+  }
+
+  // Send the queued responses, in order, while the channel has room.
+  void SendPending() {
+    while (!pending_tx_.empty()) {
+      const auto &tx = pending_tx_.front();
+      if (!Send(tx.flow, tx.iov, tx.size)) return;
+      pending_tx_.pop_front();
+    }
+  }
+
+  bool Send(const MachnetFlow_t &flow, const std::vector<MachnetIovec_t> &iov,
+            size_t size) {
+    MachnetMsgHdr_t msghdr = {};
+    msghdr.msg_size = size;
+    msghdr.flow_info = flow;
+    msghdr.msg_iov = const_cast<MachnetIovec_t *>(iov.data());
+    msghdr.msg_iovlen = iov.size();
+    if (machnet_sendmsg(channel_ctx_, &msghdr) != 0) {
+      stats_.tx_retries++;
+      return false;
+    }
+    stats_.tx_bytes += size;
+    return true;
+  }
+
+  // Drop the state of the flows that have been idle for a while; Machnet does
+  // not tell when a flow goes away.
+  void ExpireFlows(steady_clock::time_point now) {
+    std::erase_if(flows_, [now](const auto &item) {
+      return now - item.second.last_rx > kFlowIdleTimeout;
+    });
+  }
+
+  void ReportStats() {
+    const auto now = steady_clock::now();
+    const double sec_elapsed =
+        duration_cast<std::chrono::nanoseconds>(now - last_report_).count() /
+        1E9;
+    if (sec_elapsed < 1) return;
+    ExpireFlows(now);
+
+    const double kreqs =
+        (stats_.requests - last_stats_.requests) / (1000 * sec_elapsed);
+    const double tx_gbps =
+        (stats_.tx_bytes - last_stats_.tx_bytes) * 8 / (sec_elapsed * 1E9);
+    if (kreqs > 0) {
+      std::cout << "[T" << id_ << "] Requests: " << std::fixed
+                << std::setprecision(1) << kreqs << "K/sec, TX: "
+                << std::setprecision(3) << tx_gbps
+                << " Gbps, errors: " << stats_.errors - last_stats_.errors
+                << ", TX retries: "
+                << stats_.tx_retries - last_stats_.tx_retries << std::endl;
+    }
+    last_report_ = now;
+    last_stats_ = stats_;
+  }
+
+  void *const channel_ctx_;
+  const uint32_t id_;
+  const ContentCache *const cache_;
+  std::vector<MachnetIovec_t> rx_iov_;
+  // The state of the flows that need one, by remote IP and port.
+  std::unordered_map<uint64_t, FlowState> flows_;
+  // The data of a message spread over several buffers.
+  std::string scratch_;
+  // The response message being gathered.
+  std::vector<MachnetIovec_t> tx_iov_;
+  size_t tx_size_{0};
+  // The response messages waiting for room in the channel.
+  std::deque<PendingTx> pending_tx_;
+  Stats stats_;
+  Stats last_stats_;
+  steady_clock::time_point last_report_;
+};
+
+int main(int argc, char *argv[]) {
+  ::google::InitGoogleLogging(argv[0]);
+  gflags::SetUsageMessage("Static-content HTTP/1.1 server over Machnet.");
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+  signal(SIGINT, SigIntHandler);
+  FLAGS_logtostderr = 1;
+
+  CHECK(!FLAGS_local_ip.empty()) << "--local_ip is required";
+  CHECK_GT(FLAGS_threads, 0);
+
+  ContentCache cache;
+  if (FLAGS_root.empty()) {
+    cache.LoadPage(FLAGS_body_size);
+  } else {
+    CHECK(cache.Load(FLAGS_root)) << "No content to serve in " << FLAGS_root;
+  }
+  LOG(INFO) << "Serving " << cache.size() << " paths";
+
+  CHECK_EQ(machnet_init(), 0) << "Failed to initialize Machnet library.";
+
+  std::vector<std::unique_ptr<Worker>> workers;
+  std::vector<std::thread> threads;
+  for (uint32_t i = 0; i < FLAGS_threads; i++) {
+    void *channel_ctx = machnet_attach();
+    CHECK_NOTNULL(channel_ctx);
+    const uint16_t local_port = FLAGS_local_port + i;
+    const int ret =
+        machnet_listen(channel_ctx, FLAGS_local_ip.c_str(), local_port);
+    CHECK(ret == 0) << "Failed to listen on local port. machnet_listen() "
+                       "error: "
+                    << strerror(ret);
+    LOG(INFO) << "[LISTENING] [" << FLAGS_local_ip << ":" << local_port << "]";
+
+    workers.push_back(std::make_unique<Worker>(channel_ctx, i, &cache));
+    threads.emplace_back(&Worker::Run, workers.back().get());
+  }
+
+  for (auto &thread : threads) thread.join();
+  return 0;
+}
@@ -2,24 +2,45 @@
  * @file main.cc
  * @brief This application is a simple message generator that supports sending
  * and receiving network messages using Machnet.
+ *
+ * The client runs either closed-loop, with a window of messages in flight on
+ * one flow, or open-loop, issuing requests on a Poisson or fixed schedule at a
+ * target rate, from several threads and flows, whatever the responses. In
+ * open-loop mode, latencies are measured from the time each request was
+ * scheduled to be sent, so queueing delays in the client are accounted for
+ * (no "coordinated omission"). The open-loop schedule can also be replayed from
+ * a workload trace (see machnet_trace.h).
  */
 
 #include <gflags/gflags.h>
 #include <glog/logging.h>
 #include <hdr/hdr_histogram.h>
 #include <machnet.h>
+#include <machnet_trace.h>
 
+#include <algorithm>
+#include <cerrno>
 #include <chrono>
 #include <csignal>
 #include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
 #include <iomanip>
 #include <iostream>
+#include <memory>
 #include <numeric>
+#include <optional>
+#include <random>
 #include <sstream>
+#include <string>
 #include <thread>
+#include <vector>
 
 using std::chrono::duration_cast;
 using std::chrono::high_resolution_clock;
+using std::chrono::steady_clock;
 using std::chrono::time_point;
 
 DEFINE_string(local_ip, "", "IP of the local Machnet interface");
@@ -30,11 +51,45 @@ DEFINE_uint32(msg_size, 64, "Size of the message (request/response) to send.");
 DEFINE_uint32(msg_window, 8, "Maximum number of messages in flight.");
 DEFINE_uint64(msg_nr, UINT64_MAX, "Number of messages to send.");
 DEFINE_bool(verify, false, "Verify payload of received messages.");
+DEFINE_string(mode, "closed",
+              "Client load: `closed' keeps --msg_window messages in flight on "
+              "one flow; `poisson' and `fixed' issue requests at --rps with "
+              "exponential or constant inter-arrival times (open loop).");
+DEFINE_uint32(threads, 1,
+              "Threads of the server and of the open-loop client, each with "
+              "its own channel. Server thread i listens on --local_port + i.");
+DEFINE_uint32(flows_per_thread, 1, "Flows of each open-loop client thread.");
+DEFINE_uint32(remote_ports, 1,
+              "Flows are spread over this many ports from --remote_port "
+              "(the server's --threads).");
+DEFINE_double(rps, 10000, "Open loop: target request rate, of all threads.");
+DEFINE_string(msg_size_dist, "",
+              "Open loop: request sizes, as `size:weight,...' or "
+              "`uniform:min:max'. --msg_size if empty.");
+DEFINE_string(resp_size_dist, "",
+              "Open loop: response sizes, same syntax as --msg_size_dist. The "
+              "server's --msg_size if empty.");
+DEFINE_uint64(duration_s, 0, "Open loop: run time, 0 to run until SIGINT.");
+DEFINE_uint64(seed, 1, "Open loop: seed of the schedules and sizes.");
+DEFINE_string(output, "",
+              "Open loop: file the final results are appended to, if any.");
+DEFINE_string(output_format, "csv", "Format of --output: `csv' or `json'.");
+DEFINE_string(trace_file, "",
+              "Open loop: replay the requests of a workload trace (see "
+              "machnet_trace.h) instead of following --mode.");
+DEFINE_double(trace_speed, 1, "Replay speed of --trace_file, e.g., 2 for 2x.");
 
 static volatile int g_keep_running = 1;
 
 struct app_hdr_t {
   uint64_t window_slot;
+  // Open loop: when the request was scheduled, and actually sent (ns).
+  uint64_t intended_ts;
+  uint64_t tx_ts;
+  // Size of the response; 0 for the server's --msg_size.
+  uint32_t resp_size;
+  // Open loop: the client thread's flow the request was sent on.
+  uint32_t flow_index;
 };
 
 struct stats_t {
@@ -47,19 +102,121 @@ struct stats_t {
   uint64_t err_tx_drops;
 };
 
+/**
+ * @brief A distribution of message sizes: either discrete, as a list of
+ * `size:weight' (weights are relative, and default to 1), or uniform between
+ * two sizes, as `uniform:min:max'.
+ */
+class SizeDistribution {
+ public:
+  static std::optional<SizeDistribution> Parse(const std::string &spec) {
+    SizeDistribution dist;
+    std::vector<std::string> fields;
+    std::stringstream ss(spec);
+    for (std::string field; std::getline(ss, field, ':');) {
+      fields.push_back(field);
+    }
+    if (fields.size() == 3 && fields[0] == "uniform") {
+      const auto min = ParseSize(fields[1]);
+      const auto max = ParseSize(fields[2]);
+      if (!min.has_value() || !max.has_value() || min > max) {
+        return std::nullopt;
+      }
+      dist.uniform_.emplace(min.value(), max.value());
+      dist.min_ = min.value();
+      dist.max_ = max.value();
+      return dist;
+    }
+
+    std::vector<double> weights;
+    ss = std::stringstream(spec);
+    for (std::string entry; std::getline(ss, entry, ',');) {
+      const auto colon = entry.find(':');
+      const auto size = ParseSize(entry.substr(0, colon));
+      if (!size.has_value()) return std::nullopt;
+      double weight = 1;
+      if (colon != std::string::npos) {
+        const auto value = entry.substr(colon + 1);
+        char *end;
+        weight = std::strtod(value.c_str(), &end);
+        if (value.empty() || *end != '\0' || !(weight > 0)) {
+          return std::nullopt;
+        }
+      }
+      dist.sizes_.push_back(size.value());
+      weights.push_back(weight);
+    }
+    if (dist.sizes_.empty()) return std::nullopt;
+    dist.choice_ =
+        std::discrete_distribution<size_t>(weights.begin(), weights.end());
+    dist.min_ = *std::min_element(dist.sizes_.begin(), dist.sizes_.end());
+    dist.max_ = *std::max_element(dist.sizes_.begin(), dist.sizes_.end());
+    return dist;
+  }
+
+  static SizeDistribution Fixed(uint32_t size) {
+    SizeDistribution dist;
+    dist.sizes_.push_back(size);
+    dist.min_ = dist.max_ = size;
+    return dist;
+  }
+
+  uint32_t Sample(std::mt19937_64 *rng) {
+    if (uniform_.has_value()) return uniform_.value()(*rng);
+    return sizes_.size() == 1 ? sizes_[0] : sizes_[choice_(*rng)];
+  }
+
+  uint32_t min() const { return min_; }
+  uint32_t max() const { return max_; }
+
+ private:
+  static std::optional<uint32_t> ParseSize(const std::string &value) {
+    char *end;
+    errno = 0;
+    const auto size = std::strtoul(value.c_str(), &end, 10);
+    if (errno != 0 || value.empty() || *end != '\0' || size > UINT32_MAX) {
+      return std::nullopt;
+    }
+    return size;
+  }
+
+  std::vector<uint32_t> sizes_;
+  std::discrete_distribution<size_t> choice_;
+  std::optional<std::uniform_int_distribution<uint32_t>> uniform_;
+  uint32_t min_{0};
+  uint32_t max_{0};
+};
+
+// Monotonic time in nanoseconds, as carried in the application header.
+uint64_t NowNs() {
+  return duration_cast<std::chrono::nanoseconds>(
+             steady_clock::now().time_since_epoch())
+      .count();
+}
+
 class ThreadCtx {
  private:
   static constexpr int64_t kMinLatencyMicros = 1;
   static constexpr int64_t kMaxLatencyMicros = 1000 * 1000 * 100;  // 100 sec
   static constexpr int64_t kLatencyPrecision = 2;  // Two significant digits
+  // The open-loop histograms keep the whole run, with more precision, except
+  // for the per-flow ones.
+  static constexpr int64_t kMaxLatencyNanos = kMaxLatencyMicros * 1000;
+  static constexpr int64_t kOpenLoopLatencyPrecision = 3;
+  static constexpr int64_t kFlowLatencyPrecision = 2;
 
   struct msg_latency_info_t {
     time_point<high_resolution_clock> tx_ts;
   };
 
  public:
-  ThreadCtx(const void *channel_ctx, const MachnetFlow_t *flow_info)
-      : channel_ctx(CHECK_NOTNULL(channel_ctx)), flow(flow_info), stats() {
+  ThreadCtx(const void *channel_ctx, const MachnetFlow_t *flow_info,
+            uint32_t thread_id = 0)
+      : channel_ctx(CHECK_NOTNULL(channel_ctx)),
+        flow(flow_info),
+        thread_id(thread_id),
+        num_request_latency_samples(0),
+        stats() {
     // Fill-in max-sized messages, we'll send the actual size later
     rx_message.resize(MACHNET_MSG_MAX_LEN);
     tx_message.resize(MACHNET_MSG_MAX_LEN);
@@ -70,10 +227,17 @@ class ThreadCtx {
     int ret = hdr_init(kMinLatencyMicros, kMaxLatencyMicros, kLatencyPrecision,
                        &latency_hist);
     CHECK_EQ(ret, 0) << "Failed to initialize latency histogram.";
+    open_loop.latency_hist = NewOpenLoopHistogram();
+    open_loop.service_hist = NewOpenLoopHistogram();
 
     msg_latency_info_vec.resize(FLAGS_msg_window);
   }
-  ~ThreadCtx() { hdr_close(latency_hist); }
+  ~ThreadCtx() {
+    hdr_close(latency_hist);
+    hdr_close(open_loop.latency_hist);
+    hdr_close(open_loop.service_hist);
+    for (auto *hist : open_loop.flow_hists) hdr_close(hist);
+  }
 
   void RecordRequestStart(uint64_t window_slot) {
     msg_latency_info_vec[window_slot].tx_ts = high_resolution_clock::now();
@@ -91,9 +255,38 @@ class ThreadCtx {
     return latency_us;
   }
 
+  static hdr_histogram *NewOpenLoopHistogram(
+      int64_t precision = kOpenLoopLatencyPrecision) {
+    hdr_histogram *hist;
+    const int ret = hdr_init(1, kMaxLatencyNanos, precision, &hist);
+    CHECK_EQ(ret, 0) << "Failed to initialize latency histogram.";
+    return hist;
+  }
+
+  /// Add an open-loop flow to the thread.
+  void AddOpenLoopFlow(const MachnetFlow_t &flow) {
+    open_loop.flows.push_back(flow);
+    open_loop.flow_hists.push_back(NewOpenLoopHistogram(kFlowLatencyPrecision));
+  }
+
+  /// Record the latency of an open-loop request, from its intended and actual
+  /// send times.
+  void RecordOpenLoopResponse(const app_hdr_t &hdr) {
+    const auto now = NowNs();
+    hdr_record_value(open_loop.latency_hist, now - hdr.intended_ts);
+    hdr_record_value(open_loop.service_hist, now - hdr.tx_ts);
+    if (hdr.flow_index < open_loop.flow_hists.size()) {
+      hdr_record_value(open_loop.flow_hists[hdr.flow_index],
+                       now - hdr.intended_ts);
+    }
+    hdr_record_value(latency_hist, (now - hdr.intended_ts) / 1000);
+    num_request_latency_samples++;
+  }
+
  public:
   const void *channel_ctx;
   const MachnetFlow_t *flow;
+  const uint32_t thread_id;
   std::vector<uint8_t> rx_message;
   std::vector<uint8_t> tx_message;
   std::vector<uint8_t> message_gold;
@@ -106,6 +299,20 @@ class ThreadCtx {
     stats_t prev;
     time_point<high_resolution_clock> last_measure_time;
   } stats;
+
+  // Open loop only.
+  struct {
+    std::vector<MachnetFlow_t> flows;
+    // Latency from the intended send time (ns), which includes the time the
+    // request waited to be sent, and from the actual send time.
+    hdr_histogram *latency_hist;
+    hdr_histogram *service_hist;
+    // Latency from the intended send time, per flow.
+    std::vector<hdr_histogram *> flow_hists;
+    // Requests sent late, i.e., once the next request was due too.
+    uint64_t late_requests{0};
+    uint64_t duration_ns{0};
+  } open_loop;
 };
 
 void SigIntHandler([[maybe_unused]] int signal) { g_keep_running = 0; }
@@ -149,7 +356,10 @@ void ReportStats(ThreadCtx *thread_ctx) {
       drops_stats_ss << ", TX drops: " << msg_dropped;
     }
 
-    std::cout << "TX/RX (msg/sec, Gbps): (" << std::fixed
+    std::ostringstream thread_ss;
+    if (FLAGS_threads > 1) thread_ss << "[T" << thread_ctx->thread_id << "] ";
+
+    std::cout << thread_ss.str() << "TX/RX (msg/sec, Gbps): (" << std::fixed
               << std::setprecision(1) << tx_kmps << "K/" << rx_kmps << "K"
               << std::fixed << std::setprecision(3) << ", " << tx_gbps << "/"
               << rx_gbps << "). " << latency_stats_ss.str()
@@ -161,8 +371,8 @@ void ReportStats(ThreadCtx *thread_ctx) {
   }
 }
 
-void ServerLoop(void *channel_ctx) {
-  ThreadCtx thread_ctx(channel_ctx, nullptr /* flow info */);
+void ServerLoop(void *channel_ctx, uint32_t thread_id) {
+  ThreadCtx thread_ctx(channel_ctx, nullptr /* flow info */, thread_id);
   LOG(INFO) << "Server Loop: Starting.";
 
   while (true) {
@@ -186,10 +396,15 @@ void ServerLoop(void *channel_ctx) {
         reinterpret_cast<const app_hdr_t *>(thread_ctx.rx_message.data());
     VLOG(1) << "Server: Received msg for window slot " << req_hdr->window_slot;
 
-    // Send the response
+    // Send the response, which echoes the request's header.
     app_hdr_t *resp_hdr =
         reinterpret_cast<app_hdr_t *>(thread_ctx.tx_message.data());
-    resp_hdr->window_slot = req_hdr->window_slot;
+    *resp_hdr = *req_hdr;
+    const uint32_t resp_size =
+        req_hdr->resp_size == 0
+            ? FLAGS_msg_size
+            : std::clamp<uint32_t>(req_hdr->resp_size, sizeof(app_hdr_t),
+                                   thread_ctx.tx_message.size());
 
     MachnetFlow_t tx_flow;
     tx_flow.dst_ip = rx_flow.src_ip;
@@ -198,10 +413,10 @@ void ServerLoop(void *channel_ctx) {
     tx_flow.dst_port = rx_flow.src_port;
 
     const int ret = machnet_send(channel_ctx, tx_flow,
-                                 thread_ctx.tx_message.data(), FLAGS_msg_size);
+                                 thread_ctx.tx_message.data(), resp_size);
     if (ret == 0) {
       stats_cur.tx_success++;
-      stats_cur.tx_bytes += FLAGS_msg_size;
+      stats_cur.tx_bytes += resp_size;
     } else {
       stats_cur.err_tx_drops++;
     }
@@ -225,6 +440,7 @@ void ClientSendOne(ThreadCtx *thread_ctx, uint64_t window_slot) {
 
   app_hdr_t *req_hdr =
       reinterpret_cast<app_hdr_t *>(thread_ctx->tx_message.data());
+  *req_hdr = {};
   req_hdr->window_slot = window_slot;
 
   const int ret = machnet_send(thread_ctx->channel_ctx, *thread_ctx->flow,
@@ -318,6 +534,338 @@ void ClientLoop(void *channel_ctx, MachnetFlow *flow) {
             << stats_cur.rx_bytes << " Bytes)";
 }
 
+// A request of an open-loop client thread.
+struct ScheduledRequest {
+  uint64_t offset_ns;   // When to send it, since the start of the run.
+  uint32_t flow_index;  // Among the flows of the thread.
+  uint32_t req_size;
+  uint32_t resp_size;  // 0 for the server's --msg_size.
+};
+
+// The requests of an open-loop client thread, in order; nullopt at the end.
+using RequestSchedule = std::function<std::optional<ScheduledRequest>()>;
+
+// Requests at `rps', with exponential (--mode poisson) or constant
+// inter-arrival times, round-robin over `flows_nr' flows.
+RequestSchedule MakeRateSchedule(uint32_t thread_id, double rps,
+                                 uint32_t flows_nr, SizeDistribution req_sizes,
+                                 std::optional<SizeDistribution> resp_sizes) {
+  const double mean_gap_ns = 1E9 / rps;
+  const bool poisson = FLAGS_mode == "poisson";
+  // The schedule is kept in floating point, so that fixed gaps do not drift.
+  return [=, rng = std::mt19937_64(FLAGS_seed * 1000 + thread_id),
+          exp_gap = std::exponential_distribution<double>(1.0 / mean_gap_ns),
+          offset_ns = 0.0, flow_index = uint32_t{0}]() mutable {
+    offset_ns += poisson ? exp_gap(rng) : mean_gap_ns;
+    const ScheduledRequest request = {
+        .offset_ns = static_cast<uint64_t>(offset_ns),
+        .flow_index = flow_index,
+        .req_size = req_sizes.Sample(&rng),
+        .resp_size = resp_sizes.has_value() ? resp_sizes->Sample(&rng) : 0};
+    flow_index = (flow_index + 1) % flows_nr;
+    return std::optional<ScheduledRequest>(request);
+  };
+}
+
+RequestSchedule MakeTraceSchedule(std::vector<ScheduledRequest> requests) {
+  return [requests = std::move(requests), next = size_t{0}]() mutable {
+    if (next == requests.size()) return std::optional<ScheduledRequest>();
+    return std::optional<ScheduledRequest>(requests[next++]);
+  };
+}
+
+/**
+ * @brief Loads a workload trace, either binary (see machnet_trace.h) or as
+ * text lines of `timestamp_ns flow_id req_size resp_size', and splits its
+ * requests among the client threads' flows. There are as many flows as
+ * threads times `flows_per_thread'; the requests of trace flow `f' go on flow
+ * `f' modulo that.
+ *
+ * @return The requests of each thread, or nullopt if the trace is malformed.
+ */
+std::optional<std::vector<std::vector<ScheduledRequest>>> LoadTrace(
+    const std::string &path, uint32_t threads, uint32_t flows_per_thread,
+    double speed) {
+  std::ifstream in(path, std::ios::binary);
+  if (!in) return std::nullopt;
+
+  std::vector<MachnetTraceRecord_t> records;
+  MachnetTraceHdr_t hdr;
+  if (in.read(reinterpret_cast<char *>(&hdr), sizeof(hdr)) &&
+      hdr.magic == MACHNET_TRACE_MAGIC) {
+    if (hdr.version != MACHNET_TRACE_VERSION) return std::nullopt;
+    MachnetTraceRecord_t record;
+    while (in.read(reinterpret_cast<char *>(&record), sizeof(record))) {
+      records.push_back(record);
+    }
+  } else {
+    in.clear();
+    in.seekg(0);
+    for (std::string line; std::getline(in, line);) {
+      line = line.substr(0, line.find('#'));
+      std::replace(line.begin(), line.end(), ',', ' ');
+      std::istringstream ss(line);
+      uint64_t timestamp_ns;
+      uint32_t flow_id, req_size, resp_size;
+      if (!(ss >> timestamp_ns)) continue;  // Blank line.
+      if (!(ss >> flow_id >> req_size >> resp_size)) return std::nullopt;
+      records.push_back({.timestamp_ns = timestamp_ns,
+                         .flow_id = flow_id,
+                         .req_size = req_size,
+                         .resp_size = resp_size});
+    }
+  }
+  if (records.empty()) return std::nullopt;
+
+  // Recorded traces are in order of completion, not of start.
+  std::stable_sort(records.begin(), records.end(),
+                   [](const auto &a, const auto &b) {
+                     return a.timestamp_ns < b.timestamp_ns;
+                   });
+  // Messages carry the application header; responses of unknown size get the
+  // server's default.
+  auto clamp_size = [](uint32_t size) {
+    return std::clamp<uint32_t>(size, sizeof(app_hdr_t), MACHNET_MSG_MAX_LEN);
+  };
+  const uint64_t first_ns = records.front().timestamp_ns;
+  const uint32_t flows_nr = threads * flows_per_thread;
+  std::vector<std::vector<ScheduledRequest>> requests(threads);
+  for (const auto &record : records) {
+    const uint32_t flow = record.flow_id % flows_nr;
+    const uint32_t resp_size = record.resp_size;
+    requests[flow / flows_per_thread].push_back(
+        {.offset_ns =
+             static_cast<uint64_t>((record.timestamp_ns - first_ns) / speed),
+         .flow_index = flow % flows_per_thread,
+         .req_size = clamp_size(record.req_size),
+         .resp_size = resp_size == 0 ? 0 : clamp_size(resp_size)});
+  }
+  return requests;
+}
+
+// Send one open-loop request, that was due at `intended_ts'. Return false if
+// the channel is full, for the request to be retried later.
+bool OpenLoopSendOne(ThreadCtx *thread_ctx, const ScheduledRequest &request,
+                     uint64_t intended_ts) {
+  app_hdr_t *req_hdr =
+      reinterpret_cast<app_hdr_t *>(thread_ctx->tx_message.data());
+  *req_hdr = {};
+  req_hdr->intended_ts = intended_ts;
+  req_hdr->tx_ts = NowNs();
+  req_hdr->resp_size = request.resp_size;
+  req_hdr->flow_index = request.flow_index;
+
+  const auto &flow = thread_ctx->open_loop.flows[request.flow_index];
+  if (machnet_send(thread_ctx->channel_ctx, flow,
+                   thread_ctx->tx_message.data(), request.req_size) != 0) {
+    return false;
+  }
+  auto &stats_cur = thread_ctx->stats.current;
+  stats_cur.tx_success++;
+  stats_cur.tx_bytes += request.req_size;
+  return true;
+}
+
+// Receive the pending responses, and return how many there were.
+size_t OpenLoopRecvAll(ThreadCtx *thread_ctx) {
+  size_t nb_responses = 0;
+  while (true) {
+    MachnetFlow_t rx_flow;
+    const ssize_t rx_size = machnet_recv(
+        thread_ctx->channel_ctx, thread_ctx->rx_message.data(),
+        thread_ctx->rx_message.size(), &rx_flow);
+    if (rx_size <= 0) break;
+    thread_ctx->stats.current.rx_count++;
+    thread_ctx->stats.current.rx_bytes += rx_size;
+    if (static_cast<size_t>(rx_size) < sizeof(app_hdr_t)) {
+      LOG(ERROR) << "Received a truncated response of " << rx_size
+                 << " bytes.";
+      continue;
+    }
+    const auto *resp_hdr =
+        reinterpret_cast<const app_hdr_t *>(thread_ctx->rx_message.data());
+    thread_ctx->RecordOpenLoopResponse(*resp_hdr);
+    nb_responses++;
+  }
+  return nb_responses;
+}
+
+void OpenLoopClientLoop(ThreadCtx *thread_ctx, RequestSchedule schedule) {
+  // Responses still in flight when the schedule ends are waited for this long.
+  static constexpr uint64_t kDrainNs = 1000 * 1000 * 1000;
+  // Requests sent in a row, before responses are received again.
+  static constexpr int kMaxSendBurst = 32;
+  LOG(INFO) << "Open-loop Client Loop: Starting.";
+
+  const uint64_t start = NowNs();
+  const uint64_t end = FLAGS_duration_s == 0
+                           ? UINT64_MAX
+                           : start + FLAGS_duration_s * 1000 * 1000 * 1000;
+  auto request = schedule();
+  uint64_t now = start;
+  while (g_keep_running && now < end && request.has_value()) {
+    // Issue the requests that are due, even when responses lag behind. A
+    // request that does not fit in the channel keeps its intended send time.
+    for (int i = 0; i < kMaxSendBurst && request.has_value() &&
+                    start + request->offset_ns <= now;
+         i++) {
+      if (!OpenLoopSendOne(thread_ctx, request.value(),
+                           start + request->offset_ns)) {
+        break;
+      }
+      request = schedule();
+      if (request.has_value() && start + request->offset_ns <= now) {
+        thread_ctx->open_loop.late_requests++;
+      }
+    }
+
+    OpenLoopRecvAll(thread_ctx);
+    ReportStats(thread_ctx);
+    now = NowNs();
+  }
+  thread_ctx->open_loop.duration_ns = now - start;
+
+  const auto &stats_cur = thread_ctx->stats.current;
+  const uint64_t drain_end = NowNs() + kDrainNs;
+  while (g_keep_running && stats_cur.rx_count < stats_cur.tx_success &&
+         NowNs() < drain_end) {
+    OpenLoopRecvAll(thread_ctx);
+  }
+
+  LOG(INFO) << "Application Statistics (TOTAL) - [TX] Sent: "
+            << stats_cur.tx_success << " (" << stats_cur.tx_bytes
+            << " Bytes), Late: " << thread_ctx->open_loop.late_requests
+            << ", [RX] Received: " << stats_cur.rx_count << " ("
+            << stats_cur.rx_bytes << " Bytes)";
+}
+
+// Print the results of an open-loop run, and append them to --output.
+void ReportOpenLoopResults(
+    const std::vector<std::unique_ptr<ThreadCtx>> &thread_ctxs,
+    const std::string &mode, double target_rps) {
+  hdr_histogram *latency_hist = ThreadCtx::NewOpenLoopHistogram();
+  hdr_histogram *service_hist = ThreadCtx::NewOpenLoopHistogram();
+  stats_t total;
+  uint64_t late_requests = 0;
+  uint64_t duration_ns = 0;
+  for (const auto &thread_ctx : thread_ctxs) {
+    hdr_add(latency_hist, thread_ctx->open_loop.latency_hist);
+    hdr_add(service_hist, thread_ctx->open_loop.service_hist);
+    const auto &stats_cur = thread_ctx->stats.current;
+    total.tx_success += stats_cur.tx_success;
+    total.tx_bytes += stats_cur.tx_bytes;
+    total.rx_count += stats_cur.rx_count;
+    total.rx_bytes += stats_cur.rx_bytes;
+    late_requests += thread_ctx->open_loop.late_requests;
+    duration_ns = std::max(duration_ns, thread_ctx->open_loop.duration_ns);
+  }
+  const double duration_s = std::max<uint64_t>(duration_ns, 1) / 1E9;
+
+  std::vector<std::pair<std::string, double>> results = {
+      {"threads", FLAGS_threads},
+      {"flows", FLAGS_threads * FLAGS_flows_per_thread},
+      {"target_rps", target_rps},
+      {"duration_s", duration_s},
+      {"sent", total.tx_success},
+      {"received", total.rx_count},
+      {"late", late_requests},
+      {"sent_rps", total.tx_success / duration_s},
+      {"received_rps", total.rx_count / duration_s},
+      {"tx_gbps", total.tx_bytes * 8 / duration_s / 1E9},
+      {"rx_gbps", total.rx_bytes * 8 / duration_s / 1E9},
+  };
+  const std::vector<std::pair<std::string, double>> kPercentiles = {
+      {"p50", 50.0}, {"p90", 90.0}, {"p99", 99.0}, {"p999", 99.9},
+      {"p9999", 99.99}};
+  for (const auto &[name, hist] : {std::make_pair("latency", latency_hist),
+                                   std::make_pair("service", service_hist)}) {
+    for (const auto &[perc_name, perc] : kPercentiles) {
+      results.emplace_back(std::string(name) + "_" + perc_name + "_us",
+                           hdr_value_at_percentile(hist, perc) / 1E3);
+    }
+    results.emplace_back(std::string(name) + "_max_us", hdr_max(hist) / 1E3);
+    results.emplace_back(std::string(name) + "_mean_us", hdr_mean(hist) / 1E3);
+  }
+
+  auto perc_us = [](hdr_histogram *hist, double perc) {
+    return hdr_value_at_percentile(hist, perc) / 1E3;
+  };
+  std::cout << std::fixed << std::setprecision(1) << "Open loop (" << mode
+            << "): " << FLAGS_threads << " threads x "
+            << FLAGS_flows_per_thread << " flows, target " << target_rps
+            << " req/s, sent " << total.tx_success / duration_s
+            << " req/s, received " << total.rx_count / duration_s
+            << " resp/s, late " << late_requests << std::endl;
+  for (const auto &[name, hist] :
+       {std::make_pair("from intended send", latency_hist),
+        std::make_pair("from actual send", service_hist)}) {
+    std::cout << "Latency " << name << " (p50/90/99/99.9/99.99/max us): "
+              << perc_us(hist, 50.0) << "/" << perc_us(hist, 90.0) << "/"
+              << perc_us(hist, 99.0) << "/" << perc_us(hist, 99.9) << "/"
+              << perc_us(hist, 99.99) << "/" << hdr_max(hist) / 1E3
+              << std::endl;
+  }
+  hdr_close(latency_hist);
+  hdr_close(service_hist);
+
+  // Per-flow latency from the intended send time.
+  std::ostringstream flows_json;
+  flows_json << std::setprecision(3) << std::fixed;
+  std::cout << "Per-flow latency from intended send (p50/99/99.9 us):"
+            << std::endl;
+  for (const auto &thread_ctx : thread_ctxs) {
+    const auto &open_loop = thread_ctx->open_loop;
+    for (size_t j = 0; j < open_loop.flows.size(); j++) {
+      hdr_histogram *hist = open_loop.flow_hists[j];
+      const auto &flow = open_loop.flows[j];
+      std::cout << "  [T" << thread_ctx->thread_id << "." << j << "] ["
+                << flow.src_port << " <-> " << flow.dst_port
+                << "] responses " << hist->total_count << ", "
+                << perc_us(hist, 50.0) << "/" << perc_us(hist, 99.0) << "/"
+                << perc_us(hist, 99.9) << std::endl;
+      flows_json << (flows_json.tellp() == 0 ? "" : ", ") << "{\"thread\": "
+                 << thread_ctx->thread_id << ", \"flow\": " << j
+                 << ", \"local_port\": " << flow.src_port
+                 << ", \"remote_port\": " << flow.dst_port
+                 << ", \"received\": " << hist->total_count
+                 << ", \"latency_p50_us\": " << perc_us(hist, 50.0)
+                 << ", \"latency_p99_us\": " << perc_us(hist, 99.0)
+                 << ", \"latency_p999_us\": " << perc_us(hist, 99.9) << "}";
+    }
+  }
+
+  if (FLAGS_output.empty()) return;
+  std::ifstream existing(FLAGS_output);
+  const bool empty = existing.peek() == std::ifstream::traits_type::eof();
+  existing.close();
+  std::ofstream out(FLAGS_output, std::ios::app);
+  if (!out) {
+    LOG(ERROR) << "Failed to open " << FLAGS_output;
+    return;
+  }
+  out << std::setprecision(3) << std::fixed;
+  if (FLAGS_output_format == "json") {
+    // One object per line, so that runs can be appended.
+    out << "{\"mode\": \"" << mode << "\"";
+    for (const auto &[name, value] : results) {
+      out << ", \"" << name << "\": " << value;
+    }
+    out << ", \"flow_latencies\": [" << flows_json.str() << "]}" << std::endl;
+  } else {
+    // A header line first, so that a sweep of runs makes one table. Per-flow
+    // results are only in JSON.
+    if (empty) {
+      out << "mode";
+      for (const auto &[name, value] : results) out << "," << name;
+      out << std::endl;
+    }
+    out << mode;
+    for (const auto &[name, value] : results) out << "," << value;
+    out << std::endl;
+  }
+  LOG(INFO) << "Results appended to " << FLAGS_output;
+}
+
 int main(int argc, char *argv[]) {
   ::google::InitGoogleLogging(argv[0]);
   gflags::ParseCommandLineFlags(&argc, &argv, true);
@@ -326,20 +874,68 @@ int main(int argc, char *argv[]) {
   FLAGS_logtostderr = 1;
 
   CHECK_GT(FLAGS_msg_size, sizeof(app_hdr_t)) << "Message size too small";
+  CHECK_GT(FLAGS_threads, 0);
+  CHECK(FLAGS_mode == "closed" || FLAGS_mode == "poisson" ||
+        FLAGS_mode == "fixed")
+      << "Unknown mode " << FLAGS_mode;
+  const bool replay = !FLAGS_trace_file.empty();
+  const bool open_loop = FLAGS_mode != "closed" || replay;
+  CHECK(FLAGS_output_format == "csv" || FLAGS_output_format == "json")
+      << "Unknown output format " << FLAGS_output_format;
   if (FLAGS_remote_ip == "") {
-    LOG(INFO) << "Starting in server mode, response size " << FLAGS_msg_size;
+    LOG(INFO) << "Starting in server mode, response size " << FLAGS_msg_size
+              << ", " << FLAGS_threads << " threads";
   } else {
     LOG(INFO) << "Starting in client mode, request size " << FLAGS_msg_size;
   }
 
+  // Open-loop request and response sizes.
+  auto parse_sizes = [](const std::string &flag, const std::string &spec) {
+    auto dist = SizeDistribution::Parse(spec);
+    CHECK(dist.has_value()) << "Malformed --" << flag << ": " << spec;
+    CHECK_GT(dist->min(), sizeof(app_hdr_t)) << "Message size too small";
+    CHECK_LE(dist->max(), MACHNET_MSG_MAX_LEN) << "Message size too large";
+    return dist.value();
+  };
+  auto req_sizes = FLAGS_msg_size_dist.empty()
+                       ? SizeDistribution::Fixed(FLAGS_msg_size)
+                       : parse_sizes("msg_size_dist", FLAGS_msg_size_dist);
+  std::optional<SizeDistribution> resp_sizes;
+  if (!FLAGS_resp_size_dist.empty()) {
+    resp_sizes = parse_sizes("resp_size_dist", FLAGS_resp_size_dist);
+  }
+
+  // Trace replay: the requests of each client thread.
+  std::vector<std::vector<ScheduledRequest>> trace_requests;
+  double target_rps = FLAGS_rps;
+  if (replay && FLAGS_remote_ip != "") {
+    CHECK_GT(FLAGS_flows_per_thread, 0);
+    CHECK_GT(FLAGS_trace_speed, 0);
+    auto requests = LoadTrace(FLAGS_trace_file, FLAGS_threads,
+                              FLAGS_flows_per_thread, FLAGS_trace_speed);
+    CHECK(requests.has_value()) << "Malformed trace " << FLAGS_trace_file;
+    trace_requests = std::move(requests.value());
+    size_t nb_requests = 0;
+    uint64_t span_ns = 1;
+    for (const auto &thread_requests : trace_requests) {
+      if (thread_requests.empty()) continue;
+      nb_requests += thread_requests.size();
+      span_ns = std::max(span_ns, thread_requests.back().offset_ns);
+    }
+    target_rps = nb_requests * 1E9 / span_ns;
+    LOG(INFO) << "Replaying " << nb_requests << " requests over "
+              << span_ns / 1E9 << " s from " << FLAGS_trace_file;
+  }
+
   CHECK_EQ(machnet_init(), 0) << "Failed to initialize Machnet library.";
-  void *channel_ctx = machnet_attach();
-  CHECK_NOTNULL(channel_ctx);
 
   MachnetFlow_t flow;
-  std::thread datapath_thread;
-  if (FLAGS_remote_ip != "") {
+  std::vector<std::unique_ptr<ThreadCtx>> thread_ctxs;
+  std::vector<std::thread> datapath_threads;
+  if (FLAGS_remote_ip != "" && !open_loop) {
     // Client-mode
+    void *channel_ctx = machnet_attach();
+    CHECK_NOTNULL(channel_ctx);
     int ret =
         machnet_connect(channel_ctx, FLAGS_local_ip.c_str(),
                         FLAGS_remote_ip.c_str(), FLAGS_remote_port, &flow);
@@ -350,21 +946,68 @@ int main(int argc, char *argv[]) {
     LOG(INFO) << "[CONNECTED] [" << FLAGS_local_ip << ":" << flow.src_port
               << " <-> " << FLAGS_remote_ip << ":" << flow.dst_port << "]";
 
-    datapath_thread = std::thread(ClientLoop, channel_ctx, &flow);
+    datapath_threads.emplace_back(ClientLoop, channel_ctx, &flow);
+  } else if (FLAGS_remote_ip != "") {
+    // Open-loop client mode: each thread has its own channel and flows, which
+    // are spread over the server's ports.
+    CHECK_GT(FLAGS_flows_per_thread, 0);
+    CHECK_GT(FLAGS_remote_ports, 0);
+    CHECK(replay || FLAGS_rps > 0) << "--rps must be positive";
+    for (uint32_t i = 0; i < FLAGS_threads; i++) {
+      void *channel_ctx = machnet_attach();
+      CHECK_NOTNULL(channel_ctx);
+      auto thread_ctx = std::make_unique<ThreadCtx>(channel_ctx, nullptr, i);
+      for (uint32_t j = 0; j < FLAGS_flows_per_thread; j++) {
+        const uint32_t flow_index = i * FLAGS_flows_per_thread + j;
+        const uint16_t remote_port =
+            FLAGS_remote_port + flow_index % FLAGS_remote_ports;
+        int ret =
+            machnet_connect(channel_ctx, FLAGS_local_ip.c_str(),
+                            FLAGS_remote_ip.c_str(), remote_port, &flow);
+        CHECK(ret == 0) << "Failed to connect to remote host. "
+                           "machnet_connect() error: "
+                        << strerror(ret);
+        LOG(INFO) << "[CONNECTED] [" << FLAGS_local_ip << ":" << flow.src_port
+                  << " <-> " << FLAGS_remote_ip << ":" << flow.dst_port
+                  << "]";
+        thread_ctx->AddOpenLoopFlow(flow);
+      }
+      thread_ctxs.push_back(std::move(thread_ctx));
+    }
+    for (auto &thread_ctx : thread_ctxs) {
+      const uint32_t thread_id = thread_ctx->thread_id;
+      auto schedule =
+          replay ? MakeTraceSchedule(std::move(trace_requests[thread_id]))
+                 : MakeRateSchedule(thread_id, FLAGS_rps / FLAGS_threads,
+                                    FLAGS_flows_per_thread, req_sizes,
+                                    resp_sizes);
+      datapath_threads.emplace_back(OpenLoopClientLoop, thread_ctx.get(),
+                                    std::move(schedule));
+    }
   } else {
-    int ret =
-        machnet_listen(channel_ctx, FLAGS_local_ip.c_str(), FLAGS_local_port);
-    CHECK(ret == 0)
-        << "Failed to listen on local port. machnet_listen() error: "
-        << strerror(ret);
-
-    LOG(INFO) << "[LISTENING] [" << FLAGS_local_ip << ":" << FLAGS_local_port
-              << "]";
-
-    datapath_thread = std::thread(ServerLoop, channel_ctx);
+    // Server mode: each thread has its own channel and port.
+    for (uint32_t i = 0; i < FLAGS_threads; i++) {
+      void *channel_ctx = machnet_attach();
+      CHECK_NOTNULL(channel_ctx);
+      const uint16_t local_port = FLAGS_local_port + i;
+      int ret =
+          machnet_listen(channel_ctx, FLAGS_local_ip.c_str(), local_port);
+      CHECK(ret == 0)
+          << "Failed to listen on local port. machnet_listen() error: "
+          << strerror(ret);
+
+      LOG(INFO) << "[LISTENING] [" << FLAGS_local_ip << ":" << local_port
+                << "]";
+
+      datapath_threads.emplace_back(ServerLoop, channel_ctx, i);
+    }
   }
 
-  while (g_keep_running) sleep(5);
-  datapath_thread.join();
+  // The threads run until SIGINT, or the end of an open-loop run.
+  for (auto &datapath_thread : datapath_threads) datapath_thread.join();
+  if (!thread_ctxs.empty()) {
+    ReportOpenLoopResults(thread_ctxs, replay ? "trace" : FLAGS_mode,
+                          target_rps);
+  }
   return 0;
 }
@@ -0,0 +1,645 @@
+/**
+ * @file engine_bench.cc
+ * @brief Micro-benchmarks of the engine's hot path: a `MachnetEngine' on a
+ * `net_ring' port is fed crafted packet bursts from synthetic peers, and the
+ * time `MachnetEngine::Run()' takes to process them is reported per packet
+ * (`ns_per_pkt'), for:
+ *   - data RX: single-packet messages, delivered to the channel and ACKed;
+ *   - ACK RX: ACKs for data the engine sent, acknowledging 1 to 32 packets;
+ *   - message TX: messages of several sizes, segmented and sent;
+ *   - flow lookup: stale ACKs spread over 10 to 100k established flows;
+ *   - connection setup: three-way handshakes initiated by the peers.
+ *
+ * Only the engine iterations are timed; crafting the packets, draining the
+ * TX ring and the application side of the channel are not. Use the usual
+ * Google Benchmark flags for machine-readable results, e.g.:
+ *   engine_bench --benchmark_out=engine.json --benchmark_out_format=json
+ */
+#include <benchmark/benchmark.h>
+#include <channel.h>
+#include <dpdk.h>
+#include <ether.h>
+#include <glog/logging.h>
+#include <ipv4.h>
+#include <machnet.h>
+#include <machnet_common.h>
+#include <machnet_engine.h>
+#include <machnet_pkthdr.h>
+#include <packet.h>
+#include <packet_pool.h>
+#include <pmd.h>
+#include <rte_errno.h>
+#include <rte_eth_ring.h>
+#include <rte_lcore.h>
+#include <rte_ring.h>
+#include <ttime.h>
+#include <udp.h>
+#include <utils.h>
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <numeric>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+
+using juggler::MachnetEngine;
+using juggler::MachnetEngineSharedState;
+using juggler::dpdk::Packet;
+using juggler::dpdk::PacketPool;
+using juggler::dpdk::PmdPort;
+using juggler::net::Ethernet;
+using juggler::net::Ipv4;
+using juggler::net::MachnetPktHdr;
+using juggler::net::Udp;
+using juggler::net::swift::Pcb;
+using Flags = MachnetPktHdr::MachnetFlags;
+
+/**
+ * @brief A `MachnetEngine' with one channel and a listener, on a `net_ring'
+ * port whose rings the benchmarks fill and drain directly: packets from
+ * synthetic peers are injected in its RX ring, and what the engine sends is
+ * read back from its TX ring and freed, as a `net_null' port would.
+ *
+ * Peer `i' sends from port `kPeerPortMin + i % kPortsPerPeer' of address
+ * `kPeerAddrBase + i / kPortsPerPeer', so the flows of a benchmark can be
+ * told apart from the packets the engine sends them.
+ *
+ * The engine runs on a clock of its own (`kTscHz'), which only moves with
+ * `Tick()'; in between, iterations never run the slow timer.
+ */
+class EngineHarness {
+ public:
+  static constexpr uint64_t kTscHz = 1000000000;
+  static constexpr uint32_t kRingSize = 4096;
+  static constexpr uint32_t kRingDescNr = 1024;
+  static constexpr uint32_t kPoolSize = kRingSize - 1;
+  static constexpr uint16_t kBurstSize = juggler::dpdk::PacketBatch::kMaxBurst;
+  static constexpr uint16_t kListenPort = 888;
+  static constexpr uint32_t kLocalAddr = 0x0a000001;     // 10.0.0.1
+  static constexpr uint32_t kPeerAddrBase = 0x0a010000;  // 10.1.0.0
+  static constexpr uint16_t kPeerPortMin = 1024;
+  static constexpr uint32_t kPortsPerPeer = UINT16_MAX + 1 - kPeerPortMin;
+  static constexpr size_t kHdrLen = sizeof(Ethernet) + sizeof(Ipv4) +
+                                    sizeof(Udp) + sizeof(MachnetPktHdr);
+  // Largest payload of a packet, and size of the channel's buffers.
+  static constexpr size_t kMaxPayload =
+      juggler::dpdk::PmdRing::kDefaultFrameSize - sizeof(Ipv4) - sizeof(Udp) -
+      sizeof(MachnetPktHdr);
+
+  /**
+   * @brief The peer's end of a flow.
+   */
+  struct Peer {
+    Ipv4::Address addr;
+    Udp::Port port;
+    uint32_t snd_nxt;  // Next sequence number to send.
+    uint32_t rcv_nxt;  // Next sequence number expected from the engine.
+  };
+
+  EngineHarness() : local_addr_(kLocalAddr) {
+    juggler::time::tsc_hz = kTscHz;
+
+    // Ring, port and channel names must be unique in the process.
+    static uint32_t next_id = 0;
+    const auto id = next_id++;
+    const auto prefix = juggler::utils::Format("enginebench%u", id);
+    const auto socket_id = static_cast<int>(rte_socket_id());
+    rx_ring_ = rte_ring_create((prefix + "_rx").c_str(), kRingSize, socket_id,
+                               RING_F_SP_ENQ | RING_F_SC_DEQ);
+    tx_ring_ = rte_ring_create((prefix + "_tx").c_str(), kRingSize, socket_id,
+                               RING_F_SP_ENQ | RING_F_SC_DEQ);
+    CHECK(rx_ring_ != nullptr && tx_ring_ != nullptr)
+        << "Failed to create the rings of " << prefix << ": "
+        << rte_strerror(rte_errno);
+    const int port_id = rte_eth_from_rings(("net_ring_" + prefix).c_str(),
+                                           &rx_ring_, 1, &tx_ring_, 1,
+                                           socket_id);
+    CHECK_GE(port_id, 0) << "Failed to create port " << prefix << ": "
+                         << rte_strerror(rte_errno);
+
+    pool_ = std::make_unique<PacketPool>(kPoolSize);
+    pmd_port_ = std::make_shared<PmdPort>(static_cast<uint16_t>(port_id), 1, 1,
+                                          kRingDescNr, kRingDescNr);
+    pmd_port_->InitDriver();
+    shared_state_ = std::make_shared<MachnetEngineSharedState>(
+        pmd_port_->GetRSSKey(), pmd_port_->GetL2Addr(),
+        std::vector<Ipv4::Address>{local_addr_});
+    CHECK(channel_manager_.AddChannel(
+        prefix.c_str(), juggler::shm::ChannelManager<>::kDefaultRingSize,
+        juggler::shm::ChannelManager<>::kDefaultRingSize,
+        juggler::shm::ChannelManager<>::kDefaultBufferCount, kMaxPayload))
+        << "Failed to create channel " << prefix;
+    channel_ = channel_manager_.GetChannel(prefix.c_str());
+    engine_ = std::make_unique<MachnetEngine>(
+        pmd_port_, 0, 0, shared_state_,
+        std::vector<std::shared_ptr<juggler::shm::Channel>>{channel_});
+    Listen();
+  }
+  EngineHarness(const EngineHarness &) = delete;
+  EngineHarness &operator=(const EngineHarness &) = delete;
+
+  ~EngineHarness() {
+    FreeAll(rx_ring_);
+    FreeAll(tx_ring_);
+    // The engine uses the port, which uses the rings.
+    engine_.reset();
+    pmd_port_.reset();
+    rte_ring_free(rx_ring_);
+    rte_ring_free(tx_ring_);
+  }
+
+  const void *GetChannelCtx() const { return channel_->ctx(); }
+
+  static Peer MakePeer(uint32_t index) {
+    return {Ipv4::Address(kPeerAddrBase + index / kPortsPerPeer),
+            Udp::Port(static_cast<uint16_t>(kPeerPortMin +
+                                            index % kPortsPerPeer)),
+            index * 7919, 0};
+  }
+
+  /**
+   * @return The flow of a peer, as the application sees it.
+   */
+  static MachnetFlow_t GetAppFlow(const Peer &peer) {
+    MachnetFlow_t flow = {};
+    flow.src_ip = kLocalAddr;
+    flow.dst_ip = peer.addr.address.value();
+    flow.src_port = kListenPort;
+    flow.dst_port = peer.port.port.value();
+    return flow;
+  }
+
+  /**
+   * @brief Crafts a packet from a peer.
+   */
+  Packet *MakePacket(const Peer &peer, Flags net_flags, uint32_t seqno,
+                     uint32_t ackno, uint16_t payload_len = 0,
+                     uint8_t msg_flags = 0, uint64_t timestamp = 0) {
+    auto *packet = CHECK_NOTNULL(pool_->PacketAlloc());
+    const uint16_t len = kHdrLen + payload_len;
+    auto *eh = CHECK_NOTNULL(packet->append<Ethernet *>(len));
+    eh->src_addr = kPeerL2Addr;
+    eh->dst_addr = pmd_port_->GetL2Addr();
+    eh->eth_type = juggler::be16_t(Ethernet::kIpv4);
+
+    auto *ipv4h = reinterpret_cast<Ipv4 *>(eh + 1);
+    ipv4h->version_ihl = 0x45;
+    ipv4h->type_of_service = 0;
+    ipv4h->packet_id = juggler::be16_t(0x1513);
+    ipv4h->fragment_offset = juggler::be16_t(0);
+    ipv4h->time_to_live = 64;
+    ipv4h->next_proto_id = Ipv4::Proto::kUdp;
+    ipv4h->total_length = juggler::be16_t(len - sizeof(Ethernet));
+    ipv4h->src_addr = peer.addr;
+    ipv4h->dst_addr = local_addr_;
+    ipv4h->hdr_checksum = 0;
+
+    auto *udph = reinterpret_cast<Udp *>(ipv4h + 1);
+    udph->src_port = peer.port;
+    udph->dst_port = Udp::Port(kListenPort);
+    udph->len = juggler::be16_t(len - sizeof(Ethernet) - sizeof(Ipv4));
+    udph->cksum = juggler::be16_t(0);
+
+    auto *machneth = reinterpret_cast<MachnetPktHdr *>(udph + 1);
+    std::memset(machneth, 0, sizeof(*machneth));
+    machneth->magic = juggler::be16_t(MachnetPktHdr::kMagic);
+    machneth->net_flags = net_flags;
+    machneth->msg_flags = msg_flags;
+    machneth->seqno = juggler::be32_t(seqno);
+    machneth->ackno = juggler::be32_t(ackno);
+    machneth->timestamp1 = juggler::be64_t(timestamp);
+    return packet;
+  }
+
+  /**
+   * @brief Queues packets for the engine to receive.
+   */
+  void Inject(Packet **packets, uint16_t count) {
+    CHECK_EQ(rte_ring_sp_enqueue_burst(
+                 rx_ring_, reinterpret_cast<void **>(packets), count, nullptr),
+             count)
+        << "RX ring full.";
+  }
+
+  /**
+   * @brief Runs an iteration of the engine.
+   *
+   * @return How long it took, in nanoseconds.
+   */
+  uint64_t Run() {
+    const auto start = std::chrono::steady_clock::now();
+    engine_->Run(now_);
+    const auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(end - start)
+        .count();
+  }
+
+  /**
+   * @brief Advances the clock to the next slow tick, and runs the engine
+   * (e.g., to process control requests or to remove closed flows).
+   */
+  void Tick() {
+    now_ += juggler::time::s_to_cycles(1);
+    engine_->Run(now_);
+  }
+
+  /**
+   * @brief Frees the packets the engine sent, after passing the Machnet ones
+   * to `fn(peer_index, machneth)'.
+   *
+   * @return The number of Machnet packets.
+   */
+  template <typename F>
+  size_t DrainTx(F &&fn) {
+    size_t nb_machnet = 0;
+    std::array<Packet *, kBurstSize> packets;
+    unsigned int nb_tx;
+    do {
+      nb_tx = rte_ring_sc_dequeue_burst(
+          tx_ring_, reinterpret_cast<void **>(packets.data()), packets.size(),
+          nullptr);
+      for (unsigned int i = 0; i < nb_tx; i++) {
+        auto *packet = packets[i];
+        const auto *eh = packet->head_data<Ethernet *>();
+        if (packet->length() >= kHdrLen &&
+            eh->eth_type.value() == Ethernet::kIpv4) {
+          const auto *ipv4h = reinterpret_cast<const Ipv4 *>(eh + 1);
+          const auto *udph = reinterpret_cast<const Udp *>(ipv4h + 1);
+          const auto index =
+              (ipv4h->dst_addr.address.value() - kPeerAddrBase) *
+                  kPortsPerPeer +
+              udph->dst_port.port.value() - kPeerPortMin;
+          fn(index, reinterpret_cast<const MachnetPktHdr *>(udph + 1));
+          nb_machnet++;
+        }
+        Packet::Free(packet);
+      }
+    } while (nb_tx == packets.size());
+    return nb_machnet;
+  }
+
+  size_t DrainTx() {
+    return DrainTx([](uint32_t, const MachnetPktHdr *) {});
+  }
+
+  /**
+   * @brief Receives the messages the engine delivered to the channel.
+   *
+   * @return The number of messages.
+   */
+  size_t ReceiveMessages() {
+    size_t nb_msgs = 0;
+    MachnetFlow_t flow;
+    while (machnet_recv(channel_->ctx(), rx_buf_.data(), rx_buf_.size(),
+                        &flow) > 0) {
+      nb_msgs++;
+    }
+    return nb_msgs;
+  }
+
+  /**
+   * @brief Establishes the flows of peers `[first, first + count)', through
+   * three-way handshakes they initiate.
+   *
+   * @param elapsed_ns If not null, incremented by the time the engine took.
+   * @return The peers.
+   */
+  std::vector<Peer> Accept(uint32_t first, uint32_t count,
+                           uint64_t *elapsed_ns = nullptr) {
+    std::vector<Peer> peers;
+    peers.reserve(count);
+    std::array<Packet *, kBurstSize> packets;
+    uint64_t ns = 0;
+    for (uint32_t i = 0; i < count; i += kBurstSize) {
+      const uint16_t burst = std::min<uint32_t>(kBurstSize, count - i);
+      for (uint16_t j = 0; j < burst; j++) {
+        auto &peer = peers.emplace_back(MakePeer(first + i + j));
+        packets[j] = MakePacket(peer, Flags::kSyn, peer.snd_nxt++, 0);
+      }
+      Inject(packets.data(), burst);
+      ns += Run();
+
+      uint16_t nb_acks = 0;
+      DrainTx([&](uint32_t index, const MachnetPktHdr *machneth) {
+        if (machneth->net_flags != Flags::kSynAck) return;
+        CHECK_LT(index - first, peers.size());
+        auto &peer = peers[index - first];
+        peer.rcv_nxt = machneth->seqno.value() + 1;
+        packets[nb_acks++] =
+            MakePacket(peer, Flags::kAck, peer.snd_nxt, peer.rcv_nxt);
+      });
+      CHECK_EQ(nb_acks, burst) << "Missing SYN-ACKs.";
+      Inject(packets.data(), nb_acks);
+      ns += Run();
+      DrainTx();
+    }
+    if (elapsed_ns != nullptr) *elapsed_ns += ns;
+    return peers;
+  }
+
+  /**
+   * @brief Resets the flows of peers, and removes them from the engine.
+   */
+  void Close(const std::vector<Peer> &peers) {
+    std::array<Packet *, kBurstSize> packets;
+    for (size_t i = 0; i < peers.size(); i += kBurstSize) {
+      const uint16_t burst = std::min<size_t>(kBurstSize, peers.size() - i);
+      for (uint16_t j = 0; j < burst; j++) {
+        const auto &peer = peers[i + j];
+        packets[j] =
+            MakePacket(peer, Flags::kRst, peer.snd_nxt, peer.rcv_nxt);
+      }
+      Inject(packets.data(), burst);
+      Run();
+    }
+    // Closed flows are removed on the slow timer.
+    Tick();
+    DrainTx();
+  }
+
+ private:
+  static inline const Ethernet::Address kPeerL2Addr{"02:00:00:00:00:01"};
+
+  static void FreeAll(rte_ring *ring) {
+    void *obj;
+    while (rte_ring_sc_dequeue(ring, &obj) == 0) {
+      rte_pktmbuf_free(static_cast<rte_mbuf *>(obj));
+    }
+  }
+
+  void Listen() {
+    auto *ctx = channel_->ctx();
+    MachnetCtrlQueueEntry_t req = {};
+    req.id = ctx->ctrl_ctx.req_id++;
+    req.opcode = MACHNET_CTRL_OP_LISTEN;
+    req.listener_info.ip = kLocalAddr;
+    req.listener_info.port = kListenPort;
+    CHECK_EQ(__machnet_channel_ctrl_sq_enqueue(ctx, 1, &req), 1);
+
+    // Control requests are processed on the slow timer.
+    MachnetCtrlQueueEntry_t resp;
+    bool done = false;
+    for (int i = 0; i < 10 && !done; i++) {
+      Tick();
+      done = __machnet_channel_ctrl_cq_dequeue(ctx, 1, &resp) == 1;
+    }
+    CHECK(done && resp.id == req.id && resp.status == MACHNET_CTRL_STATUS_OK)
+        << "Failed to listen.";
+    DrainTx();
+  }
+
+  const Ipv4::Address local_addr_;
+  uint64_t now_{0};
+  rte_ring *rx_ring_{nullptr};
+  rte_ring *tx_ring_{nullptr};
+  // Pool of the packets from the peers.
+  std::unique_ptr<PacketPool> pool_;
+  juggler::shm::ChannelManager<> channel_manager_;
+  std::shared_ptr<juggler::shm::Channel> channel_;
+  std::shared_ptr<PmdPort> pmd_port_;
+  std::shared_ptr<MachnetEngineSharedState> shared_state_;
+  std::unique_ptr<MachnetEngine> engine_;
+  std::array<uint8_t, kMaxPayload> rx_buf_;
+};
+
+constexpr uint16_t kBurstSize = EngineHarness::kBurstSize;
+constexpr uint8_t kSinglePacketMsg =
+    MACHNET_MSGBUF_FLAGS_SYN | MACHNET_MSGBUF_FLAGS_FIN;
+
+// Reports the engine time per event (e.g., packet) processed.
+void ReportTimePer(benchmark::State &state, const char *name,
+                   uint64_t total_ns, uint64_t events) {
+  state.counters[name] =
+      events == 0 ? 0 : static_cast<double>(total_ns) / events;
+}
+
+// Data packets from one peer, each carrying a message of the given size.
+void BM_DataRx(benchmark::State &state) {  // NOLINT
+  const auto payload_len = static_cast<uint16_t>(state.range(0));
+  EngineHarness harness;
+  auto peer = harness.Accept(0, 1).front();
+
+  std::array<Packet *, kBurstSize> packets;
+  uint64_t total_ns = 0;
+  uint64_t nb_pkts = 0;
+  uint64_t nb_msgs = 0;
+  for (auto _ : state) {
+    for (auto &packet : packets) {
+      packet = harness.MakePacket(peer, Flags::kData, peer.snd_nxt++,
+                                  peer.rcv_nxt, payload_len, kSinglePacketMsg);
+    }
+    harness.Inject(packets.data(), packets.size());
+    const auto ns = harness.Run();
+    state.SetIterationTime(ns / 1E9);
+    total_ns += ns;
+    nb_pkts += packets.size();
+
+    harness.DrainTx();
+    nb_msgs += harness.ReceiveMessages();
+  }
+  if (nb_msgs != nb_pkts) state.SkipWithError("Messages were not delivered.");
+  ReportTimePer(state, "ns_per_pkt", total_ns, nb_pkts);
+  state.SetItemsProcessed(nb_pkts);
+  state.SetBytesProcessed(nb_pkts * payload_len);
+}
+BENCHMARK(BM_DataRx)
+    ->UseManualTime()
+    ->ArgName("size")
+    ->Arg(64)
+    ->Arg(512)
+    ->Arg(EngineHarness::kMaxPayload);
+
+// ACKs for bursts of data packets the engine sent, each acknowledging the
+// given number of packets.
+void BM_AckRx(benchmark::State &state) {  // NOLINT
+  const auto pkts_per_ack = static_cast<uint32_t>(state.range(0));
+  EngineHarness harness;
+  auto peer = harness.Accept(0, 1).front();
+  const auto flow = EngineHarness::GetAppFlow(peer);
+
+  std::vector<uint8_t> msg(64);
+  std::vector<std::pair<uint32_t, uint64_t>> sent;  // Seqno, timestamp.
+  std::array<Packet *, kBurstSize> acks;
+  uint64_t total_ns = 0;
+  uint64_t nb_acks = 0;
+  for (auto _ : state) {
+    for (uint16_t i = 0; i < kBurstSize; i++) {
+      if (machnet_send(harness.GetChannelCtx(), flow, msg.data(),
+                       msg.size()) != 0) {
+        state.SkipWithError("Failed to send message.");
+        break;
+      }
+    }
+    harness.Run();
+    sent.clear();
+    harness.DrainTx([&sent](uint32_t, const MachnetPktHdr *machneth) {
+      if (machneth->net_flags != Flags::kData) return;
+      sent.emplace_back(machneth->seqno.value(), machneth->timestamp1.value());
+    });
+    if (sent.empty()) {
+      state.SkipWithError("No data sent.");
+      break;
+    }
+
+    uint16_t burst = 0;
+    for (size_t i = 0; i < sent.size(); i++) {
+      if ((i + 1) % pkts_per_ack != 0 && i + 1 != sent.size()) continue;
+      acks[burst++] = harness.MakePacket(peer, Flags::kAck, peer.snd_nxt,
+                                         sent[i].first + 1, 0, 0,
+                                         sent[i].second);
+    }
+    harness.Inject(acks.data(), burst);
+    const auto ns = harness.Run();
+    state.SetIterationTime(ns / 1E9);
+    total_ns += ns;
+    nb_acks += burst;
+    harness.DrainTx();
+  }
+  ReportTimePer(state, "ns_per_ack", total_ns, nb_acks);
+  state.SetItemsProcessed(nb_acks);
+}
+BENCHMARK(BM_AckRx)
+    ->UseManualTime()
+    ->ArgName("pkts_per_ack")
+    ->Arg(1)
+    ->Arg(8)
+    ->Arg(32);
+
+// Messages of the given size from the application, as many as fit in the
+// initial congestion window.
+void BM_MsgTx(benchmark::State &state) {  // NOLINT
+  const auto msg_size = static_cast<size_t>(state.range(0));
+  const auto pkts_per_msg =
+      (msg_size + EngineHarness::kMaxPayload - 1) / EngineHarness::kMaxPayload;
+  const auto msgs_per_burst =
+      std::max<size_t>(1, Pcb::kInitialCwnd / pkts_per_msg);
+  EngineHarness harness;
+  auto peer = harness.Accept(0, 1).front();
+  const auto flow = EngineHarness::GetAppFlow(peer);
+
+  std::vector<uint8_t> msg(msg_size, 0xaa);
+  uint64_t total_ns = 0;
+  uint64_t nb_pkts = 0;
+  uint64_t nb_msgs = 0;
+  for (auto _ : state) {
+    for (size_t i = 0; i < msgs_per_burst; i++) {
+      if (machnet_send(harness.GetChannelCtx(), flow, msg.data(),
+                       msg.size()) != 0) {
+        state.SkipWithError("Failed to send message.");
+        break;
+      }
+    }
+    const auto ns = harness.Run();
+    state.SetIterationTime(ns / 1E9);
+    total_ns += ns;
+    nb_msgs += msgs_per_burst;
+
+    // Acknowledge everything at once, for the window to open again.
+    uint32_t last_seqno = 0;
+    nb_pkts += harness.DrainTx(
+        [&last_seqno](uint32_t, const MachnetPktHdr *machneth) {
+          last_seqno = machneth->seqno.value();
+        });
+    auto *ack = harness.MakePacket(peer, Flags::kAck, peer.snd_nxt,
+                                   last_seqno + 1);
+    harness.Inject(&ack, 1);
+    harness.Run();
+    harness.DrainTx();
+  }
+  if (nb_pkts != nb_msgs * pkts_per_msg) {
+    state.SkipWithError("Messages were not sent in one go.");
+  }
+  ReportTimePer(state, "ns_per_pkt", total_ns, nb_pkts);
+  ReportTimePer(state, "ns_per_msg", total_ns, nb_msgs);
+  state.SetItemsProcessed(nb_pkts);
+  state.SetBytesProcessed(nb_msgs * msg_size);
+}
+BENCHMARK(BM_MsgTx)
+    ->UseManualTime()
+    ->ArgName("size")
+    ->Arg(64)
+    ->Arg(1024)
+    ->Arg(4096)
+    ->Arg(16384)
+    ->Arg(32768);
+
+// Stale ACKs, which are dropped right after the flow lookup, spread at random
+// over the given number of established flows.
+void BM_FlowLookup(benchmark::State &state) {  // NOLINT
+  const auto nb_flows = static_cast<uint32_t>(state.range(0));
+  EngineHarness harness;
+  const auto peers = harness.Accept(0, nb_flows);
+
+  std::vector<uint32_t> order(nb_flows);
+  std::iota(order.begin(), order.end(), 0);
+  std::shuffle(order.begin(), order.end(), std::mt19937{1});
+  size_t next = 0;
+  std::array<Packet *, kBurstSize> packets;
+  uint64_t total_ns = 0;
+  uint64_t nb_pkts = 0;
+  for (auto _ : state) {
+    for (auto &packet : packets) {
+      const auto &peer = peers[order[next]];
+      if (++next == order.size()) next = 0;
+      packet = harness.MakePacket(peer, Flags::kAck, peer.snd_nxt,
+                                  peer.rcv_nxt - 1);
+    }
+    harness.Inject(packets.data(), packets.size());
+    const auto ns = harness.Run();
+    state.SetIterationTime(ns / 1E9);
+    total_ns += ns;
+    nb_pkts += packets.size();
+  }
+  if (harness.DrainTx() != 0) state.SkipWithError("Stale ACKs were answered.");
+  ReportTimePer(state, "ns_per_pkt", total_ns, nb_pkts);
+  state.SetItemsProcessed(nb_pkts);
+}
+BENCHMARK(BM_FlowLookup)
+    ->UseManualTime()
+    ->ArgName("flows")
+    ->RangeMultiplier(10)
+    ->Range(10, 100000);
+
+// Bursts of handshakes from new peers; the flows are reset and removed after
+// each burst, untimed.
+void BM_ConnSetup(benchmark::State &state) {  // NOLINT
+  EngineHarness harness;
+  uint32_t next_peer = 0;
+  uint64_t total_ns = 0;
+  uint64_t nb_conns = 0;
+  for (auto _ : state) {
+    uint64_t ns = 0;
+    const auto peers = harness.Accept(next_peer, kBurstSize, &ns);
+    state.SetIterationTime(ns / 1E9);
+    total_ns += ns;
+    nb_conns += peers.size();
+    next_peer += peers.size();
+    harness.Close(peers);
+  }
+  ReportTimePer(state, "ns_per_conn", total_ns, nb_conns);
+  ReportTimePer(state, "ns_per_pkt", total_ns, 2 * nb_conns);
+  state.SetItemsProcessed(nb_conns);
+}
+BENCHMARK(BM_ConnSetup)->UseManualTime();
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  google::InitGoogleLogging(argv[0]);
+  benchmark::Initialize(&argc, argv);
+  if (benchmark::ReportUnrecognizedArguments(argc, argv)) return 1;
+
+  auto d = juggler::dpdk::Dpdk();
+  d.InitDpdk(juggler::utils::CmdLineOpts(
+      {"", "-c", "0x0", "-n", "6", "--proc-type=auto", "-m", "1024",
+       "--log-level", "8", "--no-pci"}));
+  benchmark::RunSpecifiedBenchmarks();
+  return 0;
+}
@@ -0,0 +1,472 @@
+/**
+ * @file flow_bench.cc
+ * @brief Micro-benchmarks of the transport state machine: `RXTracking::Consume'
+ * (reassembly and SACK bookkeeping) and `Flow::process_ack' (ACK, fast
+ * retransmit and SACK recovery) are fed crafted `MachnetPktHdr' sequences,
+ * with no NIC involved: packets are built in memory, delivered messages land
+ * in a local channel, and retransmissions are staged on a TX ring that is
+ * never flushed.
+ *
+ * Each sequence covers one window and ends with everything delivered or
+ * acknowledged, so that every iteration starts from the same state. Per event
+ * (packet or ACK), the benchmarks report the TSC cycles spent
+ * (`cycles_per_event') and the allocations made: heap (`heap_allocs'),
+ * channel buffers (`msgbufs') and packets (`mbufs'), the latter for
+ * retransmissions.
+ */
+#include <benchmark/benchmark.h>
+#include <dpdk.h>
+#include <glog/logging.h>
+#include <machnet.h>
+#include <machnet_common.h>
+#include <rte_bus_pci.h>
+#include <rte_ethdev.h>
+#include <ttime.h>
+#include <utils.h>
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <numeric>
+#include <optional>
+#include <queue>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "capture_tap.h"
+#include "channel.h"
+#include "machnet_pkthdr.h"
+#include "packet_pool.h"
+#include "trace.h"
+
+// The benchmarks reach into the flow and its TX ring.
+#define private public
+#include "pmd.h"
+#include "flow.h"
+
+// Heap allocations of the process; the benchmarks report the ones made while
+// processing events.
+static uint64_t heap_allocs = 0;
+
+void *operator new(size_t size) {
+  heap_allocs++;
+  void *ptr = std::malloc(size == 0 ? 1 : size);
+  if (ptr == nullptr) std::abort();
+  return ptr;
+}
+void operator delete(void *ptr) noexcept { std::free(ptr); }
+void operator delete(void *ptr, size_t) noexcept { std::free(ptr); }
+
+namespace juggler {
+namespace net {
+namespace flow {
+namespace {
+
+enum Scenario : int64_t {
+  kInOrder = 0,
+  kReversed,
+  kRandom,     // Random reordering within the window.
+  kDupStorm,   // Every packet, or the same ACK, many times over.
+  kSackHoles,  // Every 4th packet lost, and recovered at the end.
+};
+
+const char *ScenarioName(int64_t scenario) {
+  switch (scenario) {
+    case kInOrder:
+      return "in_order";
+    case kReversed:
+      return "reversed";
+    case kRandom:
+      return "random";
+    case kDupStorm:
+      return "dup_storm";
+    case kSackHoles:
+      return "sack_holes";
+    default:
+      return "unknown";
+  }
+}
+
+/**
+ * @brief The counters of a benchmark, reported per event.
+ */
+struct EventCounters {
+  uint64_t events{0};
+  uint64_t cycles{0};
+  uint64_t heap_allocs{0};
+  uint64_t msgbufs{0};
+  uint64_t mbufs{0};
+
+  void Report(benchmark::State &state) const {
+    auto per_event = [this](uint64_t count) {
+      return events == 0 ? 0 : static_cast<double>(count) / events;
+    };
+    state.counters["cycles_per_event"] = per_event(cycles);
+    state.counters["heap_allocs"] = per_event(heap_allocs);
+    state.counters["msgbufs"] = per_event(msgbufs);
+    state.counters["mbufs"] = per_event(mbufs);
+    state.SetItemsProcessed(events);
+  }
+};
+
+/**
+ * @brief A flow and the receive side of another one, on a local channel. The
+ * flow's TX ring has a packet pool but no port: the retransmissions it stages
+ * are released before a full burst accumulates, so it never sends.
+ */
+class FlowBench {
+ public:
+  static constexpr size_t kPayloadSize = 64;
+  static constexpr uint32_t kChannelRingSize = 1 << 10;
+  static constexpr uint32_t kBufferRingSize = 1 << 12;
+  static constexpr uint32_t kBufferSize = 1 << 11;
+  static constexpr uint32_t kMbufsNr = (1 << 12) - 1;
+  // Packets of a receive window, and segments in flight in an ACK window.
+  static constexpr uint32_t kRxWindow =
+      RXTracking::kReassemblyMaxSeqnoDistance;
+  static constexpr uint32_t kTxWindow = swift::Pcb::kInitialCwnd;
+  // Staged retransmissions are released once that many are pending.
+  static constexpr uint16_t kStagedMax = dpdk::PacketBatch::kMaxBurst / 2;
+
+  FlowBench()
+      : local_addr_(0x0a000001),
+        local_port_(888),
+        remote_addr_(0x0a000002),
+        remote_port_(1234) {
+    static uint32_t next_id = 0;
+    const auto name = utils::Format("flowbench%u", next_id++);
+    CHECK(channel_mgr_.AddChannel(name.c_str(), kChannelRingSize,
+                                  kChannelRingSize, kBufferRingSize,
+                                  kBufferSize));
+    channel_ = channel_mgr_.GetChannel(name.c_str());
+    rx_tracking_ = std::make_unique<RXTracking>(
+        local_addr_.address.value(), local_port_.port.value(),
+        remote_addr_.address.value(), remote_port_.port.value(),
+        channel_.get());
+
+    pkt_pool_ = std::make_unique<dpdk::PacketPool>(
+        kMbufsNr, dpdk::PmdRing::kDefaultFrameSize + RTE_ETHER_HDR_LEN +
+                      RTE_ETHER_CRC_LEN + RTE_PKTMBUF_HEADROOM);
+    txring_ = std::make_unique<dpdk::TxRing>(
+        nullptr, 0, 0, dpdk::PmdRing::kDefaultRingDescNr, rte_eth_txconf{},
+        kMbufsNr,
+        dpdk::PmdRing::kDefaultFrameSize + RTE_ETHER_HDR_LEN +
+            RTE_ETHER_CRC_LEN + RTE_PKTMBUF_HEADROOM);
+    tracer_ = std::make_unique<Tracer>();
+    flow_ = std::make_unique<Flow>(
+        local_addr_, local_port_, remote_addr_, remote_port_,
+        Ethernet::Address("02:00:00:00:00:01"),
+        Ethernet::Address("02:00:00:00:00:02"), txring_.get(), tracer_.get(),
+        [](shm::Channel *, bool, const Key &) {}, channel_.get());
+    flow_->state_ = Flow::State::kEstablished;
+  }
+
+  ~FlowBench() {
+    flow_.reset();
+    txring_.reset();
+    for (auto *packet : packets_) dpdk::Packet::Free(packet);
+  }
+
+  /**
+   * @brief Builds the data packets of a receive window, in sequence order.
+   */
+  void MakeRxWindow() {
+    constexpr size_t kHdrLen = sizeof(Ethernet) + sizeof(Ipv4) + sizeof(Udp);
+    for (uint32_t seqno = 0; seqno < kRxWindow; seqno++) {
+      auto *packet = CHECK_NOTNULL(pkt_pool_->PacketAlloc());
+      auto *data = CHECK_NOTNULL(packet->append<uint8_t *>(
+          kHdrLen + sizeof(MachnetPktHdr) + kPayloadSize));
+      auto *machneth = reinterpret_cast<MachnetPktHdr *>(data + kHdrLen);
+      machneth->magic = be16_t(MachnetPktHdr::kMagic);
+      machneth->net_flags = MachnetPktHdr::MachnetFlags::kData;
+      machneth->msg_flags = MACHNET_MSGBUF_FLAGS_SYN | MACHNET_MSGBUF_FLAGS_FIN;
+      machneth->seqno = be32_t(seqno);
+      std::fill_n(reinterpret_cast<uint8_t *>(machneth + 1), kPayloadSize,
+                  static_cast<uint8_t>(seqno));
+      packets_.push_back(packet);
+    }
+  }
+
+  /**
+   * @brief Feeds the packets of the receive window to `RXTracking::Consume()'
+   * in the given order, from a fresh PCB.
+   */
+  void Consume(const std::vector<uint32_t> &order, EventCounters *counters) {
+    swift::Pcb pcb;
+    const auto free_bufs = channel_->GetFreeBufCount();
+    const auto allocs = heap_allocs;
+    const auto start = time::rdtsc();
+    for (const auto seqno : order) {
+      rx_tracking_->Consume(&pcb, packets_[seqno]);
+    }
+    counters->cycles += time::rdtsc() - start;
+    counters->heap_allocs += heap_allocs - allocs;
+    counters->msgbufs += free_bufs - channel_->GetFreeBufCount();
+    counters->events += order.size();
+    CHECK_EQ(pcb.rcv_nxt, kRxWindow) << "Window not delivered.";
+  }
+
+  /**
+   * @return The number of messages received by the application.
+   */
+  size_t ReceiveMessages() {
+    size_t nb_msgs = 0;
+    MachnetFlow_t flow;
+    uint8_t buf[kPayloadSize];
+    while (machnet_recv(channel_->ctx(), buf, sizeof(buf), &flow) > 0) {
+      nb_msgs++;
+    }
+    return nb_msgs;
+  }
+
+  /**
+   * @brief Resets the flow to a window of single-segment messages that have
+   * been sent but not acknowledged yet.
+   */
+  void SendTxWindow() {
+    CHECK_EQ(flow_->tx_tracking_.NumTrackedSegments(), 0);
+    flow_->pcb_ = swift::Pcb();
+    for (uint32_t i = 0; i < kTxWindow; i++) {
+      auto *msgbuf = CHECK_NOTNULL(channel_->MsgBufAlloc());
+      CHECK_NOTNULL(msgbuf->append(kPayloadSize));
+      msgbuf->set_msg_length(kPayloadSize);
+      msgbuf->set_last(msgbuf->index());
+      msgbuf->mark_first();
+      msgbuf->mark_last();
+      flow_->tx_tracking_.Append(msgbuf);
+    }
+    for (uint32_t i = 0; i < kTxWindow; i++) {
+      CHECK(flow_->tx_tracking_.GetAndUpdateOldestUnsent().has_value());
+    }
+    flow_->pcb_.snd_nxt = kTxWindow;
+    flow_->pcb_.rto_enable();
+  }
+
+  /**
+   * @brief Feeds ACKs to `Flow::process_ack()'.
+   */
+  void ProcessAcks(const std::vector<MachnetPktHdr> &acks,
+                   EventCounters *counters) {
+    auto *txring = flow_->txring_;
+    const auto allocs = heap_allocs;
+    uint64_t mbufs = 0;
+    const auto start = time::rdtsc();
+    for (const auto &ack : acks) {
+      flow_->process_ack(&ack);
+      if (txring->GetStagedCount() >= kStagedMax) [[unlikely]] {
+        mbufs += txring->GetStagedCount();
+        txring->staged_.Release();
+      }
+    }
+    counters->cycles += time::rdtsc() - start;
+    counters->heap_allocs += heap_allocs - allocs;
+    mbufs += txring->GetStagedCount();
+    txring->staged_.Release();
+    counters->mbufs += mbufs;
+    counters->events += acks.size();
+    CHECK_EQ(flow_->tx_tracking_.NumTrackedSegments(), 0)
+        << "Window not acknowledged.";
+  }
+
+ private:
+  const Ipv4::Address local_addr_;
+  const Udp::Port local_port_;
+  const Ipv4::Address remote_addr_;
+  const Udp::Port remote_port_;
+  shm::ChannelManager<shm::Channel> channel_mgr_;
+  std::shared_ptr<shm::Channel> channel_;
+  std::unique_ptr<RXTracking> rx_tracking_;
+  std::unique_ptr<dpdk::PacketPool> pkt_pool_;
+  std::unique_ptr<dpdk::TxRing> txring_;
+  std::unique_ptr<Tracer> tracer_;
+  std::unique_ptr<Flow> flow_;
+  std::vector<dpdk::Packet *> packets_;
+};
+
+// Sequences are drawn from a few random permutations, in turn.
+constexpr size_t kVariantsNr = 16;
+
+// The order in which the packets of a receive window arrive.
+std::vector<std::vector<uint32_t>> MakeRxOrders(int64_t scenario) {
+  const uint32_t kWindow = FlowBench::kRxWindow;
+  std::mt19937 rng(1);
+  std::vector<std::vector<uint32_t>> orders;
+  for (size_t v = 0; v < kVariantsNr; v++) {
+    std::vector<uint32_t> order(kWindow);
+    std::iota(order.begin(), order.end(), 0);
+    switch (scenario) {
+      case kInOrder:
+        break;
+      case kReversed:
+        std::reverse(order.begin(), order.end());
+        break;
+      case kRandom:
+        std::shuffle(order.begin(), order.end(), rng);
+        break;
+      case kDupStorm: {
+        // Each packet four times, at random.
+        std::vector<uint32_t> dups;
+        for (int i = 0; i < 4; i++) {
+          dups.insert(dups.end(), order.begin(), order.end());
+        }
+        std::shuffle(dups.begin(), dups.end(), rng);
+        order = std::move(dups);
+      } break;
+      case kSackHoles: {
+        // Every 4th packet is lost, and retransmitted at the end.
+        std::vector<uint32_t> holes;
+        std::erase_if(order, [&holes](uint32_t seqno) {
+          if (seqno % 4 != 0) return false;
+          holes.push_back(seqno);
+          return true;
+        });
+        order.insert(order.end(), holes.begin(), holes.end());
+      } break;
+      default:
+        LOG(FATAL) << "Unknown scenario " << scenario;
+    }
+    orders.push_back(std::move(order));
+  }
+  return orders;
+}
+
+// An ACK from the receive side of the peer, as `Flow::PrepareMachnetHdr()'
+// builds it.
+MachnetPktHdr MakeAck(const swift::Pcb &rx_pcb) {
+  MachnetPktHdr ack = {};
+  ack.magic = be16_t(MachnetPktHdr::kMagic);
+  ack.net_flags = MachnetPktHdr::MachnetFlags::kAck;
+  ack.ackno = be32_t(rx_pcb.rcv_nxt);
+  for (size_t i = 0; i < sizeof(ack.sack_bitmap) / sizeof(ack.sack_bitmap[0]);
+       i++) {
+    ack.sack_bitmap[i] = be64_t(rx_pcb.sack_bitmap[i]);
+  }
+  ack.sack_bitmap_count = be16_t(rx_pcb.sack_bitmap_count);
+  return ack;
+}
+
+MachnetPktHdr MakeAck(uint32_t ackno) {
+  swift::Pcb rx_pcb;
+  rx_pcb.rcv_nxt = ackno;
+  return MakeAck(rx_pcb);
+}
+
+// The ACKs for an ACK window, which all end up acknowledged.
+std::vector<std::vector<MachnetPktHdr>> MakeAckSequences(int64_t scenario) {
+  const uint32_t kWindow = FlowBench::kTxWindow;
+  std::mt19937 rng(1);
+  std::vector<std::vector<MachnetPktHdr>> sequences;
+  for (size_t v = 0; v < kVariantsNr; v++) {
+    std::vector<uint32_t> acknos(kWindow);
+    std::iota(acknos.begin(), acknos.end(), 1);
+    std::vector<MachnetPktHdr> acks;
+    switch (scenario) {
+      case kInOrder:
+        break;
+      case kReversed:
+        std::reverse(acknos.begin(), acknos.end());
+        break;
+      case kRandom:
+        std::shuffle(acknos.begin(), acknos.end(), rng);
+        break;
+      case kDupStorm:
+        // Half the window, then the same ACK many times, e.g., from a peer
+        // that lost the next packet and keeps receiving duplicates.
+        acknos.assign(4 * kWindow, kWindow / 2);
+        acknos.push_back(kWindow);
+        break;
+      case kSackHoles: {
+        // Every 4th packet is lost: each of the others yields a duplicate
+        // ACK with a growing SACK bitmap, until the holes are repaired.
+        swift::Pcb rx_pcb;
+        for (uint32_t seqno = 0; seqno < kWindow; seqno++) {
+          if (seqno % 4 == 0) continue;
+          rx_pcb.sack_bitmap_bit_set(seqno - rx_pcb.rcv_nxt);
+          acks.push_back(MakeAck(rx_pcb));
+        }
+        acknos = {kWindow};
+      } break;
+      default:
+        LOG(FATAL) << "Unknown scenario " << scenario;
+    }
+    for (const auto ackno : acknos) acks.push_back(MakeAck(ackno));
+    sequences.push_back(std::move(acks));
+  }
+  return sequences;
+}
+
+void BM_RXTracking_Consume(benchmark::State &state) {  // NOLINT
+  const auto orders = MakeRxOrders(state.range(0));
+  state.SetLabel(ScenarioName(state.range(0)));
+  FlowBench bench;
+  bench.MakeRxWindow();
+
+  EventCounters counters;
+  size_t nb_msgs = 0;
+  size_t variant = 0;
+  for (auto _ : state) {
+    const auto cycles = counters.cycles;
+    bench.Consume(orders[variant], &counters);
+    if (++variant == orders.size()) variant = 0;
+    state.SetIterationTime(static_cast<double>(counters.cycles - cycles) /
+                           time::tsc_hz);
+    nb_msgs += bench.ReceiveMessages();
+  }
+  if (nb_msgs != static_cast<size_t>(state.iterations()) *
+                     FlowBench::kRxWindow) {
+    state.SkipWithError("Messages were not delivered.");
+  }
+  counters.Report(state);
+}
+BENCHMARK(BM_RXTracking_Consume)
+    ->UseManualTime()
+    ->ArgName("scenario")
+    ->DenseRange(kInOrder, kSackHoles);
+
+void BM_Flow_ProcessAck(benchmark::State &state) {  // NOLINT
+  const auto sequences = MakeAckSequences(state.range(0));
+  state.SetLabel(ScenarioName(state.range(0)));
+  FlowBench bench;
+
+  EventCounters counters;
+  size_t variant = 0;
+  for (auto _ : state) {
+    bench.SendTxWindow();
+    const auto cycles = counters.cycles;
+    bench.ProcessAcks(sequences[variant], &counters);
+    if (++variant == sequences.size()) variant = 0;
+    state.SetIterationTime(static_cast<double>(counters.cycles - cycles) /
+                           time::tsc_hz);
+  }
+  counters.Report(state);
+}
+BENCHMARK(BM_Flow_ProcessAck)
+    ->UseManualTime()
+    ->ArgName("scenario")
+    ->DenseRange(kInOrder, kSackHoles);
+
+}  // namespace
+}  // namespace flow
+}  // namespace net
+}  // namespace juggler
+
+int main(int argc, char **argv) {
+  google::InitGoogleLogging(argv[0]);
+  benchmark::Initialize(&argc, argv);
+  if (benchmark::ReportUnrecognizedArguments(argc, argv)) return 1;
+
+  // Only the memory subsystem is used: no ports.
+  auto d = juggler::dpdk::Dpdk();
+  d.InitDpdk(juggler::utils::CmdLineOpts(
+      {"", "-c", "0x0", "-n", "6", "--proc-type=auto", "-m", "1024",
+       "--log-level", "8", "--no-pci"}));
+  juggler::time::tsc_hz = juggler::time::estimate_tsc_hz();
+  benchmark::RunSpecifiedBenchmarks();
+  return 0;
+}
@@ -0,0 +1,157 @@
+/**
+ * @file loopback_bench.cc
+ * @brief Transport benchmark over an emulated network: streams messages
+ * between two Machnet engines in one process (see `Loopback'), through links
+ * with the given loss, duplication, reordering, delay and bandwidth, and
+ * reports goodput and one-way message latency percentiles.
+ *
+ * All times are virtual, so results only depend on the flags (including the
+ * seed) and on the transport, not on the machine; e.g., compare two builds
+ * with:
+ *   loopback_bench --loss=0.001 --delay_us=25 --rate_gbps=25 --seed=1
+ */
+#include <dpdk.h>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <hdr/hdr_histogram.h>
+#include <loopback.h>
+#include <machnet.h>
+#include <utils.h>
+
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+DEFINE_uint64(seed, 1, "Seed of the emulated links.");
+DEFINE_double(loss, 0, "Packet loss rate, in each direction.");
+DEFINE_double(dup, 0, "Packet duplication rate, in each direction.");
+DEFINE_double(reorder, 0, "Packet reordering rate, in each direction.");
+DEFINE_uint64(reorder_delay_us, 100, "How long reordered packets are held.");
+DEFINE_uint64(delay_us, 10, "One-way propagation delay.");
+DEFINE_double(rate_gbps, 0, "Bottleneck bandwidth; 0 is unlimited.");
+DEFINE_uint64(queue_kb, 0, "Bottleneck queue size; 0 is unlimited.");
+DEFINE_uint64(step_ns, 1000, "Duration of an engine iteration.");
+DEFINE_uint32(msg_size, 1024, "Size of the messages.");
+DEFINE_uint64(msg_nr, 100000, "Number of messages to send.");
+DEFINE_uint32(msg_window, 64, "Maximum number of messages in flight.");
+DEFINE_uint64(timeout_s, 3600, "Give up after this long (virtual time).");
+
+namespace {
+
+using juggler::Loopback;
+using Side = Loopback::Side;
+
+constexpr uint16_t kPort = 888;
+
+juggler::dpdk::LinkConf MakeLinkConf() {
+  juggler::dpdk::LinkConf conf;
+  conf.loss_rate = FLAGS_loss;
+  conf.duplicate_rate = FLAGS_dup;
+  conf.reorder_rate = FLAGS_reorder;
+  conf.reorder_delay_us = FLAGS_reorder_delay_us;
+  conf.delay_us = FLAGS_delay_us;
+  conf.rate_bps = static_cast<uint64_t>(FLAGS_rate_gbps * 1E9);
+  conf.queue_bytes = FLAGS_queue_kb * KB;
+  return conf;
+}
+
+void PrintLinkStats(const char *name, const juggler::dpdk::LinkStats &stats) {
+  std::cout << name << ": packets " << stats.packets << ", bytes "
+            << stats.bytes << ", lost " << stats.lost << ", queue drops "
+            << stats.queue_drops << ", duplicated " << stats.duplicated
+            << ", reordered " << stats.reordered << ", overflows "
+            << stats.overflows << std::endl;
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  google::InitGoogleLogging(argv[0]);
+  gflags::SetUsageMessage("Machnet transport benchmark over an emulated link.");
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+  FLAGS_logtostderr = 1;
+  CHECK_GT(FLAGS_msg_size, 0);
+  CHECK_GT(FLAGS_msg_window, 0);
+
+  auto d = juggler::dpdk::Dpdk();
+  d.InitDpdk(juggler::utils::CmdLineOpts(
+      {"", "-c", "0x0", "-n", "6", "--proc-type=auto", "-m", "1024",
+       "--log-level", "8", "--no-pci"}));
+
+  Loopback::Options options;
+  options.a_to_b = options.b_to_a = MakeLinkConf();
+  options.seed = FLAGS_seed;
+  options.step_ns = FLAGS_step_ns;
+  Loopback loopback(options);
+  CHECK(loopback.Listen(Side::kB, kPort)) << "Failed to listen.";
+  const auto flow = loopback.Connect(Side::kA, kPort);
+  CHECK(flow.has_value()) << "Failed to connect.";
+
+  hdr_histogram *latency_hist;
+  CHECK_EQ(hdr_init(1, 1000 * Loopback::kTscHz, 3, &latency_hist), 0);
+
+  // Messages arrive in order, so their send times are looked up by index.
+  std::vector<uint64_t> send_times;
+  send_times.reserve(FLAGS_msg_nr);
+  std::vector<uint8_t> tx_buf(FLAGS_msg_size);
+  std::vector<uint8_t> rx_buf(FLAGS_msg_size);
+  uint64_t nb_received = 0;
+  uint64_t rx_bytes = 0;
+
+  const auto wall_start = std::chrono::steady_clock::now();
+  const auto start = loopback.Now();
+  const bool done = loopback.RunUntil(
+      [&]() {
+        while (send_times.size() < FLAGS_msg_nr &&
+               send_times.size() - nb_received < FLAGS_msg_window) {
+          if (machnet_send(loopback.GetChannelCtx(Side::kA), flow.value(),
+                           tx_buf.data(), tx_buf.size()) != 0) {
+            break;
+          }
+          send_times.push_back(loopback.Now());
+        }
+        MachnetFlow_t rx_flow;
+        ssize_t size;
+        while ((size = machnet_recv(loopback.GetChannelCtx(Side::kB),
+                                    rx_buf.data(), rx_buf.size(),
+                                    &rx_flow)) > 0) {
+          hdr_record_value(latency_hist,
+                           loopback.Now() - send_times[nb_received]);
+          nb_received++;
+          rx_bytes += size;
+        }
+        return nb_received == FLAGS_msg_nr;
+      },
+      FLAGS_timeout_s * Loopback::kTscHz);
+  const auto duration_ns = loopback.Now() - start;
+  const std::chrono::duration<double> wall_time =
+      std::chrono::steady_clock::now() - wall_start;
+  if (!done) {
+    LOG(ERROR) << "Timed out: received " << nb_received << " of "
+               << FLAGS_msg_nr << " messages.";
+  }
+
+  const auto &emulator = loopback.GetEmulator();
+  std::cout << "Link: " << options.a_to_b.ToString() << ", seed "
+            << FLAGS_seed << std::endl;
+  std::cout << std::fixed << std::setprecision(3)
+            << "Messages: " << nb_received << " x " << FLAGS_msg_size
+            << " bytes in " << duration_ns / 1E6 << " ms (virtual), "
+            << wall_time.count() << " s (wall)" << std::endl;
+  std::cout << "Goodput: " << rx_bytes * 8 / static_cast<double>(duration_ns)
+            << " Gbps, " << nb_received * 1E3 / duration_ns << " Mmsg/s"
+            << std::endl;
+  auto perc = [latency_hist](double p) {
+    return hdr_value_at_percentile(latency_hist, p) / 1E3;
+  };
+  std::cout << "Latency (p50/90/99/99.9/max us): " << perc(50.0) << "/"
+            << perc(90.0) << "/" << perc(99.0) << "/" << perc(99.9) << "/"
+            << hdr_max(latency_hist) / 1E3 << std::endl;
+  PrintLinkStats("A -> B", emulator.GetLink(Side::kA).GetStats());
+  PrintLinkStats("B -> A", emulator.GetLink(Side::kB).GetStats());
+
+  hdr_close(latency_hist);
+  return done ? 0 : 1;
+}
@@ -0,0 +1,196 @@
+/**
+ * @file capture_test.cc
+ *
+ * Unit tests for the packet capture filter and the pcapng writer.
+ */
+
+#include <capture.h>
+#include <gtest/gtest.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace juggler {
+
+// Builds an Ethernet/IPv4/UDP packet.
+std::vector<uint8_t> MakeUdpPacket(const std::string &src_ip,
+                                   uint16_t src_port,
+                                   const std::string &dst_ip,
+                                   uint16_t dst_port) {
+  std::vector<uint8_t> pkt(sizeof(net::Ethernet) + sizeof(net::Ipv4) +
+                           sizeof(net::Udp) + 8);
+  auto *eh = reinterpret_cast<net::Ethernet *>(pkt.data());
+  eh->eth_type = be16_t(net::Ethernet::kIpv4);
+  auto *ipv4h = reinterpret_cast<net::Ipv4 *>(eh + 1);
+  ipv4h->version_ihl = 0x45;
+  ipv4h->next_proto_id = net::Ipv4::Proto::kUdp;
+  ipv4h->src_addr = net::Ipv4::Address::MakeAddress(src_ip).value();
+  ipv4h->dst_addr = net::Ipv4::Address::MakeAddress(dst_ip).value();
+  auto *udph = reinterpret_cast<net::Udp *>(ipv4h + 1);
+  udph->src_port = net::Udp::Port(src_port);
+  udph->dst_port = net::Udp::Port(dst_port);
+  return pkt;
+}
+
+bool Match(const std::string &expr, const std::vector<uint8_t> &pkt) {
+  const auto filter = CaptureFilter::Parse(expr);
+  EXPECT_TRUE(filter.has_value()) << expr;
+  return filter.has_value() && filter->Match(pkt.data(), pkt.size());
+}
+
+TEST(CaptureFilterTest, Parse) {
+  EXPECT_TRUE(CaptureFilter::Parse("").has_value());
+  EXPECT_TRUE(CaptureFilter::Parse("udp and host 10.0.0.1 && dst port 80")
+                  .has_value());
+  EXPECT_FALSE(CaptureFilter::Parse("host").has_value());
+  EXPECT_FALSE(CaptureFilter::Parse("host 10.0.0").has_value());
+  EXPECT_FALSE(CaptureFilter::Parse("port 65536").has_value());
+  EXPECT_FALSE(CaptureFilter::Parse("port 80x").has_value());
+  EXPECT_FALSE(CaptureFilter::Parse("src").has_value());
+  EXPECT_FALSE(CaptureFilter::Parse("udp host 10.0.0.1").has_value());
+  EXPECT_FALSE(CaptureFilter::Parse("udp and").has_value());
+  EXPECT_FALSE(CaptureFilter::Parse("tcp").has_value());
+}
+
+TEST(CaptureFilterTest, Match) {
+  const auto pkt = MakeUdpPacket("10.0.0.1", 1234, "10.0.0.2", 888);
+  EXPECT_TRUE(Match("", pkt));
+  EXPECT_TRUE(Match("ip and udp", pkt));
+  EXPECT_FALSE(Match("arp", pkt));
+  EXPECT_FALSE(Match("icmp", pkt));
+
+  EXPECT_TRUE(Match("host 10.0.0.1", pkt));
+  EXPECT_TRUE(Match("host 10.0.0.2", pkt));
+  EXPECT_FALSE(Match("host 10.0.0.3", pkt));
+  EXPECT_TRUE(Match("src host 10.0.0.1", pkt));
+  EXPECT_FALSE(Match("dst host 10.0.0.1", pkt));
+
+  EXPECT_TRUE(Match("port 888", pkt));
+  EXPECT_TRUE(Match("src port 1234 and dst port 888", pkt));
+  EXPECT_FALSE(Match("src port 888", pkt));
+  EXPECT_TRUE(Match("host 10.0.0.2 and port 1234", pkt));
+  EXPECT_FALSE(Match("host 10.0.0.2 and port 80", pkt));
+
+  // Truncated packets match only on the headers they have.
+  const auto filter = CaptureFilter::Parse("port 888").value();
+  EXPECT_FALSE(filter.Match(pkt.data(), sizeof(net::Ethernet) + 4));
+  EXPECT_TRUE(CaptureFilter::Parse("").value().Match(pkt.data(), 0));
+}
+
+TEST(CaptureClockTest, ToNs) {
+  const uint64_t kTscHz = 2500000000;
+  const CaptureClock clock(1000, 5000000000, kTscHz);
+  EXPECT_EQ(clock.ToNs(1000), 5000000000);
+  EXPECT_EQ(clock.ToNs(1000 + kTscHz / 2), 5500000000);
+  // Days' worth of cycles do not overflow.
+  EXPECT_EQ(clock.ToNs(1000 + kTscHz * 86400 * 3), 5000000000 +
+                                                        86400ULL * 3 *
+                                                            1000000000);
+  EXPECT_EQ(clock.ToNs(0), 5000000000);
+}
+
+class PcapngWriterTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    fd_ = memfd_create("pcapng_test", 0);
+    ASSERT_GE(fd_, 0);
+  }
+  void TearDown() override { close(fd_); }
+
+  std::string ReadAll() const {
+    std::string s(lseek(fd_, 0, SEEK_END), '\0');
+    EXPECT_EQ(pread(fd_, s.data(), s.size(), 0), s.size());
+    return s;
+  }
+
+  struct Block {
+    uint32_t type;
+    std::string body;
+  };
+
+  // Splits the file into blocks, checking their framing.
+  static std::vector<Block> ParseBlocks(const std::string &s) {
+    std::vector<Block> blocks;
+    size_t offset = 0;
+    while (offset < s.size()) {
+      uint32_t type, len, trailing_len;
+      EXPECT_GE(s.size() - offset, 12);
+      std::memcpy(&type, s.data() + offset, 4);
+      std::memcpy(&len, s.data() + offset + 4, 4);
+      EXPECT_EQ(len % 4, 0);
+      EXPECT_LE(offset + len, s.size());
+      std::memcpy(&trailing_len, s.data() + offset + len - 4, 4);
+      EXPECT_EQ(trailing_len, len);
+      blocks.push_back({type, s.substr(offset + 8, len - 12)});
+      offset += len;
+    }
+    return blocks;
+  }
+
+  static uint32_t U32(const std::string &body, size_t offset) {
+    uint32_t value;
+    std::memcpy(&value, body.data() + offset, sizeof(value));
+    return value;
+  }
+
+  int fd_{-1};
+};
+
+TEST_F(PcapngWriterTest, Blocks) {
+  const auto pkt = MakeUdpPacket("10.0.0.1", 1234, "10.0.0.2", 888);
+  const uint64_t kTimestamp = 1700000000123456789;
+  {
+    PcapngWriter writer(fd_, "test");
+    writer.AddInterface("port0/engine0", 128);
+    EXPECT_TRUE(writer.WritePacket(0, kTimestamp, pkt.data(), 41, 1000,
+                                   CaptureDirection::kTx));
+    EXPECT_EQ(writer.GetPacketCount(), 1);
+    // Nothing is written before a flush.
+    EXPECT_TRUE(ReadAll().empty());
+    EXPECT_TRUE(writer.Flush());
+  }
+
+  const auto blocks = ParseBlocks(ReadAll());
+  ASSERT_EQ(blocks.size(), 3);
+
+  EXPECT_EQ(blocks[0].type, PcapngWriter::kBlockTypeShb);
+  EXPECT_EQ(U32(blocks[0].body, 0), PcapngWriter::kByteOrderMagic);
+  EXPECT_EQ(U32(blocks[0].body, 4), 1);  // Version 1.0.
+
+  EXPECT_EQ(blocks[1].type, PcapngWriter::kBlockTypeIdb);
+  EXPECT_EQ(U32(blocks[1].body, 0), PcapngWriter::kLinkTypeEthernet);
+  EXPECT_EQ(U32(blocks[1].body, 4), 128);
+  EXPECT_NE(blocks[1].body.find("port0/engine0"), std::string::npos);
+
+  const auto &epb = blocks[2].body;
+  EXPECT_EQ(blocks[2].type, PcapngWriter::kBlockTypeEpb);
+  EXPECT_EQ(U32(epb, 0), 0);  // Interface.
+  EXPECT_EQ((static_cast<uint64_t>(U32(epb, 4)) << 32) | U32(epb, 8),
+            kTimestamp);
+  EXPECT_EQ(U32(epb, 12), 41);
+  EXPECT_EQ(U32(epb, 16), 1000);
+  EXPECT_EQ(std::memcmp(epb.data() + 20, pkt.data(), 41), 0);
+  // Data padded to 44 bytes, then the `epb_flags' option and the end.
+  EXPECT_EQ(epb.size(), 20 + 44 + 8 + 4);
+  EXPECT_EQ(U32(epb, 64), 2 | 4 << 16);
+  EXPECT_EQ(U32(epb, 68), static_cast<uint32_t>(CaptureDirection::kTx));
+}
+
+TEST_F(PcapngWriterTest, WriteError) {
+  PcapngWriter writer(-1, "test");
+  EXPECT_FALSE(writer.Flush());
+  const auto pkt = MakeUdpPacket("10.0.0.1", 1234, "10.0.0.2", 888);
+  EXPECT_FALSE(writer.WritePacket(0, 0, pkt.data(), pkt.size(), pkt.size(),
+                                  CaptureDirection::kRx));
+}
+
+}  // namespace juggler
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
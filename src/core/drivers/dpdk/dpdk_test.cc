@@ -7,7 +7,10 @@
 
 #include <gtest/gtest.h>
 
+#include <algorithm>
+#include <limits>
 #include <memory>
+#include <vector>
 
 #include "packet.h"
 #include "pmd.h"
@@ -16,6 +19,17 @@
 std::unique_ptr<juggler::dpdk::PacketPool> g_tx_pkt_pool;
 std::unique_ptr<juggler::dpdk::PmdPort> g_pmd;
 
+// Packets the NIC takes before it runs out of descriptors; net_null takes
+// everything, so a full NIC is emulated with a TX callback.
+uint32_t g_tx_budget = std::numeric_limits<uint32_t>::max();
+
+uint16_t ThrottleTx(uint16_t, uint16_t, struct rte_mbuf **, uint16_t nb_pkts,
+                    void *) {
+  const uint16_t nb_tx = std::min<uint32_t>(nb_pkts, g_tx_budget);
+  g_tx_budget -= nb_tx;
+  return nb_tx;
+}
+
 TEST(BasicTxTest, BasicTxTest) {
   const size_t payload_size = 4000;
   juggler::net::Ethernet::Address local_mac_addr("00:11:22:33:44:55");
@@ -60,6 +74,101 @@ TEST(BasicTxTest, BasicTxTest) {
   EXPECT_EQ(ret, 1);
 }
 
+TEST(TxRingTest, StagePackets) {
+  using juggler::dpdk::PacketBatch;
+  auto *txring = g_pmd->GetRing<juggler::dpdk::TxRing>(0);
+  const auto stats = txring->GetStats();
+
+  // Staged packets wait for the flush.
+  auto *pkt = g_tx_pkt_pool->PacketAlloc();
+  ASSERT_NE(pkt, nullptr);
+  txring->StagePackets(&pkt, 1);
+  EXPECT_EQ(txring->GetStagedCount(), 1);
+  EXPECT_EQ(txring->GetStats().tx_bursts, stats.tx_bursts);
+  txring->FlushStaged();
+  EXPECT_EQ(txring->GetStagedCount(), 0);
+  EXPECT_EQ(txring->GetStats().tx_bursts, stats.tx_bursts + 1);
+  EXPECT_EQ(txring->GetStats().tx_pkts, stats.tx_pkts + 1);
+
+  // Nothing staged, no burst.
+  txring->FlushStaged();
+  EXPECT_EQ(txring->GetStats().tx_bursts, stats.tx_bursts + 1);
+
+  // A full burst is sent as soon as it is staged; the rest waits.
+  std::vector<juggler::dpdk::Packet *> pkts(PacketBatch::kMaxBurst + 3);
+  ASSERT_TRUE(g_tx_pkt_pool->PacketBulkAlloc(pkts.data(), pkts.size()));
+  txring->StagePackets(pkts.data(), pkts.size());
+  EXPECT_EQ(txring->GetStagedCount(), 3);
+  EXPECT_EQ(txring->GetStats().tx_bursts, stats.tx_bursts + 2);
+  EXPECT_EQ(txring->GetStats().tx_pkts,
+            stats.tx_pkts + 1 + PacketBatch::kMaxBurst);
+  txring->FlushStaged();
+  EXPECT_EQ(txring->GetStagedCount(), 0);
+  EXPECT_EQ(txring->GetStats().tx_bursts, stats.tx_bursts + 3);
+  EXPECT_EQ(txring->GetStats().tx_pkts, stats.tx_pkts + pkts.size() + 1);
+  EXPECT_EQ(txring->GetBacklogCount(), 0);
+}
+
+TEST(TxRingTest, BacklogWatermarks) {
+  using juggler::dpdk::TxRing;
+  auto *txring = g_pmd->GetRing<TxRing>(0);
+  juggler::dpdk::PacketPool pkt_pool(
+      TxRing::kTxBacklogSize * 2,
+      juggler::dpdk::PmdRing::kDefaultFrameSize + RTE_PKTMBUF_HEADROOM);
+  auto *cb = rte_eth_add_tx_callback(txring->GetPortId(), txring->GetRingId(),
+                                     ThrottleTx, nullptr);
+  ASSERT_NE(cb, nullptr);
+  auto stage = [&](uint16_t nb_pkts) {
+    std::vector<juggler::dpdk::Packet *> pkts(nb_pkts);
+    CHECK(pkt_pool.PacketBulkAlloc(pkts.data(), nb_pkts));
+    txring->StagePackets(pkts.data(), nb_pkts);
+    txring->FlushStaged();
+  };
+  const auto stats = txring->GetStats();
+
+  // The backlog grows while the NIC is full; up to the high watermark the ring
+  // is not congested.
+  g_tx_budget = 0;
+  stage(TxRing::kTxBacklogHighWatermark);
+  EXPECT_EQ(txring->GetBacklogCount(), TxRing::kTxBacklogHighWatermark);
+  EXPECT_FALSE(txring->IsCongested());
+  stage(1);
+  EXPECT_TRUE(txring->IsCongested());
+  EXPECT_EQ(txring->GetStats().congestions, stats.congestions + 1);
+
+  // It stays congested until the backlog drains below the low watermark.
+  g_tx_budget =
+      TxRing::kTxBacklogHighWatermark - TxRing::kTxBacklogLowWatermark;
+  txring->FlushStaged();
+  EXPECT_EQ(txring->GetBacklogCount(), TxRing::kTxBacklogLowWatermark + 1);
+  EXPECT_TRUE(txring->IsCongested());
+  g_tx_budget = 1;
+  txring->FlushStaged();
+  EXPECT_EQ(txring->GetBacklogCount(), TxRing::kTxBacklogLowWatermark);
+  EXPECT_FALSE(txring->IsCongested());
+  EXPECT_EQ(txring->GetStats().congestions, stats.congestions + 1);
+
+  // Once the backlog is full, packets are dropped.
+  g_tx_budget = 0;
+  stage(TxRing::kTxBacklogSize - TxRing::kTxBacklogLowWatermark + 10);
+  EXPECT_EQ(txring->GetBacklogCount(), TxRing::kTxBacklogSize);
+  EXPECT_EQ(txring->GetStats().dropped, stats.dropped + 10);
+  EXPECT_TRUE(txring->IsCongested());
+  EXPECT_EQ(txring->GetStats().congestions, stats.congestions + 2);
+
+  // The backlog goes out, in full, once the NIC has room again.
+  g_tx_budget = std::numeric_limits<uint32_t>::max();
+  txring->FlushStaged();
+  EXPECT_EQ(txring->GetBacklogCount(), 0);
+  EXPECT_FALSE(txring->IsCongested());
+  EXPECT_EQ(txring->GetStats().tx_pkts,
+            stats.tx_pkts + TxRing::kTxBacklogHighWatermark + 1 +
+                TxRing::kTxBacklogSize - TxRing::kTxBacklogLowWatermark);
+  EXPECT_EQ(rte_eth_remove_tx_callback(txring->GetPortId(),
+                                       txring->GetRingId(), cb),
+            0);
+}
+
 int main(int argc, char **argv) {
   testing::InitGoogleTest(&argc, argv);
 
@@ -0,0 +1,74 @@
+#include <glog/logging.h>
+#include <net_emulator.h>
+#include <rte_errno.h>
+#include <rte_eth_ring.h>
+#include <rte_lcore.h>
+#include <rte_ring.h>
+#include <utils.h>
+
+#include <string>
+
+namespace juggler {
+namespace dpdk {
+
+std::string LinkConf::ToString() const {
+  return utils::Format(
+      "[loss: %.4f, dup: %.4f, reorder: %.4f (+%lu us), delay: %lu us, "
+      "rate: %lu bps, queue: %lu bytes]",
+      loss_rate, duplicate_rate, reorder_rate, reorder_delay_us, delay_us,
+      rate_bps, queue_bytes);
+}
+
+NetworkEmulator::NetworkEmulator(const LinkConf &a_to_b, const LinkConf &b_to_a,
+                                 uint64_t seed, uint64_t tsc_hz) {
+  // Ring and port names must be unique in the process.
+  static uint32_t next_id = 0;
+  const auto id = next_id++;
+  const char *kSideNames[] = {"a", "b"};
+  const auto socket_id = static_cast<int>(rte_socket_id());
+
+  for (const auto side : {kA, kB}) {
+    const auto prefix = utils::Format("netem%u_%s", id, kSideNames[side]);
+    tx_rings_[side] =
+        rte_ring_create((prefix + "_tx").c_str(), kRingSize, socket_id,
+                        RING_F_SP_ENQ | RING_F_SC_DEQ);
+    rx_rings_[side] =
+        rte_ring_create((prefix + "_rx").c_str(), kRingSize, socket_id,
+                        RING_F_SP_ENQ | RING_F_SC_DEQ);
+    CHECK(tx_rings_[side] != nullptr && rx_rings_[side] != nullptr)
+        << "Failed to create the rings of emulated port " << prefix << ": "
+        << rte_strerror(rte_errno);
+
+    const int ret = rte_eth_from_rings(
+        ("net_ring_" + prefix).c_str(), &rx_rings_[side], 1, &tx_rings_[side],
+        1, socket_id);
+    CHECK_GE(ret, 0) << "Failed to create emulated port " << prefix << ": "
+                     << rte_strerror(rte_errno);
+    port_ids_[side] = static_cast<uint16_t>(ret);
+    LOG(INFO) << "[NETEM] [port_id: " << ret << ", side: " << kSideNames[side]
+              << "]";
+  }
+
+  dup_pool_ = std::make_unique<PacketPool>(kDupPoolSize);
+  // The links draw from different streams of the same seed.
+  links_[kA] = std::make_unique<EmulatedLink>(
+      a_to_b, seed, tsc_hz, tx_rings_[kA], rx_rings_[kB], dup_pool_.get());
+  links_[kB] = std::make_unique<EmulatedLink>(
+      b_to_a, seed ^ 0x9e3779b97f4a7c15ull, tsc_hz, tx_rings_[kB],
+      rx_rings_[kA], dup_pool_.get());
+  LOG(INFO) << "[NETEM] A -> B: " << a_to_b.ToString();
+  LOG(INFO) << "[NETEM] B -> A: " << b_to_a.ToString();
+}
+
+NetworkEmulator::~NetworkEmulator() {
+  // Free the packets first: the duplicates go back to our pool.
+  for (auto &link : links_) link.reset();
+  dup_pool_.reset();
+  for (const auto side : {kA, kB}) {
+    rte_ring_free(tx_rings_[side]);
+    rte_ring_free(rx_rings_[side]);
+  }
+}
+
+}  // namespace dpdk
+}  // namespace juggler
@@ -7,6 +7,9 @@
 #include <algorithm>
 #include <cstring>
 #include <memory>
+#include <string>
+#include <utility>
+#include <vector>
 
 namespace juggler {
 namespace dpdk {
@@ -35,9 +38,11 @@ static rte_eth_conf DefaultEthConf(const rte_eth_dev_info *devinfo) {
 
   struct rte_eth_conf port_conf = rte_eth_conf();
 
-  // The `net_null' driver is only used for testing, and it does not support
-  // offloads so return a very basic ethernet configuration.
-  if (std::string(devinfo->driver_name) == "net_null") return port_conf;
+  // The `net_null' and `net_ring' drivers are only used for testing (see
+  // `NetworkEmulator'), and they do not support offloads so return a very
+  // basic ethernet configuration.
+  const std::string driver_name(devinfo->driver_name);
+  if (driver_name == "net_null" || driver_name == "net_ring") return port_conf;
 
   port_conf.link_speeds = RTE_ETH_LINK_SPEED_AUTONEG;
   uint64_t rss_hf =
@@ -83,7 +88,8 @@ static rte_eth_conf DefaultEthConf(const rte_eth_dev_info *devinfo) {
 
 void TxRing::Init() {
   int ret = rte_eth_tx_queue_setup(this->GetPortId(), this->GetRingId(),
-                                   this->GetDescNum(), SOCKET_ID_ANY, &conf_);
+                                   this->GetDescNum(),
+                                   this->GetPmdPort()->GetNumaNode(), &conf_);
   if (ret != 0) {
     LOG(FATAL) << "rte_eth_tx_queue_setup() faled. Cannot setup TX queue.";
   }
@@ -91,7 +97,8 @@ void TxRing::Init() {
 
 void RxRing::Init() {
   int ret = rte_eth_rx_queue_setup(this->GetPortId(), this->GetRingId(),
-                                   this->GetDescNum(), SOCKET_ID_ANY, &conf_,
+                                   this->GetDescNum(),
+                                   this->GetPmdPort()->GetNumaNode(), &conf_,
                                    this->GetPacketMemPool());
   if (ret != 0) {
     LOG(FATAL) << "rte_eth_rx_queue_setup() faled. Cannot setup RX queue.";
@@ -133,7 +140,8 @@ void PmdPort::InitDriver(uint16_t mtu) {
       }
     }
 
-    LOG(INFO) << "Rings nr: " << rx_rings_nr_;
+    LOG(INFO) << "Rings nr: " << rx_rings_nr_
+              << ", NUMA node: " << GetNumaNode();
     const rte_eth_conf portconf = DefaultEthConf(&devinfo_);
     int ret =
         rte_eth_dev_configure(port_id_, rx_rings_nr_, tx_rings_nr_, &portconf);
@@ -241,9 +249,9 @@ void PmdPort::InitDriver(uint16_t mtu) {
     // Setup the TX queues.
     for (auto q = 0; q < tx_rings_nr_; q++) {
       LOG(INFO) << "Initializing TX ring: " << q;
-      auto tx_ring = makeRing<TxRing>(this, port_id_, q, tx_ring_desc_nr_,
-                                      devinfo_.default_txconf,
-                                      2 * tx_ring_desc_nr_ - 1, mbuf_data_size);
+      auto tx_ring = makeRing<TxRing>(
+          this, port_id_, q, tx_ring_desc_nr_, devinfo_.default_txconf,
+          2 * tx_ring_desc_nr_ - 1, mbuf_data_size, GetNumaNode());
       // auto tx_ring = makeRing<TxRing>(this, port_id_, q, tx_ring_desc_nr_,
       //                                 devinfo_.default_txconf);
       tx_ring.get()->Init();
@@ -253,9 +261,9 @@ void PmdPort::InitDriver(uint16_t mtu) {
     // Setup the RX queues.
     for (auto q = 0; q < rx_rings_nr_; q++) {
       LOG(INFO) << "Initializing RX ring: " << q;
-      auto rx_ring = makeRing<RxRing>(this, port_id_, q, rx_ring_desc_nr_,
-                                      devinfo_.default_rxconf,
-                                      2 * rx_ring_desc_nr_ - 1, mbuf_data_size);
+      auto rx_ring = makeRing<RxRing>(
+          this, port_id_, q, rx_ring_desc_nr_, devinfo_.default_rxconf,
+          2 * rx_ring_desc_nr_ - 1, mbuf_data_size, GetNumaNode());
       rx_ring.get()->Init();
       rx_rings_.emplace_back(std::move(rx_ring));
     }
@@ -328,6 +336,31 @@ void PmdPort::UpdatePortStats() {
   }
 }
 
+std::vector<std::pair<std::string, uint64_t>> PmdPort::GetXStats() const {
+  std::vector<std::pair<std::string, uint64_t>> xstats;
+  const int nb_xstats = rte_eth_xstats_get_names(port_id_, nullptr, 0);
+  if (nb_xstats <= 0) {
+    LOG(WARNING) << "Failed to retrieve DPDK port xstats names.";
+    return xstats;
+  }
+
+  std::vector<struct rte_eth_xstat_name> names(nb_xstats);
+  std::vector<struct rte_eth_xstat> values(nb_xstats);
+  if (rte_eth_xstats_get_names(port_id_, names.data(), nb_xstats) !=
+          nb_xstats ||
+      rte_eth_xstats_get(port_id_, values.data(), nb_xstats) != nb_xstats) {
+    LOG(WARNING) << "Failed to retrieve DPDK port xstats.";
+    return xstats;
+  }
+
+  xstats.reserve(nb_xstats);
+  for (const auto &value : values) {
+    if (value.id >= names.size()) continue;
+    xstats.emplace_back(names[value.id].name, value.value);
+  }
+  return xstats;
+}
+
 void PmdPort::DeInit() {
   if (!initialized_ || !is_dpdk_primary_process_) return;
   rte_eth_dev_stop(port_id_);
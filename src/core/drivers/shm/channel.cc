@@ -6,6 +6,9 @@
 #include <channel.h>
 #include <flow.h>
 #include <glog/logging.h>
+#include <unistd.h>
+
+#include <algorithm>
 
 namespace juggler {
 namespace shm {
@@ -38,65 +41,51 @@ Channel::Channel(const std::string &channel_name,
       listeners_(),
       active_flows_() {}
 
-Channel::~Channel() { UnregisterDMAMem(); }
+Channel::~Channel() {
+  for (auto cls = GetBufClassCount(); cls < MACHNET_CHANNEL_BUF_CLASS_MAX;
+       ++cls) {
+    if (__machnet_channel_buf_class(ctx(), cls)->state !=
+        MACHNET_CHANNEL_BUF_CLASS_FREE)
+      DestroySegment(cls);
+  }
+  UnregisterDMAMem();
+}
 
-bool Channel::RegisterMemForDMA(rte_device *dev) {
-  const auto *bufp_mem_start = GetBufPoolAddr();
-  const auto *bufp_mem_end = GetBufPoolAddr() + GetBufPoolSize();
+bool Channel::DMAMapRegion(rte_device *dev, const uchar_t *start, size_t len,
+                           std::vector<void *> *pages_va,
+                           std::vector<uint64_t> *pages_iova) {
   const size_t page_size = IsPosixShm() ? kPageSize : kHugePage2MSize;
 
-  if (attached_dev_ != nullptr) {
-    LOG(ERROR) << "Memory is already registered with DPDK";
-    return false;
-  }
-
   // Check that the memory is page-aligned.
-  if (reinterpret_cast<uintptr_t>(bufp_mem_start) & (page_size - 1)) {
+  if (reinterpret_cast<uintptr_t>(start) & (page_size - 1)) {
     LOG(ERROR) << "Channel memory is not page-aligned (page size: " << page_size
                << ")";
     return false;
   }
 
-  // There is padding at the end of the memory region to make sure that the end
-  // is page-aligned.
-  LOG_IF(FATAL, bufp_mem_end > __machnet_channel_end(ctx()))
-      << "Out of bounds!";
-
   // Calculate the number of pages in the memory region, and the IOVA addresses
   // of each one.
-  const auto pages_nr = (GetBufPoolSize() + page_size - 1) / page_size;
-  buffer_pages_va_.resize(pages_nr);
-  buffer_pages_iova_.resize(pages_nr);
+  const auto pages_nr = (len + page_size - 1) / page_size;
+  pages_va->resize(pages_nr);
+  pages_iova->resize(pages_nr);
   LOG(INFO) << "Registering " << pages_nr << " pages of size " << page_size
             << " bytes";
   for (auto i = 0u; i < pages_nr; ++i) {
-    const auto *page_addr = bufp_mem_start + i * page_size;
-    buffer_pages_va_[i] =
-        const_cast<void *>(static_cast<const void *>(page_addr));
-    buffer_pages_iova_[i] = rte_mem_virt2phy(page_addr);
-    LOG(INFO) << "Page " << i << " at " << buffer_pages_va_[i] << " has IOVA "
-              << buffer_pages_iova_[i];
-    if (buffer_pages_iova_[i] == RTE_BAD_IOVA) {
+    const auto *page_addr = start + i * page_size;
+    (*pages_va)[i] = const_cast<void *>(static_cast<const void *>(page_addr));
+    (*pages_iova)[i] = rte_mem_virt2phy(page_addr);
+    LOG(INFO) << "Page " << i << " at " << (*pages_va)[i] << " has IOVA "
+              << (*pages_iova)[i];
+    if ((*pages_iova)[i] == RTE_BAD_IOVA) {
       LOG(ERROR) << "Failed to get IOVA for page " << i;
       return false;
     }
   }
 
-  // Update the IOVA addresses of the buffers in the buffer pool.
-  for (auto i = 0u; i < GetTotalBufCount(); ++i) {
-    auto *msg_buf = GetMsgBuf(i);
-    const auto *buf_va = msg_buf->base();
-    msg_buf->set_iova(rte_mem_virt2phy(buf_va));
-    if (msg_buf->iova() == RTE_BAD_IOVA) {
-      LOG(ERROR) << utils::Format("Failed to get IOVA for buffer@%p)", buf_va);
-      return false;
-    }
-  }
-
   // Register external memory with DPDK.
-  const auto ret = rte_extmem_register(
-      const_cast<void *>(GetBufPoolAddr<void *>()), pages_nr * page_size,
-      buffer_pages_iova_.data(), buffer_pages_iova_.size(), page_size);
+  const auto ret =
+      rte_extmem_register((*pages_va)[0], pages_nr * page_size,
+                          pages_iova->data(), pages_iova->size(), page_size);
   if (ret != 0) {
     LOG(ERROR) << "Failed to register external memory with DPDK ("
                << rte_strerror(rte_errno) << ")";
@@ -107,65 +96,375 @@ bool Channel::RegisterMemForDMA(rte_device *dev) {
   for (auto i = 0u; i < pages_nr; ++i) {
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wdeprecated-declarations"
-    const auto ret = rte_dev_dma_map(dev, buffer_pages_va_[i],
-                                     buffer_pages_iova_[i], page_size);
+    const auto ret =
+        rte_dev_dma_map(dev, (*pages_va)[i], (*pages_iova)[i], page_size);
 #pragma GCC diagnostic pop
     if (ret != 0) {
       LOG(ERROR) << utils::Format(
           "Failed to DMA map page %u (VA: %p, IOVA: %p, size: %zu) (%s)", i,
-          buffer_pages_va_[i], static_cast<uintptr_t>(buffer_pages_iova_[i]),
-          page_size, rte_strerror(rte_errno));
+          (*pages_va)[i], static_cast<uintptr_t>((*pages_iova)[i]), page_size,
+          rte_strerror(rte_errno));
       return false;
     }
     LOG(INFO) << utils::Format(
-        "[+] DMA mapping: VA [%p, %p) - IOVA [%p, %p)", buffer_pages_va_[i],
-        static_cast<uchar_t *>(buffer_pages_va_[i]) + page_size,
-        static_cast<uintptr_t>(buffer_pages_iova_[i]),
-        static_cast<uintptr_t>(buffer_pages_iova_[i] + page_size));
+        "[+] DMA mapping: VA [%p, %p) - IOVA [%p, %p)", (*pages_va)[i],
+        static_cast<uchar_t *>((*pages_va)[i]) + page_size,
+        static_cast<uintptr_t>((*pages_iova)[i]),
+        static_cast<uintptr_t>((*pages_iova)[i] + page_size));
   }
 
-  attached_dev_ = dev;
-
   return true;
 }
 
-void Channel::UnregisterDMAMem() {
-  if (attached_dev_ == nullptr) {
-    LOG(ERROR) << "Memory is not registered with DPDK";
-    return;
-  }
+void Channel::DMAUnmapRegion(rte_device *dev, std::vector<void *> *pages_va,
+                             std::vector<uint64_t> *pages_iova) {
+  if (pages_va->empty()) return;
 
   const size_t page_size = IsPosixShm() ? kPageSize : kHugePage2MSize;
-  for (auto i = 0u; i < buffer_pages_va_.size(); ++i) {
+  for (auto i = 0u; i < pages_va->size(); ++i) {
     LOG(INFO) << utils::Format(
-        "[-] DMA unmapping: VA [%p, %p) - IOVA [%p, %p)", buffer_pages_va_[i],
-        static_cast<uchar_t *>(buffer_pages_va_[i]) + page_size,
-        static_cast<uintptr_t>(buffer_pages_iova_[i]),
-        static_cast<uintptr_t>(buffer_pages_iova_[i]) + page_size);
+        "[-] DMA unmapping: VA [%p, %p) - IOVA [%p, %p)", (*pages_va)[i],
+        static_cast<uchar_t *>((*pages_va)[i]) + page_size,
+        static_cast<uintptr_t>((*pages_iova)[i]),
+        static_cast<uintptr_t>((*pages_iova)[i]) + page_size);
 #pragma GCC diagnostic push
 #pragma GCC diagnostic ignored "-Wdeprecated-declarations"
-    const auto ret = rte_dev_dma_unmap(attached_dev_, buffer_pages_va_[i],
-                                       buffer_pages_iova_[i], page_size);
+    const auto ret =
+        rte_dev_dma_unmap(dev, (*pages_va)[i], (*pages_iova)[i], page_size);
 #pragma GCC diagnostic pop
     if (ret != 0) {
       LOG(ERROR) << utils::Format(
           "Failed to DMA unmap page %u (VA: %p, IOVA: %p, size: %zu) (%s)", i,
-          buffer_pages_va_[i], static_cast<uintptr_t>(buffer_pages_iova_[i]),
-          page_size, rte_strerror(rte_errno));
+          (*pages_va)[i], static_cast<uintptr_t>((*pages_iova)[i]), page_size,
+          rte_strerror(rte_errno));
     }
   }
 
-  const auto pages_nr = buffer_pages_va_.size();
-  const auto ret = rte_extmem_unregister(
-      const_cast<void *>(GetBufPoolAddr<void *>()), pages_nr * page_size);
+  const auto pages_nr = pages_va->size();
+  const auto ret = rte_extmem_unregister((*pages_va)[0], pages_nr * page_size);
   if (ret != 0) {
     LOG(ERROR) << "Failed to unregister external memory with DPDK ("
                << rte_strerror(rte_errno) << ")";
   }
 
+  pages_va->clear();
+  pages_iova->clear();
+}
+
+bool Channel::SetBufClassIOVA(uint32_t cls) {
+  const auto *buf_class = __machnet_channel_buf_class(ctx(), cls);
+  for (auto i = 0u; i < buf_class->buf_nr; ++i) {
+    auto *msg_buf = GetMsgBuf(MACHNET_MSGBUF_INDEX(cls, i));
+    const auto *buf_va = msg_buf->base();
+    msg_buf->set_iova(rte_mem_virt2phy(buf_va));
+    if (msg_buf->iova() == RTE_BAD_IOVA) {
+      LOG(ERROR) << utils::Format("Failed to get IOVA for buffer@%p)", buf_va);
+      return false;
+    }
+  }
+
+  return true;
+}
+
+bool Channel::RegisterMemForDMA(rte_device *dev) {
+  if (attached_dev_ != nullptr) {
+    LOG(ERROR) << "Memory is already registered with DPDK";
+    return false;
+  }
+
+  // There is padding at the end of the memory region to make sure that the end
+  // is page-aligned.
+  LOG_IF(FATAL,
+         GetBufPoolAddr() + GetBufPoolSize() > __machnet_channel_end(ctx()))
+      << "Out of bounds!";
+
+  if (!DMAMapRegion(dev, GetBufPoolAddr(), GetBufPoolSize(), &buffer_pages_va_,
+                    &buffer_pages_iova_))
+    return false;
+
+  // Update the IOVA addresses of the buffers in the buffer pool, for every
+  // size class.
+  for (auto cls = 0u; cls < GetBufClassCount(); ++cls) {
+    if (!SetBufClassIOVA(cls)) return false;
+  }
+
+  // Extension segments might have been created in the meantime.
+  for (auto cls = GetBufClassCount(); cls < MACHNET_CHANNEL_BUF_CLASS_MAX;
+       ++cls) {
+    const auto *buf_class = __machnet_channel_buf_class(ctx(), cls);
+    if (buf_class->state == MACHNET_CHANNEL_BUF_CLASS_FREE) continue;
+    auto &segment = segments_[cls];
+    const auto *start = __machnet_channel_mem_ofs(
+        ctx(), __machnet_channel_segment_ofs(ctx(), cls));
+    if (!DMAMapRegion(dev, start, buf_class->segment_size, &segment.pages_va,
+                      &segment.pages_iova) ||
+        !SetBufClassIOVA(cls))
+      return false;
+  }
+
+  attached_dev_ = dev;
+
+  return true;
+}
+
+void Channel::UnregisterDMAMem() {
+  if (attached_dev_ == nullptr) {
+    LOG(ERROR) << "Memory is not registered with DPDK";
+    return;
+  }
+
+  for (auto &segment : segments_)
+    DMAUnmapRegion(attached_dev_, &segment.pages_va, &segment.pages_iova);
+  DMAUnmapRegion(attached_dev_, &buffer_pages_va_, &buffer_pages_iova_);
+
   attached_dev_ = nullptr;
 }
 
+double Channel::GetFreeBufFraction(uint32_t parent) const {
+  uint64_t avail = 0, total = 0;
+  for (auto cls = 0u; cls < MACHNET_CHANNEL_BUF_CLASS_MAX; ++cls) {
+    const auto *buf_class = __machnet_channel_buf_class(ctx(), cls);
+    if (buf_class->parent != parent ||
+        !__machnet_channel_buf_class_usable(ctx(), cls))
+      continue;
+    avail += __machnet_channel_class_buffers_avail(ctx(), cls);
+    total += buf_class->buf_nr;
+  }
+
+  return total == 0 ? 1.0 : static_cast<double>(avail) / total;
+}
+
+size_t Channel::GetSegmentSlotNr(size_t buf_ring_slot_nr, size_t buffer_size,
+                                 bool is_posix_shm) {
+  while (buf_ring_slot_nr > 2 &&
+         __machnet_channel_segment_calculate_size(
+             buf_ring_slot_nr, buffer_size, is_posix_shm) ==
+             static_cast<size_t>(-1))
+    buf_ring_slot_nr /= 2;
+  return buf_ring_slot_nr;
+}
+
+size_t Channel::GetMaxSegmentsSize(
+    const std::vector<MachnetChannelBufClassConf_t> &buf_classes,
+    bool is_posix_shm) {
+  if (buf_classes.size() >= MACHNET_CHANNEL_BUF_CLASS_MAX) return 0;
+  size_t segment_size = 0;
+  for (const auto &buf_class : buf_classes) {
+    const auto size = __machnet_channel_segment_calculate_size(
+        GetSegmentSlotNr(buf_class.buf_ring_slot_nr, buf_class.buffer_size,
+                         is_posix_shm),
+        buf_class.buffer_size, is_posix_shm);
+    if (size != static_cast<size_t>(-1))
+      segment_size = std::max(segment_size, size);
+  }
+
+  return (MACHNET_CHANNEL_BUF_CLASS_MAX - buf_classes.size()) * segment_size;
+}
+
+size_t Channel::GetMaxSegmentsSize() const {
+  std::vector<MachnetChannelBufClassConf_t> buf_classes;
+  for (auto cls = 0u; cls < GetBufClassCount(); ++cls) {
+    const auto *buf_class = __machnet_channel_buf_class(ctx(), cls);
+    buf_classes.push_back({.buf_ring_slot_nr = buf_class->buf_nr + 1,
+                           .buffer_size = buf_class->buf_mss});
+  }
+
+  return GetMaxSegmentsSize(buf_classes, IsPosixShm());
+}
+
+bool Channel::CreateSegment(uint32_t parent) {
+  auto cls = GetBufClassCount();
+  while (cls < MACHNET_CHANNEL_BUF_CLASS_MAX &&
+         __machnet_channel_buf_class(ctx(), cls)->state !=
+             MACHNET_CHANNEL_BUF_CLASS_FREE)
+    ++cls;
+  if (cls == MACHNET_CHANNEL_BUF_CLASS_MAX) return false;  // No free slots.
+
+  const auto *parent_class = __machnet_channel_buf_class(ctx(), parent);
+  const auto buf_ring_slot_nr = GetSegmentSlotNr(
+      parent_class->buf_nr + 1, parent_class->buf_mss, IsPosixShm());
+
+  auto &segment = segments_[cls];
+  if (__machnet_channel_segment_create(ctx(), cls, parent, buf_ring_slot_nr,
+                                       IsPosixShm(), &segment.fd) != 0) {
+    LOG(WARNING) << "Channel " << GetName()
+                 << ": failed to create a segment for class " << parent;
+    return false;
+  }
+  segment.periods = 0;
+
+  const auto *buf_class = __machnet_channel_buf_class(ctx(), cls);
+  if (attached_dev_ != nullptr) {
+    const auto *start = __machnet_channel_mem_ofs(
+        ctx(), __machnet_channel_segment_ofs(ctx(), cls));
+    if (!DMAMapRegion(attached_dev_, start, buf_class->segment_size,
+                      &segment.pages_va, &segment.pages_iova) ||
+        !SetBufClassIOVA(cls)) {
+      LOG(ERROR) << "Channel " << GetName()
+                 << ": failed to register segment " << cls << " for DMA";
+      DestroySegment(cls);
+      return false;
+    }
+  }
+
+  LOG(INFO) << "Channel " << GetName() << ": extending class " << parent
+            << " with segment " << cls << " (" << buf_class->buf_nr
+            << " buffers, " << buf_class->segment_size << " bytes)";
+  return true;
+}
+
+void Channel::DestroySegment(uint32_t cls) {
+  auto &segment = segments_[cls];
+  DMAUnmapRegion(attached_dev_, &segment.pages_va, &segment.pages_iova);
+  __machnet_channel_segment_destroy(ctx(), cls, &segment.fd, IsPosixShm());
+  segment.periods = 0;
+  LOG(INFO) << "Channel " << GetName() << ": released segment " << cls;
+}
+
+void Channel::UpdateSegments() {
+  auto *ctx = this->ctx();
+  auto *buf_classes = ctx->data_ctx.buf_classes;
+  // The segments the engine may still touch.
+  const auto engine_segments = GetSyncedSegments();
+  bool order_changed = false;
+
+  // Advance the state of the existing segments. A new state is not acted upon
+  // until the application has acknowledged the previous one.
+  for (auto cls = GetBufClassCount(); cls < MACHNET_CHANNEL_BUF_CLASS_MAX;
+       ++cls) {
+    const auto *buf_class = &buf_classes[cls];
+    auto &segment = segments_[cls];
+    const bool acked = __machnet_channel_buf_class_acked(ctx, cls);
+    ++segment.periods;
+    switch (buf_class->state) {
+      case MACHNET_CHANNEL_BUF_CLASS_MAPPING:
+        if (acked) {
+          __machnet_channel_buf_class_set_state(
+              ctx, cls, MACHNET_CHANNEL_BUF_CLASS_ACTIVE);
+          segment.periods = 0;
+          order_changed = true;
+        } else if (segment.periods > kSegmentMapTimeoutPeriods) {
+          LOG(WARNING) << "Channel " << GetName() << ": segment " << cls
+                       << " was not mapped by the application";
+          DestroySegment(cls);
+        }
+        break;
+      case MACHNET_CHANNEL_BUF_CLASS_ACTIVE:
+        if (__machnet_channel_class_buffers_avail(ctx, cls) !=
+                buf_class->buf_nr ||
+            GetFreeBufFraction(buf_class->parent) < kSegmentShrinkThreshold) {
+          segment.periods = 0;
+        } else if (segment.periods >= kSegmentIdlePeriods) {
+          __machnet_channel_buf_class_set_state(
+              ctx, cls, MACHNET_CHANNEL_BUF_CLASS_DRAINING);
+          segment.periods = 0;
+          order_changed = true;
+        }
+        break;
+      case MACHNET_CHANNEL_BUF_CLASS_DRAINING:
+        if (GetFreeBufFraction(buf_class->parent) < kSegmentGrowThreshold) {
+          // Needed again.
+          __machnet_channel_buf_class_set_state(
+              ctx, cls, MACHNET_CHANNEL_BUF_CLASS_ACTIVE);
+          segment.periods = 0;
+          order_changed = true;
+        } else if (acked && (engine_segments & (1U << cls)) == 0 &&
+                   __machnet_channel_class_buffers_avail(ctx, cls) ==
+                       buf_class->buf_nr) {
+          // Neither side allocates from the segment any more, so all of its
+          // buffers stay back.
+          __machnet_channel_buf_class_set_state(
+              ctx, cls, MACHNET_CHANNEL_BUF_CLASS_UNMAPPING);
+          segment.periods = 0;
+        }
+        break;
+      case MACHNET_CHANNEL_BUF_CLASS_UNMAPPING:
+        if (acked) DestroySegment(cls);
+        break;
+      default:
+        break;
+    }
+  }
+  if (order_changed) __machnet_channel_buf_class_order_update(ctx);
+
+  // Extend the classes that run low, one pending segment at a time.
+  for (auto parent = 0u; parent < GetBufClassCount(); ++parent) {
+    if (GetFreeBufFraction(parent) >= kSegmentGrowThreshold) continue;
+    bool pending = false;
+    for (auto cls = GetBufClassCount(); cls < MACHNET_CHANNEL_BUF_CLASS_MAX;
+         ++cls) {
+      pending |= buf_classes[cls].state == MACHNET_CHANNEL_BUF_CLASS_MAPPING &&
+                 buf_classes[cls].parent == parent;
+    }
+    if (!pending) CreateSegment(parent);
+  }
+
+  // Let the engine switch to the active segments; they are mapped (and
+  // registered for DMA) already.
+  uint32_t active_segments = 0;
+  for (auto cls = GetBufClassCount(); cls < MACHNET_CHANNEL_BUF_CLASS_MAX;
+       ++cls) {
+    if (buf_classes[cls].state == MACHNET_CHANNEL_BUF_CLASS_ACTIVE)
+      active_segments |= 1U << cls;
+  }
+  PublishSegments(active_segments);
+}
+
+int Channel::GetSegmentFd(uint32_t cls) {
+  if (cls < GetBufClassCount() || cls >= MACHNET_CHANNEL_BUF_CLASS_MAX)
+    return -1;
+  if (__machnet_channel_buf_class(ctx(), cls)->state !=
+          MACHNET_CHANNEL_BUF_CLASS_MAPPING ||
+      segments_[cls].fd < 0)
+    return -1;
+
+  return dup(segments_[cls].fd);
+}
+
+void Channel::UpdateStatsSnapshot() {
+  auto *ctx = this->ctx();
+  auto *stats = this->stats();
+  std::atomic_ref<uint64_t> seq(stats->snapshot_seq);
+  const auto seq_begin = seq.load(std::memory_order_relaxed);
+  seq.store(seq_begin + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+
+  const auto *machnet_ring = __machnet_channel_machnet_ring(ctx);
+  const auto *app_ring = __machnet_channel_app_ring(ctx);
+  const auto *completion_ring = __machnet_channel_completion_ring(ctx);
+  stats->machnet_ring_pending = jring_count(machnet_ring);
+  stats->machnet_ring_size = machnet_ring->capacity;
+  stats->app_ring_pending = jring_count(app_ring);
+  stats->app_ring_size = app_ring->capacity;
+  stats->completion_ring_pending = jring_count(completion_ring);
+  stats->completion_ring_size = completion_ring->capacity;
+  stats->buf_free = GetFreeBufCount();
+  stats->buf_total = GetTotalBufCount();
+
+  uint32_t nr = 0;
+  for (const auto &flow : active_flows_) {
+    if (nr < MACHNET_CHANNEL_STATS_FLOW_MAX) {
+      const auto &key = flow->key();
+      const auto &pcb = flow->pcb();
+      auto *flow_stats = &stats->flows[nr];
+      flow_stats->flow.src_ip = key.local_addr.address.value();
+      flow_stats->flow.dst_ip = key.remote_addr.address.value();
+      flow_stats->flow.src_port = key.local_port.port.value();
+      flow_stats->flow.dst_port = key.remote_port.port.value();
+      flow_stats->state = static_cast<uint32_t>(flow->state());
+      flow_stats->cwnd = pcb.cwnd;
+      flow_stats->inflight = pcb.snd_nxt - pcb.snd_una;
+      flow_stats->pending_segments = flow->NumPendingSegments();
+      flow_stats->srtt_us = pcb.srtt_us;
+      flow_stats->min_rtt_us = pcb.min_rtt_us;
+    }
+    nr++;
+  }
+  stats->flow_nr = nr;
+
+  seq.store(seq_begin + 2, std::memory_order_release);
+}
+
 void Channel::RemoveFlow(
     const std::list<std::unique_ptr<Flow>>::const_iterator &flow_it) {
   active_flows_.erase(flow_it);
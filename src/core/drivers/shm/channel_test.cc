@@ -12,7 +12,10 @@
 #include <unistd.h>
 #include <utils.h>
 
+#include <algorithm>
+#include <array>
 #include <atomic>
+#include <chrono>
 #include <random>
 #include <thread>
 
@@ -174,6 +177,7 @@ TEST(BasicChannelTest, ChannelDequeue) {
   EXPECT_EQ(batch.GetSize(), 2);
   EXPECT_TRUE(check_msg(channel, batch.bufs()[0], msg1));
   EXPECT_TRUE(check_msg(channel, batch.bufs()[1], msg2));
+  machnet_detach(channel->ctx());
 }
 
 TEST(BasicChannelTest, ChannelEnqueue) {
@@ -217,6 +221,163 @@ TEST(BasicChannelTest, ChannelEnqueue) {
   EXPECT_EQ(machnet_recvmsg(channel->ctx(), &rx_msghdr), 1);
   EXPECT_EQ(rx_msghdr.msg_size, kMessageSize);
   EXPECT_EQ(rx_msg, tx_msg);
+  machnet_detach(channel->ctx());
+}
+
+// Calls into the application's data path until it has acknowledged the state
+// of an extension segment (the segments are processed in the background).
+bool app_segment_acked(MachnetChannelCtx_t *ctx, uint32_t cls) {
+  for (int i = 0; i < 10000; i++) {
+    MachnetFlow_t flow;
+    char buf[1];
+    machnet_recv(ctx, buf, sizeof(buf), &flow);
+    if (__machnet_channel_buf_class_acked(ctx, cls)) return true;
+    std::this_thread::sleep_for(std::chrono::microseconds(100));
+  }
+  return false;
+}
+
+// Fill the channel with single-buffer messages (from the application) until
+// less than 1/8 of its buffers are free.
+uint32_t app_fill_channel(juggler::shm::Channel *channel) {
+  const std::vector<char> msg(channel->GetUsableBufSize(), 'a');
+  uint32_t msg_nr = 0;
+  while (channel->GetFreeBufCount() >= channel->GetTotalBufCount() / 8) {
+    if (!app_msg_enqueue(channel->ctx(), msg)) break;
+    msg_nr++;
+  }
+  return msg_nr;
+}
+
+// Dequeue (and hold) the messages the application has sent.
+void machnet_dequeue_all(juggler::shm::Channel *channel,
+                         std::vector<MachnetRingSlot_t> *held) {
+  std::array<MachnetRingSlot_t, juggler::shm::MsgBufBatch::kMaxBurst> indices;
+  std::array<juggler::shm::MsgBuf *, juggler::shm::MsgBufBatch::kMaxBurst> msgs;
+  uint32_t ret;
+  while ((ret = channel->DequeueMessages(indices.data(), msgs.data(),
+                                         indices.size())) != 0) {
+    held->insert(held->end(), indices.begin(), indices.begin() + ret);
+  }
+}
+
+TEST(ChannelSegments, GrowShrink) {
+  const uint32_t kChannelRingSize = 1 << 8;  // 256 slots for all rings.
+  const uint32_t kBufferSize = 1 << 12;      // 4096 bytes for buffer.
+  const uint32_t kSegment = 1;
+  const int kMaxPeriods = 100;
+
+  juggler::shm::ChannelManager channel_mgr;
+  const std::string channel_name = std::string(fname) + "-grow-shrink";
+  ASSERT_TRUE(channel_mgr.AddChannel(channel_name.c_str(), kChannelRingSize,
+                                     kChannelRingSize, kChannelRingSize,
+                                     kBufferSize));
+  auto channel = channel_mgr.GetChannel(channel_name.c_str());
+  ASSERT_NE(channel, nullptr);
+  if (!channel->IsPosixShm()) GTEST_SKIP() << "Needs POSIX shared memory.";
+  auto *ctx = channel->ctx();
+  const auto *segment = __machnet_channel_buf_class(ctx, kSegment);
+  const auto total_buf_nr = channel->GetTotalBufCount();
+  const auto free_buf_nr = channel->GetFreeBufCount();
+
+  // Run the channel low on buffers; it is extended with a segment, which the
+  // engine does not use until the application has mapped it.
+  ASSERT_GT(app_fill_channel(channel.get()), 0);
+  std::vector<MachnetRingSlot_t> held;
+  machnet_dequeue_all(channel.get(), &held);
+  channel->UpdateSegments();
+  ASSERT_EQ(segment->state, MACHNET_CHANNEL_BUF_CLASS_MAPPING);
+  EXPECT_EQ(segment->parent, 0);
+  channel->SyncSegments();
+  EXPECT_EQ(channel->GetTotalBufCount(), total_buf_nr);
+
+  ASSERT_TRUE(app_segment_acked(ctx, kSegment));
+  channel->UpdateSegments();
+  ASSERT_EQ(segment->state, MACHNET_CHANNEL_BUF_CLASS_ACTIVE);
+  EXPECT_EQ(channel->GetSyncedSegments(), 0);
+  channel->SyncSegments();
+  EXPECT_EQ(channel->GetSyncedSegments(), 1U << kSegment);
+  EXPECT_EQ(channel->GetTotalBufCount(), total_buf_nr + segment->buf_nr);
+
+  // Both sides allocate from the segment once the default class runs out.
+  ASSERT_GT(app_fill_channel(channel.get()), 0);
+  machnet_dequeue_all(channel.get(), &held);
+  EXPECT_TRUE(std::any_of(held.begin(), held.end(), [](auto index) {
+    return MACHNET_MSGBUF_INDEX_CLASS(index) == kSegment;
+  }));
+  std::vector<juggler::shm::MsgBuf *> engine_bufs;
+  juggler::shm::MsgBuf *msg_buf;
+  while ((msg_buf = channel->MsgBufAlloc()) != nullptr)
+    engine_bufs.push_back(msg_buf);
+  EXPECT_TRUE(
+      std::any_of(engine_bufs.begin(), engine_bufs.end(), [](auto *buf) {
+        return MACHNET_MSGBUF_INDEX_CLASS(buf->index()) == kSegment;
+      }));
+
+  // Release everything (including the buffers the application has cached);
+  // the idle segment is drained, and reclaimed once the application has
+  // acknowledged each step.
+  for (auto *buf : engine_bufs) EXPECT_TRUE(channel->MsgBufFree(buf));
+  EXPECT_TRUE(channel->MsgBufBulkFree(held.data(), held.size()));
+  machnet_detach(ctx);
+  for (int i = 0; i < kMaxPeriods &&
+                  segment->state == MACHNET_CHANNEL_BUF_CLASS_ACTIVE;
+       i++) {
+    channel->UpdateSegments();
+  }
+  ASSERT_EQ(segment->state, MACHNET_CHANNEL_BUF_CLASS_DRAINING);
+  // The engine must switch away from the segment first.
+  channel->UpdateSegments();
+  EXPECT_EQ(segment->state, MACHNET_CHANNEL_BUF_CLASS_DRAINING);
+  channel->SyncSegments();
+  EXPECT_EQ(channel->GetSyncedSegments(), 0);
+  ASSERT_TRUE(app_segment_acked(ctx, kSegment));
+  channel->UpdateSegments();
+  ASSERT_EQ(segment->state, MACHNET_CHANNEL_BUF_CLASS_UNMAPPING);
+  ASSERT_TRUE(app_segment_acked(ctx, kSegment));
+  channel->UpdateSegments();
+  EXPECT_EQ(segment->state, MACHNET_CHANNEL_BUF_CLASS_FREE);
+
+  EXPECT_EQ(channel->GetTotalBufCount(), total_buf_nr);
+  machnet_detach(ctx);
+  EXPECT_EQ(channel->GetFreeBufCount(), free_buf_nr);
+}
+
+TEST(ChannelSegments, MapTimeout) {
+  const uint32_t kChannelRingSize = 1 << 8;  // 256 slots for all rings.
+  const uint32_t kBufferSize = 1 << 12;      // 4096 bytes for buffer.
+  const uint32_t kSegment = 1;
+  const int kMaxPeriods = 100;
+
+  juggler::shm::ChannelManager channel_mgr;
+  const std::string channel_name = std::string(fname) + "-map-timeout";
+  ASSERT_TRUE(channel_mgr.AddChannel(channel_name.c_str(), kChannelRingSize,
+                                     kChannelRingSize, kChannelRingSize,
+                                     kBufferSize));
+  auto channel = channel_mgr.GetChannel(channel_name.c_str());
+  ASSERT_NE(channel, nullptr);
+  auto *ctx = channel->ctx();
+  const auto *segment = __machnet_channel_buf_class(ctx, kSegment);
+
+  ASSERT_GT(app_fill_channel(channel.get()), 0);
+  std::vector<MachnetRingSlot_t> held;
+  machnet_dequeue_all(channel.get(), &held);
+  channel->UpdateSegments();
+  ASSERT_EQ(segment->state, MACHNET_CHANNEL_BUF_CLASS_MAPPING);
+
+  // The application never gets to map the segment (it makes no calls into
+  // the data path), so it is reclaimed.
+  EXPECT_TRUE(channel->MsgBufBulkFree(held.data(), held.size()));
+  machnet_detach(ctx);
+  for (int i = 0; i < kMaxPeriods &&
+                  segment->state == MACHNET_CHANNEL_BUF_CLASS_MAPPING;
+       i++) {
+    channel->UpdateSegments();
+    channel->SyncSegments();
+    EXPECT_EQ(channel->GetSyncedSegments(), 0);
+  }
+  EXPECT_EQ(segment->state, MACHNET_CHANNEL_BUF_CLASS_FREE);
+  EXPECT_EQ(channel->GetTotalBufCount(), kChannelRingSize - 1);
 }
 
 TEST(ChannelFullDuplex, SendRecvMsg) {
@@ -337,16 +498,10 @@ TEST(ChannelFullDuplex, SendRecvMsg) {
     std::vector<MachnetRingSlot_t> buffers;
     uint32_t buffers_size = channel->GetTotalBufCount();
 
-    // Allocate all the buffers in the channel in 3 parts
-    // Allocate from ctx->cache
-    uint32_t current_buffers_cnt;
-    auto ctx = channel->ctx();
-    while (ctx->app_buffer_cache.count > 0)
-      buffers.push_back(
-          ctx->app_buffer_cache.indices[--ctx->app_buffer_cache.count]);
-    current_buffers_cnt = buffers.size();
+    // Allocate all the buffers in the channel in 2 parts (the application
+    // flushed its buffer caches before exiting).
     // Allocate from shm::channel->cache
-    current_buffers_cnt += channel->GetAllCachedBufferIndices(&buffers);
+    uint32_t current_buffers_cnt = channel->GetAllCachedBufferIndices(&buffers);
     // Allocate from ring
     buffers.resize(buffers_size);
     current_buffers_cnt += __machnet_channel_buf_alloc_bulk(
@@ -419,6 +574,7 @@ TEST(ChannelFullDuplex, SendRecvMsg) {
       if (ret == 0) msg_tx++;
     }
 
+    machnet_detach(ctx);
     exit(error);
   }
 }
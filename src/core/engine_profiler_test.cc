@@ -0,0 +1,143 @@
+/**
+ * @file engine_profiler_test.cc
+ *
+ * Unit tests for the engine loop profiler and the sequence lock it publishes
+ * its snapshots with.
+ */
+
+#include <engine_profiler.h>
+#include <gtest/gtest.h>
+#include <seqlock.h>
+
+#include <atomic>
+#include <cstdint>
+#include <thread>
+
+namespace juggler {
+
+TEST(SeqLockTest, StoreLoad) {
+  struct Value {
+    uint64_t a;
+    uint64_t b;
+  };
+  SeqLock<Value> lock;
+
+  Value value{1, 1};
+  EXPECT_EQ(lock.Load(&value), 0);
+  EXPECT_EQ(value.a, 0);
+  EXPECT_EQ(value.b, 0);
+
+  lock.Store({42, 43});
+  EXPECT_EQ(lock.Load(&value), 1);
+  EXPECT_EQ(value.a, 42);
+  EXPECT_EQ(value.b, 43);
+}
+
+TEST(SeqLockTest, Update) {
+  SeqLock<uint64_t> lock;
+  lock.Update([](uint64_t *value) { *value = 7; });
+  lock.Update([](uint64_t *value) { *value *= 6; });
+
+  uint64_t value;
+  EXPECT_EQ(lock.Load(&value), 2);
+  EXPECT_EQ(value, 42);
+}
+
+TEST(SeqLockTest, ConcurrentReadsAreConsistent) {
+  struct Value {
+    uint64_t words[8];
+  };
+  SeqLock<Value> lock;
+  const uint64_t kUpdates = 1 << 18;
+  std::atomic<bool> done{false};
+
+  std::thread writer([&]() {
+    Value value;
+    for (uint64_t i = 1; i <= kUpdates; i++) {
+      for (auto &word : value.words) word = i;
+      lock.Store(value);
+    }
+    done.store(true);
+  });
+
+  uint64_t last = 0;
+  while (!done.load()) {
+    Value value;
+    lock.Load(&value);
+    for (const auto word : value.words) EXPECT_EQ(word, value.words[0]);
+    EXPECT_GE(value.words[0], last);
+    last = value.words[0];
+  }
+  writer.join();
+}
+
+TEST(EngineProfilerTest, Disabled) {
+  EngineProfiler<false> profiler;
+  static_assert(std::is_empty_v<EngineProfiler<false>>);
+
+  profiler.IterationBegin(time::rdtsc());
+  profiler.StageEnd(EngineStage::kRxBurst);
+  profiler.IterationEnd(true);
+  profiler.Publish();
+
+  EngineProfile profile;
+  EXPECT_FALSE(profiler.GetProfile(&profile));
+}
+
+TEST(EngineProfilerTest, BusyAndIdleIterations) {
+  EngineProfiler<true> profiler;
+  EngineProfile profile;
+  EXPECT_FALSE(profiler.GetProfile(&profile));
+
+  const size_t kBusyIterations = 100;
+  const size_t kIdleIterations = 300;
+  for (size_t i = 0; i < kBusyIterations + kIdleIterations; i++) {
+    const bool busy = i < kBusyIterations;
+    profiler.IterationBegin(time::rdtsc());
+    profiler.StageEnd(EngineStage::kRxBurst);
+    if (busy) {
+      // Two marks of the same stage in one iteration add up.
+      profiler.StageEnd(EngineStage::kMsgProcess);
+      profiler.StageEnd(EngineStage::kMsgProcess);
+    }
+    profiler.StageEnd(EngineStage::kTx);
+    profiler.IterationEnd(busy);
+  }
+  profiler.Publish();
+
+  ASSERT_TRUE(profiler.GetProfile(&profile));
+  EXPECT_EQ(profile.iterations, kBusyIterations + kIdleIterations);
+  EXPECT_EQ(profile.busy_iterations, kBusyIterations);
+  EXPECT_GT(profile.busy_cycles, 0);
+  EXPECT_GT(profile.idle_cycles, 0);
+
+  uint64_t stage_cycles = 0;
+  for (const auto &stage : profile.stages) stage_cycles += stage.cycles;
+  EXPECT_EQ(stage_cycles, profile.busy_cycles);
+
+  const auto &periodic =
+      profile.stages[static_cast<size_t>(EngineStage::kPeriodic)];
+  EXPECT_EQ(periodic.cycles, 0);
+  EXPECT_EQ(periodic.max, 0);
+
+  const auto &msg_process =
+      profile.stages[static_cast<size_t>(EngineStage::kMsgProcess)];
+  EXPECT_GT(msg_process.cycles, 0);
+  EXPECT_LE(msg_process.p50, msg_process.p99);
+  EXPECT_LE(msg_process.p99, msg_process.p999);
+  EXPECT_GT(msg_process.max, 0);
+
+  // Percentiles cover one publishing interval.
+  profiler.Publish();
+  ASSERT_TRUE(profiler.GetProfile(&profile));
+  EXPECT_EQ(profile.iterations, kBusyIterations + kIdleIterations);
+  EXPECT_EQ(
+      profile.stages[static_cast<size_t>(EngineStage::kMsgProcess)].max, 0);
+}
+
+}  // namespace juggler
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
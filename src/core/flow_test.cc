@@ -206,8 +206,8 @@ class FlowTest : public ::testing::Test {
 };
 
 TEST_F(FlowTest, TXQueue_init) {
-  EXPECT_EQ(tx_tracking_->NumUnsentMsgbufs(), 0);
-  EXPECT_EQ(tx_tracking_->NumTrackedMsgbufs(), 0);
+  EXPECT_EQ(tx_tracking_->NumUnsentSegments(), 0);
+  EXPECT_EQ(tx_tracking_->NumTrackedSegments(), 0);
   EXPECT_EQ(tx_tracking_->GetOldestUnackedMsgBuf(), nullptr);
   EXPECT_EQ(tx_tracking_->GetOldestUnsentMsgBuf(), nullptr);
   EXPECT_EQ(tx_tracking_->GetLastMsgBuf(), nullptr);
@@ -231,8 +231,8 @@ TEST_F(FlowTest, TXQueue_PushPop) {
     last = channel_->GetMsgBuf(msgbuf->last());
     tx_tracking_->Append(msgbuf);
     total_buffers_nr += buffers_nr;
-    EXPECT_EQ(tx_tracking_->NumUnsentMsgbufs(), total_buffers_nr);
-    EXPECT_EQ(tx_tracking_->NumTrackedMsgbufs(), total_buffers_nr);
+    EXPECT_EQ(tx_tracking_->NumUnsentSegments(), total_buffers_nr);
+    EXPECT_EQ(tx_tracking_->NumTrackedSegments(), total_buffers_nr);
     EXPECT_EQ(tx_tracking_->GetOldestUnackedMsgBuf(), first);
     EXPECT_EQ(tx_tracking_->GetLastMsgBuf(),
               channel_->GetMsgBuf(msgbuf->last()));
@@ -244,11 +244,11 @@ TEST_F(FlowTest, TXQueue_PushPop) {
 
   auto msgbuf = first;
   for (uint32_t i = 0; i < total_buffers_nr; i++) {
-    EXPECT_EQ(tx_tracking_->NumTrackedMsgbufs(), total_buffers_nr);
-    EXPECT_EQ(tx_tracking_->NumUnsentMsgbufs(), total_buffers_nr - i);
+    EXPECT_EQ(tx_tracking_->NumTrackedSegments(), total_buffers_nr);
+    EXPECT_EQ(tx_tracking_->NumUnsentSegments(), total_buffers_nr - i);
     auto buf = tx_tracking_->GetAndUpdateOldestUnsent();
     EXPECT_TRUE(buf.has_value());
-    EXPECT_EQ(buf.value(), msgbuf);
+    EXPECT_EQ(buf.value().msgbuf, msgbuf);
     if (msgbuf->has_next() || msgbuf->has_chain())
       msgbuf = channel_->GetMsgBuf(msgbuf->next());
     else
@@ -256,8 +256,8 @@ TEST_F(FlowTest, TXQueue_PushPop) {
     EXPECT_EQ(tx_tracking_->GetOldestUnackedMsgBuf(), first);
     EXPECT_EQ(tx_tracking_->GetOldestUnsentMsgBuf(), msgbuf);
     EXPECT_EQ(tx_tracking_->GetLastMsgBuf(), last);
-    EXPECT_EQ(tx_tracking_->NumUnsentMsgbufs(), total_buffers_nr - i - 1);
-    EXPECT_EQ(tx_tracking_->NumTrackedMsgbufs(), total_buffers_nr);
+    EXPECT_EQ(tx_tracking_->NumUnsentSegments(), total_buffers_nr - i - 1);
+    EXPECT_EQ(tx_tracking_->NumTrackedSegments(), total_buffers_nr);
   }
 
   auto buf = tx_tracking_->GetAndUpdateOldestUnsent();
@@ -265,11 +265,123 @@ TEST_F(FlowTest, TXQueue_PushPop) {
   EXPECT_EQ(tx_tracking_->GetOldestUnsentMsgBuf(), nullptr);
 
   tx_tracking_->ReceiveAcks(total_buffers_nr);
-  EXPECT_EQ(tx_tracking_->NumUnsentMsgbufs(), 0);
-  EXPECT_EQ(tx_tracking_->NumTrackedMsgbufs(), 0);
+  EXPECT_EQ(tx_tracking_->NumUnsentSegments(), 0);
+  EXPECT_EQ(tx_tracking_->NumTrackedSegments(), 0);
   EXPECT_EQ(channel_->GetFreeBufCount(), channel_->GetTotalBufCount());
 }
 
+TEST_F(FlowTest, TXQueue_NotifyDelivery) {
+  const auto kMsgLen = 3 * channel_->GetUsableBufSize() + 1;
+  const size_t kMsgsNr = 4;
+  uint32_t total_buffers_nr = 0;
+  for (size_t i = 0; i < kMsgsNr; i++) {
+    std::vector<uint8_t> data(kMsgLen);
+    auto *msgbuf = CreateMsg(data);
+    // Only ask for notifications on even messages.
+    if (i % 2 == 0) {
+      msgbuf->add_flags(MACHNET_MSGBUF_NOTIFY_DELIVERY);
+      msgbuf->set_cookie(i);
+    }
+    tx_tracking_->Append(msgbuf);
+    total_buffers_nr += 4;
+  }
+  for (uint32_t i = 0; i < total_buffers_nr; i++) {
+    EXPECT_TRUE(tx_tracking_->GetAndUpdateOldestUnsent().has_value());
+  }
+
+  MachnetTxCompletion_t completions[kMsgsNr];
+  const auto *ctx = channel_->ctx();
+  // Acknowledging all but the last buffer of a message is not a delivery.
+  tx_tracking_->ReceiveAcks(3);
+  EXPECT_EQ(__machnet_channel_completion_ring_dequeue(ctx, kMsgsNr,
+                                                      completions),
+            0);
+  tx_tracking_->ReceiveAcks(1);
+  EXPECT_EQ(__machnet_channel_completion_ring_dequeue(ctx, kMsgsNr,
+                                                      completions),
+            1);
+  EXPECT_EQ(completions[0].cookie, 0);
+  EXPECT_EQ(completions[0].status, MACHNET_TX_COMPLETION_DELIVERED);
+
+  tx_tracking_->ReceiveAcks(total_buffers_nr - 4);
+  EXPECT_EQ(__machnet_channel_completion_ring_dequeue(ctx, kMsgsNr,
+                                                      completions),
+            1);
+  EXPECT_EQ(completions[0].cookie, 2);
+  EXPECT_EQ(channel_->GetFreeBufCount(), channel_->GetTotalBufCount());
+}
+
+TEST_F(FlowTest, TXQueue_Segments) {
+  // A channel with a class of large buffers, which span several packets.
+  const char *kChannelName = "flow_test_segments";
+  const uint32_t kLargeBufferSize = 16 * KB;
+  CHECK(channel_mgr_.AddChannel(
+      kChannelName, kChannelRingSize, kChannelRingSize,
+      {{.buf_ring_slot_nr = kBufferRingSize, .buffer_size = kBufferSize},
+       {.buf_ring_slot_nr = 1 << 6, .buffer_size = kLargeBufferSize}}));
+  auto channel = channel_mgr_.GetChannel(kChannelName);
+  TXTracking tx_tracking(CHECK_NOTNULL(channel.get()));
+  const auto kSegmentSize = channel->GetUsableBufSize();
+  const auto kTotalBufCount = channel->GetTotalBufCount();
+
+  // A message made of a large buffer followed by a default one.
+  MachnetRingSlot_t index;
+  ASSERT_EQ(__machnet_channel_class_buf_alloc_bulk(channel->ctx(), 1, 1,
+                                                   &index, nullptr),
+            1);
+  __machnet_channel_buf_init(__machnet_channel_buf(channel->ctx(), index));
+  auto *large = channel->GetMsgBuf(index);
+  auto *small = CHECK_NOTNULL(channel->MsgBufAlloc());
+  const uint32_t kLargeLen = 2 * kSegmentSize + 100;
+  const uint32_t kSmallLen = 10;
+  ASSERT_NE(large->append(kLargeLen), nullptr);
+  ASSERT_NE(small->append(kSmallLen), nullptr);
+  large->set_next(small);
+  large->set_last(small->index());
+  large->set_msg_length(kLargeLen + kSmallLen);
+  large->mark_first();
+  small->mark_last();
+
+  tx_tracking.Append(large);
+  EXPECT_EQ(tx_tracking.NumUnsentSegments(), 4);
+  EXPECT_EQ(tx_tracking.NumTrackedSegments(), 4);
+
+  const std::vector<TXTracking::Segment> kExpected = {
+      {.msgbuf = large, .offset = 0, .length = kSegmentSize},
+      {.msgbuf = large, .offset = kSegmentSize, .length = kSegmentSize},
+      {.msgbuf = large, .offset = 2 * kSegmentSize, .length = 100},
+      {.msgbuf = small, .offset = 0, .length = kSmallLen}};
+  for (const auto &expected : kExpected) {
+    auto segment = tx_tracking.GetAndUpdateOldestUnsent();
+    ASSERT_TRUE(segment.has_value());
+    EXPECT_EQ(segment.value(), expected);
+    EXPECT_EQ(tx_tracking.GetOldestUnackedSegment(), kExpected[0]);
+  }
+  EXPECT_FALSE(tx_tracking.GetAndUpdateOldestUnsent().has_value());
+
+  // Only the first segment starts the message, and only the last one ends it.
+  EXPECT_EQ(kExpected[0].flags(),
+            MACHNET_MSGBUF_FLAGS_SYN | MACHNET_MSGBUF_FLAGS_SG);
+  EXPECT_EQ(kExpected[1].flags(), MACHNET_MSGBUF_FLAGS_SG);
+  EXPECT_EQ(kExpected[2].flags(), MACHNET_MSGBUF_FLAGS_SG);
+  EXPECT_EQ(kExpected[3].flags(), MACHNET_MSGBUF_FLAGS_FIN);
+
+  // The large buffer is released once all its segments are acknowledged.
+  tx_tracking.ReceiveAcks(2);
+  EXPECT_EQ(tx_tracking.GetOldestUnackedSegment(), kExpected[2]);
+  EXPECT_EQ(channel->GetFreeBufCount(), kTotalBufCount - 2);
+  tx_tracking.ReceiveAcks(1);
+  EXPECT_EQ(channel->GetFreeBufCount(), kTotalBufCount - 1);
+  tx_tracking.ReceiveAcks(1);
+  EXPECT_EQ(tx_tracking.NumTrackedSegments(), 0);
+  EXPECT_EQ(tx_tracking.GetOldestUnackedMsgBuf(), nullptr);
+  EXPECT_EQ(tx_tracking.GetLastMsgBuf(), nullptr);
+  EXPECT_EQ(channel->GetFreeBufCount(), kTotalBufCount);
+
+  channel.reset();
+  channel_mgr_.DestroyChannel(kChannelName);
+}
+
 TEST_F(FlowTest, RXQueue_Push) {
   std::mt19937 engine(rng_);
   std::uniform_int_distribution<std::mt19937::result_type> dist(
@@ -314,6 +426,8 @@ TEST_F(FlowTest, RXQueue_Push) {
     rx_msghdr.msg_iovlen = 1;
     auto ret = machnet_recvmsg(channel_->ctx(), &rx_msghdr);
     EXPECT_EQ(ret, 1) << "Failed to deliver message to application";
+    // Return the buffers cached by this thread to the channel.
+    machnet_detach(channel_->ctx());
     EXPECT_EQ(tx_message, rx_message);
     EXPECT_EQ(channel_->GetFreeBufCount(), channel_->GetTotalBufCount());
 
@@ -394,6 +508,8 @@ TEST_F(FlowTest, RXQueue_Push_OutOfOrder1) {
     rx_msghdr.msg_iovlen = 1;
     auto ret = machnet_recvmsg(channel_->ctx(), &rx_msghdr);
     EXPECT_EQ(ret, 1) << "Failed to deliver message to application";
+    // Return the buffers cached by this thread to the channel.
+    machnet_detach(channel_->ctx());
     EXPECT_EQ(tx_message, rx_message);
     EXPECT_EQ(channel_->GetFreeBufCount(), channel_->GetTotalBufCount());
 
@@ -493,6 +609,8 @@ TEST_F(FlowTest, RXQueue_Push_OutOfOrder2) {
     rx_msghdr.msg_iovlen = 1;
     auto ret = machnet_recvmsg(channel_->ctx(), &rx_msghdr);
     EXPECT_EQ(ret, 1) << "Failed to deliver message to application";
+    // Return the buffers cached by this thread to the channel.
+    machnet_detach(channel_->ctx());
     EXPECT_EQ(tx_message, rx_message);
     EXPECT_EQ(channel_->GetFreeBufCount(), channel_->GetTotalBufCount());
 
@@ -503,6 +621,45 @@ TEST_F(FlowTest, RXQueue_Push_OutOfOrder2) {
   }
 }
 
+TEST_F(FlowTest, DeferredAck) {
+  // A TX ring that is never flushed with packets on it, so it needs no port.
+  const uint32_t kTxMbufsNr = 64;
+  dpdk::TxRing txring(nullptr, 0, 0, dpdk::PmdRing::kDefaultRingDescNr,
+                      rte_eth_txconf{}, kTxMbufsNr,
+                      dpdk::PmdRing::kDefaultFrameSize + RTE_ETHER_HDR_LEN +
+                          RTE_ETHER_CRC_LEN + RTE_PKTMBUF_HEADROOM);
+  Tracer tracer;
+  Flow flow(local_addr_, local_port_, remote_addr_, remote_port_,
+            Ethernet::Address("02:00:00:00:00:01"),
+            Ethernet::Address("02:00:00:00:00:02"), &txring, &tracer,
+            [](shm::Channel *, bool, const Key &) {}, channel_.get());
+
+  // Run the packet pool of the ring dry; the ring is congested.
+  std::vector<dpdk::Packet *> packets;
+  while (auto *packet = txring.GetPacketPool()->PacketAlloc())
+    packets.push_back(packet);
+  txring.FlushStaged();
+  ASSERT_TRUE(txring.IsCongested());
+
+  // ACKs are held back (and counted once) while it is.
+  flow.SendAck();
+  flow.SendAck();
+  EXPECT_TRUE(flow.ack_deferred_);
+  EXPECT_EQ(flow.pcb_.deferred_acks, 1);
+  EXPECT_EQ(txring.GetStagedCount(), 0);
+
+  // Once the pool refills, the deferred ACK goes out on resume.
+  for (auto *packet : packets) dpdk::Packet::Free(packet);
+  txring.FlushStaged();
+  ASSERT_FALSE(txring.IsCongested());
+  flow.ResumeTx();
+  EXPECT_FALSE(flow.ack_deferred_);
+  EXPECT_EQ(flow.pcb_.deferred_acks, 1);
+  EXPECT_EQ(txring.GetStagedCount(), 1);
+  flow.ResumeTx();
+  EXPECT_EQ(txring.GetStagedCount(), 1);
+}
+
 }  // namespace flow
 }  // namespace net
 }  // namespace juggler
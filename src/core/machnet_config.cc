@@ -84,7 +84,8 @@ void MachnetConfigProcessor::AssertJsonValidMachnetConfig() {
     }
     for (const auto &[key, _] : interface.items()) {
       if (key != "ip" && key != "engine_threads" && key != "cpu_mask" &&
-          key != "pcie") {
+          key != "pcie" && key != "engine_cores" && key != "prefix_len" &&
+          key != "routes" && key != "neighbors") {
         LOG(FATAL) << "Invalid key " << key << " in " << interface << " in "
                    << config_json_filename_;
       }
@@ -121,6 +122,72 @@ void MachnetConfigProcessor::DiscoverInterfaceConfiguration() {
       LOG(INFO) << "Using default CPU mask for " << l2_addr.ToString();
     }
 
+    std::vector<size_t> engine_cores;
+    if (json_val.find("engine_cores") != json_val.end()) {
+      for (const auto &core : json_val.at("engine_cores")) {
+        CHECK(core.is_number_unsigned() && core < CPU_SETSIZE)
+            << "Invalid engine core " << core << " for " << l2_addr.ToString();
+        engine_cores.push_back(core);
+      }
+      if (json_val.find("engine_threads") == json_val.end()) {
+        engine_threads = engine_cores.size();
+      }
+      CHECK_EQ(engine_cores.size(), engine_threads)
+          << "engine_cores and engine_threads disagree for "
+          << l2_addr.ToString();
+      LOG(INFO) << "Pinning " << engine_threads << " engine threads for "
+                << l2_addr.ToString() << " to dedicated cores";
+    }
+
+    std::vector<Route> routes;
+    if (json_val.find("prefix_len") != json_val.end()) {
+      const auto &prefix_len = json_val.at("prefix_len");
+      CHECK(prefix_len.is_number_unsigned() &&
+            prefix_len <= Route::kMaxPrefixLen)
+          << "Invalid prefix_len " << prefix_len << " for "
+          << l2_addr.ToString();
+      const uint8_t len = prefix_len;
+      const net::Ipv4::Address subnet(ip_addr.address.value() &
+                                      Route::Mask(len));
+      routes.push_back({subnet, len, std::nullopt});
+    }
+    if (json_val.find("routes") != json_val.end()) {
+      for (const auto &route : json_val.at("routes")) {
+        CHECK(route.find("dst") != route.end() && route.at("dst").is_string())
+            << "No route destination in " << route << " for "
+            << l2_addr.ToString();
+        const auto prefix =
+            Route::ParsePrefix(route.at("dst").get<std::string>());
+        CHECK(prefix.has_value())
+            << "Invalid route destination in " << route << " for "
+            << l2_addr.ToString();
+        std::optional<net::Ipv4::Address> gateway;
+        if (route.find("via") != route.end()) {
+          CHECK(route.at("via").is_string()) << "Invalid gateway in " << route;
+          gateway = net::Ipv4::Address::MakeAddress(
+              route.at("via").get<std::string>());
+          CHECK(gateway.has_value()) << "Invalid gateway in " << route;
+          CHECK(gateway.value() != ip_addr)
+              << "The gateway in " << route << " is the address of "
+              << l2_addr.ToString() << " itself";
+        }
+        routes.push_back({prefix->first, prefix->second, gateway});
+      }
+    }
+
+    std::vector<NetworkInterfaceConfig::StaticNeighbor> static_neighbors;
+    if (json_val.find("neighbors") != json_val.end()) {
+      for (const auto &[ip, mac] : json_val.at("neighbors").items()) {
+        const auto addr = net::Ipv4::Address::MakeAddress(ip);
+        net::Ethernet::Address l2addr;
+        CHECK(addr.has_value() && mac.is_string() &&
+              l2addr.FromString(mac.get<std::string>()))
+            << "Invalid static neighbour " << ip << ": " << mac << " for "
+            << l2_addr.ToString();
+        static_neighbors.emplace_back(addr.value(), l2addr);
+      }
+    }
+
     std::string pci_addr = "";
     if (json_val.find("pcie") != json_val.end()) {
       pci_addr = json_val.at("pcie");
@@ -138,7 +205,8 @@ void MachnetConfigProcessor::DiscoverInterfaceConfiguration() {
     }
 
     interfaces_config_.emplace(pci_addr, l2_addr, ip_addr, engine_threads,
-                               cpu_mask);
+                               cpu_mask, engine_cores, std::move(routes),
+                               std::move(static_neighbors));
   }
   for (const auto &interface : interfaces_config_) {
     interface.Dump();
@@ -0,0 +1,132 @@
+/**
+ * @file machnet_config_test.cc
+ *
+ * Unit tests for the Machnet configuration reader.
+ */
+
+#include <gtest/gtest.h>
+#include <machnet_config.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <fstream>
+#include <string>
+
+namespace juggler {
+
+// Writes the configuration of a single interface to a temporary file, and
+// removes it when done.
+class ConfigFile {
+ public:
+  explicit ConfigFile(const std::string &interface_json) {
+    char path[] = "/tmp/machnet_config_test_XXXXXX";
+    const int fd = mkstemp(path);
+    CHECK_GE(fd, 0);
+    close(fd);
+    path_ = path;
+    std::ofstream file(path_);
+    file << R"({"machnet_config": {"00:0d:3a:d6:9b:6b": )" << interface_json
+         << "}}";
+  }
+  ~ConfigFile() { std::remove(path_.c_str()); }
+  const std::string &path() const { return path_; }
+
+ private:
+  std::string path_;
+};
+
+NetworkInterfaceConfig ParseInterface(const std::string &interface_json) {
+  const ConfigFile file(interface_json);
+  MachnetConfigProcessor config(file.path());
+  CHECK_EQ(config.interfaces_config().size(), 1);
+  return *config.interfaces_config().begin();
+}
+
+TEST(MachnetConfigTest, EngineCores) {
+  const auto interface = ParseInterface(
+      R"({"ip": "10.0.1.1", "pcie": "0000:00:00.0", "cpu_mask": "0xf0",
+          "engine_cores": [2, 5]})");
+  // The cores set the number of engines.
+  EXPECT_EQ(interface.engine_threads(), 2);
+  ASSERT_EQ(interface.engine_cores().size(), 2);
+  EXPECT_EQ(interface.engine_cores()[0], 2);
+  EXPECT_EQ(interface.engine_cores()[1], 5);
+
+  // Each engine is pinned to its own core.
+  for (size_t engine_id = 0; engine_id < 2; engine_id++) {
+    const auto mask = interface.engine_cpu_mask(engine_id);
+    EXPECT_EQ(CPU_COUNT(&mask), 1);
+    EXPECT_TRUE(CPU_ISSET(interface.engine_cores()[engine_id], &mask));
+  }
+  // Others fall back to the interface's mask.
+  const auto mask = interface.engine_cpu_mask(2);
+  const auto cpu_mask = interface.cpu_mask();
+  EXPECT_TRUE(CPU_EQUAL(&mask, &cpu_mask));
+}
+
+TEST(MachnetConfigTest, EngineCoresWithThreads) {
+  const auto interface = ParseInterface(
+      R"({"ip": "10.0.1.1", "pcie": "0000:00:00.0", "engine_threads": 3,
+          "engine_cores": [1, 2, 3]})");
+  EXPECT_EQ(interface.engine_threads(), 3);
+  EXPECT_EQ(interface.engine_cores().size(), 3);
+}
+
+TEST(MachnetConfigTest, NoEngineCores) {
+  const auto interface = ParseInterface(
+      R"({"ip": "10.0.1.1", "pcie": "0000:00:00.0", "engine_threads": 2,
+          "cpu_mask": "0x3"})");
+  EXPECT_EQ(interface.engine_threads(), 2);
+  EXPECT_TRUE(interface.engine_cores().empty());
+  const auto cpu_mask = interface.cpu_mask();
+  for (size_t engine_id = 0; engine_id < 2; engine_id++) {
+    const auto mask = interface.engine_cpu_mask(engine_id);
+    EXPECT_TRUE(CPU_EQUAL(&mask, &cpu_mask));
+  }
+}
+
+TEST(MachnetConfigDeathTest, InvalidEngineCores) {
+  // Disagrees with the number of engines.
+  EXPECT_DEATH(
+      ParseInterface(
+          R"({"ip": "10.0.1.1", "pcie": "0000:00:00.0", "engine_threads": 1,
+              "engine_cores": [1, 2]})"),
+      "disagree");
+  // Not a core.
+  EXPECT_DEATH(ParseInterface(R"({"ip": "10.0.1.1", "pcie": "0000:00:00.0",
+                                  "engine_cores": [-1]})"),
+               "Invalid engine core");
+  EXPECT_DEATH(ParseInterface(R"({"ip": "10.0.1.1", "pcie": "0000:00:00.0",
+                                  "engine_cores": ["1"]})"),
+               "Invalid engine core");
+  EXPECT_DEATH(
+      ParseInterface(R"({"ip": "10.0.1.1", "pcie": "0000:00:00.0",
+                         "engine_cores": [)" +
+                     std::to_string(CPU_SETSIZE) + "]}"),
+      "Invalid engine core");
+}
+
+TEST(MachnetConfigTest, Routes) {
+  const auto interface = ParseInterface(
+      R"({"ip": "10.0.1.1", "pcie": "0000:00:00.0", "prefix_len": 24,
+          "routes": [{"dst": "0.0.0.0/0", "via": "10.0.1.254"}]})");
+  // The subnet of the interface, then the configured routes.
+  ASSERT_EQ(interface.routes().size(), 2);
+  EXPECT_FALSE(interface.routes()[0].gateway.has_value());
+  ASSERT_TRUE(interface.routes()[1].gateway.has_value());
+  EXPECT_EQ(interface.routes()[1].gateway->ToString(), "10.0.1.254");
+}
+
+TEST(MachnetConfigDeathTest, LocalGateway) {
+  EXPECT_DEATH(ParseInterface(R"({"ip": "10.0.1.1", "pcie": "0000:00:00.0",
+                                  "routes": [{"dst": "0.0.0.0/0",
+                                              "via": "10.0.1.1"}]})"),
+               "is the address of");
+}
+
+}  // namespace juggler
+
+int main(int argc, char **argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
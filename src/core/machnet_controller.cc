@@ -1,14 +1,22 @@
+#include <capture.h>
 #include <config.h>
 #include <dpdk.h>
 #include <glog/logging.h>
 #include <machnet_controller.h>
 #include <machnet_ctrl.h>
+#include <route.h>
+#include <unistd.h>
 #include <utils.h>
 #include <worker.h>
 
+#include <algorithm>
+#include <chrono>
+#include <ctime>
 #include <future>
 #include <memory>
 #include <thread>
+#include <utility>
+#include <vector>
 
 namespace juggler {
 
@@ -32,6 +40,9 @@ void MachnetController::Run() {
   }
 
   signal(SIGINT, MachnetController::sig_handler);
+  // A capture reader that goes away (e.g., a closed pipe) must not take the
+  // whole process down; the write fails instead.
+  signal(SIGPIPE, SIG_IGN);
 
   // Initialize DPDK.
   dpdk_.InitDpdk(config_processor_.GetEalOpts());
@@ -65,17 +76,34 @@ void MachnetController::Run() {
         interface.dpdk_port_id().value(), rx_rings_nr, tx_rings_nr,
         dpdk::PmdRing::kDefaultRingDescNr, dpdk::PmdRing::kDefaultRingDescNr));
     pmd_ports_.back()->InitDriver();
+    const int nic_numa_node = pmd_ports_.back()->GetNumaNode();
 
     // Create the MachnetEngineShared State.
     auto shared_state = std::make_shared<MachnetEngineSharedState>(
         pmd_ports_.back()->GetRSSKey(), pmd_ports_.back()->GetL2Addr(),
         std::vector<net::Ipv4::Address>(1, interface.ip_addr()));
+    for (const auto &route : interface.routes()) {
+      shared_state->GetMutableRoutingTable()->AddRoute(route);
+    }
+    for (const auto &[addr, l2addr] : interface.static_neighbors()) {
+      shared_state->PinNeighbor(addr, l2addr);
+    }
     // Create the Machnet engines.
     for (size_t i = 0; i < interface.engine_threads(); ++i) {
       engines_.emplace_back(std::make_shared<juggler::MachnetEngine>(
           pmd_ports_.back(), i, i, shared_state));
       // Create the CPU mask for the engine threads.
-      cpu_masks.emplace_back(interface.cpu_mask());
+      cpu_masks.emplace_back(interface.engine_cpu_mask(i));
+      engine_numa_nodes_.emplace_back(
+          GetEngineNumaNode(cpu_masks.back(), nic_numa_node));
+      if (nic_numa_node >= 0 && engine_numa_nodes_.back() != nic_numa_node) {
+        LOG(WARNING) << "Engine " << i << " of "
+                     << interface.l2_addr().ToString()
+                     << " can run off the NUMA node of its NIC (node "
+                     << nic_numa_node << ", CPU mask 0x" << std::hex
+                     << utils::cpuset_to_sizet(cpu_masks.back()) << std::dec
+                     << "); expect cross-node traffic.";
+      }
     }
   }
 
@@ -87,12 +115,22 @@ void MachnetController::Run() {
   RunController();
 
   // The previous call will block until the server is stopped (e.g. by SIGINT).
+  StopCapture(nullptr, 0);
+  capture_stop_requester_ = nullptr;
+  ReapCapture();
   engine_thread_pool.Pause();
   engine_thread_pool.Terminate();
 
   for (const auto &pmd_port : pmd_ports_) {
     pmd_port->DumpStats();
   }
+
+  for (size_t i = 0; i < engines_.size(); ++i) {
+    EngineProfile profile;
+    if (engines_[i]->GetProfile(&profile)) {
+      LOG(INFO) << "Engine " << i << " profile: " << profile.ToString();
+    }
+  }
 }
 
 bool MachnetController::HandleNewConnection(UDSocket *s) {
@@ -106,14 +144,19 @@ bool MachnetController::HandleNewConnection(UDSocket *s) {
 }
 
 void MachnetController::HandleNewMessage(UDSocket *s, const char *data,
-                                         size_t length) {
+                                         size_t length, int fd) {
   CHECK_NOTNULL(s);
+  auto *req = reinterpret_cast<const machnet_ctrl_msg_t *>(data);
+  if (length != sizeof(machnet_ctrl_msg_t) ||
+      req->type != MACHNET_CTRL_MSG_TYPE_REQ_CAPTURE) {
+    // Only capture requests pass a file descriptor along.
+    if (fd >= 0) close(fd);
+  }
   if (length != sizeof(machnet_ctrl_msg_t)) {
     LOG(ERROR) << "Invalid message length";
     return;
   }
 
-  auto *req = reinterpret_cast<const machnet_ctrl_msg_t *>(data);
   switch (req->type) {
     case MACHNET_CTRL_MSG_TYPE_REQ_REGISTER: {
       machnet_ctrl_msg_t resp;
@@ -151,6 +194,116 @@ void MachnetController::HandleNewMessage(UDSocket *s, const char *data,
         CHECK(s->SendMsg(reinterpret_cast<char *>(&resp), sizeof(resp)));
       }
     } break;
+    case MACHNET_CTRL_MSG_TYPE_REQ_SEGMENT: {
+      int segment_fd;
+      auto ret =
+          GetChannelSegment(req->app_uuid, &req->segment_info, &segment_fd);
+
+      machnet_ctrl_msg_t resp;
+      resp.type = MACHNET_CTRL_MSG_TYPE_RESPONSE;
+      resp.msg_id = req->msg_id;
+
+      if (ret && segment_fd >= 0) {
+        resp.status = MACHNET_CTRL_STATUS_SUCCESS;
+        CHECK(s->SendMsgWithFd(reinterpret_cast<char *>(&resp), sizeof(resp),
+                               segment_fd));
+        // The descriptor was duplicated for the client.
+        close(segment_fd);
+      } else {
+        resp.status = MACHNET_CTRL_STATUS_FAILURE;
+        CHECK(s->SendMsg(reinterpret_cast<char *>(&resp), sizeof(resp)));
+      }
+    } break;
+    case MACHNET_CTRL_MSG_TYPE_REQ_STATUS:
+      [[fallthrough]];
+    case MACHNET_CTRL_MSG_TYPE_REQ_PORT_STATS: {
+      // The report is built here, on the controller thread, from the
+      // snapshots the engines publish, or from the NIC counters. Port stats
+      // are polled, so they are not logged.
+      const bool is_status = req->type == MACHNET_CTRL_MSG_TYPE_REQ_STATUS;
+      const auto report = is_status ? GetStatusReport() : GetPortStatsReport();
+      if (is_status) LOG(INFO) << report;
+
+      machnet_ctrl_msg_t resp;
+      resp.type = MACHNET_CTRL_MSG_TYPE_RESPONSE;
+      resp.msg_id = req->msg_id;
+      resp.status = MACHNET_CTRL_STATUS_SUCCESS;
+      resp.status_info.length = report.size();
+      if (!s->SendMsg(reinterpret_cast<char *>(&resp), sizeof(resp)) ||
+          !s->SendMsg(report.data(), report.size())) {
+        LOG(ERROR) << "Failed to send the report.";
+      }
+    } break;
+    case MACHNET_CTRL_MSG_TYPE_REQ_TRACE: {
+      const auto flags = req->trace_info.flags;
+      if (flags & MACHNET_TRACE_SET_CLASSES) {
+        LOG(INFO) << "Setting trace classes to 0x" << std::hex
+                  << req->trace_info.classes << std::dec;
+        SetTraceClasses(req->trace_info.classes);
+      }
+      const auto dump =
+          (flags & MACHNET_TRACE_DUMP) ? GetTraceDump() : std::string();
+
+      machnet_ctrl_msg_t resp;
+      resp.type = MACHNET_CTRL_MSG_TYPE_RESPONSE;
+      resp.msg_id = req->msg_id;
+      resp.status = MACHNET_CTRL_STATUS_SUCCESS;
+      resp.status_info.length = dump.size();
+      if (!s->SendMsg(reinterpret_cast<char *>(&resp), sizeof(resp)) ||
+          (!dump.empty() && !s->SendMsg(dump.data(), dump.size()))) {
+        LOG(ERROR) << "Failed to send the trace dump.";
+      }
+    } break;
+    case MACHNET_CTRL_MSG_TYPE_REQ_ROUTE: {
+      std::string report;
+      machnet_ctrl_msg_t resp;
+      resp.type = MACHNET_CTRL_MSG_TYPE_RESPONSE;
+      resp.msg_id = req->msg_id;
+      resp.status = HandleRouteRequest(req->route_info, &report)
+                        ? MACHNET_CTRL_STATUS_SUCCESS
+                        : MACHNET_CTRL_STATUS_FAILURE;
+      resp.status_info.length = report.size();
+      if (!s->SendMsg(reinterpret_cast<char *>(&resp), sizeof(resp)) ||
+          (!report.empty() && !s->SendMsg(report.data(), report.size()))) {
+        LOG(ERROR) << "Failed to send the route response.";
+      }
+    } break;
+    case MACHNET_CTRL_MSG_TYPE_REQ_CAPTURE: {
+      const auto &info = req->capture_info;
+      machnet_ctrl_msg_t resp;
+      resp.type = MACHNET_CTRL_MSG_TYPE_RESPONSE;
+      resp.msg_id = req->msg_id;
+      resp.status_info.length = 0;
+      std::string summary;
+      if (info.flags & MACHNET_CAPTURE_START) {
+        const std::string filter(info.filter,
+                                 strnlen(info.filter, sizeof(info.filter)));
+        const bool ret =
+            fd >= 0 &&
+            StartCapture(s, fd, filter, info.snaplen, info.max_packets);
+        if (!ret && fd >= 0) close(fd);
+        resp.status =
+            ret ? MACHNET_CTRL_STATUS_SUCCESS : MACHNET_CTRL_STATUS_FAILURE;
+      } else {
+        if (fd >= 0) close(fd);
+        // The capture takes a while to wind down; the response is sent once
+        // it has (see `ReapCapture()').
+        if (capture_stop_requester_ != nullptr) {
+          summary = "The capture is already stopping.\n";
+          resp.status = MACHNET_CTRL_STATUS_FAILURE;
+        } else if (StopCapture(s, req->msg_id)) {
+          break;
+        } else {
+          summary = "No capture.\n";
+          resp.status = MACHNET_CTRL_STATUS_SUCCESS;
+        }
+        resp.status_info.length = summary.size();
+      }
+      if (!s->SendMsg(reinterpret_cast<char *>(&resp), sizeof(resp)) ||
+          (!summary.empty() && !s->SendMsg(summary.data(), summary.size()))) {
+        LOG(ERROR) << "Failed to send the capture response.";
+      }
+    } break;
     default:
       LOG(ERROR) << "Invalid message type.";
       break;
@@ -168,6 +321,8 @@ void MachnetController::HandlePassiveClose(UDSocket *s) {
     UnregisterApplication(client_context->uuid);
     client_context->registered = false;
   }
+  if (s == capture_stop_requester_) capture_stop_requester_ = nullptr;
+  if (s == capture_owner_) StopCapture(nullptr, 0);
 }
 
 void MachnetController::HandleTimeout(UDSocket *s) {
@@ -175,6 +330,19 @@ void MachnetController::HandleTimeout(UDSocket *s) {
   LOG(WARNING) << "Not implemented.";
 }
 
+void MachnetController::HandleIdle() {
+  if (capture_stop_.load() && !capture_running_.load()) ReapCapture();
+
+  const auto now = std::chrono::steady_clock::now();
+  if (now - segments_update_time_ <
+      std::chrono::microseconds(shm::Channel::kSegmentUpdatePeriodUs))
+    return;
+  segments_update_time_ = now;
+
+  for (const auto &channel : channel_manager_.GetAllChannels())
+    channel->UpdateSegments();
+}
+
 bool MachnetController::RegisterApplication(
     const uuid_t app_uuid, const machnet_app_info_t *app_info) {
   const std::string app_uuid_str = juggler::utils::UUIDToString(app_uuid);
@@ -222,6 +390,163 @@ void MachnetController::UnregisterApplication(const uuid_t app_uuid) {
   LOG(INFO) << "Application unregistered: " << app_uuid_str;
 }
 
+bool MachnetController::GetChannelSegment(
+    const uuid_t app_uuid, const machnet_segment_info_t *segment_info,
+    int *fd) {
+  *fd = -1;
+  const std::string app_uuid_str = juggler::utils::UUIDToString(app_uuid);
+  const auto it = applications_registered_.find(app_uuid_str);
+  if (it == applications_registered_.end()) {
+    LOG(ERROR) << "Application not registered: " << app_uuid_str;
+    return false;
+  }
+
+  // Applications can only map segments of their own channels.
+  const std::string channel_uuid_str =
+      juggler::utils::UUIDToString(segment_info->channel_uuid);
+  if (it->second.find(channel_uuid_str) == it->second.end()) {
+    LOG(ERROR) << "Channel not owned by " << app_uuid_str << ": "
+               << channel_uuid_str;
+    return false;
+  }
+
+  auto channel = channel_manager_.GetChannel(channel_uuid_str.c_str());
+  if (channel == nullptr) return false;
+
+  *fd = channel->GetSegmentFd(segment_info->buf_class);
+  if (*fd < 0) {
+    LOG(WARNING) << "No pending segment " << segment_info->buf_class
+                 << " in channel " << channel_uuid_str;
+    return false;
+  }
+
+  return true;
+}
+
+int MachnetController::GetEngineNumaNode(const cpu_set_t &cpu_mask,
+                                         int nic_numa_node) {
+  int numa_node = -1;
+  for (size_t cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+    if (!CPU_ISSET(cpu, &cpu_mask)) continue;
+    const int node = utils::GetCpuNumaNode(cpu);
+    if (node < 0) continue;  // Not present.
+    if (numa_node >= 0 && node != numa_node) return -1;
+    numa_node = node;
+  }
+  // Without NUMA information, assume the node of the NIC.
+  return numa_node >= 0 || nic_numa_node < 0 ? numa_node : nic_numa_node;
+}
+
+size_t MachnetController::GetChannelMemSize() {
+  size_t mem_size = 0;
+  for (const auto &channel : channel_manager_.GetAllChannels())
+    mem_size += channel->GetSize() + channel->GetMaxSegmentsSize();
+  return mem_size;
+}
+
+bool MachnetController::GetChannelConf(
+    const MachnetChannelOpts_t &opts, size_t host_mem_size,
+    size_t *machnet_ring_slot_nr, size_t *app_ring_slot_nr,
+    std::vector<MachnetChannelBufClassConf_t> *buf_classes) {
+  auto valid_slot_nr = [](size_t slot_nr, size_t max_slot_nr) {
+    return slot_nr >= 2 && slot_nr <= max_slot_nr &&
+           utils::is_power_of_two(slot_nr);
+  };
+
+  *machnet_ring_slot_nr = opts.machnet_ring_slot_nr != 0
+                              ? opts.machnet_ring_slot_nr
+                              : ChannelManager::kDefaultRingSize;
+  *app_ring_slot_nr = opts.app_ring_slot_nr != 0
+                          ? opts.app_ring_slot_nr
+                          : ChannelManager::kDefaultRingSize;
+  if (!valid_slot_nr(*machnet_ring_slot_nr, kMaxChannelRingSize) ||
+      !valid_slot_nr(*app_ring_slot_nr, kMaxChannelRingSize)) {
+    LOG(ERROR) << "Invalid ring sizes: " << *machnet_ring_slot_nr << ", "
+               << *app_ring_slot_nr << " (max: " << kMaxChannelRingSize << ")";
+    return false;
+  }
+
+  // TODO(ilias): Figure out a way to dynamically infer the buffer size to be
+  // used.
+  const auto channel_buffer_size =
+      juggler::dpdk::PmdRing::kDefaultFrameSize - sizeof(juggler::net::Ipv4) -
+      sizeof(juggler::net::Udp) - sizeof(juggler::net::MachnetPktHdr);
+  const size_t buf_ring_slot_nr = opts.buf_ring_slot_nr != 0
+                                      ? opts.buf_ring_slot_nr
+                                      : ChannelManager::kDefaultBufferCount;
+  buf_classes->clear();
+  buf_classes->push_back({.buf_ring_slot_nr = buf_ring_slot_nr,
+                          .buffer_size = channel_buffer_size});
+  if (opts.flags & MACHNET_CHANNEL_OPTS_F_BUF_CLASSES) {
+    if (opts.buf_class_nr > MACHNET_CHANNEL_OPTS_BUF_CLASS_MAX) {
+      LOG(ERROR) << "Too many buffer classes: " << opts.buf_class_nr;
+      return false;
+    }
+    buf_classes->insert(buf_classes->end(), opts.buf_classes,
+                        opts.buf_classes + opts.buf_class_nr);
+  } else if (utils::is_power_of_two(buf_ring_slot_nr)) {
+    // Carve the small and large classes out of the buffer budget, so that the
+    // channel takes the same memory as with the default class only. If the
+    // budget is too small to split, it all stays with the default class.
+    const size_t default_buf_nr =
+        buf_ring_slot_nr / ChannelManager::kDefaultClassBudgetShare;
+    const size_t class_budget =
+        (buf_ring_slot_nr - default_buf_nr) / 2 *
+        __machnet_channel_buf_total_size(channel_buffer_size);
+    const size_t small_buf_nr =
+        class_budget / __machnet_channel_buf_total_size(
+                           ChannelManager::kDefaultSmallBufferSize);
+    const size_t large_buf_nr =
+        class_budget / __machnet_channel_buf_total_size(
+                           ChannelManager::kDefaultLargeBufferSize);
+    if (default_buf_nr >= 2 && small_buf_nr >= 2 && large_buf_nr >= 2) {
+      (*buf_classes)[0].buf_ring_slot_nr = default_buf_nr;
+      buf_classes->push_back(
+          {.buf_ring_slot_nr = small_buf_nr,
+           .buffer_size = ChannelManager::kDefaultSmallBufferSize});
+      buf_classes->push_back(
+          {.buf_ring_slot_nr = large_buf_nr,
+           .buffer_size = ChannelManager::kDefaultLargeBufferSize});
+    }
+  }
+  for (const auto &buf_class : *buf_classes) {
+    if (!valid_slot_nr(buf_class.buf_ring_slot_nr, kMaxChannelBufferCount) ||
+        buf_class.buffer_size == 0) {
+      LOG(ERROR) << "Invalid buffer class: " << buf_class.buf_ring_slot_nr
+                 << " buffers of " << buf_class.buffer_size << " bytes";
+      return false;
+    }
+  }
+
+  // Check the memory of the channel, with huge page alignment (the worst
+  // case), against the limits.
+  const auto channel_mem_size = __machnet_channel_dataplane_calculate_size_ex(
+      *machnet_ring_slot_nr, *app_ring_slot_nr, buf_classes->data(),
+      buf_classes->size(), 0);
+  if (channel_mem_size == static_cast<size_t>(-1) ||
+      channel_mem_size > kMaxChannelMemSize) {
+    LOG(ERROR) << "Invalid channel size: " << channel_mem_size
+               << " bytes (max: " << kMaxChannelMemSize << ")";
+    return false;
+  }
+  const auto segments_mem_size =
+      shm::Channel::GetMaxSegmentsSize(*buf_classes, false);
+  if (host_mem_size + channel_mem_size + segments_mem_size >
+      kMaxTotalChannelMemSize) {
+    LOG(ERROR) << "Not enough channel memory left for " << channel_mem_size
+               << " bytes (and up to " << segments_mem_size
+               << " bytes of segments; in use: " << host_mem_size
+               << ", max: " << kMaxTotalChannelMemSize << ")";
+    return false;
+  }
+
+  LOG(INFO) << "Channel sizing: rings " << *machnet_ring_slot_nr << "/"
+            << *app_ring_slot_nr << ", " << buf_classes->size()
+            << " buffer classes, " << channel_mem_size << " bytes (up to "
+            << segments_mem_size << " bytes of segments)";
+  return true;
+}
+
 bool MachnetController::CreateChannel(
     const uuid_t app_uuid, const machnet_channel_info_t *channel_info,
     int *fd) {
@@ -242,17 +567,36 @@ bool MachnetController::CreateChannel(
     return false;
   }
 
-  // TODO(ilias): Figure out a way to dynamically infer the buffer size to be
-  // used.
-  const auto channel_buffer_size =
-      juggler::dpdk::PmdRing::kDefaultFrameSize - sizeof(juggler::net::Ipv4) -
-      sizeof(juggler::net::Udp) - sizeof(juggler::net::MachnetPktHdr);
-  if (!channel_manager_.AddChannel(
-          channel_uuid_str.c_str(), ChannelManager::kDefaultRingSize,
-          ChannelManager::kDefaultRingSize, ChannelManager::kDefaultBufferCount,
-          channel_buffer_size) != 0) {
+  // The options are copied out of the (packed) request.
+  const MachnetChannelOpts_t channel_opts = channel_info->opts;
+  size_t machnet_ring_slot_nr, app_ring_slot_nr;
+  std::vector<MachnetChannelBufClassConf_t> channel_buf_classes;
+  if (!GetChannelConf(channel_opts, GetChannelMemSize(), &machnet_ring_slot_nr,
+                      &app_ring_slot_nr, &channel_buf_classes)) {
+    LOG(ERROR) << "Invalid sizing for channel " << channel_uuid_str;
     return false;
   }
+  static size_t engine_index =
+      utils::hash<size_t>(channel_uuid_str.c_str(), channel_uuid_str.size()) %
+      engines_.size();
+  const auto &engine = engines_[engine_index];
+
+  {
+    // Place the channel's memory on the node of the engine that serves it,
+    // unless the application asked otherwise.
+    const int numa_node =
+        (channel_opts.flags & MACHNET_CHANNEL_OPTS_F_NUMA_NODE)
+            ? static_cast<int>(channel_opts.numa_node)
+            : engine_numa_nodes_[engine_index];
+    LOG(INFO) << "Placing channel " << channel_uuid_str << " on NUMA node "
+              << numa_node;
+    const utils::ScopedNumaPreference numa_preference(numa_node);
+    if (!channel_manager_.AddChannel(channel_uuid_str.c_str(),
+                                     machnet_ring_slot_nr, app_ring_slot_nr,
+                                     channel_buf_classes)) {
+      return false;
+    }
+  }
 
   // Add the channel to the list of channels for this application.
   app_channels.insert(channel_uuid_str);
@@ -261,10 +605,6 @@ bool MachnetController::CreateChannel(
   // activated.
   std::promise<bool> p;
   auto fstatus = p.get_future();
-  static size_t engine_index =
-      utils::hash<size_t>(channel_uuid_str.c_str(), channel_uuid_str.size()) %
-      engines_.size();
-  const auto &engine = engines_[engine_index];
   engine->AddChannel(
       CHECK_NOTNULL(channel_manager_.GetChannel(channel_uuid_str.c_str())),
       std::move(p));
@@ -292,6 +632,300 @@ bool MachnetController::CreateChannel(
   return status;
 }
 
+std::string MachnetController::GetStatusReport() const {
+  std::string s;
+  auto status = std::make_unique<EngineStatus>();
+  for (size_t i = 0; i < engines_.size(); ++i) {
+    const auto &engine = engines_[i];
+    s += "[Machnet Engine " + std::to_string(i) + " Status]";
+    if (!engine->GetStatus(status.get())) {
+      s += " (not published yet)\n";
+      continue;
+    }
+    s += status->ToString();
+
+    const auto shared_state = engine->GetSharedState();
+    s += "\tLocal L2 address:\n";
+    s += "\t\t" + engine->GetPmdPort()->GetL2Addr().ToString() + "\n";
+    s += "\tLocal IPv4 addresses:\n";
+    s += "\t\t";
+    for (const auto &[addr, _] : shared_state->GetIpv4PortBitmap()) {
+      s += addr.ToString();
+      s += ",";
+    }
+    s += "\n";
+    s += "\tARP Table:\n";
+    for (const auto &entry : shared_state->GetArpTableEntries()) {
+      s += "\t\t" + std::get<0>(entry) + " -> " + std::get<1>(entry) + "\n";
+    }
+    s += "\tRoutes:\n";
+    for (const auto &route : shared_state->GetRoutingTable().GetRoutes()) {
+      s += "\t\t" + route.ToString() + "\n";
+    }
+
+    EngineProfile profile;
+    if (engine->GetProfile(&profile)) {
+      s += "\tProfile: " + profile.ToString() + "\n";
+    }
+  }
+  return s;
+}
+
+std::string MachnetController::GetPortStatsReport() const {
+  std::string s;
+  for (const auto &pmd_port : pmd_ports_) {
+    for (const auto &[name, value] : pmd_port->GetXStats()) {
+      s += juggler::utils::Format("%hu %s %lu\n", pmd_port->GetPortId(),
+                                  name.c_str(), value);
+    }
+  }
+  return s;
+}
+
+bool MachnetController::HandleRouteRequest(const machnet_route_info_t &info,
+                                           std::string *report) {
+  const net::Ipv4::Address local_ip(info.local_ip);
+  const net::Ipv4::Address dst_ip(info.dst_ip);
+  // Engines of the same interface share their state; visit it once.
+  std::vector<std::shared_ptr<MachnetEngineSharedState>> shared_states;
+  for (const auto &engine : engines_) {
+    const auto shared_state = engine->GetSharedState();
+    if (info.local_ip != 0 && !shared_state->IsLocalIpv4Address(local_ip))
+      continue;
+    if (std::find(shared_states.begin(), shared_states.end(), shared_state) ==
+        shared_states.end()) {
+      shared_states.push_back(shared_state);
+    }
+  }
+  if (shared_states.empty()) {
+    LOG(ERROR) << "No interface with IP address " << local_ip.ToString();
+    return false;
+  }
+
+  bool ok = true;
+  for (const auto &shared_state : shared_states) {
+    auto *routing_table = shared_state->GetMutableRoutingTable();
+    switch (info.op) {
+      case MACHNET_ROUTE_ADD: {
+        if (info.prefix_len > Route::kMaxPrefixLen) return false;
+        Route route{dst_ip, info.prefix_len, std::nullopt};
+        if (info.gateway_ip != 0) {
+          route.gateway = net::Ipv4::Address(info.gateway_ip);
+          // Traffic routed through a local address would never leave.
+          if (shared_state->IsLocalIpv4Address(route.gateway.value())) {
+            LOG(ERROR) << "The gateway " << route.gateway->ToString()
+                       << " is a local address";
+            return false;
+          }
+        }
+        LOG(INFO) << "Adding route " << route.ToString();
+        routing_table->AddRoute(route);
+      } break;
+      case MACHNET_ROUTE_DEL:
+        LOG(INFO) << "Removing route " << dst_ip.ToString() << "/"
+                  << static_cast<int>(info.prefix_len);
+        ok &= routing_table->RemoveRoute(dst_ip, info.prefix_len);
+        break;
+      case MACHNET_ROUTE_PIN_NEIGHBOR: {
+        const net::Ethernet::Address l2addr(info.l2_addr);
+        LOG(INFO) << "Pinning neighbour " << dst_ip.ToString() << " to "
+                  << l2addr.ToString();
+        shared_state->PinNeighbor(dst_ip, l2addr);
+      } break;
+      case MACHNET_ROUTE_UNPIN_NEIGHBOR:
+        LOG(INFO) << "Unpinning neighbour " << dst_ip.ToString();
+        ok &= shared_state->UnpinNeighbor(dst_ip);
+        break;
+      case MACHNET_ROUTE_LIST:
+        for (const auto &[addr, _] : shared_state->GetIpv4PortBitmap()) {
+          *report += "[Interface " + addr.ToString() + "]\n";
+        }
+        *report += "\tRoutes:\n";
+        for (const auto &route : routing_table->GetRoutes()) {
+          *report += "\t\t" + route.ToString() + "\n";
+        }
+        *report += "\tNeighbours:\n";
+        for (const auto &[addr, l2addr] : shared_state->GetArpTableEntries()) {
+          *report += "\t\t" + addr + " -> " + l2addr + "\n";
+        }
+        break;
+      default:
+        LOG(ERROR) << "Invalid route request op " << info.op;
+        return false;
+    }
+  }
+  return ok;
+}
+
+void MachnetController::SetTraceClasses(uint32_t classes) {
+  for (const auto &engine : engines_) engine->GetTracer()->SetClasses(classes);
+}
+
+std::string MachnetController::GetTraceDump() const {
+  std::string s;
+  std::vector<TraceEvent> events;
+  for (size_t i = 0; i < engines_.size(); ++i) {
+    const auto *tracer = engines_[i]->GetTracer();
+    TraceDumpHeader header = {};
+    header.magic = TraceDumpHeader::kMagic;
+    header.version = TraceDumpHeader::kVersion;
+    header.engine = i;
+    header.tsc_hz = juggler::time::estimate_tsc_hz();
+    header.recorded = tracer->Snapshot(&events);
+    header.event_nr = events.size();
+    header.classes = tracer->GetClasses();
+    s.append(reinterpret_cast<const char *>(&header), sizeof(header));
+    s.append(reinterpret_cast<const char *>(events.data()),
+             events.size() * sizeof(TraceEvent));
+  }
+  return s;
+}
+
+bool MachnetController::StartCapture(const UDSocket *owner, int fd,
+                                     const std::string &filter,
+                                     uint32_t snaplen, uint64_t max_packets) {
+  if (capture_running_.load()) {
+    LOG(ERROR) << "A capture is already running.";
+    return false;
+  }
+  // A capture that stopped by itself still has to be reaped.
+  ReapCapture();
+
+  const auto capture_filter = CaptureFilter::Parse(filter);
+  if (!capture_filter.has_value()) {
+    LOG(ERROR) << "Invalid capture filter: " << filter;
+    return false;
+  }
+  if (snaplen == 0 || snaplen > CaptureRecord::kMaxSnapLen)
+    snaplen = CaptureRecord::kMaxSnapLen;
+
+  LOG(INFO) << "Starting capture (filter: \"" << filter
+            << "\", snaplen: " << snaplen << ", max packets: " << max_packets
+            << ").";
+  capture_owner_ = owner;
+  capture_stop_.store(false);
+  capture_running_.store(true);
+  capture_thread_ =
+      std::thread(&MachnetController::CaptureLoop, this, fd,
+                  CaptureTap::Config{capture_filter.value(), snaplen},
+                  max_packets);
+  return true;
+}
+
+bool MachnetController::StopCapture(UDSocket *requester, uint32_t msg_id) {
+  capture_owner_ = nullptr;
+  if (!capture_thread_.joinable()) return false;
+  if (requester != nullptr) {
+    capture_stop_requester_ = requester;
+    capture_stop_msg_id_ = msg_id;
+  }
+  capture_stop_.store(true);
+  return true;
+}
+
+void MachnetController::ReapCapture() {
+  if (!capture_thread_.joinable()) return;
+  capture_thread_.join();
+  auto *s = std::exchange(capture_stop_requester_, nullptr);
+  if (s == nullptr) return;
+
+  machnet_ctrl_msg_t resp;
+  resp.type = MACHNET_CTRL_MSG_TYPE_RESPONSE;
+  resp.msg_id = capture_stop_msg_id_;
+  resp.status = MACHNET_CTRL_STATUS_SUCCESS;
+  resp.status_info.length = capture_summary_.size();
+  if (!s->SendMsg(reinterpret_cast<char *>(&resp), sizeof(resp)) ||
+      !s->SendMsg(capture_summary_.data(), capture_summary_.size())) {
+    LOG(ERROR) << "Failed to send the capture response.";
+  }
+}
+
+void MachnetController::CaptureLoop(int fd, CaptureTap::Config config,
+                                    uint64_t max_packets) {
+  const size_t kDrainBurst = 64;
+  const auto kIdleSleep = std::chrono::milliseconds(1);
+  const auto kStopTimeout = std::chrono::seconds(1);
+
+  PcapngWriter writer(fd, "Machnet");
+  std::vector<uint64_t> captured(engines_.size()), dropped(engines_.size());
+  for (size_t i = 0; i < engines_.size(); ++i) {
+    const auto &engine = engines_[i];
+    const auto port_id = engine->GetPmdPort()->GetPortId();
+    writer.AddInterface(
+        juggler::utils::Format("port%hu/engine%zu", port_id, i),
+        config.snaplen);
+    // The counters of the taps run across captures.
+    captured[i] = engine->GetCaptureTap()->GetCaptured();
+    dropped[i] = engine->GetCaptureTap()->GetDropped();
+  }
+
+  timespec realtime;
+  clock_gettime(CLOCK_REALTIME, &realtime);
+  const CaptureClock clock(
+      juggler::time::rdtsc(),
+      realtime.tv_sec * 1000000000ULL + realtime.tv_nsec,
+      juggler::time::estimate_tsc_hz());
+  for (const auto &engine : engines_) {
+    engine->GetCaptureTap()->Configure(config);
+  }
+
+  std::vector<CaptureRecord> records(kDrainBurst);
+  bool ok = writer.Flush();
+  auto done = [&]() {
+    return max_packets != 0 && writer.GetPacketCount() >= max_packets;
+  };
+  auto drain = [&]() {
+    size_t drained = 0;
+    for (size_t i = 0; i < engines_.size(); ++i) {
+      const auto n =
+          engines_[i]->GetCaptureTap()->Drain(records.data(), records.size());
+      for (size_t j = 0; j < n && ok && !done(); j++) {
+        const auto &record = records[j];
+        const auto direction = static_cast<CaptureDirection>(record.direction);
+        ok = writer.WritePacket(i, clock.ToNs(record.tsc), record.data,
+                                record.cap_len, record.pkt_len, direction);
+      }
+      drained += n;
+    }
+    return drained;
+  };
+
+  while (ok && !done() && !capture_stop_.load()) {
+    if (drain() == 0) {
+      ok = writer.Flush();
+      std::this_thread::sleep_for(kIdleSleep);
+    }
+  }
+
+  // The engines stop capturing on their next slow tick; write out what they
+  // captured until then.
+  for (const auto &engine : engines_) engine->GetCaptureTap()->Configure({});
+  const auto deadline = std::chrono::steady_clock::now() + kStopTimeout;
+  for (const auto &engine : engines_) {
+    while (!engine->GetCaptureTap()->IsConfigApplied() &&
+           std::chrono::steady_clock::now() < deadline) {
+      std::this_thread::sleep_for(kIdleSleep);
+    }
+  }
+  while (drain() > 0) continue;
+  if (ok) ok = writer.Flush();
+  close(fd);
+
+  uint64_t total_captured = 0, total_dropped = 0;
+  for (size_t i = 0; i < engines_.size(); ++i) {
+    const auto *tap = engines_[i]->GetCaptureTap();
+    total_captured += tap->GetCaptured() - captured[i];
+    total_dropped += tap->GetDropped() - dropped[i];
+  }
+  capture_summary_ = juggler::utils::Format(
+      "Capture finished%s: %lu packets written, %lu captured, %lu dropped "
+      "(capture ring full).\n",
+      ok ? "" : " (write error)", writer.GetPacketCount(), total_captured,
+      total_dropped);
+  LOG(INFO) << capture_summary_;
+  capture_running_.store(false);
+}
+
 void MachnetController::RunController() {
   const std::string socket_path = MACHNET_CONTROLLER_DEFAULT_PATH;
 
@@ -306,15 +940,18 @@ void MachnetController::RunController() {
   //     &MachnetController::HandlePassiveClose, this, std::placeholders::_1);
   const UDServer::on_message_cb_t on_message_cb =
       [=, this](UDSocket *socket, const char *data, size_t length, int fd) {
-        this->HandleNewMessage(socket, data, length);
+        this->HandleNewMessage(socket, data, length, fd);
       };
 
   const UDServer::on_timeout_cb_t on_timeout_cb = [=, this](UDSocket *socket) {
     this->HandleTimeout(socket);
   };
 
+  const UDServer::on_idle_cb_t on_idle_cb = [this]() { this->HandleIdle(); };
+
   server_ = std::make_unique<UDServer>(socket_path, on_connect_cb, on_close_cb,
-                                       on_message_cb, on_timeout_cb);
+                                       on_message_cb, on_timeout_cb,
+                                       on_idle_cb);
 
   server_->Run();
 }
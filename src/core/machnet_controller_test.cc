@@ -0,0 +1,215 @@
+/**
+ * @file machnet_controller_test.cc
+ *
+ * Unit tests for the MachnetController class.
+ */
+
+#include <channel.h>
+#include <gtest/gtest.h>
+#include <machnet_controller.h>
+#include <unistd.h>
+#include <utils.h>
+
+#include <algorithm>
+#include <set>
+#include <vector>
+
+namespace juggler {
+
+using BufClasses = std::vector<MachnetChannelBufClassConf_t>;
+
+// Memory a channel takes, with huge page alignment (as the controller accounts
+// for it).
+size_t ChannelMemSize(size_t machnet_ring_slot_nr, size_t app_ring_slot_nr,
+                      const BufClasses &buf_classes) {
+  return __machnet_channel_dataplane_calculate_size_ex(
+      machnet_ring_slot_nr, app_ring_slot_nr, buf_classes.data(),
+      buf_classes.size(), 0);
+}
+
+TEST(MachnetControllerTest, ChannelConfDefaults) {
+  MachnetChannelOpts_t opts = {};
+  size_t machnet_ring_slot_nr, app_ring_slot_nr;
+  BufClasses buf_classes;
+  ASSERT_TRUE(MachnetController::GetChannelConf(
+      opts, 0, &machnet_ring_slot_nr, &app_ring_slot_nr, &buf_classes));
+  EXPECT_EQ(machnet_ring_slot_nr,
+            MachnetController::ChannelManager::kDefaultRingSize);
+  EXPECT_EQ(app_ring_slot_nr,
+            MachnetController::ChannelManager::kDefaultRingSize);
+  ASSERT_EQ(buf_classes.size(), 3);
+  EXPECT_EQ(buf_classes[1].buffer_size,
+            MachnetController::ChannelManager::kDefaultSmallBufferSize);
+  EXPECT_EQ(buf_classes[2].buffer_size,
+            MachnetController::ChannelManager::kDefaultLargeBufferSize);
+
+  // The application picks its own classes (or none).
+  opts.flags = MACHNET_CHANNEL_OPTS_F_BUF_CLASSES;
+  ASSERT_TRUE(MachnetController::GetChannelConf(
+      opts, 0, &machnet_ring_slot_nr, &app_ring_slot_nr, &buf_classes));
+  EXPECT_EQ(buf_classes.size(), 1);
+  opts.buf_class_nr = 1;
+  opts.buf_classes[0] = {.buf_ring_slot_nr = 64, .buffer_size = 16384};
+  ASSERT_TRUE(MachnetController::GetChannelConf(
+      opts, 0, &machnet_ring_slot_nr, &app_ring_slot_nr, &buf_classes));
+  ASSERT_EQ(buf_classes.size(), 2);
+  EXPECT_EQ(buf_classes[1].buf_ring_slot_nr, 64);
+  EXPECT_EQ(buf_classes[1].buffer_size, 16384);
+}
+
+TEST(MachnetControllerTest, ChannelConfOversize) {
+  size_t machnet_ring_slot_nr, app_ring_slot_nr;
+  BufClasses buf_classes;
+
+  MachnetChannelOpts_t opts = {};
+  opts.machnet_ring_slot_nr = 2 * MachnetController::kMaxChannelRingSize;
+  EXPECT_FALSE(MachnetController::GetChannelConf(
+      opts, 0, &machnet_ring_slot_nr, &app_ring_slot_nr, &buf_classes));
+
+  opts = {};
+  opts.app_ring_slot_nr = 2 * MachnetController::kMaxChannelRingSize;
+  EXPECT_FALSE(MachnetController::GetChannelConf(
+      opts, 0, &machnet_ring_slot_nr, &app_ring_slot_nr, &buf_classes));
+
+  opts = {};
+  opts.buf_ring_slot_nr = 2 * MachnetController::kMaxChannelBufferCount;
+  EXPECT_FALSE(MachnetController::GetChannelConf(
+      opts, 0, &machnet_ring_slot_nr, &app_ring_slot_nr, &buf_classes));
+
+  // Each class is within limits, but the channel is too large.
+  opts = {};
+  opts.flags = MACHNET_CHANNEL_OPTS_F_BUF_CLASSES;
+  opts.buf_class_nr = 1;
+  opts.buf_classes[0] = {
+      .buf_ring_slot_nr = MachnetController::kMaxChannelBufferCount,
+      .buffer_size = 65536};
+  EXPECT_FALSE(MachnetController::GetChannelConf(
+      opts, 0, &machnet_ring_slot_nr, &app_ring_slot_nr, &buf_classes));
+}
+
+TEST(MachnetControllerTest, ChannelConfHostTotal) {
+  MachnetChannelOpts_t opts = {};
+  size_t machnet_ring_slot_nr, app_ring_slot_nr;
+  BufClasses buf_classes;
+  ASSERT_TRUE(MachnetController::GetChannelConf(
+      opts, 0, &machnet_ring_slot_nr, &app_ring_slot_nr, &buf_classes));
+  const auto channel_mem_size =
+      ChannelMemSize(machnet_ring_slot_nr, app_ring_slot_nr, buf_classes);
+  const auto segments_mem_size =
+      shm::Channel::GetMaxSegmentsSize(buf_classes, false);
+  EXPECT_GT(segments_mem_size, 0);
+
+  // The channel is accounted for along with its segments.
+  const auto kMaxTotal = MachnetController::kMaxTotalChannelMemSize;
+  EXPECT_TRUE(MachnetController::GetChannelConf(
+      opts, kMaxTotal - channel_mem_size - segments_mem_size,
+      &machnet_ring_slot_nr, &app_ring_slot_nr, &buf_classes));
+  EXPECT_FALSE(MachnetController::GetChannelConf(
+      opts, kMaxTotal - channel_mem_size, &machnet_ring_slot_nr,
+      &app_ring_slot_nr, &buf_classes));
+  EXPECT_FALSE(MachnetController::GetChannelConf(
+      opts, kMaxTotal, &machnet_ring_slot_nr, &app_ring_slot_nr,
+      &buf_classes));
+}
+
+TEST(MachnetControllerTest, MaxSegmentsSize) {
+  // Every free class slot may hold a segment as large as the largest class.
+  const BufClasses buf_classes = {{.buf_ring_slot_nr = 1024,
+                                   .buffer_size = 1024},
+                                  {.buf_ring_slot_nr = 64,
+                                   .buffer_size = 65536}};
+  size_t segment_size = 0;
+  for (const auto &buf_class : buf_classes) {
+    segment_size = std::max(segment_size,
+                            __machnet_channel_segment_calculate_size(
+                                buf_class.buf_ring_slot_nr,
+                                buf_class.buffer_size, 0));
+  }
+  EXPECT_EQ(shm::Channel::GetMaxSegmentsSize(buf_classes, false),
+            (MACHNET_CHANNEL_BUF_CLASS_MAX - buf_classes.size()) *
+                segment_size);
+
+  // Segments are capped in size; a large class is extended by smaller ones.
+  const BufClasses large_class = {
+      {.buf_ring_slot_nr = 1 << 16, .buffer_size = 16384}};
+  EXPECT_LE(shm::Channel::GetMaxSegmentsSize(large_class, false),
+            (MACHNET_CHANNEL_BUF_CLASS_MAX - 1) *
+                MACHNET_CHANNEL_SEGMENT_SIZE_MAX);
+  EXPECT_GT(shm::Channel::GetMaxSegmentsSize(large_class, false), 0);
+
+  // No free class slots.
+  const BufClasses full(MACHNET_CHANNEL_BUF_CLASS_MAX,
+                        {.buf_ring_slot_nr = 64, .buffer_size = 1024});
+  EXPECT_EQ(shm::Channel::GetMaxSegmentsSize(full, false), 0);
+}
+
+TEST(MachnetControllerTest, ChannelConfInvalidClasses) {
+  size_t machnet_ring_slot_nr, app_ring_slot_nr;
+  BufClasses buf_classes;
+  MachnetChannelOpts_t opts = {};
+  opts.flags = MACHNET_CHANNEL_OPTS_F_BUF_CLASSES;
+
+  opts.buf_class_nr = MACHNET_CHANNEL_OPTS_BUF_CLASS_MAX + 1;
+  EXPECT_FALSE(MachnetController::GetChannelConf(
+      opts, 0, &machnet_ring_slot_nr, &app_ring_slot_nr, &buf_classes));
+
+  const MachnetChannelBufClassConf_t kInvalidClasses[] = {
+      {.buf_ring_slot_nr = 100, .buffer_size = 1024},  // Not a power of 2.
+      {.buf_ring_slot_nr = 1, .buffer_size = 1024},    // No buffers.
+      {.buf_ring_slot_nr = 0, .buffer_size = 1024},
+      {.buf_ring_slot_nr = 64, .buffer_size = 0},
+  };
+  for (const auto &buf_class : kInvalidClasses) {
+    opts.buf_class_nr = 1;
+    opts.buf_classes[0] = buf_class;
+    EXPECT_FALSE(MachnetController::GetChannelConf(
+        opts, 0, &machnet_ring_slot_nr, &app_ring_slot_nr, &buf_classes))
+        << buf_class.buf_ring_slot_nr << " buffers of "
+        << buf_class.buffer_size << " bytes";
+  }
+
+  // The default class must hold a power of 2 number of buffers too.
+  opts = {};
+  opts.buf_ring_slot_nr = 1000;
+  EXPECT_FALSE(MachnetController::GetChannelConf(
+      opts, 0, &machnet_ring_slot_nr, &app_ring_slot_nr, &buf_classes));
+}
+
+TEST(MachnetControllerTest, EngineNumaNode) {
+  cpu_set_t mask;
+  CPU_ZERO(&mask);
+  // Without NUMA information, the engine is assumed on the node of its NIC.
+  EXPECT_EQ(MachnetController::GetEngineNumaNode(mask, 1), 1);
+  EXPECT_EQ(MachnetController::GetEngineNumaNode(mask, -1), -1);
+  CPU_SET(CPU_SETSIZE - 1, &mask);  // Not present.
+  EXPECT_EQ(MachnetController::GetEngineNumaNode(mask, 1), 1);
+
+  // An engine on a single core runs on the node of that core.
+  const int node = utils::GetCpuNumaNode(0);
+  CPU_ZERO(&mask);
+  CPU_SET(0, &mask);
+  EXPECT_EQ(MachnetController::GetEngineNumaNode(mask, -1), node);
+  EXPECT_EQ(MachnetController::GetEngineNumaNode(mask, 1),
+            node >= 0 ? node : 1);
+
+  // An engine that may run on the cores of several nodes has no node.
+  const long cpu_nr = sysconf(_SC_NPROCESSORS_CONF);
+  std::set<int> nodes;
+  CPU_ZERO(&mask);
+  for (long cpu = 0; cpu < cpu_nr && cpu < CPU_SETSIZE; cpu++) {
+    CPU_SET(cpu, &mask);
+    const int cpu_node = utils::GetCpuNumaNode(cpu);
+    if (cpu_node >= 0) nodes.insert(cpu_node);
+  }
+  const int expected = nodes.size() > 1    ? -1
+                       : nodes.size() == 1 ? *nodes.begin()
+                                           : 0;
+  EXPECT_EQ(MachnetController::GetEngineNumaNode(mask, 0), expected);
+}
+
+}  // namespace juggler
+
+int main(int argc, char **argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
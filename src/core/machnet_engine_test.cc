@@ -6,13 +6,24 @@
 
 #include <channel.h>
 #include <dpdk.h>
+#include <flow.h>
 #include <gtest/gtest.h>
-#include <machnet_engine.h>
+#include <machnet_pkthdr.h>
 #include <packet.h>
+#include <packet_pool.h>
 #include <pmd.h>
 
+#include <future>
+#include <list>
 #include <memory>
 #include <numeric>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#define private public
+#include <machnet_engine.h>
+#undef private
 
 constexpr const char *file_name(const char *path) {
   const char *file = path;
@@ -26,6 +37,16 @@ constexpr const char *file_name(const char *path) {
 
 const char *fname = file_name(__FILE__);
 
+// The port is shared by the tests, as it cannot be initialized twice.
+std::shared_ptr<juggler::dpdk::PmdPort> g_pmd_port;
+
+// Exposes the packet processing of the engine, to feed it crafted packets.
+class TestMachnetEngine : public juggler::MachnetEngine {
+ public:
+  using juggler::MachnetEngine::MachnetEngine;
+  using juggler::MachnetEngine::process_rx_pkt;
+};
+
 TEST(BasicMachnetEngineSharedStateTest, SrcPortAlloc) {
   using EthAddr = juggler::net::Ethernet::Address;
   using Ipv4Addr = juggler::net::Ipv4::Address;
@@ -87,7 +108,6 @@ TEST(BasicMachnetEngineSharedStateTest, SrcPortAlloc) {
 }
 
 TEST(BasicMachnetEngineTest, BasicMachnetEngineTest) {
-  using PmdPort = juggler::dpdk::PmdPort;
   using MachnetEngine = juggler::MachnetEngine;
 
   const uint32_t kChannelRingSize = 1024;
@@ -103,13 +123,92 @@ TEST(BasicMachnetEngineTest, BasicMachnetEngineTest) {
   std::vector<juggler::net::Ipv4::Address> test_ips = {test_ip};
   auto shared_state = std::make_shared<juggler::MachnetEngineSharedState>(
       rss_key, test_mac, test_ips);
-  const uint32_t kRingDescNr = 1024;
-  auto pmd_port = std::make_shared<PmdPort>(0, 1, 1, kRingDescNr, kRingDescNr);
-  pmd_port->InitDriver();
-  MachnetEngine engine(pmd_port, 0, 0, shared_state, {channel});
+  MachnetEngine engine(g_pmd_port, 0, 0, shared_state, {channel});
   EXPECT_EQ(engine.GetChannelCount(), 1);
 }
 
+TEST(BasicMachnetEngineTest, ShedSynWhileCongested) {
+  using juggler::be16_t;
+  using juggler::be32_t;
+  using juggler::net::Ethernet;
+  using juggler::net::Ipv4;
+  using juggler::net::MachnetPktHdr;
+  using juggler::net::Udp;
+
+  const uint32_t kChannelRingSize = 1024;
+  const std::string channel_name = std::string(fname) + "_shed";
+  juggler::shm::ChannelManager channel_mgr;
+  channel_mgr.AddChannel(channel_name.c_str(), kChannelRingSize,
+                         kChannelRingSize, kChannelRingSize, kChannelRingSize);
+  auto channel = channel_mgr.GetChannel(channel_name.c_str());
+
+  Ethernet::Address local_mac("00:00:00:00:00:01");
+  Ethernet::Address remote_mac("00:00:00:00:00:02");
+  Ipv4::Address local_ip, remote_ip;
+  local_ip.FromString("10.0.0.1");
+  remote_ip.FromString("10.0.0.2");
+  const Udp::Port kListenPort(1234);
+  auto shared_state = std::make_shared<juggler::MachnetEngineSharedState>(
+      std::vector<uint8_t>{}, local_mac, std::vector<Ipv4::Address>{local_ip});
+  TestMachnetEngine engine(g_pmd_port, 0, 0, shared_state, {channel});
+  engine.listeners_[local_ip][kListenPort] = channel;
+
+  // SYNs come from a pool of their own, as the TX pool is run dry below.
+  juggler::dpdk::PacketPool rx_pool(
+      64, juggler::dpdk::PmdRing::kDefaultFrameSize + RTE_PKTMBUF_HEADROOM);
+  auto input_syn = [&](uint16_t src_port) {
+    const size_t kSynLen =
+        sizeof(Ethernet) + sizeof(Ipv4) + sizeof(Udp) + sizeof(MachnetPktHdr);
+    auto *pkt = CHECK_NOTNULL(rx_pool.PacketAlloc());
+    auto *eh = CHECK_NOTNULL(pkt->append<Ethernet *>(kSynLen));
+    eh->dst_addr = local_mac;
+    eh->src_addr = remote_mac;
+    eh->eth_type = be16_t(Ethernet::kIpv4);
+    auto *ipv4h = pkt->head_data<Ipv4 *>(sizeof(Ethernet));
+    ipv4h->version_ihl = 0x45;
+    ipv4h->time_to_live = Ipv4::kDefaultTTL;
+    ipv4h->next_proto_id = Ipv4::kUdp;
+    ipv4h->total_length = be16_t(kSynLen - sizeof(Ethernet));
+    ipv4h->src_addr = remote_ip;
+    ipv4h->dst_addr = local_ip;
+    auto *udph = pkt->head_data<Udp *>(sizeof(Ethernet) + sizeof(Ipv4));
+    udph->src_port = Udp::Port(src_port);
+    udph->dst_port = kListenPort;
+    udph->len = be16_t(sizeof(Udp) + sizeof(MachnetPktHdr));
+    auto *machneth = pkt->head_data<MachnetPktHdr *>(
+        sizeof(Ethernet) + sizeof(Ipv4) + sizeof(Udp));
+    machneth->magic = be16_t(MachnetPktHdr::kMagic);
+    machneth->net_flags = MachnetPktHdr::MachnetFlags::kSyn;
+    machneth->seqno = be32_t(1);
+    engine.process_rx_pkt(pkt, 0);
+    juggler::dpdk::Packet::Free(pkt);
+  };
+
+  // Run the TX packet pool dry; the TX ring is congested.
+  auto *txring = g_pmd_port->GetRing<juggler::dpdk::TxRing>(0);
+  std::vector<juggler::dpdk::Packet *> packets;
+  while (auto *packet = txring->GetPacketPool()->PacketAlloc())
+    packets.push_back(packet);
+  txring->FlushStaged();
+  ASSERT_TRUE(txring->IsCongested());
+
+  // New connections are shed while it is.
+  input_syn(5000);
+  EXPECT_EQ(engine.shed_connections_, 1);
+  EXPECT_TRUE(engine.active_flows_map_.empty());
+
+  // And accepted once it clears.
+  for (auto *packet : packets) juggler::dpdk::Packet::Free(packet);
+  txring->FlushStaged();
+  ASSERT_FALSE(txring->IsCongested());
+  input_syn(5001);
+  EXPECT_EQ(engine.shed_connections_, 1);
+  EXPECT_EQ(engine.active_flows_map_.size(), 1);
+
+  // Send the SYN-ACK out of the way of the other tests.
+  txring->FlushStaged();
+}
+
 int main(int argc, char **argv) {
   testing::InitGoogleTest(&argc, argv);
 
@@ -119,6 +218,13 @@ int main(int argc, char **argv) {
 
   auto d = juggler::dpdk::Dpdk();
   d.InitDpdk(kEalOpts);
+
+  const uint32_t kRingDescNr = 1024;
+  g_pmd_port = std::make_shared<juggler::dpdk::PmdPort>(0, 1, 1, kRingDescNr,
+                                                        kRingDescNr);
+  g_pmd_port->InitDriver();
+
   int ret = RUN_ALL_TESTS();
+  g_pmd_port.reset();
   return ret;
 }
@@ -0,0 +1,167 @@
+/**
+ * @file neighbor_test.cc
+ *
+ * Unit tests for the neighbour table and the per-engine caches.
+ */
+
+#include <gtest/gtest.h>
+#include <neighbor.h>
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace juggler {
+
+using net::Ethernet;
+using net::Ipv4;
+
+const uint64_t kReachable = 1000;
+const uint64_t kMaxAge = 3000;
+
+Ipv4::Address Ip(const std::string &addr) {
+  return Ipv4::Address::MakeAddress(addr).value();
+}
+
+TEST(NeighborTableTest, Update) {
+  NeighborTable table(kReachable, kMaxAge);
+  const Ethernet::Address mac1("00:00:00:00:00:01");
+  const Ethernet::Address mac2("00:00:00:00:00:02");
+  EXPECT_EQ(table.GetVersion(), 0);
+
+  // Unknown neighbours are only added if asked to.
+  EXPECT_FALSE(table.Update(Ip("10.0.0.1"), mac1, 0, false));
+  EXPECT_FALSE(table.Lookup(Ip("10.0.0.1")).has_value());
+  EXPECT_TRUE(table.Update(Ip("10.0.0.1"), mac1, 0, true));
+  EXPECT_EQ(table.Lookup(Ip("10.0.0.1")), mac1);
+  EXPECT_EQ(table.GetVersion(), 1);
+
+  // Confirming a reachable entry does not publish a new snapshot.
+  EXPECT_FALSE(table.Update(Ip("10.0.0.1"), mac1, kReachable - 1, true));
+  EXPECT_EQ(table.GetVersion(), 1);
+  EXPECT_TRUE(table.Update(Ip("10.0.0.1"), mac1, kReachable, false));
+  EXPECT_EQ(table.GetVersion(), 2);
+
+  // Known neighbours move, e.g., on gratuitous ARP.
+  EXPECT_TRUE(table.Update(Ip("10.0.0.1"), mac2, kReachable + 1, false));
+  EXPECT_EQ(table.Lookup(Ip("10.0.0.1")), mac2);
+  EXPECT_EQ(table.GetSize(), 1);
+  EXPECT_EQ(table.GetSnapshot()->version, table.GetVersion());
+}
+
+TEST(NeighborTableTest, Age) {
+  NeighborTable table(kReachable, kMaxAge);
+  const Ethernet::Address mac("00:00:00:00:00:01");
+  table.Update(Ip("10.0.0.1"), mac, 0, true);
+  table.Update(Ip("10.0.0.2"), mac, 2000, true);
+
+  std::vector<Ipv4::Address> stale;
+  EXPECT_EQ(table.Age(999, &stale), 0);
+  EXPECT_TRUE(stale.empty());
+
+  EXPECT_EQ(table.Age(1000, &stale), 0);
+  EXPECT_EQ(stale, std::vector<Ipv4::Address>{Ip("10.0.0.1")});
+
+  // A refreshed entry is reachable again.
+  table.Update(Ip("10.0.0.1"), mac, 1500, false);
+  stale.clear();
+  EXPECT_EQ(table.Age(2400, &stale), 0);
+  EXPECT_TRUE(stale.empty());
+
+  const auto version = table.GetVersion();
+  stale.clear();
+  EXPECT_EQ(table.Age(4500, &stale), 1);
+  EXPECT_EQ(stale, std::vector<Ipv4::Address>{Ip("10.0.0.2")});
+  EXPECT_FALSE(table.Lookup(Ip("10.0.0.1")).has_value());
+  EXPECT_EQ(table.GetVersion(), version + 1);
+}
+
+TEST(NeighborTableTest, Pin) {
+  NeighborTable table(kReachable, kMaxAge);
+  const Ethernet::Address mac1("00:00:00:00:00:01");
+  const Ethernet::Address mac2("00:00:00:00:00:02");
+  table.Update(Ip("10.0.0.1"), mac1, 0, true);
+  table.Pin(Ip("10.0.0.1"), mac2);
+  EXPECT_EQ(table.Lookup(Ip("10.0.0.1")), mac2);
+
+  // ARP does not override pinned entries, and they never age.
+  EXPECT_FALSE(table.Update(Ip("10.0.0.1"), mac1, kMaxAge, true));
+  std::vector<Ipv4::Address> stale;
+  EXPECT_EQ(table.Age(kMaxAge * 10, &stale), 0);
+  EXPECT_TRUE(stale.empty());
+  EXPECT_EQ(table.Lookup(Ip("10.0.0.1")), mac2);
+  EXPECT_EQ(std::get<1>(table.GetEntries().front()),
+            "00:00:00:00:00:02 (static)");
+
+  EXPECT_FALSE(table.Unpin(Ip("10.0.0.2")));
+  EXPECT_TRUE(table.Unpin(Ip("10.0.0.1")));
+  EXPECT_FALSE(table.Lookup(Ip("10.0.0.1")).has_value());
+  table.Update(Ip("10.0.0.1"), mac1, 0, true);
+  EXPECT_FALSE(table.Unpin(Ip("10.0.0.1")));
+}
+
+TEST(NeighborCacheTest, Sync) {
+  NeighborTable table(kReachable, kMaxAge);
+  const Ethernet::Address mac1("00:00:00:00:00:01");
+  const Ethernet::Address mac2("00:00:00:00:00:02");
+  NeighborCache cache(&table);
+  EXPECT_FALSE(cache.Sync());
+
+  table.Update(Ip("10.0.0.1"), mac1, 0, true);
+  // The cache keeps its snapshot until it syncs.
+  EXPECT_FALSE(cache.Lookup(Ip("10.0.0.1")).has_value());
+  EXPECT_TRUE(cache.Sync());
+  EXPECT_EQ(cache.Lookup(Ip("10.0.0.1")), mac1);
+  EXPECT_FALSE(cache.Sync());
+
+  table.Update(Ip("10.0.0.1"), mac2, 1, false);
+  EXPECT_EQ(cache.Lookup(Ip("10.0.0.1")), mac1);
+  EXPECT_TRUE(cache.Sync());
+  EXPECT_EQ(cache.Lookup(Ip("10.0.0.1")), mac2);
+}
+
+TEST(NeighborCacheTest, ConcurrentUpdates) {
+  NeighborTable table(kReachable, kMaxAge);
+  const size_t kNeighbors = 64;
+  const size_t kRounds = 200;
+  std::atomic<bool> done{false};
+
+  // Readers must always see complete snapshots, whose entries map each
+  // address to the MAC address that ends with the same byte.
+  auto reader = [&]() {
+    NeighborCache cache(&table);
+    while (!done.load()) {
+      cache.Sync();
+      for (size_t i = 0; i < kNeighbors; i++) {
+        const Ipv4::Address addr(0x0a000000u + i);
+        const auto mac = cache.Lookup(addr);
+        if (mac.has_value()) {
+          ASSERT_EQ(mac->bytes[5], i);
+        }
+      }
+    }
+  };
+  std::vector<std::thread> readers;
+  for (int i = 0; i < 3; i++) readers.emplace_back(reader);
+
+  uint64_t now = 0;
+  for (size_t round = 0; round < kRounds; round++) {
+    for (size_t i = 0; i < kNeighbors; i++) {
+      const uint8_t bytes[] = {0, 0, 0, 0, static_cast<uint8_t>(round % 2),
+                               static_cast<uint8_t>(i)};
+      const Ethernet::Address mac(bytes);
+      table.Update(Ipv4::Address(0x0a000000u + i), mac, now++, true);
+    }
+  }
+  done.store(true);
+  for (auto &t : readers) t.join();
+  EXPECT_EQ(table.GetSize(), kNeighbors);
+}
+
+}  // namespace juggler
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,270 @@
+/**
+ * @file net_emulator_test.cc
+ *
+ * Unit tests for the network emulator, and end-to-end transport tests through
+ * it (see `Loopback').
+ */
+
+#include <dpdk.h>
+#include <gtest/gtest.h>
+#include <loopback.h>
+#include <machnet.h>
+#include <net_emulator.h>
+#include <packet_pool.h>
+#include <rte_ring.h>
+#include <utils.h>
+
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace juggler {
+
+using dpdk::EmulatedLink;
+using dpdk::LinkConf;
+using dpdk::LinkStats;
+using dpdk::PacketPool;
+
+// Time is counted in nanoseconds.
+const uint64_t kTscHz = 1000000000;
+
+/**
+ * @brief A link between two rings of its own, fed with packets that carry
+ * their sequence number.
+ */
+class LinkTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    static uint32_t next_id = 0;
+    const auto id = next_id++;
+    pool_ = std::make_unique<PacketPool>(4095);
+    in_ = rte_ring_create(utils::Format("linktest%u_in", id).c_str(), 4096,
+                          SOCKET_ID_ANY, RING_F_SP_ENQ | RING_F_SC_DEQ);
+    out_ = rte_ring_create(utils::Format("linktest%u_out", id).c_str(), 4096,
+                           SOCKET_ID_ANY, RING_F_SP_ENQ | RING_F_SC_DEQ);
+    ASSERT_NE(in_, nullptr);
+    ASSERT_NE(out_, nullptr);
+  }
+
+  void TearDown() override {
+    rte_ring_free(in_);
+    rte_ring_free(out_);
+  }
+
+  std::unique_ptr<EmulatedLink> MakeLink(const LinkConf &conf, uint64_t seed) {
+    return std::make_unique<EmulatedLink>(conf, seed, kTscHz, in_, out_,
+                                          pool_.get());
+  }
+
+  void Send(uint32_t seqno, uint16_t len) {
+    auto *pkt = pool_->PacketAlloc();
+    ASSERT_NE(pkt, nullptr);
+    auto *data = pkt->append<uint8_t *>(len);
+    ASSERT_NE(data, nullptr);
+    std::memcpy(data, &seqno, sizeof(seqno));
+    ASSERT_EQ(rte_ring_sp_enqueue(in_, pkt), 0);
+  }
+
+  // Returns the sequence numbers of the packets delivered so far.
+  std::vector<uint32_t> Receive() {
+    std::vector<uint32_t> seqnos;
+    void *obj;
+    while (rte_ring_sc_dequeue(out_, &obj) == 0) {
+      auto *pkt = static_cast<dpdk::Packet *>(obj);
+      uint32_t seqno;
+      std::memcpy(&seqno, pkt->head_data<uint8_t *>(), sizeof(seqno));
+      seqnos.push_back(seqno);
+      dpdk::Packet::Free(pkt);
+    }
+    return seqnos;
+  }
+
+  // Sends `count' packets at once, and returns what is delivered in the end.
+  std::vector<uint32_t> Transfer(const LinkConf &conf, uint64_t seed,
+                                 uint32_t count, LinkStats *stats) {
+    auto link = MakeLink(conf, seed);
+    std::vector<uint32_t> delivered;
+    for (uint32_t i = 0; i < count; i++) {
+      Send(i, 64);
+      // Keep the rings from filling up.
+      if (i % 1000 == 999) {
+        link->Step(0);
+        const auto seqnos = Receive();
+        delivered.insert(delivered.end(), seqnos.begin(), seqnos.end());
+      }
+    }
+    link->Step(0);
+    link->Step(UINT64_MAX);
+    const auto seqnos = Receive();
+    delivered.insert(delivered.end(), seqnos.begin(), seqnos.end());
+    *stats = link->GetStats();
+    return delivered;
+  }
+
+  std::unique_ptr<PacketPool> pool_;
+  rte_ring *in_;
+  rte_ring *out_;
+};
+
+TEST_F(LinkTest, Impairments) {
+  LinkConf conf;
+  conf.loss_rate = 0.1;
+  conf.duplicate_rate = 0.05;
+  conf.reorder_rate = 0.1;
+  const uint32_t kPackets = 10000;
+
+  LinkStats stats;
+  const auto delivered = Transfer(conf, 42, kPackets, &stats);
+  EXPECT_EQ(stats.packets, delivered.size());
+  EXPECT_EQ(stats.packets, kPackets - stats.lost + stats.duplicated);
+  EXPECT_NEAR(stats.lost, kPackets * conf.loss_rate, kPackets / 50);
+  EXPECT_NEAR(stats.duplicated, kPackets * 0.9 * conf.duplicate_rate,
+              kPackets / 50);
+  EXPECT_NEAR(stats.reordered, kPackets * 0.9 * conf.reorder_rate,
+              kPackets / 50);
+  EXPECT_FALSE(std::is_sorted(delivered.begin(), delivered.end()));
+
+  // The same seed yields the same deliveries, another one does not.
+  LinkStats stats2;
+  EXPECT_EQ(Transfer(conf, 42, kPackets, &stats2), delivered);
+  EXPECT_EQ(stats2.lost, stats.lost);
+  EXPECT_NE(Transfer(conf, 43, kPackets, &stats2), delivered);
+
+  // Packets take the same draws whatever the rates: without loss, the same
+  // packets are reordered.
+  conf.loss_rate = 0;
+  Transfer(conf, 42, kPackets, &stats2);
+  EXPECT_EQ(stats2.lost, 0);
+  EXPECT_GE(stats2.reordered, stats.reordered);
+}
+
+TEST_F(LinkTest, DelayAndRate) {
+  LinkConf conf;
+  conf.delay_us = 10;
+  conf.rate_bps = 1000000000;  // 8 ns per byte.
+  conf.queue_bytes = 2500;
+  auto link = MakeLink(conf, 1);
+
+  // The third packet does not fit in the queue behind the first two.
+  for (uint32_t i = 0; i < 3; i++) Send(i, 1000);
+  link->Step(0);
+  EXPECT_EQ(link->GetStats().queue_drops, 1);
+  EXPECT_EQ(link->NextDelivery(), 18000);
+  link->Step(17999);
+  EXPECT_TRUE(Receive().empty());
+  link->Step(18000);
+  EXPECT_EQ(Receive(), std::vector<uint32_t>{0});
+  link->Step(25999);
+  EXPECT_TRUE(Receive().empty());
+  link->Step(26000);
+  EXPECT_EQ(Receive(), std::vector<uint32_t>{1});
+  EXPECT_FALSE(link->NextDelivery().has_value());
+
+  // Once the queue drained, packets go straight through.
+  Send(3, 1000);
+  link->Step(100000);
+  EXPECT_EQ(link->NextDelivery(), 118000);
+  EXPECT_EQ(link->GetStats().bytes, 2000);
+}
+
+/**
+ * @brief Sends messages from side A to side B, and checks that they arrive
+ * intact and in order.
+ */
+struct TransferResult {
+  uint64_t duration_ns;
+  LinkStats a_to_b;
+  LinkStats b_to_a;
+};
+
+void TransferMessages(const Loopback::Options &options, size_t nb_msgs,
+                      TransferResult *result) {
+  using Side = Loopback::Side;
+  const uint16_t kPort = 888;
+  Loopback loopback(options);
+  ASSERT_TRUE(loopback.Listen(Side::kB, kPort));
+  const auto flow = loopback.Connect(Side::kA, kPort);
+  ASSERT_TRUE(flow.has_value());
+
+  // Messages span up to a few packets; each is filled with its index.
+  auto msg_size = [](size_t i) { return 1 + (i * 997) % 5000; };
+  const auto start = loopback.Now();
+  size_t nb_sent = 0;
+  size_t nb_received = 0;
+  std::vector<uint8_t> buf(8192);
+  const bool done = loopback.RunUntil(
+      [&]() {
+        while (nb_sent < nb_msgs) {
+          std::vector<uint8_t> msg(msg_size(nb_sent),
+                                   static_cast<uint8_t>(nb_sent));
+          if (machnet_send(loopback.GetChannelCtx(Side::kA), flow.value(),
+                           msg.data(), msg.size()) != 0) {
+            break;
+          }
+          nb_sent++;
+        }
+        MachnetFlow_t rx_flow;
+        ssize_t size;
+        while ((size = machnet_recv(loopback.GetChannelCtx(Side::kB),
+                                    buf.data(), buf.size(), &rx_flow)) > 0) {
+          EXPECT_EQ(static_cast<size_t>(size), msg_size(nb_received));
+          EXPECT_EQ(buf[0], static_cast<uint8_t>(nb_received));
+          EXPECT_EQ(buf[size - 1], static_cast<uint8_t>(nb_received));
+          nb_received++;
+        }
+        return nb_received == nb_msgs;
+      },
+      600 * Loopback::kTscHz);
+  ASSERT_TRUE(done) << "Received " << nb_received << " of " << nb_msgs;
+
+  result->duration_ns = loopback.Now() - start;
+  result->a_to_b = loopback.GetEmulator().GetLink(Side::kA).GetStats();
+  result->b_to_a = loopback.GetEmulator().GetLink(Side::kB).GetStats();
+}
+
+TEST(LoopbackTest, CleanLink) {
+  Loopback::Options options;
+  options.a_to_b.delay_us = options.b_to_a.delay_us = 5;
+  TransferResult result;
+  TransferMessages(options, 1000, &result);
+  EXPECT_EQ(result.a_to_b.lost, 0);
+  EXPECT_GT(result.b_to_a.packets, 0);
+}
+
+TEST(LoopbackTest, ImpairedLinkIsReproducible) {
+  Loopback::Options options;
+  for (auto *conf : {&options.a_to_b, &options.b_to_a}) {
+    conf->delay_us = 20;
+    conf->loss_rate = 0.01;
+    conf->duplicate_rate = 0.01;
+    conf->reorder_rate = 0.02;
+    conf->rate_bps = 10000000000;
+  }
+  options.seed = 7;
+
+  TransferResult result;
+  TransferMessages(options, 1000, &result);
+  EXPECT_GT(result.a_to_b.lost + result.b_to_a.lost, 0);
+
+  TransferResult result2;
+  TransferMessages(options, 1000, &result2);
+  EXPECT_EQ(result2.duration_ns, result.duration_ns);
+  EXPECT_EQ(result2.a_to_b.packets, result.a_to_b.packets);
+  EXPECT_EQ(result2.b_to_a.packets, result.b_to_a.packets);
+}
+
+}  // namespace juggler
+
+int main(int argc, char **argv) {
+  testing::InitGoogleTest(&argc, argv);
+
+  auto kEalOpts = juggler::utils::CmdLineOpts(
+      {"", "-c", "0x0", "-n", "6", "--proc-type=auto", "-m", "1024",
+       "--log-level", "8", "--no-pci"});
+
+  auto d = juggler::dpdk::Dpdk();
+  d.InitDpdk(kEalOpts);
+  return RUN_ALL_TESTS();
+}
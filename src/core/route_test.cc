@@ -0,0 +1,105 @@
+/**
+ * @file route_test.cc
+ *
+ * Unit tests for the routing table.
+ */
+
+#include <gtest/gtest.h>
+#include <route.h>
+
+#include <string>
+
+namespace juggler {
+
+using net::Ipv4;
+
+Ipv4::Address Ip(const std::string &addr) {
+  return Ipv4::Address::MakeAddress(addr).value();
+}
+
+Route MakeRoute(const std::string &cidr, const std::string &gateway = "") {
+  const auto prefix = Route::ParsePrefix(cidr).value();
+  Route route{prefix.first, prefix.second, std::nullopt};
+  if (!gateway.empty()) route.gateway = Ip(gateway);
+  return route;
+}
+
+TEST(RouteTest, ParsePrefix) {
+  auto prefix = Route::ParsePrefix("10.1.2.3/16");
+  ASSERT_TRUE(prefix.has_value());
+  EXPECT_EQ(prefix->first, Ip("10.1.0.0"));
+  EXPECT_EQ(prefix->second, 16);
+
+  prefix = Route::ParsePrefix("10.1.2.3");
+  ASSERT_TRUE(prefix.has_value());
+  EXPECT_EQ(prefix->first, Ip("10.1.2.3"));
+  EXPECT_EQ(prefix->second, 32);
+
+  prefix = Route::ParsePrefix("0.0.0.0/0");
+  ASSERT_TRUE(prefix.has_value());
+  EXPECT_EQ(prefix->second, 0);
+
+  EXPECT_FALSE(Route::ParsePrefix("10.1.2.3/33").has_value());
+  EXPECT_FALSE(Route::ParsePrefix("10.1.2.3/").has_value());
+  EXPECT_FALSE(Route::ParsePrefix("10.1.2.3/1x").has_value());
+  EXPECT_FALSE(Route::ParsePrefix("10.1.2/8").has_value());
+
+  EXPECT_EQ(MakeRoute("10.1.0.0/16", "10.0.0.1").ToString(),
+            "10.1.0.0/16 via 10.0.0.1");
+  EXPECT_EQ(MakeRoute("10.0.0.0/24").ToString(), "10.0.0.0/24 on-link");
+}
+
+TEST(RoutingTableTest, LongestPrefixMatch) {
+  RoutingTable table;
+  // Without routes, everything is on the link.
+  EXPECT_EQ(table.NextHop(Ip("192.168.1.1")), Ip("192.168.1.1"));
+
+  table.AddRoute(MakeRoute("0.0.0.0/0", "10.0.0.1"));
+  table.AddRoute(MakeRoute("10.0.0.0/24"));
+  table.AddRoute(MakeRoute("10.2.0.0/16", "10.0.0.254"));
+  table.AddRoute(MakeRoute("10.2.3.4/32", "10.0.0.253"));
+
+  EXPECT_EQ(table.NextHop(Ip("192.168.1.1")), Ip("10.0.0.1"));
+  EXPECT_EQ(table.NextHop(Ip("10.0.0.7")), Ip("10.0.0.7"));
+  EXPECT_EQ(table.NextHop(Ip("10.2.9.9")), Ip("10.0.0.254"));
+  EXPECT_EQ(table.NextHop(Ip("10.2.3.4")), Ip("10.0.0.253"));
+
+  const auto snapshot = table.GetSnapshot();
+  EXPECT_EQ(snapshot->prefix_lens, (std::vector<uint8_t>{32, 24, 16, 0}));
+  const auto *route = snapshot->Lookup(Ip("10.2.3.5"));
+  ASSERT_NE(route, nullptr);
+  EXPECT_EQ(route->prefix_len, 16);
+
+  const auto routes = table.GetRoutes();
+  ASSERT_EQ(routes.size(), 4);
+  EXPECT_EQ(routes.front().prefix_len, 32);
+  EXPECT_EQ(routes.back().prefix_len, 0);
+}
+
+TEST(RoutingTableTest, Updates) {
+  RoutingTable table;
+  EXPECT_EQ(table.GetVersion(), 0);
+  // Host bits are ignored.
+  table.AddRoute(MakeRoute("10.2.0.0/16", "10.0.0.254"));
+  table.AddRoute({Ip("10.2.7.7"), 16, Ip("10.0.0.253")});
+  EXPECT_EQ(table.GetRoutes().size(), 1);
+  EXPECT_EQ(table.NextHop(Ip("10.2.1.1")), Ip("10.0.0.253"));
+  EXPECT_EQ(table.GetVersion(), 2);
+
+  // Readers keep the snapshot they hold.
+  const auto snapshot = table.GetSnapshot();
+  EXPECT_FALSE(table.RemoveRoute(Ip("10.2.0.0"), 24));
+  EXPECT_FALSE(table.RemoveRoute(Ip("10.2.0.0"), 33));
+  EXPECT_TRUE(table.RemoveRoute(Ip("10.2.1.0"), 16));
+  EXPECT_EQ(table.NextHop(Ip("10.2.1.1")), Ip("10.2.1.1"));
+  EXPECT_EQ(snapshot->NextHop(Ip("10.2.1.1")), Ip("10.0.0.253"));
+  EXPECT_TRUE(table.GetSnapshot()->prefix_lens.empty());
+  EXPECT_EQ(table.GetVersion(), 3);
+}
+
+}  // namespace juggler
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,126 @@
+/**
+ * @file trace_test.cc
+ *
+ * Unit tests for the trace ring of transport events.
+ */
+
+#include <gtest/gtest.h>
+#include <trace.h>
+
+#include <atomic>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+namespace juggler {
+
+TEST(TraceTest, DisabledByDefault) {
+  Tracer tracer(16);
+  EXPECT_EQ(tracer.GetClasses(), 0);
+  tracer.Record(TraceEventType::kFastRexmit, 0, 1, 2);
+  EXPECT_EQ(tracer.GetRecorded(), 0);
+
+  std::vector<TraceEvent> events(4);
+  EXPECT_EQ(tracer.Snapshot(&events), 0);
+  EXPECT_TRUE(events.empty());
+}
+
+TEST(TraceTest, ClassFiltering) {
+  Tracer tracer(16);
+  tracer.SetClasses(static_cast<uint32_t>(TraceClass::kRexmit));
+  tracer.Record(TraceEventType::kRtoRexmit, 7, 100, 8, 3);
+  tracer.Record(TraceEventType::kStateChange, 7, 100, 8, 0, 1);
+  tracer.Record(TraceEventType::kRttSample, 7, 100, 8, 10, 10);
+  ASSERT_EQ(tracer.GetRecorded(), 1);
+
+  std::vector<TraceEvent> events;
+  tracer.Snapshot(&events);
+  ASSERT_EQ(events.size(), 1);
+  EXPECT_EQ(events[0].type, static_cast<uint8_t>(TraceEventType::kRtoRexmit));
+  EXPECT_EQ(events[0].flow_id, 7);
+  EXPECT_EQ(events[0].seqno, 100);
+  EXPECT_EQ(events[0].cwnd, 8);
+  EXPECT_EQ(events[0].arg0, 3);
+  EXPECT_GT(events[0].tsc, 0);
+
+  tracer.SetClasses(kTraceClassAll);
+  tracer.Record(TraceEventType::kStateChange, 7, 100, 8, 0, 1);
+  tracer.Record(TraceEventType::kRttSample, 7, 100, 8, 10, 10);
+  EXPECT_EQ(tracer.GetRecorded(), 3);
+}
+
+TEST(TraceTest, WrapAround) {
+  const size_t kCapacity = 8;
+  Tracer tracer(kCapacity);
+  tracer.SetClasses(kTraceClassAll);
+  const uint32_t kEvents = 3 * kCapacity + 3;
+  for (uint32_t i = 0; i < kEvents; i++) {
+    tracer.Record(TraceEventType::kDupAck, 0, i, 0);
+  }
+
+  // The writer is idle, so all but the slot it would write next are valid.
+  std::vector<TraceEvent> events;
+  EXPECT_EQ(tracer.Snapshot(&events), kEvents);
+  ASSERT_EQ(events.size(), kCapacity - 1);
+  for (size_t i = 0; i < events.size(); i++) {
+    EXPECT_EQ(events[i].seqno, kEvents - (kCapacity - 1) + i);
+    if (i > 0) {
+      EXPECT_GE(events[i].tsc, events[i - 1].tsc);
+    }
+  }
+}
+
+TEST(TraceTest, NewFlowId) {
+  Tracer tracer(8);
+  EXPECT_EQ(tracer.NewFlowId(), 0);
+  EXPECT_EQ(tracer.NewFlowId(), 1);
+}
+
+TEST(TraceTest, ClassesFromString) {
+  EXPECT_EQ(TraceClassesFromString(""), 0);
+  EXPECT_EQ(TraceClassesFromString("all"), kTraceClassAll);
+  EXPECT_EQ(TraceClassesFromString("rexmit,ack"),
+            static_cast<uint32_t>(TraceClass::kRexmit) |
+                static_cast<uint32_t>(TraceClass::kAck));
+  EXPECT_EQ(TraceClassesFromString("state,,rx_error,"),
+            static_cast<uint32_t>(TraceClass::kState) |
+                static_cast<uint32_t>(TraceClass::kRxError));
+  EXPECT_FALSE(TraceClassesFromString("rexmit,bogus").has_value());
+}
+
+TEST(TraceTest, ConcurrentSnapshotsAreConsistent) {
+  Tracer tracer(64);
+  tracer.SetClasses(kTraceClassAll);
+  const uint32_t kEvents = 1 << 20;
+  std::atomic<bool> done{false};
+
+  // Every event carries its index in all its fields, so a torn copy shows.
+  std::thread writer([&]() {
+    for (uint32_t i = 0; i < kEvents; i++) {
+      tracer.Record(TraceEventType::kDupAck, i, i, 0, i, i, i);
+    }
+    done.store(true);
+  });
+
+  std::vector<TraceEvent> events;
+  while (!done.load()) {
+    tracer.Snapshot(&events);
+    for (size_t i = 0; i < events.size(); i++) {
+      const auto &event = events[i];
+      EXPECT_EQ(event.flow_id, event.seqno);
+      EXPECT_EQ(event.arg0, event.seqno);
+      EXPECT_EQ(event.arg2, event.seqno);
+      if (i > 0) {
+        EXPECT_EQ(event.seqno, events[i - 1].seqno + 1);
+      }
+    }
+  }
+  writer.join();
+}
+
+}  // namespace juggler
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -159,6 +159,17 @@ bool UDSocket::SendMsg(const char *msg, size_t len) {
   return true;
 }
 
+bool UDSocket::RecvAll(char *msg, size_t len) {
+  while (len > 0) {
+    const auto ret = recv(socket_fd_, msg, len, 0);
+    if (ret < 0 && errno == EINTR) continue;
+    if (ret <= 0) return false;
+    msg += ret;
+    len -= ret;
+  }
+  return true;
+}
+
 bool UDSocket::SendMsgWithFd(const char *msg, size_t len, int fd) {
   msghdr msg_hdr;
   memset(&msg_hdr, 0, sizeof(msg_hdr));
@@ -244,11 +255,12 @@ void UDSocket::Shutdown() {
 
 UDServer::UDServer(const std::string &path, on_connect_cb_t on_connect,
                    on_close_cb_t on_close, on_message_cb_t on_message,
-                   on_timeout_cb_t on_timeout)
+                   on_timeout_cb_t on_timeout, on_idle_cb_t on_idle)
     : on_connect_(CHECK_NOTNULL(on_connect)),
       on_close_(CHECK_NOTNULL(on_close)),
       on_message_(CHECK_NOTNULL(on_message)),
       on_timeout_(CHECK_NOTNULL(on_timeout)),
+      on_idle_(on_idle),
       keep_running_(false),
       listen_socket_(),
       connected_clients_() {
@@ -285,10 +297,9 @@ void UDServer::Run() {
   std::vector<uint8_t> buffer(kMaxBufferSize);
 
   keep_running_.store(true);
-  const int kEpollTimeoutMs = 10;
   while (keep_running_.load()) {
     auto nfds = epoll_wait(epoll_fd, event_list.data(), event_list.size(),
-                           kEpollTimeoutMs);
+                           kIdleIntervalMs);
     if (nfds == -1 && errno != EINTR) {
       LOG(FATAL) << utils::Format("Failed to wait on epoll (%s)",
                                   strerror(errno));
@@ -351,6 +362,8 @@ void UDServer::Run() {
         }
       }
     }
+
+    if (on_idle_) on_idle_();
   }
 
   // Allow the server to be shut down gracefully.
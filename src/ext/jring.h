@@ -446,6 +446,28 @@ static __attribute((always_inline)) inline unsigned int jring_dequeue_burst(
              : jring_mc_dequeue_burst(r, obj_table, n, available);
 }
 
+/**
+ * Copy the object at the head of a ring without dequeuing it (NOT
+ * multi-consumer safe).
+ *
+ * @param r
+ *   A pointer to the ring structure.
+ * @param obj
+ *   A pointer to an object-sized area that will be filled.
+ * @return
+ *   - 1: The head object was copied to obj.
+ *   - 0: The ring is empty.
+ */
+static __attribute__((always_inline)) inline unsigned int jring_sc_peek(
+    struct jring *r, void *obj) {
+  uint32_t cons_head = r->cons.head;
+  uint32_t prod_tail = __atomic_load_n(&r->prod.tail, __ATOMIC_ACQUIRE);
+  if (prod_tail == cons_head) return 0;
+
+  __jring_dequeue_elems(r, cons_head, obj, r->esize, 1);
+  return 1;
+}
+
 /**
  * Return the number of entries in a ring.
  *
@@ -10,14 +10,20 @@
 
 #include <arpa/inet.h>
 #include <errno.h>
+#include <inttypes.h>
 #include <netinet/in.h>
+#include <pthread.h>
 #include <sys/mman.h>
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <sys/un.h>
+#include <time.h>
 #include <unistd.h>
 
+#include "machnet_copy.h"
 #include "machnet_ctrl.h"
+#include "machnet_trace.h"
+#include "pause.h"
 
 #define MIN(a, b)           \
   ({                        \
@@ -25,6 +31,12 @@
     __typeof__(b) _b = (b); \
     _a < _b ? _a : _b;      \
   })
+#define MAX(a, b)           \
+  ({                        \
+    __typeof__(a) _a = (a); \
+    __typeof__(b) _b = (b); \
+    _a > _b ? _a : _b;      \
+  })
 
 // Main socket/connection to the Machnet controller.
 int g_ctrl_socket = -1;
@@ -127,80 +139,440 @@ static int _machnet_ctrl_request(machnet_ctrl_msg_t *req,
   return 0;
 }
 
+/*
+ * Application-side buffer caches.
+ *
+ * Every application thread keeps a private cache of buffer indices for each
+ * channel (and buffer class) it uses, so that most allocations and releases do
+ * not touch the channel's global buffer pools (MP/MC rings that are shared
+ * with Machnet). Several threads can share a channel without contending with
+ * each other on the data path.
+ *
+ * Each cache still has a spinlock, which its thread holds while it allocates
+ * or releases buffers through the cache. The only other party that takes it
+ * is a flush of the caches of all threads: the background segments thread
+ * drains the buffers of an extension segment that Machnet wants to reclaim
+ * (`_machnet_buffer_caches_drain()'), and `machnet_detach()' and process exit
+ * flush whole caches. These are rare, so on the data path the lock is an
+ * uncontended atomic exchange on a cache line that stays with the thread's
+ * core: much cheaper than the MP/MC rings, and a flush never overlaps with an
+ * allocation or a release.
+ *
+ * The number of buffers fetched from the global pool on a cache miss adapts
+ * to the thread's behaviour: it doubles on every miss (the thread allocates
+ * more than it releases, e.g., a sender), and halves every time the cache
+ * overflows (e.g., a receiver), so that buffers are not hoarded.
+ *
+ * A thread's caches are flushed to the global pools when the thread exits,
+ * when the process exits, or when a channel is detached
+ * (`machnet_detach()'). The last two flush the caches of other threads, which
+ * may still be running, under their locks. Once the process exits, no new
+ * caches are set up, and the threads that keep running use the global pools
+ * directly.
+ */
+#define MACHNET_BUFFER_CACHE_SIZE (2 * NUM_CACHED_BUFS)
+#define MACHNET_BUFFER_CACHE_REFILL_MIN 8
+#define MACHNET_BUFFER_CACHE_REFILL_MAX (MACHNET_BUFFER_CACHE_SIZE / 2)
+
+// Cached buffers of a single buffer class.
+struct MachnetBufferClassCache {
+  uint32_t count;
+  uint32_t refill_nr;
+  MachnetRingSlot_t indices[MACHNET_BUFFER_CACHE_SIZE];
+};
+
+struct MachnetBufferCache {
+  // The channel this cache belongs to, or NULL if the cache is not in use.
+  // Only changes with both `lock' and `g_buffer_caches_lock' held.
+  const MachnetChannelCtx_t *ctx;
+  uint32_t lock;
+  // Scratch table to hold the buffer indices of a message being allocated.
+  MachnetRingSlot_t *scratch;
+  uint32_t scratch_nr;
+  struct MachnetBufferCache *next;  // Next cache of the same thread.
+  struct MachnetBufferClassCache classes[MACHNET_CHANNEL_BUF_CLASS_MAX];
+};
+
+// All the buffer caches of a thread.
+struct MachnetThreadBufferCaches {
+  struct MachnetBufferCache *head;
+  struct MachnetBufferCache *last_used;
+  struct MachnetThreadBufferCaches *prev;
+  struct MachnetThreadBufferCaches *next;
+};
+
+static __thread struct MachnetThreadBufferCaches *tls_buffer_caches;
+// Registry of the buffer caches of all threads; protected by the lock.
+static struct MachnetThreadBufferCaches *g_buffer_caches;
+static pthread_mutex_t g_buffer_caches_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t g_buffer_caches_once = PTHREAD_ONCE_INIT;
+static pthread_key_t g_buffer_caches_key;
+// Set when the process exits; protected by `g_buffer_caches_lock'.
+static int g_buffer_caches_closed;
+
+static inline void _machnet_buffer_cache_lock(
+    struct MachnetBufferCache *cache) {
+  while (unlikely(__atomic_exchange_n(&cache->lock, 1, __ATOMIC_ACQUIRE)))
+    machnet_pause();
+}
+
+static inline void _machnet_buffer_cache_unlock(
+    struct MachnetBufferCache *cache) {
+  __atomic_store_n(&cache->lock, 0, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Returns all the buffers of a class cache to the global pool.
+ */
+static void _machnet_buffer_class_cache_flush(
+    const MachnetChannelCtx_t *ctx,
+    struct MachnetBufferClassCache *class_cache) {
+  uint32_t retries = 5;
+  while (class_cache->count > 0) {
+    class_cache->count -= __machnet_channel_buf_free_bulk(
+        ctx, class_cache->count, class_cache->indices);
+    if (unlikely(retries-- == 0 && class_cache->count > 0)) {
+      fprintf(stderr, "ERROR: Failed to free buffers to global pool.\n");
+      abort();
+    }
+  }
+}
+
+/**
+ * @brief Returns all the buffers of a cache to the global pools of its
+ * channel. Must be called with `g_buffer_caches_lock' and the cache's lock
+ * held.
+ */
+static void _machnet_buffer_cache_flush(struct MachnetBufferCache *cache) {
+  if (cache->ctx == NULL) return;
+
+  for (uint32_t cls = 0; cls < MACHNET_CHANNEL_BUF_CLASS_MAX; cls++)
+    _machnet_buffer_class_cache_flush(cache->ctx, &cache->classes[cls]);
+}
+
 /**
- * @brief Allocates a specified number of buffers for use, either directly from
- * the global pool or from the application's buffer cache.
+ * @brief Makes sure that the scratch table of a cache can hold at least `nr'
+ * buffer indices. Only the thread owning the cache may call this.
  *
- * This function allocates `cnt` number of buffers for the Machnet channel. If
- * the count exceeds the number of cached buffers (`NUM_CACHED_BUFS`), the
- * allocation is made directly from the global pool. For smaller allocations, it
- * tries to fulfill the request from the application's buffer cache. If the
- * cache is empty, it refills the cache from the global pool. If allocation from
- * the global pool fails at any point, the function returns `NULL`.
+ * @return 0 on success, -1 on failure.
+ */
+static int _machnet_buffer_cache_scratch_reserve(
+    struct MachnetBufferCache *cache, uint32_t nr) {
+  if (likely(cache->scratch_nr >= nr)) return 0;
+  MachnetRingSlot_t *scratch = (MachnetRingSlot_t *)realloc(
+      cache->scratch, nr * sizeof(MachnetRingSlot_t));
+  if (scratch == NULL) return -1;
+  cache->scratch = scratch;
+  cache->scratch_nr = nr;
+  return 0;
+}
+
+// Destructor of the thread-specific key; called when a thread exits.
+static void _machnet_buffer_caches_thread_exit(void *arg) {
+  struct MachnetThreadBufferCaches *caches =
+      (struct MachnetThreadBufferCaches *)arg;
+
+  pthread_mutex_lock(&g_buffer_caches_lock);
+  if (caches->prev != NULL)
+    caches->prev->next = caches->next;
+  else
+    g_buffer_caches = caches->next;
+  if (caches->next != NULL) caches->next->prev = caches->prev;
+
+  struct MachnetBufferCache *cache = caches->head;
+  while (cache != NULL) {
+    struct MachnetBufferCache *next = cache->next;
+    _machnet_buffer_cache_lock(cache);
+    _machnet_buffer_cache_flush(cache);
+    free(cache->scratch);
+    free(cache);
+    cache = next;
+  }
+  pthread_mutex_unlock(&g_buffer_caches_lock);
+
+  free(caches);
+  if (tls_buffer_caches == caches) tls_buffer_caches = NULL;
+}
+
+/**
+ * @brief Flushes the buffer caches of all threads, either for one channel
+ * (`ctx') or for all of them (`ctx' is NULL). The flushed caches stay
+ * allocated, but are no longer associated with a channel.
+ */
+static void _machnet_buffer_caches_flush_all(const MachnetChannelCtx_t *ctx) {
+  pthread_mutex_lock(&g_buffer_caches_lock);
+  for (struct MachnetThreadBufferCaches *caches = g_buffer_caches;
+       caches != NULL; caches = caches->next) {
+    for (struct MachnetBufferCache *cache = caches->head; cache != NULL;
+         cache = cache->next) {
+      if (cache->ctx == NULL || (ctx != NULL && cache->ctx != ctx)) continue;
+      // Wait for the owning thread to be done with the cache.
+      _machnet_buffer_cache_lock(cache);
+      _machnet_buffer_cache_flush(cache);
+      __atomic_store_n(&cache->ctx, NULL, __ATOMIC_RELAXED);
+      _machnet_buffer_cache_unlock(cache);
+    }
+  }
+  pthread_mutex_unlock(&g_buffer_caches_lock);
+}
+
+/**
+ * @brief Returns the buffers of a class that the threads have cached for a
+ * channel to its global pool. Once done, no thread allocates from the class
+ * unless it is active.
  *
- * @param ctx Pointer to the MachnetChannelCtx_t structure that holds channel
- * context information, including the application buffer cache.
- * @param cnt The number of buffers to allocate.
- * @return A pointer to the first MachnetRingSlot_t element of an array
- * containing the allocated buffer indices if the allocation is successful;
- * otherwise, `NULL`.
+ * Threads allocate (and cache buffers) with their cache locked, and check the
+ * state of the class there; so after we have had each cache locked, they all
+ * see the new state.
  */
-static inline MachnetRingSlot_t *_machnet_buffers_alloc(
-    MachnetChannelCtx_t *ctx, uint32_t cnt) {
-  MachnetRingSlot_t *buffer_indices = __machnet_channel_buffer_index_table(ctx);
+static void _machnet_buffer_caches_drain(const MachnetChannelCtx_t *ctx,
+                                         uint32_t cls) {
+  pthread_mutex_lock(&g_buffer_caches_lock);
+  for (struct MachnetThreadBufferCaches *caches = g_buffer_caches;
+       caches != NULL; caches = caches->next) {
+    for (struct MachnetBufferCache *cache = caches->head; cache != NULL;
+         cache = cache->next) {
+      if (cache->ctx != ctx) continue;
+      _machnet_buffer_cache_lock(cache);
+      if (cache->ctx == ctx)
+        _machnet_buffer_class_cache_flush(ctx, &cache->classes[cls]);
+      _machnet_buffer_cache_unlock(cache);
+    }
+  }
+  pthread_mutex_unlock(&g_buffer_caches_lock);
+}
 
-  if (cnt > NUM_CACHED_BUFS) {
-    // This is a large bulk allocation, so we can bypass the application cache.
-    uint32_t ret =
-        __machnet_channel_buf_alloc_bulk(ctx, cnt, buffer_indices, NULL);
-    if (ret != cnt) {
+static void _machnet_buffer_caches_process_exit(void) {
+  pthread_mutex_lock(&g_buffer_caches_lock);
+  g_buffer_caches_closed = 1;
+  pthread_mutex_unlock(&g_buffer_caches_lock);
+  _machnet_buffer_caches_flush_all(NULL);
+}
+
+static void _machnet_buffer_caches_init(void) {
+  if (pthread_key_create(&g_buffer_caches_key,
+                         _machnet_buffer_caches_thread_exit) != 0) {
+    fprintf(stderr, "ERROR: Failed to create buffer cache key.\n");
+    abort();
+  }
+  // Thread-specific destructors do not run for the thread that calls exit().
+  atexit(_machnet_buffer_caches_process_exit);
+}
+
+/**
+ * @brief Slow path of `_machnet_buffer_cache()': sets up a buffer cache for the
+ * calling thread and the given channel.
+ *
+ * @return A pointer to the cache, or NULL on failure.
+ */
+static struct MachnetBufferCache *_machnet_buffer_cache_create(
+    const MachnetChannelCtx_t *ctx) {
+  pthread_once(&g_buffer_caches_once, _machnet_buffer_caches_init);
+
+  struct MachnetThreadBufferCaches *caches = tls_buffer_caches;
+  if (caches == NULL) {
+    caches = (struct MachnetThreadBufferCaches *)calloc(1, sizeof(*caches));
+    if (caches == NULL) return NULL;
+    if (pthread_setspecific(g_buffer_caches_key, caches) != 0) {
+      free(caches);
       return NULL;
     }
-    return buffer_indices;
+    pthread_mutex_lock(&g_buffer_caches_lock);
+    caches->next = g_buffer_caches;
+    if (g_buffer_caches != NULL) g_buffer_caches->prev = caches;
+    g_buffer_caches = caches;
+    pthread_mutex_unlock(&g_buffer_caches_lock);
+    tls_buffer_caches = caches;
+  }
+
+  // The scratch table must be able to hold the largest possible message (it
+  // grows on demand if the channel is extended).
+  const uint32_t scratch_nr = __machnet_channel_buffers_total(ctx);
+
+  pthread_mutex_lock(&g_buffer_caches_lock);
+  if (g_buffer_caches_closed) goto fail;
+  // Reuse a cache that was flushed by `machnet_detach()', if any.
+  struct MachnetBufferCache *cache = caches->head;
+  while (cache != NULL && cache->ctx != NULL) cache = cache->next;
+  if (cache == NULL) {
+    cache = (struct MachnetBufferCache *)calloc(1, sizeof(*cache));
+    if (cache == NULL) goto fail;
+    cache->next = caches->head;
+    caches->head = cache;
+  }
+  if (_machnet_buffer_cache_scratch_reserve(cache, scratch_nr) != 0) goto fail;
+  for (uint32_t cls = 0; cls < MACHNET_CHANNEL_BUF_CLASS_MAX; cls++) {
+    cache->classes[cls].count = 0;
+    cache->classes[cls].refill_nr = MACHNET_BUFFER_CACHE_REFILL_MIN;
   }
+  __atomic_store_n(&cache->ctx, ctx, __ATOMIC_RELAXED);
+  pthread_mutex_unlock(&g_buffer_caches_lock);
 
-  // Try to allocate from the application cache.
-  uint32_t index = 0;
-  while (index < cnt) {
-    if (unlikely(ctx->app_buffer_cache.count == 0)) {
-      // The cache is empty, so we need to allocate from the global pool.
-      ctx->app_buffer_cache.count += __machnet_channel_buf_alloc_bulk(
-          ctx, NUM_CACHED_BUFS, ctx->app_buffer_cache.indices, NULL);
-      if (unlikely(ctx->app_buffer_cache.count == 0)) {
-        // We failed to allocate from the global pool.
-        goto fail;
+  caches->last_used = cache;
+  return cache;
+
+fail:
+  pthread_mutex_unlock(&g_buffer_caches_lock);
+  return NULL;
+}
+
+static inline const MachnetChannelCtx_t *_machnet_buffer_cache_ctx(
+    const struct MachnetBufferCache *cache) {
+  return __atomic_load_n(&cache->ctx, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Returns the calling thread's buffer cache for a channel, creating it
+ * if needed, and locks it. The caller unlocks it with
+ * `_machnet_buffer_cache_unlock()' once done with it.
+ *
+ * @param ctx The channel context.
+ * @return A pointer to the cache, or NULL on failure (or once the process is
+ * exiting).
+ */
+static inline struct MachnetBufferCache *_machnet_buffer_cache(
+    const MachnetChannelCtx_t *ctx) {
+  while (1) {
+    struct MachnetThreadBufferCaches *caches = tls_buffer_caches;
+    struct MachnetBufferCache *cache = NULL;
+    if (likely(caches != NULL)) {
+      cache = caches->last_used;
+      if (unlikely(cache == NULL || _machnet_buffer_cache_ctx(cache) != ctx)) {
+        for (cache = caches->head; cache != NULL; cache = cache->next) {
+          if (_machnet_buffer_cache_ctx(cache) == ctx) break;
+        }
       }
     }
+    if (unlikely(cache == NULL)) {
+      cache = _machnet_buffer_cache_create(ctx);
+      if (cache == NULL) return NULL;
+    }
+    caches = tls_buffer_caches;
+    caches->last_used = cache;
 
-    buffer_indices[index++] =
-        ctx->app_buffer_cache.indices[--ctx->app_buffer_cache.count];
+    _machnet_buffer_cache_lock(cache);
+    if (likely(cache->ctx == ctx)) return cache;
+    // The cache was flushed since we looked it up.
+    _machnet_buffer_cache_unlock(cache);
   }
+}
 
-  return buffer_indices;
+/**
+ * @brief Allocates a specified number of buffers of a class, either directly
+ * from the global pool or from the calling thread's buffer cache.
+ *
+ * If the count exceeds the size of the thread's cache, the allocation is made
+ * directly from the global pool. For smaller allocations, it tries to fulfill
+ * the request from the cache. If the cache is empty, it refills the cache from
+ * the global pool (and grows the refill size).
+ *
+ * @param cache The calling thread's buffer cache for the channel.
+ * @param cls The buffer class to allocate from.
+ * @param cnt The number of buffers to allocate.
+ * @param buffer_indices Array to store the allocated buffer indices in.
+ * @return 0 on success, -1 if the pool does not have enough buffers.
+ */
+static inline int _machnet_buffers_alloc(struct MachnetBufferCache *cache,
+                                         uint32_t cls, uint32_t cnt,
+                                         MachnetRingSlot_t *buffer_indices) {
+  const MachnetChannelCtx_t *ctx = cache->ctx;
+  struct MachnetBufferClassCache *class_cache = &cache->classes[cls];
+
+  if (cnt > MACHNET_BUFFER_CACHE_SIZE) {
+    // This is a large bulk allocation, so we can bypass the cache.
+    uint32_t ret = __machnet_channel_class_buf_alloc_bulk(ctx, cls, cnt,
+                                                          buffer_indices, NULL);
+    return ret == cnt ? 0 : -1;
+  }
 
-fail:
-  // Bulk allocation has failed; return partial allocation to the application
-  // cache.
-  for (uint32_t i = 0; i < index; i++) {
-    ctx->app_buffer_cache.indices[ctx->app_buffer_cache.count++] =
-        buffer_indices[i];
+  if (unlikely(class_cache->count < cnt)) {
+    // Refill the cache from the global pool. Fetch at least what is needed for
+    // this allocation, and as many as the current refill size.
+    const uint32_t needed = cnt - class_cache->count;
+    const uint32_t refill_nr =
+        MIN(MACHNET_BUFFER_CACHE_SIZE - class_cache->count,
+            needed + class_cache->refill_nr);
+    MachnetRingSlot_t *refill = class_cache->indices + class_cache->count;
+    uint32_t ret =
+        __machnet_channel_class_buf_alloc_bulk(ctx, cls, refill_nr, refill,
+                                               NULL);
+    if (unlikely(ret == 0 && refill_nr > needed)) {
+      // The pool is running low; get just what we need.
+      ret = __machnet_channel_class_buf_alloc_bulk(ctx, cls, needed, refill,
+                                                   NULL);
+    }
+    if (unlikely(ret == 0)) return -1;
+    class_cache->count += ret;
+    class_cache->refill_nr = MIN(2 * class_cache->refill_nr,
+                                 (uint32_t)MACHNET_BUFFER_CACHE_REFILL_MAX);
   }
 
-  return NULL;
+  class_cache->count -= cnt;
+  memcpy(buffer_indices, class_cache->indices + class_cache->count,
+         cnt * sizeof(MachnetRingSlot_t));
+  return 0;
+}
+
+/**
+ * @brief Caches the given buffers in a cache that the calling thread has
+ * locked; see `_machnet_buffers_release()'.
+ */
+static inline void _machnet_buffer_cache_put(
+    struct MachnetBufferCache *cache, uint32_t cnt,
+    MachnetRingSlot_t *buffer_indices) {
+  const MachnetChannelCtx_t *ctx = cache->ctx;
+  for (uint32_t index = 0; index < cnt; index++) {
+    const uint32_t cls = MACHNET_MSGBUF_INDEX_CLASS(buffer_indices[index]);
+    assert(cls < MACHNET_CHANNEL_BUF_CLASS_MAX);
+    if (unlikely(ctx->data_ctx.buf_classes[cls].state !=
+                 MACHNET_CHANNEL_BUF_CLASS_ACTIVE)) {
+      // The class is being reclaimed; do not hold on to its buffers.
+      if (__machnet_channel_buf_free_bulk(ctx, 1, &buffer_indices[index]) !=
+          1) {
+        fprintf(stderr, "ERROR: Failed to free buffers to global pool.\n");
+        abort();
+      }
+      continue;
+    }
+    struct MachnetBufferClassCache *class_cache = &cache->classes[cls];
+    uint32_t retries = 5;
+    while (unlikely(class_cache->count == MACHNET_BUFFER_CACHE_SIZE)) {
+      // The cache is full, free to global pool.
+      uint32_t elements_to_free = class_cache->count / 2;
+      MachnetRingSlot_t *indices_to_free =
+          class_cache->indices + (MACHNET_BUFFER_CACHE_SIZE - elements_to_free);
+      class_cache->count -=
+          __machnet_channel_buf_free_bulk(ctx, elements_to_free, indices_to_free);
+      class_cache->refill_nr = MAX(class_cache->refill_nr / 2,
+                                   (uint32_t)MACHNET_BUFFER_CACHE_REFILL_MIN);
+
+      if (unlikely(retries-- == 0 &&
+                   class_cache->count == MACHNET_BUFFER_CACHE_SIZE)) {
+        /*
+         * XXX (ilias): If we reach here, we have failed to free the buffers to
+         * the global pool and we are going to leak them. Terminate execution.
+         */
+        fprintf(stderr, "ERROR: Failed to free buffers to global pool.\n");
+        abort();
+      }
+    }
+
+    class_cache->indices[class_cache->count++] = buffer_indices[index];
+  }
 }
 
 /**
  * @brief Releases a given number of buffers by either caching them or freeing
  * them to the global pool.
  *
- * This function attempts to release a specified count of buffers back into the
- * Machnet channel context's application buffer cache. If the cache is full,
- * it will free half of the cached buffers to the global buffer pool. If after
- * several retries it is unable to free buffers to the global pool, the function
- * aborts the program execution.
+ * This function releases a specified count of buffers (of any class) back into
+ * the calling thread's buffer cache. If the cache of a class is full, it frees
+ * half of the cached buffers to the global buffer pool (and shrinks the refill
+ * size). If after several retries it is unable to free buffers to the global
+ * pool, the function aborts the program execution.
  *
  * @param ctx Pointer to the MachnetChannelCtx_t structure that represents the
- *        channel context which holds the application buffer cache.
+ *        channel context.
  * @param cnt The number of buffers to be released.
  * @param buffer_indices Array of MachnetRingSlot_t that contains the indices of
  * the buffers that need to be released.
@@ -212,31 +584,502 @@ fail:
 static inline void _machnet_buffers_release(MachnetChannelCtx_t *ctx,
                                             uint32_t cnt,
                                             MachnetRingSlot_t *buffer_indices) {
-  uint32_t index = 0;
-  while (index < cnt) {
-    uint32_t retries = 5;
-    while (unlikely(ctx->app_buffer_cache.count == NUM_CACHED_BUFS)) {
-      // The cache is full, free to global pool.
-      uint32_t elements_to_free = ctx->app_buffer_cache.count / 2;
-      MachnetRingSlot_t *indices_to_free =
-          ctx->app_buffer_cache.indices + (NUM_CACHED_BUFS - elements_to_free);
-      ctx->app_buffer_cache.count -= __machnet_channel_buf_free_bulk(
-          ctx, elements_to_free, indices_to_free);
+  struct MachnetBufferCache *cache = _machnet_buffer_cache(ctx);
+  if (unlikely(cache == NULL)) {
+    // No cache available; free straight to the global pool.
+    if (__machnet_channel_buf_free_bulk(ctx, cnt, buffer_indices) != cnt) {
+      fprintf(stderr, "ERROR: Failed to free buffers to global pool.\n");
+      abort();
+    }
+    return;
+  }
 
-      if (unlikely(retries-- == 0 &&
-                   ctx->app_buffer_cache.count == NUM_CACHED_BUFS)) {
-        /*
-         * XXX (ilias): If we reach here, we have failed to free the buffers to
-         * the global pool and we are going to leak them. Terminate execution.
-         */
-        fprintf(stderr, "ERROR: Failed to free buffers to global pool.\n");
-        abort();
+  _machnet_buffer_cache_put(cache, cnt, buffer_indices);
+  _machnet_buffer_cache_unlock(cache);
+}
+
+/**
+ * @brief Allocates the buffers to hold a message of a given size.
+ *
+ * The buffer classes of the channel are used so that the message takes as few
+ * buffers as possible, and then wastes as little space as possible. The
+ * candidate layouts fill full buffers from the largest class down, and round
+ * the rest of the message up to a number of buffers of one class. Rounding up
+ * to a class may not waste more than half of a buffer of that class, or one
+ * default buffer, so that a small tail does not pin a large buffer (the
+ * smallest class takes any tail). If a class is exhausted, the layout is
+ * picked again without it. The buffers are returned in the order they should
+ * be filled (largest first). Only active classes are used; classes backed by
+ * extension segments that are being reclaimed are skipped.
+ *
+ * @param ctx The channel context.
+ * @param msg_size The size of the message.
+ * @param buffers_nr (ptr) Set to the number of buffers allocated.
+ * @return A pointer to a thread-local array holding the buffer indices on
+ * success, NULL on failure.
+ */
+static MachnetRingSlot_t *_machnet_msg_buffers_alloc(MachnetChannelCtx_t *ctx,
+                                                     uint32_t msg_size,
+                                                     uint32_t *buffers_nr) {
+  struct MachnetBufferCache *cache = _machnet_buffer_cache(ctx);
+  if (unlikely(cache == NULL)) return NULL;
+
+  const uint8_t *order = ctx->data_ctx.buf_class_order;
+  const MachnetChannelBufClass_t *buf_classes = ctx->data_ctx.buf_classes;
+  const uint32_t max_slack = buf_classes[0].buf_mss;
+  // The classes we can allocate from.
+  uint32_t usable = 0;
+  for (uint32_t cls = 0; cls < MACHNET_CHANNEL_BUF_CLASS_MAX; cls++) {
+    if (buf_classes[cls].state == MACHNET_CHANNEL_BUF_CLASS_ACTIVE &&
+        buf_classes[cls].buf_mss != 0) {
+      usable |= 1U << cls;
+    } else if (unlikely(cache->classes[cls].count > 0)) {
+      // The class is not in use (or being reclaimed); give back any buffers
+      // we cached from it.
+      _machnet_buffer_class_cache_flush(ctx, &cache->classes[cls]);
+    }
+  }
+
+  while (usable != 0) {
+    // Pick the layout.
+    uint32_t layout[MACHNET_CHANNEL_BUF_CLASS_MAX] = {0};
+    uint32_t best[MACHNET_CHANNEL_BUF_CLASS_MAX] = {0};
+    uint32_t best_nr = UINT32_MAX, best_slack = UINT32_MAX;
+    uint32_t remaining_bytes = msg_size;
+    uint32_t nr = 0;
+    int smallest = 0;
+    while (!(usable & (1U << order[smallest]))) smallest++;
+    for (int i = MACHNET_CHANNEL_BUF_CLASS_MAX - 1; i >= smallest; i--) {
+      const uint32_t cls = order[i];
+      if (!(usable & (1U << cls))) continue;
+      const uint32_t mss = buf_classes[cls].buf_mss;
+      const uint32_t cnt = (remaining_bytes + mss - 1) / mss;
+      const uint32_t slack = cnt * mss - remaining_bytes;
+      if ((i == smallest || slack <= MAX(mss / 2, max_slack)) &&
+          (nr + cnt < best_nr || (nr + cnt == best_nr && slack < best_slack))) {
+        memcpy(best, layout, sizeof(best));
+        best[cls] += cnt;
+        best_nr = nr + cnt;
+        best_slack = slack;
+      }
+      layout[cls] = remaining_bytes / mss;
+      nr += layout[cls];
+      remaining_bytes -= layout[cls] * mss;
+      if (remaining_bytes == 0) break;
+    }
+
+    // Allocate it.
+    nr = 0;
+    int i;
+    for (i = MACHNET_CHANNEL_BUF_CLASS_MAX - 1; i >= smallest; i--) {
+      const uint32_t cls = order[i];
+      const uint32_t cnt = best[cls];
+      if (cnt == 0) continue;
+      if (unlikely(_machnet_buffer_cache_scratch_reserve(cache, nr + cnt) !=
+                   0)) {
+        usable = 0;
+        break;
+      }
+      if (unlikely(_machnet_buffers_alloc(cache, cls, cnt,
+                                          cache->scratch + nr) != 0)) {
+        // The class is exhausted; try without it.
+        usable &= ~(1U << cls);
+        break;
       }
+      nr += cnt;
+    }
+    if (likely(i < smallest)) {
+      _machnet_buffer_cache_unlock(cache);
+      *buffers_nr = nr;
+      // The scratch array is only used by the owning thread; it stays valid
+      // after unlocking.
+      return cache->scratch;
+    }
+    _machnet_buffer_cache_put(cache, nr, cache->scratch);
+  }
+
+  // We failed to allocate the buffers.
+  _machnet_buffer_cache_unlock(cache);
+  return NULL;
+}
+
+/*
+ * Extension segments.
+ *
+ * Machnet may extend a channel at runtime with buffer classes backed by
+ * separate shared memory segments, and reclaim them once they are idle (see
+ * `MachnetChannelBufClass'). Whenever the state of a segment changes, Machnet
+ * bumps the `segment_gen' doorbell of the channel. The data path calls only
+ * check the doorbell, and hand the channel over to a background thread, so
+ * that they never block on the segments. The thread maps a new segment at its
+ * slot (opening it by name, or fetching its file descriptor from the
+ * controller), gives back the buffers cached from a segment being drained, or
+ * unmaps a segment being reclaimed, and then acknowledges the state.
+ */
+#define MACHNET_SEGMENTS_PENDING_MAX 64
+static struct {
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  int started;
+  // The channels to process, and the one being processed.
+  MachnetChannelCtx_t *pending[MACHNET_SEGMENTS_PENDING_MAX];
+  uint32_t pending_nr;
+  const MachnetChannelCtx_t *current;
+} g_segments = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, 0, {NULL},
+                0, NULL};
+
+/**
+ * @brief Requests the file descriptor of an extension segment from the
+ * controller.
+ *
+ * @param ctx The channel context.
+ * @param cls The buffer class of the segment.
+ * @return The file descriptor on success, -1 on failure.
+ */
+static int _machnet_segment_fd(const MachnetChannelCtx_t *ctx, uint32_t cls) {
+  machnet_ctrl_msg_t req = {};
+  req.type = MACHNET_CTRL_MSG_TYPE_REQ_SEGMENT;
+  req.msg_id = msg_id_counter++;
+  uuid_copy(req.app_uuid, g_app_uuid);
+  // Channels are named after their UUID.
+  if (uuid_parse(ctx->name, req.segment_info.channel_uuid) != 0) return -1;
+  req.segment_info.buf_class = cls;
+
+  int segment_fd;
+  machnet_ctrl_msg_t resp;
+  if (_machnet_ctrl_request(&req, &resp, &segment_fd) != 0) return -1;
+
+  if (resp.type != MACHNET_CTRL_MSG_TYPE_RESPONSE ||
+      resp.msg_id != req.msg_id || resp.status != MACHNET_CTRL_STATUS_SUCCESS) {
+    if (segment_fd >= 0) close(segment_fd);
+    return -1;
+  }
+
+  return segment_fd;
+}
+
+/**
+ * @brief Maps the extension segment of a class at its slot.
+ *
+ * @param ctx The channel context.
+ * @param cls The buffer class of the segment.
+ * @return 0 on success, -1 on failure.
+ */
+static int _machnet_segment_map(MachnetChannelCtx_t *ctx, uint32_t cls) {
+  // POSIX shared memory segments are named; others (backed by huge pages) are
+  // only reachable through the controller.
+  char name[MACHNET_CHANNEL_NAME_MAX_LEN + 16];
+  __machnet_channel_segment_name(ctx, cls, name, sizeof(name));
+  int segment_fd = shm_open(name, O_RDWR, 0);
+  if (segment_fd < 0) segment_fd = _machnet_segment_fd(ctx, cls);
+  if (segment_fd < 0) {
+    fprintf(stderr, "ERROR: Failed to get segment %u of channel %s.\n", cls,
+            ctx->name);
+    return -1;
+  }
+
+  int shm_flags = MAP_SHARED | MAP_POPULATE;
+  struct stat stat_buf;
+  if (fstat(segment_fd, &stat_buf) == 0 &&
+      stat_buf.st_blksize > getpagesize()) {
+    shm_flags |= MAP_HUGETLB;
+  }
+  const int ret =
+      __machnet_channel_segment_map(ctx, cls, shm_flags, segment_fd);
+  close(segment_fd);
+  if (ret != 0) perror("mmap()");
+  return ret;
+}
+
+/**
+ * @brief Acts upon (and acknowledges) the state changes of the extension
+ * segments of a channel. A segment that fails to map is left unacknowledged;
+ * Machnet reclaims it after a while.
+ *
+ * @param ctx The channel context.
+ */
+static void _machnet_segments_update(MachnetChannelCtx_t *ctx) {
+  const uint32_t segment_gen = ctx->ctrl_ctx.segment_gen;
+  __sync_synchronize();
+  for (uint32_t cls = ctx->data_ctx.buf_class_nr;
+       cls < MACHNET_CHANNEL_BUF_CLASS_MAX; cls++) {
+    MachnetChannelBufClass_t *buf_class = &ctx->data_ctx.buf_classes[cls];
+    const uint32_t state_gen = buf_class->state_gen;
+    if (state_gen == buf_class->app_state_gen) continue;
+    __sync_synchronize();
+    switch (buf_class->state) {
+      case MACHNET_CHANNEL_BUF_CLASS_MAPPING:
+        if (_machnet_segment_map(ctx, cls) != 0) continue;
+        break;
+      case MACHNET_CHANNEL_BUF_CLASS_DRAINING:
+        _machnet_buffer_caches_drain(ctx, cls);
+        break;
+      case MACHNET_CHANNEL_BUF_CLASS_UNMAPPING:
+        __machnet_channel_segment_unmap(ctx, cls);
+        break;
+      default:
+        break;
+    }
+    __sync_synchronize();
+    buf_class->app_state_gen = state_gen;
+  }
+  ctx->ctrl_ctx.app_segment_gen = segment_gen;
+}
+
+static void *_machnet_segments_thread(void *arg) {
+  (void)arg;
+  pthread_mutex_lock(&g_segments.lock);
+  while (1) {
+    while (g_segments.pending_nr == 0)
+      pthread_cond_wait(&g_segments.cond, &g_segments.lock);
+    MachnetChannelCtx_t *ctx = g_segments.pending[--g_segments.pending_nr];
+    g_segments.current = ctx;
+    pthread_mutex_unlock(&g_segments.lock);
+
+    _machnet_segments_update(ctx);
+
+    pthread_mutex_lock(&g_segments.lock);
+    g_segments.current = NULL;
+    pthread_cond_broadcast(&g_segments.cond);
+  }
+  return NULL;
+}
+
+/**
+ * @brief Hands a channel over to the segments thread (starting it if needed).
+ * Never blocks; if the thread is busy with the queue, the caller tries again
+ * on its next call.
+ *
+ * @param ctx The channel context.
+ */
+static void _machnet_segments_kick(MachnetChannelCtx_t *ctx) {
+  if (pthread_mutex_trylock(&g_segments.lock) != 0) return;
+  if (unlikely(!g_segments.started)) {
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, _machnet_segments_thread, NULL) != 0) {
+      fprintf(stderr, "ERROR: Failed to start the segments thread.\n");
+      pthread_mutex_unlock(&g_segments.lock);
+      return;
+    }
+    pthread_detach(thread);
+    g_segments.started = 1;
+  }
+
+  uint32_t i = 0;
+  while (i < g_segments.pending_nr && g_segments.pending[i] != ctx) i++;
+  if (i == g_segments.pending_nr &&
+      g_segments.pending_nr < MACHNET_SEGMENTS_PENDING_MAX) {
+    g_segments.pending[g_segments.pending_nr++] = ctx;
+    pthread_cond_broadcast(&g_segments.cond);
+  }
+  pthread_mutex_unlock(&g_segments.lock);
+}
+
+/**
+ * @brief Stops processing the extension segments of a channel that is going
+ * away; waits for the segments thread if it is busy with it.
+ *
+ * @param ctx The channel context.
+ */
+static void _machnet_segments_forget(const MachnetChannelCtx_t *ctx) {
+  pthread_mutex_lock(&g_segments.lock);
+  for (uint32_t i = 0; i < g_segments.pending_nr;) {
+    if (g_segments.pending[i] == ctx)
+      g_segments.pending[i] = g_segments.pending[--g_segments.pending_nr];
+    else
+      i++;
+  }
+  while (g_segments.current == ctx)
+    pthread_cond_wait(&g_segments.cond, &g_segments.lock);
+  pthread_mutex_unlock(&g_segments.lock);
+}
+
+/**
+ * @brief Checks the extension segment doorbell of a channel.
+ *
+ * @param ctx The channel context.
+ */
+static inline void _machnet_segments_poll(MachnetChannelCtx_t *ctx) {
+  if (likely(ctx->ctrl_ctx.app_segment_gen == ctx->ctrl_ctx.segment_gen))
+    return;
+  _machnet_segments_kick(ctx);
+}
+
+// A flow of the workload trace, and its requests awaiting a response.
+struct MachnetTraceFlow {
+  MachnetFlow_t flow;  // From the application's side (source is local).
+  uint32_t id;
+  int in_use;
+  int requests_outbound;  // Whether the application sends the requests.
+  uint32_t pending_head;
+  uint32_t pending_nr;
+  struct {
+    uint64_t timestamp_ns;
+    uint32_t size;
+  } pending[MACHNET_TRACE_PENDING_MAX];
+};
+
+// The workload trace being recorded, if any; protected by the lock.
+static struct {
+  FILE *file;
+  uint64_t start_ns;
+  uint32_t flows_nr;
+  uint64_t untracked_msgs;  // Messages of flows beyond the table.
+  struct MachnetTraceFlow *flows;
+  pthread_mutex_t lock;
+} g_trace = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+static uint64_t _machnet_trace_now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/**
+ * @brief Records the oldest pending request of a flow, with the size of its
+ * response (0 if none), and forgets about it. Must be called with the lock
+ * held.
+ */
+static void _machnet_trace_record(struct MachnetTraceFlow *trace_flow,
+                                  uint32_t resp_size) {
+  assert(trace_flow->pending_nr > 0);
+  const uint32_t head = trace_flow->pending_head;
+  MachnetTraceRecord_t record = {
+      .timestamp_ns = trace_flow->pending[head].timestamp_ns,
+      .flow_id = trace_flow->id,
+      .req_size = trace_flow->pending[head].size,
+      .resp_size = resp_size};
+  fwrite(&record, sizeof(record), 1, g_trace.file);
+  trace_flow->pending_head = (head + 1) % MACHNET_TRACE_PENDING_MAX;
+  trace_flow->pending_nr--;
+}
+
+/**
+ * @brief Looks up a flow of the trace, adding it if needed. Must be called
+ * with the lock held.
+ *
+ * @return The flow, or NULL if the table is full.
+ */
+static struct MachnetTraceFlow *_machnet_trace_flow(const MachnetFlow_t *flow,
+                                                    int requests_outbound) {
+  uint32_t hash = flow->src_ip * 0x9e3779b1u;
+  hash = (hash ^ flow->dst_ip) * 0x9e3779b1u;
+  hash = (hash ^ ((uint32_t)flow->src_port << 16 | flow->dst_port)) *
+         0x9e3779b1u;
+  for (uint32_t i = 0; i < MACHNET_TRACE_FLOWS_MAX; i++) {
+    struct MachnetTraceFlow *trace_flow =
+        &g_trace.flows[(hash + i) % MACHNET_TRACE_FLOWS_MAX];
+    if (!trace_flow->in_use) {
+      trace_flow->flow = *flow;
+      trace_flow->id = g_trace.flows_nr++;
+      trace_flow->in_use = 1;
+      trace_flow->requests_outbound = requests_outbound;
+      return trace_flow;
     }
+    if (memcmp(&trace_flow->flow, flow, sizeof(*flow)) == 0) return trace_flow;
+  }
+  return NULL;
+}
+
+/**
+ * @brief Records a message of the application in the trace, if any.
+ *
+ * @param flow The flow of the message, as the application sees it.
+ * @param size The size of the message; 0 for a flow being created with
+ * `machnet_connect()'.
+ * @param outbound Whether the application sends the message.
+ */
+static void _machnet_trace_msg(MachnetFlow_t flow, uint32_t size,
+                               int outbound) {
+  if (likely(__atomic_load_n(&g_trace.file, __ATOMIC_ACQUIRE) == NULL)) return;
+  const uint64_t now = _machnet_trace_now();
+
+  // Received messages carry the flow from the sender's side.
+  if (!outbound) {
+    flow = (MachnetFlow_t){.src_ip = flow.dst_ip,
+                           .dst_ip = flow.src_ip,
+                           .src_port = flow.dst_port,
+                           .dst_port = flow.src_port};
+  }
+
+  pthread_mutex_lock(&g_trace.lock);
+  if (g_trace.file == NULL) goto out;
+  // The first message of a flow, if not created by the application, is a
+  // request it receives.
+  struct MachnetTraceFlow *trace_flow = _machnet_trace_flow(&flow, outbound);
+  if (size == 0) goto out;
+  if (trace_flow == NULL) {
+    g_trace.untracked_msgs++;
+    goto out;
+  }
+
+  if (outbound == trace_flow->requests_outbound) {
+    // A request: it waits for its response.
+    if (trace_flow->pending_nr == MACHNET_TRACE_PENDING_MAX)
+      _machnet_trace_record(trace_flow, 0);
+    const uint32_t tail = (trace_flow->pending_head + trace_flow->pending_nr) %
+                          MACHNET_TRACE_PENDING_MAX;
+    trace_flow->pending[tail].timestamp_ns = now - g_trace.start_ns;
+    trace_flow->pending[tail].size = size;
+    trace_flow->pending_nr++;
+  } else if (trace_flow->pending_nr > 0) {
+    _machnet_trace_record(trace_flow, size);
+  }
+
+out:
+  pthread_mutex_unlock(&g_trace.lock);
+}
 
-    ctx->app_buffer_cache.indices[ctx->app_buffer_cache.count++] =
-        buffer_indices[index++];
+int machnet_trace_start(const char *path) {
+  int ret = -1;
+  pthread_mutex_lock(&g_trace.lock);
+  if (g_trace.file != NULL) goto out;
+
+  g_trace.flows = (struct MachnetTraceFlow *)calloc(MACHNET_TRACE_FLOWS_MAX,
+                                                    sizeof(*g_trace.flows));
+  if (g_trace.flows == NULL) goto out;
+  FILE *file = fopen(path, "wb");
+  if (file == NULL) {
+    free(g_trace.flows);
+    g_trace.flows = NULL;
+    goto out;
   }
+  const MachnetTraceHdr_t hdr = {.magic = MACHNET_TRACE_MAGIC,
+                                 .version = MACHNET_TRACE_VERSION};
+  fwrite(&hdr, sizeof(hdr), 1, file);
+  g_trace.flows_nr = 0;
+  g_trace.untracked_msgs = 0;
+  g_trace.start_ns = _machnet_trace_now();
+  __atomic_store_n(&g_trace.file, file, __ATOMIC_RELEASE);
+  ret = 0;
+
+out:
+  pthread_mutex_unlock(&g_trace.lock);
+  return ret;
+}
+
+void machnet_trace_stop(void) {
+  pthread_mutex_lock(&g_trace.lock);
+  if (g_trace.file == NULL) goto out;
+
+  for (uint32_t i = 0; i < MACHNET_TRACE_FLOWS_MAX; i++) {
+    struct MachnetTraceFlow *trace_flow = &g_trace.flows[i];
+    while (trace_flow->in_use && trace_flow->pending_nr > 0)
+      _machnet_trace_record(trace_flow, 0);
+  }
+  fclose(g_trace.file);
+  __atomic_store_n(&g_trace.file, NULL, __ATOMIC_RELEASE);
+  if (g_trace.untracked_msgs > 0) {
+    fprintf(stderr,
+            "WARNING: The trace is missing %" PRIu64
+            " messages of flows beyond the first %d.\n",
+            g_trace.untracked_msgs, MACHNET_TRACE_FLOWS_MAX);
+  }
+  free(g_trace.flows);
+  g_trace.flows = NULL;
+
+out:
+  pthread_mutex_unlock(&g_trace.lock);
 }
 
 int machnet_init() {
@@ -320,6 +1163,16 @@ int machnet_init() {
   // When this application quits, the controller will detect that the socket
   // was closed and de-register the application.
 
+  // Record a workload trace, if asked to.
+  const char *trace_path = getenv(MACHNET_TRACE_FILE_ENV);
+  if (resp.status == 0 && trace_path != NULL && *trace_path != '\0') {
+    if (machnet_trace_start(trace_path) == 0) {
+      atexit(machnet_trace_stop);
+    } else {
+      fprintf(stderr, "ERROR: Failed to record a trace to %s.\n", trace_path);
+    }
+  }
+
   return resp.status;
 }
 
@@ -347,8 +1200,9 @@ MachnetChannelCtx_t *machnet_bind(int shm_fd, size_t *channel_size) {
     /* TODO(ilias): Hack to detect if mapping is huge page backed. */
     shm_flags |= MAP_HUGETLB;
   }
-  channel = (MachnetChannelCtx_t *)mmap(
-      NULL, stat_buf.st_size, PROT_READ | PROT_WRITE, shm_flags, shm_fd, 0);
+  // The address space of the channel's extension segments is reserved along.
+  channel = (MachnetChannelCtx_t *)__machnet_channel_mmap(stat_buf.st_size,
+                                                          shm_flags, shm_fd);
   if (channel == MAP_FAILED) {
     perror("mmap()");
     goto fail;
@@ -369,10 +1223,19 @@ fail:
   return NULL;
 }
 
-void *machnet_attach() {
+void *machnet_attach() { return machnet_attach_ex(NULL); }
+
+void *machnet_attach_ex(const MachnetChannelOpts_t *opts) {
   uuid_t uuid;        // UUID for the shared memory channel.
   char uuid_str[37];  // 36 chars + null terminator for UUID string.
 
+  if (opts != NULL && (opts->flags & MACHNET_CHANNEL_OPTS_F_BUF_CLASSES) &&
+      opts->buf_class_nr > MACHNET_CHANNEL_OPTS_BUF_CLASS_MAX) {
+    fprintf(stderr, "ERROR: Too many buffer classes (%u).\n",
+            opts->buf_class_nr);
+    return NULL;
+  }
+
   uuid_generate(uuid);
   uuid_unparse(uuid, uuid_str);
 
@@ -382,9 +1245,8 @@ void *machnet_attach() {
   req.msg_id = msg_id_counter++;
   uuid_copy(req.app_uuid, g_app_uuid);
   uuid_copy(req.channel_info.channel_uuid, uuid);
-  /* Request the default. */
-  req.channel_info.desc_ring_size = MACHNET_CHANNEL_INFO_DESC_RING_SIZE_DEFAULT;
-  req.channel_info.buffer_count = MACHNET_CHANNEL_INFO_BUFFER_COUNT_DEFAULT;
+  // Zeroed options request the defaults.
+  if (opts != NULL) req.channel_info.opts = *opts;
 
   // Send the request to the Machnet control plane.
   int channel_fd;
@@ -460,6 +1322,8 @@ int machnet_connect(void *channel_ctx, const char *src_ip, const char *dst_ip,
   }
 
   *flow = resp.flow_info;
+  // The application sends the requests of the flows it creates.
+  _machnet_trace_msg(*flow, 0, 1);
 
   // Success.
   return 0;
@@ -523,6 +1387,7 @@ int machnet_send(const void *channel_ctx, MachnetFlow_t flow, const void *buf,
 
   struct MachnetMsgHdr msghdr;
   msghdr.flags = 0;
+  msghdr.cookie = 0;
   msghdr.msg_size = len;
   msghdr.flow_info = flow;
   msghdr.msg_iov = &iov;
@@ -539,21 +1404,22 @@ int machnet_sendmsg(const void *channel_ctx, const MachnetMsgHdr_t *msghdr) {
   // Sanity checks on the full message size.
   if (unlikely(msghdr->msg_size > MACHNET_MSG_MAX_LEN || msghdr->msg_size == 0))
     return -1;
+  _machnet_segments_poll(ctx);
 
-  // Get the maximum payload size of a message buffer.
-  // This is dictated by the stack, during the channel creation.
-  const uint32_t kMsgBufPayloadMax = ctx->data_ctx.buf_mss;
-
-  // Calculate how many buffers we need to hold the message, and bulk allocate
-  // them.
-  const uint32_t buffers_nr =
-      (msghdr->msg_size + kMsgBufPayloadMax - 1) / kMsgBufPayloadMax;
-  MachnetRingSlot_t *buf_index_table = _machnet_buffers_alloc(ctx, buffers_nr);
+  // Allocate the buffers to hold the message, picking among the buffer classes
+  // of the channel.
+  uint32_t buffers_nr;
+  MachnetRingSlot_t *buf_index_table =
+      _machnet_msg_buffers_alloc(ctx, msghdr->msg_size, &buffers_nr);
   if (buf_index_table == NULL) {
     // We failed to allocate the buffers.
     return -1;
   }
 
+  // Large messages are copied with non-temporal stores, to avoid thrashing the
+  // caches.
+  const int use_nt = __machnet_copy_use_nt(msghdr->msg_size);
+
   // Gather all message segments.
   uint32_t buffer_cur_index = 0;
   uint32_t total_bytes_copied = 0;
@@ -577,7 +1443,7 @@ int machnet_sendmsg(const void *channel_ctx, const MachnetMsgHdr_t *msghdr) {
       uint32_t nbytes_to_copy =
           MIN(seg_bytes, __machnet_channel_buf_tailroom(buffer));
       uchar_t *buf_data = __machnet_channel_buf_append(buffer, nbytes_to_copy);
-      memcpy(buf_data, seg_data, nbytes_to_copy);
+      __machnet_copy(buf_data, seg_data, nbytes_to_copy, use_nt);
       buffer->flags |= MACHNET_MSGBUF_FLAGS_SG;
 
       seg_data += nbytes_to_copy;
@@ -611,15 +1477,19 @@ int machnet_sendmsg(const void *channel_ctx, const MachnetMsgHdr_t *msghdr) {
   MachnetMsgBuf_t *first = __machnet_channel_buf(ctx, buf_index_table[0]);
   first->flags |= MACHNET_MSGBUF_FLAGS_SYN;
   first->flags |= (msghdr->flags & MACHNET_MSGBUF_NOTIFY_DELIVERY);
+  if (first->flags & MACHNET_MSGBUF_NOTIFY_DELIVERY)
+    first->cookie = msghdr->cookie;
   first->flow = msghdr->flow_info;
   first->msg_len = msghdr->msg_size;
   first->last = buf_index_table[buffers_nr - 1];  // Link to the last buffer.
 
   // Finally, send the message.
   // TODO(ilias): Add retries if the ring is full, and add statistics.
+  __machnet_copy_fence(use_nt);
   if (__machnet_channel_app_ring_enqueue(ctx, 1, buf_index_table) != 1) {
     return -1;
   }
+  _machnet_trace_msg(msghdr->flow_info, msghdr->msg_size, 1);
 
   return 0;
 }
@@ -658,6 +1528,7 @@ int machnet_recvmsg(const void *channel_ctx, MachnetMsgHdr_t *msghdr) {
   assert(channel_ctx != NULL);
   assert(msghdr != NULL);
   MachnetChannelCtx_t *ctx = (MachnetChannelCtx_t *)channel_ctx;
+  _machnet_segments_poll(ctx);
 
   const uint32_t kBufferBatchSize = 16;
 
@@ -669,6 +1540,7 @@ int machnet_recvmsg(const void *channel_ctx, MachnetMsgHdr_t *msghdr) {
   MachnetMsgBuf_t *buffer;
   buffer = __machnet_channel_buf(ctx, buffer_index);
   MachnetFlow_t flow_info = buffer->flow;
+  const int use_nt = __machnet_copy_use_nt(buffer->msg_len);
   uint32_t buf_data_ofs = 0;
   size_t iov_index = 0;
   uint32_t seg_data_ofs = 0;
@@ -709,7 +1581,7 @@ int machnet_recvmsg(const void *channel_ctx, MachnetMsgHdr_t *msghdr) {
     uint32_t remaining_space_in_seg = seg_len - seg_data_ofs;
     uint32_t nbytes_to_copy =
         MIN(remaining_space_in_seg, remaining_bytes_in_buf);
-    memcpy(seg_data, buf_data, nbytes_to_copy);
+    __machnet_copy(seg_data, buf_data, nbytes_to_copy, use_nt);
     buf_data_ofs += nbytes_to_copy;
     seg_data_ofs += nbytes_to_copy;
     total_bytes_copied += nbytes_to_copy;
@@ -748,6 +1620,8 @@ int machnet_recvmsg(const void *channel_ctx, MachnetMsgHdr_t *msghdr) {
 
   // Free up any remaining buffers.
   _machnet_buffers_release(ctx, buffer_indices_index, buffer_indices);
+  __machnet_copy_fence(use_nt);
+  _machnet_trace_msg(flow_info, total_bytes_copied, 0);
 
   // Success.
   return 1;
@@ -770,4 +1644,228 @@ fail:
   return -1;
 }
 
-void machnet_detach(const MachnetChannelCtx_t *ctx) {}
+ssize_t machnet_peek(const void *channel_ctx, MachnetFlow_t *flow) {
+  assert(channel_ctx != NULL);
+  MachnetChannelCtx_t *ctx = (MachnetChannelCtx_t *)channel_ctx;
+
+  MachnetRingSlot_t buffer_index;
+  if (__machnet_channel_machnet_ring_peek(ctx, &buffer_index) != 1)
+    return 0;  // No message available.
+
+  const MachnetMsgBuf_t *buffer = __machnet_channel_buf(ctx, buffer_index);
+  if (flow != NULL) *flow = buffer->flow;
+  return buffer->msg_len;
+}
+
+int machnet_recvmsg_zc(const void *channel_ctx, MachnetMsgHdr_t *msghdr,
+                       MachnetMsgHandle_t *handle) {
+  assert(channel_ctx != NULL);
+  assert(msghdr != NULL);
+  assert(handle != NULL);
+  MachnetChannelCtx_t *ctx = (MachnetChannelCtx_t *)channel_ctx;
+  _machnet_segments_poll(ctx);
+
+  // Peek at the head of the ring; the message is only consumed once we know
+  // that the application provided enough segment descriptors.
+  MachnetRingSlot_t head_index;
+  if (__machnet_channel_machnet_ring_peek(ctx, &head_index) != 1)
+    return 0;  // No message available.
+
+  MachnetMsgBuf_t *buffer = __machnet_channel_buf(ctx, head_index);
+  const uint32_t msg_size = buffer->msg_len;
+  const MachnetFlow_t flow_info = buffer->flow;
+
+  // Walk the buffer chain, and describe each buffer's data in the iovec.
+  size_t iov_index = 0;
+  uint32_t total_bytes = 0;
+  while (buffer != NULL) {
+    if (unlikely(buffer->magic != MACHNET_MSGBUF_MAGIC)) abort();
+    const uint32_t data_len = __machnet_channel_buf_data_len(buffer);
+    if (likely(iov_index < msghdr->msg_iovlen)) {
+      assert(msghdr->msg_iov != NULL);
+      msghdr->msg_iov[iov_index].base = __machnet_channel_buf_data(buffer);
+      msghdr->msg_iov[iov_index].len = data_len;
+    }
+    iov_index++;
+    total_bytes += data_len;
+
+    if (buffer->flags & MACHNET_MSGBUF_FLAGS_SG) {
+      buffer = __machnet_channel_buf(ctx, buffer->next);
+    } else {
+      buffer = NULL;
+    }
+  }
+
+  if (unlikely(iov_index > msghdr->msg_iovlen)) {
+    // Not enough segment descriptors; report how many are needed and leave the
+    // message in the ring.
+    msghdr->msg_iovlen = iov_index;
+    return -1;
+  }
+
+  assert(total_bytes == msg_size);
+  if (unlikely(total_bytes != msg_size)) abort();
+
+  // Now consume the message. The application is the only consumer of the ring,
+  // so the head cannot have changed since we peeked at it.
+  MachnetRingSlot_t buffer_index;
+  if (unlikely(__machnet_channel_machnet_ring_dequeue(ctx, 1, &buffer_index) !=
+                   1 ||
+               buffer_index != head_index)) {
+    abort();
+  }
+
+  msghdr->msg_size = msg_size;
+  msghdr->flow_info = flow_info;
+  msghdr->msg_iovlen = iov_index;
+  *handle = head_index;
+  _machnet_trace_msg(flow_info, msg_size, 0);
+
+  return 1;
+}
+
+int machnet_release(const void *channel_ctx, MachnetMsgHandle_t handle) {
+  assert(channel_ctx != NULL);
+  MachnetChannelCtx_t *ctx = (MachnetChannelCtx_t *)channel_ctx;
+
+  if (unlikely(!__machnet_channel_buf_valid(ctx, handle))) return -1;
+
+  const uint32_t kBufferBatchSize = 16;
+  MachnetRingSlot_t buffer_indices[kBufferBatchSize];
+  uint32_t buffer_indices_index = 0;
+
+  MachnetRingSlot_t buffer_index = handle;
+  MachnetMsgBuf_t *buffer = __machnet_channel_buf(ctx, buffer_index);
+  if (unlikely(buffer->magic != MACHNET_MSGBUF_MAGIC)) return -1;
+
+  while (buffer != NULL) {
+    buffer_indices[buffer_indices_index++] = buffer_index;
+    if (buffer->flags & MACHNET_MSGBUF_FLAGS_SG) {
+      buffer_index = buffer->next;
+      buffer = __machnet_channel_buf(ctx, buffer_index);
+    } else {
+      buffer = NULL;
+    }
+    if (buffer == NULL || buffer_indices_index == kBufferBatchSize) {
+      _machnet_buffers_release(ctx, buffer_indices_index, buffer_indices);
+      buffer_indices_index = 0;
+    }
+  }
+
+  return 0;
+}
+
+int machnet_msg_alloc(const void *channel_ctx, MachnetMsgHdr_t *msghdr,
+                      MachnetMsgHandle_t *handle) {
+  assert(channel_ctx != NULL);
+  assert(msghdr != NULL);
+  assert(handle != NULL);
+  MachnetChannelCtx_t *ctx = (MachnetChannelCtx_t *)channel_ctx;
+
+  // Sanity checks on the full message size.
+  if (unlikely(msghdr->msg_size > MACHNET_MSG_MAX_LEN || msghdr->msg_size == 0))
+    return -1;
+  _machnet_segments_poll(ctx);
+
+  uint32_t buffers_nr;
+  MachnetRingSlot_t *buf_index_table =
+      _machnet_msg_buffers_alloc(ctx, msghdr->msg_size, &buffers_nr);
+  if (buf_index_table == NULL) {
+    // We failed to allocate the buffers.
+    return -1;
+  }
+
+  if (unlikely(buffers_nr > msghdr->msg_iovlen)) {
+    // Not enough segment descriptors; report how many are needed.
+    _machnet_buffers_release(ctx, buffers_nr, buf_index_table);
+    msghdr->msg_iovlen = buffers_nr;
+    return -1;
+  }
+
+  // Chain the buffers together, and expose each one's payload area.
+  assert(msghdr->msg_iov != NULL);
+  uint32_t remaining_bytes = msghdr->msg_size;
+  for (uint32_t i = 0; i < buffers_nr; i++) {
+    MachnetMsgBuf_t *buffer = __machnet_channel_buf(ctx, buf_index_table[i]);
+    if (unlikely(buffer->magic != MACHNET_MSGBUF_MAGIC)) abort();
+    __machnet_channel_buf_init(buffer);
+
+    const uint32_t nbytes =
+        MIN(remaining_bytes, __machnet_channel_buf_tailroom(buffer));
+    msghdr->msg_iov[i].base = __machnet_channel_buf_append(buffer, nbytes);
+    msghdr->msg_iov[i].len = nbytes;
+    remaining_bytes -= nbytes;
+
+    if (i + 1 < buffers_nr) {
+      buffer->flags |= MACHNET_MSGBUF_FLAGS_SG;
+      buffer->next = buf_index_table[i + 1];
+    }
+  }
+  assert(remaining_bytes == 0);
+
+  MachnetMsgBuf_t *first = __machnet_channel_buf(ctx, buf_index_table[0]);
+  first->msg_len = msghdr->msg_size;
+  first->last = buf_index_table[buffers_nr - 1];
+  first->flags |= (msghdr->flags & MACHNET_MSGBUF_NOTIFY_DELIVERY);
+  if (first->flags & MACHNET_MSGBUF_NOTIFY_DELIVERY)
+    first->cookie = msghdr->cookie;
+
+  msghdr->msg_iovlen = buffers_nr;
+  *handle = buf_index_table[0];
+
+  return 0;
+}
+
+int machnet_msg_submit(const void *channel_ctx, MachnetFlow_t flow,
+                       MachnetMsgHandle_t handle) {
+  assert(channel_ctx != NULL);
+  MachnetChannelCtx_t *ctx = (MachnetChannelCtx_t *)channel_ctx;
+
+  if (unlikely(!__machnet_channel_buf_valid(ctx, handle))) return -1;
+
+  MachnetMsgBuf_t *first = __machnet_channel_buf(ctx, handle);
+  if (unlikely(first->magic != MACHNET_MSGBUF_MAGIC)) return -1;
+  if (unlikely(first->msg_len == 0 ||
+               !__machnet_channel_buf_valid(ctx, first->last)))
+    return -1;
+
+  // Mark the head and the tail of the message; intermediate buffers carry the
+  // SG flag since allocation.
+  MachnetMsgBuf_t *last = __machnet_channel_buf(ctx, first->last);
+  last->flags |= MACHNET_MSGBUF_FLAGS_FIN;
+  last->flags &= ~(MACHNET_MSGBUF_FLAGS_SG);
+  first->flags |= MACHNET_MSGBUF_FLAGS_SYN;
+  first->flow = flow;
+
+  // The message belongs to Machnet once enqueued.
+  const uint32_t msg_size = first->msg_len;
+  MachnetRingSlot_t buffer_index = handle;
+  if (__machnet_channel_app_ring_enqueue(ctx, 1, &buffer_index) != 1) {
+    // Undo the marking so that the message can be resubmitted or released.
+    first->flags &= ~(MACHNET_MSGBUF_FLAGS_SYN);
+    last->flags &= ~(MACHNET_MSGBUF_FLAGS_FIN);
+    return -1;
+  }
+  _machnet_trace_msg(flow, msg_size, 1);
+
+  return 0;
+}
+
+int machnet_poll_completions(const void *channel_ctx,
+                             MachnetTxCompletion_t *completions, int n) {
+  assert(channel_ctx != NULL);
+  assert(completions != NULL);
+  MachnetChannelCtx_t *ctx = (MachnetChannelCtx_t *)channel_ctx;
+
+  if (unlikely(n <= 0)) return 0;
+  return __machnet_channel_completion_ring_dequeue(ctx, n, completions);
+}
+
+void machnet_detach(const void *channel_ctx) {
+  assert(channel_ctx != NULL);
+  const MachnetChannelCtx_t *ctx = (const MachnetChannelCtx_t *)channel_ctx;
+  if (unlikely(ctx->magic != MACHNET_CHANNEL_CTX_MAGIC)) abort();
+
+  _machnet_segments_forget(ctx);
+  _machnet_buffer_caches_flush_all(ctx);
+}
@@ -39,6 +39,8 @@ typedef struct MachnetIovec MachnetIovec_t;
  * - `msg_iov` is a vector of `msg_iovlen` `MachnetIovec_t` structures.
  * - `msg_iovlen` is the number of `MachnetIovec_t` structures in `msg_iov`.
  * - `flags` is the message flags.
+ * - `cookie` is an opaque value that is returned in the TX completion of the
+ *    message, if `MACHNET_MSGBUF_NOTIFY_DELIVERY` is set in `flags` (TX only).
  */
 struct MachnetMsgHdr {
   uint32_t msg_size;
@@ -46,9 +48,19 @@ struct MachnetMsgHdr {
   MachnetIovec_t *msg_iov;
   size_t msg_iovlen;
   uint16_t flags;
+  uint64_t cookie;
 };
 typedef struct MachnetMsgHdr MachnetMsgHdr_t;
 
+/**
+ * @brief Handle to a message received in zero-copy mode (see
+ * `machnet_recvmsg_zc()`).
+ *
+ * The buffers backing the message are lent to the application until the handle
+ * is returned to Machnet with `machnet_release()`.
+ */
+typedef uint32_t MachnetMsgHandle_t;
+
 /// @brief Persistent connection between the application and the Machnet
 /// controller.
 extern int g_ctrl_socket;
@@ -85,6 +97,29 @@ MachnetChannelCtx_t *machnet_bind(int shm_fd, size_t *channel_size);
  */
 void *machnet_attach();
 
+/**
+ * @brief Like `machnet_attach()', but with the channel sized as requested by
+ * the application: the depth of the messaging rings, the number of buffers and
+ * the buffer size classes (see `MachnetChannelOpts_t'). Bigger channels allow
+ * more messages in flight, at the cost of memory. Machnet refuses a channel
+ * that exceeds its per-host limits.
+ *
+ * @param opts The sizing options of the channel; zero fields (or `NULL')
+ * select the defaults.
+ * @return A pointer to the channel context on success, NULL otherwise.
+ */
+void *machnet_attach_ex(const MachnetChannelOpts_t *opts);
+
+/**
+ * @brief Detaches from a channel. The buffers cached by the application's
+ * threads for this channel are returned to the channel's pool. This must be
+ * called when no other thread is using the channel, and before the channel is
+ * unmapped.
+ *
+ * @param channel_ctx The channel context.
+ */
+void machnet_detach(const void *channel_ctx);
+
 /**
  * @brief Listens for incoming messages on a specific IP and port.
  * @param[in] channel The channel associated to the listener.
@@ -128,6 +163,10 @@ int machnet_send(const void *channel_ctx, MachnetFlow_t flow, const void *buf,
  * SG collection of a message's buffers from the application's address
  * space.
  *
+ * If `MACHNET_MSGBUF_NOTIFY_DELIVERY` is set in the msghdr flags, Machnet posts
+ * a TX completion carrying the msghdr `cookie` once the remote peer has
+ * acknowledged the whole message (see `machnet_poll_completions()`).
+ *
  * @param[in] channel_ctx        The Machnet channel context
  * @param[in] msghdr             An `MachnetMsgHdr' descriptor
  * @return                   0 on success, -1 on failure
@@ -184,6 +223,104 @@ ssize_t machnet_recv(const void *channel_ctx, void *buf, size_t len,
  */
 int machnet_recvmsg(const void *channel_ctx, MachnetMsgHdr_t *msghdr);
 
+/**
+ * This function returns the size of the next pending message (destined to the
+ * application) without consuming it from the Machnet Channel.
+ *
+ * @param[in] channel_ctx        The Machnet channel context
+ * @param[out] flow              If not `NULL', it is filled with the flow
+ *                               information of the pending message.
+ * @return                       0 if no pending message, otherwise the size of
+ *                               the pending message in bytes.
+ */
+ssize_t machnet_peek(const void *channel_ctx, MachnetFlow_t *flow);
+
+/**
+ * This function receives a pending message (destined to the application) from
+ * the Machnet Channel without copying its payload. Instead of copying, the
+ * `msg_iov` entries of the msghdr are set to point to the data of the channel
+ * buffers that hold the message, in order. The buffers remain owned by the
+ * application until `machnet_release()` is called with the returned handle;
+ * the data must not be accessed after that.
+ *
+ * @param[in] channel_ctx        The Machnet channel context
+ * @param[in, out] msghdr        An `MachnetMsgHdr' descriptor. The application
+ *                               provides an array of `msg_iovlen` entries in
+ *                               `msg_iov`. On success, `msg_iovlen` is set to
+ *                               the number of entries used, and `msg_size` and
+ *                               `flow_info` describe the message. If the array
+ *                               is too small, `msg_iovlen` is set to the number
+ *                               of entries required, and the message is left
+ *                               pending.
+ * @param[out] handle            The handle of the received message.
+ * @return                       0 if no pending message, 1 if a message is
+ *                               received, -1 on failure
+ */
+int machnet_recvmsg_zc(const void *channel_ctx, MachnetMsgHdr_t *msghdr,
+                       MachnetMsgHandle_t *handle);
+
+/**
+ * This function returns the buffers of a message that was received with
+ * `machnet_recvmsg_zc()`, or allocated with `machnet_msg_alloc()` and not
+ * submitted, back to the Machnet Channel.
+ *
+ * @param[in] channel_ctx        The Machnet channel context
+ * @param[in] handle             The handle of the received message.
+ * @return                       0 on success, -1 on failure
+ */
+int machnet_release(const void *channel_ctx, MachnetMsgHandle_t handle);
+
+/**
+ * This function allocates a message of `msg_size` bytes directly in the
+ * Machnet Channel, so that the application can build its payload in place
+ * (zero-copy send). The message is backed by a train of chained channel
+ * buffers; the `msg_iov` entries of the msghdr are set to the writable spans
+ * of these buffers, in order. Once the payload is written, the message is
+ * transmitted with `machnet_msg_submit()`, or discarded with
+ * `machnet_release()`.
+ *
+ * @param[in] channel_ctx        The Machnet channel context
+ * @param[in, out] msghdr        An `MachnetMsgHdr' descriptor. The application
+ *                               sets `msg_size`, `flags` and `cookie` (see
+ *                               `machnet_sendmsg()`), and provides an array of
+ *                               `msg_iovlen` entries in `msg_iov`. On success,
+ *                               `msg_iovlen` is set to the number of entries
+ *                               used. If the array is too small, `msg_iovlen`
+ *                               is set to the number of entries required.
+ * @param[out] handle            The handle of the allocated message.
+ * @return                       0 on success, -1 on failure
+ */
+int machnet_msg_alloc(const void *channel_ctx, MachnetMsgHdr_t *msghdr,
+                      MachnetMsgHandle_t *handle);
+
+/**
+ * This function enqueues a message that was allocated with
+ * `machnet_msg_alloc()` for transmission to a remote peer over the network.
+ * On success, ownership of the message is transferred to Machnet.
+ *
+ * @param[in] channel_ctx        The Machnet channel context
+ * @param[in] flow               The pre-created flow to the remote peer
+ * @param[in] handle             The handle of the allocated message.
+ * @return                       0 on success, -1 on failure (the application
+ *                               still owns the message)
+ */
+int machnet_msg_submit(const void *channel_ctx, MachnetFlow_t flow,
+                       MachnetMsgHandle_t handle);
+
+/**
+ * This function retrieves TX completions from the Machnet Channel. A completion
+ * is posted for every message that was sent with the
+ * `MACHNET_MSGBUF_NOTIFY_DELIVERY` flag, once the remote peer has acknowledged
+ * all of its packets.
+ *
+ * @param[in] channel_ctx        The Machnet channel context
+ * @param[out] completions       An array that can hold up to `n` completions.
+ * @param[in] n                  The size of the `completions` array.
+ * @return                       # of completions retrieved.
+ */
+int machnet_poll_completions(const void *channel_ctx,
+                             MachnetTxCompletion_t *completions, int n);
+
 #ifdef __cplusplus
 }
 #endif
@@ -1,5 +1,6 @@
 #include <benchmark/benchmark.h>
 #include <machnet.h>
+#include <machnet_copy.h>
 #include <machnet_private.h>
 #include <utils.h>
 
@@ -76,6 +77,76 @@ BENCHMARK(BM_memcpy_llc_thrash)
     ->RangeMultiplier(2)
     ->Range(8, MACHNET_MSG_MAX_LEN);
 
+// Arguments: {copy kernel, non-temporal stores, copy size}.
+static void CopyKernelArguments(benchmark::internal::Benchmark *b) {
+  for (int kernel = 0; kernel < MACHNET_COPY_KERNEL_NR; kernel++) {
+    for (int nt = 0; nt <= 1; nt++) {
+      for (int64_t sz = 64; sz <= MACHNET_MSG_MAX_LEN; sz *= 4)
+        b->Args({kernel, nt, sz});
+    }
+  }
+  b->ArgNames({"kernel", "nt", "size"});
+}
+
+// Returns the copy kernel selected by the benchmark arguments, or `nullptr' if
+// it cannot run on this machine.
+static machnet_copy_fn_t GetCopyKernel(benchmark::State &state) {  // NOLINT
+  const auto kernel = static_cast<machnet_copy_kernel>(state.range(0));
+  if (!__machnet_copy_kernel_supported(kernel)) return nullptr;
+  state.SetLabel(__machnet_copy_kernel_name(kernel));
+  return __machnet_copy_kernel_fn(kernel, state.range(1));
+}
+
+// Copies between cache-resident buffers.
+static void BM_copy_kernel(benchmark::State &state) {  // NOLINT
+  const machnet_copy_fn_t copy = GetCopyKernel(state);
+  if (copy == nullptr) {
+    state.SkipWithError("Copy kernel not supported.");
+    return;
+  }
+
+  const size_t kCopySize = state.range(2);
+  std::vector<char> src(kCopySize, 'a');
+  std::vector<char> dst(kCopySize, 'b');
+  for (auto _ : state) {
+    copy(dst.data(), src.data(), kCopySize);
+    benchmark::ClobberMemory();
+  }
+  __machnet_copy_fence(state.range(1));
+
+  auto bytes_cnt = state.iterations() * kCopySize;
+  state.counters["bps"] =
+      benchmark::Counter(bytes_cnt * 8, benchmark::Counter::kIsRate);
+}
+BENCHMARK(BM_copy_kernel)->Apply(CopyKernelArguments);
+
+// Streams through a region much larger than the LLC, which is the case where
+// non-temporal stores are expected to pay off.
+static void BM_copy_kernel_stream(benchmark::State &state) {  // NOLINT
+  const machnet_copy_fn_t copy = GetCopyKernel(state);
+  if (copy == nullptr) {
+    state.SkipWithError("Copy kernel not supported.");
+    return;
+  }
+
+  const size_t kRegionSize = 1 << 28;
+  const size_t kCopySize = state.range(2);
+  const size_t kBlocksNr = kRegionSize / kCopySize;
+  std::vector<char> src(kRegionSize, 'a');
+  std::vector<char> dst(kRegionSize, 'b');
+  size_t block = 0;
+  for (auto _ : state) {
+    copy(&dst[block * kCopySize], &src[block * kCopySize], kCopySize);
+    if (++block == kBlocksNr) block = 0;
+  }
+  __machnet_copy_fence(state.range(1));
+
+  auto bytes_cnt = state.iterations() * kCopySize;
+  state.counters["bps"] =
+      benchmark::Counter(bytes_cnt * 8, benchmark::Counter::kIsRate);
+}
+BENCHMARK(BM_copy_kernel_stream)->Apply(CopyKernelArguments);
+
 static void BM_machnet_sendmsg(benchmark::State &state) {  // NOLINT
   // Create and initialize the channel.
   size_t channel_size;
@@ -117,6 +188,9 @@ static void BM_machnet_sendmsg(benchmark::State &state) {  // NOLINT
                                                 slots.data()),
              msg_pending);
 
+    // Return the buffers cached by this thread to the pool.
+    machnet_detach(channel_ctx);
+
     // Next reset the buffer pool.
     // The Machnet channel initialized the buffer pool with buffer
     // indexes from [0, capacity]. Since there is no API to perform this
@@ -145,6 +219,7 @@ static void BM_machnet_sendmsg(benchmark::State &state) {  // NOLINT
   }
 
   // Destroy the channel.
+  machnet_detach(channel_ctx);
   __machnet_channel_destroy(channel_ctx, channel_size, &channel_fd,
                             is_posix_shm, channel_name);
 
@@ -21,13 +21,14 @@ extern "C" {
  *     [ControlRing: CompletionQueue]
  *     [Ring0: Stack->Application]
  *     [Ring1: Application->Stack]
- *     [Ring2: FreeBuffers]
- *     [BufferIndexTable]
+ *     [Ring: TxCompletions]
+ *     [Ring2: FreeBuffers (class 0)]
+ *     [...]
+ *     [Ring2: FreeBuffers (class K)]
  *     [HUGE_PAGE_2M_SIZE aligned]
- *     [Buf#0]
- *     [Buf#1]
+ *     [Class 0: Buf#0 ... Buf#N]
  *     [...]
- *     [Buf#N]
+ *     [Class K: Buf#0 ... Buf#M]
  *
  *     ControlRing(SQ) is used for communicating control messages from the
  *     application to the stack; completions are emitted by the stack in the
@@ -36,16 +37,39 @@ extern "C" {
  *
  *     Ring0 is used for communicating received messages from the stack to the
  *     application, and Ring1 for the opposite direction.
- *     Ring2 serves as the global pool of buffers.
+ *     Ring2 serves as the global pool of buffers. Application threads keep
+ *     small private caches of buffer indices on top of it (see machnet.c), so
+ *     no application state lives in the shared memory region.
+ *
+ *     Buffers come in up to `MACHNET_CHANNEL_BUF_CLASS_MAX' size classes, each
+ *     with its own free ring and pool. Class 0 is the default class: its
+ *     buffers hold exactly one packet's worth of payload, and it is the class
+ *     Machnet allocates from on the receive path. Larger classes let the
+ *     application send big messages with few buffers (Machnet segments them
+ *     into packets), and smaller classes avoid wasting memory on small
+ *     messages. The class of a buffer is encoded in the top bits of its index
+ *     (see `MACHNET_MSGBUF_CLASS_SHIFT').
  *
- *     [BufferIndexTable] is a table of `MachnetRingSlot`-wide objects to be
- *     used as a temporary/scratch space for the application to allocate
- * (dequeue) buffers. It is used to avoid the need for the application to
- * allocate such table on each `send` request.
+ *     [HUGE_PAGE_2M_SIZE aligned]
+ *     [Segment slot 0: Pool | Ring]
+ *     [...]
+ *     [Segment slot MACHNET_CHANNEL_BUF_CLASS_MAX - 1: Pool | Ring]
+ *
+ *     The class slots that are not used at creation time can be backed later
+ *     by extension segments: separate shared memory segments that Machnet
+ *     creates when a class runs low on buffers, and destroys once they are
+ *     idle. Each one holds the pool and free ring of a new class that extends
+ *     (`parent') one of the original classes. Both sides reserve the address
+ *     space of all segment slots right after the channel, so a segment maps at
+ *     the same offset from the channel context in every process and the
+ *     channel's offsets keep working. Machnet rings the `segment_gen' doorbell
+ *     in the control context whenever the application must act on a change of
+ *     a segment's state (see `MachnetChannelBufClass::state').
  */
 
 #include <assert.h>
 #include <fcntl.h> /* For O_* constants */
+#include <stdio.h>
 #include <sys/mman.h>
 #include <sys/stat.h> /* For mode constants */
 
@@ -93,38 +117,114 @@ struct MachnetListenerInfo {
 };
 typedef struct MachnetListenerInfo MachnetListenerInfo_t;
 
+/**
+ * Configuration of a buffer size class, used when creating a channel.
+ */
+struct MachnetChannelBufClassConf {
+  size_t buf_ring_slot_nr;  // Number of buffers + 1 (must be power of 2).
+  size_t buffer_size;       // Usable (payload) size of each buffer.
+};
+typedef struct MachnetChannelBufClassConf MachnetChannelBufClassConf_t;
+
+/**
+ * Sizing options of a channel, requested by the application when attaching
+ * (see `machnet_attach_ex()'). A zero field selects Machnet's default. Machnet
+ * validates the options against its per-host limits, and refuses the channel
+ * if they are exceeded.
+ */
+struct MachnetChannelOpts {
+  uint32_t machnet_ring_slot_nr;  // Machnet->App ring slots (power of 2).
+  uint32_t app_ring_slot_nr;      // App->Machnet ring slots (power of 2).
+  // Number of buffers + 1 of the default (packet-sized) class (power of 2).
+  uint32_t buf_ring_slot_nr;
+#define MACHNET_CHANNEL_OPTS_F_BUF_CLASSES 0x1
+#define MACHNET_CHANNEL_OPTS_F_NUMA_NODE 0x2
+  // If `MACHNET_CHANNEL_OPTS_F_BUF_CLASSES' is set, `buf_classes' holds the
+  // size classes of the channel besides the default one (possibly none).
+  // Otherwise, Machnet's default classes are used.
+  uint32_t flags;
+#define MACHNET_CHANNEL_OPTS_BUF_CLASS_MAX 4
+  uint32_t buf_class_nr;
+  MachnetChannelBufClassConf_t buf_classes[MACHNET_CHANNEL_OPTS_BUF_CLASS_MAX];
+  // If `MACHNET_CHANNEL_OPTS_F_NUMA_NODE' is set, the channel's memory is
+  // placed on this NUMA node (e.g., the application's). Otherwise, it is placed
+  // on the node of the engine that serves the channel.
+  uint32_t numa_node;
+};
+typedef struct MachnetChannelOpts MachnetChannelOpts_t;
+
+/**
+ * A buffer size class of a channel: a free ring and the pool of buffers it
+ * manages.
+ *
+ * Classes created with the channel are always `ACTIVE'. The lifecycle of a
+ * class backed by an extension segment is driven by Machnet, and the
+ * application acknowledges every state change: Machnet bumps `state_gen' along
+ * with `state', and the application copies it to `app_state_gen' once it has
+ * done what the state asks for.
+ *   FREE -> MAPPING:      Machnet created the segment; the application must
+ *                         map it.
+ *   MAPPING -> ACTIVE:    Both sides have the segment mapped.
+ *   ACTIVE -> DRAINING:   The segment is idle; the application must stop
+ *                         allocating from it, and give back the buffers of it
+ *                         that it caches.
+ *   DRAINING -> ACTIVE:   The segment is needed again.
+ *   DRAINING -> UNMAPPING: Neither side allocates from the segment, and all of
+ *                         its buffers are back; the application must unmap it.
+ *   UNMAPPING -> FREE:    Machnet destroyed the segment.
+ */
+struct MachnetChannelBufClass {
+  size_t buf_ring_ofs;
+  size_t buf_pool_ofs;
+  size_t segment_size;  // Size of the extension segment (0 if none).
+  uint32_t buf_nr;      // Number of buffers in the pool.
+  uint32_t buf_size;    // Total size of each buffer (incl. metadata).
+  uint32_t buf_mss;     // Usable size of each buffer.
+  uint32_t parent;      // The class this one extends (itself if original).
+#define MACHNET_CHANNEL_BUF_CLASS_FREE 0
+#define MACHNET_CHANNEL_BUF_CLASS_MAPPING 1
+#define MACHNET_CHANNEL_BUF_CLASS_ACTIVE 2
+#define MACHNET_CHANNEL_BUF_CLASS_DRAINING 3
+#define MACHNET_CHANNEL_BUF_CLASS_UNMAPPING 4
+  volatile uint32_t state;      // Written by Machnet only.
+  volatile uint32_t state_gen;  // Written by Machnet only.
+  // The last `state_gen' the application has acknowledged.
+  volatile uint32_t app_state_gen;
+};
+typedef struct MachnetChannelBufClass MachnetChannelBufClass_t;
+
 struct MachnetChannelDataCtx {
   size_t stats_ofs;
   size_t ctrl_sq_ring_ofs;
   size_t ctrl_cq_ring_ofs;
   size_t machnet_ring_ofs;
   size_t app_ring_ofs;
-  size_t buf_ring_ofs;
-  size_t buffer_index_table_ofs;
+  size_t completion_ring_ofs;
+  // The pools of all classes are laid out back to back, starting at
+  // `buf_pool_ofs' (page-aligned).
   size_t buf_pool_ofs;
-  size_t buf_pool_mask;
-  uint32_t buf_size;
-  uint32_t buf_mss;
+  size_t buf_pool_size;
+#define MACHNET_CHANNEL_BUF_CLASS_MAX 16
+  // Number of classes created with the channel; the remaining slots are used
+  // by extension segments.
+  uint32_t buf_class_nr;
+  // Class ids sorted by ascending buffer size; active classes first.
+  uint8_t buf_class_order[MACHNET_CHANNEL_BUF_CLASS_MAX];
+  MachnetChannelBufClass_t buf_classes[MACHNET_CHANNEL_BUF_CLASS_MAX];
 } __attribute__((aligned(CACHE_LINE_SIZE)));
 typedef struct MachnetChannelDataCtx MachnetChannelDataCtx_t;
 
 struct MachnetChannelCtrlCtx {
   // Mutex for protecting the control queue.
   size_t req_id;
+  // Bumped by Machnet when the state of an extension segment changes; the
+  // application copies it to `app_segment_gen' once it has processed the
+  // segments.
+  volatile uint32_t segment_gen;
+  volatile uint32_t app_segment_gen;
 } __attribute__((aligned(CACHE_LINE_SIZE)));
 typedef struct MachnetChannelCtrlCtx MachnetChannelCtrlCtx_t;
 
-/*
- * This data structure is used to implement a small cache of buffer indices
- * used exclusively by the application. This reduces contention on the global
- * buffer pool (which uses atomic operations for MP-safety).
- */
-struct MachnetChannelAppBufferCache {
-  uint32_t count;
-  MachnetRingSlot_t indices[NUM_CACHED_BUFS];
-};
-typedef struct MachnetChannelAppBufferCache MachnetChannelAppBufferCache_t;
-
 /**
  * The `MachnetChannelCtx' holds all the metadata information (context) of an
  * Machnet Channel.
@@ -134,14 +234,13 @@ typedef struct MachnetChannelAppBufferCache MachnetChannelAppBufferCache_t;
 struct MachnetChannelCtx {
 #define MACHNET_CHANNEL_CTX_MAGIC 0xA5A5A5A5
   uint32_t magic;  // Magic value tagged after initialization.
-#define MACHNET_CHANNEL_VERSION 0x01
+#define MACHNET_CHANNEL_VERSION 0x06
   uint16_t version;
   uint64_t size;  // Size of the Channel's memory, including this context.
 #define MACHNET_CHANNEL_NAME_MAX_LEN 256
   char name[MACHNET_CHANNEL_NAME_MAX_LEN];
   MachnetChannelCtrlCtx_t ctrl_ctx;  // Control channel's specific metadata.
   MachnetChannelDataCtx_t data_ctx;  // Dataplane channel's specific metadata.
-  MachnetChannelAppBufferCache_t app_buffer_cache;
 } __attribute__((aligned(CACHE_LINE_SIZE)));
 typedef struct MachnetChannelCtx MachnetChannelCtx_t;
 
@@ -157,12 +256,74 @@ struct MachnetChannelAppStats {
 typedef struct MachnetChannelAppStats MachnetChannelAppStats_t;
 
 /**
- * Machnet channel statistics.
+ * Summary of a flow of the channel, as sampled by Machnet.
+ */
+struct MachnetChannelFlowStats {
+  MachnetFlow_t flow;         // Local (src) and remote (dst) endpoints.
+  uint32_t state;             // State of the flow (Machnet-specific).
+  uint32_t cwnd;              // Congestion window, in packets.
+  uint32_t inflight;          // Packets sent and not yet acknowledged.
+  uint32_t pending_segments;  // Packets waiting for the window to open.
+  uint32_t srtt_us;           // Smoothed RTT (0 if not sampled yet).
+  uint32_t min_rtt_us;        // Lowest RTT sampled.
+};
+typedef struct MachnetChannelFlowStats MachnetChannelFlowStats_t;
+
+/**
+ * Statistics of the channel maintained by Machnet, i.e., by the engine that
+ * serves the channel, for anyone who maps the channel to read.
  *
- * TODO(ilias): At the moment it contains statistics for the application side.
+ * There is a single writer. Counters are cumulative; Machnet updates them
+ * with relaxed atomic stores and readers load them atomically (rates are left
+ * to the readers). The rest (ring and buffer occupancy, flows) is a snapshot
+ * that Machnet refreshes periodically, under `snapshot_seq': it is odd while
+ * an update is in progress. See `__machnet_channel_engine_stats_read()'.
+ */
+struct MachnetChannelEngineStats {
+  // Messages delivered to the application, and sent by it.
+  uint64_t rx_msgs;
+  uint64_t rx_bytes;
+  uint64_t tx_msgs;
+  uint64_t tx_bytes;
+  // Data packets received and sent (first transmissions) on the flows.
+  uint64_t rx_pkts;
+  uint64_t tx_pkts;
+  // Data packets retransmitted.
+  uint64_t fast_rexmits;
+  uint64_t rto_rexmits;
+  // Drops, by reason.
+  uint64_t rx_drops_nobuf;       // No free buffer to store a packet in.
+  uint64_t rx_drops_window;      // Packet too far ahead of the window.
+  uint64_t rx_drops_dup;         // Packet received before.
+  uint64_t rx_drops_invalid;     // Malformed, or not valid in the flow state.
+  uint64_t tx_drops_noflow;      // Message for a flow that does not exist.
+  uint64_t tx_completion_drops;  // TX completion ring full.
+
+  // Snapshot, refreshed periodically.
+  uint64_t snapshot_seq;
+  uint32_t machnet_ring_pending;  // Messages not yet received by the app.
+  uint32_t machnet_ring_size;
+  uint32_t app_ring_pending;  // Messages not yet picked up by Machnet.
+  uint32_t app_ring_size;
+  uint32_t completion_ring_pending;
+  uint32_t completion_ring_size;
+  uint32_t buf_free;  // Free buffers, incl. the ones Machnet caches.
+  uint32_t buf_total;
+#define MACHNET_CHANNEL_STATS_FLOW_MAX 32
+  uint32_t flow_nr;  // Flows of the channel; only the first few are listed.
+  uint32_t reserved;
+  MachnetChannelFlowStats_t flows[MACHNET_CHANNEL_STATS_FLOW_MAX];
+};
+typedef struct MachnetChannelEngineStats MachnetChannelEngineStats_t;
+
+/**
+ * Machnet channel statistics: the application side (`a_stats'), and the
+ * Machnet side (`e_stats'), each on its own cache lines.
  */
 struct MachnetChannelStats {
   MachnetChannelAppStats_t a_stats;
+  MachnetChannelEngineStats_t e_stats
+      __attribute__((aligned(CACHE_LINE_SIZE)));
 } __attribute__((aligned(CACHE_LINE_SIZE)));
 typedef struct MachnetChannelStats MachnetChannelStats_t;
 
@@ -185,6 +346,21 @@ typedef struct MachnetCtrlQueueEntry MachnetCtrlQueueEntry_t;
 static_assert(sizeof(MachnetCtrlQueueEntry_t) % 4 == 0,
               "MachnetCtrlSqEntry_t must be 32-bit aligned");
 
+/**
+ * TX completion entry: Posted by Machnet to the completion ring of a channel
+ * once the remote peer has acknowledged the last packet of a message flagged
+ * with `MACHNET_MSGBUF_NOTIFY_DELIVERY'.
+ */
+struct MachnetTxCompletion {
+  uint64_t cookie;     // The cookie supplied by the application.
+  MachnetFlow_t flow;  // The flow the message was sent on.
+#define MACHNET_TX_COMPLETION_DELIVERED 0x0000
+  uint32_t status;
+};
+typedef struct MachnetTxCompletion MachnetTxCompletion_t;
+static_assert(sizeof(MachnetTxCompletion_t) % 4 == 0,
+              "MachnetTxCompletion_t must be 32-bit aligned");
+
 /**
  * Message Buffer Header: This header is carried at the beginning of every
  * buffer of an Machnet dataplane channel.
@@ -194,14 +370,14 @@ struct MachnetMsgBuf {
   const uint32_t magic;  // Magic value tagged after initialization.
   const uint32_t index;  // Index of the buffer in the buffer pool.
   const uint32_t size;   // Absolute static size of the buffer.
-  const uintptr_t iova;  // IOVA address of the buffer.
 #define MACHNET_MSGBUF_FLAGS_SYN (1 << 0)
 #define MACHNET_MSGBUF_FLAGS_SG (1 << 1)
 #define MACHNET_MSGBUF_FLAGS_FIN (1 << 2)
 #define MACHNET_MSGBUF_FLAGS_CHAIN (1 << 3)
 #define MACHNET_MSGBUF_NOTIFY_DELIVERY (1 << 7)
   uint8_t flags;
-  MachnetFlow_t flow;  // Network flow info.
+  const uintptr_t iova;  // IOVA address of the buffer.
+  MachnetFlow_t flow;    // Network flow info.
   uint32_t msg_len;    // This is the total length of the message (could be
                        // larger than the buffer size). Set in the first buffer.
   uint32_t data_len;   // Length of the data in this buffer.
@@ -211,7 +387,9 @@ struct MachnetMsgBuf {
   // If multi-buffer message (SG), last points to the last buffer index.
   // This is only set in the first buffer of the message.
   uint32_t last;
-  uint32_t reserved1[1];
+  // Application-supplied cookie, returned in the TX completion of a message
+  // flagged with `MACHNET_MSGBUF_NOTIFY_DELIVERY'. Set in the first buffer.
+  uint64_t cookie;
 } __attribute__((aligned(CACHE_LINE_SIZE)));
 typedef struct MachnetMsgBuf MachnetMsgBuf_t;
 #define MACHNET_MSGBUF_SPACE_RESERVED (sizeof(MachnetMsgBuf_t))
@@ -219,6 +397,24 @@ static_assert(MACHNET_MSGBUF_SPACE_RESERVED == CACHE_LINE_SIZE,
               "MachnetMsgBuf_t is not aligned");
 #define MACHNET_MSGBUF_HEADROOM_MAX (2 * CACHE_LINE_SIZE)
 
+// The index of a buffer carries its size class in the top bits, and its
+// position in the class' pool in the rest.
+#define MACHNET_MSGBUF_CLASS_SHIFT 28
+#define MACHNET_MSGBUF_INDEX_MASK ((1U << MACHNET_MSGBUF_CLASS_SHIFT) - 1)
+#define MACHNET_MSGBUF_INDEX(cls, idx) \
+  (((uint32_t)(cls) << MACHNET_MSGBUF_CLASS_SHIFT) | (uint32_t)(idx))
+#define MACHNET_MSGBUF_INDEX_CLASS(index) \
+  ((uint32_t)(index) >> MACHNET_MSGBUF_CLASS_SHIFT)
+static_assert(MACHNET_CHANNEL_BUF_CLASS_MAX <=
+                  (1ULL << (32 - MACHNET_MSGBUF_CLASS_SHIFT)),
+              "Too many buffer classes for the index encoding");
+
+// Maximum size of an extension segment. Every channel is followed by a
+// reservation of address space large enough for a segment in each class slot.
+#define MACHNET_CHANNEL_SEGMENT_SIZE_MAX ((size_t)64 * MB)
+#define MACHNET_CHANNEL_SEGMENT_VA_SIZE \
+  (MACHNET_CHANNEL_BUF_CLASS_MAX * MACHNET_CHANNEL_SEGMENT_SIZE_MAX)
+
 static inline __attribute__((always_inline)) void __machnet_channel_buf_init(
     MachnetMsgBuf_t *buf) {
   // Do not set the magic here. Should be set in initialization only.
@@ -232,6 +428,7 @@ static inline __attribute__((always_inline)) void __machnet_channel_buf_init(
   buf->data_ofs = MACHNET_MSGBUF_HEADROOM_MAX;
   buf->next = UINT32_MAX;
   buf->last = UINT32_MAX;
+  buf->cookie = 0;
 }
 
 /**
@@ -271,6 +468,40 @@ __machnet_channel_ctrl_cq_ring(const MachnetChannelCtx_t *ctx) {
                                               ctx->data_ctx.ctrl_cq_ring_ofs);
 }
 
+/**
+ * Get a pointer to the statistics of the channel.
+ *
+ * @param ctx                Channel's context.
+ * @return                   A pointer to the statistics.
+ */
+static inline __attribute__((always_inline)) MachnetChannelStats_t *
+__machnet_channel_stats(const MachnetChannelCtx_t *ctx) {
+  return (MachnetChannelStats_t *)__machnet_channel_mem_ofs(
+      ctx, ctx->data_ctx.stats_ofs);
+}
+
+/**
+ * Read a consistent copy of the statistics Machnet maintains for the channel
+ * (see `MachnetChannelEngineStats'). Retries while Machnet refreshes the
+ * snapshot part, which is short.
+ *
+ * @param ctx                Channel's context.
+ * @param stats              Pointer to store the copy to.
+ */
+static inline void __machnet_channel_engine_stats_read(
+    const MachnetChannelCtx_t *ctx, MachnetChannelEngineStats_t *stats) {
+  const MachnetChannelEngineStats_t *e_stats =
+      &__machnet_channel_stats(ctx)->e_stats;
+  uint64_t seq;
+  do {
+    seq = __atomic_load_n(&e_stats->snapshot_seq, __ATOMIC_ACQUIRE);
+    if (seq & 1) continue;
+    memcpy(stats, e_stats, sizeof(*stats));
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  } while ((seq & 1) ||
+           __atomic_load_n(&e_stats->snapshot_seq, __ATOMIC_RELAXED) != seq);
+}
+
 /**
  * Get a pointer to the `Machnet' ring (Machnet->Application).
  *
@@ -295,14 +526,69 @@ __machnet_channel_app_ring(const MachnetChannelCtx_t *ctx) {
 }
 
 /**
- * Get a pointer to the `MsgBuf' ring (allocator pool).
+ * Get a pointer to the TX completion ring (Machnet->Application).
+ *
+ * @param ctx                Channel's context.
+ * @return                   A pointer to the TX completion ring.
+ */
+static inline __attribute__((always_inline)) jring_t *
+__machnet_channel_completion_ring(const MachnetChannelCtx_t *ctx) {
+  return (jring_t *)__machnet_channel_mem_ofs(
+      ctx, ctx->data_ctx.completion_ring_ofs);
+}
+
+/**
+ * Get a pointer to a buffer size class of the channel.
+ *
+ * @param ctx                Channel's context.
+ * @param cls                The buffer class.
+ * @return                   A pointer to the class descriptor.
+ */
+static inline __attribute__((always_inline)) const MachnetChannelBufClass_t *
+__machnet_channel_buf_class(const MachnetChannelCtx_t *ctx, uint32_t cls) {
+  assert(cls < MACHNET_CHANNEL_BUF_CLASS_MAX);
+  return &ctx->data_ctx.buf_classes[cls];
+}
+
+/**
+ * Check whether the buffers of a class are mapped by both Machnet and the
+ * application, i.e., whether they can be used and released.
+ *
+ * @param ctx                Channel's context.
+ * @param cls                The buffer class.
+ * @return                   1 if the class is usable, 0 otherwise.
+ */
+static inline __attribute__((always_inline)) int
+__machnet_channel_buf_class_usable(const MachnetChannelCtx_t *ctx,
+                                   uint32_t cls) {
+  const uint32_t state = __machnet_channel_buf_class(ctx, cls)->state;
+  return state == MACHNET_CHANNEL_BUF_CLASS_ACTIVE ||
+         state == MACHNET_CHANNEL_BUF_CLASS_DRAINING;
+}
+
+/**
+ * Get a pointer to the `MsgBuf' ring (allocator pool) of a buffer class.
+ *
+ * @param ctx                Channel's context.
+ * @param cls                The buffer class.
+ * @return                   A pointer to the MsgBuf Ring.
+ */
+static inline __attribute__((always_inline)) jring_t *
+__machnet_channel_class_buf_ring(const MachnetChannelCtx_t *ctx, uint32_t cls) {
+  return (jring_t *)__machnet_channel_mem_ofs(
+      ctx, __machnet_channel_buf_class(ctx, cls)->buf_ring_ofs);
+}
+
+/**
+ * Get a pointer to the `MsgBuf' ring (allocator pool) of the default buffer
+ * class.
  *
  * @param ctx                Channel's context.
  * @return                   A pointer to the MsgBuf Ring.
  */
 static inline __attribute__((always_inline)) jring_t *
 __machnet_channel_buf_ring(const MachnetChannelCtx_t *ctx) {
-  return (jring_t *)__machnet_channel_mem_ofs(ctx, ctx->data_ctx.buf_ring_ofs);
+  return __machnet_channel_class_buf_ring(ctx, 0);
 }
 
 /**
@@ -315,14 +601,128 @@ static inline __attribute__((always_inline)) uchar_t *__machnet_channel_end(
   return __machnet_channel_mem_ofs(ctx, ctx->size);
 }
 
-static inline MachnetRingSlot_t *__machnet_channel_buffer_index_table(
-    const MachnetChannelCtx_t *ctx) {
-  return (MachnetRingSlot_t *)__machnet_channel_mem_ofs(
-      ctx, ctx->data_ctx.buffer_index_table_ofs);
+/**
+ * Get the offset of the extension segment slot of a buffer class, relative to
+ * the channel's context.
+ *
+ * @param ctx                Channel's context.
+ * @param cls                The buffer class.
+ * @return                   The offset of the segment slot.
+ */
+static inline __attribute__((always_inline)) size_t
+__machnet_channel_segment_ofs(const MachnetChannelCtx_t *ctx, uint32_t cls) {
+  return ALIGN_TO_BOUNDARY(ctx->size, (size_t)HUGE_PAGE_2M_SIZE) +
+         cls * MACHNET_CHANNEL_SEGMENT_SIZE_MAX;
 }
 
 /**
- * Get a pointer to the beginning of the buffer pool (i.e., the first MsgBuf).
+ * Get the size of the address space occupied by a channel: its memory, plus
+ * the reservation for the extension segments.
+ *
+ * @param channel_size       Size of the channel's memory.
+ * @return                   The size of the channel's address space.
+ */
+static inline size_t __machnet_channel_va_size(size_t channel_size) {
+  return ALIGN_TO_BOUNDARY(channel_size, (size_t)HUGE_PAGE_2M_SIZE) +
+         MACHNET_CHANNEL_SEGMENT_VA_SIZE;
+}
+
+/**
+ * Map a channel's shared memory segment, and reserve the address space of its
+ * extension segments right after it. The mapping is huge page aligned.
+ *
+ * @param channel_size       Size of the channel's memory.
+ * @param flags              `mmap()' flags for the channel's memory.
+ * @param shm_fd             File descriptor of the shared memory segment.
+ * @return                   Pointer to the channel's memory on success,
+ *                           `MAP_FAILED' otherwise.
+ */
+static inline void *__machnet_channel_mmap(size_t channel_size, int flags,
+                                           int shm_fd) {
+  const size_t va_size = __machnet_channel_va_size(channel_size);
+  // Over-reserve by a huge page so that we can align the start.
+  uchar_t *va = (uchar_t *)mmap(NULL, va_size + HUGE_PAGE_2M_SIZE, PROT_NONE,
+                                MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+                                -1, 0);
+  if (va == MAP_FAILED) return MAP_FAILED;
+
+  uchar_t *base = (uchar_t *)ALIGN_TO_BOUNDARY((uintptr_t)va,
+                                               (uintptr_t)HUGE_PAGE_2M_SIZE);
+  if (base != va) munmap(va, base - va);
+  munmap(base + va_size, (va + va_size + HUGE_PAGE_2M_SIZE) - (base + va_size));
+
+  void *channel = mmap(base, channel_size, PROT_READ | PROT_WRITE,
+                       flags | MAP_FIXED, shm_fd, 0);
+  if (channel == MAP_FAILED) munmap(base, va_size);
+  return channel;
+}
+
+/**
+ * Unmap a channel mapped with `__machnet_channel_mmap()', along with its
+ * extension segments.
+ *
+ * @param channel            Pointer to the channel's memory.
+ * @param channel_size       Size of the channel's memory.
+ */
+static inline void __machnet_channel_munmap(void *channel,
+                                            size_t channel_size) {
+  munmap(channel, __machnet_channel_va_size(channel_size));
+}
+
+/**
+ * Get the name of the shared memory segment backing an extension segment.
+ * Segments of POSIX shared memory channels can be opened by this name.
+ *
+ * @param ctx                Channel's context.
+ * @param cls                The buffer class of the segment.
+ * @param[out] name          Buffer to hold the name.
+ * @param name_len           Size of `name'.
+ */
+static inline void __machnet_channel_segment_name(
+    const MachnetChannelCtx_t *ctx, uint32_t cls, char *name,
+    size_t name_len) {
+  snprintf(name, name_len, "%s.%u", ctx->name, cls);
+}
+
+/**
+ * Map the extension segment of a buffer class at its slot.
+ *
+ * @param ctx                Channel's context.
+ * @param cls                The buffer class.
+ * @param flags              `mmap()' flags for the segment.
+ * @param shm_fd             File descriptor of the segment.
+ * @return                   0 on success, -1 on failure.
+ */
+static inline int __machnet_channel_segment_map(const MachnetChannelCtx_t *ctx,
+                                                uint32_t cls, int flags,
+                                                int shm_fd) {
+  const MachnetChannelBufClass_t *buf_class = &ctx->data_ctx.buf_classes[cls];
+  assert(buf_class->segment_size <= MACHNET_CHANNEL_SEGMENT_SIZE_MAX);
+  void *slot =
+      __machnet_channel_mem_ofs(ctx, __machnet_channel_segment_ofs(ctx, cls));
+  void *segment = mmap(slot, buf_class->segment_size, PROT_READ | PROT_WRITE,
+                       flags | MAP_FIXED, shm_fd, 0);
+  return segment == MAP_FAILED ? -1 : 0;
+}
+
+/**
+ * Unmap the extension segment of a buffer class, returning its slot to the
+ * channel's address space reservation.
+ *
+ * @param ctx                Channel's context.
+ * @param cls                The buffer class.
+ */
+static inline void __machnet_channel_segment_unmap(
+    const MachnetChannelCtx_t *ctx, uint32_t cls) {
+  void *slot =
+      __machnet_channel_mem_ofs(ctx, __machnet_channel_segment_ofs(ctx, cls));
+  mmap(slot, MACHNET_CHANNEL_SEGMENT_SIZE_MAX, PROT_NONE,
+       MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0);
+}
+
+/**
+ * Get a pointer to the beginning of the buffer pool (i.e., the first MsgBuf of
+ * the first class).
  * @param ctx                Channel's context.
  * @return                   A pointer to the beginning of the buffer pool.
  */
@@ -331,9 +731,30 @@ __machnet_channel_buf_pool(const MachnetChannelCtx_t *ctx) {
   return (uchar_t *)__machnet_channel_mem_ofs(ctx, ctx->data_ctx.buf_pool_ofs);
 }
 
+/**
+ * Get the size of the buffer pool, spanning the buffers of all classes.
+ * @param ctx                Channel's context.
+ * @return                   The size of the buffer pool in bytes.
+ */
 static inline __attribute__((always_inline)) size_t
 __machnet_channel_buf_pool_size(const MachnetChannelCtx_t *ctx) {
-  return ctx->data_ctx.buf_pool_mask * ctx->data_ctx.buf_size;
+  return ctx->data_ctx.buf_pool_size;
+}
+
+/**
+ * Check whether an index refers to a buffer of the channel.
+ *
+ * @param ctx                Channel's context.
+ * @param index              Index of the buffer.
+ * @return                   1 if the index is valid, 0 otherwise.
+ */
+static inline __attribute__((always_inline)) int __machnet_channel_buf_valid(
+    const MachnetChannelCtx_t *ctx, uint32_t index) {
+  const uint32_t cls = MACHNET_MSGBUF_INDEX_CLASS(index);
+  return cls < MACHNET_CHANNEL_BUF_CLASS_MAX &&
+         __machnet_channel_buf_class_usable(ctx, cls) &&
+         (index & MACHNET_MSGBUF_INDEX_MASK) <
+             ctx->data_ctx.buf_classes[cls].buf_nr;
 }
 
 /**
@@ -345,8 +766,11 @@ __machnet_channel_buf_pool_size(const MachnetChannelCtx_t *ctx) {
  */
 static inline __attribute__((always_inline)) MachnetMsgBuf_t *
 __machnet_channel_buf(const MachnetChannelCtx_t *ctx, uint32_t index) {
-  size_t buf_ofs =
-      ctx->data_ctx.buf_pool_ofs + (size_t)index * ctx->data_ctx.buf_size;
+  const MachnetChannelBufClass_t *buf_class =
+      &ctx->data_ctx.buf_classes[MACHNET_MSGBUF_INDEX_CLASS(index)];
+  size_t buf_ofs = buf_class->buf_pool_ofs +
+                   (size_t)(index & MACHNET_MSGBUF_INDEX_MASK) *
+                       buf_class->buf_size;
   return (MachnetMsgBuf_t *)__machnet_channel_mem_ofs(ctx, buf_ofs);
 }
 
@@ -363,14 +787,16 @@ __machnet_channel_buf_index(const MachnetChannelCtx_t *ctx,
                             const MachnetMsgBuf_t *buf) {
   assert(ctx != NULL);
   assert(buf != NULL);
-  const uint32_t buf_size = ctx->data_ctx.buf_size;
-  const size_t buf_pool_ofs = ctx->data_ctx.buf_pool_ofs;
+  const size_t buf_ofs = (uintptr_t)buf - (uintptr_t)ctx;
+  uint32_t cls = MACHNET_CHANNEL_BUF_CLASS_MAX - 1;
+  // Pools are laid out in class order (extension segment slots last).
+  while (cls > 0 && buf_ofs < ctx->data_ctx.buf_classes[cls].buf_pool_ofs)
+    cls--;
+  const MachnetChannelBufClass_t *buf_class = &ctx->data_ctx.buf_classes[cls];
   MachnetRingSlot_t index =
-      ((uintptr_t)buf -
-       (uintptr_t)__machnet_channel_mem_ofs(ctx, buf_pool_ofs)) /
-      buf_size;
-  assert(index <= ctx->data_ctx.buf_pool_mask);
-  return index;
+      (buf_ofs - buf_class->buf_pool_ofs) / buf_class->buf_size;
+  assert(index < buf_class->buf_nr);
+  return MACHNET_MSGBUF_INDEX(cls, index);
 }
 
 /**
@@ -491,9 +917,11 @@ __machnet_channel_buf_append(MachnetMsgBuf_t *buf, uint32_t len) {
 }
 
 /**
- * Allocate a number of `MsgBuf' buffers from the channel's pool.
+ * Allocate a number of `MsgBuf' buffers of a particular class from the
+ * channel's pool.
  *
  * @param ctx                Channel's context.
+ * @param cls                The buffer class to allocate from.
  * @param n                  Number of buffers to allocate.
  * @param indices            Pointer to an array that can hold at least `n'
  *                           `MachnetRingSlot_t'-sized objects to store the
@@ -504,19 +932,21 @@ __machnet_channel_buf_append(MachnetMsgBuf_t *buf, uint32_t len) {
  * @return                   Number of buffers allocated, either 0 or `n'.
  */
 static inline __attribute__((always_inline)) unsigned int
-__machnet_channel_buf_alloc_bulk(const MachnetChannelCtx_t *ctx, uint32_t n,
-                                 MachnetRingSlot_t *indices,
-                                 MachnetMsgBuf_t **bufs) {
+__machnet_channel_class_buf_alloc_bulk(const MachnetChannelCtx_t *ctx,
+                                       uint32_t cls, uint32_t n,
+                                       MachnetRingSlot_t *indices,
+                                       MachnetMsgBuf_t **bufs) {
   assert(ctx != NULL);
   assert(indices != NULL);
 
-  jring_t *buf_ring = __machnet_channel_buf_ring(ctx);
+  jring_t *buf_ring = __machnet_channel_class_buf_ring(ctx, cls);
 
   // Both sides can allocate buffers concurrently, so use directly the
   // multi-consumer function.
   uint32_t ret = jring_mc_dequeue_bulk(buf_ring, indices, n, NULL);
   for (uint32_t i = 0; i < ret; i++) {
-    assert(indices[i] < buf_ring->capacity);
+    assert(MACHNET_MSGBUF_INDEX_CLASS(indices[i]) == cls);
+    assert(__machnet_channel_buf_valid(ctx, indices[i]));
     // Initialize all buffers in the allocated batch.
     MachnetMsgBuf_t *msg_buf = __machnet_channel_buf(ctx, indices[i]);
     __machnet_channel_buf_init(msg_buf);
@@ -527,14 +957,36 @@ __machnet_channel_buf_alloc_bulk(const MachnetChannelCtx_t *ctx, uint32_t n,
 }
 
 /**
- * Release a number of `MsgBuf' buffers back to the channel's pool.
+ * Allocate a number of `MsgBuf' buffers of the default class from the
+ * channel's pool.
+ *
+ * @param ctx                Channel's context.
+ * @param n                  Number of buffers to allocate.
+ * @param indices            Pointer to an array that can hold at least `n'
+ *                           `MachnetRingSlot_t'-sized objects to store the
+ *                           allocated buffer indexes.
+ * @param bufs               (Optional: NULL) Pointer to an array that can hold
+ *                           at least `n' pointers to `MachnetMsgBuf_t' objects
+ * to store the allocated buffer pointers.
+ * @return                   Number of buffers allocated, either 0 or `n'.
+ */
+static inline __attribute__((always_inline)) unsigned int
+__machnet_channel_buf_alloc_bulk(const MachnetChannelCtx_t *ctx, uint32_t n,
+                                 MachnetRingSlot_t *indices,
+                                 MachnetMsgBuf_t **bufs) {
+  return __machnet_channel_class_buf_alloc_bulk(ctx, 0, n, indices, bufs);
+}
+
+/**
+ * Release a number of `MsgBuf' buffers back to the channel's pool. Buffers can
+ * be of any class; each one is returned to the pool of its class.
  *
  * @param ctx                Channel's context.
  * @param n                  Number of buffers to release.
  * @param bufs               Pointer to an array of `n'
  * `MachnetRingSlot_t'-sized objects that contain the indices of the buffers to
  *                           be freed.
- * @return                   Number of buffers freed, either 0 or `n'.
+ * @return                   Number of buffers freed, from 0 to `n'.
  *                           NOTE: With correct use, this fuction must always
  *                           succeed (i.e, return `n').
  */
@@ -544,20 +996,48 @@ __machnet_channel_buf_free_bulk(const MachnetChannelCtx_t *ctx, uint32_t n,
   assert(ctx != NULL);
   assert(bufs != NULL);
 
-  jring_t *buf_ring = __machnet_channel_buf_ring(ctx);
-
 #ifndef NDEBUG
   for (uint32_t i = 0; i < n; i++) {
-    assert(bufs[i] < buf_ring->capacity);
+    assert(__machnet_channel_buf_valid(ctx, bufs[i]));
   }
 #endif
-  // Both sides can release buffers concurrently, so use directly the
-  // multi-consumer function.
-  return jring_mp_enqueue_bulk(buf_ring, bufs, n, NULL);
+  // Release runs of buffers of the same class with a single enqueue. Both
+  // sides can release buffers concurrently, so use directly the
+  // multi-producer function.
+  uint32_t freed = 0;
+  while (freed < n) {
+    const uint32_t cls = MACHNET_MSGBUF_INDEX_CLASS(bufs[freed]);
+    uint32_t run = 1;
+    while (freed + run < n &&
+           MACHNET_MSGBUF_INDEX_CLASS(bufs[freed + run]) == cls)
+      run++;
+    jring_t *buf_ring = __machnet_channel_class_buf_ring(ctx, cls);
+    if (jring_mp_enqueue_bulk(buf_ring, bufs + freed, run, NULL) != run) break;
+    freed += run;
+  }
+
+  return freed;
 }
 
 /**
- * Return the number of free buffers in the channel's pool.
+ * Return the number of free buffers of a class in the channel's pool.
+ *
+ * @param ctx                Channel's context.
+ * @param cls                The buffer class.
+ * @return                   Number of items free.
+ */
+static inline __attribute__((always_inline)) uint32_t
+__machnet_channel_class_buffers_avail(const MachnetChannelCtx_t *ctx,
+                                      uint32_t cls) {
+  assert(ctx != NULL);
+
+  jring_t *buf_ring = __machnet_channel_class_buf_ring(ctx, cls);
+  return jring_count(buf_ring);
+}
+
+/**
+ * Return the number of free buffers (of all usable classes) in the channel's
+ * pool.
  *
  * @param ctx                Channel's context.
  * @return                   Number of items free.
@@ -566,8 +1046,30 @@ static inline __attribute__((always_inline)) uint32_t
 __machnet_channel_buffers_avail(const MachnetChannelCtx_t *ctx) {
   assert(ctx != NULL);
 
-  jring_t *buf_ring = __machnet_channel_buf_ring(ctx);
-  return ctx->app_buffer_cache.count + jring_count(buf_ring);
+  uint32_t avail = 0;
+  for (uint32_t cls = 0; cls < MACHNET_CHANNEL_BUF_CLASS_MAX; cls++) {
+    if (!__machnet_channel_buf_class_usable(ctx, cls)) continue;
+    avail += __machnet_channel_class_buffers_avail(ctx, cls);
+  }
+  return avail;
+}
+
+/**
+ * Return the total number of buffers (of all usable classes) of the channel.
+ *
+ * @param ctx                Channel's context.
+ * @return                   Number of buffers.
+ */
+static inline __attribute__((always_inline)) uint32_t
+__machnet_channel_buffers_total(const MachnetChannelCtx_t *ctx) {
+  assert(ctx != NULL);
+
+  uint32_t total = 0;
+  for (uint32_t cls = 0; cls < MACHNET_CHANNEL_BUF_CLASS_MAX; cls++) {
+    if (!__machnet_channel_buf_class_usable(ctx, cls)) continue;
+    total += ctx->data_ctx.buf_classes[cls].buf_nr;
+  }
+  return total;
 }
 
 /**
@@ -775,6 +1277,66 @@ __machnet_channel_machnet_ring_dequeue(const MachnetChannelCtx_t *ctx,
   return jring_sc_dequeue_burst(machnet_ring, bufs, n, NULL);
 }
 
+/**
+ * This function enqueues TX completions to the channel's completion ring
+ * (Machnet->Application).
+ *
+ * @param ctx                Channel's context.
+ * @param n                  Number of completions to enqueue.
+ * @param completions        Pointer to an array of `n' completions.
+ * @return                   Number of completions enqueued, either 0 or `n'.
+ */
+static inline __attribute__((always_inline)) uint32_t
+__machnet_channel_completion_ring_enqueue(
+    const MachnetChannelCtx_t *ctx, unsigned int n,
+    const MachnetTxCompletion_t *completions) {
+  assert(ctx != NULL);
+  assert(completions != NULL);
+
+  jring_t *completion_ring = __machnet_channel_completion_ring(ctx);
+  // Only one Machnet engine serves a channel.
+  return jring_sp_enqueue_bulk(completion_ring, completions, n, NULL);
+}
+
+/**
+ * This function dequeues TX completions from the channel's completion ring.
+ *
+ * @param ctx                Channel's context.
+ * @param n                  Maximum number of completions to dequeue.
+ * @param completions        Pointer to an array that can hold up to `n'
+ *                           completions.
+ * @return                   Number of completions dequeued, ranging [0, n].
+ */
+static inline __attribute__((always_inline)) uint32_t
+__machnet_channel_completion_ring_dequeue(const MachnetChannelCtx_t *ctx,
+                                          unsigned int n,
+                                          MachnetTxCompletion_t *completions) {
+  assert(ctx != NULL);
+  assert(completions != NULL);
+
+  jring_t *completion_ring = __machnet_channel_completion_ring(ctx);
+  // Multiple application threads might be polling concurrently.
+  return jring_mc_dequeue_burst(completion_ring, completions, n, NULL);
+}
+
+/**
+ * This function returns the index of the buffer at the head of the Machnet
+ * ring (next message to be delivered to the application), without dequeuing
+ * it. It must only be called from the consumer side of the ring (the
+ * application).
+ *
+ * @param ctx                Channel's context.
+ * @param buf                Pointer to a `MachnetRingSlot_t' that is set to
+ *                           the index of the head buffer.
+ * @return                   1 if a message is pending, 0 otherwise.
+ */
+static inline __attribute__((always_inline)) uint32_t
+__machnet_channel_machnet_ring_peek(const MachnetChannelCtx_t *ctx,
+                                    MachnetRingSlot_t *buf) {
+  jring_t *machnet_ring = __machnet_channel_machnet_ring(ctx);
+  return jring_sc_peek(machnet_ring, buf);
+}
+
 #ifdef __cplusplus
 }
 #endif
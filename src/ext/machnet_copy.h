@@ -0,0 +1,465 @@
+/**
+ * @file  machnet_copy.h
+ * @brief Payload copy kernels shared by the Machnet shim and the Machnet
+ * engine.
+ *
+ * Copies are dispatched at runtime to the widest SIMD kernel supported by the
+ * CPU (AVX-512, AVX2 or NEON), falling back to libc `memcpy'. Each kernel comes
+ * in two flavours: a regular one, and one that uses non-temporal stores. The
+ * latter is meant for large transfers (by default, larger than half of the
+ * LLC), which would otherwise evict the working set of the application from
+ * the caches. The threshold can be overridden with the
+ * `MACHNET_COPY_NT_THRESHOLD' environment variable (in bytes), and the kernel
+ * with `MACHNET_COPY_KERNEL' (e.g., "libc"), which is useful on hosts where the
+ * libc `memcpy' is faster for cache-resident copies (see machnet_bench).
+ */
+
+#ifndef SRC_EXT_MACHNET_COPY_H_
+#define SRC_EXT_MACHNET_COPY_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+enum machnet_copy_kernel {
+  MACHNET_COPY_KERNEL_LIBC = 0,
+  MACHNET_COPY_KERNEL_AVX2,
+  MACHNET_COPY_KERNEL_AVX512,
+  MACHNET_COPY_KERNEL_NEON,
+  MACHNET_COPY_KERNEL_NR,
+};
+
+#define MACHNET_COPY_KERNEL_ENV "MACHNET_COPY_KERNEL"
+#define MACHNET_COPY_NT_THRESHOLD_ENV "MACHNET_COPY_NT_THRESHOLD"
+// Used when the LLC size cannot be determined.
+#define MACHNET_COPY_NT_THRESHOLD_DEFAULT (4UL << 20)
+
+typedef void (*machnet_copy_fn_t)(void *, const void *, size_t);
+
+struct MachnetCopyCtx {
+  volatile int initialized;
+  enum machnet_copy_kernel kernel;
+  size_t nt_threshold;
+  machnet_copy_fn_t copy;
+  machnet_copy_fn_t copy_nt;
+};
+
+// Every translation unit lazily initializes its own dispatch context.
+static struct MachnetCopyCtx __machnet_copy_ctx __attribute__((unused));
+
+static inline void __machnet_copy_libc(void *dst, const void *src,
+                                       size_t len) {
+  memcpy(dst, src, len);
+}
+
+#if defined(__x86_64__)
+/*
+ * All the x86 kernels use unaligned loads and stores; the last (partial) block
+ * is handled with a single store that overlaps the previous one. The
+ * non-temporal flavours align the destination first, as required by the
+ * streaming stores.
+ */
+__attribute__((target("avx2"))) static inline void __machnet_copy_avx2(
+    void *dst, const void *src, size_t len) {
+  uint8_t *d = (uint8_t *)dst;
+  const uint8_t *s = (const uint8_t *)src;
+  if (len < 32) {
+    memcpy(d, s, len);
+    return;
+  }
+
+  const __m256i tail = _mm256_loadu_si256((const __m256i *)(s + len - 32));
+  uint8_t *d_tail = d + len - 32;
+  while (len >= 128) {
+    const __m256i y0 = _mm256_loadu_si256((const __m256i *)(s + 0));
+    const __m256i y1 = _mm256_loadu_si256((const __m256i *)(s + 32));
+    const __m256i y2 = _mm256_loadu_si256((const __m256i *)(s + 64));
+    const __m256i y3 = _mm256_loadu_si256((const __m256i *)(s + 96));
+    _mm256_storeu_si256((__m256i *)(d + 0), y0);
+    _mm256_storeu_si256((__m256i *)(d + 32), y1);
+    _mm256_storeu_si256((__m256i *)(d + 64), y2);
+    _mm256_storeu_si256((__m256i *)(d + 96), y3);
+    s += 128;
+    d += 128;
+    len -= 128;
+  }
+  while (len >= 32) {
+    _mm256_storeu_si256((__m256i *)d,
+                        _mm256_loadu_si256((const __m256i *)s));
+    s += 32;
+    d += 32;
+    len -= 32;
+  }
+  _mm256_storeu_si256((__m256i *)d_tail, tail);
+}
+
+__attribute__((target("avx2"))) static inline void __machnet_copy_avx2_nt(
+    void *dst, const void *src, size_t len) {
+  uint8_t *d = (uint8_t *)dst;
+  const uint8_t *s = (const uint8_t *)src;
+  if (len < 256) {
+    __machnet_copy_avx2(d, s, len);
+    return;
+  }
+
+  const __m256i tail = _mm256_loadu_si256((const __m256i *)(s + len - 32));
+  uint8_t *d_tail = d + len - 32;
+  _mm256_storeu_si256((__m256i *)d, _mm256_loadu_si256((const __m256i *)s));
+  const size_t ofs = 32 - ((uintptr_t)d & 31);
+  s += ofs;
+  d += ofs;
+  len -= ofs;
+  while (len >= 128) {
+    const __m256i y0 = _mm256_loadu_si256((const __m256i *)(s + 0));
+    const __m256i y1 = _mm256_loadu_si256((const __m256i *)(s + 32));
+    const __m256i y2 = _mm256_loadu_si256((const __m256i *)(s + 64));
+    const __m256i y3 = _mm256_loadu_si256((const __m256i *)(s + 96));
+    _mm256_stream_si256((__m256i *)(d + 0), y0);
+    _mm256_stream_si256((__m256i *)(d + 32), y1);
+    _mm256_stream_si256((__m256i *)(d + 64), y2);
+    _mm256_stream_si256((__m256i *)(d + 96), y3);
+    s += 128;
+    d += 128;
+    len -= 128;
+  }
+  while (len >= 32) {
+    _mm256_stream_si256((__m256i *)d, _mm256_loadu_si256((const __m256i *)s));
+    s += 32;
+    d += 32;
+    len -= 32;
+  }
+  _mm256_storeu_si256((__m256i *)d_tail, tail);
+}
+
+__attribute__((target("avx512f"))) static inline void __machnet_copy_avx512(
+    void *dst, const void *src, size_t len) {
+  uint8_t *d = (uint8_t *)dst;
+  const uint8_t *s = (const uint8_t *)src;
+  if (len < 64) {
+    __machnet_copy_avx2(d, s, len);
+    return;
+  }
+
+  const __m512i tail = _mm512_loadu_si512(s + len - 64);
+  uint8_t *d_tail = d + len - 64;
+  while (len >= 256) {
+    const __m512i z0 = _mm512_loadu_si512(s + 0);
+    const __m512i z1 = _mm512_loadu_si512(s + 64);
+    const __m512i z2 = _mm512_loadu_si512(s + 128);
+    const __m512i z3 = _mm512_loadu_si512(s + 192);
+    _mm512_storeu_si512(d + 0, z0);
+    _mm512_storeu_si512(d + 64, z1);
+    _mm512_storeu_si512(d + 128, z2);
+    _mm512_storeu_si512(d + 192, z3);
+    s += 256;
+    d += 256;
+    len -= 256;
+  }
+  while (len >= 64) {
+    _mm512_storeu_si512(d, _mm512_loadu_si512(s));
+    s += 64;
+    d += 64;
+    len -= 64;
+  }
+  _mm512_storeu_si512(d_tail, tail);
+}
+
+__attribute__((target("avx512f"))) static inline void __machnet_copy_avx512_nt(
+    void *dst, const void *src, size_t len) {
+  uint8_t *d = (uint8_t *)dst;
+  const uint8_t *s = (const uint8_t *)src;
+  if (len < 512) {
+    __machnet_copy_avx512(d, s, len);
+    return;
+  }
+
+  const __m512i tail = _mm512_loadu_si512(s + len - 64);
+  uint8_t *d_tail = d + len - 64;
+  _mm512_storeu_si512(d, _mm512_loadu_si512(s));
+  const size_t ofs = 64 - ((uintptr_t)d & 63);
+  s += ofs;
+  d += ofs;
+  len -= ofs;
+  while (len >= 256) {
+    const __m512i z0 = _mm512_loadu_si512(s + 0);
+    const __m512i z1 = _mm512_loadu_si512(s + 64);
+    const __m512i z2 = _mm512_loadu_si512(s + 128);
+    const __m512i z3 = _mm512_loadu_si512(s + 192);
+    _mm512_stream_si512((__m512i *)(d + 0), z0);
+    _mm512_stream_si512((__m512i *)(d + 64), z1);
+    _mm512_stream_si512((__m512i *)(d + 128), z2);
+    _mm512_stream_si512((__m512i *)(d + 192), z3);
+    s += 256;
+    d += 256;
+    len -= 256;
+  }
+  while (len >= 64) {
+    _mm512_stream_si512((__m512i *)d, _mm512_loadu_si512(s));
+    s += 64;
+    d += 64;
+    len -= 64;
+  }
+  _mm512_storeu_si512(d_tail, tail);
+}
+#endif  // __x86_64__
+
+#if defined(__aarch64__)
+static inline void __machnet_copy_neon(void *dst, const void *src,
+                                       size_t len) {
+  uint8_t *d = (uint8_t *)dst;
+  const uint8_t *s = (const uint8_t *)src;
+  if (len < 16) {
+    memcpy(d, s, len);
+    return;
+  }
+
+  const uint8x16_t tail = vld1q_u8(s + len - 16);
+  uint8_t *d_tail = d + len - 16;
+  while (len >= 64) {
+    const uint8x16_t q0 = vld1q_u8(s + 0);
+    const uint8x16_t q1 = vld1q_u8(s + 16);
+    const uint8x16_t q2 = vld1q_u8(s + 32);
+    const uint8x16_t q3 = vld1q_u8(s + 48);
+    vst1q_u8(d + 0, q0);
+    vst1q_u8(d + 16, q1);
+    vst1q_u8(d + 32, q2);
+    vst1q_u8(d + 48, q3);
+    s += 64;
+    d += 64;
+    len -= 64;
+  }
+  while (len >= 16) {
+    vst1q_u8(d, vld1q_u8(s));
+    s += 16;
+    d += 16;
+    len -= 16;
+  }
+  vst1q_u8(d_tail, tail);
+}
+
+static inline void __machnet_copy_neon_nt(void *dst, const void *src,
+                                          size_t len) {
+  uint8_t *d = (uint8_t *)dst;
+  const uint8_t *s = (const uint8_t *)src;
+  if (len < 256) {
+    __machnet_copy_neon(d, s, len);
+    return;
+  }
+
+  // STNP (store pair, non-temporal hint) of two Q registers.
+  const uint8x16_t tail = vld1q_u8(s + len - 16);
+  uint8_t *d_tail = d + len - 16;
+  while (len >= 64) {
+    const uint8x16_t q0 = vld1q_u8(s + 0);
+    const uint8x16_t q1 = vld1q_u8(s + 16);
+    const uint8x16_t q2 = vld1q_u8(s + 32);
+    const uint8x16_t q3 = vld1q_u8(s + 48);
+    __asm__ volatile("stnp %q1, %q2, [%0]" ::"r"(d), "w"(q0), "w"(q1)
+                     : "memory");
+    __asm__ volatile("stnp %q1, %q2, [%0, #32]" ::"r"(d), "w"(q2), "w"(q3)
+                     : "memory");
+    s += 64;
+    d += 64;
+    len -= 64;
+  }
+  while (len >= 16) {
+    vst1q_u8(d, vld1q_u8(s));
+    s += 16;
+    d += 16;
+    len -= 16;
+  }
+  vst1q_u8(d_tail, tail);
+}
+#endif  // __aarch64__
+
+/**
+ * Check whether a copy kernel can be used on this CPU.
+ *
+ * @param kernel             The copy kernel.
+ * @return                   1 if supported, 0 otherwise.
+ */
+static inline int __machnet_copy_kernel_supported(
+    enum machnet_copy_kernel kernel) {
+  switch (kernel) {
+    case MACHNET_COPY_KERNEL_LIBC:
+      return 1;
+#if defined(__x86_64__)
+    case MACHNET_COPY_KERNEL_AVX2:
+      __builtin_cpu_init();
+      return __builtin_cpu_supports("avx2");
+    case MACHNET_COPY_KERNEL_AVX512:
+      __builtin_cpu_init();
+      return __builtin_cpu_supports("avx512f");
+#elif defined(__aarch64__)
+    case MACHNET_COPY_KERNEL_NEON:
+      return 1;  // NEON is mandatory on AArch64.
+#endif
+    default:
+      return 0;
+  }
+}
+
+/**
+ * Get the human-readable name of a copy kernel.
+ */
+static inline const char *__machnet_copy_kernel_name(
+    enum machnet_copy_kernel kernel) {
+  switch (kernel) {
+    case MACHNET_COPY_KERNEL_LIBC:
+      return "libc";
+    case MACHNET_COPY_KERNEL_AVX2:
+      return "avx2";
+    case MACHNET_COPY_KERNEL_AVX512:
+      return "avx512";
+    case MACHNET_COPY_KERNEL_NEON:
+      return "neon";
+    default:
+      return "unknown";
+  }
+}
+
+/**
+ * Get the function implementing a copy kernel.
+ *
+ * @param kernel             The copy kernel.
+ * @param nt                 Whether to get the non-temporal flavour.
+ * @return                   The copy function, or NULL if the kernel is not
+ *                           available in this build.
+ */
+static inline machnet_copy_fn_t __machnet_copy_kernel_fn(
+    enum machnet_copy_kernel kernel, int nt) {
+  switch (kernel) {
+    case MACHNET_COPY_KERNEL_LIBC:
+      return __machnet_copy_libc;
+#if defined(__x86_64__)
+    case MACHNET_COPY_KERNEL_AVX2:
+      return nt ? __machnet_copy_avx2_nt : __machnet_copy_avx2;
+    case MACHNET_COPY_KERNEL_AVX512:
+      return nt ? __machnet_copy_avx512_nt : __machnet_copy_avx512;
+#elif defined(__aarch64__)
+    case MACHNET_COPY_KERNEL_NEON:
+      return nt ? __machnet_copy_neon_nt : __machnet_copy_neon;
+#endif
+    default:
+      return NULL;
+  }
+}
+
+/**
+ * Pick the best copy kernel for this CPU, and the non-temporal copy threshold.
+ * This is called lazily on the first copy.
+ */
+static inline void __machnet_copy_init(void) {
+  struct MachnetCopyCtx *ctx = &__machnet_copy_ctx;
+
+  const enum machnet_copy_kernel kPreference[] = {
+      MACHNET_COPY_KERNEL_AVX512, MACHNET_COPY_KERNEL_AVX2,
+      MACHNET_COPY_KERNEL_NEON, MACHNET_COPY_KERNEL_LIBC};
+  for (size_t i = 0; i < sizeof(kPreference) / sizeof(kPreference[0]); i++) {
+    if (__machnet_copy_kernel_supported(kPreference[i])) {
+      ctx->kernel = kPreference[i];
+      break;
+    }
+  }
+  const char *kernel_env = getenv(MACHNET_COPY_KERNEL_ENV);
+  if (kernel_env != NULL) {
+    for (int k = 0; k < MACHNET_COPY_KERNEL_NR; k++) {
+      const enum machnet_copy_kernel kernel = (enum machnet_copy_kernel)k;
+      if (strcmp(kernel_env, __machnet_copy_kernel_name(kernel)) == 0 &&
+          __machnet_copy_kernel_supported(kernel)) {
+        ctx->kernel = kernel;
+        break;
+      }
+    }
+  }
+  ctx->copy = __machnet_copy_kernel_fn(ctx->kernel, 0);
+  ctx->copy_nt = __machnet_copy_kernel_fn(ctx->kernel, 1);
+
+  ctx->nt_threshold = MACHNET_COPY_NT_THRESHOLD_DEFAULT;
+#if defined(_SC_LEVEL3_CACHE_SIZE)
+  const long llc_size = sysconf(_SC_LEVEL3_CACHE_SIZE);
+  if (llc_size > 0) ctx->nt_threshold = llc_size / 2;
+#endif
+  const char *threshold_env = getenv(MACHNET_COPY_NT_THRESHOLD_ENV);
+  if (threshold_env != NULL && *threshold_env != '\0')
+    ctx->nt_threshold = strtoull(threshold_env, NULL, 0);
+
+  __sync_synchronize();
+  ctx->initialized = 1;
+}
+
+/**
+ * Return the size (in bytes) above which transfers use non-temporal stores.
+ */
+static inline size_t __machnet_copy_nt_threshold(void) {
+  if (__builtin_expect(!__machnet_copy_ctx.initialized, 0))
+    __machnet_copy_init();
+  return __machnet_copy_ctx.nt_threshold;
+}
+
+/**
+ * Decide whether a transfer should use non-temporal stores.
+ *
+ * @param total_len          Total size of the transfer (e.g., of a message that
+ *                           is copied in several chunks).
+ * @return                   1 if the transfer should be non-temporal.
+ */
+static inline int __machnet_copy_use_nt(size_t total_len) {
+  return total_len >= __machnet_copy_nt_threshold();
+}
+
+/**
+ * Copy `len' bytes from `src' to `dst' (non-overlapping) with the best kernel
+ * for this CPU.
+ *
+ * @param dst                Destination address.
+ * @param src                Source address.
+ * @param len                Number of bytes to copy.
+ * @param nt                 Use non-temporal stores. The caller must issue
+ *                           `__machnet_copy_fence()' before publishing the
+ *                           data to another thread.
+ */
+static inline void __machnet_copy(void *dst, const void *src, size_t len,
+                                  int nt) {
+  if (__builtin_expect(!__machnet_copy_ctx.initialized, 0))
+    __machnet_copy_init();
+  if (nt)
+    __machnet_copy_ctx.copy_nt(dst, src, len);
+  else
+    __machnet_copy_ctx.copy(dst, src, len);
+}
+
+/**
+ * Order non-temporal stores issued with `__machnet_copy()' before any
+ * subsequent stores (e.g., a ring enqueue).
+ *
+ * @param nt                 Whether non-temporal copies were used.
+ */
+static inline void __machnet_copy_fence(int nt) {
+  if (!nt) return;
+#if defined(__x86_64__)
+  _mm_sfence();
+#elif defined(__aarch64__)
+  __asm__ volatile("dmb ishst" ::: "memory");
+#else
+  __sync_synchronize();
+#endif
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // SRC_EXT_MACHNET_COPY_H_
@@ -28,19 +28,120 @@ typedef struct machnet_app_info machnet_app_info_t;
  *
  * @var machnet_channel_info::channel_uuid     The UUID of the application that
  * is requesting a new channel.
- * @var machnet_channel_info::desc_ring_size   The depth of the descriptor rings
- * (Machnet, App).
- * @var machnet_channel_info::buffer_count     The size of the buffer pool.
+ * @var machnet_channel_info::opts             The requested sizing of the
+ * channel (rings, buffer pools).
  */
 struct machnet_channel_info {
   uuid_t channel_uuid;
-#define MACHNET_CHANNEL_INFO_DESC_RING_SIZE_DEFAULT 1024
-  uint32_t desc_ring_size;
-#define MACHNET_CHANNEL_INFO_BUFFER_COUNT_DEFAULT 4096
-  uint32_t buffer_count;
+  MachnetChannelOpts_t opts;
 } __attribute__((packed));
 typedef struct machnet_channel_info machnet_channel_info_t;
 
+/**
+ * @struct machnet_segment_info
+ * @brief This struct is used to request the file descriptor of an extension
+ * segment of a channel (see `MachnetChannelBufClass'), so that the application
+ * can map it.
+ *
+ * @var machnet_segment_info::channel_uuid     The UUID of the channel.
+ * @var machnet_segment_info::buf_class        The buffer class of the segment.
+ */
+struct machnet_segment_info {
+  uuid_t channel_uuid;
+  uint32_t buf_class;
+} __attribute__((packed));
+typedef struct machnet_segment_info machnet_segment_info_t;
+
+/**
+ * @struct machnet_status_info
+ * @brief Carried by the response to a status request: the controller follows
+ * the response message with a human-readable status report of the engines.
+ * The response to a port statistics request is the same, but the report has
+ * one "<port id> <name> <value>" line per extended statistic of each port.
+ *
+ * @var machnet_status_info::length            Length of the report in bytes.
+ */
+struct machnet_status_info {
+  uint32_t length;
+} __attribute__((packed));
+typedef struct machnet_status_info machnet_status_info_t;
+
+/**
+ * @struct machnet_trace_info
+ * @brief This struct is used to set the classes of transport events the
+ * engines trace, and/or to fetch their trace rings. A dump is returned like a
+ * status report (see `machnet_status_info'); its format is in `trace.h'.
+ *
+ * @var machnet_trace_info::flags     MACHNET_TRACE_SET_CLASSES and/or
+ *                                    MACHNET_TRACE_DUMP.
+ * @var machnet_trace_info::classes   Mask of classes to enable, if setting.
+ */
+struct machnet_trace_info {
+#define MACHNET_TRACE_SET_CLASSES 0x1
+#define MACHNET_TRACE_DUMP 0x2
+  uint32_t flags;
+  uint32_t classes;
+} __attribute__((packed));
+typedef struct machnet_trace_info machnet_trace_info_t;
+
+/**
+ * @struct machnet_capture_info
+ * @brief This struct is used to start or stop capturing the packets the
+ * engines receive and send. A start request carries the descriptor of the
+ * file to write the capture to, in pcapng format. A capture stops on a stop
+ * request, once `max_packets' have been captured, or when the connection that
+ * started it closes. The response to a stop request is followed by a summary
+ * of the capture, like a status report (see `machnet_status_info').
+ *
+ * @var machnet_capture_info::flags        MACHNET_CAPTURE_START or
+ *                                         MACHNET_CAPTURE_STOP.
+ * @var machnet_capture_info::snaplen      Bytes captured per packet, at most.
+ * @var machnet_capture_info::max_packets  Packets to capture (0: no limit).
+ * @var machnet_capture_info::filter       Filter expression (see
+ *                                         `CaptureFilter'), NUL-terminated.
+ */
+struct machnet_capture_info {
+#define MACHNET_CAPTURE_START 0x1
+#define MACHNET_CAPTURE_STOP 0x2
+  uint32_t flags;
+  uint32_t snaplen;
+  uint64_t max_packets;
+  char filter[112];
+} __attribute__((packed));
+typedef struct machnet_capture_info machnet_capture_info_t;
+
+/**
+ * @struct machnet_route_info
+ * @brief This struct is used to change the routing of the interfaces at
+ * runtime: add or remove routes (see `RoutingTable'), and pin or unpin the
+ * MAC addresses of neighbours. A list request returns the routes and the
+ * neighbours of the interfaces like a status report (see
+ * `machnet_status_info'). Addresses are in host byte order.
+ *
+ * @var machnet_route_info::op          One of MACHNET_ROUTE_*.
+ * @var machnet_route_info::local_ip    IP address of the interface to change;
+ *                                      0 for all of them.
+ * @var machnet_route_info::dst_ip      Prefix of the route, or address of the
+ *                                      neighbour.
+ * @var machnet_route_info::gateway_ip  Gateway of the route; 0 if on-link.
+ * @var machnet_route_info::prefix_len  Length of the prefix of the route.
+ * @var machnet_route_info::l2_addr     MAC address to pin the neighbour to.
+ */
+struct machnet_route_info {
+#define MACHNET_ROUTE_ADD 0x1
+#define MACHNET_ROUTE_DEL 0x2
+#define MACHNET_ROUTE_PIN_NEIGHBOR 0x3
+#define MACHNET_ROUTE_UNPIN_NEIGHBOR 0x4
+#define MACHNET_ROUTE_LIST 0x5
+  uint32_t op;
+  uint32_t local_ip;
+  uint32_t dst_ip;
+  uint32_t gateway_ip;
+  uint8_t prefix_len;
+  uint8_t l2_addr[6];
+} __attribute__((packed));
+typedef struct machnet_route_info machnet_route_info_t;
+
 /**
  * @struct machnet_ctrl_resp
  */
@@ -60,6 +161,12 @@ struct machnet_ctrl_msg {
 #define MACHNET_CTRL_MSG_TYPE_REQ_CHANNEL 0x02
 #define MACHNET_CTRL_MSG_TYPE_REQ_FLOW 0x03
 #define MACHNET_CTRL_MSG_TYPE_REQ_LISTEN 0x04
+#define MACHNET_CTRL_MSG_TYPE_REQ_SEGMENT 0x05
+#define MACHNET_CTRL_MSG_TYPE_REQ_STATUS 0x06
+#define MACHNET_CTRL_MSG_TYPE_REQ_PORT_STATS 0x07
+#define MACHNET_CTRL_MSG_TYPE_REQ_TRACE 0x08
+#define MACHNET_CTRL_MSG_TYPE_REQ_CAPTURE 0x09
+#define MACHNET_CTRL_MSG_TYPE_REQ_ROUTE 0x0A
 #define MACHNET_CTRL_MSG_TYPE_RESPONSE 0x10
   uint16_t type;
   uint32_t msg_id;
@@ -68,6 +175,11 @@ struct machnet_ctrl_msg {
   union {
     machnet_app_info_t app_info;
     machnet_channel_info_t channel_info;
+    machnet_segment_info_t segment_info;
+    machnet_status_info_t status_info;
+    machnet_trace_info_t trace_info;
+    machnet_capture_info_t capture_info;
+    machnet_route_info_t route_info;
   };
 } __attribute__((packed));
 typedef struct machnet_ctrl_msg machnet_ctrl_msg_t;
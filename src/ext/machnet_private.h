@@ -34,43 +34,65 @@ extern "C" {
 #define ROUNDUP_U64_POW2(x) (1ULL << (64 - __builtin_clzll(((uint64_t)x) - 1)))
 
 /**
- * Calculate the memory size needed for an Machnet Dataplane channel.
+ * Return the total size of each buffer of a class (incl. metadata), given the
+ * usable buffer size.
+ */
+static inline size_t __machnet_channel_buf_total_size(size_t buffer_size) {
+  return ROUNDUP_U64_POW2(buffer_size + MACHNET_MSGBUF_SPACE_RESERVED +
+                          MACHNET_MSGBUF_HEADROOM_MAX);
+}
+
+/**
+ * Calculate the memory size needed for an Machnet Dataplane channel with
+ * multiple buffer size classes.
  *
  * An Machnet Dataplane channel contains two rings for message passing in each
- * direction (Machnet -> Application, Application -> NSaas), and one ring that
- * holds free buffers (used for allocations).
+ * direction (Machnet -> Application, Application -> NSaas), one ring for TX
+ * completions (Machnet -> Application, same number of slots as the Application
+ * ring), and one ring per buffer class that holds free buffers (used for
+ * allocations).
  *
  * This function returns the number of bytes needed for the channel area, given
  * the number of elements in each of the rings of the channel and the desired
- * buffer size.
+ * buffer classes.
  *
  * @param machnet_ring_slot_nr The number of Machnet->App messaging ring slots
  * (must be power of 2).
  * @param app_ring_slot_nr   The number of App->Machnet messaging ring slots
  * (must be power of 2).
- * @param buf_ring_slot_nr   The number of buffers + 1 in the pool (must be
- *                           power of 2).
- * @param buffer_size        The usable size of each buffer.
+ * @param buf_classes        The buffer classes. The first one is the default
+ *                           class, used by Machnet on the receive path; its
+ *                           buffers cannot be larger than a page.
+ * @param buf_class_nr       Number of buffer classes (at most
+ *                           `MACHNET_CHANNEL_BUF_CLASS_MAX').
  * @param is_posix_shm       Whether the channel will be a POSIX shared memory.
  * @return
  *   - The memory size in bytes needed for the Machnet channel on success.
- *   - (size_t)-1 - Some parameter is not a power of 2, or the buffer size is
- *                  bad (too big).
+ *   - (size_t)-1 - Some parameter is not a power of 2, or a buffer class is
+ *                  bad (e.g., too big).
  */
-static inline size_t __machnet_channel_dataplane_calculate_size(
+static inline size_t __machnet_channel_dataplane_calculate_size_ex(
     size_t machnet_ring_slot_nr, size_t app_ring_slot_nr,
-    size_t buf_ring_slot_nr, size_t buffer_size, int is_posix_shm) {
+    const MachnetChannelBufClassConf_t *buf_classes, size_t buf_class_nr,
+    int is_posix_shm) {
   // Check that all parameters are power of 2.
-  if (!IS_POW2(machnet_ring_slot_nr) || !IS_POW2(app_ring_slot_nr) ||
-      !IS_POW2(buf_ring_slot_nr))
+  if (!IS_POW2(machnet_ring_slot_nr) || !IS_POW2(app_ring_slot_nr)) return -1;
+  if (buf_classes == NULL || buf_class_nr == 0 ||
+      buf_class_nr > MACHNET_CHANNEL_BUF_CLASS_MAX)
     return -1;
 
-  const size_t total_buffer_size =
-      ROUNDUP_U64_POW2(buffer_size + MACHNET_MSGBUF_SPACE_RESERVED +
-                       MACHNET_MSGBUF_HEADROOM_MAX);
-
   const size_t kPageSize = (is_posix_shm ? getpagesize() : HUGE_PAGE_2M_SIZE);
-  if (buffer_size > kPageSize) return -1;
+  for (size_t i = 0; i < buf_class_nr; i++) {
+    const size_t buf_ring_slot_nr = buf_classes[i].buf_ring_slot_nr;
+    const size_t buffer_size = buf_classes[i].buffer_size;
+    if (!IS_POW2(buf_ring_slot_nr) || buffer_size == 0) return -1;
+    if (buf_ring_slot_nr > MACHNET_MSGBUF_INDEX_MASK) return -1;
+    // Packet-sized buffers must not cross a page boundary; larger classes are
+    // only limited by the huge page size.
+    if (i == 0 && buffer_size > kPageSize) return -1;
+    if (__machnet_channel_buf_total_size(buffer_size) > HUGE_PAGE_2M_SIZE)
+      return -1;
+  }
 
   // Add the size of the channel's header.
   size_t total_size = sizeof(MachnetChannelCtx_t);
@@ -88,9 +110,8 @@ static inline size_t __machnet_channel_dataplane_calculate_size(
     total_size += acc;
   }
 
-  // Add the size of the rings (Machnet, Application, BufferRing).
-  size_t data_ring_sizes[] = {machnet_ring_slot_nr, app_ring_slot_nr,
-                              buf_ring_slot_nr};
+  // Add the size of the rings (Machnet, Application).
+  size_t data_ring_sizes[] = {machnet_ring_slot_nr, app_ring_slot_nr};
   for (size_t i = 0; i < COUNT_OF(data_ring_sizes); i++) {
     size_t acc =
         jring_get_buf_ring_size(sizeof(MachnetRingSlot_t), data_ring_sizes[i]);
@@ -98,16 +119,31 @@ static inline size_t __machnet_channel_dataplane_calculate_size(
     total_size += acc;
   }
 
-  // Align to cache line boundary, and add the size of the scratch buffer index
-  // table.
-  total_size = ALIGN_TO_BOUNDARY(total_size, CACHE_LINE_SIZE);
-  total_size += buf_ring_slot_nr * sizeof(MachnetRingSlot_t);
+  // Add the size of the TX completion ring.
+  size_t acc = jring_get_buf_ring_size(sizeof(MachnetTxCompletion_t),
+                                       app_ring_slot_nr);
+  if (acc == (size_t)-1) return -1;
+  total_size += acc;
+
+  // Add the size of the buffer rings.
+  for (size_t i = 0; i < buf_class_nr; i++) {
+    acc = jring_get_buf_ring_size(sizeof(MachnetRingSlot_t),
+                                  buf_classes[i].buf_ring_slot_nr);
+    if (acc == (size_t)-1) return -1;
+    total_size += acc;
+  }
 
   // Align to page boundary.
   total_size = ALIGN_TO_BOUNDARY(total_size, kPageSize);
 
-  // Add the size of the buffers.
-  total_size += buf_ring_slot_nr * total_buffer_size;
+  // Add the size of the buffers. Each pool is aligned to its buffer size, so
+  // that buffers never cross a page boundary.
+  for (size_t i = 0; i < buf_class_nr; i++) {
+    const size_t total_buffer_size =
+        __machnet_channel_buf_total_size(buf_classes[i].buffer_size);
+    total_size = ALIGN_TO_BOUNDARY(total_size, total_buffer_size);
+    total_size += buf_classes[i].buf_ring_slot_nr * total_buffer_size;
+  }
 
   // Align to page boundary.
   total_size = ALIGN_TO_BOUNDARY(total_size, kPageSize);
@@ -116,7 +152,124 @@ static inline size_t __machnet_channel_dataplane_calculate_size(
 }
 
 /**
- * Initialiaze an Machnet Dataplane channel.
+ * Calculate the memory size needed for an Machnet Dataplane channel with a
+ * single buffer class.
+ *
+ * @param machnet_ring_slot_nr The number of Machnet->App messaging ring slots
+ * (must be power of 2).
+ * @param app_ring_slot_nr   The number of App->Machnet messaging ring slots
+ * (must be power of 2).
+ * @param buf_ring_slot_nr   The number of buffers + 1 in the pool (must be
+ *                           power of 2).
+ * @param buffer_size        The usable size of each buffer.
+ * @param is_posix_shm       Whether the channel will be a POSIX shared memory.
+ * @return
+ *   - The memory size in bytes needed for the Machnet channel on success.
+ *   - (size_t)-1 - Some parameter is not a power of 2, or the buffer size is
+ *                  bad (too big).
+ */
+static inline size_t __machnet_channel_dataplane_calculate_size(
+    size_t machnet_ring_slot_nr, size_t app_ring_slot_nr,
+    size_t buf_ring_slot_nr, size_t buffer_size, int is_posix_shm) {
+  const MachnetChannelBufClassConf_t buf_class = {
+      .buf_ring_slot_nr = buf_ring_slot_nr, .buffer_size = buffer_size};
+  return __machnet_channel_dataplane_calculate_size_ex(
+      machnet_ring_slot_nr, app_ring_slot_nr, &buf_class, 1, is_posix_shm);
+}
+
+/**
+ * Initialize the free ring and the buffers of a buffer class, and make all the
+ * buffers available. The ring and pool offsets of the class must be set.
+ *
+ * @param ctx                Channel's context.
+ * @param cls                The buffer class.
+ * @param buf_ring_slot_nr   The number of buffers + 1 (must be power of 2).
+ * @param buffer_size        The usable size of each buffer.
+ * @return                   '0' on success, '-1' on failure.
+ */
+static inline int __machnet_channel_buf_class_init(MachnetChannelCtx_t *ctx,
+                                                   uint32_t cls,
+                                                   size_t buf_ring_slot_nr,
+                                                   size_t buffer_size) {
+  const int kMultiThread = 1;
+  MachnetChannelBufClass_t *buf_class = &ctx->data_ctx.buf_classes[cls];
+  jring_t *buf_ring = __machnet_channel_class_buf_ring(ctx, cls);
+  int ret = jring_init(buf_ring, buf_ring_slot_nr, sizeof(MachnetRingSlot_t),
+                       kMultiThread, kMultiThread);
+  if (ret != 0) return ret;
+
+  // Calculate the actual buffer size (incl. metadata).
+  const size_t kTotalBufSize = __machnet_channel_buf_total_size(buffer_size);
+  buf_class->buf_nr = buf_ring->capacity;
+  buf_class->buf_size = kTotalBufSize;
+  buf_class->buf_mss = buffer_size;
+
+  // Initialize the message header of each buffer.
+  for (uint32_t i = 0; i < buf_ring->capacity; i++) {
+    const uint32_t index = MACHNET_MSGBUF_INDEX(cls, i);
+    MachnetMsgBuf_t *buf = __machnet_channel_buf(ctx, index);
+    __machnet_channel_buf_init(buf);
+    // The following fields should only be initialized once here.
+    *__DECONST(uint32_t *, &buf->magic) = MACHNET_MSGBUF_MAGIC;
+    *__DECONST(uint32_t *, &buf->index) = index;
+    *__DECONST(uint32_t *, &buf->size) =
+        buffer_size + MACHNET_MSGBUF_HEADROOM_MAX;
+  }
+
+  // Initialize the buffer index table, and make all these buffers available.
+  MachnetRingSlot_t *buf_index_table = (MachnetRingSlot_t *)malloc(
+      buf_ring->capacity * sizeof(MachnetRingSlot_t));
+  if (buf_index_table == NULL) return -1;
+
+  for (size_t i = 0; i < buf_ring->capacity; i++)
+    buf_index_table[i] = MACHNET_MSGBUF_INDEX(cls, i);
+
+  unsigned int free_space;
+  int enqueued = jring_enqueue_bulk(buf_ring, buf_index_table,
+                                    buf_ring->capacity, &free_space);
+  free(buf_index_table);
+  if (((size_t)enqueued != buf_ring->capacity) || (free_space != 0))
+    return -1;  // Enqueue has failed.
+
+  return 0;
+}
+
+/**
+ * Sort the buffer classes of a channel for the allocator: active classes
+ * first, by ascending buffer size. Among classes of the same size, extension
+ * segments come first, so that the original class (which the allocator visits
+ * last-to-first) is preferred.
+ *
+ * The application may read the order while it is being updated; at worst it
+ * skips or revisits a class for one allocation.
+ *
+ * @param ctx                Channel's context.
+ */
+static inline void __machnet_channel_buf_class_order_update(
+    MachnetChannelCtx_t *ctx) {
+  const MachnetChannelBufClass_t *buf_classes = ctx->data_ctx.buf_classes;
+  uint8_t order[MACHNET_CHANNEL_BUF_CLASS_MAX];
+  for (uint32_t cls = 0; cls < MACHNET_CHANNEL_BUF_CLASS_MAX; cls++) {
+    const int active =
+        buf_classes[cls].state == MACHNET_CHANNEL_BUF_CLASS_ACTIVE;
+    uint32_t i = cls;
+    for (; i > 0; i--) {
+      const uint32_t prev = order[i - 1];
+      const int prev_active =
+          buf_classes[prev].state == MACHNET_CHANNEL_BUF_CLASS_ACTIVE;
+      if (prev_active > active) break;
+      if (prev_active == active &&
+          buf_classes[prev].buf_mss < buf_classes[cls].buf_mss)
+        break;
+      order[i] = prev;
+    }
+    order[i] = cls;
+  }
+  memcpy(ctx->data_ctx.buf_class_order, order, sizeof(order));
+}
+
+/**
+ * Initialiaze an Machnet Dataplane channel with multiple buffer size classes.
  *
  * This function initializes the memory of an Machnet Dataplane channel. It
  * initializes the context, the rings and buffers required to facilitate
@@ -129,19 +282,20 @@ static inline size_t __machnet_channel_dataplane_calculate_size(
  * @param name               The name of the channel.
  * @param machnet_ring_slot_nr The number of Machnet->App messaging ring slots.
  * @param app_ring_slot_nr   The number of App->Machnet messaging ring slots.
- * @param buf_ring_slot_nr   The number of buffers + 1 to be used in this
- *                           channel (must sum up to a power of 2).
- * @param buffer_size        The size of each buffer.
+ * @param buf_classes        The buffer classes (see
+ *                           `__machnet_channel_dataplane_calculate_size_ex()').
+ * @param buf_class_nr       Number of buffer classes.
  * @param is_multithread     1 if Machnet is using multiple threads per channel,
  * 0 otherwise.
  * @return                   '0' on success, '-1' on failure.
  */
-static inline int __machnet_channel_dataplane_init(
+static inline int __machnet_channel_dataplane_init_ex(
     uchar_t *shm, size_t shm_size, int is_posix_shm, const char *name,
     size_t machnet_ring_slot_nr, size_t app_ring_slot_nr,
-    size_t buf_ring_slot_nr, size_t buffer_size, int is_multithread) {
-  size_t total_size = __machnet_channel_dataplane_calculate_size(
-      machnet_ring_slot_nr, app_ring_slot_nr, buf_ring_slot_nr, buffer_size,
+    const MachnetChannelBufClassConf_t *buf_classes, size_t buf_class_nr,
+    int is_multithread) {
+  size_t total_size = __machnet_channel_dataplane_calculate_size_ex(
+      machnet_ring_slot_nr, app_ring_slot_nr, buf_classes, buf_class_nr,
       is_posix_shm);
   // Guard against mismatches.
   if (total_size > shm_size || total_size == (size_t)-1) return -1;
@@ -159,15 +313,12 @@ static inline int __machnet_channel_dataplane_init(
 
   // Initiliaze the ctrl context.
   ctx->ctrl_ctx.req_id = 0;
-
-  // Initialize buffer cache
-  ctx->app_buffer_cache.count = 0;
+  ctx->ctrl_ctx.segment_gen = 0;
+  ctx->ctrl_ctx.app_segment_gen = 0;
 
   // Clear out statatistics.
   ctx->data_ctx.stats_ofs = sizeof(*ctx);
-  MachnetChannelStats_t *stats =
-      (MachnetChannelStats_t *)__machnet_channel_mem_ofs(
-          ctx, ctx->data_ctx.stats_ofs);
+  MachnetChannelStats_t *stats = __machnet_channel_stats(ctx);
   memset(stats, 0, sizeof(*stats));
 
   const int kMultiThread = 1;  // Assume the application always multithreaded.
@@ -209,67 +360,65 @@ static inline int __machnet_channel_dataplane_init(
                    kMultiThread, is_multithread);
   if (ret != 0) return ret;
 
-  // jring_get_buf_ring_size() cannot fail here.
-  ctx->data_ctx.buf_ring_ofs =
+  // TX completion ring follows immediately after the App->Machnet ring.
+  ctx->data_ctx.completion_ring_ofs =
       ctx->data_ctx.app_ring_ofs +
       jring_get_buf_ring_size(sizeof(MachnetRingSlot_t), app_ring_slot_nr);
-
-  // Initialize the buffer ring.
-  jring_t *buf_ring = __machnet_channel_buf_ring(ctx);
-  ret = jring_init(buf_ring, buf_ring_slot_nr, sizeof(MachnetRingSlot_t),
-                   kMultiThread, kMultiThread);
+  jring_t *completion_ring = __machnet_channel_completion_ring(ctx);
+  ret = jring_init(completion_ring, app_ring_slot_nr,
+                   sizeof(MachnetTxCompletion_t), is_multithread,
+                   kMultiThread);
   if (ret != 0) return ret;
 
-  // Offset in memory channel where the final ring ends (buf_ring).
-  size_t buf_ring_end_ofs =
-      ctx->data_ctx.buf_ring_ofs +
-      jring_get_buf_ring_size(sizeof(MachnetRingSlot_t), buf_ring_slot_nr);
-
-  // Offset in memory, of the scratch buffer index table.
-  ctx->data_ctx.buffer_index_table_ofs =
-      ALIGN_TO_BOUNDARY(buf_ring_end_ofs, CACHE_LINE_SIZE);
-  size_t tmp_buffer_index_table_end_ofs =
-      ctx->data_ctx.buffer_index_table_ofs +
-      buf_ring_slot_nr * sizeof(MachnetRingSlot_t);
-
-  // Calculate the actual buffer size (incl. metadata).
-  const size_t kTotalBufSize =
-      ROUNDUP_U64_POW2(buffer_size + MACHNET_MSGBUF_SPACE_RESERVED +
-                       MACHNET_MSGBUF_HEADROOM_MAX);
+  // The buffer rings follow immediately after the TX completion ring.
+  // jring_get_buf_ring_size() cannot fail here.
+  ctx->data_ctx.buf_class_nr = buf_class_nr;
+  size_t ofs =
+      ctx->data_ctx.completion_ring_ofs +
+      jring_get_buf_ring_size(sizeof(MachnetTxCompletion_t), app_ring_slot_nr);
+  for (uint32_t cls = 0; cls < buf_class_nr; cls++) {
+    ctx->data_ctx.buf_classes[cls].buf_ring_ofs = ofs;
+    ofs += jring_get_buf_ring_size(sizeof(MachnetRingSlot_t),
+                                   buf_classes[cls].buf_ring_slot_nr);
+  }
 
   // Initialize the buffers. Note that the buffer pool start is aligned to the
-  // page_size boundary.
+  // page_size boundary, and each class' pool to its buffer size.
   const size_t kPageSize = is_posix_shm ? getpagesize() : HUGE_PAGE_2M_SIZE;
-  ctx->data_ctx.buf_pool_ofs =
-      ALIGN_TO_BOUNDARY(tmp_buffer_index_table_end_ofs, kPageSize);
-  ctx->data_ctx.buf_pool_mask = buf_ring->capacity;
-  ctx->data_ctx.buf_size = kTotalBufSize;
-  ctx->data_ctx.buf_mss = buffer_size;
-
-  // Initialize the message header of each buffer.
-  for (uint32_t i = 0; i < buf_ring->capacity; i++) {
-    MachnetMsgBuf_t *buf = __machnet_channel_buf(ctx, i);
-    __machnet_channel_buf_init(buf);
-    // The following fields should only be initialized once here.
-    *__DECONST(uint32_t *, &buf->magic) = MACHNET_MSGBUF_MAGIC;
-    *__DECONST(uint32_t *, &buf->index) = i;
-    *__DECONST(uint32_t *, &buf->size) =
-        buffer_size + MACHNET_MSGBUF_HEADROOM_MAX;
+  ctx->data_ctx.buf_pool_ofs = ALIGN_TO_BOUNDARY(ofs, kPageSize);
+  ofs = ctx->data_ctx.buf_pool_ofs;
+  for (uint32_t cls = 0; cls < buf_class_nr; cls++) {
+    MachnetChannelBufClass_t *buf_class = &ctx->data_ctx.buf_classes[cls];
+    const size_t kTotalBufSize =
+        __machnet_channel_buf_total_size(buf_classes[cls].buffer_size);
+
+    ofs = ALIGN_TO_BOUNDARY(ofs, kTotalBufSize);
+    buf_class->buf_pool_ofs = ofs;
+    buf_class->segment_size = 0;
+    buf_class->parent = cls;
+    ret = __machnet_channel_buf_class_init(ctx, cls,
+                                           buf_classes[cls].buf_ring_slot_nr,
+                                           buf_classes[cls].buffer_size);
+    if (ret != 0) return ret;
+    buf_class->state = MACHNET_CHANNEL_BUF_CLASS_ACTIVE;
+    ofs += buf_classes[cls].buf_ring_slot_nr * kTotalBufSize;
+  }
+  ctx->data_ctx.buf_pool_size = ofs - ctx->data_ctx.buf_pool_ofs;
+
+  // The remaining class slots are free for extension segments. Their pools
+  // start at the beginning of their slots, which keeps the pools in class
+  // order.
+  for (uint32_t cls = buf_class_nr; cls < MACHNET_CHANNEL_BUF_CLASS_MAX;
+       cls++) {
+    MachnetChannelBufClass_t *buf_class = &ctx->data_ctx.buf_classes[cls];
+    memset(buf_class, 0, sizeof(*buf_class));
+    buf_class->buf_pool_ofs = __machnet_channel_segment_ofs(ctx, cls);
+    buf_class->buf_ring_ofs = buf_class->buf_pool_ofs;
+    buf_class->state = MACHNET_CHANNEL_BUF_CLASS_FREE;
   }
 
-  // Initialize the buffer index table, and make all these buffers available.
-  MachnetRingSlot_t *buf_index_table = (MachnetRingSlot_t *)malloc(
-      buf_ring->capacity * sizeof(MachnetRingSlot_t));
-  if (buf_index_table == NULL) return -1;
-
-  for (size_t i = 0; i < buf_ring->capacity; i++) buf_index_table[i] = i;
-
-  unsigned int free_space;
-  int enqueued = jring_enqueue_bulk(buf_ring, buf_index_table,
-                                    buf_ring->capacity, &free_space);
-  free(buf_index_table);
-  if (((size_t)enqueued != buf_ring->capacity) || (free_space != 0))
-    return -1;  // Enqueue has failed.
+  // Sort the classes by buffer size, for the allocator.
+  __machnet_channel_buf_class_order_update(ctx);
 
   // Set the header magic at the end.
   __sync_synchronize();
@@ -279,6 +428,34 @@ static inline int __machnet_channel_dataplane_init(
   return 0;
 }
 
+/**
+ * Initialiaze an Machnet Dataplane channel with a single buffer class.
+ *
+ * @param shm                Pointer to the shared memory area.
+ * @param shm_size           Size of the shared memory area.
+ * @param is_posix_shm       Whether the channel is based on POSIX shared
+ *                           memory(1, or 0 otherwise).
+ * @param name               The name of the channel.
+ * @param machnet_ring_slot_nr The number of Machnet->App messaging ring slots.
+ * @param app_ring_slot_nr   The number of App->Machnet messaging ring slots.
+ * @param buf_ring_slot_nr   The number of buffers + 1 to be used in this
+ *                           channel (must sum up to a power of 2).
+ * @param buffer_size        The size of each buffer.
+ * @param is_multithread     1 if Machnet is using multiple threads per channel,
+ * 0 otherwise.
+ * @return                   '0' on success, '-1' on failure.
+ */
+static inline int __machnet_channel_dataplane_init(
+    uchar_t *shm, size_t shm_size, int is_posix_shm, const char *name,
+    size_t machnet_ring_slot_nr, size_t app_ring_slot_nr,
+    size_t buf_ring_slot_nr, size_t buffer_size, int is_multithread) {
+  const MachnetChannelBufClassConf_t buf_class = {
+      .buf_ring_slot_nr = buf_ring_slot_nr, .buffer_size = buffer_size};
+  return __machnet_channel_dataplane_init_ex(
+      shm, shm_size, is_posix_shm, name, machnet_ring_slot_nr, app_ring_slot_nr,
+      &buf_class, 1, is_multithread);
+}
+
 /**
  * This function creates a POSIX shared memory region to be used as an Machnet
  * channel. The shared memory region is created with the given name and size and
@@ -297,7 +474,7 @@ static inline MachnetChannelCtx_t *__machnet_channel_posix_create(
   assert(channel_name != NULL);
   assert(shm_fd != NULL);
   MachnetChannelCtx_t *channel = NULL;
-  int shm_flags, prot_flags;
+  int shm_flags;
 
   // Create the shared memory segment.
   *shm_fd = shm_open(channel_name, O_CREAT | O_EXCL | O_RDWR, 0666);
@@ -313,10 +490,9 @@ static inline MachnetChannelCtx_t *__machnet_channel_posix_create(
   }
 
   // Map the shared memory segment into the address space of the process.
-  prot_flags = PROT_READ | PROT_WRITE;
   shm_flags = MAP_SHARED | MAP_POPULATE;
-  channel = (MachnetChannelCtx_t *)mmap(NULL, channel_size, prot_flags,
-                                        shm_flags, *shm_fd, 0);
+  channel = (MachnetChannelCtx_t *)__machnet_channel_mmap(channel_size,
+                                                          shm_flags, *shm_fd);
   if (channel == MAP_FAILED) {
     perror("mmap()");
     goto fail;
@@ -331,7 +507,8 @@ static inline MachnetChannelCtx_t *__machnet_channel_posix_create(
   return channel;
 
 fail:
-  if (channel != NULL && channel != MAP_FAILED) munmap(channel, channel_size);
+  if (channel != NULL && channel != MAP_FAILED)
+    __machnet_channel_munmap(channel, channel_size);
 
   if (*shm_fd != -1) {
     close(*shm_fd);
@@ -386,8 +563,8 @@ static inline MachnetChannelCtx_t *__machnet_channel_hugetlbfs_create(
 
   // Map the shared memory segment into the address space of the process.
   shm_flags = MAP_SHARED | MAP_POPULATE | MAP_HUGETLB;
-  channel = (MachnetChannelCtx_t *)mmap(
-      NULL, channel_size, PROT_READ | PROT_WRITE, shm_flags, *shm_fd, 0);
+  channel = (MachnetChannelCtx_t *)__machnet_channel_mmap(channel_size,
+                                                          shm_flags, *shm_fd);
   if (channel == MAP_FAILED) {
     fprintf(stderr, "mmap() failed, error = %s\n", strerror(errno));
     goto fail;
@@ -402,7 +579,8 @@ static inline MachnetChannelCtx_t *__machnet_channel_hugetlbfs_create(
   return channel;
 
 fail:
-  if (channel != NULL && channel != MAP_FAILED) munmap(channel, channel_size);
+  if (channel != NULL && channel != MAP_FAILED)
+    __machnet_channel_munmap(channel, channel_size);
 
   if (*shm_fd != -1) {
     close(*shm_fd);
@@ -411,6 +589,210 @@ fail:
   return NULL;
 }
 
+/**
+ * Change the state of a class backed by an extension segment, and ring the
+ * channel's doorbell so that the application acknowledges the change.
+ *
+ * @param ctx                Channel's context.
+ * @param cls                The buffer class of the segment.
+ * @param state              The new state.
+ */
+static inline void __machnet_channel_buf_class_set_state(
+    MachnetChannelCtx_t *ctx, uint32_t cls, uint32_t state) {
+  MachnetChannelBufClass_t *buf_class = &ctx->data_ctx.buf_classes[cls];
+  buf_class->state = state;
+  __sync_synchronize();
+  buf_class->state_gen = buf_class->state_gen + 1;
+  __sync_synchronize();
+  ctx->ctrl_ctx.segment_gen = ctx->ctrl_ctx.segment_gen + 1;
+}
+
+/**
+ * Check whether the application has acknowledged the current state of a class
+ * backed by an extension segment.
+ *
+ * @param ctx                Channel's context.
+ * @param cls                The buffer class of the segment.
+ * @return                   1 if the state is acknowledged, 0 otherwise.
+ */
+static inline int __machnet_channel_buf_class_acked(
+    const MachnetChannelCtx_t *ctx, uint32_t cls) {
+  const MachnetChannelBufClass_t *buf_class = &ctx->data_ctx.buf_classes[cls];
+  return buf_class->app_state_gen == buf_class->state_gen;
+}
+
+/**
+ * Calculate the memory size needed for an extension segment: the buffer pool,
+ * followed by its free ring.
+ *
+ * @param buf_ring_slot_nr   The number of buffers + 1 (must be power of 2).
+ * @param buffer_size        The usable size of each buffer.
+ * @param is_posix_shm       Whether the segment will be a POSIX shared memory.
+ * @return
+ *   - The memory size in bytes needed for the segment on success.
+ *   - (size_t)-1 - Some parameter is bad, or the segment would be larger than
+ *                  `MACHNET_CHANNEL_SEGMENT_SIZE_MAX'.
+ */
+static inline size_t __machnet_channel_segment_calculate_size(
+    size_t buf_ring_slot_nr, size_t buffer_size, int is_posix_shm) {
+  if (!IS_POW2(buf_ring_slot_nr) || buffer_size == 0) return -1;
+  if (buf_ring_slot_nr > MACHNET_MSGBUF_INDEX_MASK) return -1;
+  const size_t total_buffer_size =
+      __machnet_channel_buf_total_size(buffer_size);
+  if (total_buffer_size > HUGE_PAGE_2M_SIZE) return -1;
+
+  const size_t ring_size =
+      jring_get_buf_ring_size(sizeof(MachnetRingSlot_t), buf_ring_slot_nr);
+  if (ring_size == (size_t)-1) return -1;
+
+  const size_t kPageSize = (is_posix_shm ? getpagesize() : HUGE_PAGE_2M_SIZE);
+  const size_t total_size = ALIGN_TO_BOUNDARY(
+      buf_ring_slot_nr * total_buffer_size + ring_size, kPageSize);
+  if (total_size > MACHNET_CHANNEL_SEGMENT_SIZE_MAX) return -1;
+
+  return total_size;
+}
+
+/**
+ * Create an extension segment for a free class slot of a channel, map it at
+ * its slot, and initialize its buffers. The new class extends `parent' (its
+ * buffers have the same size) and is left in the `MAPPING' state; the
+ * application is notified to map it through the channel's doorbell.
+ *
+ * @param ctx                Channel's context.
+ * @param cls                A free class slot.
+ * @param parent             The (original) class to extend.
+ * @param buf_ring_slot_nr   The number of buffers + 1 (must be power of 2).
+ * @param is_posix_shm       Whether the channel is backed by POSIX shared
+ *                           memory (1), or by huge pages (0).
+ * @param[out] shm_fd        Sets the file descriptor of the segment (-1 on
+ *                           failure).
+ * @return                   '0' on success, '-1' on failure.
+ */
+static inline int __machnet_channel_segment_create(MachnetChannelCtx_t *ctx,
+                                                   uint32_t cls,
+                                                   uint32_t parent,
+                                                   size_t buf_ring_slot_nr,
+                                                   int is_posix_shm,
+                                                   int *shm_fd) {
+  assert(ctx != NULL);
+  assert(shm_fd != NULL);
+  *shm_fd = -1;
+  if (cls < ctx->data_ctx.buf_class_nr ||
+      cls >= MACHNET_CHANNEL_BUF_CLASS_MAX ||
+      parent >= ctx->data_ctx.buf_class_nr)
+    return -1;
+  MachnetChannelBufClass_t *buf_class = &ctx->data_ctx.buf_classes[cls];
+  if (buf_class->state != MACHNET_CHANNEL_BUF_CLASS_FREE) return -1;
+
+  const size_t buffer_size = ctx->data_ctx.buf_classes[parent].buf_mss;
+  const size_t segment_size = __machnet_channel_segment_calculate_size(
+      buf_ring_slot_nr, buffer_size, is_posix_shm);
+  if (segment_size == (size_t)-1) return -1;
+
+  char name[MACHNET_CHANNEL_NAME_MAX_LEN + 16];
+  __machnet_channel_segment_name(ctx, cls, name, sizeof(name));
+  int shm_flags = MAP_SHARED | MAP_POPULATE;
+  if (is_posix_shm) {
+    *shm_fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0666);
+  } else {
+    *shm_fd = memfd_create(name, MFD_HUGETLB);
+    shm_flags |= MAP_HUGETLB;
+  }
+  if (*shm_fd < 0) {
+    fprintf(stderr, "Failed to create segment %s, error = %s\n", name,
+            strerror(errno));
+    *shm_fd = -1;
+    return -1;
+  }
+
+  if (ftruncate(*shm_fd, segment_size) == -1) {
+    fprintf(stderr, "ftruncate() failed, error = %s\n", strerror(errno));
+    goto fail;
+  }
+
+  buf_class->segment_size = segment_size;
+  if (__machnet_channel_segment_map(ctx, cls, shm_flags, *shm_fd) != 0) {
+    fprintf(stderr, "mmap() failed, error = %s\n", strerror(errno));
+    goto fail;
+  }
+
+  if (mlock(__machnet_channel_mem_ofs(ctx,
+                                      __machnet_channel_segment_ofs(ctx, cls)),
+            segment_size) != 0) {
+    fprintf(stderr, "mlock() failed, error = %s\n", strerror(errno));
+    goto fail;
+  }
+
+  // The pool is at the beginning of the slot, and the ring follows it.
+  buf_class->buf_pool_ofs = __machnet_channel_segment_ofs(ctx, cls);
+  buf_class->buf_ring_ofs =
+      buf_class->buf_pool_ofs +
+      buf_ring_slot_nr * __machnet_channel_buf_total_size(buffer_size);
+  buf_class->parent = parent;
+  if (__machnet_channel_buf_class_init(ctx, cls, buf_ring_slot_nr,
+                                       buffer_size) != 0)
+    goto fail;
+
+  // Publish the segment, and ring the doorbell.
+  __sync_synchronize();
+  __machnet_channel_buf_class_set_state(ctx, cls,
+                                        MACHNET_CHANNEL_BUF_CLASS_MAPPING);
+
+  return 0;
+
+fail:
+  __machnet_channel_segment_unmap(ctx, cls);
+  buf_class->segment_size = 0;
+  buf_class->buf_nr = 0;
+  buf_class->buf_mss = 0;
+  close(*shm_fd);
+  *shm_fd = -1;
+  if (is_posix_shm) shm_unlink(name);
+  return -1;
+}
+
+/**
+ * Destroy the extension segment of a class, and free its class slot. The
+ * application must have unmapped the segment already (or never mapped it).
+ *
+ * @param ctx                Channel's context.
+ * @param cls                The buffer class of the segment.
+ * @param shm_fd             (ptr) The file descriptor of the segment; set to
+ *                           -1.
+ * @param is_posix_shm       Whether the channel is backed by POSIX shared
+ *                           memory.
+ */
+static inline void __machnet_channel_segment_destroy(MachnetChannelCtx_t *ctx,
+                                                     uint32_t cls, int *shm_fd,
+                                                     int is_posix_shm) {
+  assert(ctx != NULL);
+  assert(cls >= ctx->data_ctx.buf_class_nr &&
+         cls < MACHNET_CHANNEL_BUF_CLASS_MAX);
+  MachnetChannelBufClass_t *buf_class = &ctx->data_ctx.buf_classes[cls];
+
+  buf_class->state = MACHNET_CHANNEL_BUF_CLASS_FREE;
+  __sync_synchronize();
+  __machnet_channel_segment_unmap(ctx, cls);
+  buf_class->segment_size = 0;
+  buf_class->buf_nr = 0;
+  buf_class->buf_mss = 0;
+  buf_class->buf_pool_ofs = __machnet_channel_segment_ofs(ctx, cls);
+  buf_class->buf_ring_ofs = buf_class->buf_pool_ofs;
+
+  if (shm_fd != NULL && *shm_fd >= 0) {
+    close(*shm_fd);
+    *shm_fd = -1;
+  }
+  if (is_posix_shm) {
+    char name[MACHNET_CHANNEL_NAME_MAX_LEN + 16];
+    __machnet_channel_segment_name(ctx, cls, name, sizeof(name));
+    shm_unlink(name);
+  }
+
+  __machnet_channel_buf_class_order_update(ctx);
+}
+
 /**
  * This function unmaps, and destroys an Machnet channel, releasing the shared
  * memory segment.
@@ -431,8 +813,8 @@ static inline void __machnet_channel_destroy(void *mapped_mem,
   assert(mapped_mem != NULL);
   assert(mapped_mem_size > 0);
 
-  // Unmap the shared memory segment.
-  munmap(mapped_mem, mapped_mem_size);
+  // Unmap the shared memory segment, along with any extension segments.
+  __machnet_channel_munmap(mapped_mem, mapped_mem_size);
   if (shm_fd != NULL && *shm_fd >= 0) {
     close(*shm_fd);
     *shm_fd = -1;
@@ -446,12 +828,14 @@ static inline void __machnet_channel_destroy(void *mapped_mem,
 
 /**
  * This function creates a shared memory region to be used as an Machnet
- * channel.
+ * channel, with multiple buffer size classes.
  *
  * @param[in] channel_name           The name of the shared memory segment.
  * @param[in] machnet_ring_slot_nr     Number of slots in the Machnet ring.
  * @param[in] app_ring_slot_nr       Number of slots in the application ring.
- * @param[in] buf_ring_slot_nr       Number of slots in the buffer ring.
+ * @param[in] buf_classes            The buffer classes (see
+ * `__machnet_channel_dataplane_calculate_size_ex()').
+ * @param[in] buf_class_nr           Number of buffer classes.
  * @param[out] channel_mem_size      (ptr) The real size of the underlying
  * shared memory segment. Can differ from `channel_size` because of alignment
  * reasons (e.g, 4K or 2MB).
@@ -462,10 +846,11 @@ static inline void __machnet_channel_destroy(void *mapped_mem,
  * @return                           Pointer to channel's memory area on
  * success, NULL otherwise.
  */
-static inline MachnetChannelCtx_t *__machnet_channel_create(
+static inline MachnetChannelCtx_t *__machnet_channel_create_ex(
     const char *channel_name, size_t machnet_ring_slot_nr,
-    size_t app_ring_slot_nr, size_t buf_ring_slot_nr, size_t buffer_size,
-    size_t *channel_mem_size, int *is_posix_shm, int *shm_fd) {
+    size_t app_ring_slot_nr, const MachnetChannelBufClassConf_t *buf_classes,
+    size_t buf_class_nr, size_t *channel_mem_size, int *is_posix_shm,
+    int *shm_fd) {
   assert(channel_name != NULL);
   assert(shm_fd != NULL);
   assert(channel_mem_size != NULL);
@@ -474,9 +859,10 @@ static inline MachnetChannelCtx_t *__machnet_channel_create(
   MachnetChannelCtx_t *channel;
 
   *is_posix_shm = 0;
-  *channel_mem_size = __machnet_channel_dataplane_calculate_size(
-      machnet_ring_slot_nr, app_ring_slot_nr, buf_ring_slot_nr, buffer_size,
+  *channel_mem_size = __machnet_channel_dataplane_calculate_size_ex(
+      machnet_ring_slot_nr, app_ring_slot_nr, buf_classes, buf_class_nr,
       *is_posix_shm);
+  if (*channel_mem_size == (size_t)-1) goto fail;
   // Try creating and mapping a hugetlbfs backed shared memory segment.
   channel = __machnet_channel_hugetlbfs_create(channel_name, *channel_mem_size,
                                                shm_fd);
@@ -489,9 +875,10 @@ static inline MachnetChannelCtx_t *__machnet_channel_create(
   // Hugetlbfs backed shared memory segment creation failed. Fallback to a
   // regular POSIX shm segment.
   *is_posix_shm = 1;
-  *channel_mem_size = __machnet_channel_dataplane_calculate_size(
-      machnet_ring_slot_nr, app_ring_slot_nr, buf_ring_slot_nr, buffer_size,
+  *channel_mem_size = __machnet_channel_dataplane_calculate_size_ex(
+      machnet_ring_slot_nr, app_ring_slot_nr, buf_classes, buf_class_nr,
       *is_posix_shm);
+  if (*channel_mem_size == (size_t)-1) goto fail;
   channel =
       __machnet_channel_posix_create(channel_name, *channel_mem_size, shm_fd);
   if (channel != NULL) goto out;
@@ -499,11 +886,17 @@ static inline MachnetChannelCtx_t *__machnet_channel_create(
   // Failed to create shared memory segment.
   return NULL;
 
+fail:
+  // Invalid channel configuration.
+  *channel_mem_size = 0;
+  *shm_fd = -1;
+  return NULL;
+
 out:
   // The shared memory segment is created and mapped. Initialize it.
-  int ret = __machnet_channel_dataplane_init(
+  int ret = __machnet_channel_dataplane_init_ex(
       (uchar_t *)channel, *channel_mem_size, *is_posix_shm, channel_name,
-      machnet_ring_slot_nr, app_ring_slot_nr, buf_ring_slot_nr, buffer_size, 0);
+      machnet_ring_slot_nr, app_ring_slot_nr, buf_classes, buf_class_nr, 0);
   if (ret != 0) {
     __machnet_channel_destroy((void *)channel, *channel_mem_size, shm_fd,
                               *is_posix_shm, channel_name);
@@ -515,6 +908,36 @@ out:
   return channel;
 }
 
+/**
+ * This function creates a shared memory region to be used as an Machnet
+ * channel, with a single buffer class.
+ *
+ * @param[in] channel_name           The name of the shared memory segment.
+ * @param[in] machnet_ring_slot_nr     Number of slots in the Machnet ring.
+ * @param[in] app_ring_slot_nr       Number of slots in the application ring.
+ * @param[in] buf_ring_slot_nr       Number of slots in the buffer ring.
+ * @param[in] buffer_size            The usable size of each buffer.
+ * @param[out] channel_mem_size      (ptr) The real size of the underlying
+ * shared memory segment. Can differ from `channel_size` because of alignment
+ * reasons (e.g, 4K or 2MB).
+ * @param[out] is_posix_shm          (ptr) Set to 1 if this is a POSIX shared
+ * memory segment (not backed by hugetlbfs)
+ * @param[out] shm_fd                Sets the file descriptor accordingly (-1 on
+ *                                   failure, >0 on success).
+ * @return                           Pointer to channel's memory area on
+ * success, NULL otherwise.
+ */
+static inline MachnetChannelCtx_t *__machnet_channel_create(
+    const char *channel_name, size_t machnet_ring_slot_nr,
+    size_t app_ring_slot_nr, size_t buf_ring_slot_nr, size_t buffer_size,
+    size_t *channel_mem_size, int *is_posix_shm, int *shm_fd) {
+  const MachnetChannelBufClassConf_t buf_class = {
+      .buf_ring_slot_nr = buf_ring_slot_nr, .buffer_size = buffer_size};
+  return __machnet_channel_create_ex(channel_name, machnet_ring_slot_nr,
+                                     app_ring_slot_nr, &buf_class, 1,
+                                     channel_mem_size, is_posix_shm, shm_fd);
+}
+
 static inline __attribute__((always_inline)) uint32_t __machnet_channel_enqueue(
     const MachnetChannelCtx_t *ctx, unsigned int n,
     const MachnetRingSlot_t *bufs) {
@@ -4,6 +4,7 @@
 #include <gtest/gtest.h>
 #include <utils.h>
 
+#include <atomic>
 #include <random>
 #include <thread>
 
@@ -74,6 +75,61 @@ TEST(MachnetPrivateTest, NSaasChannelDataplaneInit) {
   EXPECT_EQ(channel_fd, -1);
 }
 
+TEST(MachnetPrivateTest, NSaasChannelEngineStats) {
+  const uint32_t kChannelRingSize = 1 << 11;  // 2048 slots for all rings.
+  const uint32_t kBufferSize = 1 << 12;       // 4096 bytes for buffer.
+  const std::string channel_name = "test_channel_engine_stats";
+
+  size_t channel_size;
+  int is_posix_shm;
+  int channel_fd;
+  MachnetChannelCtx_t *channel_ctx = __machnet_channel_create(
+      channel_name.c_str(), kChannelRingSize, kChannelRingSize,
+      kChannelRingSize, kBufferSize, &channel_size, &is_posix_shm, &channel_fd);
+  ASSERT_NE(channel_ctx, nullptr);
+
+  // The statistics start cleared, and do not overlap the control rings.
+  auto *e_stats = &__machnet_channel_stats(channel_ctx)->e_stats;
+  EXPECT_LE(reinterpret_cast<uchar_t *>(e_stats + 1),
+            reinterpret_cast<uchar_t *>(
+                __machnet_channel_ctrl_sq_ring(channel_ctx)));
+  MachnetChannelEngineStats_t stats;
+  __machnet_channel_engine_stats_read(channel_ctx, &stats);
+  EXPECT_EQ(stats.rx_msgs, 0);
+  EXPECT_EQ(stats.snapshot_seq, 0);
+  EXPECT_EQ(stats.flow_nr, 0);
+
+  // A reader racing with snapshot updates sees them whole.
+  const uint32_t kUpdates = 1 << 16;
+  std::atomic<bool> done{false};
+  std::thread writer([&]() {
+    for (uint32_t i = 1; i <= kUpdates; i++) {
+      __atomic_store_n(&e_stats->rx_msgs, i, __ATOMIC_RELAXED);
+      __atomic_store_n(&e_stats->snapshot_seq, 2 * i - 1, __ATOMIC_RELAXED);
+      __atomic_thread_fence(__ATOMIC_RELEASE);
+      e_stats->buf_free = i;
+      e_stats->buf_total = i;
+      e_stats->flow_nr = i;
+      __atomic_store_n(&e_stats->snapshot_seq, 2 * i, __ATOMIC_RELEASE);
+    }
+    done.store(true);
+  });
+  while (!done.load()) {
+    __machnet_channel_engine_stats_read(channel_ctx, &stats);
+    EXPECT_EQ(stats.snapshot_seq % 2, 0);
+    EXPECT_EQ(stats.buf_free, stats.snapshot_seq / 2);
+    EXPECT_EQ(stats.buf_total, stats.buf_free);
+    EXPECT_EQ(stats.flow_nr, stats.buf_free);
+  }
+  writer.join();
+  __machnet_channel_engine_stats_read(channel_ctx, &stats);
+  EXPECT_EQ(stats.rx_msgs, kUpdates);
+  EXPECT_EQ(stats.flow_nr, kUpdates);
+
+  __machnet_channel_destroy(channel_ctx, channel_size, &channel_fd,
+                            is_posix_shm, channel_name.c_str());
+}
+
 TEST(MachnetPrivateTest, NSaasChannelBufAllocFree) {
   const uint32_t kChannelRingSize = 1 << 11;  // 2048 slots for all rings.
   const uint32_t kBufferSize = 1 << 12;       // 4096 bytes for buffer.
@@ -139,6 +195,121 @@ TEST(MachnetPrivateTest, NSaasChannelBufAllocFree) {
   EXPECT_EQ(channel_fd, -1);
 }
 
+TEST(MachnetPrivateTest, NSaasChannelSegments) {
+  const uint32_t kChannelRingSize = 1 << 8;  // 256 slots for all rings.
+  const uint32_t kBufferSize = 1 << 10;      // 1024 bytes for buffer.
+  const uint32_t kSegmentRingSize = 1 << 9;  // 512 slots for the segment.
+  const std::string channel_name = "test_channel_segments";
+
+  size_t channel_size;
+  int is_posix_shm;
+  int channel_fd;
+  auto *channel = __machnet_channel_create(
+      channel_name.c_str(), kChannelRingSize, kChannelRingSize,
+      kChannelRingSize, kBufferSize, &channel_size, &is_posix_shm, &channel_fd);
+  ASSERT_NE(channel, nullptr);
+  EXPECT_EQ(channel->data_ctx.buf_classes[0].state,
+            MACHNET_CHANNEL_BUF_CLASS_ACTIVE);
+  EXPECT_EQ(channel->data_ctx.buf_classes[1].state,
+            MACHNET_CHANNEL_BUF_CLASS_FREE);
+
+  // Segments cannot replace the classes of the channel, or be too large.
+  int segment_fd;
+  EXPECT_EQ(__machnet_channel_segment_create(channel, 0, 0, kSegmentRingSize,
+                                             is_posix_shm, &segment_fd),
+            -1);
+  EXPECT_EQ(segment_fd, -1);
+  EXPECT_EQ(__machnet_channel_segment_calculate_size(
+                MACHNET_CHANNEL_SEGMENT_SIZE_MAX / kBufferSize, kBufferSize,
+                is_posix_shm),
+            std::size_t(-1));
+
+  // Extend the default class.
+  const uint32_t kClass = 1;
+  ASSERT_EQ(__machnet_channel_segment_create(channel, kClass, 0,
+                                             kSegmentRingSize, is_posix_shm,
+                                             &segment_fd),
+            0);
+  EXPECT_GE(segment_fd, 0);
+  const auto *buf_class = __machnet_channel_buf_class(channel, kClass);
+  EXPECT_EQ(buf_class->state, MACHNET_CHANNEL_BUF_CLASS_MAPPING);
+  EXPECT_EQ(buf_class->parent, 0);
+  EXPECT_EQ(buf_class->buf_nr, kSegmentRingSize - 1);
+  EXPECT_EQ(buf_class->buf_mss, kBufferSize);
+  EXPECT_EQ(channel->ctrl_ctx.segment_gen, 1);
+
+  // Not usable until the application has mapped it.
+  EXPECT_FALSE(
+      __machnet_channel_buf_valid(channel, MACHNET_MSGBUF_INDEX(kClass, 0)));
+  EXPECT_EQ(__machnet_channel_buffers_total(channel), kChannelRingSize - 1);
+
+  // Within a process the segment is already mapped; play the application's
+  // part and acknowledge it, then activate it.
+  EXPECT_FALSE(__machnet_channel_buf_class_acked(channel, kClass));
+  channel->data_ctx.buf_classes[kClass].app_state_gen = buf_class->state_gen;
+  EXPECT_TRUE(__machnet_channel_buf_class_acked(channel, kClass));
+  __machnet_channel_buf_class_set_state(channel, kClass,
+                                        MACHNET_CHANNEL_BUF_CLASS_ACTIVE);
+  EXPECT_FALSE(__machnet_channel_buf_class_acked(channel, kClass));
+  EXPECT_EQ(channel->ctrl_ctx.segment_gen, 2);
+  __machnet_channel_buf_class_order_update(channel);
+  // Same size as the default class, but ordered before it.
+  EXPECT_EQ(channel->data_ctx.buf_class_order[0], kClass);
+  EXPECT_EQ(channel->data_ctx.buf_class_order[1], 0);
+  EXPECT_EQ(__machnet_channel_buffers_total(channel),
+            kChannelRingSize - 1 + kSegmentRingSize - 1);
+
+  // All the buffers of the segment are usable, and map back to their index.
+  std::vector<MachnetRingSlot_t> buffer_indices(kSegmentRingSize - 1);
+  std::vector<MachnetMsgBuf_t *> buffers(buffer_indices.size());
+  EXPECT_EQ(__machnet_channel_class_buf_alloc_bulk(
+                channel, kClass, buffer_indices.size(), buffer_indices.data(),
+                buffers.data()),
+            buffer_indices.size());
+  for (size_t i = 0; i < buffer_indices.size(); i++) {
+    EXPECT_EQ(MACHNET_MSGBUF_INDEX_CLASS(buffer_indices[i]), kClass);
+    EXPECT_EQ(buffers[i]->magic, MACHNET_MSGBUF_MAGIC);
+    EXPECT_EQ(buffers[i]->index, buffer_indices[i]);
+    EXPECT_EQ(__machnet_channel_buf_index(channel, buffers[i]),
+              buffer_indices[i]);
+  }
+  EXPECT_EQ(__machnet_channel_buf_index(
+                channel, __machnet_channel_buf(channel,
+                                               MACHNET_MSGBUF_INDEX(0, 1))),
+            MACHNET_MSGBUF_INDEX(0, 1));
+  EXPECT_EQ(__machnet_channel_buf_free_bulk(channel, buffer_indices.size(),
+                                            buffer_indices.data()),
+            buffer_indices.size());
+  EXPECT_EQ(__machnet_channel_class_buffers_avail(channel, kClass),
+            kSegmentRingSize - 1);
+
+  // Reclaim the segment.
+  __machnet_channel_buf_class_set_state(channel, kClass,
+                                        MACHNET_CHANNEL_BUF_CLASS_UNMAPPING);
+  __machnet_channel_segment_destroy(channel, kClass, &segment_fd,
+                                    is_posix_shm);
+  EXPECT_EQ(segment_fd, -1);
+  EXPECT_EQ(buf_class->state, MACHNET_CHANNEL_BUF_CLASS_FREE);
+  EXPECT_EQ(buf_class->buf_nr, 0);
+  EXPECT_EQ(channel->data_ctx.buf_class_order[0], 0);
+  EXPECT_FALSE(
+      __machnet_channel_buf_valid(channel, MACHNET_MSGBUF_INDEX(kClass, 0)));
+  EXPECT_EQ(__machnet_channel_buffers_total(channel), kChannelRingSize - 1);
+
+  // The slot can be reused.
+  ASSERT_EQ(__machnet_channel_segment_create(channel, kClass, 0,
+                                             kSegmentRingSize, is_posix_shm,
+                                             &segment_fd),
+            0);
+  EXPECT_EQ(channel->ctrl_ctx.segment_gen, 4);
+  __machnet_channel_segment_destroy(channel, kClass, &segment_fd,
+                                    is_posix_shm);
+
+  __machnet_channel_destroy(channel, channel_size, &channel_fd, is_posix_shm,
+                            channel_name.c_str());
+  EXPECT_EQ(channel_fd, -1);
+}
+
 TEST(MachnetBufferPool, Concurrency) {
   const uint32_t kChannelRingSize = 1 << 8;  // 256 slots for all rings.
   const uint32_t kBufferSize = 1 << 8;       // 256 bytes for buffer.
@@ -11,10 +11,18 @@
 #include <utils.h>
 
 #include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
 #include <random>
+#include <string>
+#include <thread>
 #include <unordered_set>
 
+#include "machnet_copy.h"
 #include "machnet_private.h"
+#include "machnet_trace.h"
 
 constexpr const char *file_name(const char *path) {
   const char *file = path;
@@ -167,13 +175,8 @@ uint32_t bounce_machnet_to_app(const MachnetChannelCtx_t *ctx) {
 // Could be called after each test round, to validate that the buffer pool is in
 // a valid state.
 bool check_buffer_pool(const MachnetChannelCtx_t *ctx) {
-  // Release cached buffers to the pool
-  if (__machnet_channel_buf_free_bulk(ctx, ctx->app_buffer_cache.count,
-                                      ctx->app_buffer_cache.indices) !=
-      ctx->app_buffer_cache.count) {
-    return false;
-  }
-  *__DECONST(uint32_t *, &ctx->app_buffer_cache.count) = 0;
+  // Release the buffers cached by the application threads to the pool.
+  machnet_detach(ctx);
 
   jring_t *buf_ring = __machnet_channel_buf_ring(ctx);
   auto nbuffers = buf_ring->capacity;
@@ -236,6 +239,15 @@ TEST(MachnetTest, Bind) {
                             channel_name);
 }
 
+TEST(MachnetTest, AttachOptions) {
+  // Requests for more buffer classes than the options can carry are refused
+  // before reaching the controller.
+  MachnetChannelOpts_t opts = {};
+  opts.flags = MACHNET_CHANNEL_OPTS_F_BUF_CLASSES;
+  opts.buf_class_nr = MACHNET_CHANNEL_OPTS_BUF_CLASS_MAX + 1;
+  EXPECT_EQ(machnet_attach_ex(&opts), nullptr);
+}
+
 TEST(MachnetTest, SimpleSendRecvMsg) {
   // Send a single-buffer message.
   const uint32_t buffer_payload =
@@ -437,6 +449,640 @@ TEST(MachnetTest, InvalidSendRecv) {
   }
 }
 
+TEST(MachnetTest, ZeroCopyRecvMsg) {
+  std::uniform_int_distribution<uint32_t> msg_len{1, MACHNET_MSG_MAX_LEN};
+
+  const size_t nr_msgs = 256;
+  for (size_t i = 0; i < nr_msgs; i++) {
+    const uint32_t msg_size = msg_len(mersenne_engine);
+    std::vector<std::vector<uint8_t>> tx_segments;
+    prepare_segments(msg_size, 1, &tx_segments);
+
+    std::vector<MachnetIovec_t> tx_iov;
+    MachnetFlow_t flow;
+    MachnetMsgHdr_t tx_msghdr;
+
+    // Nothing is pending yet.
+    EXPECT_EQ(machnet_peek(g_channel_ctx, nullptr), 0);
+
+    prepare_tx_msg(&flow, &tx_iov, &tx_msghdr, &tx_segments, msg_size);
+    int ret = machnet_sendmsg(g_channel_ctx, &tx_msghdr);
+    EXPECT_EQ(ret, 0) << "Msg size: " << msg_size;
+    EXPECT_EQ(bounce_machnet_to_app(g_channel_ctx), 1);
+
+    // Peeking must not consume the message.
+    MachnetFlow_t peek_flow;
+    EXPECT_EQ(machnet_peek(g_channel_ctx, &peek_flow), msg_size);
+    EXPECT_EQ(memcmp(&peek_flow, &flow, sizeof(flow)), 0);
+    EXPECT_EQ(__machnet_channel_machnet_ring_pending(g_channel_ctx), 1);
+
+    // A too short iovec array fails, and reports the required length.
+    MachnetIovec_t short_iov;
+    MachnetMsgHdr_t rx_msghdr;
+    MachnetMsgHandle_t handle;
+    rx_msghdr.msg_iov = &short_iov;
+    rx_msghdr.msg_iovlen = 0;
+    EXPECT_EQ(machnet_recvmsg_zc(g_channel_ctx, &rx_msghdr, &handle), -1);
+    const uint32_t buf_mss =
+        __machnet_channel_buf_class(g_channel_ctx, 0)->buf_mss;
+    const size_t buffers_nr = (msg_size + buf_mss - 1) / buf_mss;
+    EXPECT_EQ(rx_msghdr.msg_iovlen, buffers_nr);
+    EXPECT_EQ(__machnet_channel_machnet_ring_pending(g_channel_ctx), 1);
+
+    // Receive the message in place.
+    std::vector<MachnetIovec_t> rx_iov(rx_msghdr.msg_iovlen);
+    rx_msghdr.msg_iov = rx_iov.data();
+    rx_msghdr.msg_iovlen = rx_iov.size();
+    EXPECT_EQ(machnet_recvmsg_zc(g_channel_ctx, &rx_msghdr, &handle), 1);
+    EXPECT_EQ(rx_msghdr.msg_size, msg_size);
+    EXPECT_EQ(rx_msghdr.msg_iovlen, buffers_nr);
+    EXPECT_EQ(memcmp(&rx_msghdr.flow_info, &flow, sizeof(flow)), 0);
+    EXPECT_EQ(__machnet_channel_machnet_ring_pending(g_channel_ctx), 0);
+
+    std::vector<uint8_t> rx_msg;
+    for (size_t j = 0; j < rx_msghdr.msg_iovlen; j++) {
+      const auto *seg = static_cast<const uint8_t *>(rx_iov[j].base);
+      rx_msg.insert(rx_msg.end(), seg, seg + rx_iov[j].len);
+    }
+    EXPECT_EQ(rx_msg, tx_segments[0]) << "Msg size: " << msg_size;
+
+    EXPECT_EQ(machnet_release(g_channel_ctx, handle), 0);
+    EXPECT_TRUE(check_buffer_pool(g_channel_ctx));
+    EXPECT_EQ(jring_full(__machnet_channel_buf_ring(g_channel_ctx)), 1)
+        << "Available buffers: "
+        << jring_count(__machnet_channel_buf_ring(g_channel_ctx));
+  }
+
+  // An empty channel yields no message.
+  MachnetIovec_t iov;
+  MachnetMsgHdr_t msghdr;
+  MachnetMsgHandle_t handle;
+  msghdr.msg_iov = &iov;
+  msghdr.msg_iovlen = 1;
+  EXPECT_EQ(machnet_recvmsg_zc(g_channel_ctx, &msghdr, &handle), 0);
+}
+
+TEST(MachnetTest, ZeroCopySendMsg) {
+  std::uniform_int_distribution<uint32_t> msg_len{1, MACHNET_MSG_MAX_LEN};
+
+  const size_t nr_msgs = 256;
+  for (size_t i = 0; i < nr_msgs; i++) {
+    const uint32_t msg_size = msg_len(mersenne_engine);
+    const MachnetFlow_t flow = {.src_ip = UINT32_MAX,
+                                .dst_ip = UINT32_MAX,
+                                .src_port = UINT16_MAX,
+                                .dst_port = UINT16_MAX};
+
+    // A too short iovec array fails, and reports the required length.
+    MachnetIovec_t short_iov;
+    MachnetMsgHdr_t tx_msghdr;
+    MachnetMsgHandle_t handle;
+    tx_msghdr.msg_size = msg_size;
+    tx_msghdr.msg_iov = &short_iov;
+    tx_msghdr.msg_iovlen = 0;
+    EXPECT_EQ(machnet_msg_alloc(g_channel_ctx, &tx_msghdr, &handle), -1);
+    EXPECT_GT(tx_msghdr.msg_iovlen, 0);
+
+    // Allocate the message and build it in place.
+    std::vector<MachnetIovec_t> tx_iov(tx_msghdr.msg_iovlen);
+    tx_msghdr.msg_iov = tx_iov.data();
+    tx_msghdr.msg_iovlen = tx_iov.size();
+    EXPECT_EQ(machnet_msg_alloc(g_channel_ctx, &tx_msghdr, &handle), 0);
+    EXPECT_EQ(tx_msghdr.msg_iovlen, tx_iov.size());
+
+    std::vector<uint8_t> tx_msg(msg_size);
+    std::iota(tx_msg.begin(), tx_msg.end(), i);
+    size_t ofs = 0;
+    for (const auto &seg : tx_iov) {
+      memcpy(seg.base, tx_msg.data() + ofs, seg.len);
+      ofs += seg.len;
+    }
+    EXPECT_EQ(ofs, msg_size);
+
+    EXPECT_EQ(machnet_msg_submit(g_channel_ctx, flow, handle), 0);
+    EXPECT_EQ(__machnet_channel_app_ring_pending(g_channel_ctx), 1);
+
+    // Bounce the message back to the application, and receive it.
+    EXPECT_EQ(bounce_machnet_to_app(g_channel_ctx), 1);
+    std::vector<uint8_t> rx_msg(msg_size);
+    MachnetIovec_t rx_iov = {.base = rx_msg.data(), .len = rx_msg.size()};
+    MachnetMsgHdr_t rx_msghdr;
+    rx_msghdr.msg_iov = &rx_iov;
+    rx_msghdr.msg_iovlen = 1;
+    EXPECT_EQ(machnet_recvmsg(g_channel_ctx, &rx_msghdr), 1);
+    EXPECT_EQ(rx_msghdr.msg_size, msg_size);
+    EXPECT_EQ(rx_msg, tx_msg) << "Msg size: " << msg_size;
+    EXPECT_EQ(memcmp(&rx_msghdr.flow_info, &flow, sizeof(flow)), 0);
+    EXPECT_TRUE(check_buffer_pool(g_channel_ctx));
+  }
+
+  // Messages that are not submitted can be released.
+  const uint32_t buf_mss =
+      __machnet_channel_buf_class(g_channel_ctx, 0)->buf_mss;
+  std::vector<MachnetIovec_t> iov(MACHNET_MSG_MAX_LEN / buf_mss + 1);
+  MachnetMsgHdr_t msghdr;
+  MachnetMsgHandle_t handle;
+  msghdr.msg_size = MACHNET_MSG_MAX_LEN;
+  msghdr.msg_iov = iov.data();
+  msghdr.msg_iovlen = iov.size();
+  EXPECT_EQ(machnet_msg_alloc(g_channel_ctx, &msghdr, &handle), 0);
+  EXPECT_EQ(machnet_release(g_channel_ctx, handle), 0);
+  EXPECT_TRUE(check_buffer_pool(g_channel_ctx));
+  EXPECT_EQ(jring_full(__machnet_channel_buf_ring(g_channel_ctx)), 1);
+
+  // Invalid sizes are rejected.
+  msghdr.msg_size = 0;
+  EXPECT_EQ(machnet_msg_alloc(g_channel_ctx, &msghdr, &handle), -1);
+  msghdr.msg_size = MACHNET_MSG_MAX_LEN + 1;
+  EXPECT_EQ(machnet_msg_alloc(g_channel_ctx, &msghdr, &handle), -1);
+}
+
+TEST(MachnetTest, TxCompletions) {
+  MachnetTxCompletion_t completions[4];
+  EXPECT_EQ(machnet_poll_completions(g_channel_ctx, completions, 4), 0);
+
+  // Send a message that asks for delivery notification.
+  std::vector<uint8_t> data(1024);
+  std::iota(data.begin(), data.end(), 0);
+  MachnetIovec_t iov = {.base = data.data(), .len = data.size()};
+  MachnetMsgHdr_t msghdr;
+  msghdr.flow_info = {.src_ip = UINT32_MAX,
+                      .dst_ip = UINT32_MAX,
+                      .src_port = UINT16_MAX,
+                      .dst_port = UINT16_MAX};
+  msghdr.msg_size = data.size();
+  msghdr.msg_iov = &iov;
+  msghdr.msg_iovlen = 1;
+  msghdr.flags = MACHNET_MSGBUF_NOTIFY_DELIVERY;
+  msghdr.cookie = 0xdeadbeefcafeULL;
+  EXPECT_EQ(machnet_sendmsg(g_channel_ctx, &msghdr), 0);
+
+  // The cookie travels with the first buffer of the message.
+  MachnetRingSlot_t index;
+  EXPECT_EQ(__machnet_channel_app_ring_dequeue(g_channel_ctx, 1, &index), 1);
+  MachnetMsgBuf_t *first = __machnet_channel_buf(g_channel_ctx, index);
+  EXPECT_TRUE(first->flags & MACHNET_MSGBUF_NOTIFY_DELIVERY);
+  EXPECT_EQ(first->cookie, msghdr.cookie);
+  EXPECT_EQ(__machnet_channel_buf_free_bulk(g_channel_ctx, 1, &index), 1);
+
+  // Emulate Machnet posting the completions.
+  for (uint64_t i = 0; i < 3; i++) {
+    const MachnetTxCompletion_t completion = {
+        .cookie = msghdr.cookie + i,
+        .flow = msghdr.flow_info,
+        .status = MACHNET_TX_COMPLETION_DELIVERED};
+    EXPECT_EQ(__machnet_channel_completion_ring_enqueue(g_channel_ctx, 1,
+                                                        &completion),
+              1);
+  }
+  EXPECT_EQ(machnet_poll_completions(g_channel_ctx, completions, 4), 3);
+  for (uint64_t i = 0; i < 3; i++) {
+    EXPECT_EQ(completions[i].cookie, msghdr.cookie + i);
+    EXPECT_EQ(completions[i].status, MACHNET_TX_COMPLETION_DELIVERED);
+    EXPECT_EQ(memcmp(&completions[i].flow, &msghdr.flow_info,
+                     sizeof(msghdr.flow_info)),
+              0);
+  }
+  EXPECT_EQ(machnet_poll_completions(g_channel_ctx, completions, 4), 0);
+  EXPECT_TRUE(check_buffer_pool(g_channel_ctx));
+}
+
+TEST(MachnetTest, TraceCapture) {
+  const std::string path = std::string("/tmp/") + channel_name + ".trace";
+  std::vector<uint8_t> data(1024);
+  auto send = [&data](MachnetFlow_t flow, uint32_t size) {
+    return machnet_send(g_channel_ctx, flow, data.data(), size);
+  };
+  // A flow of the application, and the same flow as the peer sees it.
+  auto peer_flow = [](MachnetFlow_t flow) {
+    return MachnetFlow_t{.src_ip = flow.dst_ip,
+                         .dst_ip = flow.src_ip,
+                         .src_port = flow.dst_port,
+                         .dst_port = flow.src_port};
+  };
+  const MachnetFlow_t client_flow = {
+      .src_ip = 1, .dst_ip = 2, .src_port = 1000, .dst_port = 888};
+  const MachnetFlow_t server_flow = {
+      .src_ip = 1, .dst_ip = 3, .src_port = 888, .dst_port = 2000};
+
+  // The messages of the peers are queued before the trace starts: two
+  // responses to the client flow, and a request to the server flow.
+  ASSERT_EQ(send(peer_flow(client_flow), 150), 0);
+  ASSERT_EQ(send(peer_flow(client_flow), 250), 0);
+  ASSERT_EQ(send(peer_flow(server_flow), 300), 0);
+  ASSERT_EQ(machnet_trace_start(path.c_str()), 0);
+  EXPECT_EQ(machnet_trace_start(path.c_str()), -1);
+
+  // Two requests on the client flow, which the application sends first.
+  ASSERT_EQ(send(client_flow, 100), 0);
+  ASSERT_EQ(send(client_flow, 200), 0);
+  // The responses (and the requests, looped back) come in.
+  EXPECT_EQ(bounce_machnet_to_app(g_channel_ctx), 5);
+  MachnetFlow_t flow;
+  for (const ssize_t size : {150, 250, 300, 100, 200}) {
+    EXPECT_EQ(machnet_recv(g_channel_ctx, data.data(), data.size(), &flow),
+              size);
+  }
+  // The response of the server flow.
+  ASSERT_EQ(send(server_flow, 50), 0);
+  machnet_trace_stop();
+
+  MachnetRingSlot_t index;
+  ASSERT_EQ(__machnet_channel_app_ring_dequeue(g_channel_ctx, 1, &index), 1);
+  EXPECT_EQ(machnet_release(g_channel_ctx, index), 0);
+  EXPECT_TRUE(check_buffer_pool(g_channel_ctx));
+
+  FILE *file = fopen(path.c_str(), "rb");
+  ASSERT_NE(file, nullptr);
+  MachnetTraceHdr_t hdr;
+  ASSERT_EQ(fread(&hdr, sizeof(hdr), 1, file), 1);
+  EXPECT_EQ(hdr.magic, MACHNET_TRACE_MAGIC);
+  EXPECT_EQ(hdr.version, MACHNET_TRACE_VERSION);
+  std::vector<MachnetTraceRecord_t> records(8);
+  records.resize(
+      fread(records.data(), sizeof(records[0]), records.size(), file));
+  fclose(file);
+  unlink(path.c_str());
+
+  // The looped-back requests look like requests from the client flow's peer,
+  // which are left without a response.
+  ASSERT_EQ(records.size(), 5);
+  const std::vector<std::array<uint32_t, 3>> kExpected = {
+      {0, 100, 150}, {0, 200, 250}, {1, 300, 50}, {2, 100, 0}, {2, 200, 0}};
+  for (size_t i = 0; i < records.size(); i++) {
+    EXPECT_EQ(records[i].flow_id, kExpected[i][0]) << i;
+    EXPECT_EQ(records[i].req_size, kExpected[i][1]) << i;
+    EXPECT_EQ(records[i].resp_size, kExpected[i][2]) << i;
+  }
+  EXPECT_LE(records[0].timestamp_ns, records[1].timestamp_ns);
+  EXPECT_LE(records[1].timestamp_ns, records[2].timestamp_ns);
+}
+
+TEST(MachnetTest, TraceUntrackedFlows) {
+  const std::string path = std::string("/tmp/") + channel_name + ".trace";
+  std::vector<uint8_t> data(64);
+  ASSERT_EQ(machnet_trace_start(path.c_str()), 0);
+
+  // Requests on one flow more than the trace tracks.
+  for (uint32_t i = 0; i <= MACHNET_TRACE_FLOWS_MAX; i++) {
+    const MachnetFlow_t flow = {.src_ip = 1,
+                                .dst_ip = 2,
+                                .src_port = 1000,
+                                .dst_port = static_cast<uint16_t>(i)};
+    ASSERT_EQ(machnet_send(g_channel_ctx, flow, data.data(), data.size()), 0);
+    MachnetRingSlot_t index;
+    ASSERT_EQ(__machnet_channel_app_ring_dequeue(g_channel_ctx, 1, &index), 1);
+    ASSERT_EQ(machnet_release(g_channel_ctx, index), 0);
+  }
+  testing::internal::CaptureStderr();
+  machnet_trace_stop();
+  EXPECT_NE(testing::internal::GetCapturedStderr().find("missing 1 messages"),
+            std::string::npos);
+  EXPECT_TRUE(check_buffer_pool(g_channel_ctx));
+
+  // The requests of the tracked flows are recorded without a response.
+  FILE *file = fopen(path.c_str(), "rb");
+  ASSERT_NE(file, nullptr);
+  ASSERT_EQ(fseek(file, 0, SEEK_END), 0);
+  EXPECT_EQ(ftell(file), sizeof(MachnetTraceHdr_t) +
+                             MACHNET_TRACE_FLOWS_MAX *
+                                 sizeof(MachnetTraceRecord_t));
+  fclose(file);
+  unlink(path.c_str());
+}
+
+TEST(MachnetTest, MultiThreadBufferCaches) {
+  const size_t kThreadsNr = 4;
+  const size_t kIterations = 2048;
+  const uint32_t kBufferSize =
+      __machnet_channel_buf_class(g_channel_ctx, 0)->buf_mss;
+
+  // Threads sharing the channel concurrently allocate and release messages of
+  // various sizes; each thread's buffers go through its own cache.
+  std::vector<std::thread> threads;
+  std::atomic<size_t> errors{0};
+  for (size_t t = 0; t < kThreadsNr; t++) {
+    threads.emplace_back([t, kBufferSize, &errors]() {
+      std::mt19937 rng(t);
+      std::uniform_int_distribution<uint32_t> msg_len{1, 64 * kBufferSize};
+      std::vector<MachnetMsgHandle_t> handles;
+      std::vector<MachnetIovec_t> iov(64);
+      for (size_t i = 0; i < kIterations; i++) {
+        MachnetMsgHdr_t msghdr;
+        msghdr.msg_size = msg_len(rng);
+        msghdr.flags = 0;
+        msghdr.cookie = 0;
+        msghdr.msg_iov = iov.data();
+        msghdr.msg_iovlen = iov.size();
+        MachnetMsgHandle_t handle;
+        if (machnet_msg_alloc(g_channel_ctx, &msghdr, &handle) != 0) {
+          errors++;
+          continue;
+        }
+        handles.push_back(handle);
+        // Hold on to a few messages, to mix allocations and releases.
+        if (handles.size() > 4 || rng() % 2) {
+          if (machnet_release(g_channel_ctx, handles.front()) != 0) errors++;
+          handles.erase(handles.begin());
+        }
+      }
+      for (auto handle : handles) {
+        if (machnet_release(g_channel_ctx, handle) != 0) errors++;
+      }
+      // The thread's cache is flushed when the thread exits.
+    });
+  }
+  for (auto &thread : threads) thread.join();
+
+  EXPECT_EQ(errors, 0);
+  EXPECT_EQ(__machnet_channel_buffers_avail(g_channel_ctx),
+            __machnet_channel_buf_ring(g_channel_ctx)->capacity);
+  EXPECT_TRUE(check_buffer_pool(g_channel_ctx));
+}
+
+TEST(MachnetTest, BufferClasses) {
+  const char *kChannelName = "machnet_test_buffer_classes";
+  const uint32_t kLargeMss = 64 * KB - MACHNET_MSGBUF_SPACE_RESERVED -
+                             MACHNET_MSGBUF_HEADROOM_MAX;
+  // The default class comes first; the others are in no particular order.
+  const MachnetChannelBufClassConf_t kClasses[] = {
+      {.buf_ring_slot_nr = 1 << 11, .buffer_size = 1024},
+      {.buf_ring_slot_nr = 1 << 10, .buffer_size = 192},
+      {.buf_ring_slot_nr = 1 << 8, .buffer_size = kLargeMss}};
+  enum { kDefault = 0, kSmall = 1, kLarge = 2, kClassNr = 3 };
+
+  // Invalid class configurations.
+  EXPECT_EQ(__machnet_channel_dataplane_calculate_size_ex(
+                FLAGS_machnet_slots_nr, FLAGS_app_slots_nr, kClasses, 0, 1),
+            (size_t)-1);
+  EXPECT_EQ(__machnet_channel_dataplane_calculate_size_ex(
+                FLAGS_machnet_slots_nr, FLAGS_app_slots_nr, kClasses,
+                MACHNET_CHANNEL_BUF_CLASS_MAX + 1, 1),
+            (size_t)-1);
+  // The default class must not have buffers larger than a page.
+  EXPECT_EQ(__machnet_channel_dataplane_calculate_size_ex(
+                FLAGS_machnet_slots_nr, FLAGS_app_slots_nr, &kClasses[kLarge],
+                1, 1),
+            (size_t)-1);
+
+  size_t channel_size;
+  int is_posix_shm;
+  int channel_fd;
+  MachnetChannelCtx_t *ctx = __machnet_channel_create_ex(
+      kChannelName, FLAGS_machnet_slots_nr, FLAGS_app_slots_nr, kClasses,
+      kClassNr, &channel_size, &is_posix_shm, &channel_fd);
+  ASSERT_NE(ctx, nullptr);
+  ASSERT_EQ(ctx->data_ctx.buf_class_nr, kClassNr);
+  EXPECT_EQ(ctx->data_ctx.buf_class_order[0], kSmall);
+  EXPECT_EQ(ctx->data_ctx.buf_class_order[1], kDefault);
+  EXPECT_EQ(ctx->data_ctx.buf_class_order[2], kLarge);
+
+  // Every buffer of every class is addressable, and knows its index.
+  for (uint32_t cls = 0; cls < kClassNr; cls++) {
+    const auto *buf_class = __machnet_channel_buf_class(ctx, cls);
+    EXPECT_EQ(buf_class->buf_nr, kClasses[cls].buf_ring_slot_nr - 1);
+    EXPECT_EQ(buf_class->buf_mss, kClasses[cls].buffer_size);
+    for (uint32_t i = 0; i < buf_class->buf_nr; i++) {
+      const uint32_t index = MACHNET_MSGBUF_INDEX(cls, i);
+      const MachnetMsgBuf_t *buf = __machnet_channel_buf(ctx, index);
+      ASSERT_EQ(buf->index, index);
+      ASSERT_EQ(__machnet_channel_buf_index(ctx, buf), index);
+      ASSERT_LE(__machnet_channel_buf_data(buf) + buf_class->buf_mss,
+                __machnet_channel_buf_pool(ctx) +
+                    __machnet_channel_buf_pool_size(ctx));
+    }
+  }
+  EXPECT_FALSE(__machnet_channel_buf_valid(ctx, MACHNET_MSGBUF_INDEX(
+                                                    kClassNr, 0)));
+  EXPECT_FALSE(__machnet_channel_buf_valid(
+      ctx, MACHNET_MSGBUF_INDEX(kLarge, kClasses[kLarge].buf_ring_slot_nr)));
+
+  auto buffer_pools_full = [ctx]() {
+    machnet_detach(ctx);
+    for (uint32_t cls = 0; cls < kClassNr; cls++) {
+      if (__machnet_channel_class_buffers_avail(ctx, cls) !=
+          __machnet_channel_buf_class(ctx, cls)->buf_nr)
+        return false;
+    }
+    return true;
+  };
+
+  // Sends a message of the given size, checks how many buffers of each class
+  // it took, and receives it back.
+  auto send_recv = [ctx](uint32_t msg_size,
+                         std::array<uint32_t, kClassNr> expected) {
+    std::vector<std::vector<uint8_t>> tx_segments;
+    prepare_segments(msg_size, 1, &tx_segments);
+    std::vector<MachnetIovec_t> tx_iov;
+    MachnetFlow_t flow;
+    MachnetMsgHdr_t tx_msghdr;
+    prepare_tx_msg(&flow, &tx_iov, &tx_msghdr, &tx_segments, msg_size);
+    ASSERT_EQ(machnet_sendmsg(ctx, &tx_msghdr), 0) << "Msg size: " << msg_size;
+    ASSERT_EQ(bounce_machnet_to_app(ctx), 1);
+
+    std::array<uint32_t, kClassNr> buffers_nr{};
+    MachnetRingSlot_t index;
+    ASSERT_EQ(__machnet_channel_machnet_ring_peek(ctx, &index), 1);
+    while (true) {
+      ASSERT_TRUE(__machnet_channel_buf_valid(ctx, index));
+      buffers_nr[MACHNET_MSGBUF_INDEX_CLASS(index)]++;
+      const MachnetMsgBuf_t *buf = __machnet_channel_buf(ctx, index);
+      if (!(buf->flags & MACHNET_MSGBUF_FLAGS_SG)) break;
+      index = buf->next;
+    }
+    EXPECT_EQ(buffers_nr, expected) << "Msg size: " << msg_size;
+
+    std::vector<std::vector<uint8_t>> rx_segments;
+    prepare_segments(msg_size, 1, &rx_segments);
+    std::vector<MachnetIovec_t> rx_iov;
+    MachnetMsgHdr_t rx_msghdr;
+    prepare_rx_msg(&rx_iov, &rx_msghdr, &rx_segments, msg_size);
+    EXPECT_EQ(machnet_recvmsg(ctx, &rx_msghdr), 1) << "Msg size: " << msg_size;
+    EXPECT_EQ(rx_segments, tx_segments) << "Msg size: " << msg_size;
+  };
+
+  // Messages take as few buffers as possible, and then waste as little space
+  // as possible; a small tail does not pin a large buffer.
+  send_recv(100, {0, 1, 0});
+  send_recv(192, {0, 1, 0});
+  send_recv(193, {1, 0, 0});
+  send_recv(600, {1, 0, 0});
+  send_recv(1024 + 100, {1, 1, 0});
+  send_recv(1024 + 192, {1, 1, 0});
+  send_recv(1024 + 300, {2, 0, 0});
+  send_recv(1024 + 600, {2, 0, 0});
+  send_recv(2048 + 100, {2, 1, 0});
+  send_recv(kLargeMss, {0, 0, 1});
+  send_recv(kLargeMss + 1000, {1, 0, 1});
+  send_recv(100000, {0, 0, 2});
+  send_recv(MACHNET_MSG_MAX_LEN,
+            {(MACHNET_MSG_MAX_LEN % kLargeMss) / 1024, 0,
+             MACHNET_MSG_MAX_LEN / kLargeMss});
+  EXPECT_TRUE(buffer_pools_full());
+
+  // When a class is exhausted, the message falls back to smaller classes.
+  std::vector<MachnetRingSlot_t> large(__machnet_channel_class_buffers_avail(
+      ctx, kLarge));
+  ASSERT_EQ(__machnet_channel_class_buf_alloc_bulk(ctx, kLarge, large.size(),
+                                                   large.data(), nullptr),
+            large.size());
+  send_recv(100000, {100000 / 1024 + 1, 0, 0});
+  {
+    // Too large for what is left; nothing is leaked.
+    const uint32_t kMsgSize = 4 * MB;
+    std::vector<std::vector<uint8_t>> tx_segments;
+    prepare_segments(kMsgSize, 1, &tx_segments);
+    std::vector<MachnetIovec_t> tx_iov;
+    MachnetFlow_t flow;
+    MachnetMsgHdr_t tx_msghdr;
+    prepare_tx_msg(&flow, &tx_iov, &tx_msghdr, &tx_segments, kMsgSize);
+    EXPECT_EQ(machnet_sendmsg(ctx, &tx_msghdr), -1);
+  }
+  ASSERT_EQ(__machnet_channel_buf_free_bulk(ctx, large.size(), large.data()),
+            large.size());
+  EXPECT_TRUE(buffer_pools_full());
+
+  __machnet_channel_destroy(ctx, channel_size, &channel_fd, is_posix_shm,
+                            kChannelName);
+}
+
+// Calls into the data path until the application has acknowledged the state
+// of an extension segment (the segments are processed in the background).
+bool wait_segment_acked(MachnetChannelCtx_t *ctx, uint32_t cls) {
+  for (int i = 0; i < 10000; i++) {
+    MachnetFlow_t flow;
+    char buf[1];
+    machnet_recv(ctx, buf, sizeof(buf), &flow);
+    if (__machnet_channel_buf_class_acked(ctx, cls)) return true;
+    std::this_thread::sleep_for(std::chrono::microseconds(100));
+  }
+  return false;
+}
+
+TEST(MachnetTest, ExtensionSegments) {
+  const char *kChannelName = "machnet_test_extension_segments";
+  const uint32_t kRingSize = 1 << 8;
+  const uint32_t kBufferSize = 1024;
+  const uint32_t kSegment = 1;
+  const uint32_t kMsgSize = 3 * kBufferSize;
+
+  size_t channel_size;
+  int is_posix_shm;
+  int channel_fd;
+  MachnetChannelCtx_t *ctx = __machnet_channel_create(
+      kChannelName, FLAGS_machnet_slots_nr, FLAGS_app_slots_nr, kRingSize,
+      kBufferSize, &channel_size, &is_posix_shm, &channel_fd);
+  ASSERT_NE(ctx, nullptr);
+
+  // Play Machnet's part: extend the default class, and activate the segment
+  // once the application has mapped it.
+  int segment_fd;
+  ASSERT_EQ(__machnet_channel_segment_create(ctx, kSegment, 0, kRingSize,
+                                             is_posix_shm, &segment_fd),
+            0);
+  if (!is_posix_shm) {
+    // Huge page segments are handed over by the controller.
+    __machnet_channel_segment_destroy(ctx, kSegment, &segment_fd,
+                                      is_posix_shm);
+    __machnet_channel_destroy(ctx, channel_size, &channel_fd, is_posix_shm,
+                              kChannelName);
+    GTEST_SKIP() << "Needs POSIX shared memory.";
+  }
+  ASSERT_TRUE(wait_segment_acked(ctx, kSegment));
+  __machnet_channel_buf_class_set_state(ctx, kSegment,
+                                        MACHNET_CHANNEL_BUF_CLASS_ACTIVE);
+  __machnet_channel_buf_class_order_update(ctx);
+  ASSERT_TRUE(wait_segment_acked(ctx, kSegment));
+
+  // Exhaust the default class; messages are carried by the segment.
+  std::vector<MachnetRingSlot_t> held(
+      __machnet_channel_class_buffers_avail(ctx, 0));
+  ASSERT_EQ(__machnet_channel_class_buf_alloc_bulk(ctx, 0, held.size(),
+                                                   held.data(), nullptr),
+            held.size());
+
+  std::vector<std::vector<uint8_t>> tx_segments;
+  prepare_segments(kMsgSize, 1, &tx_segments);
+  std::vector<MachnetIovec_t> tx_iov;
+  MachnetFlow_t flow;
+  MachnetMsgHdr_t tx_msghdr;
+  prepare_tx_msg(&flow, &tx_iov, &tx_msghdr, &tx_segments, kMsgSize);
+  ASSERT_EQ(machnet_sendmsg(ctx, &tx_msghdr), 0);
+  ASSERT_EQ(bounce_machnet_to_app(ctx), 1);
+  MachnetRingSlot_t index;
+  ASSERT_EQ(__machnet_channel_machnet_ring_peek(ctx, &index), 1);
+  EXPECT_EQ(MACHNET_MSGBUF_INDEX_CLASS(index), kSegment);
+
+  std::vector<std::vector<uint8_t>> rx_segments;
+  prepare_segments(kMsgSize, 1, &rx_segments);
+  std::vector<MachnetIovec_t> rx_iov;
+  MachnetMsgHdr_t rx_msghdr;
+  prepare_rx_msg(&rx_iov, &rx_msghdr, &rx_segments, kMsgSize);
+  ASSERT_EQ(machnet_recvmsg(ctx, &rx_msghdr), 1);
+  EXPECT_EQ(rx_segments, tx_segments);
+
+  // Once the segment is being drained, the application gives back the buffers
+  // it cached from it, and no longer uses it.
+  __machnet_channel_buf_class_set_state(ctx, kSegment,
+                                        MACHNET_CHANNEL_BUF_CLASS_DRAINING);
+  __machnet_channel_buf_class_order_update(ctx);
+  ASSERT_TRUE(wait_segment_acked(ctx, kSegment));
+  EXPECT_EQ(machnet_sendmsg(ctx, &tx_msghdr), -1);
+  EXPECT_EQ(__machnet_channel_class_buffers_avail(ctx, kSegment),
+            kRingSize - 1);
+
+  ASSERT_EQ(__machnet_channel_buf_free_bulk(ctx, held.size(), held.data()),
+            held.size());
+  EXPECT_EQ(machnet_sendmsg(ctx, &tx_msghdr), 0);
+  ASSERT_EQ(bounce_machnet_to_app(ctx), 1);
+  ASSERT_EQ(__machnet_channel_machnet_ring_peek(ctx, &index), 1);
+  EXPECT_EQ(MACHNET_MSGBUF_INDEX_CLASS(index), 0);
+  EXPECT_EQ(machnet_recvmsg(ctx, &rx_msghdr), 1);
+
+  // Reclaim the segment; the application unmaps it.
+  __machnet_channel_buf_class_set_state(ctx, kSegment,
+                                        MACHNET_CHANNEL_BUF_CLASS_UNMAPPING);
+  ASSERT_TRUE(wait_segment_acked(ctx, kSegment));
+  machnet_detach(ctx);
+  __machnet_channel_segment_destroy(ctx, kSegment, &segment_fd, is_posix_shm);
+  EXPECT_EQ(__machnet_channel_buffers_avail(ctx), kRingSize - 1);
+  __machnet_channel_destroy(ctx, channel_size, &channel_fd, is_posix_shm,
+                            kChannelName);
+}
+
+TEST(MachnetTest, CopyKernels) {
+  const size_t kMaxLen = 64 * 1024;
+  const size_t kGuard = 64;
+  std::vector<uint8_t> src(kMaxLen + kGuard);
+  std::generate(src.begin(), src.end(), std::ref(mersenne_engine));
+  std::vector<uint8_t> dst(kMaxLen + 2 * kGuard);
+
+  for (int kernel = 0; kernel < MACHNET_COPY_KERNEL_NR; kernel++) {
+    const auto k = static_cast<machnet_copy_kernel>(kernel);
+    if (!__machnet_copy_kernel_supported(k)) continue;
+    for (int nt = 0; nt <= 1; nt++) {
+      const machnet_copy_fn_t copy = __machnet_copy_kernel_fn(k, nt);
+      ASSERT_NE(copy, nullptr) << __machnet_copy_kernel_name(k);
+      for (size_t len = 0; len <= kMaxLen;
+           len = len < 1024 ? len + 7 : len * 3) {
+        for (size_t ofs : {0, 1, 17, 33}) {
+          std::fill(dst.begin(), dst.end(), 0xA5);
+          copy(&dst[kGuard + ofs], &src[ofs], len);
+          __machnet_copy_fence(nt);
+          EXPECT_EQ(memcmp(&dst[kGuard + ofs], &src[ofs], len), 0)
+              << __machnet_copy_kernel_name(k) << " nt " << nt << " len "
+              << len << " ofs " << ofs;
+          // Nothing outside the destination range is touched.
+          EXPECT_TRUE(std::all_of(dst.begin(), dst.begin() + kGuard + ofs,
+                                  [](uint8_t b) { return b == 0xA5; }));
+          EXPECT_TRUE(std::all_of(dst.begin() + kGuard + ofs + len, dst.end(),
+                                  [](uint8_t b) { return b == 0xA5; }));
+        }
+      }
+    }
+  }
+}
+
 int main(int argc, char **argv) {
   ::google::InitGoogleLogging(argv[0]);
   testing::InitGoogleTest(&argc, argv);
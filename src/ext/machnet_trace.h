@@ -0,0 +1,76 @@
+/**
+ * @file  machnet_trace.h
+ * @brief Workload traces: the sequence of request/response exchanges of an
+ * application, as recorded by the Machnet library and replayed by `msg_gen'
+ * (see `--trace_file').
+ *
+ * The library records a trace when the `MACHNET_TRACE_FILE' environment
+ * variable names a file at `machnet_init()' time. A request is the message that
+ * opens an exchange on a flow: the messages the application sends on flows it
+ * created with `machnet_connect()', and the messages it receives on the other
+ * flows. Machnet delivers the messages of a flow in order, so each response is
+ * paired with the oldest pending request of its flow.
+ *
+ * A trace file is a `MachnetTraceHdr' followed by `MachnetTraceRecord's, one
+ * per exchange, in the order the exchanges complete. Requests still pending
+ * when the trace stops are recorded with a zero response size.
+ */
+
+#ifndef SRC_EXT_MACHNET_TRACE_H_
+#define SRC_EXT_MACHNET_TRACE_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+#define MACHNET_TRACE_FILE_ENV "MACHNET_TRACE_FILE"
+#define MACHNET_TRACE_MAGIC 0x52544e4d  // "MNTR"
+#define MACHNET_TRACE_VERSION 1
+// Flows tracked by the recorder; exchanges on other flows are not recorded,
+// and their messages are counted and reported when the trace stops.
+#define MACHNET_TRACE_FLOWS_MAX 4096
+// Requests pending per flow; older ones are recorded without a response.
+#define MACHNET_TRACE_PENDING_MAX 64
+
+struct MachnetTraceHdr {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t reserved;
+};
+typedef struct MachnetTraceHdr MachnetTraceHdr_t;
+
+struct MachnetTraceRecord {
+  uint64_t timestamp_ns;  // When the request was sent or received, since the
+                          // start of the trace.
+  uint32_t flow_id;       // Flows are numbered from 0, in order of appearance.
+  uint32_t req_size;
+  uint32_t resp_size;
+} __attribute__((packed));
+typedef struct MachnetTraceRecord MachnetTraceRecord_t;
+
+/**
+ * @brief NOT part of the public API.
+ *
+ * Starts recording the exchanges of the application to a trace file.
+ * `machnet_init()' calls it when `MACHNET_TRACE_FILE' is set.
+ *
+ * @param path The trace file, which is truncated.
+ * @return 0 on success, -1 on failure (including a trace already recorded).
+ */
+int machnet_trace_start(const char *path);
+
+/**
+ * @brief NOT part of the public API.
+ *
+ * Stops recording, and closes the trace file. This runs at exit when the trace
+ * was started by `machnet_init()'.
+ */
+void machnet_trace_stop(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // SRC_EXT_MACHNET_TRACE_H_
@@ -10,8 +10,10 @@
 #include <dpdk.h>
 #include <ether.h>
 #include <ipv4.h>
+#include <neighbor.h>
 #include <packet.h>
 #include <pmd.h>
+#include <ttime.h>
 
 #include <unordered_set>
 
@@ -67,9 +69,10 @@ static_assert(sizeof(Arp) == 28, "Arp size mismatch");
 
 /**
  * @brief This class implements a minimal ARP layer. It is used to resolve IP
- * addresses to MAC addresses.
+ * addresses to MAC addresses, which it keeps in a `NeighborTable'.
  *
- * This class is not thread-safe.
+ * Once the local IP addresses are set, resolving addresses and processing ARP
+ * packets is thread-safe; `AddLocalIpAddr()' is not.
  *
  * NOTE: No IPv6 support yet.
  */
@@ -103,17 +106,20 @@ class ArpHandler {
 
   /**
    * @brief This method is called to issue an ARP who-has request in the LAN.
-   * The system owning the remote IP needs to respond with an ARP reply.
+   * The system owning the remote IP needs to respond with an ARP reply. The
+   * request is staged on the TX ring; the caller flushes it.
    *
    * @param local_ip  The IP address of the local machine.
    * @param target_ip The IP address of the target machine.
    */
-  void RequestL2Addr(const dpdk::TxRing *txring, const Ipv4::Address &local_ip,
+  void RequestL2Addr(dpdk::TxRing *txring, const Ipv4::Address &local_ip,
                      const Ipv4::Address &target_ip) {
     DCHECK_NOTNULL(txring);
     DCHECK_NOTNULL(txring->GetPacketPool());
     auto *packet = txring->GetPacketPool()->PacketAlloc();
-    CHECK_NOTNULL(packet);
+    // Out of packets; the request is retried, or the peer asks again.
+    if (packet == nullptr) [[unlikely]]
+      return;
 
     auto *eh = packet->append<Ethernet *>(sizeof(Ethernet) + sizeof(Arp));
     CHECK_NOTNULL(eh);
@@ -137,9 +143,40 @@ class ArpHandler {
     arph->ipv4_data.tha = net::Ethernet::kZeroAddr;
     arph->ipv4_data.tpa = target_ip;
 
-    // Send the ARP request.
-    auto nb_tx = txring->TrySendPackets(&packet, 1);
-    LOG_IF(WARNING, nb_tx != 1) << "Failed to send ARP request";
+    // Stage the ARP request.
+    txring->StagePackets(&packet, 1);
+  }
+
+  /**
+   * @brief Announces a local IP address with a gratuitous ARP request, so
+   * that the neighbours that know it update their caches (e.g., after a
+   * restart or a migration). The request is staged on the TX ring; the caller
+   * flushes it.
+   *
+   * @param local_ip The IP address to announce.
+   */
+  void Announce(dpdk::TxRing *txring, const Ipv4::Address &local_ip) {
+    RequestL2Addr(txring, local_ip, local_ip);
+  }
+
+  /**
+   * @brief Ages the neighbour table: evicts the entries that were not
+   * confirmed for too long, and asks the stale ones again. The requests are
+   * staged on the TX ring; the caller flushes them.
+   *
+   * @param now The current TSC.
+   */
+  void RefreshNeighbors(dpdk::TxRing *txring, uint64_t now) {
+    std::vector<Ipv4::Address> stale;
+    const auto nb_expired = neighbors_.Age(now, &stale);
+    LOG_IF(INFO, nb_expired > 0)
+        << "Evicted " << nb_expired << " expired ARP entries.";
+    if (stale.empty() || local_ip_addrs_.empty()) return;
+
+    const auto &local_ip = *local_ip_addrs_.begin();
+    for (const auto &target_ip : stale) {
+      RequestL2Addr(txring, local_ip, target_ip);
+    }
   }
 
   /**
@@ -148,12 +185,14 @@ class ArpHandler {
    * @param rx_arph A pointer to the received packet's ARP header.
    * @param local_ip local IP address which will be used to generate the reply.
    */
-  void Reply(const dpdk::TxRing *txring, const Arp *rx_arph,
+  void Reply(dpdk::TxRing *txring, const Arp *rx_arph,
              const Ipv4::Address &local_ip) const {
     DCHECK_NOTNULL(txring);
     DCHECK_NOTNULL(txring->GetPacketPool());
     auto *packet = txring->GetPacketPool()->PacketAlloc();
-    CHECK_NOTNULL(packet);
+    // Out of packets; the request is retried, or the peer asks again.
+    if (packet == nullptr) [[unlikely]]
+      return;
 
     auto *eh = packet->append<Ethernet *>(sizeof(Ethernet) + sizeof(Arp));
     CHECK_NOTNULL(eh);
@@ -175,9 +214,8 @@ class ArpHandler {
     arph->ipv4_data.tha = rx_arph->ipv4_data.sha;
     arph->ipv4_data.tpa = rx_arph->ipv4_data.spa;
 
-    // Send the ARP reply.
-    auto nb_tx = txring->TrySendPackets(&packet, 1);
-    LOG_IF(WARNING, nb_tx != 1) << "Failed to send ARP reply";
+    // Stage the ARP reply.
+    txring->StagePackets(&packet, 1);
   }
 
   /**
@@ -190,12 +228,11 @@ class ArpHandler {
    * @return The MAC address of the target machine, if found in the cache, or
    *        `std::nullopt` otherwise.
    */
-  std::optional<Ethernet::Address> GetL2Addr(const dpdk::TxRing *txring,
+  std::optional<Ethernet::Address> GetL2Addr(dpdk::TxRing *txring,
                                              const Ipv4::Address &local_ip,
                                              const Ipv4::Address &target_ip) {
-    if (arp_table_.find(target_ip) != arp_table_.end()) {
-      return arp_table_[target_ip];
-    }
+    const auto l2addr = neighbors_.Lookup(target_ip);
+    if (l2addr.has_value()) return l2addr;
 
     // Destination L2 Adress not found in the cache; issue an ARP who-has
     // request for the given target IP address.
@@ -234,43 +271,50 @@ class ArpHandler {
       return;
     }
 
+    const auto op = arph->op.value();
+    if (op != Arp::ArpOp::kRequest && op != Arp::ArpOp::kReply) [[unlikely]] {
+      LOG(WARNING) << "Received ARP packet with unsupported operation.";
+      return;
+    }
+
     static const Ipv4::Address zero_addr(0u);
-    auto target_ip = arph->ipv4_data.tpa;
-    // Check ARP opcode, and handle operation.
-    switch (arph->op.value()) {
-      case Arp::ArpOp::kRequest:
-        // Check if this request is for us.
-        if (local_ip_addrs_.find(target_ip) == local_ip_addrs_.end()) break;
-        Reply(txring, arph, target_ip);
-        break;
-      case Arp::ArpOp::kReply:
-        // Check if the ARP reply is for us.
-        if (local_ip_addrs_.find(target_ip) == local_ip_addrs_.end()) break;
-        // Update the cache.
-        arp_table_[arph->ipv4_data.spa] = arph->ipv4_data.sha;
-        break;
-      default:
-        LOG(WARNING) << "Received ARP packet with unsupported operation.";
-        return;
+    const auto sender_ip = arph->ipv4_data.spa;
+    const auto target_ip = arph->ipv4_data.tpa;
+    const bool for_us =
+        local_ip_addrs_.find(target_ip) != local_ip_addrs_.end();
+    // As in RFC 826, the sender's address updates the entry we already have
+    // for it (this is how gratuitous ARP works), and is only added if the
+    // packet is for us. Probes (RFC 5227) carry no sender address.
+    if (sender_ip != zero_addr &&
+        local_ip_addrs_.find(sender_ip) == local_ip_addrs_.end()) {
+      neighbors_.Update(sender_ip, arph->ipv4_data.sha, time::rdtsc(),
+                        for_us);
     }
+
+    if (op == Arp::ArpOp::kRequest && for_us) Reply(txring, arph, target_ip);
+  }
+
+  const NeighborTable &GetNeighborTable() const { return neighbors_; }
+
+  // Static neighbour entries (see `NeighborTable::Pin()').
+  void PinNeighbor(const Ipv4::Address &addr,
+                   const Ethernet::Address &l2addr) {
+    neighbors_.Pin(addr, l2addr);
+  }
+  bool UnpinNeighbor(const Ipv4::Address &addr) {
+    return neighbors_.Unpin(addr);
   }
 
   std::vector<std::tuple<std::string, std::string>> GetArpTableEntries() const {
-    std::vector<std::tuple<std::string, std::string>> arp_table;
-    for (auto &kv : arp_table_) {
-      std::string ip_addr = kv.first.ToString();
-      std::string l2_addr = kv.second.ToString();
-      arp_table.emplace_back(ip_addr, l2_addr);
-    }
-    return arp_table;
+    return neighbors_.GetEntries();
   }
 
-  size_t GetArpTableSize() const { return arp_table_.size(); }
+  size_t GetArpTableSize() const { return neighbors_.GetSize(); }
 
  private:
   const Ethernet::Address local_l2addr_;
   std::unordered_set<Ipv4::Address> local_ip_addrs_;
-  std::unordered_map<Ipv4::Address, Ethernet::Address> arp_table_{};
+  NeighborTable neighbors_{};
 };
 
 }  // namespace juggler
@@ -0,0 +1,377 @@
+/**
+ * @file capture.h
+ * @brief Packet capture: the filter that selects packets by their 5-tuple, the
+ * record a captured packet is copied to, and the pcapng writer the records end
+ * up in (see `CaptureTap' for the engine side).
+ */
+#ifndef SRC_INCLUDE_CAPTURE_H_
+#define SRC_INCLUDE_CAPTURE_H_
+
+#include <ether.h>
+#include <ipv4.h>
+#include <udp.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace juggler {
+
+/**
+ * @brief Direction of a captured packet; the values are those of the pcapng
+ * `epb_flags' option.
+ */
+enum class CaptureDirection : uint8_t {
+  kRx = 1,
+  kTx = 2,
+};
+
+/**
+ * @brief A captured packet, truncated to the snapshot length. Records are
+ * fixed-size, so that they can be passed through a ring of elements.
+ */
+struct CaptureRecord {
+  static constexpr size_t kSize = 256;
+  static constexpr size_t kMaxSnapLen = kSize - 16;
+  uint64_t tsc;      // When the packet was received or staged for TX.
+  uint32_t pkt_len;  // Original length of the packet.
+  uint16_t cap_len;  // Bytes of the packet in `data'.
+  uint8_t direction;  // `CaptureDirection'.
+  uint8_t reserved;
+  uint8_t data[kMaxSnapLen];
+};
+static_assert(sizeof(CaptureRecord) == CaptureRecord::kSize,
+              "CaptureRecord size mismatch");
+
+/**
+ * @brief Selects packets by their 5-tuple, with a subset of the BPF (tcpdump)
+ * syntax: primitives joined with `and', each one of
+ *   ip | arp | udp | icmp
+ *   [src|dst] host <IPv4 address>
+ *   [src|dst] port <UDP port>
+ * Without `src' or `dst', a host or port matches either side. The empty filter
+ * matches every packet.
+ */
+class CaptureFilter {
+ public:
+  CaptureFilter() = default;
+
+  /**
+   * @brief Parses a filter expression.
+   *
+   * @param expr The expression, e.g., "host 10.0.0.2 and dst port 888".
+   * @return The filter, or std::nullopt if the expression is invalid.
+   */
+  static std::optional<CaptureFilter> Parse(const std::string &expr) {
+    std::istringstream tokens(expr);
+    std::vector<std::string> words;
+    for (std::string word; tokens >> word;) words.push_back(word);
+
+    CaptureFilter filter;
+    size_t i = 0;
+    while (i < words.size()) {
+      if (!filter.terms_.empty()) {
+        if (words[i] != "and" && words[i] != "&&") return std::nullopt;
+        if (++i == words.size()) return std::nullopt;
+      }
+
+      Term term;
+      if (words[i] == "ip" || words[i] == "arp") {
+        term.kind = Term::Kind::kEtherType;
+        term.value =
+            words[i] == "ip" ? net::Ethernet::kIpv4 : net::Ethernet::kArp;
+        filter.terms_.push_back(term);
+        i++;
+        continue;
+      }
+      if (words[i] == "udp" || words[i] == "icmp") {
+        term.kind = Term::Kind::kIpProto;
+        term.value = words[i] == "udp" ? net::Ipv4::Proto::kUdp
+                                        : net::Ipv4::Proto::kIcmp;
+        filter.terms_.push_back(term);
+        i++;
+        continue;
+      }
+
+      if (words[i] == "src" || words[i] == "dst") {
+        term.dir = words[i] == "src" ? kDirSrc : kDirDst;
+        if (++i == words.size()) return std::nullopt;
+      }
+      if (i + 1 >= words.size()) return std::nullopt;
+      const auto &value = words[i + 1];
+      if (words[i] == "host") {
+        const auto addr = net::Ipv4::Address::MakeAddress(value);
+        if (!addr.has_value()) return std::nullopt;
+        term.kind = Term::Kind::kHost;
+        term.value = addr->address.value();
+      } else if (words[i] == "port") {
+        char *end;
+        errno = 0;
+        const auto port = std::strtoul(value.c_str(), &end, 10);
+        if (errno != 0 || *end != '\0' || value.empty() || port > UINT16_MAX)
+          return std::nullopt;
+        term.kind = Term::Kind::kPort;
+        term.value = port;
+      } else {
+        return std::nullopt;
+      }
+      filter.terms_.push_back(term);
+      i += 2;
+    }
+    filter.expr_ = expr;
+    return filter;
+  }
+
+  /**
+   * @brief Checks a packet against the filter.
+   *
+   * @param data The packet, starting from its Ethernet header.
+   * @param len Bytes available at `data'.
+   * @return True if the packet matches.
+   */
+  bool Match(const uint8_t *data, size_t len) const {
+    if (terms_.empty()) return true;
+    using net::Ethernet;
+    using net::Ipv4;
+    using net::Udp;
+    if (len < sizeof(Ethernet)) return false;
+
+    const auto *eh = reinterpret_cast<const Ethernet *>(data);
+    const uint16_t ether_type = eh->eth_type.value();
+    const Ipv4 *ipv4h = nullptr;
+    const Udp *udph = nullptr;
+    if (ether_type == Ethernet::kIpv4 &&
+        len >= sizeof(Ethernet) + sizeof(Ipv4)) {
+      ipv4h = reinterpret_cast<const Ipv4 *>(data + sizeof(Ethernet));
+      const size_t ipv4_hdr_len = (ipv4h->version_ihl & 0xf) * 4;
+      if (ipv4h->next_proto_id == Ipv4::Proto::kUdp &&
+          len >= sizeof(Ethernet) + ipv4_hdr_len + sizeof(Udp)) {
+        udph = reinterpret_cast<const Udp *>(data + sizeof(Ethernet) +
+                                             ipv4_hdr_len);
+      }
+    }
+
+    for (const auto &term : terms_) {
+      bool match = false;
+      switch (term.kind) {
+        case Term::Kind::kEtherType:
+          match = ether_type == term.value;
+          break;
+        case Term::Kind::kIpProto:
+          match = ipv4h != nullptr && ipv4h->next_proto_id == term.value;
+          break;
+        case Term::Kind::kHost:
+          match = ipv4h != nullptr &&
+                  (((term.dir & kDirSrc) &&
+                    ipv4h->src_addr.address.value() == term.value) ||
+                   ((term.dir & kDirDst) &&
+                    ipv4h->dst_addr.address.value() == term.value));
+          break;
+        case Term::Kind::kPort:
+          match = udph != nullptr &&
+                  (((term.dir & kDirSrc) &&
+                    udph->src_port.port.value() == term.value) ||
+                   ((term.dir & kDirDst) &&
+                    udph->dst_port.port.value() == term.value));
+          break;
+      }
+      if (!match) return false;
+    }
+    return true;
+  }
+
+  const std::string &ToString() const { return expr_; }
+
+ private:
+  static constexpr uint8_t kDirSrc = 1 << 0;
+  static constexpr uint8_t kDirDst = 1 << 1;
+  static constexpr uint8_t kDirAny = kDirSrc | kDirDst;
+
+  struct Term {
+    enum class Kind : uint8_t { kEtherType, kIpProto, kHost, kPort };
+    Kind kind{Kind::kEtherType};
+    uint8_t dir{kDirAny};
+    uint32_t value{0};
+  };
+
+  std::vector<Term> terms_;
+  std::string expr_;
+};
+
+/**
+ * @brief Converts TSC timestamps to wall-clock time, from a reference point
+ * taken when the capture starts.
+ */
+class CaptureClock {
+ public:
+  CaptureClock(uint64_t tsc, uint64_t realtime_ns, uint64_t tsc_hz)
+      : tsc_(tsc), realtime_ns_(realtime_ns), tsc_hz_(tsc_hz) {}
+
+  uint64_t ToNs(uint64_t tsc) const {
+    if (tsc < tsc_ || tsc_hz_ == 0) return realtime_ns_;
+    const auto cycles = tsc - tsc_;
+    // Split the conversion so that it does not overflow.
+    return realtime_ns_ + cycles / tsc_hz_ * 1000000000 +
+           cycles % tsc_hz_ * 1000000000 / tsc_hz_;
+  }
+
+ private:
+  const uint64_t tsc_;
+  const uint64_t realtime_ns_;
+  const uint64_t tsc_hz_;
+};
+
+/**
+ * @brief Writes packets to a file descriptor in the pcapng format, with
+ * nanosecond timestamps and the direction of each packet. Blocks are
+ * buffered, and written out once enough accumulate or on `Flush()'.
+ */
+class PcapngWriter {
+ public:
+  static constexpr uint32_t kBlockTypeShb = 0x0a0d0d0a;
+  static constexpr uint32_t kBlockTypeIdb = 0x00000001;
+  static constexpr uint32_t kBlockTypeEpb = 0x00000006;
+  static constexpr uint32_t kByteOrderMagic = 0x1a2b3c4d;
+  static constexpr uint16_t kLinkTypeEthernet = 1;
+  static constexpr size_t kFlushThreshold = 64 * 1024;
+
+  /**
+   * @param fd File descriptor to write to; not owned.
+   * @param application Name of the application, recorded in the header.
+   */
+  PcapngWriter(int fd, const std::string &application) : fd_(fd) {
+    const auto start = BeginBlock(kBlockTypeShb);
+    Append<uint32_t>(kByteOrderMagic);
+    Append<uint16_t>(1);  // Major version.
+    Append<uint16_t>(0);  // Minor version.
+    Append<int64_t>(-1);  // Section length (unknown).
+    AppendOption(kOptShbUserAppl, application.data(), application.size());
+    AppendOption(kOptEndOfOpt, nullptr, 0);
+    EndBlock(start);
+  }
+  PcapngWriter(const PcapngWriter &) = delete;
+  PcapngWriter &operator=(const PcapngWriter &) = delete;
+
+  /**
+   * @brief Adds an Ethernet interface; packets refer to interfaces by the
+   * order they were added in, from 0.
+   *
+   * @param name Name of the interface.
+   * @param snaplen Maximum number of bytes captured per packet.
+   */
+  void AddInterface(const std::string &name, uint32_t snaplen) {
+    const auto start = BeginBlock(kBlockTypeIdb);
+    Append<uint16_t>(kLinkTypeEthernet);
+    Append<uint16_t>(0);
+    Append<uint32_t>(snaplen);
+    AppendOption(kOptIfName, name.data(), name.size());
+    const uint8_t tsresol = 9;  // Nanoseconds.
+    AppendOption(kOptIfTsresol, &tsresol, sizeof(tsresol));
+    AppendOption(kOptEndOfOpt, nullptr, 0);
+    EndBlock(start);
+  }
+
+  /**
+   * @brief Writes a packet.
+   *
+   * @param interface Index of the interface (see `AddInterface()').
+   * @param timestamp_ns Wall-clock time of the packet, in nanoseconds.
+   * @param data The captured bytes of the packet.
+   * @param cap_len Number of captured bytes.
+   * @param pkt_len Original length of the packet.
+   * @param direction Direction of the packet.
+   * @return False if writing to the file descriptor failed.
+   */
+  bool WritePacket(uint32_t interface, uint64_t timestamp_ns,
+                   const uint8_t *data, uint32_t cap_len, uint32_t pkt_len,
+                   CaptureDirection direction) {
+    const auto start = BeginBlock(kBlockTypeEpb);
+    Append<uint32_t>(interface);
+    Append<uint32_t>(timestamp_ns >> 32);
+    Append<uint32_t>(timestamp_ns & 0xffffffff);
+    Append<uint32_t>(cap_len);
+    Append<uint32_t>(pkt_len);
+    AppendPadded(data, cap_len);
+    const auto flags = static_cast<uint32_t>(direction);
+    AppendOption(kOptEpbFlags, &flags, sizeof(flags));
+    AppendOption(kOptEndOfOpt, nullptr, 0);
+    EndBlock(start);
+    packets_++;
+
+    if (buffer_.size() >= kFlushThreshold) return Flush();
+    return !failed_;
+  }
+
+  /**
+   * @brief Writes out the buffered blocks.
+   * @return False if writing to the file descriptor failed (now or earlier).
+   */
+  bool Flush() {
+    size_t written = 0;
+    while (!failed_ && written < buffer_.size()) {
+      const auto ret =
+          write(fd_, buffer_.data() + written, buffer_.size() - written);
+      if (ret < 0 && errno == EINTR) continue;
+      if (ret <= 0) {
+        failed_ = true;
+        break;
+      }
+      written += ret;
+    }
+    buffer_.clear();
+    return !failed_;
+  }
+
+  uint64_t GetPacketCount() const { return packets_; }
+
+ private:
+  static constexpr uint16_t kOptEndOfOpt = 0;
+  static constexpr uint16_t kOptShbUserAppl = 4;
+  static constexpr uint16_t kOptIfName = 2;
+  static constexpr uint16_t kOptIfTsresol = 9;
+  static constexpr uint16_t kOptEpbFlags = 2;
+
+  template <typename T>
+  void Append(T value) {
+    buffer_.append(reinterpret_cast<const char *>(&value), sizeof(value));
+  }
+
+  void AppendPadded(const void *data, size_t len) {
+    buffer_.append(reinterpret_cast<const char *>(data), len);
+    buffer_.append((4 - len % 4) % 4, '\0');
+  }
+
+  void AppendOption(uint16_t code, const void *value, uint16_t len) {
+    Append<uint16_t>(code);
+    Append<uint16_t>(len);
+    AppendPadded(value, len);
+  }
+
+  size_t BeginBlock(uint32_t type) {
+    const auto start = buffer_.size();
+    Append<uint32_t>(type);
+    Append<uint32_t>(0);  // Total length, filled in by `EndBlock()'.
+    return start;
+  }
+
+  void EndBlock(size_t start) {
+    const uint32_t len = buffer_.size() - start + sizeof(uint32_t);
+    std::memcpy(buffer_.data() + start + sizeof(uint32_t), &len, sizeof(len));
+    Append<uint32_t>(len);
+  }
+
+  const int fd_;
+  std::string buffer_;
+  bool failed_{false};
+  uint64_t packets_{0};
+};
+
+}  // namespace juggler
+
+#endif  // SRC_INCLUDE_CAPTURE_H_
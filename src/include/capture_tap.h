@@ -0,0 +1,188 @@
+/**
+ * @file capture_tap.h
+ * @brief Engine side of packet capture: copies the packets an engine receives
+ * and sends, if they match the filter, into a ring that a capture thread
+ * drains (see `capture.h').
+ */
+#ifndef SRC_INCLUDE_CAPTURE_TAP_H_
+#define SRC_INCLUDE_CAPTURE_TAP_H_
+
+#include <capture.h>
+#include <glog/logging.h>
+#include <jring.h>
+#include <packet.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <optional>
+
+namespace juggler {
+
+/**
+ * @brief Capture tap of an engine. The engine thread is the only producer of
+ * the ring and the capture thread the only consumer.
+ *
+ * The configuration is requested from any thread, and applied by the engine
+ * on its next slow tick (see `Update()'), so that the data path never takes
+ * a lock. Packets are copied, up to the snapshot length, rather than
+ * referenced: the mbufs go back to the NIC and the channels at once, whatever
+ * the pace of the capture thread. If the ring is full, packets are not
+ * captured, and counted as dropped.
+ */
+class CaptureTap {
+ public:
+  static constexpr uint32_t kRingSlots = 4096;
+
+  struct Config {
+    CaptureFilter filter;
+    uint32_t snaplen;
+  };
+
+  CaptureTap() {
+    const auto ring_size =
+        jring_get_buf_ring_size(sizeof(CaptureRecord), kRingSlots);
+    ring_ = static_cast<struct jring *>(
+        std::aligned_alloc(CACHE_LINE_SIZE, ring_size));
+    CHECK_NOTNULL(ring_);
+    CHECK_EQ(jring_init(ring_, kRingSlots, sizeof(CaptureRecord), 0, 0), 0);
+  }
+  ~CaptureTap() { std::free(ring_); }
+  CaptureTap(const CaptureTap &) = delete;
+  CaptureTap &operator=(const CaptureTap &) = delete;
+
+  /**
+   * @brief Requests a new configuration; std::nullopt stops capturing. Safe to
+   * call from any thread.
+   */
+  void Configure(std::optional<Config> config) {
+    const std::lock_guard<std::mutex> lock(mtx_);
+    pending_ = std::move(config);
+    requested_gen_.fetch_add(1, std::memory_order_release);
+  }
+
+  /**
+   * @return True once the engine applied the last configuration requested.
+   */
+  bool IsConfigApplied() const {
+    return applied_gen_.load(std::memory_order_acquire) ==
+           requested_gen_.load(std::memory_order_acquire);
+  }
+
+  /**
+   * @brief Applies the last configuration requested, if it changed. Must only
+   * be called by the engine thread.
+   *
+   * @return True if the configuration changed.
+   */
+  bool Update() {
+    const auto gen = requested_gen_.load(std::memory_order_acquire);
+    if (gen == applied_gen_.load(std::memory_order_relaxed)) [[likely]]
+      return false;
+
+    const std::lock_guard<std::mutex> lock(mtx_);
+    enabled_ = pending_.has_value();
+    if (enabled_) {
+      filter_ = pending_->filter;
+      snaplen_ = std::min<uint32_t>(pending_->snaplen,
+                                    CaptureRecord::kMaxSnapLen);
+    }
+    applied_gen_.store(requested_gen_.load(std::memory_order_relaxed),
+                       std::memory_order_release);
+    return true;
+  }
+
+  /**
+   * @return True if the engine is capturing packets.
+   */
+  bool IsEnabled() const { return enabled_; }
+
+  /**
+   * @brief Captures the packets that match the filter. Must only be called by
+   * the engine thread.
+   *
+   * @param pkts Packets to capture.
+   * @param nb_pkts Number of packets.
+   * @param direction Whether the packets were received or are being sent.
+   * @param tsc Timestamp of the packets.
+   */
+  void Tap(dpdk::Packet *const *pkts, uint16_t nb_pkts,
+           CaptureDirection direction, uint64_t tsc) {
+    if (!enabled_) return;
+
+    CaptureRecord records[dpdk::PacketBatch::kMaxBurst];
+    while (nb_pkts > 0) {
+      const uint16_t n =
+          std::min<uint16_t>(nb_pkts, dpdk::PacketBatch::kMaxBurst);
+      uint32_t nb_records = 0;
+      for (uint16_t i = 0; i < n; i++) {
+        const auto *pkt = pkts[i];
+        const auto *data = pkt->head_data<const uint8_t *>();
+        const uint16_t seg_len = pkt->seg_length();
+        if (!filter_.Match(data, seg_len)) continue;
+
+        auto *record = &records[nb_records++];
+        record->tsc = tsc;
+        record->pkt_len = pkt->length();
+        record->cap_len = std::min<uint32_t>(seg_len, snaplen_);
+        record->direction = static_cast<uint8_t>(direction);
+        record->reserved = 0;
+        std::memcpy(record->data, data, record->cap_len);
+      }
+
+      const auto enqueued =
+          jring_sp_enqueue_burst(ring_, records, nb_records, nullptr);
+      StatsAdd(&captured_, enqueued);
+      StatsAdd(&dropped_, nb_records - enqueued);
+      pkts += n;
+      nb_pkts -= n;
+    }
+  }
+
+  /**
+   * @brief Takes captured packets off the ring. Must only be called by the
+   * (single) capture thread.
+   *
+   * @param records Array to store the records to.
+   * @param nb_records Size of the array.
+   * @return The number of records stored.
+   */
+  uint32_t Drain(CaptureRecord *records, uint32_t nb_records) {
+    return jring_sc_dequeue_burst(ring_, records, nb_records, nullptr);
+  }
+
+  // Packets captured, and packets not captured because the ring was full.
+  uint64_t GetCaptured() const {
+    return captured_.load(std::memory_order_relaxed);
+  }
+  uint64_t GetDropped() const {
+    return dropped_.load(std::memory_order_relaxed);
+  }
+
+ private:
+  // The engine is the only writer of the counters.
+  static void StatsAdd(std::atomic<uint64_t> *counter, uint64_t value) {
+    if (value == 0) return;
+    counter->store(counter->load(std::memory_order_relaxed) + value,
+                   std::memory_order_relaxed);
+  }
+
+  struct jring *ring_;
+  std::mutex mtx_;
+  std::optional<Config> pending_;
+  std::atomic<uint64_t> requested_gen_{0};
+  std::atomic<uint64_t> applied_gen_{0};
+  // Configuration in use; only accessed by the engine thread.
+  bool enabled_{false};
+  CaptureFilter filter_{};
+  uint32_t snaplen_{0};
+  std::atomic<uint64_t> captured_{0};
+  std::atomic<uint64_t> dropped_{0};
+};
+
+}  // namespace juggler
+
+#endif  // SRC_INCLUDE_CAPTURE_TAP_H_
@@ -5,6 +5,7 @@
 #ifndef SRC_INCLUDE_CC_H_
 #define SRC_INCLUDE_CC_H_
 
+#include <algorithm>
 #include <cstddef>
 #include <cstdint>
 #include <vector>
@@ -64,6 +65,9 @@ struct Pcb {
          ", cwnd: " + std::to_string(cwnd) +
          ", fast_rexmits: " + std::to_string(fast_rexmits) +
          ", rto_rexmits: " + std::to_string(rto_rexmits) +
+         ", deferred_acks: " + std::to_string(deferred_acks) +
+         ", tx_pauses: " + std::to_string(tx_pauses) +
+         ", srtt_us: " + std::to_string(srtt_us) +
          ", effective_wnd: " + std::to_string(effective_wnd());
     return s;
   }
@@ -86,6 +90,12 @@ struct Pcb {
   }
   void rto_advance() { rto_timer++; }
 
+  // Account an RTT sample; the smoothed RTT follows RFC 6298 (gain 1/8).
+  void rtt_sample(uint32_t rtt_us) {
+    srtt_us = srtt_us == 0 ? rtt_us : srtt_us - srtt_us / 8 + rtt_us / 8;
+    min_rtt_us = min_rtt_us == 0 ? rtt_us : std::min(min_rtt_us, rtt_us);
+  }
+
   void sack_bitmap_shift_right_one() {
     constexpr size_t sack_bitmap_bucket_max_idx =
         kSackBitmapSize / sizeof(sack_bitmap[0]) - 1;
@@ -131,6 +141,16 @@ struct Pcb {
   int rto_timer{kRtoDisabled};
   uint16_t fast_rexmits{0};
   uint16_t rto_rexmits{0};
+  // ACKs held back, and transmissions paused, because the TX path was
+  // congested.
+  uint32_t deferred_acks{0};
+  uint32_t tx_pauses{0};
+  // RTT estimate. Data packets carry the TSC they were sent at, and the
+  // receiver echoes the one of the last data packet it received in its ACKs
+  // (`ts_echo').
+  uint64_t ts_echo{0};
+  uint32_t srtt_us{0};
+  uint32_t min_rtt_us{0};
 };
 
 }  // namespace swift
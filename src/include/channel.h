@@ -16,6 +16,8 @@
 #include <rte_eal.h>
 #include <rte_mbuf_core.h>
 
+#include <array>
+#include <atomic>
 #include <iterator>
 #include <list>
 #include <memory>
@@ -23,6 +25,7 @@
 #include <type_traits>
 #include <unordered_map>
 #include <unordered_set>
+#include <vector>
 
 namespace juggler {
 class MachnetEngine;  // forward declaration
@@ -39,6 +42,18 @@ class Flow;  // forward declaration
 namespace juggler {
 namespace shm {
 
+/**
+ * @brief Adds to a counter of the statistics Machnet maintains for a channel
+ * (see `MachnetChannelEngineStats'). The engine serving the channel is the
+ * only writer, so a relaxed load and store do, without a locked instruction;
+ * readers load the counter atomically.
+ */
+static inline void StatsAdd(uint64_t *counter, uint64_t value) {
+  std::atomic_ref<uint64_t> c(*counter);
+  c.store(c.load(std::memory_order_relaxed) + value,
+          std::memory_order_relaxed);
+}
+
 /**
  * @brief Class `ShmChannel' abstracts Machnet shared memory channels.
  * It provides useful methods to allocate, enqueue and dequeue messages to
@@ -75,6 +90,11 @@ class ShmChannel {
     return const_cast<MachnetChannelCtx_t *>(ctx_);
   }
 
+  // Get the statistics Machnet maintains for the channel (see `StatsAdd()').
+  MachnetChannelEngineStats_t *stats() const {
+    return &__machnet_channel_stats(ctx_)->e_stats;
+  }
+
   // Get the channel's file descriptor.
   int GetFd() const { return channel_fd_; }
 
@@ -98,22 +118,72 @@ class ShmChannel {
   // Size of the channel in bytes.
   uint64_t GetSize() const { return ctx_->size; }
 
-  // Total size of each channel's buffer in bytes.
-  uint32_t GetTotalBufSize() const { return ctx_->data_ctx.buf_size; }
+  // Number of buffer size classes in the channel.
+  uint32_t GetBufClassCount() const { return ctx_->data_ctx.buf_class_nr; }
+
+  // Total size of each buffer of the default class in bytes.
+  uint32_t GetTotalBufSize() const {
+    return __machnet_channel_buf_class(ctx(), 0)->buf_size;
+  }
 
   // Machnet channel `MsgBuf' have reserved space for headers.
-  // This method returns the space in the `MsgBuf' that can be used to store the
-  // payload. There is still headroom for possible packet headers.
-  uint32_t GetUsableBufSize() const { return ctx_->data_ctx.buf_mss; }
+  // This method returns the space in a `MsgBuf' of the default class that can
+  // be used to store the payload. There is still headroom for possible packet
+  // headers. Buffers of the default class (the only ones allocated by the
+  // engine) fit in a single packet.
+  uint32_t GetUsableBufSize() const {
+    return __machnet_channel_buf_class(ctx(), 0)->buf_mss;
+  }
 
-  // Total amount of buffers in the channel.
+  // Total amount of buffers in the channel, across all size classes (and the
+  // extension segments in use by the engine).
   uint32_t GetTotalBufCount() const {
-    return __machnet_channel_buf_ring(ctx_)->capacity;
+    uint32_t total = 0;
+    for (uint32_t cls = 0; cls < MACHNET_CHANNEL_BUF_CLASS_MAX; cls++) {
+      if (IsBufClassInUse(cls))
+        total += __machnet_channel_buf_class(ctx_, cls)->buf_nr;
+    }
+    return total;
   }
 
   // Get the number of buffers that are currently available (i.e., not in use).
   uint32_t GetFreeBufCount() const {
-    return cached_buf_count + __machnet_channel_buffers_avail(ctx_);
+    uint32_t avail = cached_buf_count;
+    for (uint32_t cls = 0; cls < MACHNET_CHANNEL_BUF_CLASS_MAX; cls++) {
+      if (IsBufClassInUse(cls))
+        avail += __machnet_channel_class_buffers_avail(ctx_, cls);
+    }
+    return avail;
+  }
+
+  /**
+   * @brief Publish the extension segments that the Machnet engine may use.
+   * Called by the controller, which creates and destroys the segments; the
+   * engine switches to them in `SyncSegments()'.
+   *
+   * @param segments A mask of the buffer classes of the segments.
+   */
+  void PublishSegments(uint32_t segments) {
+    published_segments_.store(segments, std::memory_order_release);
+  }
+
+  /**
+   * @brief Get the extension segments the engine has switched to. Once a
+   * segment is missing from the mask, the engine no longer touches it.
+   *
+   * @return A mask of the buffer classes of the segments.
+   */
+  uint32_t GetSyncedSegments() const {
+    return synced_segments_.load(std::memory_order_acquire);
+  }
+
+  /**
+   * @brief Switch to the extension segments last published by the controller.
+   * Called periodically by the Machnet engine.
+   */
+  void SyncSegments() {
+    engine_segments_ = published_segments_.load(std::memory_order_acquire);
+    synced_segments_.store(engine_segments_, std::memory_order_release);
   }
 
   /**
@@ -164,6 +234,20 @@ class ShmChannel {
     return __machnet_channel_ctrl_cq_enqueue(ctx_, nb_entries, ctrl_entries);
   }
 
+  /**
+   * @brief Enqueue a batch of TX completions to the channel (destined to the
+   * application).
+   *
+   * @param completions   A pointer to the array of `MachnetTxCompletion_t'.
+   * @param nb_entries    The number of entries in the array above.
+   * @return              The number of entries enqueued (0 or `nb_entries').
+   */
+  uint32_t EnqueueTxCompletions(const MachnetTxCompletion_t *completions,
+                                uint32_t nb_entries) {
+    return __machnet_channel_completion_ring_enqueue(ctx_, nb_entries,
+                                                     completions);
+  }
+
   /**
    * @brief Enqueues a batch of messages to the channel (destined to the
    * application).
@@ -257,8 +341,8 @@ class ShmChannel {
    */
   MsgBuf *MsgBufAlloc() {
     if (cached_buf_count == 0) {
-      uint32_t ret = __machnet_channel_buf_alloc_bulk(
-          ctx_, NUM_CACHED_BUFS, cached_buf_indices.data(), cached_bufs.data());
+      uint32_t ret = DefaultBufAllocBulk(
+          NUM_CACHED_BUFS, cached_buf_indices.data(), cached_bufs.data());
       if (ret != NUM_CACHED_BUFS) return nullptr;
       cached_buf_count += NUM_CACHED_BUFS;
     }
@@ -279,7 +363,10 @@ class ShmChannel {
         ctx_, reinterpret_cast<const MachnetMsgBuf_t *>(buf))};
     MachnetMsgBuf_t *msg_buf = __machnet_channel_buf(ctx_, index[0]);
 
-    if (cached_buf_count < NUM_CACHED_BUFS) {
+    // Only buffers of the default class are cached, as these are the ones we
+    // allocate.
+    if (MACHNET_MSGBUF_INDEX_CLASS(index[0]) == 0 &&
+        cached_buf_count < NUM_CACHED_BUFS) {
       cached_buf_indices[cached_buf_count] = index[0];
       cached_bufs[cached_buf_count] = msg_buf;
       cached_buf_count++;
@@ -306,8 +393,8 @@ class ShmChannel {
   bool MsgBufBulkAlloc(MsgBufBatch *batch,
                        uint32_t cnt = MsgBufBatch::kMaxBurst) {
     (void)DCHECK_NOTNULL(batch);
-    uint32_t ret = __machnet_channel_buf_alloc_bulk(
-        ctx_, std::min(cnt, static_cast<uint32_t>(batch->GetRoom())),
+    uint32_t ret = DefaultBufAllocBulk(
+        std::min(cnt, static_cast<uint32_t>(batch->GetRoom())),
         batch->buf_indices(),
         reinterpret_cast<MachnetMsgBuf_t **>(batch->bufs()));
     batch->IncrCount(ret);
@@ -338,22 +425,29 @@ class ShmChannel {
 
   bool MsgBufBulkFree(MachnetRingSlot_t *indices, uint32_t cnt) {
     int retries = 5;
-    uint32_t freed;
-    const uint32_t cache_free_slots = NUM_CACHED_BUFS - cached_buf_count;
-    const uint32_t to_cache =
-        (cnt <= cache_free_slots) ? cnt : cache_free_slots;
-
-    for (freed = 0; freed < to_cache; freed++) {
-      cached_buf_indices[cached_buf_count] = indices[freed];
-      MachnetMsgBuf_t *msg_buf = __machnet_channel_buf(ctx_, indices[freed]);
-      cached_bufs[cached_buf_count] = msg_buf;
-      cached_buf_count++;
+    uint32_t freed = 0;
+
+    // Cache buffers of the default class while there is room, and move
+    // everything else to the front of the array to be released to the channel.
+    uint32_t to_release = 0;
+    for (uint32_t i = 0; i < cnt; i++) {
+      if (MACHNET_MSGBUF_INDEX_CLASS(indices[i]) == 0 &&
+          cached_buf_count < NUM_CACHED_BUFS) {
+        cached_buf_indices[cached_buf_count] = indices[i];
+        cached_bufs[cached_buf_count] = __machnet_channel_buf(ctx_, indices[i]);
+        cached_buf_count++;
+        freed++;
+      } else {
+        indices[to_release++] = indices[i];
+      }
     }
-    if (cnt > cache_free_slots) {
+    if (to_release > 0) {
+      uint32_t released = 0;
       do {
-        freed +=
-            __machnet_channel_buf_free_bulk(ctx_, cnt - freed, indices + freed);
-      } while (freed == 0 && retries-- > 0);
+        released += __machnet_channel_buf_free_bulk(
+            ctx_, to_release - released, indices + released);
+      } while (released == 0 && retries-- > 0);
+      freed += released;
     }
     if (freed == 0) [[unlikely]]
       return false;  // NOLINT
@@ -370,6 +464,35 @@ class ShmChannel {
   }
 
  private:
+  // Whether the engine uses the buffers of a class: the classes created with
+  // the channel, and the extension segments it has switched to.
+  bool IsBufClassInUse(uint32_t cls) const {
+    return cls < GetBufClassCount() || (engine_segments_ & (1U << cls)) != 0;
+  }
+
+  /**
+   * @brief Allocates buffers of the default class. When the default class runs
+   * out, the buffers come from the extension segments of the default class
+   * that the engine uses (if any).
+   *
+   * @return The number of buffers allocated, either 0 or `n'.
+   */
+  uint32_t DefaultBufAllocBulk(uint32_t n, MachnetRingSlot_t *indices,
+                               MachnetMsgBuf_t **bufs) {
+    uint32_t ret = __machnet_channel_buf_alloc_bulk(ctx_, n, indices, bufs);
+    if (ret != 0) [[likely]]
+      return ret;  // NOLINT
+
+    for (uint32_t segments = engine_segments_; segments != 0;
+         segments &= segments - 1) {
+      const uint32_t cls = __builtin_ctz(segments);
+      if (__machnet_channel_buf_class(ctx_, cls)->parent != 0) continue;
+      ret = __machnet_channel_class_buf_alloc_bulk(ctx_, cls, n, indices, bufs);
+      if (ret != 0) return ret;
+    }
+    return 0;
+  }
+
   const std::string name_;
   const MachnetChannelCtx_t *ctx_;
   const size_t mem_size_;
@@ -378,6 +501,12 @@ class ShmChannel {
   std::array<MachnetRingSlot_t, NUM_CACHED_BUFS> cached_buf_indices;
   std::array<MachnetMsgBuf_t *, NUM_CACHED_BUFS> cached_bufs;
   uint32_t cached_buf_count;
+  // The extension segments the engine may use (a mask of buffer classes), as
+  // published by the controller and as last switched to by the engine.
+  std::atomic<uint32_t> published_segments_{0};
+  std::atomic<uint32_t> synced_segments_{0};
+  // The engine's own copy, for its data path.
+  uint32_t engine_segments_{0};
 };
 
 /**
@@ -425,6 +554,54 @@ class Channel : public ShmChannel {
    */
   void UnregisterDMAMem();
 
+  /**
+   * @brief Grow or shrink the channel's memory to follow its working set:
+   * buffer classes that run low on free buffers are extended with extension
+   * segments, and segments that stay idle are reclaimed (see
+   * `MachnetChannelBufClass' for the protocol with the application). Called
+   * periodically by the controller (every `kSegmentUpdatePeriodUs'), off the
+   * engine's data path; the engine only switches to segments that are ready
+   * (see `SyncSegments()').
+   */
+  void UpdateSegments();
+
+  /**
+   * @brief Refresh the snapshot part of the channel's statistics (ring and
+   * buffer occupancy, flows; see `MachnetChannelEngineStats'). Called
+   * periodically by the Machnet engine.
+   */
+  void UpdateStatsSnapshot();
+
+  /**
+   * @brief Get a file descriptor of an extension segment that the application
+   * has to map.
+   *
+   * @param cls The buffer class of the segment.
+   * @return A new file descriptor (to be closed by the caller), or -1 if the
+   * segment is not waiting to be mapped.
+   */
+  int GetSegmentFd(uint32_t cls);
+
+  // Period of `UpdateSegments()'.
+  static constexpr uint64_t kSegmentUpdatePeriodUs = 1000000;
+
+  /**
+   * @brief Get the memory that the extension segments of a channel may take
+   * at most: every free class slot holding a segment of the class with the
+   * largest ones.
+   *
+   * @param buf_classes The buffer classes of the channel.
+   * @param is_posix_shm Whether the channel is backed by POSIX shared memory
+   * (if not, the segments are aligned to huge pages).
+   * @return The size in bytes.
+   */
+  static size_t GetMaxSegmentsSize(
+      const std::vector<MachnetChannelBufClassConf_t> &buf_classes,
+      bool is_posix_shm);
+
+  // Same as above, for this channel.
+  size_t GetMaxSegmentsSize() const;
+
  protected:
   /**
    * @brief Gets the list of active flows.
@@ -490,11 +667,52 @@ class Channel : public ShmChannel {
   // List of active flows associated with this channel.
   std::list<std::unique_ptr<Flow>> active_flows_;
 
+  // Extension segments are created when the free buffers of a class (incl.
+  // its segments) drop below `kSegmentGrowThreshold'. A segment is reclaimed
+  // once it has been idle for `kSegmentIdlePeriods' while its class has at
+  // least `kSegmentShrinkThreshold' of its buffers free.
+  static constexpr double kSegmentGrowThreshold = 0.125;
+  static constexpr double kSegmentShrinkThreshold = 0.5;
+  static constexpr uint32_t kSegmentIdlePeriods = 30;
+  // Periods to wait for the application to map a new segment.
+  static constexpr uint32_t kSegmentMapTimeoutPeriods = 10;
+
+  // Machnet-side state of an extension segment.
+  struct Segment {
+    int fd{-1};
+    // Number of periods in the current state (or idle, if active).
+    uint32_t periods{0};
+    std::vector<void *> pages_va{};
+    std::vector<uint64_t> pages_iova{};
+  };
+
+  // Fraction of free buffers of an original class, incl. its segments.
+  double GetFreeBufFraction(uint32_t parent) const;
+  // Number of ring slots of a segment extending a class: as many buffers as
+  // the class has, as far as the segment size allows.
+  static size_t GetSegmentSlotNr(size_t buf_ring_slot_nr, size_t buffer_size,
+                                 bool is_posix_shm);
+  bool CreateSegment(uint32_t parent);
+  void DestroySegment(uint32_t cls);
+
+  // DMA map a memory region, and register it as DPDK external memory.
+  bool DMAMapRegion(rte_device *dev, const uchar_t *start, size_t len,
+                    std::vector<void *> *pages_va,
+                    std::vector<uint64_t> *pages_iova);
+  void DMAUnmapRegion(rte_device *dev, std::vector<void *> *pages_va,
+                      std::vector<uint64_t> *pages_iova);
+  // Set the IOVA address of every buffer of a class.
+  bool SetBufClassIOVA(uint32_t cls);
+
   // DPDK external memory region.
   rte_device *attached_dev_{nullptr};
   std::vector<void *> buffer_pages_va_{};
   std::vector<uint64_t> buffer_pages_iova_{};
 
+  // The extension segments and the DMA registration are only accessed by the
+  // controller thread.
+  std::array<Segment, MACHNET_CHANNEL_BUF_CLASS_MAX> segments_{};
+
   friend class juggler::MachnetEngine;
   template <class T>
   class ChannelManager;
@@ -514,6 +732,18 @@ class ChannelManager {
   static constexpr size_t kMaxChannelNr = 32;
   static constexpr size_t kDefaultRingSize = 256;
   static constexpr size_t kDefaultBufferCount = 4096;
+  // Besides the default (MTU-sized) class, channels carry a class of small
+  // buffers for short messages, and a class of large buffers so that big
+  // messages take few buffers. The sizes are usable bytes per buffer. The
+  // extra classes do not add to the memory of a channel: they are carved out
+  // of its buffer budget (`kDefaultBufferCount' default buffers, unless the
+  // application asks for another count), of which the default class keeps
+  // 1/`kDefaultClassBudgetShare' and the other two classes split the rest.
+  static constexpr size_t kDefaultClassBudgetShare = 2;
+  static constexpr size_t kDefaultSmallBufferSize =
+      512 - MACHNET_MSGBUF_SPACE_RESERVED - MACHNET_MSGBUF_HEADROOM_MAX;
+  static constexpr size_t kDefaultLargeBufferSize =
+      64 * KB - MACHNET_MSGBUF_SPACE_RESERVED - MACHNET_MSGBUF_HEADROOM_MAX;
   ChannelManager() {}
   ChannelManager(const ChannelManager &) = delete;
   ChannelManager &operator=(const ChannelManager &) = delete;
@@ -537,6 +767,30 @@ class ChannelManager {
   bool AddChannel(const char *name, size_t machnet_ring_slot_nr,
                   size_t app_ring_slot_nr, size_t buf_ring_slot_nr,
                   size_t buffer_size) {
+    return AddChannel(name, machnet_ring_slot_nr, app_ring_slot_nr,
+                      {{.buf_ring_slot_nr = buf_ring_slot_nr,
+                        .buffer_size = buffer_size}});
+  }
+
+  /**
+   * Create a new Machnet dataplane channel with several buffer size classes.
+   *
+   * @param name               Name of the channel (POSIX shared memory
+   *                           segment)
+   * @param machnet_ring_slot_nr The number of Machnet->App messaging ring slots
+   *                           (must be power of 2).
+   * @param app_ring_slot_nr   The number of App->Machnet messaging ring slots
+   *                           (must be power of 2).
+   * @param buf_classes        The buffer size classes. The first one is the
+   *                           default class, used to receive packets; its
+   *                           buffers must fit in a single packet.
+   * @return
+   *   - `true` if the channel was successfully created.
+   *   - `false` otherwise.
+   */
+  bool AddChannel(
+      const char *name, size_t machnet_ring_slot_nr, size_t app_ring_slot_nr,
+      const std::vector<MachnetChannelBufClassConf_t> &buf_classes) {
     const std::lock_guard<std::mutex> lock(mtx_);
     if (channels_.size() >= kMaxChannelNr) {
       LOG(WARNING) << "Too many channels.";
@@ -551,9 +805,9 @@ class ChannelManager {
     int channel_fd;
     size_t shm_segment_size;
     int is_posix_shm;
-    auto *ctx = __machnet_channel_create(
-        name, machnet_ring_slot_nr, app_ring_slot_nr, buf_ring_slot_nr,
-        buffer_size, &shm_segment_size, &is_posix_shm, &channel_fd);
+    auto *ctx = __machnet_channel_create_ex(
+        name, machnet_ring_slot_nr, app_ring_slot_nr, buf_classes.data(),
+        buf_classes.size(), &shm_segment_size, &is_posix_shm, &channel_fd);
     if (ctx == nullptr) {
       LOG(WARNING) << "Failed to create channel " << name
                    << " with requested size " << shm_segment_size << ".";
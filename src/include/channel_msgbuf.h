@@ -76,6 +76,13 @@ class MsgBuf {
   bool is_last() const { return (flags() & MACHNET_MSGBUF_FLAGS_FIN) != 0; }
   // Returns true if the `MachnetMsgBuf_t' is the last in a message.
   bool is_sg() const { return (flags() & MACHNET_MSGBUF_FLAGS_SG) != 0; }
+  // Returns true if the application asked to be notified upon delivery of
+  // this message (only valid on the first `MsgBuf').
+  bool is_notify_delivery() const {
+    return (flags() & MACHNET_MSGBUF_NOTIFY_DELIVERY) != 0;
+  }
+  // Return the application-supplied cookie (only valid on the first `MsgBuf').
+  uint64_t cookie() const { return msg_buf_.cookie; }
 
   std::string flow_info() const {
     const net::Ipv4::Address src_ip(msg_buf_.flow.src_ip);
@@ -125,6 +132,7 @@ class MsgBuf {
   }
   void set_next(MsgBuf *next) { set_next(next->index()); }
   void set_last(uint32_t last) { msg_buf_.last = last; }
+  void set_cookie(uint64_t cookie) { msg_buf_.cookie = cookie; }
   void mark_first() { add_flags(MACHNET_MSGBUF_FLAGS_SYN); }
   void mark_last() { add_flags(MACHNET_MSGBUF_FLAGS_FIN); }
 
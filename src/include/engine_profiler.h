@@ -0,0 +1,229 @@
+/**
+ * @file engine_profiler.h
+ * @brief TSC-based profiler of the Machnet engine loop: per-stage cycle
+ * counters and histograms, and busy versus idle iterations.
+ */
+#ifndef SRC_INCLUDE_ENGINE_PROFILER_H_
+#define SRC_INCLUDE_ENGINE_PROFILER_H_
+
+#include <common.h>
+#include <glog/logging.h>
+#include <hdr/hdr_histogram.h>
+#include <seqlock.h>
+#include <ttime.h>
+#include <utils.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+
+namespace juggler {
+
+#ifdef MACHNET_ENGINE_PROFILING
+static constexpr bool kEngineProfilingEnabled = true;
+#else
+static constexpr bool kEngineProfilingEnabled = false;
+#endif
+
+/**
+ * @brief Stages of an iteration of the engine loop.
+ */
+enum class EngineStage : uint8_t {
+  kPeriodic = 0,    // Periodic processing (timers, control plane).
+  kRxBurst,         // Polling the RX ring.
+  kRxProcess,       // Parsing RX packets and feeding them to the flows.
+  kChannelDequeue,  // Polling the channels for messages.
+  kMsgProcess,      // Feeding messages to the flows.
+  kTx,              // Flushing the TX ring.
+  kStageNr,
+};
+
+static inline const char *EngineStageToString(EngineStage stage) {
+  switch (stage) {
+    case EngineStage::kPeriodic:
+      return "periodic";
+    case EngineStage::kRxBurst:
+      return "rx_burst";
+    case EngineStage::kRxProcess:
+      return "rx_process";
+    case EngineStage::kChannelDequeue:
+      return "channel_dequeue";
+    case EngineStage::kMsgProcess:
+      return "msg_process";
+    case EngineStage::kTx:
+      return "tx";
+    default:
+      return "unknown";
+  }
+}
+
+/**
+ * @brief A snapshot of the profile of an engine, as published by the engine
+ * thread. Counters are cumulative since the engine started; percentiles are of
+ * the cycles spent per busy iteration in each stage, over the last publishing
+ * interval.
+ */
+struct EngineProfile {
+  static constexpr size_t kStageNr =
+      static_cast<size_t>(EngineStage::kStageNr);
+
+  struct StageStats {
+    uint64_t cycles;
+    uint64_t p50;
+    uint64_t p99;
+    uint64_t p999;
+    uint64_t max;
+  };
+
+  uint64_t iterations;
+  uint64_t busy_iterations;
+  uint64_t busy_cycles;
+  uint64_t idle_cycles;
+  StageStats stages[kStageNr];
+
+  std::string ToString() const {
+    const uint64_t total_cycles = busy_cycles + idle_cycles;
+    auto pct = [](uint64_t part, uint64_t whole) {
+      return whole == 0 ? 0.0 : 100.0 * part / whole;
+    };
+
+    std::string s = utils::Format(
+        "iterations: %lu (busy: %.2f%%), cycles busy: %.2f%%",
+        iterations, pct(busy_iterations, iterations),
+        pct(busy_cycles, total_cycles));
+    for (size_t i = 0; i < kStageNr; i++) {
+      const auto &stage = stages[i];
+      s += utils::Format(
+          "\n\t%-16s %6.2f%% of busy cycles, per iteration p50/p99/p99.9/max: "
+          "%lu/%lu/%lu/%lu cycles",
+          EngineStageToString(static_cast<EngineStage>(i)),
+          pct(stage.cycles, busy_cycles), stage.p50, stage.p99, stage.p999,
+          stage.max);
+    }
+    return s;
+  }
+};
+
+/**
+ * @brief Profiles the loop of an engine. The engine thread marks the end of
+ * each stage of an iteration; the profiler accounts the cycles since the
+ * previous mark to that stage. The engine thread periodically publishes a
+ * snapshot (`EngineProfile') that other threads read without locking.
+ *
+ * With `enabled' false (the default, unless `MACHNET_ENGINE_PROFILING' is
+ * defined) all methods are empty and the profiler compiles to nothing.
+ */
+template <bool enabled = kEngineProfilingEnabled>
+class EngineProfiler;
+
+template <>
+class EngineProfiler<false> {
+ public:
+  void IterationBegin(uint64_t now) {}
+  void StageEnd(EngineStage stage) {}
+  void IterationEnd(bool busy) {}
+  void Publish() {}
+  bool GetProfile(EngineProfile *profile) const { return false; }
+};
+
+template <>
+class EngineProfiler<true> {
+ public:
+  // Histograms track values up to this many cycles; larger ones are clamped.
+  static constexpr int64_t kMaxTrackedCycles = 1ll << 32;
+  static constexpr int kHistogramPrecision = 2;
+
+  EngineProfiler() : profile_(), last_mark_(0), iter_cycles_() {
+    for (auto &histogram : histograms_) {
+      const int ret =
+          hdr_init(1, kMaxTrackedCycles, kHistogramPrecision, &histogram);
+      CHECK_EQ(ret, 0) << "Failed to initialize profiler histogram.";
+    }
+  }
+  ~EngineProfiler() {
+    for (auto *histogram : histograms_) hdr_close(histogram);
+  }
+  EngineProfiler(const EngineProfiler &) = delete;
+  EngineProfiler &operator=(const EngineProfiler &) = delete;
+
+  /**
+   * @brief Marks the beginning of an iteration of the engine loop.
+   *
+   * @param now The TSC at the beginning of the iteration.
+   */
+  void IterationBegin(uint64_t now) { last_mark_ = now; }
+
+  /**
+   * @brief Marks the end of a stage; the cycles since the previous mark are
+   * accounted to it. A stage may end more than once per iteration.
+   */
+  void StageEnd(EngineStage stage) {
+    const auto now = time::rdtsc();
+    iter_cycles_[static_cast<size_t>(stage)] += now - last_mark_;
+    last_mark_ = now;
+  }
+
+  /**
+   * @brief Marks the end of an iteration.
+   *
+   * @param busy Whether the iteration did any work, as opposed to polling
+   * empty queues.
+   */
+  void IterationEnd(bool busy) {
+    uint64_t cycles = 0;
+    for (const auto c : iter_cycles_) cycles += c;
+
+    profile_.iterations++;
+    if (busy) {
+      profile_.busy_iterations++;
+      profile_.busy_cycles += cycles;
+      for (size_t i = 0; i < EngineProfile::kStageNr; i++) {
+        if (iter_cycles_[i] == 0) continue;
+        profile_.stages[i].cycles += iter_cycles_[i];
+        hdr_record_value(histograms_[i],
+                         std::min<int64_t>(iter_cycles_[i], kMaxTrackedCycles));
+      }
+    } else {
+      profile_.idle_cycles += cycles;
+    }
+    std::fill(std::begin(iter_cycles_), std::end(iter_cycles_), 0);
+  }
+
+  /**
+   * @brief Publishes a snapshot of the profile and starts a new interval for
+   * the histograms. Must be called by the engine thread.
+   */
+  void Publish() {
+    for (size_t i = 0; i < EngineProfile::kStageNr; i++) {
+      auto *histogram = histograms_[i];
+      auto &stage = profile_.stages[i];
+      stage.p50 = hdr_value_at_percentile(histogram, 50.0);
+      stage.p99 = hdr_value_at_percentile(histogram, 99.0);
+      stage.p999 = hdr_value_at_percentile(histogram, 99.9);
+      stage.max = hdr_max(histogram);
+      hdr_reset(histogram);
+    }
+    snapshot_.Store(profile_);
+  }
+
+  /**
+   * @brief Reads the last published snapshot; safe to call from any thread.
+   *
+   * @param profile Pointer to store the snapshot to.
+   * @return True if a snapshot has been published.
+   */
+  bool GetProfile(EngineProfile *profile) const {
+    return snapshot_.Load(profile) != 0;
+  }
+
+ private:
+  EngineProfile profile_;
+  uint64_t last_mark_;
+  uint64_t iter_cycles_[EngineProfile::kStageNr];
+  hdr_histogram *histograms_[EngineProfile::kStageNr];
+  SeqLock<EngineProfile> snapshot_;
+};
+
+}  // namespace juggler
+
+#endif  // SRC_INCLUDE_ENGINE_PROFILER_H_
@@ -0,0 +1,153 @@
+/**
+ * @file engine_status.h
+ * @brief Snapshot of the state of a Machnet engine (TX path, channels,
+ * listeners, flows), published by the engine thread and formatted by others.
+ */
+#ifndef SRC_INCLUDE_ENGINE_STATUS_H_
+#define SRC_INCLUDE_ENGINE_STATUS_H_
+
+#include <cc.h>
+#include <flow.h>
+#include <flow_key.h>
+#include <ipv4.h>
+#include <pmd.h>
+#include <utils.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+
+namespace juggler {
+
+/**
+ * @brief Plain, fixed-size copy of the state of an engine. The engine thread
+ * fills it in on every slow tick; formatting it is left to the reader, off the
+ * data path. Tables that do not fit are truncated; the totals are kept.
+ */
+struct EngineStatus {
+  static constexpr size_t kMaxChannels = 64;
+  static constexpr size_t kMaxListeners = 64;
+  static constexpr size_t kMaxFlows = 4096;
+  static constexpr size_t kChannelNameLen = 64;
+
+  struct ChannelStatus {
+    char name[kChannelNameLen];
+    uint32_t total_bufs;
+    uint32_t free_bufs;
+  };
+
+  struct ListenerStatus {
+    uint32_t ip;
+    uint16_t port;
+    uint16_t channel;  // Index in `channels'.
+  };
+
+  struct FlowStatus {
+    uint32_t local_ip;
+    uint32_t remote_ip;
+    uint16_t local_port;
+    uint16_t remote_port;
+    uint16_t channel;  // Index in `channels'.
+    uint8_t state;     // `net::flow::Flow::State'.
+    uint32_t snd_nxt;
+    uint32_t snd_una;
+    uint32_t rcv_nxt;
+    uint32_t effective_wnd;
+    uint16_t cwnd;
+    uint16_t fast_rexmits;
+    uint16_t rto_rexmits;
+    uint32_t deferred_acks;
+    uint32_t tx_pauses;
+    uint32_t srtt_us;
+    uint32_t pending_segments;
+  };
+
+  uint64_t periodic_ticks;
+  uint16_t port_id;
+  uint16_t rx_queue;
+  uint16_t tx_queue;
+
+  // TX path.
+  dpdk::TxRing::Stats tx;
+  uint32_t tx_backlog;
+  bool tx_congested;
+  uint32_t pool_free;
+  uint32_t pool_capacity;
+  uint64_t alloc_failures;
+  uint64_t shed_connections;
+
+  uint32_t channels_nr;
+  uint32_t listeners_nr;
+  uint32_t flows_nr;
+  ChannelStatus channels[kMaxChannels];
+  ListenerStatus listeners[kMaxListeners];
+  FlowStatus flows[kMaxFlows];
+
+  const char *GetChannelName(uint16_t index) const {
+    return index < std::min<size_t>(channels_nr, kMaxChannels)
+               ? channels[index].name
+               : "?";
+  }
+
+  std::string ToString() const {
+    using Flow = net::flow::Flow;
+    std::string s;
+    s += utils::Format("[PMD Port: %hu, RX_Q: %hu, TX_Q: %hu, tick: %lu]\n",
+                       port_id, rx_queue, tx_queue, periodic_ticks);
+    s += "\tTX path:\n";
+    s += utils::Format(
+        "\t\tpkts: %lu, bursts: %lu, backlog: %u, backlogged: %lu, "
+        "dropped: %lu, congested: %s (%lu times), pool free: %u/%u, "
+        "alloc failures: %lu, shed connections: %lu\n",
+        tx.tx_pkts, tx.tx_bursts, tx_backlog, tx.backlogged, tx.dropped,
+        tx_congested ? "yes" : "no", tx.congestions, pool_free, pool_capacity,
+        alloc_failures, shed_connections);
+
+    s += "\tActive channels:";
+    for (size_t i = 0; i < std::min<size_t>(channels_nr, kMaxChannels); i++) {
+      s += utils::Format("\n\t\t[%s] Total buffers: %u, Free buffers: %u",
+                         channels[i].name, channels[i].total_bufs,
+                         channels[i].free_bufs);
+    }
+    if (channels_nr > kMaxChannels)
+      s += utils::Format("\n\t\t(%zu more)", channels_nr - kMaxChannels);
+    s += "\n";
+
+    s += "\tListeners:\n";
+    for (size_t i = 0; i < std::min<size_t>(listeners_nr, kMaxListeners);
+         i++) {
+      const auto &listener = listeners[i];
+      s += utils::Format("\t\t%s:%hu <-> [%s]\n",
+                         net::Ipv4::Address(listener.ip).ToString().c_str(),
+                         listener.port, GetChannelName(listener.channel));
+    }
+    if (listeners_nr > kMaxListeners)
+      s += utils::Format("\t\t(%zu more)\n", listeners_nr - kMaxListeners);
+
+    s += "\tActive flows:\n";
+    for (size_t i = 0; i < std::min<size_t>(flows_nr, kMaxFlows); i++) {
+      const auto &flow = flows[i];
+      const net::flow::Key key(flow.local_ip, flow.local_port, flow.remote_ip,
+                               flow.remote_port);
+      s += utils::Format(
+          "\t\t%s [%s] <-> [%s]\n\t\t\t[CC] snd_nxt: %u, snd_una: %u, "
+          "rcv_nxt: %u, cwnd: %hu, fast_rexmits: %hu, rto_rexmits: %hu, "
+          "deferred_acks: %u, tx_pauses: %u, srtt_us: %u, effective_wnd: %u"
+          "\n\t\t\t"
+          "[TX Queue] Pending MsgBufs: %u\n",
+          key.ToString().c_str(),
+          Flow::StateToString(static_cast<Flow::State>(flow.state)),
+          GetChannelName(flow.channel), flow.snd_nxt, flow.snd_una,
+          flow.rcv_nxt, flow.cwnd, flow.fast_rexmits, flow.rto_rexmits,
+          flow.deferred_acks, flow.tx_pauses, flow.srtt_us, flow.effective_wnd,
+          flow.pending_segments);
+    }
+    if (flows_nr > kMaxFlows)
+      s += utils::Format("\t\t(%zu more)\n", flows_nr - kMaxFlows);
+    return s;
+  }
+};
+
+}  // namespace juggler
+
+#endif  // SRC_INCLUDE_ENGINE_STATUS_H_
@@ -20,10 +20,13 @@
 #include <packet.h>
 #include <packet_pool.h>
 #include <pmd.h>
+#include <trace.h>
+#include <ttime.h>
 #include <types.h>
 #include <udp.h>
 #include <utils.h>
 
+#include <algorithm>
 #include <cstdint>
 #include <optional>
 #include <queue>
@@ -33,117 +36,199 @@ namespace juggler {
 namespace net {
 namespace flow {
 
+/**
+ * @class TXTracking
+ * @brief Tracking for the message buffers of a flow that are pending
+ * transmission or acknowledgement.
+ *
+ * Each packet carries one segment of a message buffer. Buffers of the default
+ * size class fit in a single segment, while buffers of the larger classes are
+ * split into several segments of at most `GetUsableBufSize()' bytes.
+ */
 class TXTracking {
  public:
+  /**
+   * @brief A slice of a message buffer that is carried by a single packet.
+   */
+  struct Segment {
+    shm::MsgBuf* msgbuf = nullptr;
+    uint32_t offset = 0;
+    uint32_t length = 0;
+
+    bool operator==(const Segment&) const = default;
+    bool is_first() const { return offset == 0; }
+    bool is_last() const { return offset + length == msgbuf->length(); }
+    // Returns true if the segment spans the whole message buffer.
+    bool is_whole() const { return is_first() && is_last(); }
+
+    /**
+     * @brief Returns the message flags to put on the wire for this segment.
+     * The receiver stores each packet in its own buffer, so segments other
+     * than the last one of a buffer are always followed by another buffer.
+     */
+    uint16_t flags() const {
+      uint16_t flags = msgbuf->flags();
+      if (!is_first()) {
+        flags &= ~(MACHNET_MSGBUF_FLAGS_SYN | MACHNET_MSGBUF_NOTIFY_DELIVERY);
+      }
+      if (!is_last()) {
+        flags &= ~(MACHNET_MSGBUF_FLAGS_FIN | MACHNET_MSGBUF_FLAGS_CHAIN);
+        flags |= MACHNET_MSGBUF_FLAGS_SG;
+      }
+      return flags;
+    }
+  };
+
   TXTracking() = delete;
   explicit TXTracking(shm::Channel* channel)
       : channel_(CHECK_NOTNULL(channel)),
-        oldest_unacked_msgbuf_(nullptr),
-        oldest_unsent_msgbuf_(nullptr),
+        segment_size_(channel->GetUsableBufSize()),
+        oldest_unacked_(),
+        oldest_unsent_(),
         last_msgbuf_(nullptr),
-        num_unsent_msgbufs_(0),
-        num_tracked_msgbufs_(0) {}
-
-  const uint32_t NumUnsentMsgbufs() const { return num_unsent_msgbufs_; }
-  shm::MsgBuf* GetOldestUnackedMsgBuf() const { return oldest_unacked_msgbuf_; }
+        num_unsent_segments_(0),
+        num_tracked_segments_(0),
+        pending_completion_(std::nullopt) {}
+
+  const uint32_t NumUnsentSegments() const { return num_unsent_segments_; }
+  const Segment& GetOldestUnackedSegment() const { return oldest_unacked_; }
+  shm::MsgBuf* GetOldestUnackedMsgBuf() const {
+    return oldest_unacked_.msgbuf;
+  }
 
   void ReceiveAcks(uint32_t num_acked_pkts) {
     shm::MsgBufBatch to_free;
     while (num_acked_pkts) {
-      auto msgbuf = oldest_unacked_msgbuf_;
-      DCHECK(msgbuf != nullptr);
-      if (msgbuf != last_msgbuf_) {
-        DCHECK_NE(oldest_unacked_msgbuf_, oldest_unsent_msgbuf_)
-            << "Releasing an unsent msgbuf!";
-        oldest_unacked_msgbuf_ = channel_->GetMsgBuf(msgbuf->next());
-      } else {
-        oldest_unacked_msgbuf_ = nullptr;
-        last_msgbuf_ = nullptr;
+      const auto segment = oldest_unacked_;
+      DCHECK(segment.msgbuf != nullptr);
+      DCHECK(segment != oldest_unsent_) << "Releasing an unsent segment!";
+      oldest_unacked_ = NextSegment(segment);
+      num_tracked_segments_--;
+      num_acked_pkts--;
+      // A message buffer is released once all its segments are acknowledged.
+      if (!segment.is_last()) continue;
+
+      auto* msgbuf = segment.msgbuf;
+      if (msgbuf == last_msgbuf_) last_msgbuf_ = nullptr;
+      // Post a TX completion once the last buffer of a message that asked for
+      // delivery notification is acknowledged.
+      if (msgbuf->is_first() && msgbuf->is_notify_delivery()) {
+        pending_completion_ =
+            MachnetTxCompletion_t{.cookie = msgbuf->cookie(),
+                                  .flow = *msgbuf->flow(),
+                                  .status = MACHNET_TX_COMPLETION_DELIVERED};
       }
-      to_free.Append(msgbuf, msgbuf->index());
-      if (to_free.IsFull()) {
-        num_tracked_msgbufs_ -= to_free.GetSize();
-        CHECK(channel_->MsgBufBulkFree(&to_free));
+      if (msgbuf->is_last() && pending_completion_.has_value()) {
+        if (channel_->EnqueueTxCompletions(&pending_completion_.value(), 1) !=
+            1) {
+          VLOG(1) << "Completion ring full. Dropping TX completion.";
+          shm::StatsAdd(&channel_->stats()->tx_completion_drops, 1);
+        }
+        pending_completion_.reset();
       }
-      num_acked_pkts--;
+      to_free.Append(msgbuf, msgbuf->index());
+      if (to_free.IsFull()) CHECK(channel_->MsgBufBulkFree(&to_free));
     }
 
-    num_tracked_msgbufs_ -= to_free.GetSize();
     CHECK(channel_->MsgBufBulkFree(&to_free));
   }
 
   void Append(shm::MsgBuf* msgbuf) {
     DCHECK(msgbuf->is_first());
+    const auto first_segment = MakeSegment(msgbuf, 0);
     // Append the message at the end of the chain of buffers, if any.
     if (last_msgbuf_ == nullptr) {
       // This is the first pending message buffer in the flow.
-      DCHECK(oldest_unsent_msgbuf_ == nullptr);
-      last_msgbuf_ = channel_->GetMsgBuf(msgbuf->last());
-      oldest_unsent_msgbuf_ = msgbuf;
-      oldest_unacked_msgbuf_ = msgbuf;
+      DCHECK(oldest_unsent_.msgbuf == nullptr);
+      oldest_unsent_ = first_segment;
+      oldest_unacked_ = first_segment;
     } else {
       // This is not the first message buffer in the flow.
-      DCHECK(oldest_unacked_msgbuf_ != nullptr);
+      DCHECK(oldest_unacked_.msgbuf != nullptr);
       // Let's enqueue the new message buffer at the end of the chain.
       last_msgbuf_->link(msgbuf);
       DCHECK(!(last_msgbuf_->is_last() && last_msgbuf_->is_sg()));
-      // Update the last buffer pointer to point to the current buffer.
-      last_msgbuf_ = channel_->GetMsgBuf(msgbuf->last());
-      if (oldest_unsent_msgbuf_ == nullptr) oldest_unsent_msgbuf_ = msgbuf;
+      if (oldest_unsent_.msgbuf == nullptr) oldest_unsent_ = first_segment;
     }
-
-    const auto msg_length = msgbuf->msg_length();
-    const auto effective_buffer_size = channel_->GetUsableBufSize();
-    const auto msg_buffers_nr =
-        (msg_length + effective_buffer_size - 1) / effective_buffer_size;
-    num_unsent_msgbufs_ += msg_buffers_nr;
-    num_tracked_msgbufs_ += msg_buffers_nr;
+    // Update the last buffer pointer to point to the current buffer.
+    last_msgbuf_ = channel_->GetMsgBuf(msgbuf->last());
+
+    // Buffers may belong to different size classes, so we walk the message to
+    // count its segments.
+    uint32_t msg_segments_nr = 0;
+    for (auto* buf = msgbuf;; buf = channel_->GetMsgBuf(buf->next())) {
+      msg_segments_nr += SegmentsNr(buf);
+      if (buf->is_last()) break;
+    }
+    num_unsent_segments_ += msg_segments_nr;
+    num_tracked_segments_ += msg_segments_nr;
   }
 
-  std::optional<shm::MsgBuf*> GetAndUpdateOldestUnsent() {
-    if (oldest_unsent_msgbuf_ == nullptr) {
-      DCHECK_EQ(NumUnsentMsgbufs(), 0);
+  std::optional<Segment> GetAndUpdateOldestUnsent() {
+    if (oldest_unsent_.msgbuf == nullptr) {
+      DCHECK_EQ(NumUnsentSegments(), 0);
       return std::nullopt;
     }
 
-    auto msgbuf = oldest_unsent_msgbuf_;
-    if (oldest_unsent_msgbuf_ != last_msgbuf_) {
-      oldest_unsent_msgbuf_ =
-          channel_->GetMsgBuf(oldest_unsent_msgbuf_->next());
-    } else {
-      oldest_unsent_msgbuf_ = nullptr;
-    }
+    const auto segment = oldest_unsent_;
+    oldest_unsent_ = NextSegment(segment);
+    num_unsent_segments_--;
+    return segment;
+  }
 
-    num_unsent_msgbufs_--;
-    return msgbuf;
+  /**
+   * @brief Returns the segment that follows a given one, which is either the
+   * next slice of the same message buffer or the first slice of the next
+   * buffer in the chain. Returns an empty segment at the end of the chain.
+   */
+  Segment NextSegment(const Segment& segment) const {
+    if (!segment.is_last())
+      return MakeSegment(segment.msgbuf, segment.offset + segment.length);
+    if (segment.msgbuf == last_msgbuf_) return Segment{};
+    return MakeSegment(channel_->GetMsgBuf(segment.msgbuf->next()), 0);
   }
 
  private:
-  const uint32_t NumTrackedMsgbufs() const { return num_tracked_msgbufs_; }
+  const uint32_t NumTrackedSegments() const { return num_tracked_segments_; }
   const shm::MsgBuf* GetLastMsgBuf() const { return last_msgbuf_; }
   const shm::MsgBuf* GetOldestUnsentMsgBuf() const {
-    return oldest_unsent_msgbuf_;
+    return oldest_unsent_.msgbuf;
+  }
+
+  Segment MakeSegment(shm::MsgBuf* msgbuf, uint32_t offset) const {
+    const auto length = std::min(segment_size_, msgbuf->length() - offset);
+    return Segment{.msgbuf = msgbuf, .offset = offset, .length = length};
+  }
+
+  // Number of packets needed to carry a message buffer.
+  uint32_t SegmentsNr(const shm::MsgBuf* msgbuf) const {
+    if (msgbuf->length() <= segment_size_) return 1;
+    return (msgbuf->length() + segment_size_ - 1) / segment_size_;
   }
 
   shm::Channel* channel_;
+  const uint32_t segment_size_;
 
   /*
    * For the linked list of shm::MsgBufs in the channel (chain going downwards),
-   * we track 3 pointers
+   * we track 3 positions
    *
-   * B   -> oldest sent but unacknowledged MsgBuf
+   * B   -> oldest sent but unacknowledged segment
    * ...
-   * B   -> oldest unsent MsgBuf
+   * B   -> oldest unsent segment
    * ...
    * B   -> last MsgBuf, among all active messages in this flow
    */
 
-  shm::MsgBuf* oldest_unacked_msgbuf_;
-  shm::MsgBuf* oldest_unsent_msgbuf_;
+  Segment oldest_unacked_;
+  Segment oldest_unsent_;
   shm::MsgBuf* last_msgbuf_;
 
-  uint32_t num_unsent_msgbufs_;
-  uint32_t num_tracked_msgbufs_;
+  uint32_t num_unsent_segments_;
+  uint32_t num_tracked_segments_;
+  // TX completion of the oldest unacknowledged message, if the application
+  // asked to be notified upon its delivery.
+  std::optional<MachnetTxCompletion_t> pending_completion_;
 };
 
 /**
@@ -191,15 +276,18 @@ class RXTracking {
     const auto seqno = machneth->seqno.value();
     const auto expected_seqno = pcb->rcv_nxt;
 
+    auto* stats = channel_->stats();
     if (swift::seqno_lt(seqno, expected_seqno)) {
       VLOG(2) << "Received old packet: " << seqno << " < " << expected_seqno;
+      shm::StatsAdd(&stats->rx_drops_dup, 1);
       return 0;
     }
 
     const size_t distance = seqno - expected_seqno;
     if (distance >= kReassemblyMaxSeqnoDistance) {
-      LOG(ERROR) << "Packet too far ahead. Dropping as we can't handle SACK. "
-                 << "seqno: " << seqno << ", expected: " << expected_seqno;
+      VLOG(1) << "Packet too far ahead. Dropping as we can't handle SACK. "
+              << "seqno: " << seqno << ", expected: " << expected_seqno;
+      shm::StatsAdd(&stats->rx_drops_window, 1);
       return 0;
     }
 
@@ -211,6 +299,7 @@ class RXTracking {
                           return entry.seqno >= seqno;
                         });
       if (it != reass_q_.end() && it->seqno == seqno) {
+        shm::StatsAdd(&stats->rx_drops_dup, 1);
         return 0; // Duplicate packet
       }
     }
@@ -219,13 +308,15 @@ class RXTracking {
     auto* msgbuf = channel_->MsgBufAlloc();
     if (msgbuf == nullptr) {
       VLOG(1) << "Failed to allocate a message buffer. Dropping packet.";
+      shm::StatsAdd(&stats->rx_drops_nobuf, 1);
       return -1;
     }
-    
+    shm::StatsAdd(&stats->rx_pkts, 1);
+
     const size_t payload_len =
         packet->length() - net_hdr_len - sizeof(MachnetPktHdr);
     auto* msg_data = msgbuf->append<uint8_t*>(payload_len);
-    utils::Copy(CHECK_NOTNULL(msg_data), payload, msgbuf->length());
+    utils::CopyPayload(CHECK_NOTNULL(msg_data), payload, msgbuf->length());
     msgbuf->set_flags(machneth->msg_flags);
     msgbuf->set_src_ip(remote_ip_);
     msgbuf->set_src_port(remote_port_);
@@ -248,10 +339,12 @@ class RXTracking {
 
  private:
   void PushInOrderMsgbufsToShmTrain(swift::Pcb* pcb) {
+    auto* stats = channel_->stats();
     while (!reass_q_.empty() && reass_q_.front().seqno == pcb->rcv_nxt) {
       auto& front = reass_q_.front();
       auto* msgbuf = front.msgbuf;
       reass_q_.pop_front();
+      shm::StatsAdd(&stats->rx_bytes, msgbuf->length());
 
       if (cur_msg_train_head_ == nullptr) {
         DCHECK(msgbuf->is_first());
@@ -270,6 +363,7 @@ class RXTracking {
         if (nr_delivered != 1) {
           LOG(FATAL) << "SHM channel full, failed to deliver message";
         }
+        shm::StatsAdd(&stats->rx_msgs, 1);
 
         cur_msg_train_head_ = nullptr;
         cur_msg_train_tail_ = nullptr;
@@ -348,19 +442,23 @@ class Flow {
    * @param remote_port Remote UDP port.
    * @param local_l2_addr Local L2 address.
    * @param remote_l2_addr Remote L2 address.
-   * @param txring TX ring to send packets to.
+   * @param txring TX ring to stage packets on; the engine that owns it sends
+   * them (see `TxRing::StagePackets()').
+   * @param tracer Trace ring of the engine, to record the flow's events to.
    * @param channel Shared memory channel this flow is associated with.
    */
   Flow(const Ipv4::Address& local_addr, const Udp::Port& local_port,
        const Ipv4::Address& remote_addr, const Udp::Port& remote_port,
        const Ethernet::Address& local_l2_addr,
        const Ethernet::Address& remote_l2_addr, dpdk::TxRing* txring,
-       ApplicationCallback callback, shm::Channel* channel)
+       Tracer* tracer, ApplicationCallback callback, shm::Channel* channel)
       : key_(local_addr, local_port, remote_addr, remote_port),
         local_l2_addr_(local_l2_addr),
         remote_l2_addr_(remote_l2_addr),
         state_(State::kClosed),
         txring_(CHECK_NOTNULL(txring)),
+        tracer_(CHECK_NOTNULL(tracer)),
+        flow_id_(tracer_->NewFlowId()),
         callback_(std::move(callback)),
         channel_(CHECK_NOTNULL(channel)),
         pcb_(),
@@ -369,6 +467,10 @@ class Flow {
                      remote_addr.address.value(), remote_port.port.value(),
                      CHECK_NOTNULL(channel)) {
     CHECK_NOTNULL(txring_->GetPacketPool());
+    Trace(TraceEventType::kFlowCreate, pcb_.snd_nxt,
+          local_addr.address.value(), remote_addr.address.value(),
+          static_cast<uint32_t>(local_port.port.value()) << 16 |
+              remote_port.port.value());
   }
   ~Flow() {}
   /**
@@ -383,6 +485,17 @@ class Flow {
    */
   const Key& key() const { return key_; }
 
+  /**
+   * @brief The MAC address packets of this flow are sent to; it follows the
+   * peer if it moves (see `MachnetEngine::UpdateFlowsL2Addr()').
+   */
+  const Ethernet::Address& remote_l2_addr() const { return remote_l2_addr_; }
+  void SetRemoteL2Addr(const Ethernet::Address& l2addr) {
+    VLOG(1) << "Flow " << key_.ToString() << " now sends to "
+            << l2addr.ToString();
+    remote_l2_addr_ = l2addr;
+  }
+
   /**
    * @brief Get the associated channel.
    */
@@ -393,6 +506,18 @@ class Flow {
    */
   State state() const { return state_; }
 
+  /**
+   * @brief Get the congestion control state of the flow.
+   */
+  const swift::Pcb& pcb() const { return pcb_; }
+
+  /**
+   * @brief Get the number of segments queued for transmission.
+   */
+  uint32_t NumPendingSegments() const {
+    return tx_tracking_.NumUnsentSegments();
+  }
+
   std::string ToString() const {
     return utils::Format(
         "%s [%s] <-> [%s]\n\t\t\t%s\n\t\t\t[TX Queue] Pending "
@@ -400,7 +525,7 @@ class Flow {
         "%u",
         key_.ToString().c_str(), StateToString(state_),
         channel_->GetName().c_str(), pcb_.ToString().c_str(),
-        tx_tracking_.NumUnsentMsgbufs());
+        tx_tracking_.NumUnsentSegments());
   }
 
   bool Match(const dpdk::Packet* packet) const {
@@ -425,7 +550,7 @@ class Flow {
     CHECK(state_ == State::kClosed);
     SendSyn(pcb_.get_snd_nxt());
     pcb_.rto_reset();
-    state_ = State::kSynSent;
+    SetState(State::kSynSent);
   }
 
   void ShutDown() {
@@ -439,7 +564,7 @@ class Flow {
       case State::kEstablished:
         pcb_.rto_disable();
         SendRst();
-        state_ = State::kClosed;
+        SetState(State::kClosed);
         break;
       default:
         LOG(FATAL) << "Unknown state";
@@ -463,7 +588,10 @@ class Flow {
     auto* machneth = packet->head_data<MachnetPktHdr*>(net_hdr_len);
 
     if (machneth->magic.value() != MachnetPktHdr::kMagic) {
-      LOG(ERROR) << "Invalid Machnet header magic: " << machneth->magic;
+      Trace(TraceEventType::kBadMagic, machneth->seqno.value(),
+            machneth->magic.value());
+      VLOG(1) << "Invalid Machnet header magic: " << machneth->magic;
+      shm::StatsAdd(&channel_->stats()->rx_drops_invalid, 1);
       return;
     }
 
@@ -472,8 +600,10 @@ class Flow {
         // SYN packet received. For this to be valid it has to be an already
         // established flow with this SYN being a retransmission.
         if (state_ != State::kSynReceived && state_ != State::kClosed) {
-          LOG(ERROR) << "SYN packet received for flow in state: "
-                     << static_cast<int>(state_);
+          Trace(TraceEventType::kUnexpected, machneth->seqno.value(),
+                machneth->net_flags, static_cast<uint32_t>(state_));
+          VLOG(1) << "SYN packet received for flow in state: "
+                  << static_cast<int>(state_);
           return;
         }
 
@@ -483,7 +613,7 @@ class Flow {
           pcb_.rcv_nxt = machneth->seqno.value();
           pcb_.advance_rcv_nxt();
           SendSynAck(pcb_.get_snd_nxt());
-          state_ = State::kSynReceived;
+          SetState(State::kSynReceived);
         } else if (state_ == State::kSynReceived) {
           // If the flow is in SYN-RECEIVED state, our SYN-ACK packet was lost.
           // We need to retransmit it.
@@ -494,15 +624,19 @@ class Flow {
         // SYN-ACK packet received. For this to be valid it has to be an already
         // established flow with this SYN-ACK being a retransmission.
         if (state_ != State::kSynSent && state_ != State::kEstablished) {
-          LOG(ERROR) << "SYN-ACK packet received for flow in state: "
-                     << static_cast<int>(state_);
+          Trace(TraceEventType::kUnexpected, machneth->seqno.value(),
+                machneth->net_flags, static_cast<uint32_t>(state_));
+          VLOG(1) << "SYN-ACK packet received for flow in state: "
+                  << static_cast<int>(state_);
           return;
         }
 
         if (machneth->ackno.value() != pcb_.snd_nxt) {
-          LOG(ERROR) << "SYN-ACK packet received with invalid ackno: "
-                     << machneth->ackno << " snd_una: " << pcb_.snd_una
-                     << " snd_nxt: " << pcb_.snd_nxt;
+          Trace(TraceEventType::kInvalidAck, machneth->ackno.value(),
+                pcb_.snd_nxt);
+          VLOG(1) << "SYN-ACK packet received with invalid ackno: "
+                  << machneth->ackno << " snd_una: " << pcb_.snd_una
+                  << " snd_nxt: " << pcb_.snd_nxt;
           return;
         }
 
@@ -512,7 +646,7 @@ class Flow {
           pcb_.advance_rcv_nxt();
           pcb_.rto_maybe_reset();
           // Mark the flow as established.
-          state_ = State::kEstablished;
+          SetState(State::kEstablished);
           // Notify the application that the flow is established.
           callback_(channel(), true, key());
         }
@@ -524,7 +658,7 @@ class Flow {
         const auto expected_seqno = pcb_.rcv_nxt;
         if (swift::seqno_eq(seqno, expected_seqno)) {
           // If the RST packet is in sequence, we can reset the flow.
-          state_ = State::kClosed;
+          SetState(State::kClosed);
         }
       } break;
       case MachnetPktHdr::MachnetFlags::kAck:
@@ -534,13 +668,20 @@ class Flow {
         break;
       case MachnetPktHdr::MachnetFlags::kData:
         if (state_ != State::kEstablished) {
-          LOG(ERROR) << "Data packet received for flow in state: "
-                     << static_cast<int>(state_);
+          Trace(TraceEventType::kUnexpected, machneth->seqno.value(),
+                machneth->net_flags, static_cast<uint32_t>(state_));
+          VLOG(1) << "Data packet received for flow in state: "
+                  << static_cast<int>(state_);
+          shm::StatsAdd(&channel_->stats()->rx_drops_invalid, 1);
           return;
         }
         // Data packet, process the payload.
         const int consume_returncode = rx_tracking_.Consume(&pcb_, packet);
-        if (consume_returncode == 0) SendAck();
+        if (consume_returncode == 0) {
+          // Echo the sender's timestamp, for it to sample the RTT.
+          pcb_.ts_echo = machneth->timestamp1.value();
+          SendAck();
+        }
         break;
     }
   }
@@ -555,6 +696,9 @@ class Flow {
    * aggregating to a partial or a full Message.
    */
   void OutputMessage(shm::MsgBuf* msg) {
+    auto* stats = channel_->stats();
+    shm::StatsAdd(&stats->tx_msgs, 1);
+    shm::StatsAdd(&stats->tx_bytes, msg->msg_length());
     tx_tracking_.Append(msg);
 
     // TODO(ilias): We first need to check whether the cwnd is < 1, so that we
@@ -565,6 +709,15 @@ class Flow {
     TransmitPackets();
   }
 
+  /**
+   * @brief Sends what the flow held back while the TX path was congested: a
+   * deferred ACK, and any pending data the window allows.
+   */
+  void ResumeTx() {
+    if (ack_deferred_) SendAck();
+    TransmitPackets();
+  }
+
   /**
    * @brief Periodically checks the state of the flow and performs necessary
    * actions.
@@ -604,6 +757,17 @@ class Flow {
   }
 
  private:
+  void Trace(TraceEventType type, uint32_t seqno, uint32_t arg0 = 0,
+             uint32_t arg1 = 0, uint32_t arg2 = 0) const {
+    tracer_->Record(type, flow_id_, seqno, pcb_.cwnd, arg0, arg1, arg2);
+  }
+
+  void SetState(State state) {
+    Trace(TraceEventType::kStateChange, pcb_.snd_nxt,
+          static_cast<uint32_t>(state_), static_cast<uint32_t>(state));
+    state_ = state;
+  }
+
   void PrepareL2Header(dpdk::Packet* packet) const {
     auto* eh = packet->head_data<Ethernet*>();
     eh->src_addr = local_l2_addr_;
@@ -654,12 +818,14 @@ class Flow {
     }
     machneth->sack_bitmap_count = be16_t(pcb_.sack_bitmap_count);
 
-    machneth->timestamp1 = be64_t(0);
+    machneth->timestamp1 = be64_t(pcb_.ts_echo);
   }
 
-  void SendControlPacket(uint32_t seqno,
+  bool SendControlPacket(uint32_t seqno,
                          const MachnetPktHdr::MachnetFlags& flags) const {
-    auto* packet = CHECK_NOTNULL(txring_->GetPacketPool()->PacketAlloc());
+    auto* packet = txring_->GetPacketPool()->PacketAlloc();
+    if (packet == nullptr) [[unlikely]]
+      return false;
     dpdk::Packet::Reset(packet);
 
     const size_t kControlPacketSize =
@@ -670,47 +836,70 @@ class Flow {
     PrepareL4Header(packet);
     PrepareMachnetHdr(packet, seqno, flags);
 
-    // Send the packet.
-    txring_->SendPackets(&packet, 1);
+    // Stage the packet; the engine sends it with the rest of its TX burst.
+    txring_->StagePackets(&packet, 1);
+    return true;
   }
 
-  void SendSyn(uint32_t seqno) const {
-    SendControlPacket(seqno, MachnetPktHdr::MachnetFlags::kSyn);
+  bool SendSyn(uint32_t seqno) const {
+    return SendControlPacket(seqno, MachnetPktHdr::MachnetFlags::kSyn);
   }
 
-  void SendSynAck(uint32_t seqno) const {
-    SendControlPacket(seqno, MachnetPktHdr::MachnetFlags::kSyn |
-                                 MachnetPktHdr::MachnetFlags::kAck);
+  bool SendSynAck(uint32_t seqno) const {
+    return SendControlPacket(seqno, MachnetPktHdr::MachnetFlags::kSyn |
+                                        MachnetPktHdr::MachnetFlags::kAck);
   }
 
-  void SendAck() const {
-    SendControlPacket(pcb_.seqno(), MachnetPktHdr::MachnetFlags::kAck);
+  /**
+   * @brief Sends an ACK, or defers it while the TX path is congested. ACKs are
+   * cumulative, so the single ACK sent on `ResumeTx()' covers everything that
+   * was received in the meantime.
+   */
+  void SendAck() {
+    if (txring_->IsCongested() ||
+        !SendControlPacket(pcb_.seqno(), MachnetPktHdr::MachnetFlags::kAck))
+        [[unlikely]] {
+      if (!ack_deferred_) {
+        pcb_.deferred_acks++;
+        Trace(TraceEventType::kAckDeferred, pcb_.rcv_nxt);
+      }
+      ack_deferred_ = true;
+      return;
+    }
+    ack_deferred_ = false;
   }
 
-  void SendRst() const {
-    SendControlPacket(pcb_.seqno(), MachnetPktHdr::MachnetFlags::kRst);
+  bool SendRst() const {
+    return SendControlPacket(pcb_.seqno(), MachnetPktHdr::MachnetFlags::kRst);
   }
 
   /**
    * @brief This helper method prepares a network packet that carries the data
-   * of a particular `MachnetMsgBuf_t'.
+   * of a segment of a particular `MachnetMsgBuf_t'.
    *
    * @tparam copy_mode Copy mode of the packet. Either kMemCopy or kZeroCopy.
-   * @param buf Pointer to the message buffer to be sent.
+   * Segments that do not span their whole message buffer are always copied.
+   * @param segment The segment of the message buffer to be sent.
    * @param packet Pointer to an allocated packet.
    * @param seqno Sequence number of the packet.
+   * @param timestamp TSC to stamp the packet with, for RTT sampling; 0 for
+   * retransmissions, whose ACKs are ambiguous.
    */
   template <CopyMode copy_mode>
-  void PrepareDataPacket(shm::MsgBuf* msg_buf, dpdk::Packet* packet,
-                         uint32_t seqno) const {
+  void PrepareDataPacket(const TXTracking::Segment& segment,
+                         dpdk::Packet* packet, uint32_t seqno,
+                         uint64_t timestamp = 0) const {
+    auto* msg_buf = segment.msgbuf;
     DCHECK(!(msg_buf->is_last() && msg_buf->is_sg()));
     // Header length after before the payload.
     const size_t hdr_length =
         (sizeof(Ethernet) + sizeof(Ipv4) + sizeof(Udp) + sizeof(MachnetPktHdr));
-    const uint32_t pkt_len = hdr_length + msg_buf->length();
+    const uint32_t pkt_len = hdr_length + segment.length;
     CHECK_LE(pkt_len - sizeof(Ethernet), dpdk::PmdRing::kDefaultFrameSize);
+    const bool zero_copy =
+        copy_mode == CopyMode::kZeroCopy && segment.is_whole();
 
-    if constexpr (copy_mode == CopyMode::kMemCopy) {
+    if (!zero_copy) {
       // In this mode we memory copy the packet payload.
 
       // We reset the allocated packet here. This is because if `FAST_FREE'
@@ -749,89 +938,116 @@ class Flow {
     machneth->magic = be16_t(MachnetPktHdr::kMagic);
     machneth->net_flags = MachnetPktHdr::MachnetFlags::kData;
     machneth->ackno = be32_t(UINT32_MAX);
-    machneth->msg_flags = msg_buf->flags();
-    DCHECK(!(msg_buf->is_last() && msg_buf->is_sg()));
+    machneth->msg_flags = segment.flags();
 
     // machneth->msg_id = be32_t(msg_id_);
     machneth->seqno = be32_t(seqno);
-    machneth->timestamp1 = be64_t(0);
+    machneth->timestamp1 = be64_t(timestamp);
 
-    if constexpr (copy_mode == CopyMode::kMemCopy) {
+    if (!zero_copy) {
       // Copy the payload.
       auto* payload = reinterpret_cast<uint8_t*>(machneth + 1);
-      utils::Copy(payload, msg_buf->head_data(), msg_buf->length());
+      utils::CopyPayload(payload, msg_buf->head_data(segment.offset),
+                         segment.length);
     }
   }
 
   void FastRetransmit() {
-    // Retransmit the oldest unacknowledged message buffer.
-    auto* packet = CHECK_NOTNULL(txring_->GetPacketPool()->PacketAlloc());
-    PrepareDataPacket<CopyMode::kMemCopy>(tx_tracking_.GetOldestUnackedMsgBuf(),
-                                          packet, pcb_.snd_una);
-    txring_->SendPackets(&packet, 1);
+    // Retransmit the oldest unacknowledged segment. If we are out of packets,
+    // the RTO timer retransmits it instead.
+    auto* packet = txring_->GetPacketPool()->PacketAlloc();
+    if (packet == nullptr) [[unlikely]]
+      return;
+    PrepareDataPacket<CopyMode::kMemCopy>(
+        tx_tracking_.GetOldestUnackedSegment(), packet, pcb_.snd_una);
+    txring_->StagePackets(&packet, 1);
     pcb_.rto_reset();
     pcb_.fast_rexmits++;
-    LOG(INFO) << "Fast retransmitting packet " << pcb_.snd_una;
+    shm::StatsAdd(&channel_->stats()->fast_rexmits, 1);
+    Trace(TraceEventType::kFastRexmit, pcb_.snd_una);
+    VLOG(1) << "Fast retransmitting packet " << pcb_.snd_una;
   }
 
   void RTORetransmit() {
+    bool sent = true;
     if (state_ == State::kEstablished) {
-      LOG(INFO) << "RTO retransmitting data packet " << pcb_.snd_una;
-      auto* packet = CHECK_NOTNULL(txring_->GetPacketPool()->PacketAlloc());
-      PrepareDataPacket<CopyMode::kMemCopy>(
-          tx_tracking_.GetOldestUnackedMsgBuf(), packet, pcb_.snd_una);
-      txring_->SendPackets(&packet, 1);
+      VLOG(1) << "RTO retransmitting data packet " << pcb_.snd_una;
+      auto* packet = txring_->GetPacketPool()->PacketAlloc();
+      sent = packet != nullptr;
+      if (sent) [[likely]] {
+        PrepareDataPacket<CopyMode::kMemCopy>(
+            tx_tracking_.GetOldestUnackedSegment(), packet, pcb_.snd_una);
+        txring_->StagePackets(&packet, 1);
+      }
     } else if (state_ == State::kSynReceived) {
-      SendSynAck(pcb_.snd_una);
+      sent = SendSynAck(pcb_.snd_una);
     } else if (state_ == State::kSynSent) {
-      LOG(INFO) << "RTO retransmitting SYN packet " << pcb_.snd_una;
+      VLOG(1) << "RTO retransmitting SYN packet " << pcb_.snd_una;
       // Retransmit the SYN packet.
-      SendSyn(pcb_.snd_una);
+      sent = SendSyn(pcb_.snd_una);
     }
     pcb_.rto_reset();
-    pcb_.rto_rexmits++;
+    // Running out of packets is local overload, not a sign of a dead peer; it
+    // does not count towards giving up on the flow.
+    if (sent) {
+      pcb_.rto_rexmits++;
+      shm::StatsAdd(&channel_->stats()->rto_rexmits, 1);
+      Trace(TraceEventType::kRtoRexmit, pcb_.snd_una, pcb_.rto_rexmits);
+    }
   }
 
   /**
    * @brief Helper function to transmit a number of packets from the queue of
-   * pending TX data.
+   * pending TX data. While the TX path is congested the data stays queued,
+   * until the engine resumes the flow (see `ResumeTx()').
    */
   void TransmitPackets() {
     auto remaining_packets =
-        std::min(pcb_.effective_wnd(), tx_tracking_.NumUnsentMsgbufs());
+        std::min(pcb_.effective_wnd(), tx_tracking_.NumUnsentSegments());
     if (remaining_packets == 0) return;
 
+    if (txring_->IsCongested()) [[unlikely]] {
+      pcb_.tx_pauses++;
+      Trace(TraceEventType::kTxPause, pcb_.snd_nxt, remaining_packets);
+      return;
+    }
+
+    bool sent = false;
+    const auto now = time::rdtsc();
     do {
       // Allocate a packet batch.
       dpdk::PacketBatch batch;
       auto pkt_cnt =
           std::min(remaining_packets, static_cast<uint32_t>(batch.GetRoom()));
-      if (!txring_->GetPacketPool()->PacketBulkAlloc(&batch, pkt_cnt)) {
-        LOG(ERROR) << "Failed to allocate packet batch";
-        return;
+      if (!txring_->GetPacketPool()->PacketBulkAlloc(&batch, pkt_cnt))
+          [[unlikely]] {
+        pcb_.tx_pauses++;
+        Trace(TraceEventType::kTxPause, pcb_.snd_nxt, remaining_packets);
+        break;
       }
 
       // Prepare the packets.
       for (uint16_t i = 0; i < batch.GetSize(); i++) {
-        auto msg = tx_tracking_.GetAndUpdateOldestUnsent();
-        if (!msg.has_value()) break;
-        auto* msg_buf = msg.value();
+        auto segment = tx_tracking_.GetAndUpdateOldestUnsent();
+        if (!segment.has_value()) break;
         auto* packet = batch.pkts()[i];
         if (kShmZeroCopyEnabled) {
-          PrepareDataPacket<CopyMode::kZeroCopy>(msg_buf, packet,
-                                                 pcb_.get_snd_nxt());
+          PrepareDataPacket<CopyMode::kZeroCopy>(segment.value(), packet,
+                                                 pcb_.get_snd_nxt(), now);
         } else {
-          PrepareDataPacket<CopyMode::kMemCopy>(msg_buf, packet,
-                                                pcb_.get_snd_nxt());
+          PrepareDataPacket<CopyMode::kMemCopy>(segment.value(), packet,
+                                                pcb_.get_snd_nxt(), now);
         }
       }
 
       // TX.
-      txring_->SendPackets(&batch);
+      txring_->StagePackets(&batch);
+      shm::StatsAdd(&channel_->stats()->tx_pkts, pkt_cnt);
       remaining_packets -= pkt_cnt;
+      sent = true;
     } while (remaining_packets);
 
-    if (pcb_.rto_disabled()) pcb_.rto_enable();
+    if (sent && pcb_.rto_disabled()) pcb_.rto_enable();
   }
 
   void process_ack(const MachnetPktHdr* machneth) {
@@ -843,6 +1059,7 @@ class Flow {
       pcb_.duplicate_acks++;
       // Update the number of out-of-order acknowledgements.
       pcb_.snd_ooo_acks = machneth->sack_bitmap_count.value();
+      Trace(TraceEventType::kDupAck, ackno, pcb_.duplicate_acks);
 
       if (pcb_.duplicate_acks < swift::Pcb::kRexmitThreshold) {
         // We have not reached the threshold yet, so we do not do anything.
@@ -862,7 +1079,7 @@ class Flow {
         // In order to avoid retransmitting multiple times other missing packets
         // in the bitmap, we skip holes: we use the number of duplicate ACKs to
         // skip previous holes.
-        auto* msgbuf = tx_tracking_.GetOldestUnackedMsgBuf();
+        auto segment = tx_tracking_.GetOldestUnackedSegment();
         size_t holes_to_skip =
             pcb_.duplicate_acks - swift::Pcb::kRexmitThreshold;
         size_t index = 0;
@@ -885,33 +1102,50 @@ class Flow {
             if (holes_to_skip-- == 0) {
               auto seqno = pcb_.snd_una + index;
               auto* packet_pool = txring_->GetPacketPool();
-              auto* packet = CHECK_NOTNULL(packet_pool->PacketAlloc());
-              PrepareDataPacket<CopyMode::kMemCopy>(msgbuf, packet, seqno);
-              txring_->SendPackets(&packet, 1);
+              auto* packet = packet_pool->PacketAlloc();
+              // Out of packets; a later ACK or the RTO retransmits it.
+              if (packet == nullptr) [[unlikely]]
+                return;
+              PrepareDataPacket<CopyMode::kMemCopy>(segment, packet, seqno);
+              txring_->StagePackets(&packet, 1);
               pcb_.rto_reset();
+              shm::StatsAdd(&channel_->stats()->fast_rexmits, 1);
+              Trace(TraceEventType::kSackRexmit, seqno);
               return;
             }
           } else {
             sack_bitmap_count--;
           }
           index++;
-          msgbuf = channel_->GetMsgBuf(msgbuf->next());
+          segment = tx_tracking_.NextSegment(segment);
         }
         // There is no other missing segment to retransmit, so we could send new
         // packets.
       }
     } else if (swift::seqno_gt(ackno, pcb_.snd_nxt)) {
-      LOG(ERROR) << "ACK received for untransmitted data.";
+      Trace(TraceEventType::kInvalidAck, ackno, pcb_.snd_nxt);
+      VLOG(1) << "ACK received for untransmitted data.";
     } else {
       // This is a valid ACK, acknowledging new data.
       size_t num_acked_packets = ackno - pcb_.snd_una;
       if (state_ == State::kSynReceived) {
-        state_ = State::kEstablished;
+        SetState(State::kEstablished);
         num_acked_packets--;
       }
 
       tx_tracking_.ReceiveAcks(num_acked_packets);
 
+      // ACKs echo the TSC of the last data packet the peer received; zero if
+      // that was a retransmission.
+      const auto ts_echo = machneth->timestamp1.value();
+      const auto now = time::rdtsc();
+      if (ts_echo != 0 && ts_echo <= now) {
+        const auto rtt_us = static_cast<uint32_t>(
+            std::min<uint64_t>(time::cycles_to_us(now - ts_echo), UINT32_MAX));
+        pcb_.rtt_sample(rtt_us);
+        Trace(TraceEventType::kRttSample, ackno, rtt_us, pcb_.srtt_us);
+      }
+
       pcb_.snd_una = ackno;
       pcb_.duplicate_acks = 0;
       pcb_.snd_ooo_acks = 0;
@@ -925,17 +1159,22 @@ class Flow {
   const Key key_;
   // A flow is identified by the 5-tuple (Proto is always UDP).
   const Ethernet::Address local_l2_addr_;
-  const Ethernet::Address remote_l2_addr_;
+  Ethernet::Address remote_l2_addr_;
   // Flow state.
   State state_;
   // Pointer to the TX ring for the flow to send packets on.
   dpdk::TxRing* txring_;
+  // Trace ring of the engine, and the id the flow's events are tagged with.
+  Tracer* tracer_;
+  const uint32_t flow_id_;
   // Callback to be invoked when the flow is either established or closed.
   ApplicationCallback callback_;
   // Shared pointer to the channel attached to this flow.
   shm::Channel* channel_;
   // Swift CC protocol control block.
   swift::Pcb pcb_;
+  // Whether an ACK is pending, held back while the TX path was congested.
+  bool ack_deferred_{false};
   TXTracking tx_tracking_;
   RXTracking rx_tracking_;
 };
@@ -0,0 +1,257 @@
+/**
+ * @file loopback.h
+ * @brief Two Machnet engines in one process, connected back to back through a
+ * `NetworkEmulator', for end-to-end transport tests and benchmarks.
+ */
+#ifndef SRC_INCLUDE_LOOPBACK_H_
+#define SRC_INCLUDE_LOOPBACK_H_
+
+#include <channel.h>
+#include <glog/logging.h>
+#include <ipv4.h>
+#include <machnet_common.h>
+#include <machnet_engine.h>
+#include <net_emulator.h>
+#include <pmd.h>
+#include <ttime.h>
+#include <utils.h>
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <string>
+
+namespace juggler {
+
+/**
+ * @brief A Machnet engine with one channel on each side (A and B) of a
+ * `NetworkEmulator', stepped in lockstep from a single thread with a virtual
+ * clock. The clock only moves with `Step()': by a fixed quantum (the time an
+ * engine iteration is assumed to take) while packets or messages are
+ * pending, and straight to the next packet delivery or slow tick otherwise.
+ * Runs are thus reproducible for a given seed, whatever the speed of the
+ * machine, and idle periods (e.g., waiting for an RTO) cost nothing.
+ *
+ * The clock counts nanoseconds: the constructor sets the TSC frequency of the
+ * calling thread (`time::tsc_hz'), which must be the one stepping. Flows take
+ * their RTT samples from the real TSC, so those are not meaningful here.
+ *
+ * Applications use the channels with the usual non-blocking calls (e.g.,
+ * `machnet_send()', `machnet_recv()'), between steps; `Listen()' and
+ * `Connect()' replace their blocking counterparts. Each side pins the MAC
+ * address of the other, so no ARP is needed.
+ *
+ * This class is not thread-safe.
+ */
+class Loopback {
+ public:
+  using Side = dpdk::NetworkEmulator::Side;
+  static constexpr uint64_t kTscHz = 1000000000;
+  static constexpr uint32_t kRingDescNr = 1024;
+  static constexpr uint64_t kControlTimeoutNs = 10000000000;
+
+  struct Options {
+    dpdk::LinkConf a_to_b{};
+    dpdk::LinkConf b_to_a{};
+    uint64_t seed{1};
+    uint64_t step_ns{1000};  // Duration of an engine iteration.
+  };
+
+  explicit Loopback(const Options &options)
+      : step_ns_(options.step_ns),
+        emulator_(std::make_unique<dpdk::NetworkEmulator>(
+            options.a_to_b, options.b_to_a, options.seed, kTscHz)) {
+    CHECK_GT(step_ns_, 0);
+    time::tsc_hz = kTscHz;
+
+    // Channel names must be unique in the process.
+    static uint32_t next_id = 0;
+    const auto id = next_id++;
+    const char *kSideNames[] = {"a", "b"};
+    const auto channel_buffer_size =
+        dpdk::PmdRing::kDefaultFrameSize - sizeof(net::Ipv4) -
+        sizeof(net::Udp) - sizeof(net::MachnetPktHdr);
+    for (const auto side : {Side::kA, Side::kB}) {
+      auto &endpoint = endpoints_[side];
+      endpoint.ipv4_addr = net::Ipv4::Address(0x0a000001u + side);
+      endpoint.pmd_port = std::make_shared<dpdk::PmdPort>(
+          emulator_->GetPortId(side), 1, 1, kRingDescNr, kRingDescNr);
+      endpoint.pmd_port->InitDriver();
+      endpoint.shared_state = std::make_shared<MachnetEngineSharedState>(
+          endpoint.pmd_port->GetRSSKey(), endpoint.pmd_port->GetL2Addr(),
+          std::vector<net::Ipv4::Address>{endpoint.ipv4_addr});
+
+      const auto name = utils::Format("loopback%u_%s", id, kSideNames[side]);
+      CHECK(channel_manager_.AddChannel(
+          name.c_str(), shm::ChannelManager<>::kDefaultRingSize,
+          shm::ChannelManager<>::kDefaultRingSize,
+          shm::ChannelManager<>::kDefaultBufferCount, channel_buffer_size))
+          << "Failed to create channel " << name;
+      endpoint.channel = channel_manager_.GetChannel(name.c_str());
+      endpoint.engine = std::make_unique<MachnetEngine>(
+          endpoint.pmd_port, 0, 0, endpoint.shared_state,
+          std::vector<std::shared_ptr<shm::Channel>>{endpoint.channel});
+    }
+    for (const auto side : {Side::kA, Side::kB}) {
+      const auto &peer = endpoints_[Peer(side)];
+      endpoints_[side].shared_state->PinNeighbor(peer.ipv4_addr,
+                                                 peer.pmd_port->GetL2Addr());
+    }
+    tick_ns_ = endpoints_[Side::kA].engine->kSlowTimerIntervalUs * 1000;
+  }
+  Loopback(const Loopback &) = delete;
+  Loopback &operator=(const Loopback &) = delete;
+  // Packets go back to the pools of the ports before these are destroyed.
+  ~Loopback() { emulator_->Drain(); }
+
+  static Side Peer(Side side) { return side == Side::kA ? Side::kB : Side::kA; }
+
+  /**
+   * @return The virtual time, in nanoseconds.
+   */
+  uint64_t Now() const { return now_; }
+
+  /**
+   * @return The context of a side's channel, to use with the Machnet API.
+   */
+  const void *GetChannelCtx(Side side) const {
+    return endpoints_[side].channel->ctx();
+  }
+
+  net::Ipv4::Address GetIpv4Addr(Side side) const {
+    return endpoints_[side].ipv4_addr;
+  }
+
+  MachnetEngine &GetEngine(Side side) { return *endpoints_[side].engine; }
+
+  const dpdk::NetworkEmulator &GetEmulator() const { return *emulator_; }
+
+  /**
+   * @brief Runs an iteration of both engines and of the emulator at the
+   * current time, then advances the clock.
+   */
+  void Step() {
+    for (auto &endpoint : endpoints_) endpoint.engine->Run(now_);
+    emulator_->Step(now_);
+    // The engines run their slow timer on the same iterations.
+    if (now_ - last_tick_ >= tick_ns_) last_tick_ = now_;
+
+    auto next = now_ + step_ns_;
+    if (!IsBusy()) {
+      // Nothing happens until the next delivery or slow tick.
+      auto wakeup = last_tick_ + tick_ns_;
+      const auto delivery = emulator_->NextDelivery();
+      if (delivery.has_value()) wakeup = std::min(wakeup, delivery.value());
+      next = std::max(next, wakeup);
+    }
+    now_ = next;
+  }
+
+  /**
+   * @brief Steps until a condition holds, checking it before every step.
+   *
+   * @param done The condition; it may also act as the applications do.
+   * @param timeout_ns How long to wait for, in virtual time.
+   * @return False on timeout.
+   */
+  bool RunUntil(const std::function<bool()> &done, uint64_t timeout_ns) {
+    const auto deadline = now_ + timeout_ns;
+    while (!done()) {
+      if (now_ >= deadline) return false;
+      Step();
+    }
+    return true;
+  }
+
+  /**
+   * @brief Listens on a port of a side, like `machnet_listen()'.
+   */
+  bool Listen(Side side, uint16_t port) {
+    MachnetCtrlQueueEntry_t req = {};
+    req.opcode = MACHNET_CTRL_OP_LISTEN;
+    req.listener_info.ip = endpoints_[side].ipv4_addr.address.value();
+    req.listener_info.port = port;
+    return Control(side, &req).has_value();
+  }
+
+  /**
+   * @brief Connects a side to a port of the other one, like
+   * `machnet_connect()'.
+   *
+   * @return The flow, once established.
+   */
+  std::optional<MachnetFlow_t> Connect(Side side, uint16_t port) {
+    MachnetCtrlQueueEntry_t req = {};
+    req.opcode = MACHNET_CTRL_OP_CREATE_FLOW;
+    req.flow_info.src_ip = endpoints_[side].ipv4_addr.address.value();
+    req.flow_info.dst_ip = endpoints_[Peer(side)].ipv4_addr.address.value();
+    req.flow_info.dst_port = port;
+    const auto resp = Control(side, &req);
+    if (!resp.has_value()) return std::nullopt;
+    return resp->flow_info;
+  }
+
+ private:
+  struct Endpoint {
+    net::Ipv4::Address ipv4_addr;
+    std::shared_ptr<dpdk::PmdPort> pmd_port;
+    std::shared_ptr<MachnetEngineSharedState> shared_state;
+    std::shared_ptr<shm::Channel> channel;
+    std::unique_ptr<MachnetEngine> engine;
+  };
+
+  // Whether the engines have work to do on the next iteration: packets to
+  // receive or to send again, or messages from the applications.
+  bool IsBusy() const {
+    if (emulator_->HasQueued()) return true;
+    return std::any_of(
+        endpoints_.begin(), endpoints_.end(), [](const Endpoint &endpoint) {
+          const auto *txring = endpoint.pmd_port->GetRing<dpdk::TxRing>(0);
+          return txring->GetBacklogCount() > 0 ||
+                 __machnet_channel_app_ring_pending(endpoint.channel->ctx()) >
+                     0;
+        });
+  }
+
+  // Submits a control request, and steps until its completion.
+  std::optional<MachnetCtrlQueueEntry_t> Control(
+      Side side, MachnetCtrlQueueEntry_t *req) {
+    auto *ctx = endpoints_[side].channel->ctx();
+    req->id = ctx->ctrl_ctx.req_id++;
+    if (__machnet_channel_ctrl_sq_enqueue(ctx, 1, req) != 1) {
+      LOG(ERROR) << "Failed to enqueue control request.";
+      return std::nullopt;
+    }
+
+    MachnetCtrlQueueEntry_t resp;
+    if (!RunUntil(
+            [ctx, &resp]() {
+              return __machnet_channel_ctrl_cq_dequeue(ctx, 1, &resp) == 1;
+            },
+            kControlTimeoutNs)) {
+      LOG(ERROR) << "Control request " << req->id << " timed out.";
+      return std::nullopt;
+    }
+    if (resp.id != req->id || resp.status != MACHNET_CTRL_STATUS_OK) {
+      LOG(ERROR) << "Control request " << req->id << " failed.";
+      return std::nullopt;
+    }
+    return resp;
+  }
+
+  const uint64_t step_ns_;
+  uint64_t tick_ns_{0};
+  uint64_t now_{0};
+  uint64_t last_tick_{0};
+  // Destroyed last: the engines and ports use its rings.
+  std::unique_ptr<dpdk::NetworkEmulator> emulator_;
+  shm::ChannelManager<> channel_manager_;
+  std::array<Endpoint, 2> endpoints_;
+};
+
+}  // namespace juggler
+
+#endif  // SRC_INCLUDE_LOOPBACK_H_
@@ -8,28 +8,36 @@
 #include <dpdk.h>
 #include <ether.h>
 #include <ipv4.h>
+#include <route.h>
 #include <utils.h>
 
 #include <algorithm>
 #include <nlohmann/json.hpp>
 #include <unordered_set>
+#include <utility>
+#include <vector>
 
 namespace juggler {
 
 class NetworkInterfaceConfig {
  public:
+  using StaticNeighbor = std::pair<net::Ipv4::Address, net::Ethernet::Address>;
   inline static const cpu_set_t kDefaultCpuMask =
       utils::calculate_cpu_mask(0xFFFFFFFF);
-  explicit NetworkInterfaceConfig(const std::string pcie_addr,
-                                  const net::Ethernet::Address &l2_addr,
-                                  const net::Ipv4::Address &ip_addr,
-                                  size_t engine_threads = 1,
-                                  cpu_set_t cpu_mask = kDefaultCpuMask)
+  explicit NetworkInterfaceConfig(
+      const std::string pcie_addr, const net::Ethernet::Address &l2_addr,
+      const net::Ipv4::Address &ip_addr, size_t engine_threads = 1,
+      cpu_set_t cpu_mask = kDefaultCpuMask,
+      std::vector<size_t> engine_cores = {}, std::vector<Route> routes = {},
+      std::vector<StaticNeighbor> static_neighbors = {})
       : pcie_addr_(pcie_addr),
         l2_addr_(l2_addr),
         ip_addr_(ip_addr),
         engine_threads_(engine_threads),
         cpu_mask_(cpu_mask),
+        engine_cores_(engine_cores),
+        routes_(std::move(routes)),
+        static_neighbors_(std::move(static_neighbors)),
         dpdk_port_id_(std::nullopt) {}
   bool operator==(const NetworkInterfaceConfig &other) const {
     return l2_addr_ == other.l2_addr_;
@@ -40,16 +48,42 @@ class NetworkInterfaceConfig {
   const net::Ipv4::Address &ip_addr() const { return ip_addr_; }
   size_t engine_threads() const { return engine_threads_; }
   cpu_set_t cpu_mask() const { return cpu_mask_; }
+  const std::vector<size_t> &engine_cores() const { return engine_cores_; }
+  const std::vector<Route> &routes() const { return routes_; }
+  const std::vector<StaticNeighbor> &static_neighbors() const {
+    return static_neighbors_;
+  }
+  // CPU mask of an engine: its own core if one is configured, else the mask
+  // shared by all the engines of the interface.
+  cpu_set_t engine_cpu_mask(size_t engine_id) const {
+    if (engine_id >= engine_cores_.size()) return cpu_mask_;
+    cpu_set_t mask;
+    CPU_ZERO(&mask);
+    CPU_SET(engine_cores_[engine_id], &mask);
+    return mask;
+  }
   std::optional<uint16_t> dpdk_port_id() const { return dpdk_port_id_; }
   void Dump() const {
+    std::string engine_cores;
+    for (const auto core : engine_cores_) {
+      if (!engine_cores.empty()) engine_cores += ",";
+      engine_cores += std::to_string(core);
+    }
     LOG(INFO) << "NetworkInterfaceConfig: "
               << utils::Format(
                      "[PCIe: %s, L2: %s, IP: %s, engine_threads: %zu, "
-                     "cpu_mask: %lu, dpdk_port_id: %d]",
+                     "cpu_mask: %lu, engine_cores: [%s], dpdk_port_id: %d]",
                      pcie_addr_.c_str(), l2_addr_.ToString().c_str(),
                      ip_addr_.ToString().c_str(), engine_threads_,
-                     utils::cpuset_to_sizet(cpu_mask_),
+                     utils::cpuset_to_sizet(cpu_mask_), engine_cores.c_str(),
                      dpdk_port_id_.value_or(-1));
+    for (const auto &route : routes_) {
+      LOG(INFO) << "  Route: " << route.ToString();
+    }
+    for (const auto &[addr, l2addr] : static_neighbors_) {
+      LOG(INFO) << "  Static neighbour: " << addr.ToString() << " -> "
+                << l2addr.ToString();
+    }
   }
 
   void set_dpdk_port_id(std::optional<uint16_t> dpdk_port_id) {
@@ -62,6 +96,9 @@ class NetworkInterfaceConfig {
   const net::Ipv4::Address ip_addr_;
   const size_t engine_threads_;
   cpu_set_t cpu_mask_;
+  const std::vector<size_t> engine_cores_;
+  const std::vector<Route> routes_;
+  const std::vector<StaticNeighbor> static_neighbors_;
   std::optional<uint16_t> dpdk_port_id_;
 };
 }  // namespace juggler
@@ -87,6 +124,16 @@ namespace juggler {
  *         "engine_threads": "1",
  *         "cpu_mask": "0x1"
  *     },
+ *     "00:0d:3a:d6:9b:6b": {
+ *         "ip": "10.0.1.1",
+ *         "engine_cores": [2, 3],
+ *         "prefix_len": 24,
+ *         "routes": [
+ *           {"dst": "10.2.0.0/16", "via": "10.0.1.254"},
+ *           {"dst": "0.0.0.0/0", "via": "10.0.1.254"}
+ *         ],
+ *         "neighbors": {"10.0.1.254": "00:0d:3a:d6:9b:70"}
+ *     },
  *   }
  * }
  *
@@ -96,6 +143,17 @@ namespace juggler {
  *
  * Note that `engine_threads` (decimal) and `cpu_mask` (hex) are optional. If
  * not specified, the default value is 1 and 0xFFFFFFFF respectively.
+ *
+ * `engine_cores` (optional) pins each engine of the interface to its own core,
+ * in order; it also sets the number of engines. Cores should be on the NUMA
+ * node of the NIC: Machnet warns at startup about engines that are not.
+ *
+ * `prefix_len`, `routes` and `neighbors` (optional) set up the routing of the
+ * interface (see `RoutingTable'). `prefix_len` adds an on-link route to the
+ * subnet of `ip`; each route sends the destinations in `dst` through gateway
+ * `via` (on-link if omitted). Destinations without a route are assumed to be
+ * on the link. `neighbors` pins the MAC addresses of known hosts or gateways,
+ * which are then never resolved with ARP.
  */
 class MachnetConfigProcessor {
  public:
@@ -13,7 +13,10 @@
 #include <ud_socket.h>
 #include <uuid/uuid.h>
 
+#include <atomic>
+#include <chrono>
 #include <csignal>
+#include <string>
 #include <thread>
 
 #include "common.h"
@@ -33,6 +36,12 @@ class MachnetController {
   using ChannelManager = juggler::shm::ChannelManager<juggler::shm::Channel>;
   // Timeout for idle connections in seconds.
   static constexpr uint32_t kConnectionTimeoutInSec = 2;
+  // Per-host limits on the channel sizing requested by the applications (see
+  // `MachnetChannelOpts'). Channel memory is accounted for with huge pages.
+  static constexpr size_t kMaxChannelRingSize = 1 << 16;
+  static constexpr size_t kMaxChannelBufferCount = 1 << 18;
+  static constexpr size_t kMaxChannelMemSize = size_t{1} * 1024 * MB;
+  static constexpr size_t kMaxTotalChannelMemSize = size_t{8} * 1024 * MB;
   MachnetController(const MachnetController &) = delete;
   // Delete constructor and assignment operator.
   MachnetController &operator=(const MachnetController &) = delete;
@@ -77,6 +86,32 @@ class MachnetController {
    */
   void Stop();
 
+  /**
+   * @brief Resolve the sizing options requested by an application into the
+   * configuration of a new channel, filling in the defaults. The result is
+   * checked against the per-host limits; a channel is accounted for along
+   * with the most memory its extension segments may take.
+   * @param[in] opts                  The requested sizing options.
+   * @param[in] host_mem_size         The memory taken by the existing
+   *                                  channels (and their segments).
+   * @param[out] machnet_ring_slot_nr The number of Machnet->App ring slots.
+   * @param[out] app_ring_slot_nr     The number of App->Machnet ring slots.
+   * @param[out] buf_classes          The buffer size classes.
+   * @return True if the channel can be created, false otherwise.
+   */
+  static bool GetChannelConf(
+      const MachnetChannelOpts_t &opts, size_t host_mem_size,
+      size_t *machnet_ring_slot_nr, size_t *app_ring_slot_nr,
+      std::vector<MachnetChannelBufClassConf_t> *buf_classes);
+
+  /**
+   * @brief Get the NUMA node an engine runs on.
+   * @param[in] cpu_mask      The CPU mask of the engine.
+   * @param[in] nic_numa_node The NUMA node of the engine's NIC.
+   * @return The NUMA node, or -1 if the engine can run on several nodes.
+   */
+  static int GetEngineNumaNode(const cpu_set_t &cpu_mask, int nic_numa_node);
+
  private:
   // Default constructor is private.
   explicit MachnetController(const std::string &conf_file);
@@ -94,8 +129,9 @@ class MachnetController {
    * @param s The socket that is being connected.
    * @param data The data received.
    * @param length The length of the data received.
+   * @param fd A file descriptor passed along with the message, or -1.
    */
-  void HandleNewMessage(UDSocket *s, const char *data, size_t length);
+  void HandleNewMessage(UDSocket *s, const char *data, size_t length, int fd);
 
   /**
    * @brief Callback to handle passive close of the socket.
@@ -110,6 +146,14 @@ class MachnetController {
    */
   void HandleTimeout(UDSocket *s);
 
+  /**
+   * @brief Callback for periodic work on the controller's thread: grows and
+   * shrinks the buffer pools of the channels with extension segments (see
+   * `Channel::UpdateSegments()'), so that the engines never block on it, and
+   * reaps a capture that was asked to stop once it has finished.
+   */
+  void HandleIdle();
+
   /**
    * @brief Callback to handle shutdown of a client.
    * @param s The socket that is being closed.
@@ -145,6 +189,88 @@ class MachnetController {
   bool CreateChannel(const uuid_t app_uuid,
                      const machnet_channel_info_t *channel_info, int *fd);
 
+  /**
+   * @brief Get a pending extension segment of a channel, for the application
+   * to map it.
+   * @param[in] app_uuid     UUID of the originating application.
+   * @param[in] segment_info The channel and the buffer class of the segment.
+   * @param[out] fd          The file descriptor of the segment (-1 on
+   * failure).
+   * @return True if the segment has been found, false otherwise.
+   */
+  bool GetChannelSegment(const uuid_t app_uuid,
+                         const machnet_segment_info_t *segment_info, int *fd);
+
+  /**
+   * @brief Build a human-readable status report of all the engines, from the
+   * snapshots they publish (see `EngineStatus'). Runs on the controller
+   * thread, off the data path.
+   * @return The report.
+   */
+  std::string GetStatusReport() const;
+
+  /**
+   * @brief Build a report of the extended statistics of all the ports, one
+   * "<port id> <name> <value>" line per counter (see `PmdPort::GetXStats()').
+   * @return The report.
+   */
+  std::string GetPortStatsReport() const;
+
+  /**
+   * @brief Sets the classes of transport events all the engines trace (see
+   * `Tracer').
+   * @param classes Mask of `TraceClass'.
+   */
+  void SetTraceClasses(uint32_t classes);
+
+  /**
+   * @brief Build a binary dump of the trace rings of all the engines: for
+   * each, a `TraceDumpHeader' followed by its events.
+   * @return The dump.
+   */
+  std::string GetTraceDump() const;
+
+  /**
+   * @brief Applies a routing request (see `machnet_route_info') to the
+   * interfaces it names.
+   * @param info The request.
+   * @param report Pointer to store the listing to, for list requests.
+   * @return True on success.
+   */
+  bool HandleRouteRequest(const machnet_route_info_t &info,
+                          std::string *report);
+
+  /**
+   * @brief Start capturing the packets of all the engines (see `CaptureTap'),
+   * on a thread of its own. Only one capture runs at a time.
+   * @param owner       The connection that requested the capture; the
+   *                    capture stops when it closes.
+   * @param fd          The file descriptor to write the capture to; it is
+   *                    owned by the capture from now on.
+   * @param filter      The filter expression (see `CaptureFilter').
+   * @param snaplen     Bytes captured per packet, at most.
+   * @param max_packets Number of packets after which to stop (0: no limit).
+   * @return True if the capture has started.
+   */
+  bool StartCapture(const UDSocket *owner, int fd, const std::string &filter,
+                    uint32_t snaplen, uint64_t max_packets);
+
+  /**
+   * @brief Ask the capture, if any, to stop. It finishes on its own thread, and
+   * is reaped from `HandleIdle()' (see `ReapCapture()').
+   * @param requester The connection to send the summary of the capture to once
+   *                  it has finished, or nullptr.
+   * @param msg_id    ID of the stop request, for the response.
+   * @return False if there is no capture.
+   */
+  bool StopCapture(UDSocket *requester, uint32_t msg_id);
+
+  /**
+   * @brief Wait for the capture thread, if any, to finish, and send the summary
+   * of the capture to the connection that asked to stop it, if any.
+   */
+  void ReapCapture();
+
   /**
    * @brief The main loop of the controller.
    */
@@ -156,6 +282,18 @@ class MachnetController {
   void StopController();
 
  private:
+  /**
+   * @brief Get the memory taken by the channels, including the most their
+   * extension segments may take.
+   */
+  size_t GetChannelMemSize();
+
+  /**
+   * @brief Body of the capture thread: drains the capture taps of the engines
+   * into a pcapng file until asked to stop (see `StartCapture()').
+   */
+  void CaptureLoop(int fd, CaptureTap::Config config, uint64_t max_packets);
+
   static inline MachnetController *instance_;
   MachnetConfigProcessor config_processor_;
   ChannelManager channel_manager_;
@@ -163,7 +301,20 @@ class MachnetController {
   dpdk::Dpdk dpdk_{};
   std::vector<std::shared_ptr<dpdk::PmdPort>> pmd_ports_{};
   std::vector<std::shared_ptr<MachnetEngine>> engines_{};
+  // NUMA node of each engine (-1 if unknown).
+  std::vector<int> engine_numa_nodes_{};
   std::unique_ptr<UDServer> server_{nullptr};
+  // When the extension segments of the channels were last updated.
+  std::chrono::steady_clock::time_point segments_update_time_{};
+  // Packet capture; at most one runs at a time.
+  std::thread capture_thread_{};
+  std::atomic<bool> capture_stop_{false};
+  std::atomic<bool> capture_running_{false};
+  const UDSocket *capture_owner_{nullptr};
+  // Connection waiting for the summary of the capture, and its request ID.
+  UDSocket *capture_stop_requester_{nullptr};
+  uint32_t capture_stop_msg_id_{0};
+  std::string capture_summary_{};
   std::unordered_map<std::string, std::unordered_set<std::string>>
       applications_registered_{};
 };
@@ -6,18 +6,25 @@
 #define SRC_INCLUDE_MACHNET_ENGINE_H_
 
 #include <arp.h>
+#include <capture_tap.h>
 #include <channel.h>
 #include <common.h>
+#include <engine_profiler.h>
+#include <engine_status.h>
 #include <ether.h>
 #include <flow.h>
 #include <icmp.h>
 #include <ipv4.h>
 #include <pmd.h>
+#include <route.h>
 #include <rte_thash.h>
+#include <seqlock.h>
+#include <trace.h>
 #include <udp.h>
 
 #include <concepts>
 #include <cstddef>
+#include <cstring>
 #include <functional>
 #include <future>
 #include <list>
@@ -25,6 +32,7 @@
 #include <optional>
 #include <string>
 #include <tuple>
+#include <unordered_map>
 #include <unordered_set>
 #include <vector>
 
@@ -41,6 +49,10 @@ class MachnetEngineSharedState {
   static const size_t kSrcPortMax = (1 << 16) - 1;  // 65535
   static constexpr size_t kSrcPortBitmapSize =
       (kSrcPortMax + 1) / sizeof(uint64_t) / 8;
+  // Interval between neighbour table refreshes, and number of gratuitous ARP
+  // announcements sent after startup (one per interval).
+  static constexpr uint64_t kNeighborTickIntervalS = 1;
+  static constexpr uint32_t kGratuitousArpCount = 3;
   explicit MachnetEngineSharedState(std::vector<uint8_t> rss_key,
                                     net::Ethernet::Address l2addr,
                                     std::vector<net::Ipv4::Address> ipv4_addrs)
@@ -276,20 +288,71 @@ class MachnetEngineSharedState {
     SrcPortReleaseLocked(ipv4_addr, port);
   }
 
-  std::optional<net::Ethernet::Address> GetL2Addr(
-      const dpdk::TxRing *txring, const net::Ipv4::Address &local_ip,
-      const net::Ipv4::Address &target_ip) {
-    const std::lock_guard<std::mutex> lock(mtx_);
-    return arp_handler_.GetL2Addr(txring, local_ip, target_ip);
+  /**
+   * @brief The neighbour table of the interface; engines read it through a
+   * `NeighborCache'.
+   */
+  const NeighborTable &GetNeighborTable() const {
+    return arp_handler_.GetNeighborTable();
+  }
+
+  /**
+   * @brief The routing table of the interface; the MAC address of a peer is
+   * that of its next hop.
+   */
+  const RoutingTable &GetRoutingTable() const { return routing_table_; }
+  RoutingTable *GetMutableRoutingTable() { return &routing_table_; }
+
+  void PinNeighbor(const net::Ipv4::Address &addr,
+                   const net::Ethernet::Address &l2addr) {
+    arp_handler_.PinNeighbor(addr, l2addr);
+  }
+  bool UnpinNeighbor(const net::Ipv4::Address &addr) {
+    return arp_handler_.UnpinNeighbor(addr);
+  }
+
+  /**
+   * @brief Issues an ARP request for an address that is not in the neighbour
+   * table.
+   */
+  void RequestL2Addr(dpdk::TxRing *txring, const net::Ipv4::Address &local_ip,
+                     const net::Ipv4::Address &target_ip) {
+    arp_handler_.RequestL2Addr(txring, local_ip, target_ip);
   }
 
+  // ARP processing does not block the other engines (see `NeighborTable').
   void ProcessArpPacket(dpdk::TxRing *txring, net::Arp *arph) {
-    const std::lock_guard<std::mutex> lock(mtx_);
     arp_handler_.ProcessArpPacket(txring, arph);
   }
 
+  /**
+   * @brief Announces the local IP addresses with gratuitous ARP after
+   * startup, and ages the neighbour table. Every engine calls this on its
+   * slow tick; only one of them does the work each interval, and the others
+   * return at once.
+   *
+   * @param txring The TX ring of the calling engine, to send ARP requests on.
+   * @param now The current TSC.
+   */
+  void NeighborTick(dpdk::TxRing *txring, uint64_t now) {
+    auto next = next_neighbor_tick_.load(std::memory_order_relaxed);
+    if (now < next) return;
+    const auto interval = time::s_to_cycles(kNeighborTickIntervalS);
+    if (!next_neighbor_tick_.compare_exchange_strong(
+            next, now + interval, std::memory_order_relaxed)) {
+      return;
+    }
+
+    if (announcements_left_.load(std::memory_order_relaxed) > 0) {
+      announcements_left_.fetch_sub(1, std::memory_order_relaxed);
+      for (const auto &[addr, _] : ipv4_port_bitmap_) {
+        arp_handler_.Announce(txring, addr);
+      }
+    }
+    arp_handler_.RefreshNeighbors(txring, now);
+  }
+
   std::vector<std::tuple<std::string, std::string>> GetArpTableEntries() {
-    const std::lock_guard<std::mutex> lock(mtx_);
     return arp_handler_.GetArpTableEntries();
   }
 
@@ -324,6 +387,11 @@ class MachnetEngineSharedState {
 
   const std::vector<uint8_t> rss_key_;
   ArpHandler arp_handler_;
+  RoutingTable routing_table_;
+  // Neighbour table maintenance (see `NeighborTick()'); the engine that wins
+  // the exchange on `next_neighbor_tick_' does it for that interval.
+  std::atomic<uint64_t> next_neighbor_tick_{0};
+  std::atomic<uint32_t> announcements_left_{kGratuitousArpCount};
   std::mutex mtx_{};
   std::unordered_map<net::Ipv4::Address, std::vector<uint64_t>>
       ipv4_port_bitmap_{};
@@ -375,6 +443,8 @@ class MachnetEngine {
         txring_(pmd_port_->GetRing<dpdk::TxRing>(tx_queue_id)),
         packet_pool_(CHECK_NOTNULL(txring_->GetPacketPool())),
         shared_state_(CHECK_NOTNULL(shared_state)),
+        neighbor_cache_(&shared_state_->GetNeighborTable()),
+        routes_(shared_state_->GetRoutingTable().GetSnapshot()),
         channels_(channels),
         last_periodic_timestamp_(0),
         periodic_ticks_(0) {
@@ -384,6 +454,8 @@ class MachnetEngine {
           std::unordered_map<Udp::Port, std::shared_ptr<shm::Channel>>());
     }
   }
+  // The TX ring outlives the engine; it must not keep tapping packets.
+  ~MachnetEngine() { txring_->SetCaptureTap(nullptr); }
 
   /**
    * @brief Get the PMD port used by this engine.
@@ -415,16 +487,24 @@ class MachnetEngine {
    * @param now The current TSC.
    */
   void Run(uint64_t now) {
+    profiler_.IterationBegin(now);
+    bool busy = false;
+
     // Calculate the time elapsed since the last periodic processing.
     const auto elapsed = time::cycles_to_us(now - last_periodic_timestamp_);
     if (elapsed >= kSlowTimerIntervalUs) {
       // Perform periodic processing.
       PeriodicProcess(now);
       last_periodic_timestamp_ = now;
+      busy = true;
+      profiler_.StageEnd(EngineStage::kPeriodic);
     }
 
     juggler::dpdk::PacketBatch rx_packet_batch;
     const uint16_t nb_pkt_rx = rxring_->RecvPackets(&rx_packet_batch);
+    capture_tap_->Tap(rx_packet_batch.pkts(), nb_pkt_rx, CaptureDirection::kRx,
+                      now);
+    profiler_.StageEnd(EngineStage::kRxBurst);
     for (uint16_t i = 0; i < nb_pkt_rx; i++) {
       const auto *pkt = rx_packet_batch.pkts()[i];
       process_rx_pkt(pkt, now);
@@ -432,19 +512,39 @@ class MachnetEngine {
 
     // We have processed the RX batch; release it.
     rx_packet_batch.Release();
+    busy |= nb_pkt_rx > 0;
+    profiler_.StageEnd(EngineStage::kRxProcess);
 
     // Process messages from channels.
     shm::MsgBufBatch msg_buf_batch;
     for (auto &channel : channels_) {
       // TODO(ilias): Revisit the number of messages to dequeue.
       const auto nb_msg_dequeued = channel->DequeueMessages(&msg_buf_batch);
+      profiler_.StageEnd(EngineStage::kChannelDequeue);
       for (uint32_t i = 0; i < nb_msg_dequeued; i++) {
         auto *msg = msg_buf_batch.bufs()[i];
         process_msg(channel.get(), msg, now);
       }
       // We have processed the message batch; reset it.
       msg_buf_batch.Clear();
+      busy |= nb_msg_dequeued > 0;
+      profiler_.StageEnd(EngineStage::kMsgProcess);
+    }
+
+    // Send everything this iteration produced (data, ACKs, retransmissions,
+    // ARP and ICMP replies) in a single burst.
+    busy |= txring_->GetStagedCount() > 0 || txring_->GetBacklogCount() > 0;
+    txring_->FlushStaged();
+
+    // Once the TX path is no longer congested, let the flows send what they
+    // held back in the meantime.
+    const bool tx_congested = txring_->IsCongested();
+    if (tx_congested_ && !tx_congested) {
+      for (const auto &[_, flow_it] : active_flows_map_) (*flow_it)->ResumeTx();
     }
+    tx_congested_ = tx_congested;
+    profiler_.StageEnd(EngineStage::kTx);
+    profiler_.IterationEnd(busy);
   }
 
   /**
@@ -457,62 +557,166 @@ class MachnetEngine {
     // Advance the periodic ticks counter.
     ++periodic_ticks_;
     HandleRTO();
-    DumpStatus();
+    // Start or stop capturing packets, if requested; sent packets are tapped
+    // as they are staged.
+    if (capture_tap_->Update()) {
+      txring_->SetCaptureTap(capture_tap_->IsEnabled() ? capture_tap_.get()
+                                                       : nullptr);
+    }
+    profiler_.Publish();
+    PublishStatus();
+    // Pick up neighbour and routing table changes; flows follow peers whose
+    // MAC address changed (e.g., after a VM migration or a route change).
+    shared_state_->NeighborTick(txring_, now);
+    const bool neighbors_changed = neighbor_cache_.Sync();
+    if (RoutesChanged() || neighbors_changed) UpdateFlowsL2Addr();
     ProcessControlRequests();
     // Continue the rest of management tasks locked to avoid race conditions
     // with the control plane.
     const std::lock_guard<std::mutex> lock(mtx_);
     // Refresh the list of active channels, if needed.
     ChannelsUpdate();
+    // Switch to the extension segments the controller has set up (or stop
+    // using those it reclaims), and refresh the occupancy and flows in the
+    // statistics of the channels.
+    for (auto &channel : channels_) {
+      channel->SyncSegments();
+      channel->UpdateStatsSnapshot();
+    }
   }
 
   // Return the number of channels served by this engine.
   size_t GetChannelCount() const { return channels_.size(); }
 
+  /**
+   * @brief Get the state shared with the other engines of the interface.
+   */
+  std::shared_ptr<MachnetEngineSharedState> GetSharedState() const {
+    return shared_state_;
+  }
+
+  /**
+   * @brief Reads the last status snapshot the engine published (see
+   * `EngineStatus'). Safe to call from any thread.
+   *
+   * @param status Pointer to store the snapshot to.
+   * @return True if a snapshot has been published.
+   */
+  bool GetStatus(EngineStatus *status) const {
+    return status_->Load(status) != 0;
+  }
+
+  /**
+   * @brief Reads the last profile the engine published (see
+   * `EngineProfiler'). Safe to call from any thread.
+   *
+   * @param profile Pointer to store the profile to.
+   * @return True if profiling is enabled and a profile has been published.
+   */
+  bool GetProfile(EngineProfile *profile) const {
+    return profiler_.GetProfile(profile);
+  }
+
+  /**
+   * @brief Returns the trace ring of the engine's flows (see `Tracer'); its
+   * classes can be set, and snapshots taken, from any thread.
+   */
+  Tracer *GetTracer() const { return tracer_.get(); }
+
+  /**
+   * @brief Returns the packet capture tap of the engine (see `CaptureTap');
+   * it is configured, and drained, from other threads.
+   */
+  CaptureTap *GetCaptureTap() const { return capture_tap_.get(); }
+
  protected:
-  void DumpStatus() {
-    std::string s;
-    s += "[Machnet Engine Status]";
-    s += "[PMD Port: " + std::to_string(pmd_port_->GetPortId()) +
-         ", RX_Q: " + std::to_string(rxring_->GetRingId()) +
-         ", TX_Q: " + std::to_string(txring_->GetRingId()) + "]\n";
-    s += "\tLocal L2 address:\n";
-    s += "\t\t" + pmd_port_->GetL2Addr().ToString() + "\n";
-    s += "\tLocal IPv4 addresses:\n";
-    s += "\t\t";
-    for (const auto &[addr, _] : shared_state_->GetIpv4PortBitmap()) {
-      s += addr.ToString();
-      s += ",";
-    }
-    s += "\n";
-    s += "\tActive channels:";
+  /**
+   * @brief Publishes a snapshot of the state of the engine (see
+   * `EngineStatus'). Only plain counters are copied here; formatting is left
+   * to the readers, so that it stays off the data path.
+   */
+  void PublishStatus() {
+    std::unordered_map<const shm::Channel *, uint16_t> channel_index;
+    channel_index.reserve(channels_.size());
     for (const auto &channel : channels_) {
-      s += "\n\t\t";
-      s += "[" + channel->GetName() + "]" +
-           " Total buffers: " + std::to_string(channel->GetTotalBufCount()) +
-           ", Free buffers: " + std::to_string(channel->GetFreeBufCount());
+      channel_index.emplace(channel.get(), channel_index.size());
     }
-    s += "\n";
-    s += "\tARP Table:\n";
-    for (const auto &entry : shared_state_->GetArpTableEntries()) {
-      s += "\t\t" + std::get<0>(entry) + " -> " + std::get<1>(entry) + "\n";
-    }
-    s += "\tListeners:\n";
-    for (const auto &listeners_for_ip : listeners_) {
-      const auto ip = listeners_for_ip.first.ToString();
-      for (const auto &listener : listeners_for_ip.second) {
-        s += "\t\t" + ip + ":" + std::to_string(listener.first.port.value()) +
-             " <-> [" + listener.second->GetName() + "]" + "\n";
+    auto get_channel_index = [&channel_index](const shm::Channel *channel) {
+      const auto it = channel_index.find(channel);
+      return it == channel_index.end() ? static_cast<uint16_t>(UINT16_MAX)
+                                       : it->second;
+    };
+
+    status_->Update([&](EngineStatus *status) {
+      status->periodic_ticks = periodic_ticks_;
+      status->port_id = pmd_port_->GetPortId();
+      status->rx_queue = rxring_->GetRingId();
+      status->tx_queue = txring_->GetRingId();
+
+      status->tx = txring_->GetStats();
+      status->tx_backlog = txring_->GetBacklogCount();
+      status->tx_congested = txring_->IsCongested();
+      status->pool_free = packet_pool_->AvailPacketsCount();
+      status->pool_capacity = packet_pool_->Capacity();
+      status->alloc_failures = packet_pool_->GetAllocFailures();
+      status->shed_connections = shed_connections_;
+
+      status->channels_nr = channels_.size();
+      for (size_t i = 0;
+           i < std::min(channels_.size(), EngineStatus::kMaxChannels); i++) {
+        const auto &channel = channels_[i];
+        auto *channel_status = &status->channels[i];
+        const auto name = channel->GetName();
+        const auto name_len =
+            std::min(name.size(), EngineStatus::kChannelNameLen - 1);
+        std::memcpy(channel_status->name, name.data(), name_len);
+        channel_status->name[name_len] = '\0';
+        channel_status->total_bufs = channel->GetTotalBufCount();
+        channel_status->free_bufs = channel->GetFreeBufCount();
       }
-    }
-    s += "\tActive flows:\n";
-    for (const auto &[key, flow_it] : active_flows_map_) {
-      s += "\t\t";
-      s += (*flow_it)->ToString();
-      s += "\n";
-    }
-    s += "\n";
-    LOG(INFO) << s;
+
+      size_t nr = 0;
+      for (const auto &[ip, listeners_on_ip] : listeners_) {
+        for (const auto &[port, channel] : listeners_on_ip) {
+          if (nr < EngineStatus::kMaxListeners) {
+            auto *listener_status = &status->listeners[nr];
+            listener_status->ip = ip.address.value();
+            listener_status->port = port.port.value();
+            listener_status->channel = get_channel_index(channel.get());
+          }
+          nr++;
+        }
+      }
+      status->listeners_nr = nr;
+
+      nr = 0;
+      for (const auto &[key, flow_it] : active_flows_map_) {
+        if (nr < EngineStatus::kMaxFlows) {
+          const auto &flow = *flow_it;
+          const auto &pcb = flow->pcb();
+          auto *flow_status = &status->flows[nr];
+          flow_status->local_ip = key.local_addr.address.value();
+          flow_status->remote_ip = key.remote_addr.address.value();
+          flow_status->local_port = key.local_port.port.value();
+          flow_status->remote_port = key.remote_port.port.value();
+          flow_status->channel = get_channel_index(flow->channel());
+          flow_status->state = static_cast<uint8_t>(flow->state());
+          flow_status->snd_nxt = pcb.snd_nxt;
+          flow_status->snd_una = pcb.snd_una;
+          flow_status->rcv_nxt = pcb.rcv_nxt;
+          flow_status->effective_wnd = pcb.effective_wnd();
+          flow_status->cwnd = pcb.cwnd;
+          flow_status->fast_rexmits = pcb.fast_rexmits;
+          flow_status->rto_rexmits = pcb.rto_rexmits;
+          flow_status->deferred_acks = pcb.deferred_acks;
+          flow_status->tx_pauses = pcb.tx_pauses;
+          flow_status->srtt_us = pcb.srtt_us;
+          flow_status->pending_segments = flow->NumPendingSegments();
+        }
+        nr++;
+      }
+      status->flows_nr = nr;
+    });
   }
 
   /**
@@ -695,14 +899,23 @@ class MachnetEngine {
         continue;
       }
 
+      // Do not open new connections while the TX path is congested; the
+      // request times out if the congestion persists.
+      if (txring_->IsCongested()) {
+        it++;
+        continue;
+      }
+
       const Ipv4::Address src_addr(req.flow_info.src_ip);
       const Ipv4::Address dst_addr(req.flow_info.dst_ip);
       const Udp::Port dst_port(req.flow_info.dst_port);
 
-      auto remote_l2_addr =
-          shared_state_->GetL2Addr(txring_, src_addr, dst_addr);
+      // Peers off the local subnet are reached through their gateway.
+      const auto next_hop = routes_->NextHop(dst_addr);
+      auto remote_l2_addr = neighbor_cache_.Lookup(next_hop);
       if (!remote_l2_addr.has_value()) {
-        // L2 address has not been resolved yet.
+        // L2 address has not been resolved yet; ask (again).
+        shared_state_->RequestL2Addr(txring_, src_addr, next_hop);
         it++;
         continue;
       }
@@ -712,6 +925,9 @@ class MachnetEngine {
                          rss_key = pmd_port_->GetRSSKey(), pmd_port = pmd_port_,
                          rx_queue_id =
                              rxring_->GetRingId()](uint16_t port) -> bool {
+        // Without RSS, all the packets land on the first queue.
+        if (!pmd_port->HasRSS()) return rx_queue_id == 0;
+
         rte_thash_tuple ipv4_l3_l4_tuple;
         ipv4_l3_l4_tuple.v4.src_addr = src_addr.address.value();
         ipv4_l3_l4_tuple.v4.dst_addr = dst_addr.address.value();
@@ -772,13 +988,47 @@ class MachnetEngine {
       const auto &flow_it =
           channel->CreateFlow(src_addr, src_port.value(), dst_addr, dst_port,
                               pmd_port_->GetL2Addr(), remote_l2_addr.value(),
-                              txring_, application_callback);
+                              txring_, tracer_.get(), application_callback);
       (*flow_it)->InitiateHandshake();
       active_flows_map_.emplace((*flow_it)->key(), flow_it);
       it = pending_requests_.erase(it);
     }
   }
 
+  /**
+   * @brief Picks up the current snapshot of the routing table, if it changed.
+   *
+   * @return True if it changed.
+   */
+  bool RoutesChanged() {
+    const auto &routing_table = shared_state_->GetRoutingTable();
+    if (routing_table.GetVersion() == routes_->version) [[likely]]
+      return false;
+    routes_ = routing_table.GetSnapshot();
+    return true;
+  }
+
+  /**
+   * @brief Points the active flows at the current MAC addresses of their next
+   * hops, as found in the neighbour table. Next hops not in the table yet are
+   * asked for, and their flows keep the address they had meanwhile.
+   */
+  void UpdateFlowsL2Addr() {
+    std::unordered_set<Ipv4::Address> requested;
+    for (const auto &[key, flow_it] : active_flows_map_) {
+      const auto next_hop = routes_->NextHop(key.remote_addr);
+      const auto l2addr = neighbor_cache_.Lookup(next_hop);
+      if (!l2addr.has_value()) {
+        if (requested.insert(next_hop).second) {
+          shared_state_->RequestL2Addr(txring_, key.local_addr, next_hop);
+        }
+        continue;
+      }
+      if (l2addr == (*flow_it)->remote_l2_addr()) continue;
+      (*flow_it)->SetRemoteL2Addr(l2addr.value());
+    }
+  }
+
   /**
    * @brief Iterate throught the list of flows, check and handle RTOs.
    */
@@ -896,12 +1146,19 @@ class MachnetEngine {
             break;
           }
 
+          // Shed new connections while the TX path is congested, to protect
+          // the established ones; the peer retransmits its SYN.
+          if (txring_->IsCongested()) {
+            shed_connections_++;
+            break;
+          }
+
           auto empty_callback = [](shm::Channel *, bool,
                                    const net::flow::Key &) {};
           const auto &flow_it = channel->CreateFlow(
               local_ipv4_addr, local_udp_port, remote_ipv4_addr,
               remote_udp_port, pmd_port_->GetL2Addr(), eh->src_addr, txring_,
-              empty_callback);
+              tracer_.get(), empty_callback);
           active_flows_map_.insert({pkt_key, flow_it});
 
           // Handle the incoming packet.
@@ -921,11 +1178,15 @@ class MachnetEngine {
         // Only process ICMP echo requests.
         if (icmph->type != Icmp::kEchoRequest) [[unlikely]] return;
 
+        // Echo replies are the first thing to go under TX congestion.
+        if (txring_->IsCongested()) [[unlikely]] return;
+
         // Allocate and construct a new packet for the response, instead of
         // in-place modification.
         // If `FAST_FREE' is enabled it's unsafe to use packets from different
         // pools (the driver may put them in the wrong pool on reclaim).
-        auto *response = CHECK_NOTNULL(packet_pool_->PacketAlloc());
+        auto *response = packet_pool_->PacketAlloc();
+        if (response == nullptr) [[unlikely]] return;
         auto *response_eh = response->append<Ethernet *>(pkt->length());
         response_eh->dst_addr = eh->src_addr;
         response_eh->src_addr = pmd_port_->GetL2Addr();
@@ -961,8 +1222,7 @@ class MachnetEngine {
             reinterpret_cast<const uint8_t *>(response_icmph),
             pkt->length() - sizeof(Ethernet) - sizeof(Ipv4));
 
-        auto nsent = txring_->TrySendPackets(&response, 1);
-        LOG_IF(WARNING, nsent != 1) << "Failed to send ICMP echo reply";
+        txring_->StagePackets(&response, 1);
       }
       // clang-format on
 
@@ -991,6 +1251,7 @@ class MachnetEngine {
                                   channel->GetName().c_str(),
                                   std::hash<net::flow::Key>{}(msg_key),
                                   msg_key.ToString().c_str());
+      shm::StatsAdd(&channel->stats()->tx_drops_noflow, 1);
       return;
     }
     const auto &flow_it = active_flows_map_[msg_key];
@@ -1024,6 +1285,9 @@ class MachnetEngine {
   dpdk::PacketPool *packet_pool_;
   // Shared State instance for this engine.
   std::shared_ptr<MachnetEngineSharedState> shared_state_;
+  // This engine's view of the neighbour and routing tables.
+  NeighborCache neighbor_cache_;
+  std::shared_ptr<const RoutingTable::Snapshot> routes_;
   // Local IPv4 addresses bound to this engine/interface.
   std::unordered_set<Ipv4::Address> local_ipv4_addrs_;
   // Vector of active channels this engine is serving.
@@ -1032,6 +1296,20 @@ class MachnetEngine {
   uint64_t last_periodic_timestamp_{0};
   // Clock ticks for the slow timer.
   uint64_t periodic_ticks_{0};
+  // Whether the TX ring was congested at the end of the last iteration.
+  bool tx_congested_{false};
+  // Number of incoming connections refused because the TX path was congested.
+  uint64_t shed_connections_{0};
+  // Profiler of the engine loop; empty unless profiling is enabled.
+  [[no_unique_address]] EngineProfiler<> profiler_{};
+  // Status snapshot, published on every slow tick; it is large, so it lives on
+  // the heap.
+  std::unique_ptr<SeqLock<EngineStatus>> status_{
+      std::make_unique<SeqLock<EngineStatus>>()};
+  // Trace ring of transport events of the engine's flows; off by default.
+  std::unique_ptr<Tracer> tracer_{std::make_unique<Tracer>()};
+  // Packet capture tap; off by default.
+  std::unique_ptr<CaptureTap> capture_tap_{std::make_unique<CaptureTap>()};
   // Listeners for incoming packets.
   std::unordered_map<
       Ipv4::Address,
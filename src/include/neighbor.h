@@ -0,0 +1,271 @@
+/**
+ * @file neighbor.h
+ * @brief Neighbour table (IPv4 to MAC addresses) shared by the engines of an
+ * interface, and the per-engine caches that read it.
+ */
+#ifndef SRC_INCLUDE_NEIGHBOR_H_
+#define SRC_INCLUDE_NEIGHBOR_H_
+
+#include <ether.h>
+#include <glog/logging.h>
+#include <ipv4.h>
+#include <ttime.h>
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <tuple>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace juggler {
+
+/**
+ * @brief Read-mostly neighbour table, updated RCU-style: writers copy the
+ * current snapshot, modify the copy and publish it, while readers keep using
+ * the snapshot they hold until they pick up the new one. Lookups thus never
+ * wait for ARP processing, and ARP packets that do not change anything (e.g.,
+ * a storm of requests from known hosts) do not take the writer lock at all.
+ * Snapshots are reclaimed once their last reader drops them.
+ *
+ * Entries age: an entry not confirmed for `reachable' cycles is stale, and
+ * should be refreshed (see `Age()'); one not confirmed for `max_age' cycles
+ * is evicted. Stale entries are still used meanwhile. Pinned (static)
+ * entries never age, and ARP does not change them.
+ */
+class NeighborTable {
+ public:
+  using Ethernet = net::Ethernet;
+  using Ipv4 = net::Ipv4;
+  static constexpr uint64_t kReachableTimeS = 30;
+  static constexpr uint64_t kMaxAgeS = 60;
+
+  struct Entry {
+    Ethernet::Address l2addr;
+    uint64_t updated_tsc;  // Last time the entry was confirmed.
+    bool pinned;
+  };
+
+  struct Snapshot {
+    uint64_t version;
+    std::unordered_map<Ipv4::Address, Entry> entries;
+  };
+
+  NeighborTable()
+      : NeighborTable(kReachableTimeS * time::estimate_tsc_hz(),
+                      kMaxAgeS * time::estimate_tsc_hz()) {}
+  NeighborTable(uint64_t reachable_cycles, uint64_t max_age_cycles)
+      : reachable_cycles_(reachable_cycles),
+        max_age_cycles_(max_age_cycles),
+        snapshot_(std::make_shared<const Snapshot>()),
+        version_(0) {
+    CHECK_LE(reachable_cycles_, max_age_cycles_);
+  }
+  NeighborTable(const NeighborTable &) = delete;
+  NeighborTable &operator=(const NeighborTable &) = delete;
+
+  /**
+   * @return The version of the current snapshot; it changes with every
+   * update.
+   */
+  uint64_t GetVersion() const {
+    return version_.load(std::memory_order_acquire);
+  }
+
+  /**
+   * @return The current snapshot.
+   */
+  std::shared_ptr<const Snapshot> GetSnapshot() const {
+    return snapshot_.load(std::memory_order_acquire);
+  }
+
+  /**
+   * @brief Looks an address up in the current snapshot. Engines should use a
+   * `NeighborCache' instead.
+   */
+  std::optional<Ethernet::Address> Lookup(const Ipv4::Address &addr) const {
+    const auto snapshot = GetSnapshot();
+    const auto it = snapshot->entries.find(addr);
+    if (it == snapshot->entries.end()) return std::nullopt;
+    return it->second.l2addr;
+  }
+
+  /**
+   * @brief Records the MAC address of a neighbour.
+   *
+   * @param addr The IP address of the neighbour.
+   * @param l2addr Its MAC address.
+   * @param now The current TSC.
+   * @param create Whether to add the neighbour if it is not in the table;
+   * otherwise only known neighbours are updated.
+   * @return True if the table changed.
+   */
+  bool Update(const Ipv4::Address &addr, const Ethernet::Address &l2addr,
+              uint64_t now, bool create) {
+    // Most updates confirm what the table already says.
+    if (!NeedsUpdate(*GetSnapshot(), addr, l2addr, now, create)) return false;
+
+    const std::lock_guard<std::mutex> lock(mtx_);
+    const auto snapshot = GetSnapshot();
+    if (!NeedsUpdate(*snapshot, addr, l2addr, now, create)) return false;
+
+    auto entries = snapshot->entries;
+    const auto it = entries.find(addr);
+    if (it != entries.end() && it->second.l2addr != l2addr) {
+      LOG(INFO) << "Neighbour " << addr.ToString() << " moved from "
+                << it->second.l2addr.ToString() << " to "
+                << l2addr.ToString();
+    }
+    entries[addr] = {l2addr, now, false};
+    PublishLocked(std::move(entries));
+    return true;
+  }
+
+  /**
+   * @brief Pins the MAC address of a neighbour, replacing any entry learned.
+   */
+  void Pin(const Ipv4::Address &addr, const Ethernet::Address &l2addr) {
+    const std::lock_guard<std::mutex> lock(mtx_);
+    auto entries = GetSnapshot()->entries;
+    entries[addr] = {l2addr, 0, true};
+    PublishLocked(std::move(entries));
+  }
+
+  /**
+   * @brief Removes a pinned entry; the neighbour is resolved with ARP again.
+   *
+   * @return False if there was no pinned entry for the address.
+   */
+  bool Unpin(const Ipv4::Address &addr) {
+    const std::lock_guard<std::mutex> lock(mtx_);
+    auto entries = GetSnapshot()->entries;
+    const auto it = entries.find(addr);
+    if (it == entries.end() || !it->second.pinned) return false;
+    entries.erase(it);
+    PublishLocked(std::move(entries));
+    return true;
+  }
+
+  /**
+   * @brief Evicts the entries that expired, and lists the stale ones.
+   *
+   * @param now The current TSC.
+   * @param stale Vector to append the addresses of the stale entries to.
+   * @return The number of entries evicted.
+   */
+  size_t Age(uint64_t now, std::vector<Ipv4::Address> *stale) {
+    const std::lock_guard<std::mutex> lock(mtx_);
+    const auto snapshot = GetSnapshot();
+    size_t nb_expired = 0;
+    for (const auto &[addr, entry] : snapshot->entries) {
+      if (entry.pinned) continue;
+      const auto age = AgeOf(entry, now);
+      if (age >= max_age_cycles_) {
+        nb_expired++;
+      } else if (age >= reachable_cycles_) {
+        stale->push_back(addr);
+      }
+    }
+    if (nb_expired == 0) return 0;
+
+    auto entries = snapshot->entries;
+    std::erase_if(entries, [this, now](const auto &kv) {
+      return !kv.second.pinned && AgeOf(kv.second, now) >= max_age_cycles_;
+    });
+    PublishLocked(std::move(entries));
+    return nb_expired;
+  }
+
+  std::vector<std::tuple<std::string, std::string>> GetEntries() const {
+    std::vector<std::tuple<std::string, std::string>> entries;
+    for (const auto &[addr, entry] : GetSnapshot()->entries) {
+      auto l2addr = entry.l2addr.ToString();
+      if (entry.pinned) l2addr += " (static)";
+      entries.emplace_back(addr.ToString(), l2addr);
+    }
+    return entries;
+  }
+
+  size_t GetSize() const { return GetSnapshot()->entries.size(); }
+
+ private:
+  bool NeedsUpdate(const Snapshot &snapshot, const Ipv4::Address &addr,
+                   const Ethernet::Address &l2addr, uint64_t now,
+                   bool create) const {
+    const auto it = snapshot.entries.find(addr);
+    if (it == snapshot.entries.end()) return create;
+    if (it->second.pinned) return false;
+    // Confirmations of reachable entries are not worth a new snapshot.
+    return it->second.l2addr != l2addr ||
+           AgeOf(it->second, now) >= reachable_cycles_;
+  }
+
+  // Another engine may have updated the entry with a slightly later TSC.
+  static uint64_t AgeOf(const Entry &entry, uint64_t now) {
+    return now > entry.updated_tsc ? now - entry.updated_tsc : 0;
+  }
+
+  void PublishLocked(std::unordered_map<Ipv4::Address, Entry> entries) {
+    const auto version = version_.load(std::memory_order_relaxed) + 1;
+    snapshot_.store(std::make_shared<const Snapshot>(
+                        Snapshot{version, std::move(entries)}),
+                    std::memory_order_release);
+    version_.store(version, std::memory_order_release);
+  }
+
+  const uint64_t reachable_cycles_;
+  const uint64_t max_age_cycles_;
+  // Serializes writers.
+  std::mutex mtx_;
+  std::atomic<std::shared_ptr<const Snapshot>> snapshot_;
+  std::atomic<uint64_t> version_;
+};
+
+/**
+ * @brief An engine's view of a `NeighborTable': it holds on to a snapshot of
+ * the table, and only picks up a new one when the table changed, so lookups
+ * touch nothing that other threads write to.
+ *
+ * This class is not thread-safe.
+ */
+class NeighborCache {
+ public:
+  using Ethernet = net::Ethernet;
+  using Ipv4 = net::Ipv4;
+
+  explicit NeighborCache(const NeighborTable *table)
+      : table_(CHECK_NOTNULL(table)), snapshot_(table_->GetSnapshot()) {}
+
+  /**
+   * @brief Picks up the current snapshot of the table, if it changed.
+   *
+   * @return True if it changed since the last call.
+   */
+  bool Sync() {
+    if (table_->GetVersion() == snapshot_->version) [[likely]]
+      return false;
+    snapshot_ = table_->GetSnapshot();
+    return true;
+  }
+
+  /**
+   * @brief Looks an address up in the snapshot held; see `Sync()'.
+   */
+  std::optional<Ethernet::Address> Lookup(const Ipv4::Address &addr) const {
+    const auto it = snapshot_->entries.find(addr);
+    if (it == snapshot_->entries.end()) return std::nullopt;
+    return it->second.l2addr;
+  }
+
+ private:
+  const NeighborTable *table_;
+  std::shared_ptr<const NeighborTable::Snapshot> snapshot_;
+};
+
+}  // namespace juggler
+
+#endif  // SRC_INCLUDE_NEIGHBOR_H_
@@ -0,0 +1,312 @@
+/**
+ * @file net_emulator.h
+ * @brief Deterministic network emulator: a pair of `net_ring' ports wired back
+ * to back through links that drop, duplicate, reorder, delay and rate-limit
+ * packets, driven by a caller-provided clock and a seeded RNG.
+ */
+#ifndef SRC_INCLUDE_NET_EMULATOR_H_
+#define SRC_INCLUDE_NET_EMULATOR_H_
+
+#include <glog/logging.h>
+#include <packet_pool.h>
+#include <rte_mbuf.h>
+#include <rte_ring.h>
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <queue>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace juggler {
+namespace dpdk {
+
+/**
+ * @brief The impairments of one direction of an emulated link. Packets are
+ * first queued at the bottleneck (tail drop), then lost, duplicated or held
+ * back (reordered) at random, and delivered after the propagation delay.
+ */
+struct LinkConf {
+  double loss_rate{0};       // Probability that a packet is lost.
+  double duplicate_rate{0};  // Probability that a packet is delivered twice.
+  double reorder_rate{0};    // Probability that a packet is held back.
+  uint64_t reorder_delay_us{100};  // How long packets are held back.
+  uint64_t delay_us{0};            // One-way propagation delay.
+  uint64_t rate_bps{0};            // Bottleneck bandwidth; 0 is unlimited.
+  uint64_t queue_bytes{0};  // Bottleneck queue size; 0 is unlimited.
+
+  std::string ToString() const;
+};
+
+struct LinkStats {
+  uint64_t packets{0};  // Packets delivered (duplicates included).
+  uint64_t bytes{0};    // Bytes delivered.
+  uint64_t lost{0};
+  uint64_t queue_drops{0};  // Dropped at the bottleneck queue.
+  uint64_t duplicated{0};
+  uint64_t reordered{0};
+  uint64_t overflows{0};  // Dropped because the receiver's ring was full.
+};
+
+/**
+ * @brief One direction of an emulated link: moves packets from the ring the
+ * sender transmits to, to the ring the receiver polls, applying `LinkConf'.
+ *
+ * Every decision comes from the RNG seeded at construction, and time only
+ * advances with `Step()', so the same seed, configuration and sequence of
+ * packets and steps always yield the same deliveries. Each packet takes the
+ * same number of RNG draws whatever the configuration, so that, e.g., raising
+ * the loss rate does not change which packets get reordered.
+ *
+ * This class is not thread-safe.
+ */
+class EmulatedLink {
+ public:
+  static constexpr uint16_t kBurstSize = 64;
+
+  /**
+   * @param conf The impairments of the link.
+   * @param seed Seed of the RNG.
+   * @param tsc_hz Frequency of the clock passed to `Step()'.
+   * @param in Ring the sender transmits to.
+   * @param out Ring the receiver polls.
+   * @param dup_pool Pool to allocate the duplicated packets from.
+   */
+  EmulatedLink(const LinkConf &conf, uint64_t seed, uint64_t tsc_hz,
+               rte_ring *in, rte_ring *out, PacketPool *dup_pool)
+      : conf_(conf),
+        tsc_hz_(tsc_hz),
+        rng_(seed),
+        in_(CHECK_NOTNULL(in)),
+        out_(CHECK_NOTNULL(out)),
+        dup_pool_(CHECK_NOTNULL(dup_pool)) {
+    CHECK_GT(tsc_hz_, 0);
+  }
+  EmulatedLink(const EmulatedLink &) = delete;
+  EmulatedLink &operator=(const EmulatedLink &) = delete;
+  ~EmulatedLink() { Drain(); }
+
+  const LinkConf &GetConf() const { return conf_; }
+  const LinkStats &GetStats() const { return stats_; }
+
+  /**
+   * @brief Takes the packets sent since the last step, and delivers the ones
+   * due by `now'.
+   *
+   * @param now The current time, in cycles of the clock given at
+   * construction; it must not go backwards.
+   */
+  void Step(uint64_t now) {
+    rte_mbuf *mbufs[kBurstSize];
+    unsigned int nb_rx;
+    do {
+      nb_rx = rte_ring_sc_dequeue_burst(in_, reinterpret_cast<void **>(mbufs),
+                                        kBurstSize, nullptr);
+      for (unsigned int i = 0; i < nb_rx; i++) Admit(mbufs[i], now);
+    } while (nb_rx == kBurstSize);
+
+    while (!in_flight_.empty() && in_flight_.top().deliver_at <= now) {
+      auto *mbuf = in_flight_.top().mbuf;
+      in_flight_.pop();
+      const auto len = rte_pktmbuf_pkt_len(mbuf);
+      if (rte_ring_sp_enqueue(out_, mbuf) != 0) {
+        rte_pktmbuf_free(mbuf);
+        stats_.overflows++;
+        continue;
+      }
+      stats_.packets++;
+      stats_.bytes += len;
+    }
+  }
+
+  /**
+   * @return The time the next packet in flight is due, if any.
+   */
+  std::optional<uint64_t> NextDelivery() const {
+    if (in_flight_.empty()) return std::nullopt;
+    return in_flight_.top().deliver_at;
+  }
+
+  /**
+   * @return True if packets wait in either ring, to be stepped or received;
+   * packets in flight are not counted (see `NextDelivery()').
+   */
+  bool HasQueued() const {
+    return !rte_ring_empty(in_) || !rte_ring_empty(out_);
+  }
+
+  /**
+   * @brief Frees all the packets in the rings and in flight.
+   */
+  void Drain() {
+    void *obj;
+    while (rte_ring_sc_dequeue(in_, &obj) == 0) {
+      rte_pktmbuf_free(static_cast<rte_mbuf *>(obj));
+    }
+    while (rte_ring_sc_dequeue(out_, &obj) == 0) {
+      rte_pktmbuf_free(static_cast<rte_mbuf *>(obj));
+    }
+    while (!in_flight_.empty()) {
+      rte_pktmbuf_free(in_flight_.top().mbuf);
+      in_flight_.pop();
+    }
+  }
+
+ private:
+  struct InFlight {
+    uint64_t deliver_at;
+    uint64_t seqno;  // Packets due at the same time keep their order.
+    rte_mbuf *mbuf;
+    bool operator>(const InFlight &other) const {
+      return deliver_at != other.deliver_at ? deliver_at > other.deliver_at
+                                            : seqno > other.seqno;
+    }
+  };
+
+  // A uniform draw in [0, 1).
+  double Draw() { return static_cast<double>(rng_() >> 11) * 0x1.0p-53; }
+
+  uint64_t UsToCycles(uint64_t us) const { return us * tsc_hz_ / 1000000; }
+
+  void Admit(rte_mbuf *mbuf, uint64_t now) {
+    const bool lose = Draw() < conf_.loss_rate;
+    const bool duplicate = Draw() < conf_.duplicate_rate;
+    const bool reorder = Draw() < conf_.reorder_rate;
+    const auto len = rte_pktmbuf_pkt_len(mbuf);
+
+    // Serialize at the bottleneck, behind the packets queued there.
+    uint64_t departure = now;
+    if (conf_.rate_bps != 0) {
+      const uint64_t start = std::max(now, busy_until_);
+      if (conf_.queue_bytes != 0) {
+        const auto backlog_bytes =
+            static_cast<double>(start - now) * conf_.rate_bps / 8 / tsc_hz_;
+        if (backlog_bytes + len > conf_.queue_bytes) {
+          rte_pktmbuf_free(mbuf);
+          stats_.queue_drops++;
+          return;
+        }
+      }
+      busy_until_ = start + static_cast<uint64_t>(len) * 8 * tsc_hz_ /
+                                conf_.rate_bps;
+      departure = busy_until_;
+    }
+
+    if (lose) {
+      rte_pktmbuf_free(mbuf);
+      stats_.lost++;
+      return;
+    }
+
+    auto deliver_at = departure + UsToCycles(conf_.delay_us);
+    if (reorder) {
+      deliver_at += UsToCycles(conf_.reorder_delay_us);
+      stats_.reordered++;
+    }
+    in_flight_.push({deliver_at, next_seqno_++, mbuf});
+
+    if (duplicate) {
+      auto *copy = rte_pktmbuf_copy(mbuf, dup_pool_->GetMemPool(), 0,
+                                    UINT32_MAX);
+      if (copy == nullptr) [[unlikely]]
+        return;
+      in_flight_.push({deliver_at, next_seqno_++, copy});
+      stats_.duplicated++;
+    }
+  }
+
+  const LinkConf conf_;
+  const uint64_t tsc_hz_;
+  std::mt19937_64 rng_;
+  rte_ring *const in_;
+  rte_ring *const out_;
+  PacketPool *const dup_pool_;
+  // Time the bottleneck finishes sending the packets queued.
+  uint64_t busy_until_{0};
+  uint64_t next_seqno_{0};
+  std::priority_queue<InFlight, std::vector<InFlight>, std::greater<InFlight>>
+      in_flight_;
+  LinkStats stats_{};
+};
+
+/**
+ * @brief Two `net_ring' ports (sides A and B) connected by an `EmulatedLink'
+ * in each direction. The ports are used like any other, e.g., by a `PmdPort'
+ * each; packets only move between them when the emulator is stepped.
+ *
+ * The ports must be closed (e.g., their `PmdPort's destroyed) before the
+ * emulator is, and `Drain()' must be called before the pools of the packets
+ * sent go away.
+ */
+class NetworkEmulator {
+ public:
+  enum Side : uint8_t { kA = 0, kB = 1 };
+  static constexpr uint32_t kRingSize = 4096;
+  static constexpr uint32_t kDupPoolSize = 4096 - 1;
+
+  /**
+   * @param a_to_b The impairments of packets sent by side A.
+   * @param b_to_a The impairments of packets sent by side B.
+   * @param seed Seed of the links' RNGs.
+   * @param tsc_hz Frequency of the clock passed to `Step()'.
+   */
+  NetworkEmulator(const LinkConf &a_to_b, const LinkConf &b_to_a,
+                  uint64_t seed, uint64_t tsc_hz);
+  NetworkEmulator(const NetworkEmulator &) = delete;
+  NetworkEmulator &operator=(const NetworkEmulator &) = delete;
+  ~NetworkEmulator();
+
+  /**
+   * @return The DPDK port ID of a side.
+   */
+  uint16_t GetPortId(Side side) const { return port_ids_[side]; }
+
+  /**
+   * @return The link of the packets sent by a side.
+   */
+  const EmulatedLink &GetLink(Side side) const { return *links_[side]; }
+
+  /**
+   * @brief Moves the packets of both links; see `EmulatedLink::Step()'.
+   */
+  void Step(uint64_t now) {
+    for (auto &link : links_) link->Step(now);
+  }
+
+  std::optional<uint64_t> NextDelivery() const {
+    std::optional<uint64_t> next;
+    for (const auto &link : links_) {
+      const auto deliver_at = link->NextDelivery();
+      if (deliver_at.has_value() && (!next.has_value() || deliver_at < next)) {
+        next = deliver_at;
+      }
+    }
+    return next;
+  }
+
+  bool HasQueued() const {
+    return links_[kA]->HasQueued() || links_[kB]->HasQueued();
+  }
+
+  void Drain() {
+    for (auto &link : links_) link->Drain();
+  }
+
+ private:
+  // Rings that side A and B transmit to, and receive from, respectively.
+  std::array<rte_ring *, 2> tx_rings_{};
+  std::array<rte_ring *, 2> rx_rings_{};
+  std::array<uint16_t, 2> port_ids_{};
+  std::unique_ptr<PacketPool> dup_pool_;
+  std::array<std::unique_ptr<EmulatedLink>, 2> links_;
+};
+
+}  // namespace dpdk
+}  // namespace juggler
+
+#endif  // SRC_INCLUDE_NET_EMULATOR_H_
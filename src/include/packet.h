@@ -85,6 +85,11 @@ class alignas(juggler::hardware_constructive_interference_size) Packet {
    */
   uint16_t length() const { return rte_pktmbuf_pkt_len(&mbuf_); }
 
+  /**
+   * @return Length of the data in the first segment of the packet.
+   */
+  uint16_t seg_length() const { return rte_pktmbuf_data_len(&mbuf_); }
+
   /**
    * @return RSS hash value associated with the packet.
    * @note This is valid only if the DPDK PMD was initialized with RSS enabled.
@@ -39,10 +39,13 @@ class PacketPool {
    * @param nmbufs Number of mbufs.
    * @param mbuf_size Size of each mbuf.
    * @param mempool_name Name of the mempool.
+   * @param socket_id NUMA node to allocate the mbufs on (`SOCKET_ID_ANY' for
+   * the node of the calling lcore).
    */
   PacketPool(uint32_t nmbufs = kRteDefaultMbufsNum_,
              uint16_t mbuf_size = kRteDefaultMbufDataSz_,
-             const char *mempool_name = kRteDefaultMempoolName);
+             const char *mempool_name = kRteDefaultMempoolName,
+             int socket_id = SOCKET_ID_ANY);
   ~PacketPool();
 
   /**
@@ -64,10 +67,14 @@ class PacketPool {
 
   /**
    * @brief Allocates a packet from the pool.
-   * @return Pointer to the allocated packet.
+   * @return Pointer to the allocated packet, or nullptr if the pool is
+   * exhausted.
    */
   Packet *PacketAlloc() {
-    return reinterpret_cast<Packet *>(rte_pktmbuf_alloc(mpool_));
+    auto *packet = reinterpret_cast<Packet *>(rte_pktmbuf_alloc(mpool_));
+    if (packet == nullptr) [[unlikely]]
+      alloc_failures_++;
+    return packet;
   }
 
   /**
@@ -81,6 +88,7 @@ class PacketPool {
         mpool_, reinterpret_cast<struct rte_mbuf **>(pkts), cnt);
     if (ret == 0) [[likely]]
       return true;
+    alloc_failures_++;
     return false;
   }
 
@@ -94,8 +102,10 @@ class PacketPool {
     (void)DCHECK_NOTNULL(batch);
     int ret = rte_pktmbuf_alloc_bulk(
         mpool_, reinterpret_cast<struct rte_mbuf **>(batch->pkts()), cnt);
-    if (ret != 0) [[unlikely]]
+    if (ret != 0) [[unlikely]] {
+      alloc_failures_++;
       return false;
+    }
 
     batch->IncrCount(cnt);
     return true;
@@ -111,12 +121,19 @@ class PacketPool {
    */
   uint32_t AvailPacketsCount() { return rte_mempool_avail_count(mpool_); }
 
+  /**
+   * @return The number of (single or bulk) allocations that failed because the
+   * pool was exhausted.
+   */
+  uint64_t GetAllocFailures() const { return alloc_failures_; }
+
  private:
   const bool
       is_dpdk_primary_process_;  //!< Indicates if it's a DPDK primary process.
   static uint16_t next_id_;  //!< Static ID for the next packet pool instance.
   rte_mempool *mpool_;       //!< Underlying rte mbuf pool.
   uint16_t id_;              //!< Unique ID for this packet pool instance.
+  uint64_t alloc_failures_{0};  //!< Number of failed allocations.
 };
 
 }  // namespace dpdk
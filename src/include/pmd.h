@@ -5,16 +5,20 @@
 #include <rte_bus_pci.h>
 #include <rte_ethdev.h>
 
+#include <algorithm>
+#include <array>
 #include <memory>
 #include <optional>
 #include <string>
 #include <utility>
 #include <vector>
 
+#include "capture_tap.h"
 #include "dpdk.h"
 #include "ether.h"
 #include "packet.h"
 #include "packet_pool.h"
+#include "ttime.h"
 
 namespace juggler {
 namespace dpdk {
@@ -60,12 +64,14 @@ class PmdRing {
         ndesc_(ndesc),
         ppool_(nullptr) {}
   PmdRing(const PmdPort *port, uint8_t port_id, uint16_t ring_id,
-          uint16_t ndesc, uint32_t nmbufs, uint32_t mbuf_sz)
+          uint16_t ndesc, uint32_t nmbufs, uint32_t mbuf_sz, int socket_id)
       : pmd_port_(port),
         port_id_(port_id),
         ring_id_(ring_id),
         ndesc_(ndesc),
-        ppool_(std::unique_ptr<PacketPool>(new PacketPool(nmbufs, mbuf_sz))) {}
+        ppool_(std::unique_ptr<PacketPool>(new PacketPool(
+            nmbufs, mbuf_sz, PacketPool::kRteDefaultMempoolName,
+            socket_id))) {}
 
   rte_mempool *GetPacketMemPool() const { return ppool_.get()->GetMemPool(); }
 
@@ -84,6 +90,34 @@ class PmdRing {
  */
 class TxRing : public PmdRing {
  public:
+  // Capacity of the software backlog that holds packets the NIC could not
+  // take; it must be a power of two.
+  static constexpr uint32_t kTxBacklogSize = 1024;
+  static_assert((kTxBacklogSize & (kTxBacklogSize - 1)) == 0,
+                "kTxBacklogSize must be a power of two");
+  // The ring is congested once the backlog grows above the high watermark,
+  // and stays congested until it drains below the low one.
+  static constexpr uint32_t kTxBacklogHighWatermark = kTxBacklogSize / 2;
+  static constexpr uint32_t kTxBacklogLowWatermark = kTxBacklogSize / 8;
+  // The ring is congested once less than 1/8 of the packet pool is free, and
+  // stays congested until 1/4 is free again.
+  static constexpr uint32_t kPoolLowWatermarkDiv = 8;
+  static constexpr uint32_t kPoolHighWatermarkDiv = 4;
+  // Counting the free packets of the pool is not free; while not congested it
+  // is only sampled every that many flushes.
+  static constexpr uint32_t kPoolSampleInterval = 64;
+
+  /**
+   * @brief Counters of the TX path of the ring.
+   */
+  struct Stats {
+    uint64_t tx_pkts{0};      // Packets handed to the NIC.
+    uint64_t tx_bursts{0};    // Calls to `rte_eth_tx_burst()'.
+    uint64_t backlogged{0};   // Packets the NIC did not take at first.
+    uint64_t dropped{0};      // Packets dropped with the backlog full.
+    uint64_t congestions{0};  // Times the ring became congested.
+  };
+
   TxRing(const PmdPort *pmd_port, uint8_t port_id, uint16_t ring_id,
          uint16_t ndesc)
       : PmdRing(pmd_port, port_id, ring_id, ndesc) {}
@@ -94,13 +128,21 @@ class TxRing : public PmdRing {
 
   TxRing(const PmdPort *pmd_port, uint8_t port_id, uint16_t ring_id,
          uint16_t ndesc, struct rte_eth_txconf txconf, uint32_t nmbufs,
-         uint32_t mbuf_sz)
-      : PmdRing(pmd_port, port_id, ring_id, ndesc, nmbufs, mbuf_sz),
+         uint32_t mbuf_sz, int socket_id = SOCKET_ID_ANY)
+      : PmdRing(pmd_port, port_id, ring_id, ndesc, nmbufs, mbuf_sz,
+                socket_id),
         conf_(txconf) {}
 
   TxRing(TxRing const &) = delete;
   TxRing &operator=(TxRing const &) = delete;
 
+  ~TxRing() {
+    // Release the packets that never made it to the NIC.
+    staged_.Release();
+    while (backlog_head_ != backlog_tail_)
+      Packet::Free(backlog_[backlog_head_++ & (kTxBacklogSize - 1)]);
+  }
+
   void Init();
 
   /**
@@ -161,6 +203,88 @@ class TxRing : public PmdRing {
     batch->Clear();
   }
 
+  /**
+   * @brief Stages packets for transmission. Staged packets are sent as one
+   * burst on `FlushStaged()', or as soon as a full burst is staged. This lets
+   * the many TX paths of an engine share doorbells instead of sending small
+   * bursts each.
+   *
+   * @param pkts Array of packet pointers to stage.
+   * @param nb_pkts Number of packets to stage.
+   */
+  void StagePackets(Packet **pkts, uint16_t nb_pkts) {
+    if (capture_tap_ != nullptr) [[unlikely]]
+      capture_tap_->Tap(pkts, nb_pkts, CaptureDirection::kTx, time::rdtsc());
+    while (nb_pkts > 0) {
+      const auto n = std::min(nb_pkts, staged_.GetRoom());
+      staged_.Append(pkts, n);
+      pkts += n;
+      nb_pkts -= n;
+      if (staged_.IsFull()) FlushStaged();
+    }
+  }
+
+  /**
+   * @brief Stages a batch of packets for transmission (see `StagePackets()').
+   *
+   * @param batch Batch of packets to stage; it is cleared.
+   */
+  void StagePackets(PacketBatch *batch) {
+    StagePackets(batch->pkts(), batch->GetSize());
+    batch->Clear();
+  }
+
+  /**
+   * @brief Sends the staged packets without blocking. Packets the NIC does not
+   * take are kept, in order, in a bounded software backlog and retried on the
+   * next flush; once the backlog is full, further packets are dropped and left
+   * to the transport to recover. Also updates the congestion state of the
+   * ring (see `IsCongested()').
+   */
+  void FlushStaged() {
+    if (backlog_head_ == backlog_tail_) {
+      if (!staged_.IsEmpty()) {
+        const auto nb_sent = Burst(staged_.pkts(), staged_.GetSize());
+        BacklogAppend(staged_.pkts() + nb_sent, staged_.GetSize() - nb_sent);
+        staged_.Clear();
+      }
+    } else {
+      // Staged packets go behind the older, backlogged ones.
+      BacklogAppend(staged_.pkts(), staged_.GetSize());
+      staged_.Clear();
+      BacklogDrain();
+    }
+    UpdateCongestion();
+  }
+
+  /**
+   * @brief Sets the capture tap that the staged packets are passed to, or
+   * nullptr to stop passing them.
+   */
+  void SetCaptureTap(CaptureTap *capture_tap) { capture_tap_ = capture_tap; }
+
+  /**
+   * @return Number of packets staged for transmission.
+   */
+  uint16_t GetStagedCount() const { return staged_.GetSize(); }
+
+  /**
+   * @return Number of packets waiting in the backlog for room on the NIC.
+   */
+  uint32_t GetBacklogCount() const { return backlog_tail_ - backlog_head_; }
+
+  /**
+   * @return True if the TX path is overloaded, i.e., the backlog is filling up
+   * or the packet pool is running low. Callers should hold back traffic that
+   * can wait (ACKs, new data, new connections) until it clears.
+   */
+  bool IsCongested() const { return congested_; }
+
+  /**
+   * @return The TX counters of the ring.
+   */
+  const Stats &GetStats() const { return stats_; }
+
   /**
    * @brief Explicitly reclaims the memory buffers (mbufs) used by sent packets
    * in the TX ring.
@@ -170,7 +294,77 @@ class TxRing : public PmdRing {
   }
 
  private:
+  uint16_t Burst(Packet **pkts, uint16_t nb_pkts) {
+    const uint16_t nb_sent =
+        rte_eth_tx_burst(this->GetPortId(), this->GetRingId(),
+                         reinterpret_cast<struct rte_mbuf **>(pkts), nb_pkts);
+    stats_.tx_bursts++;
+    stats_.tx_pkts += nb_sent;
+    return nb_sent;
+  }
+
+  void BacklogAppend(Packet **pkts, uint16_t nb_pkts) {
+    const uint32_t nb_room = kTxBacklogSize - GetBacklogCount();
+    const uint16_t nb_backlog = std::min<uint32_t>(nb_pkts, nb_room);
+    for (uint16_t i = 0; i < nb_backlog; i++)
+      backlog_[backlog_tail_++ & (kTxBacklogSize - 1)] = pkts[i];
+    for (uint16_t i = nb_backlog; i < nb_pkts; i++) Packet::Free(pkts[i]);
+    stats_.backlogged += nb_backlog;
+    stats_.dropped += nb_pkts - nb_backlog;
+  }
+
+  void BacklogDrain() {
+    while (backlog_head_ != backlog_tail_) {
+      // Send the contiguous run of packets up to the end of the array.
+      const uint32_t idx = backlog_head_ & (kTxBacklogSize - 1);
+      const uint16_t nb_pkts = std::min(
+          {GetBacklogCount(), kTxBacklogSize - idx,
+           static_cast<uint32_t>(PacketBatch::kMaxBurst)});
+      const auto nb_sent = Burst(&backlog_[idx], nb_pkts);
+      backlog_head_ += nb_sent;
+      if (nb_sent < nb_pkts) break;
+    }
+  }
+
+  void UpdateCongestion() {
+    const bool was_congested = congested_;
+    const uint32_t backlog_threshold =
+        was_congested ? kTxBacklogLowWatermark : kTxBacklogHighWatermark;
+    bool congested = GetBacklogCount() > backlog_threshold;
+
+    auto *pool = GetPacketPool();
+    if (pool != nullptr) {
+      // A failed allocation since the last flush means the pool ran dry.
+      const auto alloc_failures = pool->GetAllocFailures();
+      congested |= alloc_failures != last_alloc_failures_;
+      last_alloc_failures_ = alloc_failures;
+
+      if (!congested &&
+          (was_congested || ++flushes_since_sample_ >= kPoolSampleInterval)) {
+        flushes_since_sample_ = 0;
+        const uint32_t pool_div =
+            was_congested ? kPoolHighWatermarkDiv : kPoolLowWatermarkDiv;
+        congested = pool->AvailPacketsCount() < pool->Capacity() / pool_div;
+      }
+    }
+
+    if (congested && !was_congested) stats_.congestions++;
+    congested_ = congested;
+  }
+
   struct rte_eth_txconf conf_;
+  // Packets waiting to be sent in a single burst.
+  PacketBatch staged_;
+  // Packets the NIC did not take yet, in order; free-running indices.
+  std::array<Packet *, kTxBacklogSize> backlog_;
+  uint32_t backlog_head_{0};
+  uint32_t backlog_tail_{0};
+  bool congested_{false};
+  uint64_t last_alloc_failures_{0};
+  uint32_t flushes_since_sample_{0};
+  Stats stats_{};
+  // Capture tap of the engine, while it captures packets.
+  CaptureTap *capture_tap_{nullptr};
 };
 
 /**
@@ -186,8 +380,9 @@ class RxRing : public PmdRing {
 
   RxRing(const PmdPort *pmd_port, uint8_t port_id, uint16_t ring_id,
          uint16_t ndesc, struct rte_eth_rxconf rxconf, uint32_t nmbufs,
-         uint32_t mbuf_sz)
-      : PmdRing(pmd_port, port_id, ring_id, ndesc, nmbufs, mbuf_sz),
+         uint32_t mbuf_sz, int socket_id = SOCKET_ID_ANY)
+      : PmdRing(pmd_port, port_id, ring_id, ndesc, nmbufs, mbuf_sz,
+                socket_id),
         conf_(rxconf) {}
 
   RxRing(RxRing const &) = delete;
@@ -281,6 +476,7 @@ class PmdPort {
         rx_rings_nr_(rx_rings_nr),
         tx_ring_desc_nr_(tx_desc_nr),
         rx_ring_desc_nr_(rx_desc_nr),
+        numa_node_(rte_eth_dev_socket_id(id)),
         initialized_(false) {
     // Get L2 address.
     rte_ether_addr temp;
@@ -321,6 +517,16 @@ class PmdPort {
 
   uint16_t GetPortId() const { return port_id_; }
 
+  /**
+   * @brief Retrieves the NUMA node the NIC is attached to. The rings and packet
+   * pools of the port are allocated on this node.
+   *
+   * @return The NUMA node, or `SOCKET_ID_ANY' if it is unknown.
+   */
+  int GetNumaNode() const {
+    return numa_node_ < 0 ? SOCKET_ID_ANY : numa_node_;
+  }
+
   std::string GetDriverName() const {
     return juggler::utils::Format("%s", devinfo_.driver_name);
   }
@@ -367,6 +573,15 @@ class PmdPort {
    */
   const std::vector<uint8_t> &GetRSSKey() const { return rss_hash_key_; }
 
+  /**
+   * @brief Whether the port spreads packets over its RX queues with RSS.
+   * Devices without RSS (e.g., the `net_null' and `net_ring' vdevs) deliver
+   * everything to the first queue.
+   */
+  bool HasRSS() const {
+    return devinfo_.reta_size != 0 && !rss_hash_key_.empty();
+  }
+
   /**
    * @brief Calculates the landing RX queue for a given RSS hash.
    *
@@ -374,6 +589,7 @@ class PmdPort {
    * @return The index of the RX queue.
    */
   uint16_t GetRSSRxQueue(uint32_t rss_hash) const {
+    if (!HasRSS()) return 0;
     auto lsb = rss_hash & (devinfo_.reta_size - 1);
     auto index = lsb / RTE_ETH_RETA_GROUP_SIZE;
     auto shift = lsb % RTE_ETH_RETA_GROUP_SIZE;
@@ -440,6 +656,15 @@ class PmdPort {
     return port_stats_.q_obytes[queue_id];
   }
 
+  /**
+   * @brief Retrieves the extended statistics of the port (see
+   * `rte_eth_xstats_get()'); they cover the basic ones, plus driver-specific
+   * counters.
+   *
+   * @return The statistics, as (name, value) pairs; empty on failure.
+   */
+  std::vector<std::pair<std::string, uint64_t>> GetXStats() const;
+
   void DumpStats() {
     UpdatePortStats();
     LOG(INFO) << juggler::utils::Format(
@@ -467,6 +692,7 @@ class PmdPort {
   const uint16_t port_id_;
   const uint16_t tx_rings_nr_, rx_rings_nr_;
   uint16_t tx_ring_desc_nr_, rx_ring_desc_nr_;
+  const int numa_node_;
   std::vector<std::unique_ptr<PmdRing>> tx_rings_, rx_rings_;
 
   juggler::net::Ethernet::Address l2_addr_;
@@ -0,0 +1,192 @@
+/**
+ * @file route.h
+ * @brief IPv4 routing table, mapping destinations to the next hop that their
+ * packets are sent to on the link.
+ */
+#ifndef SRC_INCLUDE_ROUTE_H_
+#define SRC_INCLUDE_ROUTE_H_
+
+#include <glog/logging.h>
+#include <ipv4.h>
+#include <utils.h>
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace juggler {
+
+/**
+ * @brief A route to a prefix: either directly on the link, or through a
+ * gateway (which must be on the link).
+ */
+struct Route {
+  static constexpr uint8_t kMaxPrefixLen = 32;
+
+  net::Ipv4::Address prefix;
+  uint8_t prefix_len;
+  std::optional<net::Ipv4::Address> gateway;
+
+  static uint32_t Mask(uint8_t prefix_len) {
+    return prefix_len == 0 ? 0 : ~0u << (kMaxPrefixLen - prefix_len);
+  }
+
+  /**
+   * @brief Parses a prefix in CIDR notation (e.g., "10.1.0.0/16"); a plain
+   * address is a /32. Host bits are cleared.
+   */
+  static std::optional<std::pair<net::Ipv4::Address, uint8_t>> ParsePrefix(
+      const std::string &cidr) {
+    const auto slash = cidr.find('/');
+    const auto addr = net::Ipv4::Address::MakeAddress(cidr.substr(0, slash));
+    if (!addr.has_value()) return std::nullopt;
+    uint32_t prefix_len = kMaxPrefixLen;
+    if (slash != std::string::npos) {
+      const auto len = cidr.substr(slash + 1);
+      if (len.empty() || len.size() > 2 ||
+          len.find_first_not_of("0123456789") != std::string::npos) {
+        return std::nullopt;
+      }
+      prefix_len = std::stoul(len);
+      if (prefix_len > kMaxPrefixLen) return std::nullopt;
+    }
+    const net::Ipv4::Address prefix(addr->address.value() & Mask(prefix_len));
+    return std::make_pair(prefix, static_cast<uint8_t>(prefix_len));
+  }
+
+  std::string ToString() const {
+    auto s = utils::Format("%s/%hhu", prefix.ToString().c_str(), prefix_len);
+    s += gateway.has_value() ? " via " + gateway->ToString() : " on-link";
+    return s;
+  }
+};
+
+/**
+ * @brief Longest-prefix-match routing table. Routes are kept in one hash map
+ * per prefix length, so a lookup costs at most one probe per length in use
+ * (usually two or three), whatever the number of routes.
+ *
+ * Like the `NeighborTable', it is updated by publishing a new snapshot, so
+ * that lookups never wait for the control plane. Destinations that match no
+ * route are assumed to be on the link, as they were before routes existed.
+ */
+class RoutingTable {
+ public:
+  using Ipv4 = net::Ipv4;
+
+  struct Snapshot {
+    uint64_t version{0};
+    // Routes by prefix length, then by prefix (host byte order).
+    std::array<std::unordered_map<uint32_t, Route>, Route::kMaxPrefixLen + 1>
+        routes{};
+    // Prefix lengths in use, longest first.
+    std::vector<uint8_t> prefix_lens{};
+
+    /**
+     * @return The most specific route to `addr', if any.
+     */
+    const Route *Lookup(const Ipv4::Address &addr) const {
+      const auto value = addr.address.value();
+      for (const auto len : prefix_lens) {
+        const auto it = routes[len].find(value & Route::Mask(len));
+        if (it != routes[len].end()) return &it->second;
+      }
+      return nullptr;
+    }
+
+    /**
+     * @return The address to resolve to reach `addr': the gateway of its
+     * route, if any, or `addr' itself.
+     */
+    Ipv4::Address NextHop(const Ipv4::Address &addr) const {
+      const auto *route = Lookup(addr);
+      if (route == nullptr || !route->gateway.has_value()) return addr;
+      return route->gateway.value();
+    }
+  };
+
+  RoutingTable() : snapshot_(std::make_shared<const Snapshot>()) {}
+  RoutingTable(const RoutingTable &) = delete;
+  RoutingTable &operator=(const RoutingTable &) = delete;
+
+  uint64_t GetVersion() const { return GetSnapshot()->version; }
+
+  std::shared_ptr<const Snapshot> GetSnapshot() const {
+    return snapshot_.load(std::memory_order_acquire);
+  }
+
+  Ipv4::Address NextHop(const Ipv4::Address &addr) const {
+    return GetSnapshot()->NextHop(addr);
+  }
+
+  /**
+   * @brief Adds a route, or replaces the one to the same prefix.
+   */
+  void AddRoute(const Route &route) {
+    CHECK_LE(route.prefix_len, Route::kMaxPrefixLen);
+    const std::lock_guard<std::mutex> lock(mtx_);
+    auto snapshot = std::make_shared<Snapshot>(*GetSnapshot());
+    auto normalized = route;
+    normalized.prefix = Ipv4::Address(route.prefix.address.value() &
+                                      Route::Mask(route.prefix_len));
+    snapshot->routes[route.prefix_len].insert_or_assign(
+        normalized.prefix.address.value(), normalized);
+    PublishLocked(std::move(snapshot));
+  }
+
+  /**
+   * @brief Removes the route to a prefix.
+   *
+   * @return False if there was no such route.
+   */
+  bool RemoveRoute(const Ipv4::Address &prefix, uint8_t prefix_len) {
+    if (prefix_len > Route::kMaxPrefixLen) return false;
+    const std::lock_guard<std::mutex> lock(mtx_);
+    auto snapshot = std::make_shared<Snapshot>(*GetSnapshot());
+    if (snapshot->routes[prefix_len].erase(prefix.address.value() &
+                                           Route::Mask(prefix_len)) == 0) {
+      return false;
+    }
+    PublishLocked(std::move(snapshot));
+    return true;
+  }
+
+  /**
+   * @return All the routes, most specific first.
+   */
+  std::vector<Route> GetRoutes() const {
+    const auto snapshot = GetSnapshot();
+    std::vector<Route> routes;
+    for (const auto len : snapshot->prefix_lens) {
+      for (const auto &[_, route] : snapshot->routes[len]) {
+        routes.push_back(route);
+      }
+    }
+    return routes;
+  }
+
+ private:
+  void PublishLocked(std::shared_ptr<Snapshot> snapshot) {
+    snapshot->prefix_lens.clear();
+    for (int len = Route::kMaxPrefixLen; len >= 0; len--) {
+      if (!snapshot->routes[len].empty()) snapshot->prefix_lens.push_back(len);
+    }
+    snapshot->version++;
+    snapshot_.store(std::move(snapshot), std::memory_order_release);
+  }
+
+  // Serializes writers.
+  std::mutex mtx_;
+  std::atomic<std::shared_ptr<const Snapshot>> snapshot_;
+};
+
+}  // namespace juggler
+
+#endif  // SRC_INCLUDE_ROUTE_H_
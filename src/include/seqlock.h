@@ -0,0 +1,95 @@
+/**
+ * @file seqlock.h
+ * @brief A single-writer sequence lock, to publish snapshots of data-plane
+ * state to other threads without blocking the writer.
+ */
+#ifndef SRC_INCLUDE_SEQLOCK_H_
+#define SRC_INCLUDE_SEQLOCK_H_
+
+#include <common.h>
+#include <pause.h>
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+namespace juggler {
+
+/**
+ * @brief Holds a value of type `T' that one thread (the writer) updates, and
+ * any number of threads read. The writer never waits; readers retry if they
+ * raced with an update.
+ *
+ * @tparam T A trivially copyable type.
+ */
+template <typename T>
+class SeqLock {
+  static_assert(std::is_trivially_copyable_v<T>,
+                "SeqLock requires a trivially copyable type");
+
+ public:
+  SeqLock() : seq_(0), value_() {}
+  SeqLock(const SeqLock &) = delete;
+  SeqLock &operator=(const SeqLock &) = delete;
+
+  /**
+   * @brief Publishes a new value. Must only be called by the writer thread.
+   *
+   * @param value The value to publish.
+   */
+  void Store(const T &value) {
+    const auto seq = seq_.load(std::memory_order_relaxed);
+    seq_.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    std::memcpy(&value_, &value, sizeof(T));
+    seq_.store(seq + 2, std::memory_order_release);
+  }
+
+  /**
+   * @brief Updates the value in place, for values too large to build a copy of
+   * first. Readers retry until `update' returns, so it should be short. Must
+   * only be called by the writer thread.
+   *
+   * @param update Callable that takes a `T *' and updates it.
+   */
+  template <typename F>
+  void Update(F &&update) {
+    const auto seq = seq_.load(std::memory_order_relaxed);
+    seq_.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    update(&value_);
+    seq_.store(seq + 2, std::memory_order_release);
+  }
+
+  /**
+   * @brief Reads a consistent copy of the last published value.
+   *
+   * @param value Pointer to store the value to.
+   * @return The version of the value read; 0 if nothing was published yet.
+   */
+  uint64_t Load(T *value) const {
+    uint64_t seq_begin, seq_end;
+    do {
+      seq_begin = seq_.load(std::memory_order_acquire);
+      if (seq_begin & 1) {
+        machnet_pause();
+        continue;
+      }
+      std::memcpy(value, &value_, sizeof(T));
+      std::atomic_thread_fence(std::memory_order_acquire);
+      seq_end = seq_.load(std::memory_order_relaxed);
+      if (seq_begin == seq_end) break;
+    } while (true);
+
+    return seq_begin / 2;
+  }
+
+ private:
+  alignas(hardware_destructive_interference_size) std::atomic<uint64_t> seq_;
+  T value_;
+};
+
+}  // namespace juggler
+
+#endif  // SRC_INCLUDE_SEQLOCK_H_
@@ -0,0 +1,297 @@
+/**
+ * @file trace.h
+ * @brief Binary tracing of hot-path transport events (retransmissions, state
+ * changes, bad packets, congestion) into a fixed-size ring per engine, and the
+ * dump format the `machnet_trace' tool decodes offline.
+ */
+#ifndef SRC_INCLUDE_TRACE_H_
+#define SRC_INCLUDE_TRACE_H_
+
+#include <common.h>
+#include <glog/logging.h>
+#include <ttime.h>
+#include <utils.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace juggler {
+
+/**
+ * @brief Classes of trace events; each is enabled separately, at runtime.
+ */
+enum class TraceClass : uint32_t {
+  kRexmit = 1 << 0,      // Retransmissions.
+  kState = 1 << 1,       // Flow creation and state changes.
+  kRxError = 1 << 2,     // Packets that are invalid for their flow.
+  kCongestion = 1 << 3,  // TX pauses and deferred ACKs.
+  kAck = 1 << 4,         // Duplicate ACKs and RTT samples (high volume).
+};
+static constexpr uint32_t kTraceClassAll = (1 << 5) - 1;
+
+/**
+ * @brief Types of trace events. The meaning of the arguments is listed with
+ * each type; `seqno' and `cwnd' are the flow's, unless noted otherwise.
+ */
+enum class TraceEventType : uint8_t {
+  // arg0: local IP, arg1: remote IP, arg2: local port << 16 | remote port.
+  kFlowCreate = 0,
+  kStateChange,   // arg0: old state, arg1: new state.
+  kFastRexmit,    // seqno: retransmitted packet.
+  kSackRexmit,    // seqno: retransmitted packet.
+  kRtoRexmit,     // seqno: retransmitted packet, arg0: consecutive RTOs.
+  kBadMagic,      // arg0: magic.
+  kUnexpected,    // arg0: packet flags, arg1: state.
+  kInvalidAck,    // seqno: ackno, arg0: snd_nxt.
+  kTxPause,       // arg0: pending segments.
+  kAckDeferred,   // seqno: rcv_nxt.
+  kDupAck,        // seqno: ackno, arg0: duplicate ACKs.
+  kRttSample,     // arg0: RTT (us), arg1: smoothed RTT (us).
+  kTypeNr,
+};
+
+static constexpr TraceClass TraceEventClass(TraceEventType type) {
+  switch (type) {
+    case TraceEventType::kFlowCreate:
+    case TraceEventType::kStateChange:
+      return TraceClass::kState;
+    case TraceEventType::kFastRexmit:
+    case TraceEventType::kSackRexmit:
+    case TraceEventType::kRtoRexmit:
+      return TraceClass::kRexmit;
+    case TraceEventType::kBadMagic:
+    case TraceEventType::kUnexpected:
+    case TraceEventType::kInvalidAck:
+      return TraceClass::kRxError;
+    case TraceEventType::kTxPause:
+    case TraceEventType::kAckDeferred:
+      return TraceClass::kCongestion;
+    default:
+      return TraceClass::kAck;
+  }
+}
+
+static inline const char *TraceEventTypeToString(TraceEventType type) {
+  switch (type) {
+    case TraceEventType::kFlowCreate:
+      return "flow_create";
+    case TraceEventType::kStateChange:
+      return "state_change";
+    case TraceEventType::kFastRexmit:
+      return "fast_rexmit";
+    case TraceEventType::kSackRexmit:
+      return "sack_rexmit";
+    case TraceEventType::kRtoRexmit:
+      return "rto_rexmit";
+    case TraceEventType::kBadMagic:
+      return "bad_magic";
+    case TraceEventType::kUnexpected:
+      return "unexpected";
+    case TraceEventType::kInvalidAck:
+      return "invalid_ack";
+    case TraceEventType::kTxPause:
+      return "tx_pause";
+    case TraceEventType::kAckDeferred:
+      return "ack_deferred";
+    case TraceEventType::kDupAck:
+      return "dup_ack";
+    case TraceEventType::kRttSample:
+      return "rtt_sample";
+    default:
+      return "unknown";
+  }
+}
+
+/**
+ * @brief Parses a comma-separated list of trace classes ("rexmit", "state",
+ * "rx_error", "congestion", "ack", or "all").
+ *
+ * @param classes The list.
+ * @return The classes as a bit mask, or std::nullopt if a name is unknown.
+ */
+static inline std::optional<uint32_t> TraceClassesFromString(
+    const std::string &classes) {
+  static constexpr std::pair<const char *, uint32_t> kNames[] = {
+      {"rexmit", static_cast<uint32_t>(TraceClass::kRexmit)},
+      {"state", static_cast<uint32_t>(TraceClass::kState)},
+      {"rx_error", static_cast<uint32_t>(TraceClass::kRxError)},
+      {"congestion", static_cast<uint32_t>(TraceClass::kCongestion)},
+      {"ack", static_cast<uint32_t>(TraceClass::kAck)},
+      {"all", kTraceClassAll},
+  };
+  uint32_t mask = 0;
+  size_t pos = 0;
+  while (pos <= classes.size()) {
+    auto end = classes.find(',', pos);
+    if (end == std::string::npos) end = classes.size();
+    const auto name = classes.substr(pos, end - pos);
+    pos = end + 1;
+    if (name.empty()) continue;
+    bool found = false;
+    for (const auto &[class_name, bits] : kNames) {
+      if (name != class_name) continue;
+      mask |= bits;
+      found = true;
+    }
+    if (!found) return std::nullopt;
+  }
+  return mask;
+}
+
+/**
+ * @brief A trace event; fixed size, so that two fit in a cache line.
+ */
+struct TraceEvent {
+  uint64_t tsc;
+  uint32_t flow_id;  // Per-engine id of the flow (see `Tracer::NewFlowId()').
+  uint8_t type;      // `TraceEventType'.
+  uint8_t reserved;
+  uint16_t cwnd;
+  uint32_t seqno;
+  uint32_t arg0;
+  uint32_t arg1;
+  uint32_t arg2;
+};
+static_assert(sizeof(TraceEvent) == 32, "TraceEvent must be 32 bytes");
+
+/**
+ * @brief Header of the trace of an engine in a dump; a dump is a sequence of
+ * headers, each followed by `event_nr' events, oldest first.
+ */
+struct TraceDumpHeader {
+  static constexpr uint32_t kMagic = 0x4352544d;  // "MTRC".
+  static constexpr uint16_t kVersion = 1;
+  uint32_t magic;
+  uint16_t version;
+  uint16_t engine;   // Index of the engine.
+  uint64_t tsc_hz;   // To convert event timestamps to time.
+  uint64_t recorded;  // Events recorded since the start; older ones are lost.
+  uint32_t event_nr;
+  uint32_t classes;  // Classes enabled at the time of the dump.
+};
+static_assert(sizeof(TraceDumpHeader) == 32,
+              "TraceDumpHeader must be 32 bytes");
+
+/**
+ * @brief Fixed-size ring of trace events of an engine. The engine thread is
+ * the only writer; when the ring is full the oldest events are overwritten.
+ * Any thread can take a snapshot of the ring, without stopping the writer.
+ *
+ * With all classes disabled (the default) recording an event costs a relaxed
+ * load and a branch. Otherwise it costs a TSC read and a 32-byte store.
+ */
+class Tracer {
+ public:
+  static constexpr size_t kDefaultCapacity = 1 << 16;
+
+  /**
+   * @param capacity Number of events in the ring (power of 2).
+   */
+  explicit Tracer(size_t capacity = kDefaultCapacity)
+      : mask_(capacity - 1),
+        events_(std::make_unique<TraceEvent[]>(capacity)),
+        classes_(0),
+        head_(0),
+        next_flow_id_(0) {
+    CHECK(utils::is_power_of_two(capacity))
+        << "Trace ring capacity must be a power of 2.";
+  }
+  Tracer(const Tracer &) = delete;
+  Tracer &operator=(const Tracer &) = delete;
+
+  size_t GetCapacity() const { return mask_ + 1; }
+
+  /**
+   * @brief Sets the classes of events to record (a mask of `TraceClass').
+   * Safe to call from any thread.
+   */
+  void SetClasses(uint32_t classes) {
+    classes_.store(classes, std::memory_order_relaxed);
+  }
+  uint32_t GetClasses() const {
+    return classes_.load(std::memory_order_relaxed);
+  }
+  bool IsEnabled(TraceEventType type) const {
+    return GetClasses() & static_cast<uint32_t>(TraceEventClass(type));
+  }
+
+  /**
+   * @brief Returns an id for a new flow, to tag its events with. Must only be
+   * called by the writer thread.
+   */
+  uint32_t NewFlowId() { return next_flow_id_++; }
+
+  /**
+   * @brief Records an event, if its class is enabled. Must only be called by
+   * the writer thread.
+   */
+  void Record(TraceEventType type, uint32_t flow_id, uint32_t seqno,
+              uint16_t cwnd, uint32_t arg0 = 0, uint32_t arg1 = 0,
+              uint32_t arg2 = 0) {
+    if (!IsEnabled(type)) [[likely]]
+      return;
+
+    const auto head = head_.load(std::memory_order_relaxed);
+    auto *event = &events_[head & mask_];
+    event->tsc = time::rdtsc();
+    event->flow_id = flow_id;
+    event->type = static_cast<uint8_t>(type);
+    event->reserved = 0;
+    event->cwnd = cwnd;
+    event->seqno = seqno;
+    event->arg0 = arg0;
+    event->arg1 = arg1;
+    event->arg2 = arg2;
+    head_.store(head + 1, std::memory_order_release);
+  }
+
+  // Number of events recorded since the start, including overwritten ones.
+  uint64_t GetRecorded() const { return head_.load(std::memory_order_acquire); }
+
+  /**
+   * @brief Copies the events in the ring, oldest first. Safe to call from any
+   * thread; events the writer overwrote while they were copied are left out.
+   *
+   * @param events Vector to store the events to (cleared first).
+   * @return The number of events recorded since the start, as of the copy.
+   */
+  uint64_t Snapshot(std::vector<TraceEvent> *events) const {
+    const auto capacity = GetCapacity();
+    const auto head = head_.load(std::memory_order_acquire);
+    const auto first = head > capacity ? head - capacity : 0;
+    events->resize(head - first);
+    for (auto i = first; i < head; i++) {
+      std::memcpy(&(*events)[i - first], &events_[i & mask_],
+                  sizeof(TraceEvent));
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+
+    // The writer may be overwriting the slot of event `head_now - capacity'
+    // already; drop that one and anything older.
+    const auto head_now = head_.load(std::memory_order_relaxed);
+    const auto valid = head_now + 1 > capacity ? head_now + 1 - capacity : 0;
+    if (valid > first) {
+      events->erase(events->begin(),
+                    events->begin() + std::min(valid - first, head - first));
+    }
+    return head;
+  }
+
+ private:
+  const size_t mask_;
+  std::unique_ptr<TraceEvent[]> events_;
+  std::atomic<uint32_t> classes_;
+  alignas(hardware_destructive_interference_size) std::atomic<uint64_t> head_;
+  uint32_t next_flow_id_;
+};
+
+}  // namespace juggler
+
+#endif  // SRC_INCLUDE_TRACE_H_
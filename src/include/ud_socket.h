@@ -47,6 +47,13 @@ class UDSocket {
   bool SendMsg(const char *msg, size_t len);
   bool SendMsgWithFd(const char *msg, size_t len, int fd);
   int RecvMsgWithFd(char *msg, size_t len, int *fd);
+  /**
+   * @brief Receives exactly `len' bytes, e.g., a response of the controller
+   * or the report that follows it.
+   *
+   * @return False if the peer closed the connection or on error.
+   */
+  bool RecvAll(char *msg, size_t len);
 
   void *GetContext() const { return context_; }
   bool AllocateUserData(size_t size);
@@ -88,9 +95,13 @@ class UDServer {
   using on_message_cb_t =
       std::function<void(UDSocket *, const char *, size_t, int)>;
   using on_timeout_cb_t = std::function<void(UDSocket *)>;
+  // Called from the server's loop at least every `kIdleIntervalMs', for
+  // periodic work on the server's thread.
+  using on_idle_cb_t = std::function<void()>;
+  static constexpr int kIdleIntervalMs = 10;
   UDServer(const std::string &path, on_connect_cb_t on_connect,
            on_close_cb_t on_close, on_message_cb_t on_message,
-           on_timeout_cb_t on_timeout);
+           on_timeout_cb_t on_timeout, on_idle_cb_t on_idle = nullptr);
   ~UDServer();
 
   void Run();
@@ -101,6 +112,7 @@ class UDServer {
   const on_close_cb_t on_close_;
   const on_message_cb_t on_message_;
   const on_timeout_cb_t on_timeout_;
+  const on_idle_cb_t on_idle_;
   std::atomic<bool> keep_running_;
   UDSocket listen_socket_;
   std::unordered_map<int, std::unique_ptr<UDSocket>> connected_clients_;
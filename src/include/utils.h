@@ -7,12 +7,17 @@
 #define SRC_INCLUDE_UTILS_H_
 
 #include <glog/logging.h>
+#include <linux/mempolicy.h>
 #include <sched.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
 
+#include <cctype>
 #include <chrono>
 #include <cstdarg>
 #include <cstring>
+#include <filesystem>
 #include <functional>
 #include <iomanip>
 #include <sstream>
@@ -20,6 +25,7 @@
 #include <type_traits>
 #include <vector>
 
+#include "machnet_copy.h"
 #include "ttime.h"
 
 #define XXH_STATIC_LINKING_ONLY
@@ -36,6 +42,20 @@ namespace utils {
   std::memcpy(dest, src, nbytes);
 }
 
+/**
+ * @brief Copies packet or message payload with the best SIMD kernel for this
+ * CPU (see `machnet_copy.h`). Unlike `Copy`, which is meant for small
+ * structures, this pays off for copies of a few hundred bytes or more.
+ *
+ * Per-packet copies always use regular stores: they are at most one MTU in
+ * size, and the data is consumed right away (by the NIC or the application).
+ */
+[[maybe_unused]] static inline void CopyPayload(void *__restrict__ dest,
+                                                const void *__restrict__ src,
+                                                std::size_t nbytes) {
+  __machnet_copy(dest, src, nbytes, 0);
+}
+
 [[maybe_unused]] static inline std::string HexDump(uint8_t *data, size_t len) {
   std::stringstream ss;
   for (size_t i = 0; i < len; i++) {
@@ -240,6 +260,54 @@ namespace utils {
   return m;
 }
 
+/**
+ * @brief Returns the NUMA node of a CPU core.
+ *
+ * @param cpu The CPU core.
+ * @return The NUMA node, or -1 if it is unknown (e.g., no NUMA support).
+ */
+[[maybe_unused]] static int GetCpuNumaNode(size_t cpu) {
+  const std::filesystem::path cpu_path =
+      "/sys/devices/system/cpu/cpu" + std::to_string(cpu);
+  std::error_code ec;
+  for (const auto &entry : std::filesystem::directory_iterator(cpu_path, ec)) {
+    // The node of the CPU shows up as a `nodeN' link.
+    const std::string name = entry.path().filename();
+    if (name.size() > 4 && name.compare(0, 4, "node") == 0 &&
+        std::isdigit(name[4])) {
+      return std::stoi(name.substr(4));
+    }
+  }
+  return -1;
+}
+
+/**
+ * @brief Makes the calling thread prefer a NUMA node for the memory it
+ * allocates (incl. huge pages), until the object goes out of scope. Falls back
+ * to other nodes when the preferred one runs out of memory.
+ */
+class ScopedNumaPreference {
+ public:
+  explicit ScopedNumaPreference(int node) : active_(false) {
+    if (node < 0 || node >= static_cast<int>(sizeof(uint64_t) * 8)) return;
+    const uint64_t nodemask = 1ULL << node;
+    if (syscall(SYS_set_mempolicy, MPOL_PREFERRED, &nodemask,
+                sizeof(nodemask) * 8) != 0) {
+      PLOG(WARNING) << "Failed to prefer NUMA node " << node;
+      return;
+    }
+    active_ = true;
+  }
+  ~ScopedNumaPreference() {
+    if (active_) syscall(SYS_set_mempolicy, MPOL_DEFAULT, nullptr, 0);
+  }
+  ScopedNumaPreference(const ScopedNumaPreference &) = delete;
+  ScopedNumaPreference &operator=(const ScopedNumaPreference &) = delete;
+
+ private:
+  bool active_;
+};
+
 template <typename T>
 requires std::integral<T>
 static constexpr inline bool is_power_of_two(T x) {
@@ -0,0 +1,98 @@
+-- Wireshark dissector for the Machnet transport header (`MachnetPktHdr' in
+-- src/include/machnet_pkthdr.h), carried over UDP on any port.
+--
+-- Install it in the personal plugins folder of Wireshark (see Help > About >
+-- Folders), or load it for one run:
+--   wireshark -X lua_script:machnet.lua capture.pcapng
+--
+-- Packets are recognized by the magic value at the start of the UDP payload.
+-- The data packets of a flow are numbered by `seqno'; `ackno' is the next
+-- sequence number the receiver expects, and the SACK bitmap marks the packets
+-- after it that arrived out of order. Data packets carry the sender's TSC in
+-- `timestamp', and ACKs echo it back.
+
+local machnet = Proto("machnet", "Machnet Transport")
+
+local kMagic = 0x4e53
+local kHdrLen = 54
+
+local net_flags_names = {
+  [0x00] = "DATA",
+  [0x01] = "SYN",
+  [0x02] = "ACK",
+  [0x03] = "SYN-ACK",
+  [0x80] = "RST",
+}
+
+local f = machnet.fields
+f.magic = ProtoField.uint16("machnet.magic", "Magic", base.HEX)
+f.net_flags = ProtoField.uint8("machnet.net_flags", "Flags", base.HEX,
+                               net_flags_names)
+f.msg_flags = ProtoField.uint8("machnet.msg_flags", "Message flags",
+                               base.HEX)
+f.msg_syn = ProtoField.bool("machnet.msg_flags.syn", "First segment", 8,
+                            nil, 0x01)
+f.msg_sg = ProtoField.bool("machnet.msg_flags.sg", "Scatter-gather", 8,
+                           nil, 0x02)
+f.msg_fin = ProtoField.bool("machnet.msg_flags.fin", "Last segment", 8,
+                            nil, 0x04)
+f.msg_chain = ProtoField.bool("machnet.msg_flags.chain", "Chained", 8,
+                              nil, 0x08)
+f.seqno = ProtoField.uint32("machnet.seqno", "Sequence number")
+f.ackno = ProtoField.uint32("machnet.ackno", "Acknowledgment number")
+f.sack_bitmap = ProtoField.bytes("machnet.sack_bitmap", "SACK bitmap")
+f.sack_bitmap_count = ProtoField.uint16("machnet.sack_bitmap_count",
+                                        "SACK bitmap length")
+f.timestamp = ProtoField.uint64("machnet.timestamp", "Timestamp (TSC)")
+f.payload_len = ProtoField.uint32("machnet.payload_len", "Payload length")
+
+local function dissect(buffer, pinfo, tree)
+  if buffer:len() < kHdrLen or buffer(0, 2):uint() ~= kMagic then
+    return 0
+  end
+
+  pinfo.cols.protocol = "Machnet"
+  local net_flags = buffer(2, 1):uint()
+  local flags_name = net_flags_names[net_flags] or
+                     string.format("0x%02x", net_flags)
+  local seqno = buffer(4, 4):uint()
+  local ackno = buffer(8, 4):uint()
+  local payload_len = buffer:len() - kHdrLen
+  pinfo.cols.info = string.format("%s seq=%u ack=%u len=%u", flags_name,
+                                  seqno, ackno, payload_len)
+
+  local subtree = tree:add(machnet, buffer(0, kHdrLen))
+  subtree:add(f.magic, buffer(0, 2))
+  subtree:add(f.net_flags, buffer(2, 1))
+  local msg_flags = subtree:add(f.msg_flags, buffer(3, 1))
+  msg_flags:add(f.msg_syn, buffer(3, 1))
+  msg_flags:add(f.msg_sg, buffer(3, 1))
+  msg_flags:add(f.msg_fin, buffer(3, 1))
+  msg_flags:add(f.msg_chain, buffer(3, 1))
+  subtree:add(f.seqno, buffer(4, 4))
+  subtree:add(f.ackno, buffer(8, 4))
+  subtree:add(f.sack_bitmap, buffer(12, 32))
+  subtree:add(f.sack_bitmap_count, buffer(44, 2))
+  subtree:add(f.timestamp, buffer(46, 8))
+  subtree:add(f.payload_len, payload_len):set_generated()
+
+  if payload_len > 0 then
+    Dissector.get("data"):call(buffer(kHdrLen):tvb(), pinfo, tree)
+  end
+  return buffer:len()
+end
+
+function machnet.dissector(buffer, pinfo, tree)
+  return dissect(buffer, pinfo, tree)
+end
+
+-- Machnet flows use arbitrary UDP ports, so match on the magic value instead.
+local function heuristic(buffer, pinfo, tree)
+  if dissect(buffer, pinfo, tree) == 0 then
+    return false
+  end
+  pinfo.conversation = machnet
+  return true
+end
+
+machnet:register_heuristic("udp", heuristic)
@@ -0,0 +1,185 @@
+/**
+ * @file main.cc
+ * @brief Captures the packets a running Machnet instance receives and sends,
+ * into a pcapng file, without stopping it (see `CaptureTap').
+ *
+ * Machnet writes the capture into a pipe, and this tool copies it to the
+ * output, so that it can also be streamed, e.g., to Wireshark:
+ *   machnet_capture -w - host 10.0.0.2 and port 888 | wireshark -k -i -
+ * The capture stops on SIGINT, after `--duration_s', or once `--count'
+ * packets have been captured. See `machnet.lua' for a Wireshark dissector of
+ * the Machnet header.
+ */
+#include <capture.h>
+#include <fcntl.h>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <machnet_ctrl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <ud_socket.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+DEFINE_string(socket, MACHNET_CONTROLLER_DEFAULT_PATH,
+              "Path of the Machnet controller socket.");
+DEFINE_string(w, "", "File to write the capture to ('-' for stdout).");
+DEFINE_uint32(snaplen, juggler::CaptureRecord::kMaxSnapLen,
+              "Bytes to capture per packet, at most.");
+DEFINE_uint64(count, 0, "Packets to capture (0: no limit).");
+DEFINE_uint32(duration_s, 0, "Seconds to capture for (0: until SIGINT).");
+
+namespace {
+
+volatile sig_atomic_t g_stop = 0;
+
+void SigHandler(int) { g_stop = 1; }
+
+bool WriteAll(int fd, const char *data, size_t len) {
+  while (len > 0) {
+    const auto ret = write(fd, data, len);
+    if (ret < 0 && errno == EINTR) continue;
+    if (ret <= 0) return false;
+    data += ret;
+    len -= ret;
+  }
+  return true;
+}
+
+bool RecvResponse(juggler::net::UDSocket *socket, std::string *report) {
+  machnet_ctrl_msg_t resp;
+  if (!socket->RecvAll(reinterpret_cast<char *>(&resp), sizeof(resp))) {
+    LOG(ERROR) << "Failed to receive the response.";
+    return false;
+  }
+  if (resp.type != MACHNET_CTRL_MSG_TYPE_RESPONSE ||
+      resp.status != MACHNET_CTRL_STATUS_SUCCESS) {
+    return false;
+  }
+  report->assign(resp.status_info.length, '\0');
+  if (!socket->RecvAll(report->data(), report->size())) {
+    LOG(ERROR) << "Failed to receive the capture summary.";
+    return false;
+  }
+  return true;
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  google::InitGoogleLogging(argv[0]);
+  gflags::SetUsageMessage("-w <file> [filter expression]");
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+  FLAGS_logtostderr = 1;
+
+  if (FLAGS_w.empty()) {
+    gflags::ShowUsageWithFlagsRestrict(argv[0], "machnet_capture");
+    return EXIT_FAILURE;
+  }
+
+  // The remaining arguments make up the filter, as with tcpdump.
+  std::string filter;
+  for (int i = 1; i < argc; i++) {
+    if (!filter.empty()) filter += " ";
+    filter += argv[i];
+  }
+  machnet_ctrl_msg_t req = {};
+  if (filter.size() >= sizeof(req.capture_info.filter) ||
+      !juggler::CaptureFilter::Parse(filter).has_value()) {
+    LOG(ERROR) << "Invalid capture filter: " << filter;
+    return EXIT_FAILURE;
+  }
+
+  const int out_fd = FLAGS_w == "-" ? STDOUT_FILENO
+                                    : open(FLAGS_w.c_str(),
+                                           O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (out_fd < 0) {
+    LOG(ERROR) << "Cannot open " << FLAGS_w << ": " << strerror(errno);
+    return EXIT_FAILURE;
+  }
+
+  int pipe_fds[2];
+  if (pipe(pipe_fds) != 0) {
+    LOG(ERROR) << "Failed to create a pipe: " << strerror(errno);
+    return EXIT_FAILURE;
+  }
+
+  juggler::net::UDSocket socket;
+  if (!socket.Connect(FLAGS_socket)) {
+    LOG(ERROR) << "Cannot connect to the Machnet controller at "
+               << FLAGS_socket;
+    return EXIT_FAILURE;
+  }
+
+  req.type = MACHNET_CTRL_MSG_TYPE_REQ_CAPTURE;
+  req.msg_id = 0;
+  req.capture_info.flags = MACHNET_CAPTURE_START;
+  req.capture_info.snaplen = FLAGS_snaplen;
+  req.capture_info.max_packets = FLAGS_count;
+  std::memcpy(req.capture_info.filter, filter.c_str(), filter.size() + 1);
+  if (!socket.SendMsgWithFd(reinterpret_cast<char *>(&req), sizeof(req),
+                            pipe_fds[1])) {
+    return EXIT_FAILURE;
+  }
+  close(pipe_fds[1]);
+
+  std::string summary;
+  if (!RecvResponse(&socket, &summary)) {
+    LOG(ERROR) << "Failed to start the capture (is another one running?).";
+    return EXIT_FAILURE;
+  }
+
+  struct sigaction sa = {};
+  sa.sa_handler = SigHandler;
+  sigaction(SIGINT, &sa, nullptr);
+  sigaction(SIGTERM, &sa, nullptr);
+  sigaction(SIGALRM, &sa, nullptr);
+  if (FLAGS_duration_s > 0) alarm(FLAGS_duration_s);
+
+  // Machnet closes the pipe once the capture is over: either it was asked to
+  // stop, or it captured `--count' packets. The pipe is polled with a timeout,
+  // so that a signal is noticed even if no packets come.
+  const int kPollTimeoutMs = 100;
+  req.capture_info.flags = MACHNET_CAPTURE_STOP;
+  bool stop_sent = false;
+  bool ok = true;
+  std::vector<char> buf(1 << 16);
+  while (true) {
+    if (g_stop && !stop_sent) {
+      if (!socket.SendMsg(reinterpret_cast<char *>(&req), sizeof(req)))
+        return EXIT_FAILURE;
+      stop_sent = true;
+    }
+    pollfd pfd = {pipe_fds[0], POLLIN, 0};
+    if (poll(&pfd, 1, kPollTimeoutMs) <= 0) continue;
+    const auto ret = read(pipe_fds[0], buf.data(), buf.size());
+    if (ret < 0 && errno == EINTR) continue;
+    if (ret < 0) {
+      LOG(ERROR) << "Failed to read the capture: " << strerror(errno);
+      ok = false;
+      break;
+    }
+    if (ret == 0) break;
+    if (ok && !WriteAll(out_fd, buf.data(), ret)) {
+      // Keep draining the pipe, so that Machnet can finish.
+      LOG(ERROR) << "Failed to write " << FLAGS_w << ": " << strerror(errno);
+      ok = false;
+    }
+  }
+  if (out_fd != STDOUT_FILENO) close(out_fd);
+
+  if (!stop_sent &&
+      !socket.SendMsg(reinterpret_cast<char *>(&req), sizeof(req))) {
+    return EXIT_FAILURE;
+  }
+  if (!RecvResponse(&socket, &summary)) return EXIT_FAILURE;
+  std::cerr << summary;
+  return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
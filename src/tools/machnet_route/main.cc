@@ -0,0 +1,137 @@
+/**
+ * @file main.cc
+ * @brief Changes the routing of a running Machnet instance (see
+ * `RoutingTable'): routes through gateways, and pinned neighbours.
+ *
+ * Examples:
+ *   machnet_route add 10.2.0.0/16 via 10.0.1.254
+ *   machnet_route add 10.0.1.0/24           # On-link.
+ *   machnet_route del 10.2.0.0/16
+ *   machnet_route pin 10.0.1.254 00:0d:3a:d6:9b:70
+ *   machnet_route unpin 10.0.1.254
+ *   machnet_route list
+ * Changes apply to all the interfaces, or to the one of `--ip'.
+ */
+#include <ether.h>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <ipv4.h>
+#include <machnet_ctrl.h>
+#include <route.h>
+#include <sys/socket.h>
+#include <ud_socket.h>
+
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+DEFINE_string(socket, MACHNET_CONTROLLER_DEFAULT_PATH,
+              "Path of the Machnet controller socket.");
+DEFINE_string(ip, "", "IP address of the interface to change (default: all).");
+
+namespace {
+
+/**
+ * @brief Builds the request for the command line arguments.
+ *
+ * @return False if they are invalid.
+ */
+bool ParseArgs(const std::vector<std::string> &args,
+               machnet_route_info_t *info) {
+  if (args.empty()) return false;
+  const auto &cmd = args[0];
+  if (cmd == "list" && args.size() == 1) {
+    info->op = MACHNET_ROUTE_LIST;
+    return true;
+  }
+
+  if ((cmd == "add" && (args.size() == 2 || args.size() == 4)) ||
+      (cmd == "del" && args.size() == 2)) {
+    const auto prefix = juggler::Route::ParsePrefix(args[1]);
+    if (!prefix.has_value()) return false;
+    info->op = cmd == "add" ? MACHNET_ROUTE_ADD : MACHNET_ROUTE_DEL;
+    info->dst_ip = prefix->first.address.value();
+    info->prefix_len = prefix->second;
+    if (args.size() == 4) {
+      const auto gateway = juggler::net::Ipv4::Address::MakeAddress(args[3]);
+      if (args[2] != "via" || !gateway.has_value()) return false;
+      info->gateway_ip = gateway->address.value();
+    }
+    return true;
+  }
+
+  if ((cmd == "pin" && args.size() == 3) ||
+      (cmd == "unpin" && args.size() == 2)) {
+    const auto addr = juggler::net::Ipv4::Address::MakeAddress(args[1]);
+    if (!addr.has_value()) return false;
+    info->op = cmd == "pin" ? MACHNET_ROUTE_PIN_NEIGHBOR
+                            : MACHNET_ROUTE_UNPIN_NEIGHBOR;
+    info->dst_ip = addr->address.value();
+    if (cmd == "pin") {
+      juggler::net::Ethernet::Address l2addr;
+      if (!l2addr.FromString(args[2])) return false;
+      std::memcpy(info->l2_addr, l2addr.bytes, sizeof(info->l2_addr));
+    }
+    return true;
+  }
+  return false;
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  google::InitGoogleLogging(argv[0]);
+  gflags::SetUsageMessage(
+      "add <prefix> [via <gateway>] | del <prefix> | pin <ip> <mac> | "
+      "unpin <ip> | list");
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+  FLAGS_logtostderr = 1;
+
+  machnet_ctrl_msg_t req = {};
+  req.type = MACHNET_CTRL_MSG_TYPE_REQ_ROUTE;
+  req.msg_id = 0;
+  if (!ParseArgs(std::vector<std::string>(argv + 1, argv + argc),
+                 &req.route_info)) {
+    gflags::ShowUsageWithFlagsRestrict(argv[0], "machnet_route");
+    return EXIT_FAILURE;
+  }
+  if (!FLAGS_ip.empty()) {
+    const auto local_ip = juggler::net::Ipv4::Address::MakeAddress(FLAGS_ip);
+    if (!local_ip.has_value()) {
+      LOG(ERROR) << "Invalid interface IP address: " << FLAGS_ip;
+      return EXIT_FAILURE;
+    }
+    req.route_info.local_ip = local_ip->address.value();
+  }
+
+  juggler::net::UDSocket socket;
+  if (!socket.Connect(FLAGS_socket)) {
+    LOG(ERROR) << "Cannot connect to the Machnet controller at "
+               << FLAGS_socket;
+    return EXIT_FAILURE;
+  }
+  if (!socket.SendMsg(reinterpret_cast<char *>(&req), sizeof(req))) {
+    return EXIT_FAILURE;
+  }
+
+  // The response message is followed by the listing, if any.
+  machnet_ctrl_msg_t resp;
+  if (!socket.RecvAll(reinterpret_cast<char *>(&resp), sizeof(resp))) {
+    LOG(ERROR) << "Failed to receive the response.";
+    return EXIT_FAILURE;
+  }
+  if (resp.type != MACHNET_CTRL_MSG_TYPE_RESPONSE ||
+      resp.status != MACHNET_CTRL_STATUS_SUCCESS) {
+    LOG(ERROR) << "Route request failed.";
+    return EXIT_FAILURE;
+  }
+
+  std::string report(resp.status_info.length, '\0');
+  if (!socket.RecvAll(report.data(), report.size())) {
+    LOG(ERROR) << "Failed to receive the listing.";
+    return EXIT_FAILURE;
+  }
+  std::cout << report;
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,57 @@
+/**
+ * @file main.cc
+ * @brief Prints the status of a running Machnet controller and its engines
+ * (TX path, channels, listeners, flows, ARP table, profile).
+ */
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <machnet_ctrl.h>
+#include <sys/socket.h>
+#include <ud_socket.h>
+
+#include <iostream>
+#include <string>
+
+DEFINE_string(socket, MACHNET_CONTROLLER_DEFAULT_PATH,
+              "Path of the Machnet controller socket.");
+
+int main(int argc, char *argv[]) {
+  google::InitGoogleLogging(argv[0]);
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+  FLAGS_logtostderr = 1;
+
+  juggler::net::UDSocket socket;
+  if (!socket.Connect(FLAGS_socket)) {
+    LOG(ERROR) << "Cannot connect to the Machnet controller at "
+               << FLAGS_socket;
+    return EXIT_FAILURE;
+  }
+
+  machnet_ctrl_msg_t req = {};
+  req.type = MACHNET_CTRL_MSG_TYPE_REQ_STATUS;
+  req.msg_id = 0;
+  if (!socket.SendMsg(reinterpret_cast<char *>(&req), sizeof(req))) {
+    return EXIT_FAILURE;
+  }
+
+  // The response message is followed by the report itself.
+  machnet_ctrl_msg_t resp;
+  if (!socket.RecvAll(reinterpret_cast<char *>(&resp), sizeof(resp))) {
+    LOG(ERROR) << "Failed to receive the response.";
+    return EXIT_FAILURE;
+  }
+  if (resp.type != MACHNET_CTRL_MSG_TYPE_RESPONSE ||
+      resp.status != MACHNET_CTRL_STATUS_SUCCESS) {
+    LOG(ERROR) << "Status request failed.";
+    return EXIT_FAILURE;
+  }
+
+  std::string report(resp.status_info.length, '\0');
+  if (!socket.RecvAll(report.data(), report.size())) {
+    LOG(ERROR) << "Failed to receive the status report.";
+    return EXIT_FAILURE;
+  }
+
+  std::cout << report;
+  return EXIT_SUCCESS;
+}
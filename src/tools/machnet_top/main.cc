@@ -0,0 +1,325 @@
+/**
+ * @file main.cc
+ * @brief Shows live rates of a running Machnet instance: per-channel traffic,
+ * drops, retransmissions, ring and buffer occupancy and flows, read from the
+ * statistics the engines maintain in the channels, and the extended
+ * statistics of the NIC ports, polled from the controller.
+ *
+ * The Machnet process holds a descriptor of every channel (a memfd, or POSIX
+ * shared memory). The tool maps them read-only through `/proc/<pid>/fd', so it
+ * needs the permissions to inspect the Machnet process (e.g., root).
+ */
+#include <dirent.h>
+#include <fcntl.h>
+#include <flow.h>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <ipv4.h>
+#include <machnet_common.h>
+#include <machnet_ctrl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <ud_socket.h>
+#include <unistd.h>
+#include <utils.h>
+
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <cstdio>
+#include <map>
+#include <sstream>
+#include <string>
+#include <thread>
+
+DEFINE_string(socket, MACHNET_CONTROLLER_DEFAULT_PATH,
+              "Path of the Machnet controller socket.");
+DEFINE_int32(pid, 0,
+             "PID of the Machnet process; by default, the process serving "
+             "the controller socket.");
+DEFINE_uint32(interval_ms, 1000, "Refresh interval in milliseconds.");
+DEFINE_uint32(iterations, 0, "Number of refreshes (0: until interrupted).");
+DEFINE_string(xstats_filter, "",
+              "Only show the port statistics whose name contains this.");
+
+namespace {
+
+using juggler::utils::Format;
+
+// A channel of the Machnet process, mapped read-only.
+struct MappedChannel {
+  // Null if the file is not a channel (e.g., an extension segment).
+  const MachnetChannelCtx_t *ctx{nullptr};
+  size_t size{0};
+  bool seen{false};
+  bool has_prev{false};
+  MachnetChannelEngineStats_t prev{};
+};
+
+using ChannelMap = std::map<ino_t, MappedChannel>;
+
+// Returns the extended statistics of the ports, keyed by "<port>/<name>".
+bool GetPortStats(juggler::net::UDSocket *socket,
+                  std::map<std::string, uint64_t> *xstats) {
+  machnet_ctrl_msg_t req = {};
+  req.type = MACHNET_CTRL_MSG_TYPE_REQ_PORT_STATS;
+  if (!socket->SendMsg(reinterpret_cast<char *>(&req), sizeof(req))) {
+    return false;
+  }
+
+  machnet_ctrl_msg_t resp;
+  if (!socket->RecvAll(reinterpret_cast<char *>(&resp), sizeof(resp)) ||
+      resp.type != MACHNET_CTRL_MSG_TYPE_RESPONSE ||
+      resp.status != MACHNET_CTRL_STATUS_SUCCESS) {
+    return false;
+  }
+  std::string report(resp.status_info.length, '\0');
+  if (!socket->RecvAll(report.data(), report.size())) return false;
+
+  xstats->clear();
+  std::istringstream lines(report);
+  std::string port, name;
+  uint64_t value;
+  while (lines >> port >> name >> value) (*xstats)[port + "/" + name] = value;
+  return true;
+}
+
+// Maps the channels of the Machnet process that are not mapped yet, and
+// unmaps the ones it no longer has open.
+bool ScanChannels(pid_t pid, ChannelMap *channels) {
+  for (auto &[_, channel] : *channels) channel.seen = false;
+
+  const auto fd_dir = Format("/proc/%d/fd", pid);
+  DIR *dir = opendir(fd_dir.c_str());
+  if (dir == nullptr) {
+    PLOG(ERROR) << "Cannot open " << fd_dir;
+    return false;
+  }
+
+  struct dirent *entry;
+  while ((entry = readdir(dir)) != nullptr) {
+    if (entry->d_name[0] == '.') continue;
+    const auto path = fd_dir + "/" + entry->d_name;
+    char target[PATH_MAX];
+    const auto len = readlink(path.c_str(), target, sizeof(target) - 1);
+    if (len <= 0) continue;
+    target[len] = '\0';
+    const std::string link(target);
+    if (link.rfind("/memfd:", 0) != 0 && link.rfind("/dev/shm/", 0) != 0)
+      continue;
+
+    const int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) continue;
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+      close(fd);
+      continue;
+    }
+    auto it = channels->find(st.st_ino);
+    if (it != channels->end()) {
+      it->second.seen = true;
+      close(fd);
+      continue;
+    }
+
+    const size_t size = st.st_size;
+    void *mem = nullptr;
+    if (size >= sizeof(MachnetChannelCtx_t) + sizeof(MachnetChannelStats_t)) {
+      mem = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+      if (mem == MAP_FAILED) mem = nullptr;
+    }
+    close(fd);
+
+    MappedChannel channel;
+    channel.seen = true;
+    const auto *ctx = static_cast<const MachnetChannelCtx_t *>(mem);
+    if (ctx != nullptr && ctx->magic == MACHNET_CHANNEL_CTX_MAGIC &&
+        ctx->version == MACHNET_CHANNEL_VERSION) {
+      channel.ctx = ctx;
+      channel.size = size;
+    } else if (ctx != nullptr) {
+      if (ctx->magic == MACHNET_CHANNEL_CTX_MAGIC) {
+        LOG(WARNING) << "Skipping channel " << ctx->name << " of version "
+                     << ctx->version << " (expected "
+                     << MACHNET_CHANNEL_VERSION << ")";
+      }
+      // The channel might still be initializing; look at it again later.
+      const bool retry = ctx->magic == 0;
+      munmap(mem, size);
+      if (retry) continue;
+    }
+    channels->emplace(st.st_ino, channel);
+  }
+  closedir(dir);
+
+  for (auto it = channels->begin(); it != channels->end();) {
+    if (it->second.seen) {
+      ++it;
+      continue;
+    }
+    if (it->second.ctx != nullptr) {
+      munmap(const_cast<MachnetChannelCtx_t *>(it->second.ctx),
+             it->second.size);
+    }
+    it = channels->erase(it);
+  }
+  return true;
+}
+
+std::string FormatChannel(const MappedChannel &channel,
+                          const MachnetChannelEngineStats_t &cur,
+                          double secs) {
+  const auto &prev = channel.prev;
+  auto rate = [&](uint64_t MachnetChannelEngineStats_t::*counter) {
+    return (cur.*counter - prev.*counter) / secs;
+  };
+  auto mbps = [&](uint64_t MachnetChannelEngineStats_t::*counter) {
+    return rate(counter) * 8 / 1e6;
+  };
+
+  std::string s = Format(
+      "%-24.24s %10.0f %9.1f %10.0f %9.1f %8.0f %8.0f %5u/%-5u %5u/%-5u "
+      "%7u/%-7u\n",
+      channel.ctx->name, rate(&MachnetChannelEngineStats_t::rx_msgs),
+      mbps(&MachnetChannelEngineStats_t::rx_bytes),
+      rate(&MachnetChannelEngineStats_t::tx_msgs),
+      mbps(&MachnetChannelEngineStats_t::tx_bytes),
+      rate(&MachnetChannelEngineStats_t::fast_rexmits) +
+          rate(&MachnetChannelEngineStats_t::rto_rexmits),
+      rate(&MachnetChannelEngineStats_t::rx_drops_nobuf) +
+          rate(&MachnetChannelEngineStats_t::rx_drops_window) +
+          rate(&MachnetChannelEngineStats_t::rx_drops_dup) +
+          rate(&MachnetChannelEngineStats_t::rx_drops_invalid) +
+          rate(&MachnetChannelEngineStats_t::tx_drops_noflow) +
+          rate(&MachnetChannelEngineStats_t::tx_completion_drops),
+      cur.machnet_ring_pending, cur.machnet_ring_size, cur.app_ring_pending,
+      cur.app_ring_size, cur.buf_free, cur.buf_total);
+
+  // Break the drops and retransmissions down, if there are any.
+  const std::pair<const char *, uint64_t MachnetChannelEngineStats_t::*>
+      details[] = {
+          {"fast_rexmits", &MachnetChannelEngineStats_t::fast_rexmits},
+          {"rto_rexmits", &MachnetChannelEngineStats_t::rto_rexmits},
+          {"rx_drops_nobuf", &MachnetChannelEngineStats_t::rx_drops_nobuf},
+          {"rx_drops_window", &MachnetChannelEngineStats_t::rx_drops_window},
+          {"rx_drops_dup", &MachnetChannelEngineStats_t::rx_drops_dup},
+          {"rx_drops_invalid", &MachnetChannelEngineStats_t::rx_drops_invalid},
+          {"tx_drops_noflow", &MachnetChannelEngineStats_t::tx_drops_noflow},
+          {"tx_completion_drops",
+           &MachnetChannelEngineStats_t::tx_completion_drops},
+      };
+  std::string detail;
+  for (const auto &[name, counter] : details) {
+    if (cur.*counter == prev.*counter) continue;
+    detail += Format(" %s: %.0f/s", name, rate(counter));
+  }
+  if (!detail.empty()) s += "    " + detail + "\n";
+
+  using Flow = juggler::net::flow::Flow;
+  const auto flow_nr =
+      std::min<uint32_t>(cur.flow_nr, MACHNET_CHANNEL_STATS_FLOW_MAX);
+  for (uint32_t i = 0; i < flow_nr; i++) {
+    const auto &flow = cur.flows[i];
+    const auto state = static_cast<Flow::State>(flow.state);
+    s += Format(
+        "    %s:%hu -> %s:%hu [%s] cwnd: %u, inflight: %u, pending: %u, "
+        "srtt: %u us, min_rtt: %u us\n",
+        juggler::net::Ipv4::Address(flow.flow.src_ip).ToString().c_str(),
+        flow.flow.src_port,
+        juggler::net::Ipv4::Address(flow.flow.dst_ip).ToString().c_str(),
+        flow.flow.dst_port,
+        state <= Flow::State::kEstablished ? Flow::StateToString(state) : "?",
+        flow.cwnd, flow.inflight, flow.pending_segments, flow.srtt_us,
+        flow.min_rtt_us);
+  }
+  if (cur.flow_nr > flow_nr)
+    s += Format("    (%u more flows)\n", cur.flow_nr - flow_nr);
+  return s;
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  google::InitGoogleLogging(argv[0]);
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+  FLAGS_logtostderr = 1;
+
+  juggler::net::UDSocket socket;
+  if (!socket.Connect(FLAGS_socket)) {
+    LOG(ERROR) << "Cannot connect to the Machnet controller at "
+               << FLAGS_socket;
+    return EXIT_FAILURE;
+  }
+
+  pid_t pid = FLAGS_pid;
+  if (pid == 0) {
+    struct ucred cred;
+    socklen_t len = sizeof(cred);
+    if (getsockopt(socket.GetFd(), SOL_SOCKET, SO_PEERCRED, &cred, &len) !=
+        0) {
+      PLOG(ERROR) << "Cannot find the PID of the Machnet process";
+      return EXIT_FAILURE;
+    }
+    pid = cred.pid;
+  }
+
+  const bool is_tty = isatty(STDOUT_FILENO);
+  ChannelMap channels;
+  std::map<std::string, uint64_t> xstats, prev_xstats;
+  auto last = std::chrono::steady_clock::now();
+  for (uint32_t i = 0; FLAGS_iterations == 0 || i <= FLAGS_iterations; i++) {
+    if (!ScanChannels(pid, &channels)) return EXIT_FAILURE;
+    if (!GetPortStats(&socket, &xstats)) {
+      LOG(ERROR) << "Failed to get the port statistics.";
+      return EXIT_FAILURE;
+    }
+    const auto now = std::chrono::steady_clock::now();
+    const double secs = std::chrono::duration<double>(now - last).count();
+    last = now;
+
+    // The first round only takes the samples to compute rates against.
+    std::string s;
+    if (i > 0) {
+      if (is_tty) s += "\033[H\033[2J";
+      s += Format("Machnet (pid %d), %.2f s interval\n\n", pid, secs);
+      s += Format("%-8s %-40s %14s %20s\n", "PORT", "COUNTER", "RATE/s",
+                  "TOTAL");
+      for (const auto &[key, value] : xstats) {
+        const auto it = prev_xstats.find(key);
+        if (it == prev_xstats.end() || it->second == value) continue;
+        if (key.find(FLAGS_xstats_filter) == std::string::npos) continue;
+        const auto sep = key.find('/');
+        s += Format("%-8s %-40s %14.0f %20lu\n", key.substr(0, sep).c_str(),
+                    key.substr(sep + 1).c_str(), (value - it->second) / secs,
+                    value);
+      }
+
+      s += Format("\n%-24s %10s %9s %10s %9s %8s %8s %11s %11s %15s\n",
+                  "CHANNEL", "RX msg/s", "RX Mbps", "TX msg/s", "TX Mbps",
+                  "rexmit/s", "drops/s", "M->A ring", "A->M ring", "bufs free");
+    }
+    for (auto &[_, channel] : channels) {
+      if (channel.ctx == nullptr) continue;
+      MachnetChannelEngineStats_t cur;
+      __machnet_channel_engine_stats_read(channel.ctx, &cur);
+      if (i > 0 && channel.has_prev) s += FormatChannel(channel, cur, secs);
+      channel.prev = cur;
+      channel.has_prev = true;
+    }
+    prev_xstats.swap(xstats);
+    fputs(s.c_str(), stdout);
+    fflush(stdout);
+
+    if (FLAGS_iterations == 0 || i < FLAGS_iterations) {
+      std::this_thread::sleep_for(
+          std::chrono::milliseconds(FLAGS_interval_ms));
+    }
+  }
+
+  for (auto &[_, channel] : channels) {
+    if (channel.ctx == nullptr) continue;
+    munmap(const_cast<MachnetChannelCtx_t *>(channel.ctx), channel.size);
+  }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,253 @@
+/**
+ * @file main.cc
+ * @brief Controls the transport event tracing of a running Machnet instance
+ * (see `Tracer'): sets the classes of events the engines record, dumps their
+ * trace rings to a file, and decodes dumps, offline, into per-flow timelines.
+ *
+ * Examples:
+ *   machnet_trace --classes=rexmit,state   # Start tracing.
+ *   machnet_trace --dump=/tmp/trace.bin    # Fetch the rings.
+ *   machnet_trace --classes= --dump=/tmp/trace.bin  # Stop, then fetch.
+ *   machnet_trace --decode=/tmp/trace.bin  # Print the timelines.
+ */
+#include <flow.h>
+#include <flow_key.h>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <machnet_ctrl.h>
+#include <sys/socket.h>
+#include <trace.h>
+#include <ud_socket.h>
+#include <utils.h>
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <string>
+#include <vector>
+
+DEFINE_string(socket, MACHNET_CONTROLLER_DEFAULT_PATH,
+              "Path of the Machnet controller socket.");
+DEFINE_string(classes, "",
+              "Comma-separated classes of events to trace (rexmit, state, "
+              "rx_error, congestion, ack, all); empty to stop tracing. Only "
+              "applied if given.");
+DEFINE_string(dump, "", "File to dump the trace rings of the engines to.");
+DEFINE_string(decode, "", "Dump file to decode into per-flow timelines.");
+DEFINE_int64(flow, -1, "Only decode the events of this flow id.");
+
+namespace {
+
+using juggler::TraceDumpHeader;
+using juggler::TraceEvent;
+using juggler::TraceEventType;
+using juggler::utils::Format;
+using Flow = juggler::net::flow::Flow;
+
+/**
+ * @brief Sends a trace request to the controller.
+ *
+ * @param flags MACHNET_TRACE_SET_CLASSES and/or MACHNET_TRACE_DUMP.
+ * @param classes Classes to enable, if setting them.
+ * @param dump Pointer to store the dump to, if requested.
+ * @return True on success.
+ */
+bool RequestTrace(uint32_t flags, uint32_t classes, std::string *dump) {
+  juggler::net::UDSocket socket;
+  if (!socket.Connect(FLAGS_socket)) {
+    LOG(ERROR) << "Cannot connect to the Machnet controller at "
+               << FLAGS_socket;
+    return false;
+  }
+
+  machnet_ctrl_msg_t req = {};
+  req.type = MACHNET_CTRL_MSG_TYPE_REQ_TRACE;
+  req.msg_id = 0;
+  req.trace_info.flags = flags;
+  req.trace_info.classes = classes;
+  if (!socket.SendMsg(reinterpret_cast<char *>(&req), sizeof(req))) {
+    return false;
+  }
+
+  // The response message is followed by the dump, if any.
+  machnet_ctrl_msg_t resp;
+  if (!socket.RecvAll(reinterpret_cast<char *>(&resp), sizeof(resp))) {
+    LOG(ERROR) << "Failed to receive the response.";
+    return false;
+  }
+  if (resp.type != MACHNET_CTRL_MSG_TYPE_RESPONSE ||
+      resp.status != MACHNET_CTRL_STATUS_SUCCESS) {
+    LOG(ERROR) << "Trace request failed.";
+    return false;
+  }
+
+  dump->assign(resp.status_info.length, '\0');
+  if (!socket.RecvAll(dump->data(), dump->size())) {
+    LOG(ERROR) << "Failed to receive the trace dump.";
+    return false;
+  }
+  return true;
+}
+
+const char *StateName(uint32_t state) {
+  if (state > static_cast<uint32_t>(Flow::State::kEstablished)) return "?";
+  return Flow::StateToString(static_cast<Flow::State>(state));
+}
+
+std::string EventDetails(const TraceEvent &event) {
+  switch (static_cast<TraceEventType>(event.type)) {
+    case TraceEventType::kStateChange:
+      return Format("%s -> %s", StateName(event.arg0), StateName(event.arg1));
+    case TraceEventType::kRtoRexmit:
+      return Format("consecutive: %u", event.arg0);
+    case TraceEventType::kBadMagic:
+      return Format("magic: 0x%x", event.arg0);
+    case TraceEventType::kUnexpected:
+      return Format("flags: 0x%x, state: %s", event.arg0,
+                    StateName(event.arg1));
+    case TraceEventType::kInvalidAck:
+      return Format("snd_nxt: %u", event.arg0);
+    case TraceEventType::kTxPause:
+      return Format("pending: %u", event.arg0);
+    case TraceEventType::kDupAck:
+      return Format("duplicate_acks: %u", event.arg0);
+    case TraceEventType::kRttSample:
+      return Format("rtt_us: %u, srtt_us: %u", event.arg0, event.arg1);
+    default:
+      return "";
+  }
+}
+
+/**
+ * @brief Prints the events of an engine, grouped by flow, with timestamps
+ * relative to the oldest event of the engine.
+ */
+void PrintTimelines(const TraceDumpHeader &header, const TraceEvent *events) {
+  const auto lost = header.recorded - header.event_nr;
+  std::cout << Format(
+      "[Engine %hu] classes: 0x%x, events: %u, recorded: %lu, lost: %lu\n",
+      header.engine, header.classes, header.event_nr, header.recorded, lost);
+  if (header.event_nr == 0) return;
+
+  std::map<uint32_t, std::vector<const TraceEvent *>> flows;
+  std::map<uint32_t, std::string> labels;
+  for (uint32_t i = 0; i < header.event_nr; i++) {
+    const auto &event = events[i];
+    if (FLAGS_flow >= 0 && event.flow_id != static_cast<uint64_t>(FLAGS_flow))
+      continue;
+    flows[event.flow_id].push_back(&event);
+    if (static_cast<TraceEventType>(event.type) ==
+        TraceEventType::kFlowCreate) {
+      const juggler::net::flow::Key key(event.arg0, event.arg2 >> 16,
+                                        event.arg1, event.arg2 & 0xffff);
+      labels[event.flow_id] = key.ToString();
+    }
+  }
+
+  const auto start = events[0].tsc;
+  for (const auto &[flow_id, flow_events] : flows) {
+    const auto label = labels.find(flow_id);
+    std::cout << Format("\tFlow %u %s\n", flow_id,
+                        label != labels.end() ? label->second.c_str()
+                                              : "(created before the trace)");
+    for (const auto *event : flow_events) {
+      const double us = header.tsc_hz != 0 ? (event->tsc - start) * 1E6 /
+                                                 header.tsc_hz
+                                           : 0;
+      const auto type = static_cast<TraceEventType>(event->type);
+      std::cout << Format("\t\t%14.3f us  %-12s seqno: %u, cwnd: %hu", us,
+                          juggler::TraceEventTypeToString(type), event->seqno,
+                          event->cwnd);
+      const auto details = EventDetails(*event);
+      if (!details.empty()) std::cout << ", " << details;
+      std::cout << "\n";
+    }
+  }
+}
+
+bool Decode(const std::string &path) {
+  std::ifstream file(path, std::ios::binary);
+  if (!file) {
+    LOG(ERROR) << "Cannot open " << path;
+    return false;
+  }
+  const std::string dump((std::istreambuf_iterator<char>(file)),
+                         std::istreambuf_iterator<char>());
+
+  size_t offset = 0;
+  while (offset < dump.size()) {
+    TraceDumpHeader header;
+    if (dump.size() - offset < sizeof(header)) {
+      LOG(ERROR) << "Truncated dump at offset " << offset;
+      return false;
+    }
+    std::memcpy(&header, dump.data() + offset, sizeof(header));
+    offset += sizeof(header);
+    if (header.magic != TraceDumpHeader::kMagic ||
+        header.version != TraceDumpHeader::kVersion) {
+      LOG(ERROR) << "Not a Machnet trace dump, or of another version.";
+      return false;
+    }
+    const size_t events_size =
+        static_cast<size_t>(header.event_nr) * sizeof(TraceEvent);
+    if (dump.size() - offset < events_size) {
+      LOG(ERROR) << "Truncated dump at offset " << offset;
+      return false;
+    }
+    std::vector<TraceEvent> events(header.event_nr);
+    std::memcpy(events.data(), dump.data() + offset, events_size);
+    offset += events_size;
+    PrintTimelines(header, events.data());
+  }
+  return true;
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  google::InitGoogleLogging(argv[0]);
+  gflags::SetUsageMessage(
+      "[--classes=<classes>] [--dump=<file>] | --decode=<file>");
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+  FLAGS_logtostderr = 1;
+
+  if (!FLAGS_decode.empty()) {
+    return Decode(FLAGS_decode) ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+
+  // An empty list of classes is meaningful (it stops tracing); only apply the
+  // classes if they were given.
+  uint32_t flags = 0;
+  uint32_t classes = 0;
+  if (!gflags::GetCommandLineFlagInfoOrDie("classes").is_default) {
+    const auto parsed = juggler::TraceClassesFromString(FLAGS_classes);
+    if (!parsed.has_value()) {
+      LOG(ERROR) << "Invalid trace classes: " << FLAGS_classes;
+      return EXIT_FAILURE;
+    }
+    flags |= MACHNET_TRACE_SET_CLASSES;
+    classes = parsed.value();
+  }
+  if (!FLAGS_dump.empty()) flags |= MACHNET_TRACE_DUMP;
+  if (flags == 0) {
+    gflags::ShowUsageWithFlagsRestrict(argv[0], "machnet_trace");
+    return EXIT_FAILURE;
+  }
+
+  std::string dump;
+  if (!RequestTrace(flags, classes, &dump)) return EXIT_FAILURE;
+  if (flags & MACHNET_TRACE_DUMP) {
+    std::ofstream file(FLAGS_dump, std::ios::binary);
+    file.write(dump.data(), dump.size());
+    if (!file) {
+      LOG(ERROR) << "Failed to write " << FLAGS_dump;
+      return EXIT_FAILURE;
+    }
+    std::cout << "Wrote " << dump.size() << " bytes to " << FLAGS_dump
+              << "\n";
+  }
+  return EXIT_SUCCESS;
+}
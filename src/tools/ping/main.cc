@@ -306,6 +306,7 @@ void icmp_rx(void *context) {
       const auto *arph = packet->head_data<juggler::net::Arp *>(
           sizeof(juggler::net::Ethernet));
       ctx->arp_handler.ProcessArpPacket(ctx->tx_ring, arph);
+      ctx->tx_ring->FlushStaged();
       continue;
     }
 
@@ -379,6 +380,7 @@ std::optional<juggler::net::Ethernet::Address> ArpResolveBusyWait(
   juggler::ArpHandler arp_handler(local_mac, {local_ip});
 
   arp_handler.GetL2Addr(tx_ring, local_ip, remote_ip);
+  tx_ring->FlushStaged();
   auto start = std::chrono::steady_clock::now();
   while (true) {
     auto now = std::chrono::steady_clock::now();
@@ -404,6 +406,7 @@ std::optional<juggler::net::Ethernet::Address> ArpResolveBusyWait(
           sizeof(juggler::net::Ethernet));
       arp_handler.ProcessArpPacket(tx_ring, arph);
       auto remote_mac = arp_handler.GetL2Addr(tx_ring, local_ip, remote_ip);
+      tx_ring->FlushStaged();
       if (remote_mac.has_value()) {
         batch.Release();
         return remote_mac;
@@ -149,6 +149,7 @@ std::optional<juggler::net::Ethernet::Address> ArpResolveBusyWait(
   juggler::ArpHandler arp_handler(local_mac, {local_ip});
 
   arp_handler.GetL2Addr(tx_ring, local_ip, remote_ip);
+  tx_ring->FlushStaged();
   auto start = std::chrono::steady_clock::now();
   while (true) {
     auto now = std::chrono::steady_clock::now();
@@ -174,6 +175,7 @@ std::optional<juggler::net::Ethernet::Address> ArpResolveBusyWait(
           sizeof(juggler::net::Ethernet));
       arp_handler.ProcessArpPacket(tx_ring, arph);
       auto remote_mac = arp_handler.GetL2Addr(tx_ring, local_ip, remote_ip);
+      tx_ring->FlushStaged();
       if (remote_mac.has_value()) {
         batch.Release();
         return remote_mac;
@@ -512,6 +514,7 @@ void bounce(void *context) {
       const auto *arph = packet->head_data<juggler::net::Arp *>(
           sizeof(juggler::net::Ethernet));
       ctx->arp_handler.ProcessArpPacket(tx, arph);
+      tx->FlushStaged();
       // We are going to drop this packet, so we need to explicitly reclaim the
       // mbuf now.
       juggler::dpdk::Packet::Free(packet);